@@ -3,13 +3,30 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <round.h>
+#include <kernel/histogram.h>
 #include "devices/timer.h"
+#include "threads/counter.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#include "filesys/journal.h"
+#endif
+#ifdef VM
+#include "vm/swap.h"
+#endif
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  It also drives
+   virtio block devices, which stand in for ATA disks that are not
+   there; see "Virtio block devices" below. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -32,6 +49,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,31 +65,131 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* PCI bus-master IDE registers, at an I/O base taken from the
+   controller's BAR4, 8 bytes per channel. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_START 0x01           /* Start transfer. */
+#define BM_READ 0x08            /* Transfer direction: 1=to memory. */
+
+/* Bus-master Status Register bits.  INTR and ERR clear when 1 is
+   written to them. */
+#define BM_ACTIVE 0x01          /* Transfer in progress. */
+#define BM_ERR 0x02             /* Transfer failed. */
+#define BM_INTR 0x04            /* Device raised its interrupt. */
+
+/* A Physical Region Descriptor: one physically contiguous piece
+   of a DMA transfer's buffer.  A piece may not cross a 64 kB
+   boundary, so we never let one cross a page. */
+struct prd {
+	uint32_t addr;              /* Physical address, even. */
+	uint16_t size;              /* Size in bytes, 0 means 64 kB. */
+	uint16_t flags;             /* PRD_EOT on the last entry. */
+};
+#define PRD_EOT 0x8000          /* End of table. */
 
-/* An ATA device. */
+/* An ATA device, or a virtio block device. */
 struct disk {
 	char name[8];               /* Name, e.g. "hd0:1". */
 	struct channel *channel;    /* Channel disk is on. */
 	int dev_no;                 /* Device 0 or 1 for master or slave. */
+	int slot;                   /* Place in disk_get()'s numbering, 0...3
+	                               for hd0:0...hd1:1. */
 
 	bool is_ata;                /* 1=This device is an ATA disk. */
-	disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
+	disk_sector_t capacity;     /* Capacity in sectors (if is_ata, or a
+	                               virtio disk). */
+	size_t block_sectors;       /* Sectors per interrupt in multiple
+								   mode, or 0 if not in multiple mode. */
 
 	long long read_cnt;         /* Number of sectors read. */
 	long long write_cnt;        /* Number of sectors written. */
+	long long read_cmds;        /* Number of read commands. */
+	long long write_cmds;       /* Number of write commands. */
+
+	/* Updated by the channel's dispatcher only. */
+	struct histogram read_latency;  /* Cycles from submit to completion. */
+	struct histogram write_latency;
+	struct histogram seek;      /* Sectors between commands. */
+	disk_sector_t last_end;     /* Sector after the last command's. */
+	long long seq_cmds;         /* Commands near the last one. */
+	long long random_cmds;      /* Commands farther away. */
+
+	/* Under the channel's lock. */
+	int queued;                 /* Requests waiting in the queue. */
+	int queued_max;             /* Most ever waiting. */
+	long long queued_sum;       /* Sum of QUEUED at each submit. */
+	long long submits;          /* Requests submitted. */
+	long long boosts;           /* Queued writes raised by a waiter. */
+	long long priority_cmds;    /* Commands served out of C-SCAN order
+	                               for priority. */
+};
+
+/* A command that starts at most this many sectors from where the
+   disk's previous one ended counts as sequential. */
+#define SEQ_DISTANCE 8
+
+/* A waiting request gains one priority level per this many timer
+   ticks, so that a stream of high-priority requests cannot starve
+   the others. */
+#define DISK_AGE_TICKS 5
+
+/* A read or write waiting in its channel's queue. */
+struct disk_request {
+	struct list_elem elem;      /* Element in channel's queue or run. */
+	struct disk *disk;          /* Disk to transfer to or from. */
+	disk_sector_t sec_no;       /* First sector. */
+	size_t cnt;                 /* Number of sectors. */
+	uint8_t *buffer;            /* CNT * DISK_SECTOR_SIZE bytes. */
+	bool read;                  /* Read into BUFFER, or write from it? */
+	int priority;               /* Submitter's priority, or more if
+	                               boosted.  Under the channel's lock. */
+	int64_t queued;             /* Timer tick when submitted. */
+	uint64_t start;             /* TSC when submitted. */
+	struct completion done;     /* Completed once transferred. */
 };
 
 /* An ATA channel (aka controller).
-   Each channel can control up to two disks. */
+   Each channel can control up to two disks.
+
+   Callers queue requests and sleep; the channel's dispatcher
+   thread alone drives the controller.  It serves the queue in
+   C-SCAN order, sweeping up from the last sector it served and
+   then starting over from the lowest, and merges requests that
+   continue one another into one command.  Each request carries
+   its submitter's priority, and a command starts only at one of
+   the requests of the highest priority, counting what they have
+   gained by waiting (see DISK_AGE_TICKS); the sweep orders those.
+   A thread that waits for writes it did not submit, such as
+   fsync(), raises theirs with disk_boost_writes(). */
 struct channel {
 	char name[8];               /* Name, e.g. "hd0". */
 	uint16_t reg_base;          /* Base I/O port. */
 	uint8_t irq;                /* Interrupt in use. */
 
-	struct lock lock;           /* Must acquire to access the controller. */
+	struct lock lock;           /* Protects QUEUE and HEAD. */
+	struct condition pending;   /* Signaled when QUEUE gains a request. */
+	struct list queue;          /* Requests, in request_less() order. */
+	uint64_t head;              /* request_key() of where the last run
+								   ended. */
 	bool expecting_interrupt;   /* True if an interrupt is expected, false if
 								   any interrupt would be spurious. */
-	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+	struct completion done;     /* Completed by interrupt handler. */
+
+	uint16_t bm_base;           /* Bus-master registers, or 0 for PIO only. */
+	struct prd *prdt;           /* PRD table, one page, if bm_base != 0. */
+	struct virtq *vq;           /* Virtqueue, for a virtio block device
+	                               (REG_BASE is then its I/O BAR and
+	                               only device 0 is used), else null. */
 
 	struct disk devices[2];     /* The devices on this channel. */
 };
@@ -80,14 +198,48 @@ struct channel {
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* Virtio block devices, one per channel, up to one for each place
+   in disk_get()'s numbering but the boot disk's. */
+#define VIRTIO_CNT 3
+static struct channel virtio_channels[VIRTIO_CNT];
+static size_t virtio_cnt;
+
+/* What disk_get() returns, by channel and device number. */
+static struct disk *disks[CHANNEL_CNT][2];
+
+static void init_channel (struct channel *);
+static void init_disk (struct disk *, struct channel *, int dev_no,
+		int slot);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
+static void register_counters (struct disk *);
+static void set_multiple_mode (struct disk *, size_t block_sectors);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sectors (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
+static uint16_t find_bus_master (void);
+static void find_virtio_disks (void);
+
+static int disk_index (const struct disk *);
+static void submit (struct disk *, disk_sector_t, size_t cnt, void *buffer,
+		bool read);
+static int request_priority (const struct disk_request *, int64_t now);
+static bool request_less (const struct list_elem *, const struct list_elem *,
+		void *aux);
+static void take_run (struct channel *, struct list *run);
+static void dispatcher (void *channel);
+static size_t run_sectors (struct list *run);
+static void account_run (struct list *run);
+static void finish_run (struct list *run, uint64_t now);
+static bool dma_transfer (struct disk *, disk_sector_t, size_t cnt,
+		struct list *run, bool read);
+static void pio_transfer (struct disk *, disk_sector_t, size_t cnt,
+		struct list *run, bool read);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static void virtio_transfer (struct channel *, struct list runs[],
+		size_t run_cnt);
 
 static void wait_until_idle (const struct disk *);
 static bool wait_while_busy (const struct disk *);
@@ -95,10 +247,13 @@ static void select_device (const struct disk *);
 static void select_device_wait (const struct disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static void virtio_interrupt (struct intr_frame *);
+static void inspect_disk_stats (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) {
+	uint16_t bm_base = find_bus_master ();
 	size_t chan_no;
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -119,22 +274,16 @@ disk_init (void) {
 			default:
 				NOT_REACHED ();
 		}
-		lock_init (&c->lock);
-		c->expecting_interrupt = false;
-		sema_init (&c->completion_wait, 0);
+		init_channel (c);
+		if (bm_base != 0) {
+			c->prdt = palloc_get_page (0);
+			if (c->prdt != NULL)
+				c->bm_base = bm_base + chan_no * 8;
+		}
 
 		/* Initialize devices. */
-		for (dev_no = 0; dev_no < 2; dev_no++) {
-			struct disk *d = &c->devices[dev_no];
-			snprintf (d->name, sizeof d->name, "%s:%d", c->name, dev_no);
-			d->channel = c;
-			d->dev_no = dev_no;
-
-			d->is_ata = false;
-			d->capacity = 0;
-
-			d->read_cnt = d->write_cnt = 0;
-		}
+		for (dev_no = 0; dev_no < 2; dev_no++)
+			init_disk (&c->devices[dev_no], c, dev_no, chan_no * 2 + dev_no);
 
 		/* Register interrupt handler. */
 		intr_register_ext (c->irq, interrupt_handler, c->name);
@@ -148,14 +297,70 @@ disk_init (void) {
 
 		/* Read hard disk identity information. */
 		for (dev_no = 0; dev_no < 2; dev_no++)
-			if (c->devices[dev_no].is_ata)
+			if (c->devices[dev_no].is_ata) {
 				identify_ata_device (&c->devices[dev_no]);
+				register_counters (&c->devices[dev_no]);
+			}
+		for (dev_no = 0; dev_no < 2; dev_no++)
+			if (c->devices[dev_no].is_ata)
+				disks[chan_no][dev_no] = &c->devices[dev_no];
+		if (c->bm_base != 0)
+			printf ("%s: bus-master DMA at port %#x\n", c->name, c->bm_base);
+
+		if ((c->devices[0].is_ata || c->devices[1].is_ata)
+				&& thread_create (c->name, PRI_MAX, dispatcher, c) == TID_ERROR)
+			PANIC ("%s: cannot start dispatcher", c->name);
 	}
+	find_virtio_disks ();
+
+	intr_register_int (0x49, 3, INTR_OFF, inspect_disk_stats,
+			"Inspect Disk Statistics");
 
 	/* DO NOT MODIFY BELOW LINES. */
 	register_disk_inspect_intr ();
 }
 
+/* Initializes channel C's request queue, with no bus master or
+   virtqueue. */
+static void
+init_channel (struct channel *c) {
+	lock_init (&c->lock);
+	cond_init (&c->pending);
+	list_init (&c->queue);
+	c->head = 0;
+	c->expecting_interrupt = false;
+	completion_init (&c->done);
+	c->bm_base = 0;
+	c->prdt = NULL;
+	c->vq = NULL;
+}
+
+/* Initializes D as device DEV_NO on channel C, in place SLOT of
+   disk_get()'s numbering, with no capacity yet. */
+static void
+init_disk (struct disk *d, struct channel *c, int dev_no, int slot) {
+	ASSERT (slot >= 0 && slot < CHANNEL_CNT * 2);
+	snprintf (d->name, sizeof d->name, "hd%d:%d", (slot >> 1) & 1, slot & 1);
+	d->channel = c;
+	d->dev_no = dev_no;
+	d->slot = slot;
+
+	d->is_ata = false;
+	d->capacity = 0;
+	d->block_sectors = 0;
+
+	d->read_cnt = d->write_cnt = 0;
+	d->read_cmds = d->write_cmds = 0;
+	histogram_init (&d->read_latency);
+	histogram_init (&d->write_latency);
+	histogram_init (&d->seek);
+	d->last_end = 0;
+	d->seq_cmds = d->random_cmds = 0;
+	d->queued = d->queued_max = 0;
+	d->queued_sum = d->submits = 0;
+	d->boosts = d->priority_cmds = 0;
+}
+
 /* Prints disk statistics. */
 void
 disk_print_stats (void) {
@@ -166,11 +371,42 @@ disk_print_stats (void) {
 
 		for (dev_no = 0; dev_no < 2; dev_no++) {
 			struct disk *d = disk_get (chan_no, dev_no);
-			if (d != NULL && d->is_ata)
-				printf ("%s: %lld reads, %lld writes\n",
-						d->name, d->read_cnt, d->write_cnt);
+			char name[32];
+			long long depth;
+
+			if (d == NULL)
+				continue;
+			printf ("%s: %lld reads in %lld commands, "
+					"%lld writes in %lld commands\n",
+					d->name, d->read_cnt, d->read_cmds,
+					d->write_cnt, d->write_cmds);
+			if (d->submits == 0)
+				continue;
+			depth = d->queued_sum * 100 / d->submits;
+			printf ("%s: %lld bytes read, %lld bytes written, "
+					"%lld sequential and %lld random commands, "
+					"queue depth %lld.%02lld average, %d max\n",
+					d->name, d->read_cnt * DISK_SECTOR_SIZE,
+					d->write_cnt * DISK_SECTOR_SIZE, d->seq_cmds,
+					d->random_cmds, depth / 100, depth % 100, d->queued_max);
+			printf ("%s: %lld commands moved up for priority, "
+					"%lld writes boosted\n",
+					d->name, d->priority_cmds, d->boosts);
+			snprintf (name, sizeof name, "%s: read latency", d->name);
+			histogram_print (&d->read_latency, name, "cycles");
+			snprintf (name, sizeof name, "%s: write latency", d->name);
+			histogram_print (&d->write_latency, name, "cycles");
+			snprintf (name, sizeof name, "%s: seek distance", d->name);
+			histogram_print (&d->seek, name, "sectors");
 		}
 	}
+#ifdef FILESYS
+	cache_print_stats ();
+	journal_print_stats ();
+#endif
+#ifdef VM
+	swap_print_stats ();
+#endif
 }
 
 /* Returns the disk numbered DEV_NO--either 0 or 1 for master or
@@ -181,16 +417,15 @@ disk_print_stats (void) {
 0:1 - file system
 1:0 - scratch
 1:1 - swap
-*/
+
+   A virtio block device can take the place of any of these but
+   the boot disk, if it has no ATA disk; see find_virtio_disks(). */
 struct disk *
 disk_get (int chan_no, int dev_no) {
 	ASSERT (dev_no == 0 || dev_no == 1);
 
-	if (chan_no < (int) CHANNEL_CNT) {
-		struct disk *d = &channels[chan_no].devices[dev_no];
-		if (d->is_ata)
-			return d;
-	}
+	if (chan_no < (int) CHANNEL_CNT)
+		return disks[chan_no][dev_no];
 	return NULL;
 }
 
@@ -209,21 +444,19 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
-	struct channel *c;
-
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	disk_read_multiple (d, sec_no, 1, buffer);
+}
 
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * DISK_SECTOR_SIZE bytes,
+   with a single command.  CNT must be between 1 and
+   DISK_MULTIPLE_MAX.  The command setup and device selection are
+   paid once for the whole run, and the channel may fold
+   neighboring requests into the same command. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer) {
+	submit (d, sec_no, cnt, buffer, true);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,23 +466,281 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
+	disk_write_multiple (d, sec_no, 1, buffer);
+}
+
+/* Writes the CNT sectors starting at SEC_NO on disk D from
+   BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes, with a
+   single command, as disk_read_multiple(). */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer) {
+	submit (d, sec_no, cnt, (void *) buffer, false);
+}
+
+/* Returns D's number for tracing: 0 through 3 for hd0:0 through
+   hd1:1. */
+static int
+disk_index (const struct disk *d) {
+	return d->slot;
+}
+
+/* Request queue. */
+
+/* Queues a transfer of the CNT sectors starting at SEC_NO between
+   disk D and BUFFER and waits until it is done. */
+static void
+submit (struct disk *d, disk_sector_t sec_no, size_t cnt, void *buffer,
+		bool read) {
 	struct channel *c;
+	struct disk_request r;
 
 	ASSERT (d != NULL);
 	ASSERT (buffer != NULL);
+	ASSERT (cnt > 0 && cnt <= DISK_MULTIPLE_MAX);
+	ASSERT (sec_no + cnt <= d->capacity);
 
 	c = d->channel;
+	r.disk = d;
+	r.sec_no = sec_no;
+	r.cnt = cnt;
+	r.buffer = buffer;
+	r.read = read;
+	r.priority = thread_get_priority ();
+	r.queued = timer_ticks ();
+	r.start = rdtsc ();
+	completion_init (&r.done);
+	trace (read ? TRACE_DISK_READ : TRACE_DISK_WRITE, disk_index (d),
+			sec_no, cnt);
+
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
+	list_insert_ordered (&c->queue, &r.elem, request_less, NULL);
+	d->queued++;
+	if (d->queued > d->queued_max)
+		d->queued_max = d->queued;
+	d->queued_sum += d->queued;
+	d->submits++;
+	cond_signal (&c->pending, &c->lock);
 	lock_release (&c->lock);
+	wait_for_completion (&r.done);
 }
-
+
+/* Raises the priority of every write queued for disk D to at
+   least PRIORITY, for a caller about to wait for writes submitted
+   by other threads. */
+void
+disk_boost_writes (struct disk *d, int priority) {
+	struct channel *c;
+	struct list_elem *e;
+
+	ASSERT (d != NULL);
+
+	c = d->channel;
+	lock_acquire (&c->lock);
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+		if (r->disk == d && !r->read && r->priority < priority) {
+			r->priority = priority;
+			d->boosts++;
+		}
+	}
+	lock_release (&c->lock);
+}
+
+/* Returns request R's priority at timer tick NOW, with what it has
+   gained by waiting. */
+static int
+request_priority (const struct disk_request *r, int64_t now) {
+	return r->priority + (now - r->queued) / DISK_AGE_TICKS;
+}
+
+/* Returns where request R starts, ordering the channel's master
+   before its slave. */
+static uint64_t
+request_key (const struct disk_request *r) {
+	return ((uint64_t) r->disk->dev_no << 32) | r->sec_no;
+}
+
+/* Orders requests by request_key().  Requests that start at the
+   same sector stay in the order they were queued. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct disk_request *a = list_entry (a_, struct disk_request, elem);
+	const struct disk_request *b = list_entry (b_, struct disk_request, elem);
+
+	return request_key (a) < request_key (b);
+}
+
+/* Moves the next run of requests in C-SCAN order from C's queue
+   to RUN: among the requests of the highest priority, the first
+   at or past C's head, or the lowest one once the sweep passes
+   the last, and the requests of any priority that continue it in
+   the same direction, up to DISK_MULTIPLE_MAX sectors in all.  C's
+   queue must not be empty.  Must hold C's lock. */
+static void
+take_run (struct channel *c, struct list *run) {
+	int64_t now = timer_ticks ();
+	struct disk_request *first, *r;
+	struct list_elem *e, *scan = NULL, *lowest = NULL;
+	int top = PRI_MIN;
+	uint64_t end;
+	size_t cnt;
+
+	ASSERT (lock_held_by_current_thread (&c->lock));
+	ASSERT (!list_empty (&c->queue));
+
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		int priority = request_priority (list_entry (e, struct disk_request,
+					elem), now);
+
+		if (priority > top)
+			top = priority;
+	}
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		r = list_entry (e, struct disk_request, elem);
+		if (scan == NULL && request_key (r) >= c->head)
+			scan = e;
+		if (request_priority (r, now) < top)
+			continue;
+		if (lowest == NULL)
+			lowest = e;
+		if (request_key (r) >= c->head)
+			break;
+	}
+	if (scan == NULL)
+		scan = list_begin (&c->queue);
+	if (e == list_end (&c->queue))
+		e = lowest;
+
+	first = list_entry (e, struct disk_request, elem);
+	if (e != scan)
+		first->disk->priority_cmds++;
+	cnt = 0;
+	end = request_key (first);
+	while (e != list_end (&c->queue)) {
+		r = list_entry (e, struct disk_request, elem);
+		if (r->disk != first->disk || r->read != first->read
+				|| request_key (r) != end || cnt + r->cnt > DISK_MULTIPLE_MAX)
+			break;
+		e = list_remove (e);
+		list_push_back (run, &r->elem);
+		r->disk->queued--;
+		cnt += r->cnt;
+		end += r->cnt;
+	}
+	c->head = end;
+}
+
+/* Most runs a virtio device's dispatcher puts in flight at
+   once. */
+#define VIRTIO_BATCH 16
+
+/* Serves the requests queued on CHANNEL, one run per command, and
+   wakes their submitters.  An ATA channel runs one command at a
+   time; a virtio device is given up to VIRTIO_BATCH of them
+   together. */
+static void
+dispatcher (void *channel) {
+	struct channel *c = channel;
+
+	/* Stay on the bootstrap processor, which takes the disk
+	   interrupts that wake us. */
+	thread_set_affinity (thread_current (), 1u << 0);
+
+	for (;;) {
+		struct list runs[VIRTIO_BATCH];
+		size_t run_cnt = 0, max = c->vq != NULL ? VIRTIO_BATCH : 1;
+		size_t i;
+		uint64_t now;
+
+		lock_acquire (&c->lock);
+		while (list_empty (&c->queue))
+			cond_wait (&c->pending, &c->lock);
+		while (run_cnt < max && !list_empty (&c->queue)) {
+			list_init (&runs[run_cnt]);
+			take_run (c, &runs[run_cnt++]);
+		}
+		lock_release (&c->lock);
+
+		for (i = 0; i < run_cnt; i++)
+			account_run (&runs[i]);
+		if (c->vq != NULL)
+			virtio_transfer (c, runs, run_cnt);
+		else {
+			struct disk_request *first = list_entry (list_front (&runs[0]),
+					struct disk_request, elem);
+			struct disk *d = first->disk;
+			size_t cnt = run_sectors (&runs[0]);
+
+			if (!dma_transfer (d, first->sec_no, cnt, &runs[0], first->read))
+				pio_transfer (d, first->sec_no, cnt, &runs[0], first->read);
+		}
+		now = rdtsc ();
+		for (i = 0; i < run_cnt; i++)
+			finish_run (&runs[i], now);
+	}
+}
+
+/* Returns the sectors in RUN. */
+static size_t
+run_sectors (struct list *run) {
+	size_t cnt = 0;
+
+	for (struct list_elem *e = list_begin (run); e != list_end (run);
+			e = list_next (e))
+		cnt += list_entry (e, struct disk_request, elem)->cnt;
+	return cnt;
+}
+
+/* Counts RUN, about to be transferred, in its disk's statistics,
+   and leaves the disk's LAST_END just past it. */
+static void
+account_run (struct list *run) {
+	struct disk_request *first = list_entry (list_front (run),
+			struct disk_request, elem);
+	struct disk *d = first->disk;
+	size_t cnt = run_sectors (run);
+	disk_sector_t distance;
+
+	distance = first->sec_no > d->last_end ? first->sec_no - d->last_end
+		: d->last_end - first->sec_no;
+	histogram_add (&d->seek, distance);
+	if (distance <= SEQ_DISTANCE)
+		d->seq_cmds++;
+	else
+		d->random_cmds++;
+	d->last_end = first->sec_no + cnt;
+
+	if (first->read) {
+		d->read_cnt += cnt;
+		d->read_cmds++;
+	} else {
+		d->write_cnt += cnt;
+		d->write_cmds++;
+	}
+}
+
+/* Wakes the submitters of the requests in RUN, which was
+   transferred by TSC time NOW. */
+static void
+finish_run (struct list *run, uint64_t now) {
+	while (!list_empty (run)) {
+		struct disk_request *r = list_entry (list_pop_front (run),
+				struct disk_request, elem);
+		struct disk *d = r->disk;
+
+		histogram_add (r->read ? &d->read_latency : &d->write_latency,
+				now - r->start);
+		trace (TRACE_DISK_DONE, disk_index (d), r->sec_no, now - r->start);
+		complete (&r->done);
+	}
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -354,7 +845,7 @@ identify_ata_device (struct disk *d) {
 	   into our buffer. */
 	select_device_wait (d);
 	issue_pio_command (c, CMD_IDENTIFY_DEVICE);
-	sema_down (&c->completion_wait);
+	wait_for_completion (&c->done);
 	if (!wait_while_busy (d)) {
 		d->is_ata = false;
 		return;
@@ -364,6 +855,10 @@ identify_ata_device (struct disk *d) {
 	/* Calculate capacity. */
 	d->capacity = id[60] | ((uint32_t) id[61] << 16);
 
+	/* Move as many sectors per interrupt as the disk allows. */
+	if ((id[47] & 0xff) > 1)
+		set_multiple_mode (d, id[47] & 0xff);
+
 	/* Print identification message. */
 	printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
 	if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024 * 1024)
@@ -382,6 +877,34 @@ identify_ata_device (struct disk *d) {
 	printf ("\"\n");
 }
 
+/* Registers D's sector counts as counters "disk.NAME.reads" and
+   "disk.NAME.writes". */
+static void
+register_counters (struct disk *d) {
+	char name[COUNTER_NAME_MAX + 1];
+
+	snprintf (name, sizeof name, "disk.%s.reads", d->name);
+	counter_register_value (name, &d->read_cnt);
+	snprintf (name, sizeof name, "disk.%s.writes", d->name);
+	counter_register_value (name, &d->write_cnt);
+}
+
+/* Sends SET MULTIPLE MODE to disk D so that READ MULTIPLE and
+   WRITE MULTIPLE move BLOCK_SECTORS sectors per interrupt, and
+   records the setting if the disk accepts it. */
+static void
+set_multiple_mode (struct disk *d, size_t block_sectors) {
+	struct channel *c = d->channel;
+
+	select_device_wait (d);
+	outb (reg_nsect (c), block_sectors);
+	issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+	wait_for_completion (&c->done);
+	wait_while_busy (d);
+	if ((inb (reg_status (c)) & STA_ERR) == 0)
+		d->block_sectors = block_sectors;
+}
+
 /* Prints STRING, which consists of SIZE bytes in a funky format:
    each pair of bytes is in reverse order.  Does not print
    trailing whitespace and/or nulls. */
@@ -402,17 +925,17 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sectors (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (sec_no + cnt <= d->capacity);
+	ASSERT (sec_no + cnt <= (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt == DISK_MULTIPLE_MAX ? 0 : cnt);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
@@ -421,17 +944,198 @@ select_sector (struct disk *d, disk_sector_t sec_no) {
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Serves DMA commands too. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) {
-	/* Interrupts must be enabled or our semaphore will never be
-	   up'd by the completion handler. */
+	/* Interrupts must be enabled or our completion will never be
+	   signaled by the interrupt handler. */
 	ASSERT (intr_get_level () == INTR_ON);
 
 	c->expecting_interrupt = true;
 	outb (reg_command (c), command);
 }
 
+/* Bus-master DMA. */
+
+/* Reads the 32-bit PCI configuration register REG of bus 0
+   device DEV function FN. */
+static uint32_t
+pci_read_config (int dev, int fn, int reg) {
+	outl (0xcf8, 0x80000000 | (dev << 11) | (fn << 8) | (reg & 0xfc));
+	return inl (0xcfc);
+}
+
+/* Writes DATA to PCI configuration register REG of bus 0 device
+   DEV function FN. */
+static void
+pci_write_config (int dev, int fn, int reg, uint32_t data) {
+	outl (0xcf8, 0x80000000 | (dev << 11) | (fn << 8) | (reg & 0xfc));
+	outl (0xcfc, data);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that drives the two
+   legacy channels and can master the bus, enables its bus
+   mastering, and returns the I/O base of its bus-master
+   registers.  Returns 0 if there is none, and then every transfer
+   is done in PIO mode. */
+static uint16_t
+find_bus_master (void) {
+	for (int dev = 0; dev < 32; dev++)
+		for (int fn = 0; fn < 8; fn++) {
+			uint32_t id = pci_read_config (dev, fn, 0x00);
+			uint32_t class = pci_read_config (dev, fn, 0x08) >> 8;
+			uint32_t bar4;
+
+			if ((id & 0xffff) == 0xffff) {
+				if (fn == 0)
+					break;
+				continue;
+			}
+
+			/* Mass storage, IDE, bus master, both channels in
+			   compatibility mode. */
+			if ((class & 0xffff00) != 0x010100 || (class & 0x80) == 0
+					|| (class & 0x05) != 0)
+				continue;
+			bar4 = pci_read_config (dev, fn, 0x20);
+			if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+				continue;
+
+			/* Enable I/O space and bus mastering. */
+			pci_write_config (dev, fn, 0x04,
+					(pci_read_config (dev, fn, 0x04) & 0xffff) | 0x05);
+			return bar4 & 0xfffc;
+		}
+	return 0;
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D and
+   the buffers of the requests in RUN, in order, by bus-master DMA:
+   into the buffers if READ, out of them otherwise.  The disk
+   interrupts once, when the whole transfer is done, and the
+   dispatcher sleeps until then with the CPU free for other
+   threads.
+
+   Returns false without touching the disk if the channel has no
+   bus master or a buffer is not DMA-able, and also if the
+   transfer fails, after turning DMA off for the channel.  Either
+   way the caller does the transfer in PIO mode instead. */
+static bool
+dma_transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		struct list *run, bool read) {
+	struct channel *c = d->channel;
+	uint8_t bm_status, status;
+	struct list_elem *e;
+	size_t n = 0;
+
+	if (c->bm_base == 0)
+		return false;
+
+	/* The bus master reaches only the low 4 GB of physical memory,
+	   through the kernel's direct map, in even-sized pieces. */
+	for (e = list_begin (run); e != list_end (run); e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		uint8_t *p = r->buffer, *end = p + r->cnt * DISK_SECTOR_SIZE;
+
+		if (!is_kernel_vaddr (p) || (uint64_t) p % 2 != 0
+				|| vtop (end - 1) >= ((uint64_t) 1 << 32))
+			return false;
+	}
+
+	/* One entry per page each buffer touches.  A run holds at most
+	   DISK_MULTIPLE_MAX sectors, each in at most two pages, so the
+	   table fits in its page. */
+	for (e = list_begin (run); e != list_end (run); e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		uint8_t *p = r->buffer, *end = p + r->cnt * DISK_SECTOR_SIZE;
+
+		while (p < end) {
+			uint8_t *next = (uint8_t *) pg_round_down (p) + PGSIZE;
+			size_t size = (next < end ? next : end) - p;
+
+			ASSERT (n < PGSIZE / sizeof *c->prdt);
+			c->prdt[n].addr = vtop (p);
+			c->prdt[n].size = size;
+			c->prdt[n].flags = 0;
+			n++;
+			p += size;
+		}
+	}
+	c->prdt[n - 1].flags = PRD_EOT;
+
+	outl (reg_bm_prdt (c), vtop (c->prdt));
+	outb (reg_bm_command (c), read ? BM_READ : 0);
+	outb (reg_bm_status (c), BM_INTR | BM_ERR);
+	select_sectors (d, sec_no, cnt);
+	issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+	outb (reg_bm_command (c), (read ? BM_READ : 0) | BM_START);
+	wait_for_completion (&c->done);
+	outb (reg_bm_command (c), read ? BM_READ : 0);
+
+	bm_status = inb (reg_bm_status (c));
+	outb (reg_bm_status (c), BM_INTR | BM_ERR);
+	status = inb (reg_alt_status (c));
+	if ((bm_status & (BM_ERR | BM_ACTIVE)) != 0 || (status & STA_ERR) != 0) {
+		printf ("%s: DMA failed, sector=%"PRDSNu", using PIO\n",
+				d->name, sec_no);
+		c->bm_base = 0;
+		return false;
+	}
+	return true;
+}
+
+/* Returns the buffer for the next sector of a PIO transfer over
+   RUN, whose position is *E and *I, and advances the position. */
+static uint8_t *
+next_sector (struct list_elem **e, size_t *i) {
+	struct disk_request *r = list_entry (*e, struct disk_request, elem);
+
+	if (*i == r->cnt) {
+		*e = list_next (*e);
+		*i = 0;
+		r = list_entry (*e, struct disk_request, elem);
+	}
+	return r->buffer + (*i)++ * DISK_SECTOR_SIZE;
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D and
+   the buffers of the requests in RUN, as dma_transfer(), in PIO
+   mode.  A disk in multiple mode interrupts once per block of
+   sectors, instead of once per sector. */
+static void
+pio_transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		struct list *run, bool read) {
+	struct channel *c = d->channel;
+	struct list_elem *e = list_begin (run);
+	size_t block, i, j, pos = 0;
+
+	block = cnt > 1 && d->block_sectors > 1 ? d->block_sectors : 1;
+	select_sectors (d, sec_no, cnt);
+	if (read) {
+		issue_pio_command (c, block > 1 ? CMD_READ_MULTIPLE
+				: CMD_READ_SECTOR_RETRY);
+		for (i = 0; i < cnt; i += block) {
+			wait_for_completion (&c->done);
+			if (!wait_while_busy (d))
+				PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name,
+						sec_no + (disk_sector_t) i);
+			for (j = i; j < i + block && j < cnt; j++)
+				input_sector (c, next_sector (&e, &pos));
+		}
+	} else {
+		issue_pio_command (c, block > 1 ? CMD_WRITE_MULTIPLE
+				: CMD_WRITE_SECTOR_RETRY);
+		for (i = 0; i < cnt; i += block) {
+			if (!wait_while_busy (d))
+				PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name,
+						sec_no + (disk_sector_t) i);
+			for (j = i; j < i + block && j < cnt; j++)
+				output_sector (c, next_sector (&e, &pos));
+			wait_for_completion (&c->done);
+		}
+	}
+}
+
 /* Reads a sector from channel C's data register in PIO mode into
    SECTOR, which must have room for DISK_SECTOR_SIZE bytes. */
 static void
@@ -446,6 +1150,436 @@ output_sector (struct channel *c, const void *sector) {
 	outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
 }
 
+/* Virtio block devices.
+
+   A virtio block device is a PCI function that the hypervisor
+   serves from the host directly, so that a transfer costs one
+   port write to kick the device and one interrupt when it is
+   done, instead of the trapping register accesses of an ATA
+   command.  We drive the legacy interface of [VIRTIO-0.9.5],
+   which QEMU offers for "-drive if=virtio", through the
+   function's I/O BAR.
+
+   Requests reach the device through a split virtqueue: a table
+   of buffer descriptors, an "available" ring in which we post
+   the first descriptor of each request's chain, and a "used"
+   ring in which the device hands them back.  A request's chain
+   is a header, one descriptor per physically contiguous piece of
+   its data, and a status byte.  The dispatcher posts a batch of
+   runs, each as one request unless its buffers are in more
+   pieces than the device takes at once, kicks the device once,
+   and sleeps until all of them are used.  With EVENT_IDX the
+   device interrupts once for the whole batch; without it, the
+   interrupt handler lets all but the last interrupt pass. */
+
+/* PCI IDs of a legacy or transitional virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* A device at PCI device number VIRTIO_SLOT_DEV + N asks for place
+   N in disk_get()'s numbering, as "pintos --virtio" sets up. */
+#define VIRTIO_SLOT_DEV 0x10
+
+/* Legacy virtio registers, at the I/O base taken from BAR0.
+   Device configuration follows them, with MSI-X off. */
+#define reg_vio_dev_features(C) ((C)->reg_base + 0x00) /* Device features. */
+#define reg_vio_drv_features(C) ((C)->reg_base + 0x04) /* Driver features. */
+#define reg_vio_queue_pfn(C) ((C)->reg_base + 0x08)    /* Queue page frame. */
+#define reg_vio_queue_size(C) ((C)->reg_base + 0x0c)   /* Queue size (r/o). */
+#define reg_vio_queue_sel(C) ((C)->reg_base + 0x0e)    /* Queue select. */
+#define reg_vio_queue_notify(C) ((C)->reg_base + 0x10) /* Queue notify. */
+#define reg_vio_status(C) ((C)->reg_base + 0x12)       /* Device status. */
+#define reg_vio_isr(C) ((C)->reg_base + 0x13)          /* ISR status (r/o). */
+#define reg_vio_config(C, OFS) ((C)->reg_base + 0x14 + (OFS))
+
+/* Device Status Register bits. */
+#define VIO_ACKNOWLEDGE 0x01    /* Guest has seen the device. */
+#define VIO_DRIVER 0x02         /* Guest has a driver for it. */
+#define VIO_DRIVER_OK 0x04      /* Driver is ready. */
+#define VIO_FAILED 0x80         /* Driver gave up on it. */
+
+/* Feature bits. */
+#define VIO_BLK_F_SEG_MAX (1u << 2)     /* Config's SEG_MAX is valid. */
+#define VIO_BLK_F_RO (1u << 5)          /* Disk is read-only. */
+#define VIO_RING_F_EVENT_IDX (1u << 29) /* Device honors USED_EVENT. */
+
+/* Block device configuration offsets. */
+#define VIO_BLK_CAPACITY 0      /* 64-bit size in 512-byte sectors. */
+#define VIO_BLK_SEG_MAX 12      /* Most data pieces in a request. */
+
+/* Request types. */
+#define VIO_BLK_T_IN 0          /* Read. */
+#define VIO_BLK_T_OUT 1         /* Write. */
+
+/* ISR Status Register bits.  Reading the register clears them. */
+#define VIO_ISR_QUEUE 0x01      /* A queue has new used entries. */
+
+/* IRQ lines taken by the timer, keyboard, PIC cascade, serial
+   port and ATA channels, which virtio devices cannot share. */
+#define LEGACY_IRQS (1u << 0 | 1u << 1 | 1u << 2 | 1u << 4 | 1u << 14 \
+		| 1u << 15)
+
+/* A descriptor: one piece of a request. */
+struct vring_desc {
+	uint64_t addr;              /* Physical address. */
+	uint32_t len;               /* Length in bytes. */
+	uint16_t flags;             /* VRING_DESC_F_*. */
+	uint16_t next;              /* Next in the chain, with F_NEXT. */
+};
+#define VRING_DESC_F_NEXT 1     /* The chain continues at NEXT. */
+#define VRING_DESC_F_WRITE 2    /* The device writes the piece. */
+
+/* The available ring, written by the driver.  RING[SIZE] is
+   USED_EVENT: with EVENT_IDX, the device interrupts only when
+   the used ring's IDX moves past it. */
+struct vring_avail {
+	uint16_t flags;
+	uint16_t idx;               /* Where the next entry goes. */
+	uint16_t ring[];            /* Heads of descriptor chains. */
+};
+
+/* An entry of the used ring. */
+struct vring_used_elem {
+	uint32_t id;                /* Head of the chain. */
+	uint32_t len;               /* Bytes the device wrote. */
+};
+
+/* The used ring, written by the device. */
+struct vring_used {
+	uint16_t flags;
+	uint16_t idx;               /* Where the next entry goes. */
+	struct vring_used_elem ring[];
+};
+
+/* A request's header, which the device reads, and status, which
+   it writes. */
+struct virtio_blk_req {
+	uint32_t type;              /* VIO_BLK_T_*. */
+	uint32_t reserved;
+	uint64_t sector;            /* First sector. */
+	uint8_t status;             /* 0 once the request has succeeded. */
+};
+
+/* Requests in flight at once, as many as have headers in a
+   page. */
+#define VIRTIO_REQS (PGSIZE / sizeof (struct virtio_blk_req))
+
+/* One request must hold a whole disk_request's buffer, which
+   spans at most this many pages. */
+#define VIRTIO_SEG_MIN (DISK_MULTIPLE_MAX * DISK_SECTOR_SIZE / PGSIZE + 1)
+
+/* A virtio device's request queue. */
+struct virtq {
+	uint16_t size;              /* Descriptors, a power of 2. */
+	struct vring_desc *desc;    /* SIZE descriptors. */
+	struct vring_avail *avail;
+	struct vring_used *used;
+	struct virtio_blk_req *reqs;  /* VIRTIO_REQS headers, one page. */
+	uint16_t used_idx;          /* Where our last batch ended. */
+	uint16_t wait_idx;          /* Used ring IDX that ends this one. */
+	size_t seg_max;             /* Most data pieces per request. */
+	bool event_idx;             /* VIO_RING_F_EVENT_IDX negotiated? */
+};
+static struct virtq virtqs[VIRTIO_CNT];
+
+static void virtio_attach (int dev, int fn, int slot);
+static bool virtio_init_queue (struct channel *, uint32_t features);
+
+/* Looks on PCI bus 0 for virtio block devices and makes each of
+   them the disk in the place in disk_get()'s numbering that its
+   PCI device number asks for, if it has no ATA disk, or else in
+   the first place, other than the boot disk's, that has none. */
+static void
+find_virtio_disks (void) {
+	for (int dev = 0; dev < 32; dev++)
+		for (int fn = 0; fn < 8; fn++) {
+			uint32_t id = pci_read_config (dev, fn, 0x00);
+			int slot;
+
+			if ((id & 0xffff) == 0xffff) {
+				if (fn == 0)
+					break;
+				continue;
+			}
+			if (id != ((uint32_t) VIRTIO_BLK_DEVICE << 16 | VIRTIO_VENDOR))
+				continue;
+
+			slot = dev - VIRTIO_SLOT_DEV;
+			if (slot < 1 || slot >= CHANNEL_CNT * 2
+					|| disks[slot / 2][slot % 2] != NULL)
+				for (slot = 1; slot < CHANNEL_CNT * 2; slot++)
+					if (disks[slot / 2][slot % 2] == NULL)
+						break;
+			if (slot == CHANNEL_CNT * 2 || virtio_cnt == VIRTIO_CNT) {
+				printf ("virtio-blk at PCI %02x.%x: no place for it\n",
+						dev, fn);
+				return;
+			}
+			virtio_attach (dev, fn, slot);
+		}
+}
+
+/* Sets up the virtio block device at PCI device DEV function FN
+   as the disk in place SLOT of disk_get()'s numbering and starts
+   its dispatcher.  Leaves the place empty if the device cannot be
+   used. */
+static void
+virtio_attach (int dev, int fn, int slot) {
+	struct channel *c = &virtio_channels[virtio_cnt];
+	struct disk *d = &c->devices[0];
+	uint32_t bar0 = pci_read_config (dev, fn, 0x10);
+	uint8_t irq = pci_read_config (dev, fn, 0x3c) & 0xff;
+	uint32_t features;
+	uint64_t capacity;
+	size_t i;
+
+	snprintf (c->name, sizeof c->name, "vd%zu", virtio_cnt);
+	init_channel (c);
+	init_disk (d, c, 0, slot);
+	if ((bar0 & 1) == 0 || irq >= 16 || (LEGACY_IRQS & (1u << irq)) != 0) {
+		printf ("%s: virtio-blk at PCI %02x.%x has no usable I/O BAR "
+				"or IRQ\n", c->name, dev, fn);
+		return;
+	}
+	c->reg_base = bar0 & 0xfffc;
+	c->irq = irq + 0x20;
+
+	/* Enable I/O space and bus mastering, reset the device, and
+	   take the features we know. */
+	pci_write_config (dev, fn, 0x04,
+			(pci_read_config (dev, fn, 0x04) & 0xffff) | 0x05);
+	outb (reg_vio_status (c), 0);
+	outb (reg_vio_status (c), VIO_ACKNOWLEDGE | VIO_DRIVER);
+	features = inl (reg_vio_dev_features (c));
+	if (features & VIO_BLK_F_RO) {
+		printf ("%s: virtio-blk at PCI %02x.%x is read-only\n",
+				c->name, dev, fn);
+		outb (reg_vio_status (c), VIO_FAILED);
+		return;
+	}
+	features &= VIO_BLK_F_SEG_MAX | VIO_RING_F_EVENT_IDX;
+	outl (reg_vio_drv_features (c), features);
+	if (!virtio_init_queue (c, features)) {
+		printf ("%s: cannot set up the queue of virtio-blk at PCI "
+				"%02x.%x\n", c->name, dev, fn);
+		outb (reg_vio_status (c), VIO_FAILED);
+		return;
+	}
+
+	capacity = inl (reg_vio_config (c, VIO_BLK_CAPACITY))
+		| (uint64_t) inl (reg_vio_config (c, VIO_BLK_CAPACITY + 4)) << 32;
+	d->capacity = capacity < UINT32_MAX ? capacity : UINT32_MAX;
+
+	/* Devices on one line share a handler. */
+	for (i = 0; i < virtio_cnt; i++)
+		if (virtio_channels[i].irq == c->irq)
+			break;
+	if (i == virtio_cnt)
+		intr_register_ext (c->irq, virtio_interrupt, "virtio-blk");
+	outb (reg_vio_status (c), VIO_ACKNOWLEDGE | VIO_DRIVER | VIO_DRIVER_OK);
+
+	printf ("%s: detected %'"PRDSNu" sector virtio disk %s, "
+			"%zu-piece requests%s\n", d->name, d->capacity, c->name,
+			c->vq->seg_max, c->vq->event_idx ? ", event index" : "");
+	register_counters (d);
+	disks[slot / 2][slot % 2] = d;
+	virtio_cnt++;
+	if (thread_create (c->name, PRI_MAX, dispatcher, c) == TID_ERROR)
+		PANIC ("%s: cannot start dispatcher", c->name);
+}
+
+/* Sets up queue 0 of virtio channel C, whose driver features are
+   FEATURES, and tells the device where it is.  Returns false if
+   the device's queue is too small or there is no memory for it. */
+static bool
+virtio_init_queue (struct channel *c, uint32_t features) {
+	struct virtq *q = &virtqs[c - virtio_channels];
+	size_t used_ofs, pages;
+	uint8_t *ring;
+	uint16_t size;
+
+	outw (reg_vio_queue_sel (c), 0);
+	size = inw (reg_vio_queue_size (c));
+	if (size < VIRTIO_SEG_MIN + 2 || (size & (size - 1)) != 0)
+		return false;
+
+	/* The used ring starts on the page after the descriptors and
+	   the available ring. */
+	used_ofs = ROUND_UP (size * sizeof (struct vring_desc)
+			+ sizeof (struct vring_avail) + (size + 1) * sizeof (uint16_t),
+			PGSIZE);
+	pages = DIV_ROUND_UP (used_ofs + sizeof (struct vring_used)
+			+ size * sizeof (struct vring_used_elem) + sizeof (uint16_t),
+			PGSIZE);
+	ring = palloc_get_multiple (PAL_ZERO, pages);
+	q->reqs = palloc_get_page (PAL_ZERO);
+	if (ring == NULL || q->reqs == NULL) {
+		palloc_free_multiple (ring, pages);
+		palloc_free_page (q->reqs);
+		return false;
+	}
+
+	q->size = size;
+	q->desc = (struct vring_desc *) ring;
+	q->avail = (struct vring_avail *) (ring + size * sizeof *q->desc);
+	q->used = (struct vring_used *) (ring + used_ofs);
+	q->used_idx = q->wait_idx = 0;
+	q->seg_max = size - 2;
+	if (features & VIO_BLK_F_SEG_MAX) {
+		uint32_t seg_max = inl (reg_vio_config (c, VIO_BLK_SEG_MAX));
+
+		if (seg_max < q->seg_max)
+			q->seg_max = seg_max;
+	}
+	q->event_idx = (features & VIO_RING_F_EVENT_IDX) != 0;
+	if (q->seg_max < VIRTIO_SEG_MIN) {
+		palloc_free_multiple (ring, pages);
+		palloc_free_page (q->reqs);
+		return false;
+	}
+
+	outl (reg_vio_queue_pfn (c), vtop (ring) >> 12);
+	c->vq = q;
+	return true;
+}
+
+/* Returns the physically contiguous pieces of R's buffer, one per
+   page it touches. */
+static size_t
+buffer_pieces (const struct disk_request *r) {
+	uint8_t *end = r->buffer + r->cnt * DISK_SECTOR_SIZE;
+
+	return ((uint8_t *) pg_round_down (end - 1)
+			- (uint8_t *) pg_round_down (r->buffer)) / PGSIZE + 1;
+}
+
+/* Sets descriptor I of Q to the SIZE bytes at P, chained to the
+   next descriptor if FLAGS has VRING_DESC_F_NEXT. */
+static void
+virtio_set_desc (struct virtq *q, uint16_t i, const void *p, size_t size,
+		uint16_t flags) {
+	q->desc[i].addr = vtop (p);
+	q->desc[i].len = size;
+	q->desc[i].flags = flags;
+	q->desc[i].next = i + 1;
+}
+
+/* Posts one device request, for the requests of a run from E up
+   to END, to virtio channel C's queue, in header SLOT and the
+   descriptors from DESC on.  Returns the descriptor after the
+   last one it used.  The device sees the request only once
+   virtio_kick() makes it available. */
+static uint16_t
+virtio_post (struct channel *c, size_t slot, uint16_t desc,
+		struct list_elem *e, struct list_elem *end) {
+	struct virtq *q = c->vq;
+	struct disk_request *first = list_entry (e, struct disk_request, elem);
+	struct virtio_blk_req *req = &q->reqs[slot];
+	uint16_t flags = VRING_DESC_F_NEXT
+		| (first->read ? VRING_DESC_F_WRITE : 0);
+
+	req->type = first->read ? VIO_BLK_T_IN : VIO_BLK_T_OUT;
+	req->reserved = 0;
+	req->sector = first->sec_no;
+	req->status = 0xff;
+	q->avail->ring[(uint16_t) (q->avail->idx + slot) & (q->size - 1)] = desc;
+	virtio_set_desc (q, desc++, req, offsetof (struct virtio_blk_req, status),
+			VRING_DESC_F_NEXT);
+
+	for (; e != end; e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		uint8_t *p = r->buffer, *bend = p + r->cnt * DISK_SECTOR_SIZE;
+
+		ASSERT (is_kernel_vaddr (p));
+		while (p < bend) {
+			uint8_t *next = (uint8_t *) pg_round_down (p) + PGSIZE;
+			size_t size = (next < bend ? next : bend) - p;
+
+			virtio_set_desc (q, desc++, p, size, flags);
+			p += size;
+		}
+	}
+	virtio_set_desc (q, desc++, &req->status, 1, VRING_DESC_F_WRITE);
+	return desc;
+}
+
+/* Makes the CNT requests posted to virtio channel C's queue
+   available to the device, kicks it, and sleeps until it has used
+   them all.  Panics if any of them failed. */
+static void
+virtio_kick (struct channel *c, size_t cnt) {
+	struct virtq *q = c->vq;
+	size_t i;
+
+	q->wait_idx = q->used_idx + cnt;
+	if (q->event_idx)
+		q->avail->ring[q->size] = q->wait_idx - 1;
+	barrier ();
+	q->avail->idx += cnt;
+	barrier ();
+
+	/* Interrupts must be enabled or our completion will never be
+	   signaled by the interrupt handler. */
+	ASSERT (intr_get_level () == INTR_ON);
+	c->expecting_interrupt = true;
+	outw (reg_vio_queue_notify (c), 0);
+	wait_for_completion (&c->done);
+	q->used_idx = q->wait_idx;
+
+	for (i = 0; i < cnt; i++)
+		if (q->reqs[i].status != 0)
+			PANIC ("%s: disk %s failed, sector=%"PRIu64, c->devices[0].name,
+					q->reqs[i].type == VIO_BLK_T_IN ? "read" : "write",
+					q->reqs[i].sector);
+}
+
+/* Transfers the runs RUNS[0...RUN_CNT - 1] between the disk on
+   virtio channel C and the buffers of their requests.  A run goes
+   to the device as one request, split between the run's
+   requests only where their buffers have more pieces than the
+   device takes in one, and as many requests are in flight at once
+   as the queue has room for. */
+static void
+virtio_transfer (struct channel *c, struct list runs[], size_t run_cnt) {
+	struct virtq *q = c->vq;
+	uint16_t desc = 0;
+	size_t posted = 0, i;
+
+	for (i = 0; i < run_cnt; i++) {
+		struct list_elem *e = list_begin (&runs[i]);
+
+		while (e != list_end (&runs[i])) {
+			struct list_elem *end = e;
+			size_t pieces = 0;
+
+			/* Take as many of the run's requests as fit in one
+			   device request and in what is left of the queue. */
+			if (posted < VIRTIO_REQS)
+				for (; end != list_end (&runs[i]); end = list_next (end)) {
+					size_t n = buffer_pieces (list_entry (end,
+								struct disk_request, elem));
+
+					if (pieces + n > q->seg_max
+							|| desc + pieces + n + 2 > q->size)
+						break;
+					pieces += n;
+				}
+			if (end == e) {
+				/* The queue is full: let it drain. */
+				ASSERT (posted > 0);
+				virtio_kick (c, posted);
+				desc = 0;
+				posted = 0;
+				continue;
+			}
+			desc = virtio_post (c, posted++, desc, e, end);
+			e = end;
+		}
+	}
+	if (posted > 0)
+		virtio_kick (c, posted);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -520,7 +1654,7 @@ interrupt_handler (struct intr_frame *f) {
 		if (f->vec_no == c->irq) {
 			if (c->expecting_interrupt) {
 				inb (reg_status (c));               /* Acknowledge interrupt. */
-				sema_up (&c->completion_wait);      /* Wake up waiter. */
+				complete (&c->done);                /* Wake up waiter. */
 			} else
 				printf ("%s: unexpected interrupt\n", c->name);
 			return;
@@ -529,6 +1663,28 @@ interrupt_handler (struct intr_frame *f) {
 	NOT_REACHED ();
 }
 
+/* Virtio block device interrupt handler, shared by the devices
+   on one line.  Wakes a dispatcher once its whole batch is
+   used. */
+static void
+virtio_interrupt (struct intr_frame *f) {
+	size_t i;
+
+	for (i = 0; i < virtio_cnt; i++) {
+		struct channel *c = &virtio_channels[i];
+
+		/* Reading the ISR status acknowledges the interrupt. */
+		if (c->irq != f->vec_no
+				|| (inb (reg_vio_isr (c)) & VIO_ISR_QUEUE) == 0)
+			continue;
+		barrier ();
+		if (c->expecting_interrupt && c->vq->used->idx == c->vq->wait_idx) {
+			c->expecting_interrupt = false;
+			complete (&c->done);
+		}
+	}
+}
+
 static void
 inspect_read_cnt (struct intr_frame *f) {
 	struct disk * d = disk_get (f->R.rdx, f->R.rcx);
@@ -541,6 +1697,48 @@ inspect_write_cnt (struct intr_frame *f) {
 	f->R.rax = d->write_cnt;
 }
 
+/* Disk statistics inspection, via int 0x49.
+ * Input:
+ *   @RDX - chan_no of disk to inspect
+ *   @RCX - dev_no of disk to inspect
+ *   @RAX - What to read: 0 and 1 for the read and write latency
+ *          histograms, in cycles, 2 for the seek-distance histogram, in
+ *          sectors, 3 and 4 for bytes read and written, 5 and 6 for
+ *          sequential and random commands, 7 for requests submitted,
+ *          8 for the sum of the queue depths they found, counting
+ *          themselves, 9 for the deepest queue.
+ *   @RSI - Histogram bucket, for RAX = 0, 1, 2.
+ * Output:
+ *   @RAX - The requested count, or -1 if the input is invalid. */
+static void
+inspect_disk_stats (struct intr_frame *f) {
+	uint64_t what = f->R.rax, bucket = f->R.rsi;
+	const struct histogram *h = NULL;
+	struct disk *d;
+
+	f->R.rax = -1;
+	if (f->R.rdx >= CHANNEL_CNT || f->R.rcx > 1)
+		return;
+	d = disk_get (f->R.rdx, f->R.rcx);
+	if (d == NULL)
+		return;
+
+	switch (what) {
+		case 0: h = &d->read_latency; break;
+		case 1: h = &d->write_latency; break;
+		case 2: h = &d->seek; break;
+		case 3: f->R.rax = d->read_cnt * DISK_SECTOR_SIZE; return;
+		case 4: f->R.rax = d->write_cnt * DISK_SECTOR_SIZE; return;
+		case 5: f->R.rax = d->seq_cmds; return;
+		case 6: f->R.rax = d->random_cmds; return;
+		case 7: f->R.rax = d->submits; return;
+		case 8: f->R.rax = d->queued_sum; return;
+		case 9: f->R.rax = d->queued_max; return;
+	}
+	if (h != NULL && bucket < HISTOGRAM_BUCKETS)
+		f->R.rax = h->buckets[bucket];
+}
+
 /* Tool for testing disk r/w cnt. Calling this function via int 0x43 and int 0x44.
  * Input:
  *   @RDX - chan_no of disk to inspect
@@ -1,25 +1,49 @@
 #include "devices/input.h"
 #include <debug.h>
-#include "devices/intq.h"
 #include "devices/serial.h"
+#include "devices/spsc.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
 
-/* Stores keys from the keyboard and serial port. */
-static struct intq buffer;
+/* Stores keys from the keyboard and serial port.  Both produce
+   from interrupt handlers, which do not nest, so they count as
+   one producer; readers take READERS to count as one consumer. */
+static uint8_t buffer_bytes[64];
+static struct spsc buffer;
+
+/* Serializes readers. */
+static struct lock readers;
+
+/* Readers waiting for a key. */
+static struct wait_queue not_empty;
 
 /* Initializes the input buffer. */
 void
 input_init (void) {
-	intq_init (&buffer);
+	spsc_init (&buffer, buffer_bytes, sizeof buffer_bytes);
+	lock_init (&readers);
+	wait_queue_init (&not_empty);
 }
 
 /* Adds a key to the input buffer.
    Interrupts must be off and the buffer must not be full. */
 void
 input_putc (uint8_t key) {
+	input_putbuf (&key, 1);
+}
+
+/* Adds the N keys in BUF to the input buffer.
+   Interrupts must be off and the buffer must have room for
+   them. */
+void
+input_putbuf (const uint8_t *buf, size_t n) {
 	ASSERT (intr_get_level () == INTR_OFF);
-	ASSERT (!intq_full (&buffer));
+	ASSERT (n <= spsc_room (&buffer));
 
-	intq_putc (&buffer, key);
+	if (n == 0)
+		return;
+	spsc_put (&buffer, buf, n);
+	wait_queue_wake_one (&not_empty);
 	serial_notify ();
 }
 
@@ -27,15 +51,48 @@ input_putc (uint8_t key) {
    If the buffer is empty, waits for a key to be pressed. */
 uint8_t
 input_getc (void) {
-	enum intr_level old_level;
 	uint8_t key;
 
+	input_getbuf (&key, 1);
+	return key;
+}
+
+/* Retrieves between 1 and N keys from the input buffer into BUF,
+   as many as are there, and returns the number retrieved.  If the
+   buffer is empty, first waits for a key to be pressed.  Once
+   there are keys, takes them without turning interrupts off. */
+size_t
+input_getbuf (uint8_t *buf, size_t n) {
+	enum intr_level old_level;
+	size_t cnt;
+
+	ASSERT (n > 0);
+
+	lock_acquire (&readers);
+	while ((cnt = spsc_get (&buffer, buf, n)) == 0) {
+		/* Check again with interrupts off, so that a key arriving
+		   in between cannot go unnoticed. */
+		old_level = intr_disable ();
+		if (spsc_count (&buffer) == 0)
+			wait_queue_wait (&not_empty, 0);
+		intr_set_level (old_level);
+	}
+	lock_release (&readers);
+
+	/* Serial receive interrupts may have been held off while the
+	   buffer was full. */
 	old_level = intr_disable ();
-	key = intq_getc (&buffer);
 	serial_notify ();
 	intr_set_level (old_level);
+	return cnt;
+}
 
-	return key;
+/* Returns the number of keys the input buffer has room for.
+   Interrupts must be off. */
+size_t
+input_room (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	return spsc_room (&buffer);
 }
 
 /* Returns true if the input buffer is full,
@@ -43,6 +100,5 @@ input_getc (void) {
    Interrupts must be off. */
 bool
 input_full (void) {
-	ASSERT (intr_get_level () == INTR_OFF);
-	return intq_full (&buffer);
+	return input_room () == 0;
 }
@@ -3,14 +3,15 @@
 #include "threads/thread.h"
 
 static int next (int pos);
-static void wait (struct intq *q, struct thread **waiter);
-static void signal (struct intq *q, struct thread **waiter);
+static void wait (struct intq *q, struct wait_queue *wq);
+static void signal (struct intq *q, struct wait_queue *wq);
 
 /* Initializes interrupt queue Q. */
 void
 intq_init (struct intq *q) {
-	lock_init (&q->lock);
-	q->not_full = q->not_empty = NULL;
+	spin_lock_init (&q->lock);
+	wait_queue_init (&q->not_full);
+	wait_queue_init (&q->not_empty);
 	q->head = q->tail = 0;
 }
 
@@ -37,16 +38,16 @@ intq_getc (struct intq *q) {
 	uint8_t byte;
 
 	ASSERT (intr_get_level () == INTR_OFF);
+	spin_lock (&q->lock);
 	while (intq_empty (q)) {
 		ASSERT (!intr_context ());
-		lock_acquire (&q->lock);
 		wait (q, &q->not_empty);
-		lock_release (&q->lock);
 	}
 
 	byte = q->buf[q->tail];
 	q->tail = next (q->tail);
 	signal (q, &q->not_full);
+	spin_unlock (&q->lock);
 	return byte;
 }
 
@@ -57,16 +58,16 @@ intq_getc (struct intq *q) {
 void
 intq_putc (struct intq *q, uint8_t byte) {
 	ASSERT (intr_get_level () == INTR_OFF);
+	spin_lock (&q->lock);
 	while (intq_full (q)) {
 		ASSERT (!intr_context ());
-		lock_acquire (&q->lock);
 		wait (q, &q->not_full);
-		lock_release (&q->lock);
 	}
 
 	q->buf[q->head] = byte;
 	q->head = next (q->head);
 	signal (q, &q->not_empty);
+	spin_unlock (&q->lock);
 }
 
 /* Returns the position after POS within an intq. */
@@ -75,31 +76,30 @@ next (int pos) {
 	return (pos + 1) % INTQ_BUFSIZE;
 }
 
-/* WAITER must be the address of Q's not_empty or not_full
-   member.  Waits until the given condition is true. */
+/* WQ must be the address of Q's not_empty or not_full member.
+   Waits until the given condition may have become true; the
+   caller re-checks it, since another waiter may have run first.
+   Q's lock is dropped while sleeping. */
 static void
-wait (struct intq *q UNUSED, struct thread **waiter) {
+wait (struct intq *q, struct wait_queue *wq) {
 	ASSERT (!intr_context ());
 	ASSERT (intr_get_level () == INTR_OFF);
-	ASSERT ((waiter == &q->not_empty && intq_empty (q))
-			|| (waiter == &q->not_full && intq_full (q)));
+	ASSERT ((wq == &q->not_empty && intq_empty (q))
+			|| (wq == &q->not_full && intq_full (q)));
 
-	*waiter = thread_current ();
-	thread_block ();
+	spin_unlock (&q->lock);
+	wait_queue_wait (wq, 0);
+	spin_lock (&q->lock);
 }
 
-/* WAITER must be the address of Q's not_empty or not_full
-   member, and the associated condition must be true.  If a
-   thread is waiting for the condition, wakes it up and resets
-   the waiting thread. */
+/* WQ must be the address of Q's not_empty or not_full member,
+   and the associated condition must be true.  If any thread is
+   waiting for the condition, wakes one of them up. */
 static void
-signal (struct intq *q UNUSED, struct thread **waiter) {
+signal (struct intq *q UNUSED, struct wait_queue *wq) {
 	ASSERT (intr_get_level () == INTR_OFF);
-	ASSERT ((waiter == &q->not_empty && !intq_empty (q))
-			|| (waiter == &q->not_full && !intq_full (q)));
+	ASSERT ((wq == &q->not_empty && !intq_empty (q))
+			|| (wq == &q->not_full && !intq_full (q)));
 
-	if (*waiter != NULL) {
-		thread_unblock (*waiter);
-		*waiter = NULL;
-	}
+	wait_queue_wake_one (wq);
 }
@@ -0,0 +1,226 @@
+#include "devices/ioapic.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/lapic.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* I/O APIC interrupt routing.
+
+   The 8259 PICs need an OUTB, which traps to the hypervisor, to
+   acknowledge each interrupt.  The I/O APIC instead forwards each
+   of its input pins to a local APIC as a message, and is told
+   the interrupt is done by the local APIC's EOI, a single store
+   or, in x2APIC mode, MSR write.  It can also send any pin to any
+   CPU.
+
+   ISA IRQ N keeps vector 0x20 + N, so that the handlers that
+   intr_register_ext() installs are none the wiser, but it is not
+   always on pin N: the ACPI MADT lists "interrupt source
+   overrides", such as QEMU's timer on pin 2 and its level-
+   triggered PCI lines.  Without a MADT or a local APIC we stay
+   with the PICs.  See [IOAPIC] and [ACPI] 5.2.12. */
+
+/* I/O APIC registers, selected through IOREGSEL and accessed
+   through IOWIN. */
+#define IOREGSEL 0x00                   /* Register select. */
+#define IOWIN 0x10                      /* Register window. */
+#define IOAPICVER 0x01                  /* Version; bits 16...23 are the
+                                           highest pin. */
+#define IOREDTBL(PIN) (0x10 + 2 * (PIN))  /* Redirection entry, low half. */
+
+/* Redirection entry bits. */
+#define RED_ACTIVE_LOW (1 << 13)        /* Polarity: active low. */
+#define RED_LEVEL (1 << 15)             /* Trigger: level. */
+#define RED_MASKED (1 << 16)            /* Interrupt masked. */
+
+/* MADT entry types. */
+#define MADT_IOAPIC 1
+#define MADT_OVERRIDE 2
+
+/* MPS INTI flags of an override. */
+#define INTI_POLARITY 0x3               /* 1=active high, 3=active low. */
+#define INTI_TRIGGER 0xc                /* 4=edge, 0xc=level. */
+
+#define ISA_IRQ_CNT 16
+
+/* Where ioapic_probe() found the I/O APIC: the physical address of
+   its registers, or 0 if none. */
+static uint32_t ioapic_phys;
+
+/* Pin and redirection entry flags of each ISA IRQ. */
+static struct {
+	uint32_t pin;
+	uint32_t flags;
+} isa_irqs[ISA_IRQ_CNT];
+
+static volatile uint32_t *ioapic_regs;  /* Mapped registers, or NULL. */
+
+/* The header common to all ACPI tables. */
+struct acpi_header {
+	char signature[4];
+	uint32_t length;                    /* Bytes, header included. */
+	uint8_t revision;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__ ((packed));
+
+/* Returns true if the LEN bytes at P sum to 0, as every ACPI
+   structure's do. */
+static bool
+checksum_ok (const void *p, size_t len) {
+	const uint8_t *b = p;
+	uint8_t sum = 0;
+
+	while (len-- > 0)
+		sum += *b++;
+	return sum == 0;
+}
+
+/* Returns the ACPI RSDP in the LEN bytes of physical memory at
+   START, or a null pointer. */
+static const uint8_t *
+find_rsdp (uint64_t start, size_t len) {
+	for (uint64_t pa = start; pa + 20 <= start + len; pa += 16) {
+		const uint8_t *p = ptov (pa);
+
+		if (!memcmp (p, "RSD PTR ", 8) && checksum_ok (p, 20))
+			return p;
+	}
+	return NULL;
+}
+
+/* Returns the MADT, through the RSDT, or a null pointer. */
+static const struct acpi_header *
+find_madt (void) {
+	const uint8_t *rsdp;
+	const struct acpi_header *rsdt;
+	uint64_t ebda = (uint64_t) *(uint16_t *) ptov (0x40e) << 4;
+	size_t i, cnt;
+
+	/* The RSDP is in the first kB of the EBDA or in the BIOS
+	   ROM. */
+	rsdp = ebda != 0 ? find_rsdp (ebda, 1024) : NULL;
+	if (rsdp == NULL)
+		rsdp = find_rsdp (0xe0000, 0x20000);
+	if (rsdp == NULL)
+		return NULL;
+
+	rsdt = ptov (*(uint32_t *) (rsdp + 16));
+	if (memcmp (rsdt->signature, "RSDT", 4)
+			|| !checksum_ok (rsdt, rsdt->length))
+		return NULL;
+	cnt = (rsdt->length - sizeof *rsdt) / sizeof (uint32_t);
+	for (i = 0; i < cnt; i++) {
+		const uint32_t *entries = (const uint32_t *) (rsdt + 1);
+		const struct acpi_header *h = ptov (entries[i]);
+
+		if (!memcmp (h->signature, "APIC", 4) && checksum_ok (h, h->length))
+			return h;
+	}
+	return NULL;
+}
+
+/* Finds the I/O APIC that serves the ISA IRQs and the pin of each
+   IRQ in the ACPI MADT, for ioapic_init().  Must run before
+   palloc hands out the memory the ACPI tables are in, since it
+   treats it as free, and after paging_init(), which maps it. */
+void
+ioapic_probe (void) {
+	const struct acpi_header *madt = find_madt ();
+	const uint8_t *p, *end;
+	int irq;
+
+	if (madt == NULL)
+		return;
+	for (irq = 0; irq < ISA_IRQ_CNT; irq++) {
+		isa_irqs[irq].pin = irq;
+		isa_irqs[irq].flags = 0;
+	}
+
+	/* The entries follow the header, the local APIC address and
+	   the flags. */
+	end = (const uint8_t *) madt + madt->length;
+	for (p = (const uint8_t *) (madt + 1) + 8; p + 2 <= end && p[1] >= 2;
+			p += p[1]) {
+		if (p[0] == MADT_IOAPIC && p[1] >= 12 && ioapic_phys == 0
+				&& *(uint32_t *) (p + 8) == 0)
+			ioapic_phys = *(uint32_t *) (p + 4);
+		else if (p[0] == MADT_OVERRIDE && p[1] >= 10 && p[2] == 0
+				&& p[3] < ISA_IRQ_CNT) {
+			uint16_t inti = *(uint16_t *) (p + 8);
+			uint32_t flags = 0;
+
+			if ((inti & INTI_POLARITY) == 3)
+				flags |= RED_ACTIVE_LOW;
+			if ((inti & INTI_TRIGGER) == 0xc)
+				flags |= RED_LEVEL;
+			isa_irqs[p[3]].pin = *(uint32_t *) (p + 4);
+			isa_irqs[p[3]].flags = flags;
+		}
+	}
+}
+
+static uint32_t
+ioapic_read (unsigned reg) {
+	ioapic_regs[IOREGSEL / 4] = reg;
+	return ioapic_regs[IOWIN / 4];
+}
+
+static void
+ioapic_write (unsigned reg, uint32_t value) {
+	ioapic_regs[IOREGSEL / 4] = reg;
+	ioapic_regs[IOWIN / 4] = value;
+}
+
+/* Takes the external interrupts over from the PICs, if
+   ioapic_probe() found an I/O APIC and lapic_init() has set up
+   the local APIC: routes each ISA IRQ to this CPU at the vector
+   the PICs gave it, then masks the PICs.  Returns false, leaving
+   the PICs in charge, otherwise. */
+bool
+ioapic_init (void) {
+	enum intr_level old_level;
+	uint32_t pins;
+	uint64_t *pte;
+	int irq;
+
+	if (ioapic_phys == 0 || !lapic_present ())
+		return false;
+
+	/* Map the registers uncached, as lapic_init() does. */
+	pte = pml4e_walk (base_pml4, (uint64_t) ptov (ioapic_phys), 1);
+	if (pte == NULL)
+		return false;
+	*pte = (ioapic_phys & ~PGMASK) | PTE_P | PTE_W | PTE_G | PTE_PCD
+		| PTE_PWT;
+	invlpg ((uint64_t) ptov (ioapic_phys));
+	ioapic_regs = ptov (ioapic_phys);
+	pins = (ioapic_read (IOAPICVER) >> 16 & 0xff) + 1;
+
+	old_level = intr_disable ();
+	for (irq = 0; irq < ISA_IRQ_CNT; irq++) {
+		uint32_t pin = isa_irqs[irq].pin;
+
+		/* IRQ 2 is the PICs' cascade, which nothing raises. */
+		if (irq == 2 || pin >= pins)
+			continue;
+		ioapic_write (IOREDTBL (pin) + 1, lapic_id () << 24);
+		ioapic_write (IOREDTBL (pin), isa_irqs[irq].flags | (0x20 + irq));
+	}
+	intr_mask_pic ();
+	intr_set_level (old_level);
+
+	printf ("I/O APIC: %u pins at %#x, ISA interrupts to CPU %u.\n",
+			pins, ioapic_phys, lapic_id ());
+	return true;
+}
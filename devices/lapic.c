@@ -0,0 +1,281 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Local APIC timer.
+
+   The local APIC is memory-mapped at the physical address in the
+   IA32_APIC_BASE MSR.  Its timer delivers one interrupt per
+   arming, either when the TSC reaches a deadline (TSC-deadline
+   mode) or when a down-counter that runs at the APIC bus clock
+   reaches zero (one-shot mode).  We prefer the former, which
+   needs no conversion, and measure the counter's rate against
+   the TSC for the latter.  See [IA32-v3a] 10.5.4 "APIC Timer".
+
+   Where the CPU has one, we use x2APIC mode, in which the
+   registers are MSRs instead of memory: an EOI or IPI is then one
+   WRMSR, which a hypervisor can take without decoding a memory
+   access, and the ICR takes its destination and command in a
+   single write.  See [IA32-v3a] 10.12 "Extended XAPIC (x2APIC)". */
+
+/* Register offsets. */
+#define LAPIC_ID 0x020                  /* Local APIC ID. */
+#define LAPIC_EOI 0x0b0                 /* End of interrupt. */
+#define LAPIC_SVR 0x0f0                 /* Spurious interrupt vector. */
+#define LAPIC_ICR_LO 0x300              /* Interrupt command, low half. */
+#define LAPIC_ICR_HI 0x310              /* Interrupt command, high half. */
+#define LAPIC_LVT_TIMER 0x320           /* Timer local vector table entry. */
+#define LAPIC_TIMER_INIT 0x380          /* Timer initial count. */
+#define LAPIC_TIMER_CUR 0x390           /* Timer current count. */
+#define LAPIC_TIMER_DIV 0x3e0           /* Timer divide configuration. */
+
+#define SVR_ENABLE (1 << 8)             /* APIC software enable. */
+#define LVT_MASKED (1 << 16)            /* Interrupt masked. */
+#define LVT_TSC_DEADLINE (2 << 17)      /* TSC-deadline timer mode. */
+#define TIMER_DIV_1 0xb                 /* Count at the bus clock rate. */
+#define ICR_INIT (5 << 8)               /* INIT delivery mode. */
+#define ICR_STARTUP (6 << 8)            /* Start-up delivery mode. */
+#define ICR_PENDING (1 << 12)           /* Delivery status: send pending. */
+#define ICR_ASSERT (1 << 14)            /* Level: assert. */
+#define ICR_ALL_BUT_SELF (3 << 18)      /* Shorthand: all excluding self. */
+
+#define MSR_APIC_BASE 0x1b
+#define MSR_TSC_DEADLINE 0x6e0
+#define MSR_X2APIC_REGS 0x800           /* MSR of register offset 0. */
+#define APIC_BASE_X2APIC (1 << 10)
+#define APIC_BASE_ENABLE (1 << 11)
+#define APIC_BASE_ADDR 0xfffff000ULL
+
+#define CPUID_1_EDX_APIC (1 << 9)
+#define CPUID_1_ECX_X2APIC (1 << 21)
+#define CPUID_1_ECX_TSC_DEADLINE (1 << 24)
+
+static volatile uint32_t *lapic_regs;   /* Mapped registers, or NULL. */
+static bool x2apic;             /* Using x2APIC mode? */
+static bool tsc_deadline;       /* Using TSC-deadline mode? */
+static uint64_t tsc_hz;         /* TSC cycles per second. */
+static uint64_t count_hz;       /* Timer counts per second, one-shot mode. */
+
+static intr_handler_func spurious_interrupt;
+
+static inline uint32_t
+lapic_read (unsigned reg) {
+	if (x2apic)
+		return read_msr (MSR_X2APIC_REGS + reg / 16);
+	return lapic_regs[reg / sizeof *lapic_regs];
+}
+
+static inline void
+lapic_write (unsigned reg, uint32_t value) {
+	if (x2apic)
+		write_msr (MSR_X2APIC_REGS + reg / 16, value);
+	else
+		lapic_regs[reg / sizeof *lapic_regs] = value;
+}
+
+/* Sends the interrupt command ICR to the CPU whose local APIC ID
+   is APIC_ID, or as ICR's shorthand says, and waits for it to be
+   delivered.  In x2APIC mode the ICR is one 64-bit register and
+   the send is done when the write is. */
+static void
+write_icr (uint32_t apic_id, uint32_t icr) {
+	if (x2apic) {
+		write_msr (MSR_X2APIC_REGS + LAPIC_ICR_LO / 16,
+				(uint64_t) apic_id << 32 | icr);
+		return;
+	}
+	lapic_write (LAPIC_ICR_HI, apic_id << 24);
+	lapic_write (LAPIC_ICR_LO, icr);
+	while (lapic_read (LAPIC_ICR_LO) & ICR_PENDING)
+		continue;
+}
+
+/* Enables the running CPU's local APIC, in x2APIC mode if we use
+   it.  x2APIC mode can be entered only from xAPIC mode. */
+static void
+enable_apic (void) {
+	uint64_t base = read_msr (MSR_APIC_BASE) | APIC_BASE_ENABLE;
+
+	write_msr (MSR_APIC_BASE, base);
+	if (x2apic)
+		write_msr (MSR_APIC_BASE, base | APIC_BASE_X2APIC);
+}
+
+/* Maps and enables the local APIC and routes its timer to
+   TIMER_HANDLER.  TSC_HZ is the measured TSC rate.  Must be called
+   with interrupts on, since the one-shot rate is measured with a
+   short busy wait.  Returns false, leaving everything untouched,
+   if the CPU has no local APIC. */
+bool
+lapic_init (intr_handler_func *timer_handler, uint64_t tsc_hz_) {
+	uint32_t ecx, edx;
+	uint64_t base, *pte;
+
+	ASSERT (intr_get_level () == INTR_ON);
+	ASSERT (lapic_regs == NULL);
+
+	cpuid (1, NULL, NULL, &ecx, &edx);
+	if (!(edx & CPUID_1_EDX_APIC) || tsc_hz_ == 0)
+		return false;
+	tsc_hz = tsc_hz_;
+	tsc_deadline = (ecx & CPUID_1_ECX_TSC_DEADLINE) != 0;
+
+	/* Map the register page, uncached, into the kernel's half of
+	   the address space, which every page table shares.  x2APIC
+	   mode does not use it, but lapic_present() goes by it. */
+	base = read_msr (MSR_APIC_BASE) & APIC_BASE_ADDR;
+	pte = pml4e_walk (base_pml4, (uint64_t) ptov (base), 1);
+	if (pte == NULL)
+		return false;
+	*pte = base | PTE_P | PTE_W | PTE_G | PTE_PCD | PTE_PWT;
+	invlpg ((uint64_t) ptov (base));
+	x2apic = (ecx & CPUID_1_ECX_X2APIC) != 0;
+	enable_apic ();
+	lapic_regs = ptov (base);
+
+	intr_register_int (LAPIC_SPURIOUS_VEC, 0, INTR_OFF, spurious_interrupt,
+			"Local APIC Spurious");
+	intr_register_apic (LAPIC_TIMER_VEC, timer_handler, "Local APIC Timer");
+	lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+
+	if (!tsc_deadline) {
+		/* Count down, masked, for about 10 ms of TSC time. */
+		uint64_t start, elapsed;
+		uint32_t counted;
+
+		lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_1);
+		lapic_write (LAPIC_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VEC);
+		start = rdtsc ();
+		lapic_write (LAPIC_TIMER_INIT, UINT32_MAX);
+		while ((elapsed = rdtsc () - start) < tsc_hz / 100)
+			continue;
+		counted = UINT32_MAX - lapic_read (LAPIC_TIMER_CUR);
+		lapic_write (LAPIC_TIMER_INIT, 0);
+		count_hz = (uint64_t) counted * tsc_hz / elapsed;
+		lapic_write (LAPIC_LVT_TIMER, LAPIC_TIMER_VEC);
+	} else
+		lapic_write (LAPIC_LVT_TIMER, LVT_TSC_DEADLINE | LAPIC_TIMER_VEC);
+
+	if (x2apic)
+		printf ("Local APIC: x2APIC mode.\n");
+	if (tsc_deadline)
+		printf ("Local APIC timer: TSC-deadline mode.\n");
+	else
+		printf ("Local APIC timer: one-shot mode, %'"PRIu64" Hz.\n", count_hz);
+	return true;
+}
+
+/* Returns true if lapic_init() has set up the local APIC. */
+bool
+lapic_present (void) {
+	return lapic_regs != NULL;
+}
+
+/* Returns the running CPU's local APIC ID. */
+uint32_t
+lapic_id (void) {
+	ASSERT (lapic_present ());
+	return x2apic ? lapic_read (LAPIC_ID) : lapic_read (LAPIC_ID) >> 24;
+}
+
+/* Enables the local APIC of an application processor, which
+   lapic_init() on the bootstrap processor has already mapped. */
+void
+lapic_init_ap (void) {
+	ASSERT (lapic_present ());
+	enable_apic ();
+	lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+}
+
+/* Sends the command ICR to the other CPUs and waits for it to be
+   delivered. */
+static void
+send_ipi_others (uint32_t icr) {
+	write_icr (0, ICR_ALL_BUT_SELF | icr);
+}
+
+/* Starts all the other CPUs in real mode at physical address
+   ENTRY, which must be page-aligned and below 1 MB, by the
+   INIT-SIPI-SIPI sequence of [IA32-v3a] 8.4.4.1 "Typical BSP
+   Initialization Sequence". */
+void
+lapic_start_aps (uint32_t entry) {
+	ASSERT (lapic_present ());
+	ASSERT (entry % 4096 == 0 && entry < 0x100000);
+
+	send_ipi_others (ICR_INIT | ICR_ASSERT);
+	timer_msleep (10);
+	send_ipi_others (ICR_STARTUP | (entry >> 12));
+	timer_usleep (200);
+	send_ipi_others (ICR_STARTUP | (entry >> 12));
+	timer_usleep (200);
+}
+
+/* Sends fixed interrupt VEC to the CPU whose local APIC ID is
+   APIC_ID, and waits for it to be delivered.  Interrupts must be
+   off, so that nothing else on this CPU uses the ICR meanwhile. */
+void
+lapic_send_ipi (uint32_t apic_id, uint8_t vec) {
+	ASSERT (lapic_present ());
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	write_icr (apic_id, vec);
+}
+
+/* Acknowledges the interrupt being handled. */
+void
+lapic_eoi (void) {
+	lapic_write (LAPIC_EOI, 0);
+}
+
+/* Arms the timer to interrupt once, when the TSC reaches DEADLINE,
+   replacing any earlier arming.  A deadline in the past interrupts
+   right away. */
+void
+lapic_timer_arm (uint64_t deadline) {
+	ASSERT (lapic_present ());
+
+	if (tsc_deadline)
+		write_msr (MSR_TSC_DEADLINE, deadline);
+	else {
+		uint64_t now = rdtsc ();
+		uint64_t count = 1;
+
+		/* Deadlines more than a second out are cut to one second,
+		   keeping the product in range; the handler re-arms. */
+		if (deadline > now) {
+			uint64_t delta = deadline - now;
+			if (delta > tsc_hz)
+				delta = tsc_hz;
+			count = delta * count_hz / tsc_hz;
+		}
+		if (count == 0)
+			count = 1;
+		else if (count > UINT32_MAX)
+			count = UINT32_MAX;
+		lapic_write (LAPIC_TIMER_INIT, count);
+	}
+}
+
+/* Disarms the timer. */
+void
+lapic_timer_cancel (void) {
+	ASSERT (lapic_present ());
+
+	if (tsc_deadline)
+		write_msr (MSR_TSC_DEADLINE, 0);
+	else
+		lapic_write (LAPIC_TIMER_INIT, 0);
+}
+
+/* Spurious interrupts need no acknowledgment. */
+static void
+spurious_interrupt (struct intr_frame *f UNUSED) {
+}
@@ -0,0 +1,87 @@
+#include "devices/spsc.h"
+#include <debug.h>
+#include <string.h>
+
+static void copy_in (struct spsc *, size_t pos, const uint8_t *, size_t);
+static void copy_out (const struct spsc *, size_t pos, uint8_t *, size_t);
+
+/* Initializes Q to use the SIZE bytes in BUF, where SIZE is a
+   power of 2.  Q starts out empty. */
+void
+spsc_init (struct spsc *q, uint8_t *buf, size_t size) {
+	ASSERT (buf != NULL);
+	ASSERT (size > 0 && (size & (size - 1)) == 0);
+
+	q->buf = buf;
+	q->size = size;
+	q->head = q->tail = 0;
+}
+
+/* Returns the number of bytes in Q.  The other side may change
+   that at any moment, but only in its own direction, so the
+   consumer can get at least this many bytes, and the producer can
+   put at least spsc_room() bytes. */
+size_t
+spsc_count (const struct spsc *q) {
+	return __atomic_load_n (&q->head, __ATOMIC_ACQUIRE)
+		- __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Returns the number of bytes that could be put into Q. */
+size_t
+spsc_room (const struct spsc *q) {
+	return q->size - spsc_count (q);
+}
+
+/* Puts up to N bytes from BUF into Q, as many as fit, and returns
+   the number put.  Only the producer may call this. */
+size_t
+spsc_put (struct spsc *q, const uint8_t *buf, size_t n) {
+	size_t head = q->head;
+	size_t tail = __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE);
+	size_t room = q->size - (head - tail);
+
+	if (n > room)
+		n = room;
+	copy_in (q, head, buf, n);
+	__atomic_store_n (&q->head, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* Gets up to N bytes from Q into BUF, as many as there are, and
+   returns the number gotten.  Only the consumer may call this. */
+size_t
+spsc_get (struct spsc *q, uint8_t *buf, size_t n) {
+	size_t tail = q->tail;
+	size_t head = __atomic_load_n (&q->head, __ATOMIC_ACQUIRE);
+
+	if (n > head - tail)
+		n = head - tail;
+	copy_out (q, tail, buf, n);
+	__atomic_store_n (&q->tail, tail + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* Copies the N bytes in BUF into Q starting at free-running
+   position POS, in at most two pieces around the end of Q's
+   buffer. */
+static void
+copy_in (struct spsc *q, size_t pos, const uint8_t *buf, size_t n) {
+	size_t ofs = pos & (q->size - 1);
+	size_t first = n < q->size - ofs ? n : q->size - ofs;
+
+	memcpy (q->buf + ofs, buf, first);
+	memcpy (q->buf, buf + first, n - first);
+}
+
+/* Copies N bytes out of Q starting at free-running position POS
+   into BUF, in at most two pieces around the end of Q's
+   buffer. */
+static void
+copy_out (const struct spsc *q, size_t pos, uint8_t *buf, size_t n) {
+	size_t ofs = pos & (q->size - 1);
+	size_t first = n < q->size - ofs ? n : q->size - ofs;
+
+	memcpy (buf, q->buf + ofs, first);
+	memcpy (buf + first, q->buf, n - first);
+}
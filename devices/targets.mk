@@ -5,3 +5,6 @@ devices_SRC += devices/serial.c		# Serial port device.
 devices_SRC += devices/disk.c		# IDE disk device.
 devices_SRC += devices/input.c		# Serial and keyboard input.
 devices_SRC += devices/intq.c		# Interrupt queue.
+devices_SRC += devices/spsc.c		# Lock-free byte ring.
+devices_SRC += devices/lapic.c		# Local APIC timer.
+devices_SRC += devices/ioapic.c		# I/O APIC interrupt routing.
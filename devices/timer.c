@@ -1,12 +1,19 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "devices/lapic.h"
+#include "intrinsic.h"
+#include <vdso.h>
 
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -17,67 +24,248 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* Number of timer ticks since OS booted. */
+/* 8254 input clock, in Hz. */
+#define PIT_HZ 1193180
+
+/* 8254 counter value for one timer tick. */
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Largest number of ticks a single one-shot countdown can cover,
+   given the 8254's 16-bit counter. */
+#define PIT_MAX_TICKS (0xffff / PIT_TICK_COUNT)
+
+/* Number of timer ticks since OS booted.  Only catch_up()
+   writes it, and an aligned 64-bit store is atomic, so readers
+   load it without turning interrupts off. */
 static int64_t ticks;
 
+/* If true, the idle thread stops the periodic tick and programs a
+   one-shot countdown to the next sleeper's deadline instead.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* Number of ticks covered by the armed one-shot countdown, or 0
+   if the timer is in periodic mode. */
+static unsigned oneshot_ticks;
+
+/* Statistics. */
+static long long idle_periods;  /* # of one-shot countdowns armed. */
+static long long skipped_ticks; /* # of tick interrupts not taken. */
+static long long wake_passes;   /* # of passes that woke sleepers. */
+static long long wakeups;       /* # of sleepers woken by those passes. */
+static long long coalesced;     /* # of those woken inside their slack. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Loops per second to take instead of measuring them, or 0.  Set
+   by "-loops", from what an earlier boot printed. */
+uint64_t timer_loops_per_sec;
+
+/* Loops to time against the TSC, and times to time them. */
+#define LOOPS_SAMPLE (1u << 16)
+#define LOOPS_SAMPLE_RUNS 3
+
+/* Threads blocked in timer_sleep(), kept as a binary min-heap
+   ordered by wakeup deadline, so that the earliest deadline is
+   always sleepers[0].  A sleeper may be woken any time between its
+   wakeup tick and its deadline; they differ only for
+   timer_sleep_slack(), and SLACK_CNT counts such sleepers.  The
+   array is grown by timer_sleep() in thread context; the interrupt
+   handler only notices that sleepers are due and leaves waking
+   them to WAKE_SOFTIRQ.  Access with interrupts off. */
+static struct thread **sleepers;
+static size_t sleeper_cnt;      /* Number of threads in the heap. */
+static size_t sleeper_cap;      /* Number of slots in SLEEPERS. */
+static size_t slack_cnt;        /* Sleepers with a nonzero slack. */
+static struct softirq wake_softirq;
+
+/* Nanosecond clock and high-resolution sleeps.  timer_calibrate()
+   measures the TSC against the 8254; from then on timer_nsec()
+   reads the TSC, and timer_msleep() and friends block on
+   HR_SLEEPERS, a heap whose maximum is the earliest TSC deadline,
+   served by the local APIC timer.  Sleeps too short to be worth a
+   context switch spin on the TSC instead.  Access HR_SLEEPERS with
+   interrupts off.  The TSC fields below change together, under
+   CLOCK_SEQ, which timer_nsec() retries on, as user processes do
+   on their copy (see vdso_update()). */
+#define NSEC_PER_SEC 1000000000LL
+#define TSC_CALIBRATE_TICKS 5   /* Ticks to measure the TSC over. */
+#define HR_SPIN_NS 20000        /* Spin, rather than block, below this. */
+static uint64_t tsc_hz;         /* TSC cycles per second, or 0. */
+static uint64_t tsc_epoch;      /* TSC when calibration started. */
+static int64_t tsc_epoch_ns;    /* timer_nsec() at TSC_EPOCH. */
+static uint64_t ns_per_cycle;   /* Nanoseconds per TSC cycle, 32.32. */
+static uint64_t cycles_per_ns;  /* TSC cycles per nanosecond, 40.24. */
+static uint32_t clock_seq;      /* Update count of the above; odd
+                                   during one. */
+static bool hrtimer_ready;      /* Local APIC timer set up? */
+static struct heap hr_sleepers;
+
+/* Where user processes read the clock, or NULL.  See
+   timer_publish(). */
+static struct vdso_time *vdso_time;
+
 static intr_handler_func timer_interrupt;
+static void pit_program (uint8_t control, uint16_t count);
+static void catch_up (unsigned elapsed);
+static softirq_func wake_sleepers;
+static bool wake_due (void);
+static bool sleepers_reserve (void);
+static void sleepers_push (struct thread *);
+static struct thread *sleepers_remove (size_t i);
+static inline void sleepers_set (size_t i, struct thread *);
+static unsigned loops_by_trial (void);
+static unsigned loops_from_tsc (void);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void calibrate_tsc (void);
+static void hr_sleep (int64_t ns);
+static intr_handler_func hrtimer_interrupt;
+static heap_less_func hr_later;
+static void vdso_update (void);
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
    corresponding interrupt. */
 void
 timer_init (void) {
-	/* 8254 input frequency divided by TIMER_FREQ, rounded to
-	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
-
-	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-	outb (0x40, count & 0xff);
-	outb (0x40, count >> 8);
-
+	pit_program (0x34, PIT_TICK_COUNT);
+	softirq_init (&wake_softirq, wake_sleepers, NULL);
 	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates loops_per_tick, used to implement brief delays, and
+   the TSC.  Once the TSC is measured, timing a short run of loops
+   against it takes microseconds, where finding loops_per_tick by
+   trial waits out a tick per trial. */
 void
 timer_calibrate (void) {
-	unsigned high_bit, test_bit;
-
 	ASSERT (intr_get_level () == INTR_ON);
 	printf ("Calibrating timer...  ");
 
-	/* Approximate loops_per_tick as the largest power-of-two
-	   still less than one timer tick. */
-	loops_per_tick = 1u << 10;
-	while (!too_many_loops (loops_per_tick << 1)) {
-		loops_per_tick <<= 1;
-		ASSERT (loops_per_tick != 0);
-	}
-
-	/* Refine the next 8 bits of loops_per_tick. */
-	high_bit = loops_per_tick;
-	for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
-		if (!too_many_loops (high_bit | test_bit))
-			loops_per_tick |= test_bit;
+	calibrate_tsc ();
+	if (timer_loops_per_sec / TIMER_FREQ != 0)
+		loops_per_tick = timer_loops_per_sec / TIMER_FREQ > UINT_MAX
+			? UINT_MAX : timer_loops_per_sec / TIMER_FREQ;
+	else if (tsc_hz != 0)
+		loops_per_tick = loops_from_tsc ();
+	else
+		loops_per_tick = loops_by_trial ();
 
 	printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+	if (tsc_hz != 0)
+		printf ("TSC: %'"PRIu64" Hz.\n", tsc_hz);
+
+	heap_init (&hr_sleepers);
+	hrtimer_ready = lapic_init (hrtimer_interrupt, tsc_hz);
+}
+
+/* Measures the TSC rate over TSC_CALIBRATE_TICKS timer ticks and
+   switches timer_nsec() over to the TSC. */
+static void
+calibrate_tsc (void) {
+	int64_t start = timer_ticks ();
+	enum intr_level old_level;
+	uint64_t tsc_start, hz;
+
+	/* Start on a tick boundary. */
+	while (timer_ticks () == start)
+		continue;
+	start++;
+	tsc_start = rdtsc ();
+	while (timer_ticks () < start + TSC_CALIBRATE_TICKS)
+		continue;
+	hz = (rdtsc () - tsc_start) * TIMER_FREQ / TSC_CALIBRATE_TICKS;
+	if (hz == 0)
+		return;
+
+	/* With interrupts off, no reader can interrupt the update on
+	   this CPU and spin on it. */
+	old_level = intr_disable ();
+	__atomic_store_n (&clock_seq, clock_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	ns_per_cycle = ((uint64_t) NSEC_PER_SEC << 32) / hz;
+	cycles_per_ns = (hz << 24) / NSEC_PER_SEC;
+	tsc_epoch_ns = start * (NSEC_PER_SEC / TIMER_FREQ);
+	tsc_epoch = tsc_start;
+	tsc_hz = hz;
+	__atomic_store_n (&clock_seq, clock_seq + 1, __ATOMIC_RELEASE);
+	vdso_update ();
+	intr_set_level (old_level);
 }
 
-/* Returns the number of timer ticks since the OS booted. */
+/* Returns the number of nanoseconds since the OS booted, with
+   TSC resolution once timer_calibrate() has run and timer-tick
+   resolution before. */
 int64_t
-timer_ticks (void) {
+timer_nsec (void) {
+	uint64_t hz, epoch, mult;
+	int64_t epoch_ns;
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n (&clock_seq, __ATOMIC_ACQUIRE);
+		hz = tsc_hz;
+		epoch = tsc_epoch;
+		epoch_ns = tsc_epoch_ns;
+		mult = ns_per_cycle;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	} while ((seq & 1) != 0
+			|| __atomic_load_n (&clock_seq, __ATOMIC_RELAXED) != seq);
+
+	if (hz == 0)
+		return timer_ticks () * (NSEC_PER_SEC / TIMER_FREQ);
+	return epoch_ns
+		+ (int64_t) (((unsigned __int128) (rdtsc () - epoch) * mult) >> 32);
+}
+
+/* Converts CYCLES of the TSC to nanoseconds.  Returns 0 until
+   timer_calibrate() has measured the TSC. */
+int64_t
+timer_cycles_to_ns (uint64_t cycles) {
+	return ((unsigned __int128) cycles * ns_per_cycle) >> 32;
+}
+
+/* Has the clock kept in V from now on, for user processes to read
+   without a system call.  V must stay allocated. */
+void
+timer_publish (struct vdso_time *v) {
 	enum intr_level old_level = intr_disable ();
-	int64_t t = ticks;
+	vdso_time = v;
+	vdso_update ();
 	intr_set_level (old_level);
+}
+
+/* Copies the clock to VDSO_TIME, if set, under its sequence count.
+   Interrupts must be off, so that only a user reader can see the
+   update half done, and it retries. */
+static void
+vdso_update (void) {
+	struct vdso_time *v = vdso_time;
+
+	if (v == NULL)
+		return;
+	v->seq++;
 	barrier ();
-	return t;
+	v->tick_freq = TIMER_FREQ;
+	v->ticks = ticks;
+	v->tsc_hz = tsc_hz;
+	v->tsc_epoch = tsc_epoch;
+	v->tsc_epoch_ns = tsc_epoch_ns;
+	v->ns_per_cycle = ns_per_cycle;
+	barrier ();
+	v->seq++;
+}
+
+/* Returns the number of timer ticks since the OS booted.  Safe
+   to call from any CPU and in any context, with interrupts on or
+   off. */
+int64_t
+timer_ticks (void) {
+	return __atomic_load_n (&ticks, __ATOMIC_ACQUIRE);
 }
 
 /* Returns the number of timer ticks elapsed since THEN, which
@@ -87,45 +275,506 @@ timer_elapsed (int64_t then) {
 	return timer_ticks () - then;
 }
 
-/* Suspends execution for approximately TICKS timer ticks. */
+/* Suspends execution for approximately TICKS timer ticks.
+   The calling thread is blocked until the timer interrupt that
+   reaches its wakeup tick, rather than being rescheduled over
+   and over to poll the clock. */
 void
 timer_sleep (int64_t ticks) {
+	timer_sleep_slack (ticks, 0);
+}
+
+/* Suspends execution for at least TICKS and at most TICKS + SLACK
+   timer ticks.  The timer only has to wake the caller by the end
+   of that window, and does so in the same pass as any other
+   sleeper that is due once the caller's window has opened, so
+   threads with loose, nearby deadlines share one wakeup instead
+   of each taking their own. */
+void
+timer_sleep_slack (int64_t ticks, int64_t slack) {
 	int64_t start = timer_ticks ();
+	struct thread *t = thread_current ();
 
 	ASSERT (intr_get_level () == INTR_ON);
-	while (timer_elapsed (start) < ticks)
-		thread_yield ();
+	ASSERT (slack >= 0);
+	if (ticks <= 0)
+		return;
+
+	if (!sleepers_reserve ()) {
+		/* Out of memory for the sleep queue: fall back to polling. */
+		while (timer_elapsed (start) < ticks)
+			thread_yield ();
+		return;
+	}
+
+	/* sleepers_reserve() returns with interrupts off and a free
+	   slot in the heap. */
+	t->wakeup_tick = start + ticks;
+	t->wakeup_deadline = t->wakeup_tick + slack;
+	if (slack > 0)
+		slack_cnt++;
+	sleepers_push (t);
+	thread_block ();
+	intr_enable ();
+}
+
+/* Makes room in the sleep queue for a following timer_block() and
+   returns true with interrupts off, so that the caller can check
+   its wakeup condition and block without racing the event.
+   Returns false, with interrupts unchanged, if out of memory.
+   Must be called with interrupts on. */
+bool
+timer_reserve (void) {
+	ASSERT (intr_get_level () == INTR_ON);
+	return sleepers_reserve ();
+}
+
+/* Blocks the current thread until some other thread or handler
+   unblocks it, or until TICKS timer ticks pass, whichever comes
+   first.  A waker other than the timer must take the thread off
+   the sleep queue with timer_cancel() before unblocking it.  Must
+   be called with interrupts off, after timer_reserve() and with
+   no intervening sleep. */
+void
+timer_block (int64_t ticks) {
+	struct thread *t = thread_current ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (ticks > 0);
+
+	t->wakeup_tick = t->wakeup_deadline = ticks + timer_ticks ();
+	sleepers_push (t);
+	thread_block ();
+}
+
+/* Takes T, blocked in timer_block(), off the sleep queue.  Returns
+   false if the timer has already woken T.  Interrupts must be
+   off. */
+bool
+timer_cancel (struct thread *t) {
+	size_t i = t->sleep_idx;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (i >= sleeper_cnt || sleepers[i] != t)
+		return false;
+	if (t->wakeup_deadline != t->wakeup_tick)
+		slack_cnt--;
+	sleepers_remove (i);
+	return true;
 }
 
 /* Suspends execution for approximately MS milliseconds. */
 void
 timer_msleep (int64_t ms) {
-	real_time_sleep (ms, 1000);
+	if (hrtimer_ready)
+		hr_sleep (ms * 1000 * 1000);
+	else
+		real_time_sleep (ms, 1000);
 }
 
 /* Suspends execution for approximately US microseconds. */
 void
 timer_usleep (int64_t us) {
-	real_time_sleep (us, 1000 * 1000);
+	if (hrtimer_ready)
+		hr_sleep (us * 1000);
+	else
+		real_time_sleep (us, 1000 * 1000);
 }
 
 /* Suspends execution for approximately NS nanoseconds. */
 void
 timer_nsleep (int64_t ns) {
-	real_time_sleep (ns, 1000 * 1000 * 1000);
+	if (hrtimer_ready)
+		hr_sleep (ns);
+	else
+		real_time_sleep (ns, 1000 * 1000 * 1000);
+}
+
+/* Sleeps for NS nanoseconds against the TSC, blocking until the
+   local APIC timer fires unless NS is under HR_SPIN_NS. */
+static void
+hr_sleep (int64_t ns) {
+	struct thread *t = thread_current ();
+	enum intr_level old_level;
+	uint64_t deadline;
+
+	ASSERT (intr_get_level () == INTR_ON);
+	if (ns <= 0)
+		return;
+
+	deadline = rdtsc ()
+		+ (uint64_t) (((unsigned __int128) ns * cycles_per_ns) >> 24);
+	if (ns < HR_SPIN_NS) {
+		while (rdtsc () < deadline)
+			continue;
+		return;
+	}
+
+	old_level = intr_disable ();
+	t->wakeup_tsc = deadline;
+	heap_insert (&hr_sleepers, &t->hr_elem, hr_later, NULL);
+	if (heap_max (&hr_sleepers) == &t->hr_elem)
+		lapic_timer_arm (deadline);
+	thread_block ();
+	intr_set_level (old_level);
+}
+
+/* Local APIC timer interrupt handler.  Wakes the high-resolution
+   sleepers that are due and re-arms for the next one. */
+static void
+hrtimer_interrupt (struct intr_frame *args UNUSED) {
+	uint64_t now = rdtsc ();
+	bool preempt = false;
+
+	while (!heap_empty (&hr_sleepers)) {
+		struct thread *t = heap_entry (heap_max (&hr_sleepers),
+				struct thread, hr_elem);
+		if (t->wakeup_tsc > now) {
+			lapic_timer_arm (t->wakeup_tsc);
+			break;
+		}
+		heap_pop_max (&hr_sleepers, hr_later, NULL);
+		thread_unblock (t);
+		if (thread_outranks (t, thread_current ()))
+			preempt = true;
+	}
+	if (preempt)
+		intr_yield_on_return ();
+}
+
+/* Orders high-resolution sleepers so that the earliest deadline
+   is the heap's maximum. */
+static bool
+hr_later (const struct heap_elem *a, const struct heap_elem *b,
+		void *aux UNUSED) {
+	return heap_entry (a, struct thread, hr_elem)->wakeup_tsc
+		> heap_entry (b, struct thread, hr_elem)->wakeup_tsc;
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  In tickless mode, replaces the periodic tick by a single
+   countdown that expires at the earliest sleeper's deadline, or as
+   far out as the 8254 allows if nobody is sleeping. */
+void
+timer_idle_enter (void) {
+	int64_t delta = PIT_MAX_TICKS;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (!timer_tickless || oneshot_ticks != 0)
+		return;
+
+	if (sleeper_cnt > 0 && sleepers[0]->wakeup_deadline - ticks < delta)
+		delta = sleepers[0]->wakeup_deadline - ticks;
+	if (delta <= 1)
+		return;
+
+	oneshot_ticks = delta;
+	idle_periods++;
+	pit_program (0x30, PIT_TICK_COUNT * delta);
+}
+
+/* Called by the idle thread, with interrupts off, after it wakes
+   up.  If the wakeup came from some other interrupt before the
+   countdown expired, accounts for the whole ticks that have
+   passed and goes back to the periodic tick. */
+void
+timer_idle_exit (void) {
+	unsigned remaining, elapsed;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (oneshot_ticks == 0)
+		return;
+
+	/* Latch and read counter 0. */
+	outb (0x43, 0x00);
+	remaining = inb (0x40);
+	remaining |= inb (0x40) << 8;
+
+	elapsed = (PIT_TICK_COUNT * oneshot_ticks - remaining) / PIT_TICK_COUNT;
+	if (elapsed > oneshot_ticks)
+		elapsed = oneshot_ticks;
+	oneshot_ticks = 0;
+	pit_program (0x34, PIT_TICK_COUNT);
+	catch_up (elapsed);
 }
 
 /* Prints timer statistics. */
 void
 timer_print_stats (void) {
 	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+	if (timer_tickless)
+		printf ("Timer: %lld idle countdowns, %lld tick interrupts skipped\n",
+				idle_periods, skipped_ticks);
+	if (wake_passes > 0)
+		printf ("Timer: %lld wakeups in %lld passes (%lld.%02lld per pass), "
+				"%lld coalesced\n", wakeups, wake_passes,
+				wakeups / wake_passes, wakeups * 100 / wake_passes % 100,
+				coalesced);
+}
+
+/* Writes CONTROL to the 8254 control word register and then COUNT
+   to counter 0, LSB first. */
+static void
+pit_program (uint8_t control, uint16_t count) {
+	outb (0x43, control);
+	outb (0x40, count & 0xff);
+	outb (0x40, count >> 8);
 }
 
-/* Timer interrupt handler. */
+/* Timer interrupt handler.  Only the earliest deadline in the
+   sleep queue is examined unless some sleeper is due, so a tick
+   with nothing to wake costs O(1). */
+static void
+timer_interrupt (struct intr_frame *f) {
+	profile_tick (f);
+	if (oneshot_ticks != 0) {
+		/* The idle countdown expired: go back to the periodic tick
+		   and account for every tick it covered. */
+		unsigned elapsed = oneshot_ticks;
+		oneshot_ticks = 0;
+		pit_program (0x34, PIT_TICK_COUNT);
+		catch_up (elapsed);
+	} else
+		catch_up (1);
+}
+
+/* Advances the clock by ELAPSED ticks, running the scheduler's
+   per-tick work from the interrupt handler exactly as if each
+   tick had raised its own interrupt, and wakes the sleepers that
+   are due: from the handler via WAKE_SOFTIRQ, with interrupts on,
+   otherwise right away.  Outside interrupt context
+   (timer_idle_exit()) only the idle thread is running, and it is
+   about to reschedule anyway. */
+static void
+catch_up (unsigned elapsed) {
+	bool in_handler = intr_context ();
+
+	if (elapsed > 1)
+		skipped_ticks += elapsed - 1;
+	while (elapsed-- > 0) {
+		__atomic_store_n (&ticks, ticks + 1, __ATOMIC_RELEASE);
+		if (in_handler)
+			thread_tick ();
+	}
+	vdso_update ();
+
+	if (sleeper_cnt > 0 && sleepers[0]->wakeup_deadline <= ticks) {
+		if (in_handler)
+			softirq_raise (&wake_softirq);
+		else
+			wake_due ();
+	}
+}
+
+/* Softirq that wakes every sleeper that is due and yields on
+   return from the interrupt if one of them outranks the running
+   thread. */
+static void
+wake_sleepers (void *aux UNUSED) {
+	if (wake_due ())
+		intr_yield_on_return ();
+}
+
+/* Wakes T, which has just been taken off the sleep queue, and
+   returns true if it outranks the running thread.  Interrupts
+   must be off. */
+static bool
+wake_one (struct thread *t) {
+	if (t->wakeup_deadline != t->wakeup_tick) {
+		slack_cnt--;
+		if (t->wakeup_deadline > ticks)
+			coalesced++;
+	}
+	wakeups++;
+	thread_unblock (t);
+	return thread_outranks (t, thread_current ());
+}
+
+/* Wakes every sleeper whose deadline has passed.  Interrupts are
+   turned off only around each wakeup.  If any sleeper was woken,
+   the same pass then sweeps the queue once for sleepers with slack
+   whose window has already opened, so they do not each need a
+   pass of their own later.  Returns true if a woken thread has a
+   higher priority than the running one. */
+static bool
+wake_due (void) {
+	bool preempt = false;
+	bool woke = false;
+	enum intr_level old_level;
+	size_t i;
+
+	for (;;) {
+		struct thread *t = NULL;
+
+		old_level = intr_disable ();
+		if (sleeper_cnt > 0 && sleepers[0]->wakeup_deadline <= ticks) {
+			t = sleepers_remove (0);
+			preempt |= wake_one (t);
+			woke = true;
+		}
+		intr_set_level (old_level);
+		if (t == NULL)
+			break;
+	}
+	if (!woke)
+		return preempt;
+
+	/* Removing sleepers[I] only moves entries we have already kept
+	   into slots at or after I, except for the one ancestor that a
+	   sift-up may drop into slot I itself, so looking at slot I
+	   again after each removal visits every sleeper. */
+	old_level = intr_disable ();
+	wake_passes++;
+	for (i = sleeper_cnt; slack_cnt > 0 && i-- > 0; )
+		while (i < sleeper_cnt && sleepers[i]->wakeup_tick <= ticks)
+			preempt |= wake_one (sleepers_remove (i));
+	intr_set_level (old_level);
+	return preempt;
+}
+
+/* Makes sure the sleep queue has room for one more thread and
+   returns true with interrupts disabled.  Returns false, with
+   interrupts unchanged, if memory for a larger queue cannot be
+   allocated.  Must be called with interrupts on. */
+static bool
+sleepers_reserve (void) {
+	for (;;) {
+		struct thread **new_heap, **old_heap;
+		size_t new_cap;
+
+		intr_disable ();
+		if (sleeper_cnt < sleeper_cap)
+			return true;
+		new_cap = sleeper_cap != 0 ? sleeper_cap * 2 : 16;
+		intr_enable ();
+
+		new_heap = malloc (new_cap * sizeof *new_heap);
+		if (new_heap == NULL)
+			return false;
+
+		/* Another thread may have grown the heap while we were
+		   allocating, so only install ours if it is still bigger. */
+		old_heap = new_heap;
+		intr_disable ();
+		if (new_cap > sleeper_cap) {
+			memcpy (new_heap, sleepers, sleeper_cnt * sizeof *sleepers);
+			old_heap = sleepers;
+			sleepers = new_heap;
+			sleeper_cap = new_cap;
+		}
+		intr_enable ();
+		free (old_heap);
+	}
+}
+
+/* Returns true if sleeper A must wake up before sleeper B. */
+static inline bool
+sleeper_before (const struct thread *a, const struct thread *b) {
+	return a->wakeup_deadline < b->wakeup_deadline;
+}
+
+/* Stores T in slot I of the sleep queue. */
+static inline void
+sleepers_set (size_t i, struct thread *t) {
+	sleepers[i] = t;
+	t->sleep_idx = i;
+}
+
+/* Inserts T into the sleep queue, which must have a free slot.
+   Interrupts must be off. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED) {
-	ticks++;
-	thread_tick ();
+sleepers_push (struct thread *t) {
+	size_t i;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (sleeper_cnt < sleeper_cap);
+
+	for (i = sleeper_cnt++; i > 0; i = (i - 1) / 2) {
+		struct thread *parent = sleepers[(i - 1) / 2];
+		if (!sleeper_before (t, parent))
+			break;
+		sleepers_set (i, parent);
+	}
+	sleepers_set (i, t);
+}
+
+/* Removes and returns sleepers[I], which must exist.  Interrupts
+   must be off. */
+static struct thread *
+sleepers_remove (size_t i) {
+	struct thread *victim, *last;
+	size_t child;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (i < sleeper_cnt);
+
+	victim = sleepers[i];
+	last = sleepers[--sleeper_cnt];
+	if (i == sleeper_cnt)
+		return victim;
+
+	/* LAST may belong either above or below slot I. */
+	for (; i > 0 && sleeper_before (last, sleepers[(i - 1) / 2]);
+			i = (i - 1) / 2)
+		sleepers_set (i, sleepers[(i - 1) / 2]);
+	for (; (child = 2 * i + 1) < sleeper_cnt; i = child) {
+		if (child + 1 < sleeper_cnt
+				&& sleeper_before (sleepers[child + 1], sleepers[child]))
+			child++;
+		if (!sleeper_before (sleepers[child], last))
+			break;
+		sleepers_set (i, sleepers[child]);
+	}
+	sleepers_set (i, last);
+	return victim;
+}
+
+/* Finds loops_per_tick by trial: the largest number of loops,
+   to 9 significant bits, that runs within one timer tick. */
+static unsigned
+loops_by_trial (void) {
+	unsigned loops, high_bit, test_bit;
+
+	/* Approximate loops_per_tick as the largest power-of-two
+	   still less than one timer tick. */
+	loops = 1u << 10;
+	while (!too_many_loops (loops << 1)) {
+		loops <<= 1;
+		ASSERT (loops != 0);
+	}
+
+	/* Refine the next 8 bits of loops_per_tick. */
+	high_bit = loops;
+	for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
+		if (!too_many_loops (high_bit | test_bit))
+			loops |= test_bit;
+	return loops;
+}
+
+/* Derives loops_per_tick from the TSC, which must be calibrated,
+   by timing LOOPS_SAMPLE loops.  Interrupts are off while timing,
+   so that no handler runs in the middle, and the fastest of a few
+   runs counts, as the trials in loops_by_trial() would. */
+static unsigned
+loops_from_tsc (void) {
+	uint64_t best = UINT64_MAX;
+	uint64_t loops;
+	int i;
+
+	for (i = 0; i < LOOPS_SAMPLE_RUNS; i++) {
+		enum intr_level old_level = intr_disable ();
+		uint64_t start = rdtsc ();
+		uint64_t cycles;
+
+		busy_wait (LOOPS_SAMPLE);
+		cycles = rdtsc () - start;
+		intr_set_level (old_level);
+		if (cycles < best)
+			best = cycles;
+	}
+
+	loops = (uint64_t) LOOPS_SAMPLE * (tsc_hz / TIMER_FREQ) / (best ? best : 1);
+	return loops == 0 ? 1 : loops > UINT_MAX ? UINT_MAX : loops;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -133,17 +782,16 @@ timer_interrupt (struct intr_frame *args UNUSED) {
 static bool
 too_many_loops (unsigned loops) {
 	/* Wait for a timer tick. */
-	int64_t start = ticks;
-	while (ticks == start)
-		barrier ();
+	int64_t start = timer_ticks ();
+	while (timer_ticks () == start)
+		continue;
 
 	/* Run LOOPS loops. */
-	start = ticks;
+	start = timer_ticks ();
 	busy_wait (loops);
 
 	/* If the tick count changed, we iterated too long. */
-	barrier ();
-	return start != ticks;
+	return start != timer_ticks ();
 }
 
 /* Iterates through a simple loop LOOPS times, for implementing
@@ -20,11 +20,15 @@ static size_t cx, cy;
 /* Attribute value for gray text on a black background. */
 #define GRAY_ON_BLACK 0x07
 
+/* Four blank cells, as one word of framebuffer. */
+#define BLANK_CELLS (0x0001000100010001ull * (GRAY_ON_BLACK << 8 | ' '))
+
 /* Framebuffer.  See [FREEVGA] under "VGA Text Mode Operation".
    The character at (x,y) is fb[y][x][0].
    The attribute at (x,y) is fb[y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
 
+static void put (int c);
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
@@ -52,7 +56,41 @@ vga_putc (int c) {
 	enum intr_level old_level = intr_disable ();
 
 	init ();
+	put (c);
+
+	/* Update cursor position. */
+	move_cursor ();
+
+	intr_set_level (old_level);
+}
+
+/* Writes the N characters in BUF to the VGA text display, as
+   vga_putc() would each in turn, but moves the hardware cursor,
+   which costs two port writes, only once at the end.  Each
+   character is read with interrupts as the caller had them, so
+   BUF may be user memory that has yet to fault in. */
+void
+vga_putbuf (const char *buf, size_t n) {
+	enum intr_level old_level;
+
+	for (size_t i = 0; i < n; i++) {
+		char c = buf[i];
+
+		old_level = intr_disable ();
+		init ();
+		put (c);
+		intr_set_level (old_level);
+	}
+	old_level = intr_disable ();
+	init ();
+	move_cursor ();
+	intr_set_level (old_level);
+}
 
+/* Puts C on the display and advances the cursor position, without
+   moving the hardware cursor.  Interrupts must be off. */
+static void
+put (int c) {
 	switch (c) {
 		case '\n':
 			newline ();
@@ -84,14 +122,10 @@ vga_putc (int c) {
 				newline ();
 			break;
 	}
-
-	/* Update cursor position. */
-	move_cursor ();
-
-	intr_set_level (old_level);
 }
-
-/* Clears the screen and moves the cursor to the upper left. */
+
+/* Clears the screen and moves the cursor to the upper left,
+   leaving the hardware cursor for the caller to move. */
 static void
 cls (void) {
 	size_t y;
@@ -100,19 +134,16 @@ cls (void) {
 		clear_row (y);
 
 	cx = cy = 0;
-	move_cursor ();
 }
 
-/* Clears row Y to spaces. */
+/* Clears row Y to spaces, four cells at a time. */
 static void
 clear_row (size_t y) {
-	size_t x;
+	uint64_t *row = (uint64_t *) fb[y];
+	size_t i;
 
-	for (x = 0; x < COL_CNT; x++)
-	{
-		fb[y][x][0] = ' ';
-		fb[y][x][1] = GRAY_ON_BLACK;
-	}
+	for (i = 0; i < sizeof fb[y] / sizeof *row; i++)
+		row[i] = BLANK_CELLS;
 }
 
 /* Advances the cursor to the first column in the next line on
@@ -125,6 +156,7 @@ newline (void) {
 	if (cy >= ROW_CNT)
 	{
 		cy = ROW_CNT - 1;
+		/* memmove() copies a word at a time. */
 		memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
 		clear_row (ROW_CNT - 1);
 	}
@@ -0,0 +1,1039 @@
+/* Buffer cache for file system sectors.
+
+   Inode reads and writes go through a fixed pool of CACHE_SECTORS
+   sector-sized blocks instead of going to the disk each time.  A
+   hash table maps sector numbers to blocks.  A write only marks
+   its block dirty.  The data reaches the disk when the block is
+   evicted or when cache_flush runs, so many small writes to one
+   sector cost a single disk write.
+
+   Replacement is 2Q, so that one large scan cannot flush the hot
+   blocks.  A sector read in for the first time goes on the
+   probation FIFO.  While that holds more than a quarter of the
+   cache, its oldest block is evicted first, however often it was
+   used meanwhile, and its sector is remembered in a ring of ghost
+   entries.  A sector missed again while it is still a ghost has
+   proven itself: it joins the main set, from which the clock
+   algorithm evicts.  The hand sweeps the blocks, clears each
+   accessed bit it passes, and evicts the first block whose bit is
+   already clear.
+
+   CACHE_LOCK guards the index, the clock hand, the probation FIFO,
+   the ghosts, and each block's
+   sector, pin count and flags.  Each block's own LOCK guards its
+   data.  Only a thread that has pinned the block takes that lock,
+   so a block with no pins can be evicted.  Disk I/O runs without
+   CACHE_LOCK held.  A dirty victim is written back while it is
+   still in the index, so no one can read a stale copy of its
+   sector from the disk in the meantime.  A block that has just
+   been indexed is filled while its LOCK is held, so its readers
+   wait for the data.
+
+   Sequential readers also queue sectors they will soon want with
+   cache_readahead().  A kernel thread reads those into the cache
+   in the background, so the reader finds them there instead of
+   waiting on the disk.  Blocks read ahead are marked PREFETCHED
+   until first used.  One that is the oldest on probation, still
+   unused after a whole queue's worth more has been read ahead, was
+   a wrong guess, and goes before any other block.
+
+   A flusher thread writes dirty blocks behind the writers: every
+   FLUSH_INTERVAL, and as soon as half the cache is dirty.  It
+   writes them in sector order, so one pass is one sweep of the
+   disk head, and eviction seldom has to wait for a write.
+
+   The metadata journal holds the blocks it logs with
+   cache_write_held().  A held block is neither evicted nor written
+   back until the journal has committed it and calls
+   cache_release(), so its sector on disk never runs ahead of the
+   journal.  Writers set TXN with the block's LOCK held, so a write
+   back that finds TXN clear under that lock copies data the
+   journal has not yet claimed.
+
+   A dirty block written with cache_write_owned() also sits on its
+   owner's list until it is cleaned, so that fsync() can flush one
+   file's blocks by walking that list. */
+
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/counter.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* One cached sector. */
+struct cache_block {
+	struct hash_elem elem;      /* Element in CACHE_INDEX, if VALID. */
+	disk_sector_t sector;       /* Sector held, if VALID. */
+	bool valid;                 /* Holds a sector? */
+	bool accessed;              /* Used since the hand last passed? */
+	bool probation;             /* On PROBATION, not in the main set? */
+	bool prefetched;            /* Read ahead and not used since? */
+	long long ra_seq;           /* READAHEAD_CNT when read ahead. */
+	struct list_elem fifo_elem; /* Element in PROBATION. */
+	bool dirty;                 /* Newer than the disk? */
+	int pins;                   /* Threads using or waiting for DATA. */
+	unsigned txn;               /* Journal transaction holding it, or 0. */
+	struct cache_owner *owner;  /* Owner while dirty, or null. */
+	struct list_elem owner_elem; /* Element in OWNER's list. */
+	struct lock lock;           /* Guards DATA. */
+	uint8_t *data;              /* DISK_SECTOR_SIZE bytes. */
+};
+
+size_t cache_sectors = 64;
+
+static struct cache_block *blocks;  /* CACHE_SECTORS blocks, or null. */
+static struct hash cache_index;     /* Sector to block. */
+static struct lock cache_lock;
+static struct condition cache_unpinned; /* Signaled when PINS drops to 0. */
+static size_t clock_hand;
+
+/* 2Q: blocks seen once, oldest first, and the sectors of those
+   recently evicted from it. */
+static struct list probation;
+static size_t probation_cnt;
+static size_t probation_max;        /* Quarter of the cache. */
+struct cache_ghost {
+	struct hash_elem elem;      /* Element in GHOST_INDEX, if USED. */
+	disk_sector_t sector;
+	bool used;
+};
+static struct cache_ghost *ghosts;  /* Ring of GHOST_CNT entries. */
+static size_t ghost_cnt, ghost_next;
+static struct hash ghost_index;     /* Sector to ghost. */
+
+/* Sectors for partial transfers while the cache is off, so that
+   small reads and writes need no bounce buffer of their own.
+   SCRATCH_SEMA counts the free ones; SCRATCH_BUSY is guarded by
+   CACHE_LOCK.  Reads proceed in parallel, but the read-modify-write
+   of a partial write holds SCRATCH_WRITE_LOCK so that two writers
+   to one sector cannot undo each other. */
+#define SCRATCH_CNT 4
+static uint8_t scratch[SCRATCH_CNT][DISK_SECTOR_SIZE];
+static bool scratch_busy[SCRATCH_CNT];
+static struct semaphore scratch_sema;
+static struct lock scratch_write_lock;
+
+/* Sectors waiting for the read-ahead thread, in a ring of
+   RA_QUEUE entries guarded by CACHE_LOCK.  Requests that find it
+   full are dropped: read-ahead is only a hint. */
+#define RA_QUEUE 64
+static disk_sector_t ra_queue[RA_QUEUE];
+static size_t ra_head, ra_cnt;
+static struct condition ra_ready;   /* Signaled when RA_CNT grows. */
+static bool ra_running;             /* Read-ahead thread started? */
+
+/* Adjacent sectors moved with one disk command, through a bounce
+   page, by the read-ahead thread and by flush passes.  Runs stay
+   short next to the cache size, so that a run's pins never starve
+   the clock. */
+#define RUN_MAX (PGSIZE / DISK_SECTOR_SIZE)
+static size_t run_max;              /* Run length in use, at most RUN_MAX. */
+static uint8_t *ra_buf;             /* Read-ahead bounce page. */
+static uint8_t *flush_buf;          /* Flush bounce page, under FLUSH_LOCK. */
+
+/* Write-behind.  DIRTY_CNT counts dirty blocks and is guarded by
+   CACHE_LOCK; FLUSH_LOCK serializes users of FLUSH_LIST. */
+#define FLUSH_INTERVAL TIMER_FREQ   /* Ticks between flusher passes. */
+static size_t dirty_cnt;
+static struct cache_block **flush_list; /* CACHE_SECTORS entries. */
+static struct lock flush_lock;
+static struct completion flush_kick; /* Cache is half dirty. */
+static int writing_cnt;             /* Write-backs in progress. */
+static struct condition writes_done; /* Signaled when WRITING_CNT is 0. */
+
+/* Statistics. */
+static long long hit_cnt;           /* Lookups found in the cache. */
+static long long probation_hit_cnt; /* Of those, found on probation. */
+static long long ghost_hit_cnt;     /* Misses that found a ghost. */
+static long long promote_cnt;       /* Blocks read into the main set. */
+static long long miss_cnt;          /* Lookups that claimed a block. */
+static long long writeback_cnt;     /* Dirty blocks written to disk. */
+static long long readahead_cnt;     /* Sectors read ahead. */
+static long long ra_hit_cnt;        /* Of those, used before eviction. */
+static long long ra_waste_cnt;      /* Of those, evicted unused. */
+static long long flush_cnt;         /* Sectors written by flush passes. */
+static long long flush_ticks;       /* Ticks those passes took. */
+
+static hash_hash_func block_hash, ghost_hash;
+static hash_less_func block_less, ghost_less;
+static void block_assign (struct cache_block *, disk_sector_t);
+static struct cache_block *cache_get (disk_sector_t, bool fill);
+static struct cache_block *cache_claim (disk_sector_t, bool *claimed);
+static void cache_put (struct cache_block *, bool dirtied);
+static void cache_put_owned (struct cache_block *, struct cache_owner *);
+static void mark_dirty (struct cache_block *);
+static void mark_clean (struct cache_block *);
+static struct cache_block *cache_lookup (disk_sector_t);
+static struct cache_block *cache_evict (void);
+static bool write_back (struct cache_block *);
+static void unpin (struct cache_block *);
+static void redirty (struct cache_block *);
+static void write_end (void);
+static void wait_writes (void);
+static void readahead_thread (void *);
+static void read_run (disk_sector_t, size_t cnt, uint8_t *buf);
+static uint8_t *scratch_get (void);
+static void scratch_put (uint8_t *);
+static void flush_dirty (struct cache_owner *);
+static size_t write_run (struct cache_block **, size_t cnt);
+static void flusher_thread (void *);
+
+/* Initializes the buffer cache with CACHE_SECTORS blocks. */
+void
+cache_init (void) {
+	size_t pages = DIV_ROUND_UP (cache_sectors * DISK_SECTOR_SIZE, PGSIZE);
+	uint8_t *data;
+
+	lock_init (&cache_lock);
+	cond_init (&cache_unpinned);
+	cond_init (&ra_ready);
+	lock_init (&flush_lock);
+	completion_init (&flush_kick);
+	cond_init (&writes_done);
+	sema_init (&scratch_sema, SCRATCH_CNT);
+	lock_init (&scratch_write_lock);
+	counter_register_value ("cache.hits", &hit_cnt);
+	counter_register_value ("cache.misses", &miss_cnt);
+	counter_register_value ("cache.ghost_hits", &ghost_hit_cnt);
+	counter_register_value ("cache.writebacks", &writeback_cnt);
+	counter_register_value ("cache.readahead", &readahead_cnt);
+	if (cache_sectors == 0)
+		return;
+
+	blocks = calloc (cache_sectors, sizeof *blocks);
+	flush_list = malloc (cache_sectors * sizeof *flush_list);
+	ghost_cnt = cache_sectors / 2 > 0 ? cache_sectors / 2 : 1;
+	ghosts = calloc (ghost_cnt, sizeof *ghosts);
+	data = palloc_get_multiple (0, pages);
+	ra_buf = palloc_get_page (0);
+	flush_buf = palloc_get_page (0);
+	if (blocks == NULL || flush_list == NULL || data == NULL
+			|| ra_buf == NULL || flush_buf == NULL || ghosts == NULL
+			|| !hash_init (&cache_index, block_hash, block_less, NULL)
+			|| !hash_init (&ghost_index, ghost_hash, ghost_less, NULL))
+		PANIC ("cache_init: out of memory");
+	for (size_t i = 0; i < cache_sectors; i++) {
+		lock_init (&blocks[i].lock);
+		blocks[i].data = data + i * DISK_SECTOR_SIZE;
+	}
+	list_init (&probation);
+	probation_max = cache_sectors / 4 > 0 ? cache_sectors / 4 : 1;
+	run_max = cache_sectors / 4 < RUN_MAX ? cache_sectors / 4 : RUN_MAX;
+	if (run_max == 0)
+		run_max = 1;
+	ra_running = thread_create ("readahead", PRI_DEFAULT, readahead_thread,
+			NULL) != TID_ERROR;
+	if (thread_create ("flusher", PRI_DEFAULT, flusher_thread, NULL)
+			== TID_ERROR)
+		PANIC ("cache_init: can't start flusher");
+}
+
+/* Reads SECTOR into BUF, which must have room for
+   DISK_SECTOR_SIZE bytes. */
+void
+cache_read (disk_sector_t sector, void *buf) {
+	cache_read_at (sector, buf, 0, DISK_SECTOR_SIZE);
+}
+
+/* Writes DISK_SECTOR_SIZE bytes from BUF to SECTOR. */
+void
+cache_write (disk_sector_t sector, const void *buf) {
+	cache_write_at (sector, buf, 0, DISK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS of SECTOR into BUF. */
+void
+cache_read_at (disk_sector_t sector, void *buf, size_t ofs, size_t size) {
+	struct cache_block *b;
+	uint8_t *bounce;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	if (blocks == NULL) {
+		if (size == DISK_SECTOR_SIZE) {
+			disk_read (filesys_disk, sector, buf);
+			return;
+		}
+		bounce = scratch_get ();
+		disk_read (filesys_disk, sector, bounce);
+		memcpy (buf, bounce + ofs, size);
+		scratch_put (bounce);
+		return;
+	}
+
+	b = cache_get (sector, true);
+	memcpy (buf, b->data + ofs, size);
+	cache_put (b, false);
+}
+
+/* Writes SIZE bytes from BUF starting at byte OFS of SECTOR.  The
+   disk sees the data when the block is evicted or flushed. */
+void
+cache_write_at (disk_sector_t sector, const void *buf, size_t ofs,
+		size_t size) {
+	struct cache_block *b;
+	uint8_t *bounce;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	if (blocks == NULL) {
+		if (size == DISK_SECTOR_SIZE) {
+			disk_write (filesys_disk, sector, buf);
+			return;
+		}
+		lock_acquire (&scratch_write_lock);
+		bounce = scratch_get ();
+		disk_read (filesys_disk, sector, bounce);
+		memcpy (bounce + ofs, buf, size);
+		disk_write (filesys_disk, sector, bounce);
+		scratch_put (bounce);
+		lock_release (&scratch_write_lock);
+		return;
+	}
+
+	/* A write of the whole sector need not read the old data. */
+	b = cache_get (sector, size < DISK_SECTOR_SIZE);
+	memcpy (b->data + ofs, buf, size);
+	cache_put (b, true);
+}
+
+/* Writes SIZE bytes from BUF starting at byte OFS of SECTOR, as
+   cache_write_at(), for journal transaction TXN, which is not 0.
+   The block then stays in the cache and off the disk until
+   cache_release() lets it go for TXN, or for a later transaction
+   that holds it by then.  The cache must be on. */
+void
+cache_write_held (disk_sector_t sector, const void *buf, size_t ofs,
+		size_t size, unsigned txn) {
+	struct cache_block *b;
+
+	ASSERT (blocks != NULL);
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+	ASSERT (txn != 0);
+
+	b = cache_get (sector, size < DISK_SECTOR_SIZE);
+	lock_acquire (&cache_lock);
+	__atomic_store_n (&b->txn, txn, __ATOMIC_RELAXED);
+	lock_release (&cache_lock);
+	memcpy (b->data + ofs, buf, size);
+	cache_put (b, true);
+}
+
+/* Initializes OWNER with no dirty blocks. */
+void
+cache_owner_init (struct cache_owner *owner) {
+	list_init (&owner->dirty);
+}
+
+/* Leaves OWNER's dirty blocks to the normal write-behind, so that
+   OWNER may be freed. */
+void
+cache_owner_done (struct cache_owner *owner) {
+	if (blocks == NULL)
+		return;
+
+	lock_acquire (&cache_lock);
+	while (!list_empty (&owner->dirty))
+		list_entry (list_pop_front (&owner->dirty), struct cache_block,
+				owner_elem)->owner = NULL;
+	lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUF starting at byte OFS of SECTOR, as
+   cache_write_at(), and puts the block on OWNER's dirty list. */
+void
+cache_write_owned (disk_sector_t sector, const void *buf, size_t ofs,
+		size_t size, struct cache_owner *owner) {
+	struct cache_block *b;
+
+	ASSERT (ofs + size <= DISK_SECTOR_SIZE);
+
+	if (blocks == NULL) {
+		cache_write_at (sector, buf, ofs, size);
+		return;
+	}
+	b = cache_get (sector, size < DISK_SECTOR_SIZE);
+	memcpy (b->data + ofs, buf, size);
+	cache_put_owned (b, owner);
+}
+
+/* Writes OWNER's dirty blocks to disk, in sector order, and waits
+   for write-backs already under way. */
+void
+cache_flush_owner (struct cache_owner *owner) {
+	if (blocks == NULL)
+		return;
+	flush_dirty (owner);
+	lock_acquire (&cache_lock);
+	wait_writes ();
+	lock_release (&cache_lock);
+}
+
+/* Writes SECTOR to disk if it is cached and dirty, and waits for
+   write-backs already under way.  A block the journal holds is
+   left to it. */
+void
+cache_flush_sector (disk_sector_t sector) {
+	struct cache_block *b;
+
+	if (blocks == NULL)
+		return;
+	lock_acquire (&cache_lock);
+	b = cache_lookup (sector);
+	if (b != NULL)
+		write_back (b);
+	wait_writes ();
+	lock_release (&cache_lock);
+}
+
+/* Lets SECTOR's block be written back and evicted again, if
+   journal transaction TXN still holds it. */
+void
+cache_release (disk_sector_t sector, unsigned txn) {
+	struct cache_block *b;
+
+	lock_acquire (&cache_lock);
+	b = cache_lookup (sector);
+	if (b != NULL && b->txn == txn) {
+		__atomic_store_n (&b->txn, 0, __ATOMIC_RELAXED);
+		cond_broadcast (&cache_unpinned, &cache_lock);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Asks for SECTOR to be read into the cache in the background,
+   unless it is already there. */
+void
+cache_readahead (disk_sector_t sector) {
+	if (!ra_running)
+		return;
+
+	lock_acquire (&cache_lock);
+	if (ra_cnt < RA_QUEUE && cache_lookup (sector) == NULL) {
+		ra_queue[(ra_head + ra_cnt++) % RA_QUEUE] = sector;
+		cond_signal (&ra_ready, &cache_lock);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Reads the sectors from SECTOR up to SECTOR + CNT that are not
+   in the cache into it, as cache_readahead() would, but right away
+   and however many there are.  For threads that can wait, such as
+   workers prefetching for others. */
+void
+cache_prefetch (disk_sector_t sector, size_t cnt) {
+	uint8_t *buf;
+
+	if (cache_sectors == 0)
+		return;
+
+	/* Without a bounce page, sectors are read one by one. */
+	buf = palloc_get_page (0);
+	while (cnt > 0) {
+		size_t n = 0;
+
+		lock_acquire (&cache_lock);
+		while (cnt > 0 && cache_lookup (sector) != NULL) {
+			sector++;
+			cnt--;
+		}
+		while (n < cnt && n < run_max && cache_lookup (sector + n) == NULL)
+			n++;
+		lock_release (&cache_lock);
+
+		if (n > 0) {
+			read_run (sector, n, buf);
+			sector += n;
+			cnt -= n;
+		}
+	}
+	palloc_free_page (buf);
+}
+
+/* Writes every dirty block that the journal does not hold to
+   disk, and waits for write-backs already under way. */
+void
+cache_flush (void) {
+	if (blocks == NULL)
+		return;
+	flush_dirty (NULL);
+	lock_acquire (&cache_lock);
+	wait_writes ();
+	lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void) {
+	if (blocks == NULL)
+		return;
+	printf ("Buffer cache: %zu sectors, %lld hits, %lld misses, "
+			"%lld write-backs, %lld read ahead\n",
+			cache_sectors, hit_cnt, miss_cnt, writeback_cnt, readahead_cnt);
+	printf ("Buffer cache: %lld hits on probation, %zu of %zu blocks on "
+			"probation, %lld ghost hits, %lld read into main set\n",
+			probation_hit_cnt, probation_cnt, cache_sectors, ghost_hit_cnt,
+			promote_cnt);
+	printf ("Buffer cache: %lld read ahead used, %lld evicted unused\n",
+			ra_hit_cnt, ra_waste_cnt);
+	printf ("Buffer cache: %zu dirty, %lld sectors flushed at %lld "
+			"sectors/s\n", dirty_cnt, flush_cnt,
+			flush_ticks > 0 ? flush_cnt * TIMER_FREQ / flush_ticks : 0);
+}
+
+/* Returns the block holding SECTOR, pinned and with its LOCK held,
+   claiming one if SECTOR is not cached.  A claimed block is read
+   from disk if FILL is true, or left with stale contents for the
+   caller to overwrite otherwise. */
+static struct cache_block *
+cache_get (disk_sector_t sector, bool fill) {
+	bool claimed;
+	struct cache_block *b = cache_claim (sector, &claimed);
+
+	if (claimed && fill)
+		disk_read (filesys_disk, sector, b->data);
+	return b;
+}
+
+/* Returns the block holding SECTOR, pinned and with its LOCK held.
+   If SECTOR is not cached, claims a block for it without reading
+   it, and sets *CLAIMED to true. */
+static struct cache_block *
+cache_claim (disk_sector_t sector, bool *claimed) {
+	struct cache_block *b;
+
+	lock_acquire (&cache_lock);
+	for (;;) {
+		/* Look again after every pass of cache_evict(), which may
+		   have let another thread bring SECTOR in. */
+		b = cache_lookup (sector);
+		if (b != NULL) {
+			hit_cnt++;
+			probation_hit_cnt += b->probation;
+			ra_hit_cnt += b->prefetched;
+			b->prefetched = false;
+			b->pins++;
+			b->accessed = true;
+			lock_release (&cache_lock);
+			lock_acquire (&b->lock);
+			*claimed = false;
+			return b;
+		}
+		b = cache_evict ();
+		if (b != NULL)
+			break;
+	}
+
+	miss_cnt++;
+	block_assign (b, sector);
+	b->pins = 1;
+
+	/* Nobody else has pinned B, so this does not block. */
+	lock_acquire (&b->lock);
+	lock_release (&cache_lock);
+	*claimed = true;
+	return b;
+}
+
+/* Makes victim B hold SECTOR instead of what it held, and files
+   it for 2Q: in the main set if SECTOR is a ghost, on probation
+   otherwise.  A block leaving probation leaves a ghost behind.
+   Must hold CACHE_LOCK. */
+static void
+block_assign (struct cache_block *b, disk_sector_t sector) {
+	struct cache_ghost probe, *g;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	if (b->valid) {
+		ra_waste_cnt += b->prefetched;
+		hash_delete (&cache_index, &b->elem);
+		if (b->probation) {
+			list_remove (&b->fifo_elem);
+			probation_cnt--;
+			g = &ghosts[ghost_next];
+			ghost_next = (ghost_next + 1) % ghost_cnt;
+			if (g->used)
+				hash_delete (&ghost_index, &g->elem);
+			g->sector = b->sector;
+			g->used = hash_insert (&ghost_index, &g->elem) == NULL;
+		}
+	}
+	b->sector = sector;
+	b->valid = true;
+	b->prefetched = false;
+	hash_insert (&cache_index, &b->elem);
+
+	probe.sector = sector;
+	e = hash_find (&ghost_index, &probe.elem);
+	if (e != NULL) {
+		g = hash_entry (e, struct cache_ghost, elem);
+		hash_delete (&ghost_index, &g->elem);
+		g->used = false;
+		ghost_hit_cnt++;
+		promote_cnt++;
+		b->probation = false;
+		b->accessed = true;
+	} else {
+		b->probation = true;
+		b->accessed = false;
+		list_push_back (&probation, &b->fifo_elem);
+		probation_cnt++;
+	}
+}
+
+/* Releases block B obtained from cache_get(), marking it dirty
+   if DIRTIED. */
+static void
+cache_put (struct cache_block *b, bool dirtied) {
+	lock_release (&b->lock);
+	lock_acquire (&cache_lock);
+	if (dirtied)
+		mark_dirty (b);
+	unpin (b);
+	lock_release (&cache_lock);
+}
+
+/* Releases block B obtained from cache_get(), marking it dirty on
+   behalf of OWNER. */
+static void
+cache_put_owned (struct cache_block *b, struct cache_owner *owner) {
+	lock_release (&b->lock);
+	lock_acquire (&cache_lock);
+	mark_dirty (b);
+	if (b->owner != owner) {
+		if (b->owner != NULL)
+			list_remove (&b->owner_elem);
+		b->owner = owner;
+		list_push_back (&owner->dirty, &b->owner_elem);
+	}
+	unpin (b);
+	lock_release (&cache_lock);
+}
+
+/* Marks B dirty, kicking the flusher once half the cache is
+   dirty.  Must hold CACHE_LOCK. */
+static void
+mark_dirty (struct cache_block *b) {
+	if (!b->dirty) {
+		b->dirty = true;
+		if (++dirty_cnt == cache_sectors / 2)
+			complete (&flush_kick);
+	}
+}
+
+/* Marks dirty block B clean, and takes it off its owner's list.
+   Must hold CACHE_LOCK. */
+static void
+mark_clean (struct cache_block *b) {
+	ASSERT (b->dirty);
+	b->dirty = false;
+	dirty_cnt--;
+	if (b->owner != NULL) {
+		list_remove (&b->owner_elem);
+		b->owner = NULL;
+	}
+}
+
+/* Returns the block holding SECTOR, or a null pointer if SECTOR
+   is not cached.  Must hold CACHE_LOCK. */
+static struct cache_block *
+cache_lookup (disk_sector_t sector) {
+	struct cache_block probe;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+	probe.sector = sector;
+	e = hash_find (&cache_index, &probe.elem);
+	return e != NULL ? hash_entry (e, struct cache_block, elem) : NULL;
+}
+
+/* Advances the clock hand to a clean block that nobody has pinned
+   and returns it.  First, though, a dirty candidate is written
+   back, and if every block is pinned the thread waits for one to
+   be released.  Those cases drop CACHE_LOCK for a while and
+   return a null pointer, and the caller must then look up its
+   sector again.  Must hold CACHE_LOCK. */
+static struct cache_block *
+cache_evict (void) {
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	/* A stale block read ahead goes first.  It is never dirty. */
+	if (!list_empty (&probation)) {
+		struct cache_block *b = list_entry (list_front (&probation),
+				struct cache_block, fifo_elem);
+
+		if (b->prefetched && readahead_cnt - b->ra_seq >= RA_QUEUE
+				&& b->pins == 0 && b->txn == 0)
+			return b;
+	}
+
+	/* Past its quota, probation gives up its oldest block. */
+	if (probation_cnt > probation_max)
+		for (struct list_elem *e = list_begin (&probation);
+				e != list_end (&probation); e = list_next (e)) {
+			struct cache_block *b = list_entry (e, struct cache_block,
+					fifo_elem);
+
+			if (b->pins > 0 || b->txn != 0)
+				continue;
+			if (b->dirty) {
+				write_back (b);
+				return NULL;
+			}
+			return b;
+		}
+
+	/* One sweep clears every accessed bit, so a second sweep
+	   without a victim means every block was pinned. */
+	for (size_t scanned = 0; scanned < 2 * cache_sectors; scanned++) {
+		struct cache_block *b = &blocks[clock_hand];
+
+		clock_hand = (clock_hand + 1) % cache_sectors;
+		if (b->pins > 0 || b->txn != 0)
+			continue;
+		if (b->accessed) {
+			b->accessed = false;
+			continue;
+		}
+		if (b->dirty) {
+			write_back (b);
+			return NULL;
+		}
+		return b;
+	}
+	cond_wait (&cache_unpinned, &cache_lock);
+	return NULL;
+}
+
+/* Writes block B to disk if it is dirty and returns true, or
+   returns false if it was clean or the journal holds it.  B stays
+   indexed throughout.  It is marked clean before the write, so a
+   writer that gets in first dirties it again and is written by
+   the next pass.  Must hold CACHE_LOCK, which is released during
+   the write. */
+static bool
+write_back (struct cache_block *b) {
+	bool held;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	if (!b->dirty || b->txn != 0)
+		return false;
+	mark_clean (b);
+	b->pins++;
+	writing_cnt++;
+	lock_release (&cache_lock);
+
+	lock_acquire (&b->lock);
+	held = __atomic_load_n (&b->txn, __ATOMIC_RELAXED) != 0;
+	if (!held)
+		disk_write (filesys_disk, b->sector, b->data);
+	lock_release (&b->lock);
+
+	lock_acquire (&cache_lock);
+	if (held)
+		redirty (b);
+	else
+		writeback_cnt++;
+	unpin (b);
+	write_end ();
+	return !held;
+}
+
+/* Marks B dirty again after a write back skipped it.  Must hold
+   CACHE_LOCK. */
+static void
+redirty (struct cache_block *b) {
+	if (!b->dirty) {
+		b->dirty = true;
+		dirty_cnt++;
+	}
+}
+
+/* Ends a write back counted in WRITING_CNT.  Must hold
+   CACHE_LOCK. */
+static void
+write_end (void) {
+	if (--writing_cnt == 0)
+		cond_broadcast (&writes_done, &cache_lock);
+}
+
+/* Waits until no write back is in progress, first raising the
+   disk priority of those queued to the caller's, since they may
+   be the flusher's.  Must hold CACHE_LOCK. */
+static void
+wait_writes (void) {
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+
+	while (writing_cnt > 0) {
+		disk_boost_writes (filesys_disk, thread_get_priority ());
+		cond_wait (&writes_done, &cache_lock);
+	}
+}
+
+/* Drops a pin on B.  Must hold CACHE_LOCK. */
+static void
+unpin (struct cache_block *b) {
+	ASSERT (b->pins > 0);
+	if (--b->pins == 0)
+		cond_signal (&cache_unpinned, &cache_lock);
+}
+
+/* Reads queued sectors into the cache, oldest first.  A sector
+   that a reader brought in meanwhile is skipped.  Queued sectors
+   that follow one another on disk are read with one command. */
+static void
+readahead_thread (void *aux UNUSED) {
+	lock_acquire (&cache_lock);
+	for (;;) {
+		disk_sector_t sector;
+		size_t cnt = 1;
+
+		while (ra_cnt == 0)
+			cond_wait (&ra_ready, &cache_lock);
+		sector = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % RA_QUEUE;
+		ra_cnt--;
+		if (cache_lookup (sector) != NULL)
+			continue;
+		while (cnt < run_max && ra_cnt > 0
+				&& ra_queue[ra_head] == sector + cnt
+				&& cache_lookup (sector + cnt) == NULL) {
+			ra_head = (ra_head + 1) % RA_QUEUE;
+			ra_cnt--;
+			cnt++;
+		}
+		lock_release (&cache_lock);
+		read_run (sector, cnt, ra_buf);
+		lock_acquire (&cache_lock);
+	}
+}
+
+/* Reads the CNT sectors from SECTOR on, which were missing from
+   the cache a moment ago, into the cache as read ahead.  A run
+   that is still missing whole goes with one disk command through
+   bounce page BUF, if there is one.  Called without CACHE_LOCK. */
+static void
+read_run (disk_sector_t sector, size_t cnt, uint8_t *buf) {
+	struct cache_block *run[RUN_MAX];
+	bool claimed[RUN_MAX];
+	size_t got = 0;
+
+	ASSERT (cnt <= run_max);
+
+	/* A reader may bring some of the run in meanwhile; then read
+	   only the sectors claimed here, one by one. */
+	for (size_t i = 0; i < cnt; i++) {
+		run[i] = cache_claim (sector + i, &claimed[i]);
+		got += claimed[i];
+	}
+
+	/* A reader already waiting for a block is using it. */
+	lock_acquire (&cache_lock);
+	for (size_t i = 0; i < cnt; i++)
+		if (claimed[i] && run[i]->pins == 1) {
+			run[i]->prefetched = true;
+			run[i]->ra_seq = readahead_cnt;
+		}
+	lock_release (&cache_lock);
+
+	if (got == cnt && cnt > 1 && buf != NULL) {
+		disk_read_multiple (filesys_disk, sector, cnt, buf);
+		for (size_t i = 0; i < cnt; i++)
+			memcpy (run[i]->data, buf + i * DISK_SECTOR_SIZE,
+					DISK_SECTOR_SIZE);
+	} else
+		for (size_t i = 0; i < cnt; i++)
+			if (claimed[i])
+				disk_read (filesys_disk, sector + i, run[i]->data);
+	for (size_t i = 0; i < cnt; i++)
+		cache_put (run[i], false);
+
+	lock_acquire (&cache_lock);
+	readahead_cnt += got;
+	lock_release (&cache_lock);
+}
+
+/* Takes a free scratch sector, waiting for one if need be. */
+static uint8_t *
+scratch_get (void) {
+	size_t i;
+
+	sema_down (&scratch_sema);
+	lock_acquire (&cache_lock);
+	for (i = 0; scratch_busy[i]; i++)
+		ASSERT (i + 1 < SCRATCH_CNT);
+	scratch_busy[i] = true;
+	lock_release (&cache_lock);
+	return scratch[i];
+}
+
+/* Returns scratch sector P from scratch_get(). */
+static void
+scratch_put (uint8_t *p) {
+	size_t i = (p - scratch[0]) / DISK_SECTOR_SIZE;
+
+	lock_acquire (&cache_lock);
+	scratch_busy[i] = false;
+	lock_release (&cache_lock);
+	sema_up (&scratch_sema);
+}
+
+/* Orders pointers to cache blocks by sector. */
+static int
+sector_cmp (const void *a_, const void *b_) {
+	const struct cache_block *a = *(struct cache_block *const *) a_;
+	const struct cache_block *b = *(struct cache_block *const *) b_;
+
+	return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Writes the blocks that are dirty now, in sector order: OWNER's,
+   or every block if OWNER is null. */
+static void
+flush_dirty (struct cache_owner *owner) {
+	int64_t start = timer_ticks ();
+	size_t cnt = 0;
+	long long wrote = 0;
+
+	lock_acquire (&flush_lock);
+	lock_acquire (&cache_lock);
+	if (owner != NULL) {
+		for (struct list_elem *e = list_begin (&owner->dirty);
+				e != list_end (&owner->dirty); e = list_next (e)) {
+			struct cache_block *b = list_entry (e, struct cache_block,
+					owner_elem);
+			if (b->txn == 0)
+				flush_list[cnt++] = b;
+		}
+	} else
+		for (size_t i = 0; i < cache_sectors; i++)
+			if (blocks[i].valid && blocks[i].dirty && blocks[i].txn == 0)
+				flush_list[cnt++] = &blocks[i];
+	lock_release (&cache_lock);
+
+	qsort (flush_list, cnt, sizeof *flush_list, sector_cmp);
+
+	/* Eviction may have written or reused a block meanwhile, so
+	   runs are formed from what is dirty now. */
+	lock_acquire (&cache_lock);
+	for (size_t i = 0; i < cnt; ) {
+		struct cache_block **run = flush_list + i;
+		size_t n = 0;
+
+		while (i + n < cnt && n < run_max && run[n]->valid && run[n]->dirty
+				&& run[n]->txn == 0 && run[n]->sector == run[0]->sector + n)
+			n++;
+		if (n == 0) {
+			i++;
+			continue;
+		}
+		wrote += write_run (run, n);
+		i += n;
+	}
+	flush_cnt += wrote;
+	flush_ticks += timer_ticks () - start;
+	lock_release (&cache_lock);
+	lock_release (&flush_lock);
+}
+
+/* Writes the CNT dirty blocks in RUN, which hold adjacent
+   sectors in order, with one disk command, and returns how many
+   were written.  Like write_back(), marks them clean first, and
+   skips those the journal comes to hold meanwhile.  Must hold
+   CACHE_LOCK, which is released during the write, and
+   FLUSH_LOCK. */
+static size_t
+write_run (struct cache_block **run, size_t cnt) {
+	bool held[RUN_MAX];
+	size_t wrote = 0;
+
+	ASSERT (lock_held_by_current_thread (&cache_lock));
+	ASSERT (lock_held_by_current_thread (&flush_lock));
+
+	if (cnt == 1)
+		return write_back (run[0]);
+
+	for (size_t i = 0; i < cnt; i++) {
+		mark_clean (run[i]);
+		run[i]->pins++;
+	}
+	writing_cnt++;
+	lock_release (&cache_lock);
+
+	/* A writer that gets in after the copy dirties its block
+	   again. */
+	for (size_t i = 0; i < cnt; i++) {
+		lock_acquire (&run[i]->lock);
+		held[i] = __atomic_load_n (&run[i]->txn, __ATOMIC_RELAXED) != 0;
+		memcpy (flush_buf + i * DISK_SECTOR_SIZE, run[i]->data,
+				DISK_SECTOR_SIZE);
+		lock_release (&run[i]->lock);
+		wrote += !held[i];
+	}
+	if (wrote == cnt)
+		disk_write_multiple (filesys_disk, run[0]->sector, cnt, flush_buf);
+	else
+		for (size_t i = 0; i < cnt; i++)
+			if (!held[i])
+				disk_write (filesys_disk, run[i]->sector,
+						flush_buf + i * DISK_SECTOR_SIZE);
+
+	lock_acquire (&cache_lock);
+	writeback_cnt += wrote;
+	for (size_t i = 0; i < cnt; i++) {
+		if (held[i])
+			redirty (run[i]);
+		unpin (run[i]);
+	}
+	write_end ();
+	return wrote;
+}
+
+/* Writes dirty blocks behind every FLUSH_INTERVAL, or sooner when
+   half the cache turns dirty. */
+static void
+flusher_thread (void *aux UNUSED) {
+	for (;;) {
+		wait_for_completion_timeout (&flush_kick, FLUSH_INTERVAL);
+		flush_dirty (NULL);
+	}
+}
+
+static uint64_t
+block_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct cache_block *b = hash_entry (e, struct cache_block, elem);
+	return hash_int (b->sector);
+}
+
+static bool
+block_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct cache_block, elem)->sector
+		< hash_entry (b, struct cache_block, elem)->sector;
+}
+
+static uint64_t
+ghost_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct cache_ghost *g = hash_entry (e, struct cache_ghost, elem);
+	return hash_int (g->sector);
+}
+
+static bool
+ghost_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct cache_ghost, elem)->sector
+		< hash_entry (b, struct cache_ghost, elem)->sector;
+}
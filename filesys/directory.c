@@ -1,10 +1,15 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
-#include <list.h>
+#include <dirent.h>
+#include <hash.h>
+#include <rhash.h>
+#include <round.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -12,41 +17,161 @@ struct dir {
 	off_t pos;                          /* Current position. */
 };
 
-/* A single directory entry. */
-struct dir_entry {
-	disk_sector_t inode_sector;         /* Sector number of header. */
-	char name[NAME_MAX + 1];            /* Null terminated file name. */
-	bool in_use;                        /* In use or free? */
+/* A directory is a sequence of blocks of one sector each.  A
+ * block starts with a header, followed by variable-length records
+ * that fill the rest of it, each REC_LEN bytes from the next.  A
+ * record in use holds an entry's name, without a null terminator,
+ * and any bytes past the name up to the next record are free.
+ * Removing an entry gives its bytes to the record before it, or
+ * frees the record if it comes first, so entries never move and
+ * their offsets stay valid as positions for dir_readdir(). */
+#define DIR_BLOCK DISK_SECTOR_SIZE
+
+/* Header of a directory block. */
+struct dir_block_header {
+	uint16_t free;                      /* Bytes not in entries in use. */
+	uint16_t cnt;                       /* Entries in use. */
 };
 
+/* A record of a directory block. */
+struct dir_record {
+	disk_sector_t inode_sector;         /* Sector number of header,
+	                                       or 0 if free. */
+	uint16_t rec_len;                   /* Bytes to the next record. */
+	uint8_t name_len;                   /* Bytes in NAME. */
+	char name[];                        /* File name. */
+} __attribute__ ((packed));
+
+/* Bytes a record with a name of LEN bytes takes. */
+#define RECORD_SIZE(LEN) (sizeof (struct dir_record) + (LEN))
+
+/* Entries with the longest names that fit in a block. */
+#define BLOCK_ENTRIES \
+	((DIR_BLOCK - sizeof (struct dir_block_header)) / RECORD_SIZE (NAME_MAX))
+
+/* In-memory index of a directory's entries.  It is built on first
+ * use and attached to the directory's inode, so every struct dir
+ * open on that inode shares it.  NAMES maps each name in use to
+ * its slot.  BLOCK_FREE mirrors each block header's free count, so
+ * dir_add() reads only blocks that may have room.  LOCK serializes
+ * lookups, adds and removes in the directory. */
+struct dir_index {
+	struct lock lock;
+	struct rhash names;                 /* Slots in use, by name. */
+	uint16_t *block_free;               /* Free bytes, by block. */
+	size_t block_cnt;                   /* Blocks in the directory. */
+};
+
+/* One entry of a directory. */
+struct dir_slot {
+	off_t ofs;                          /* Offset of its record. */
+	disk_sector_t inode_sector;         /* Entry's inode. */
+	char name[NAME_MAX + 1];            /* Entry's name. */
+};
+
+/* Slab caches for struct dir and struct dir_slot. */
+static struct kmem_cache *dir_cache;
+static struct kmem_cache *slot_cache;
+
+/* Serializes building indexes and the first opening of the root
+ * directory. */
+static struct lock index_build_lock;
+
+/* The root directory's inode, held open from its first use until
+ * dir_done() so that its index outlives each path lookup. */
+static struct inode *root_inode;
+
+static struct dir_index *dir_index_get (const struct dir *);
+static struct dir_index *dir_index_build (struct inode *);
+static void dir_index_destroy (void *);
+static struct dir_slot *index_find (struct dir_index *, const char *name);
+static bool block_read (struct inode *, size_t block, uint8_t *buf);
+static bool block_write (struct inode *, size_t block, const uint8_t *buf);
+static void block_init (uint8_t *buf);
+static struct dir_record *record_at (uint8_t *buf, size_t ofs);
+static bool record_in_use (const struct dir_record *);
+static size_t block_insert (uint8_t *buf, const char *name,
+		disk_sector_t inode_sector);
+static bool block_remove (uint8_t *buf, size_t ofs);
+static rhash_hash_func slot_hash;
+static rhash_equal_func slot_equal;
+static rhash_action_func slot_free;
+
+/* Initializes the directory module. */
+void
+dir_init (void) {
+	dir_cache = kmem_cache_create ("dir", sizeof (struct dir), 0, NULL);
+	slot_cache = kmem_cache_create ("dir_slot", sizeof (struct dir_slot), 0,
+			NULL);
+	if (dir_cache == NULL || slot_cache == NULL)
+		PANIC ("dir_init: out of memory");
+	lock_init (&index_build_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
-	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+	size_t block_cnt = entry_cnt > 0
+		? DIV_ROUND_UP (entry_cnt, BLOCK_ENTRIES) : 1;
+	uint8_t buf[DIR_BLOCK];
+	struct inode *inode;
+	bool success = true;
+
+	if (!inode_create (sector, block_cnt * DIR_BLOCK, true))
+		return false;
+	inode = inode_open (sector);
+	if (inode == NULL)
+		return false;
+	block_init (buf);
+	for (size_t b = 0; b < block_cnt && success; b++)
+		success = block_write (inode, b, buf);
+	inode_close (inode);
+	return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
  * it takes ownership.  Returns a null pointer on failure. */
 struct dir *
 dir_open (struct inode *inode) {
-	struct dir *dir = calloc (1, sizeof *dir);
+	struct dir *dir = kmem_cache_alloc (dir_cache);
 	if (inode != NULL && dir != NULL) {
+		inode_set_journaled (inode);
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
 	} else {
 		inode_close (inode);
-		free (dir);
+		kmem_cache_free (dir_cache, dir);
 		return NULL;
 	}
 }
 
+/* Releases the directory module's hold on the root directory. */
+void
+dir_done (void) {
+	inode_close (root_inode);
+	root_inode = NULL;
+}
+
 /* Opens the root directory and returns a directory for it.
  * Return true if successful, false on failure. */
 struct dir *
 dir_open_root (void) {
-	return dir_open (inode_open (ROOT_DIR_SECTOR));
+	struct inode *root = __atomic_load_n (&root_inode, __ATOMIC_ACQUIRE);
+
+	if (root == NULL) {
+		lock_acquire (&index_build_lock);
+		root = root_inode;
+		if (root == NULL) {
+			root = inode_open (ROOT_DIR_SECTOR);
+			__atomic_store_n (&root_inode, root, __ATOMIC_RELEASE);
+		}
+		lock_release (&index_build_lock);
+		if (root == NULL)
+			return NULL;
+	}
+	return dir_open (inode_reopen (root));
 }
 
 /* Opens and returns a new directory for the same inode as DIR.
@@ -61,7 +186,7 @@ void
 dir_close (struct dir *dir) {
 	if (dir != NULL) {
 		inode_close (dir->inode);
-		free (dir);
+		kmem_cache_free (dir_cache, dir);
 	}
 }
 
@@ -71,48 +196,32 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
- * If successful, returns true, sets *EP to the directory entry
- * if EP is non-null, and sets *OFSP to the byte offset of the
- * directory entry if OFSP is non-null.
- * otherwise, returns false and ignores EP and OFSP. */
-static bool
-lookup (const struct dir *dir, const char *name,
-		struct dir_entry *ep, off_t *ofsp) {
-	struct dir_entry e;
-	size_t ofs;
-
-	ASSERT (dir != NULL);
-	ASSERT (name != NULL);
-
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (e.in_use && !strcmp (name, e.name)) {
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
-		}
-	return false;
-}
-
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
- * a null pointer.  The caller must close *INODE. */
+ * a null pointer.  The caller must close *INODE.  Also fails if
+ * memory for DIR's index runs out. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
-	struct dir_entry e;
+	struct dir_index *index;
+	struct dir_slot *slot;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
-	else
-		*inode = NULL;
+	*inode = NULL;
+	index = dir_index_get (dir);
+	if (index == NULL)
+		return false;
+
+	lock_acquire (&index->lock);
+	slot = index_find (index, name);
+	if (slot != NULL) {
+		inode_readahead_open (slot->inode_sector);
+		*inode = inode_open (slot->inode_sector);
+	}
+	lock_release (&index->lock);
 
 	return *inode != NULL;
 }
@@ -125,40 +234,70 @@ dir_lookup (const struct dir *dir, const char *name,
  * error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
-	struct dir_entry e;
-	off_t ofs;
+	struct dir_index *index;
+	struct dir_slot *slot;
+	uint8_t buf[DIR_BLOCK];
+	size_t need, b, ofs = 0;
 	bool success = false;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
+	ASSERT (inode_sector != 0);
 
-	/* Check NAME for validity. */
-	if (*name == '\0' || strlen (name) > NAME_MAX)
+	/* Check NAME for validity.  "/" names the root directory
+	 * itself, so an entry by that name could never be opened. */
+	if (*name == '\0' || strlen (name) > NAME_MAX || !strcmp (name, "/"))
 		return false;
+	need = RECORD_SIZE (strlen (name));
 
-	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
-		goto done;
+	index = dir_index_get (dir);
+	if (index == NULL)
+		return false;
+	lock_acquire (&index->lock);
 
-	/* Set OFS to offset of free slot.
-	 * If there are no free slots, then it will be set to the
-	 * current end-of-file.
+	/* Check that NAME is not in use, and make room to index it
+	 * once its entry is written. */
+	if (index_find (index, name) != NULL
+			|| !rhash_reserve (&index->names, 1))
+		goto done;
+	slot = kmem_cache_alloc (slot_cache);
+	if (slot == NULL)
+		goto done;
 
-	 * inode_read_at() will only return a short read at end of file.
-	 * Otherwise, we'd need to verify that we didn't get a short
-	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e)
-		if (!e.in_use)
+	/* Put the entry in the first block with room, or else in a new
+	 * block past the end of the directory. */
+	for (b = 0; b < index->block_cnt; b++)
+		if (index->block_free[b] >= need
+				&& block_read (dir->inode, b, buf)
+				&& (ofs = block_insert (buf, name, inode_sector)) != 0)
 			break;
+	if (b == index->block_cnt) {
+		uint16_t *block_free = realloc (index->block_free,
+				(b + 1) * sizeof *block_free);
+
+		if (block_free == NULL)
+			goto fail;
+		index->block_free = block_free;
+		block_init (buf);
+		ofs = block_insert (buf, name, inode_sector);
+	}
+	if (!block_write (dir->inode, b, buf))
+		goto fail;
+	if (b == index->block_cnt)
+		index->block_cnt++;
+	index->block_free[b] = ((struct dir_block_header *) buf)->free;
+
+	slot->ofs = b * DIR_BLOCK + ofs;
+	slot->inode_sector = inode_sector;
+	strlcpy (slot->name, name, sizeof slot->name);
+	rhash_insert (&index->names, slot);
+	success = true;
+	goto done;
 
-	/* Write slot. */
-	e.in_use = true;
-	strlcpy (e.name, name, sizeof e.name);
-	e.inode_sector = inode_sector;
-	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-
+fail:
+	kmem_cache_free (slot_cache, slot);
 done:
+	lock_release (&index->lock);
 	return success;
 }
 
@@ -167,33 +306,47 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool
 dir_remove (struct dir *dir, const char *name) {
-	struct dir_entry e;
+	struct dir_index *index;
+	struct dir_slot *slot;
 	struct inode *inode = NULL;
+	uint8_t buf[DIR_BLOCK];
+	size_t b;
 	bool success = false;
-	off_t ofs;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	index = dir_index_get (dir);
+	if (index == NULL)
+		return false;
+	lock_acquire (&index->lock);
+
 	/* Find directory entry. */
-	if (!lookup (dir, name, &e, &ofs))
+	slot = index_find (index, name);
+	if (slot == NULL)
 		goto done;
 
 	/* Open inode. */
-	inode = inode_open (e.inode_sector);
+	inode = inode_open (slot->inode_sector);
 	if (inode == NULL)
 		goto done;
 
 	/* Erase directory entry. */
-	e.in_use = false;
-	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+	b = slot->ofs / DIR_BLOCK;
+	if (!block_read (dir->inode, b, buf)
+			|| !block_remove (buf, slot->ofs % DIR_BLOCK)
+			|| !block_write (dir->inode, b, buf))
 		goto done;
+	index->block_free[b] = ((struct dir_block_header *) buf)->free;
+	rhash_delete (&index->names, slot);
+	kmem_cache_free (slot_cache, slot);
 
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
 
 done:
+	lock_release (&index->lock);
 	inode_close (inode);
 	return success;
 }
@@ -203,14 +356,296 @@ done:
  * contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
-	struct dir_entry e;
+	uint8_t buf[DIR_BLOCK];
+
+	while (block_read (dir->inode, dir->pos / DIR_BLOCK, buf)) {
+		off_t base = dir->pos / DIR_BLOCK * DIR_BLOCK;
+		struct dir_record *r;
+		size_t ofs;
+
+		for (ofs = sizeof (struct dir_block_header);
+				(r = record_at (buf, ofs)) != NULL; ofs += r->rec_len)
+			if (base + (off_t) ofs >= dir->pos && record_in_use (r)) {
+				/* The caller will likely look the entry up next. */
+				cache_readahead (r->inode_sector);
+				dir->pos = base + ofs + 1;
+				memcpy (name, r->name, r->name_len);
+				name[r->name_len] = '\0';
+				return true;
+			}
+		dir->pos = base + DIR_BLOCK;
+	}
+	return false;
+}
 
-	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
-		dir->pos += sizeof e;
-		if (e.in_use) {
-			strlcpy (name, e.name, NAME_MAX + 1);
-			return true;
+/* Packs the entries in use of directory INODE, starting at offset
+ * *POS, into BUF as struct dirents, as many as fit in SIZE bytes,
+ * and advances *POS past those packed.  Reads the directory a
+ * block at a time, and the inodes of the entries packed ahead, for
+ * the stat() that usually follows.  Returns the bytes stored in
+ * BUF, 0 at the end of the directory or if the first entry does
+ * not fit. */
+size_t
+dir_getdents (struct inode *inode, off_t *pos, void *buf, size_t size) {
+	uint8_t block[DIR_BLOCK];
+	uint8_t *p = buf;
+	size_t used = 0;
+
+	while (block_read (inode, *pos / DIR_BLOCK, block)) {
+		off_t base = *pos / DIR_BLOCK * DIR_BLOCK;
+		struct dir_record *r;
+		size_t ofs;
+
+		for (ofs = sizeof (struct dir_block_header);
+				(r = record_at (block, ofs)) != NULL; ofs += r->rec_len) {
+			struct dirent *d = (struct dirent *) (p + used);
+			size_t reclen;
+
+			if (base + (off_t) ofs < *pos || !record_in_use (r))
+				continue;
+			reclen = DIRENT_RECLEN (r->name_len);
+			if (reclen > size - used) {
+				*pos = base + ofs;
+				return used;
+			}
+			cache_readahead (r->inode_sector);
+			d->d_ino = r->inode_sector;
+			d->d_reclen = reclen;
+			memcpy (d->d_name, r->name, r->name_len);
+			d->d_name[r->name_len] = '\0';
+			used += reclen;
 		}
+		*pos = base + DIR_BLOCK;
 	}
-	return false;
+	return used;
+}
+
+/* Returns DIR's index, building it on first use, or a null pointer
+ * if memory runs out. */
+static struct dir_index *
+dir_index_get (const struct dir *dir) {
+	struct dir_index *index = inode_get_aux (dir->inode);
+
+	if (index != NULL)
+		return index;
+
+	lock_acquire (&index_build_lock);
+	index = inode_get_aux (dir->inode);
+	if (index == NULL) {
+		index = dir_index_build (dir->inode);
+		if (index != NULL)
+			inode_set_aux (dir->inode, index, dir_index_destroy);
+	}
+	lock_release (&index_build_lock);
+	return index;
+}
+
+/* Reads directory INODE, a block at a time, and returns a new
+ * index of it, or a null pointer if memory runs out. */
+static struct dir_index *
+dir_index_build (struct inode *inode) {
+	struct dir_index *index = malloc (sizeof *index);
+	uint8_t buf[DIR_BLOCK];
+	size_t b;
+
+	if (index == NULL)
+		return NULL;
+	lock_init (&index->lock);
+	index->block_free = NULL;
+	index->block_cnt = 0;
+	if (!rhash_init (&index->names, slot_hash, slot_equal, NULL)) {
+		free (index);
+		return NULL;
+	}
+
+	for (b = 0; block_read (inode, b, buf); b++) {
+		size_t free_bytes = DIR_BLOCK - sizeof (struct dir_block_header);
+		uint16_t *block_free = realloc (index->block_free,
+				(b + 1) * sizeof *block_free);
+		struct dir_record *r;
+		size_t ofs;
+
+		if (block_free == NULL) {
+			dir_index_destroy (index);
+			return NULL;
+		}
+		index->block_free = block_free;
+		index->block_cnt = b + 1;
+
+		for (ofs = sizeof (struct dir_block_header);
+				(r = record_at (buf, ofs)) != NULL; ofs += r->rec_len) {
+			struct dir_slot *slot, *old;
+
+			if (!record_in_use (r))
+				continue;
+			free_bytes -= RECORD_SIZE (r->name_len);
+			slot = kmem_cache_alloc (slot_cache);
+			if (slot == NULL) {
+				dir_index_destroy (index);
+				return NULL;
+			}
+			slot->ofs = b * DIR_BLOCK + ofs;
+			slot->inode_sector = r->inode_sector;
+			memcpy (slot->name, r->name, r->name_len);
+			slot->name[r->name_len] = '\0';
+
+			old = rhash_insert (&index->names, slot);
+			if (old == slot) {
+				kmem_cache_free (slot_cache, slot);
+				dir_index_destroy (index);
+				return NULL;
+			}
+
+			/* Lookups found the first of two equal names. */
+			if (old != NULL)
+				kmem_cache_free (slot_cache, slot);
+		}
+
+		/* A damaged block is left alone. */
+		index->block_free[b] = ofs == DIR_BLOCK ? free_bytes : 0;
+	}
+	return index;
+}
+
+/* Frees directory index INDEX_. */
+static void
+dir_index_destroy (void *index_) {
+	struct dir_index *index = index_;
+
+	rhash_destroy (&index->names, slot_free);
+	free (index->block_free);
+	free (index);
+}
+
+/* Returns the slot in use for NAME in INDEX, or a null pointer if
+ * there is none.  Must hold INDEX's lock. */
+static struct dir_slot *
+index_find (struct dir_index *index, const char *name) {
+	struct dir_slot probe;
+
+	ASSERT (lock_held_by_current_thread (&index->lock));
+	if (strlen (name) > NAME_MAX)
+		return NULL;
+	strlcpy (probe.name, name, sizeof probe.name);
+	return rhash_find (&index->names, &probe);
+}
+
+/* Reads block BLOCK of directory INODE into BUF, and returns true
+ * if the directory has such a block. */
+static bool
+block_read (struct inode *inode, size_t block, uint8_t *buf) {
+	return inode_read_at (inode, buf, DIR_BLOCK, block * DIR_BLOCK)
+		== DIR_BLOCK;
+}
+
+/* Writes BUF to block BLOCK of directory INODE, extending the
+ * directory if BLOCK is just past its end.  Returns true if
+ * successful. */
+static bool
+block_write (struct inode *inode, size_t block, const uint8_t *buf) {
+	return inode_write_at (inode, buf, DIR_BLOCK, block * DIR_BLOCK)
+		== DIR_BLOCK;
+}
+
+/* Initializes BUF as an empty directory block, with one free
+ * record that spans it. */
+static void
+block_init (uint8_t *buf) {
+	struct dir_block_header *h = (struct dir_block_header *) buf;
+	struct dir_record *r = (struct dir_record *) (h + 1);
+
+	memset (buf, 0, DIR_BLOCK);
+	h->free = DIR_BLOCK - sizeof *h;
+	r->rec_len = DIR_BLOCK - sizeof *h;
+}
+
+/* Returns the record at offset OFS of directory block BUF, or a
+ * null pointer if OFS is the end of the block or the record there
+ * is damaged. */
+static struct dir_record *
+record_at (uint8_t *buf, size_t ofs) {
+	struct dir_record *r = (struct dir_record *) (buf + ofs);
+
+	if (ofs + sizeof *r > DIR_BLOCK || r->rec_len < sizeof *r
+			|| r->rec_len > DIR_BLOCK - ofs || r->name_len > NAME_MAX
+			|| RECORD_SIZE (r->name_len) > r->rec_len)
+		return NULL;
+	return r;
+}
+
+/* Returns true if record R holds an entry. */
+static bool
+record_in_use (const struct dir_record *r) {
+	return r->inode_sector != 0 && r->name_len > 0;
+}
+
+/* Adds an entry for NAME, with inode INODE_SECTOR, to directory
+ * block BUF, in the first free space large enough for it.  Returns
+ * its offset in the block, or 0 if no space is. */
+static size_t
+block_insert (uint8_t *buf, const char *name, disk_sector_t inode_sector) {
+	struct dir_block_header *h = (struct dir_block_header *) buf;
+	size_t len = strlen (name), need = RECORD_SIZE (len);
+	struct dir_record *r;
+	size_t ofs;
+
+	for (ofs = sizeof *h; (r = record_at (buf, ofs)) != NULL;
+			ofs += r->rec_len) {
+		size_t used = record_in_use (r) ? RECORD_SIZE (r->name_len) : 0;
+		struct dir_record *e = (struct dir_record *) (buf + ofs + used);
+
+		if (r->rec_len - used < need)
+			continue;
+		e->rec_len = r->rec_len - used;
+		if (used > 0)
+			r->rec_len = used;
+		e->inode_sector = inode_sector;
+		e->name_len = len;
+		memcpy (e->name, name, len);
+		h->free -= need;
+		h->cnt++;
+		return ofs + used;
+	}
+	return 0;
+}
+
+/* Removes the entry at offset OFS from directory block BUF.
+ * Returns false if no entry starts there. */
+static bool
+block_remove (uint8_t *buf, size_t ofs) {
+	struct dir_block_header *h = (struct dir_block_header *) buf;
+	struct dir_record *r, *prev = NULL;
+	size_t i;
+
+	for (i = sizeof *h; (r = record_at (buf, i)) != NULL && i < ofs;
+			i += r->rec_len)
+		prev = r;
+	if (r == NULL || i != ofs || !record_in_use (r))
+		return false;
+
+	h->free += RECORD_SIZE (r->name_len);
+	h->cnt--;
+	if (prev != NULL)
+		prev->rec_len += r->rec_len;
+	else {
+		r->inode_sector = 0;
+		r->name_len = 0;
+	}
+	return true;
+}
+
+static uint64_t
+slot_hash (const void *slot, void *aux UNUSED) {
+	return hash_string (((const struct dir_slot *) slot)->name);
+}
+
+static bool
+slot_equal (const void *a, const void *b, void *aux UNUSED) {
+	return !strcmp (((const struct dir_slot *) a)->name,
+			((const struct dir_slot *) b)->name);
+}
+
+static void
+slot_free (void *slot, void *aux UNUSED) {
+	kmem_cache_free (slot_cache, slot);
 }
@@ -1,6 +1,10 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
+#include <round.h>
 #include "devices/disk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include <stdio.h>
@@ -14,9 +18,16 @@ struct fat_boot {
 	unsigned int fat_start;
 	unsigned int fat_sectors; /* Size of FAT in sectors. */
 	unsigned int root_dir_cluster;
+	unsigned int fat_used_sectors; /* FAT sectors on disk, or 0 for all. */
 };
 
-/* FAT FS */
+/* FAT FS.  Unless FAT_LAZY, FAT holds the whole table.  With
+   FAT_LAZY it is null, and cells are read and written in the
+   buffer cache, so that mounting reads nothing but the boot sector.
+   USED then covers only the FAT sectors marked in INDEXED, each
+   brought in the first time an allocation or update reaches it;
+   clusters of other sectors count as free in FREE_CNT until
+   then. */
 struct fat_fs {
 	struct fat_boot bs;
 	unsigned int *fat;
@@ -24,12 +35,50 @@ struct fat_fs {
 	disk_sector_t data_start;
 	cluster_t last_clst;
 	struct lock write_lock;
+	struct bitmap *used;    /* Clusters in a chain or preallocated. */
+	size_t free_cnt;        /* Clear bits in USED. */
+	size_t prealloc_cnt;    /* Preallocated clusters. */
+	cluster_t cursor;       /* Where a new chain's search starts. */
+	struct bitmap *indexed; /* FAT sectors reflected in USED. */
 };
 
+/* FAT cells per sector. */
+#define CELLS_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (cluster_t))
+
+bool fat_lazy;
+
+/* Clusters set aside past the end of a chain that is growing one
+   cluster at a time, so that the chain stays contiguous while other
+   chains grow next to it.  NEXT is the cluster the chain takes
+   next, that is, one past its last cluster, and the run ends before
+   END.  A slot with NEXT == END is unused. */
+struct fat_prealloc {
+	cluster_t next;
+	cluster_t end;
+};
+
+/* Most clusters preallocated for one chain, and most chains with a
+   preallocation at a time. */
+#define PREALLOC_CLUSTERS 8
+#define PREALLOC_SLOTS 8
+
 static struct fat_fs *fat_fs;
+static struct fat_prealloc preallocs[PREALLOC_SLOTS];
+static size_t prealloc_hand;   /* Slot to reuse when all are taken. */
 
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_index_init (void);
+static void index_set (cluster_t start, size_t cnt, bool used);
+static cluster_t fat_alloc (cluster_t near, bool new_chain);
+static void prealloc_reserve (cluster_t next);
+static void prealloc_drop (struct fat_prealloc *);
+static struct fat_prealloc *prealloc_find (cluster_t next);
+static void fat_transfer (unsigned sectors, bool write);
+static cluster_t cell_get (cluster_t);
+static void cell_set (cluster_t, cluster_t val);
+static bool index_cover (cluster_t start, size_t cnt);
+static size_t scan_free (size_t start, size_t cnt);
 
 void
 fat_init (void) {
@@ -51,37 +100,49 @@ fat_init (void) {
 	fat_fs_init ();
 }
 
+/* Loads the FAT from the disk.  Only the sectors that format and
+ * later closes wrote are read; the rest of the table is free. */
 void
 fat_open (void) {
+	unsigned used = fat_fs->bs.fat_used_sectors;
+
+	if (fat_lazy) {
+		fat_index_init ();
+		return;
+	}
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
-
-	// Load FAT directly from the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_read = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
-	}
+	if (used == 0 || used > fat_fs->bs.fat_sectors)
+		used = fat_fs->bs.fat_sectors;
+	fat_transfer (used, false);
+	fat_index_init ();
 }
 
 void
 fat_close (void) {
+	// Preallocations live only in memory
+	for (size_t i = 0; i < PREALLOC_SLOTS; i++)
+		prealloc_drop (&preallocs[i]);
+
+
+	// Write the FAT up to its last cluster in use, and past that
+	// whatever the disk may still hold from before, then the boot
+	// sector that says where the FAT ends.  A lazy FAT is in the
+	// cache already, and cell_set() kept the count up to date.
+	if (!fat_lazy) {
+		cluster_t last = fat_fs->fat_length - 1;
+		while (last > 0 && fat_fs->fat[last] == 0)
+			last--;
+		unsigned used = DIV_ROUND_UP ((last + 1) * sizeof (cluster_t),
+				DISK_SECTOR_SIZE);
+		unsigned stale = fat_fs->bs.fat_used_sectors;
+		if (stale == 0 || stale > fat_fs->bs.fat_sectors)
+			stale = fat_fs->bs.fat_sectors;
+		fat_transfer (used > stale ? used : stale, true);
+		fat_fs->bs.fat_used_sectors = used;
+	}
+
 	// Write FAT boot sector
 	uint8_t *bounce = calloc (1, DISK_SECTOR_SIZE);
 	if (bounce == NULL)
@@ -89,40 +150,68 @@ fat_close (void) {
 	memcpy (bounce, &fat_fs->bs, sizeof (fat_fs->bs));
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
+}
 
-	// Write FAT directly to the disk
+/* Reads the first SECTORS sectors of the FAT from the disk into
+ * the table, or writes them from it if WRITE.  Whole sectors move
+ * DISK_MULTIPLE_MAX at a time; a last partial one goes through a
+ * bounce buffer, and any sectors past it hold no clusters. */
+static void
+fat_transfer (unsigned sectors, bool write) {
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
+	const size_t fat_bytes = fat_fs->fat_length * sizeof (cluster_t);
+	unsigned whole = fat_bytes / DISK_SECTOR_SIZE;
+	disk_sector_t start = fat_fs->bs.fat_start;
+
+	if (whole > sectors)
+		whole = sectors;
+	for (unsigned i = 0; i < whole; ) {
+		size_t cnt = whole - i < DISK_MULTIPLE_MAX
+			? whole - i : DISK_MULTIPLE_MAX;
+
+		if (write)
+			disk_write_multiple (filesys_disk, start + i, cnt,
+					buffer + i * DISK_SECTOR_SIZE);
+		else
+			disk_read_multiple (filesys_disk, start + i, cnt,
+					buffer + i * DISK_SECTOR_SIZE);
+		i += cnt;
+	}
+	if (whole < sectors) {
+		size_t ofs = (size_t) whole * DISK_SECTOR_SIZE;
+		uint8_t *bounce = calloc (1, DISK_SECTOR_SIZE);
+
+		if (bounce == NULL)
+			PANIC ("FAT transfer failed");
+		if (write) {
+			memcpy (bounce, buffer + ofs, fat_bytes - ofs);
+			disk_write (filesys_disk, start + whole, bounce);
 		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
+			disk_read (filesys_disk, start + whole, bounce);
+			memcpy (buffer + ofs, bounce, fat_bytes - ofs);
 		}
+		free (bounce);
 	}
 }
 
 void
 fat_create (void) {
-	// Create FAT boot
+	// Create FAT boot.  Whatever the disk holds past the FAT
+	// sectors fat_close() writes is not part of the new table, so
+	// format writes only those.
 	fat_boot_create ();
+	fat_fs->bs.fat_used_sectors = 1;
 	fat_fs_init ();
 
 	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT creation failed");
+	if (fat_lazy)
+		fat_fs->bs.fat_used_sectors = 0;
+	else {
+		fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
+		if (fat_fs->fat == NULL)
+			PANIC ("FAT creation failed");
+	}
+	fat_index_init ();
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
@@ -143,7 +232,7 @@ fat_boot_create (void) {
 	fat_fs->bs = (struct fat_boot){
 	    .magic = FAT_MAGIC,
 	    .sectors_per_cluster = SECTORS_PER_CLUSTER,
-	    .total_sectors = disk_size (filesys_disk),
+	    .total_sectors = disk_size (filesys_disk) - journal_size (),
 	    .fat_start = 1,
 	    .fat_sectors = fat_sectors,
 	    .root_dir_cluster = ROOT_DIR_CLUSTER,
@@ -152,7 +241,122 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER + 1;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
+	lock_init (&fat_fs->write_lock);
+}
+
+/* Builds the index of clusters in use from the FAT.  Cluster 0
+   never holds data. */
+static void
+fat_index_init (void) {
+	bitmap_destroy (fat_fs->used);
+	bitmap_destroy (fat_fs->indexed);
+	fat_fs->used = bitmap_create (fat_fs->fat_length);
+	fat_fs->indexed = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->used == NULL || fat_fs->indexed == NULL)
+		PANIC ("FAT index creation failed");
+	bitmap_mark (fat_fs->used, 0);
+	if (!fat_lazy) {
+		for (cluster_t c = 1; c < fat_fs->fat_length; c++)
+			if (fat_fs->fat[c] != 0)
+				bitmap_mark (fat_fs->used, c);
+		bitmap_set_all (fat_fs->indexed, true);
+	}
+	fat_fs->free_cnt = bitmap_count (fat_fs->used, 0, fat_fs->fat_length,
+			false);
+	fat_fs->prealloc_cnt = 0;
+	fat_fs->cursor = ROOT_DIR_CLUSTER;
+}
+
+/* Makes sure USED covers the CNT clusters from START, reading in
+   the FAT sectors that hold them if need be.  Returns true if USED
+   changed.  Must hold WRITE_LOCK, or be formatting. */
+static bool
+index_cover (cluster_t start, size_t cnt) {
+	size_t first = start / CELLS_PER_SECTOR;
+	size_t end = DIV_ROUND_UP (start + cnt, CELLS_PER_SECTOR);
+	bool changed = false;
+
+	if (end > fat_fs->bs.fat_sectors)
+		end = fat_fs->bs.fat_sectors;
+	for (size_t s = first; s < end; s++) {
+		if (bitmap_test (fat_fs->indexed, s))
+			continue;
+		bitmap_mark (fat_fs->indexed, s);
+		for (cluster_t c = s * CELLS_PER_SECTOR;
+				c < (s + 1) * CELLS_PER_SECTOR && c < fat_fs->fat_length; c++)
+			if (c != 0 && cell_get (c) != 0) {
+				bitmap_mark (fat_fs->used, c);
+				fat_fs->free_cnt--;
+				changed = true;
+			}
+	}
+	return changed;
+}
+
+/* Returns the first of CNT clusters in a row that are free from
+   START on, or BITMAP_ERROR, reading FAT sectors in as the search
+   reaches them.  Must hold WRITE_LOCK. */
+static size_t
+scan_free (size_t start, size_t cnt) {
+	size_t c;
+
+	do
+		c = bitmap_scan (fat_fs->used, start, cnt, false);
+	while (c != BITMAP_ERROR && index_cover (c, cnt));
+	return c;
+}
+
+/* Returns FAT cell CLST.  A lazy FAT reads it through the cache;
+   sectors past those on disk hold only zeros. */
+static cluster_t
+cell_get (cluster_t clst) {
+	size_t s = clst / CELLS_PER_SECTOR;
+	cluster_t val;
+
+	if (!fat_lazy)
+		return fat_fs->fat[clst];
+	if (s >= fat_fs->bs.fat_used_sectors)
+		return 0;
+	cache_read_at (fat_fs->bs.fat_start + s, &val,
+			clst % CELLS_PER_SECTOR * sizeof val, sizeof val);
+	return val;
+}
+
+/* Sets FAT cell CLST to VAL.  A lazy FAT that reaches past the
+   sectors on disk zero-fills the sectors up to CLST's first, in
+   the cache, for the flusher to write. */
+static void
+cell_set (cluster_t clst, cluster_t val) {
+	static const uint8_t zeros[DISK_SECTOR_SIZE];
+	size_t s = clst / CELLS_PER_SECTOR;
+
+	if (!fat_lazy) {
+		fat_fs->fat[clst] = val;
+		return;
+	}
+	while (fat_fs->bs.fat_used_sectors <= s)
+		cache_write (fat_fs->bs.fat_start + fat_fs->bs.fat_used_sectors++,
+				zeros);
+	cache_write_at (fat_fs->bs.fat_start + s, &val,
+			clst % CELLS_PER_SECTOR * sizeof val, sizeof val);
+}
+
+/* Marks the CNT clusters from START in the index as USED or free,
+   keeping FREE_CNT in step.  Each must be in the other state. */
+static void
+index_set (cluster_t start, size_t cnt, bool used) {
+	index_cover (start, cnt);
+	ASSERT (used ? bitmap_none (fat_fs->used, start, cnt)
+			: bitmap_all (fat_fs->used, start, cnt));
+	bitmap_set_multiple (fat_fs->used, start, cnt, used);
+	if (used)
+		fat_fs->free_cnt -= cnt;
+	else
+		fat_fs->free_cnt += cnt;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -161,33 +365,204 @@ fat_fs_init (void) {
 
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
- * Returns 0 if fails to allocate a new cluster. */
+ * Returns 0 if fails to allocate a new cluster.
+ *
+ * Allocation keeps chains contiguous where it can.  A chain grows
+ * into the cluster right after CLST when that one is free, or into
+ * its preallocation.  Otherwise it takes the nearest free cluster
+ * after CLST.  A new chain starts at the first run of
+ * PREALLOC_CLUSTERS free clusters after a next-fit cursor, which
+ * leaves it room to grow, and the cursor moves past that room.  Once a chain grows sequentially, the
+ * clusters after its end are preallocated to it. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	struct fat_prealloc *p;
+	cluster_t new;
+
+	ASSERT (clst < fat_fs->fat_length);
+
+	lock_acquire (&fat_fs->write_lock);
+	p = clst != 0 ? prealloc_find (clst + 1) : NULL;
+	if (p != NULL) {
+		/* Already marked in USED.  The rest of the run stays with
+		   the chain's new end. */
+		new = p->next++;
+		fat_fs->prealloc_cnt--;
+	} else {
+		new = fat_alloc (clst != 0 ? clst : fat_fs->cursor, clst == 0);
+		if (new == 0) {
+			lock_release (&fat_fs->write_lock);
+			return 0;
+		}
+	}
+
+	cell_set (new, EOChain);
+	if (clst != 0)
+		cell_set (clst, new);
+
+	/* A chain that grew by one contiguous cluster is likely to keep
+	   growing. */
+	if (clst != 0 && new == clst + 1 && p == NULL)
+		prealloc_reserve (new + 1);
+	lock_release (&fat_fs->write_lock);
+	return new;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		cell_set (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = cell_get (clst);
+		struct fat_prealloc *p;
+
+		ASSERT (clst < fat_fs->fat_length);
+		if (next == EOChain && (p = prealloc_find (clst + 1)) != NULL)
+			prealloc_drop (p);
+		index_cover (clst, 1);
+		cell_set (clst, 0);
+		index_set (clst, 1, false);
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
+}
+
+/* Returns the clusters preallocated to the chain that ends at CLST
+ * to the free pool.  Called when the file that owns the chain is
+ * closed. */
+void
+fat_release_prealloc (cluster_t clst) {
+	struct fat_prealloc *p;
+
+	lock_acquire (&fat_fs->write_lock);
+	p = prealloc_find (clst + 1);
+	if (p != NULL)
+		prealloc_drop (p);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	index_cover (clst, 1);
+	cell_set (clst, val);
+	if (bitmap_test (fat_fs->used, clst) != (val != 0))
+		index_set (clst, 1, val != 0);
+}
+
+/* Returns the number of clusters free for new data, counting
+ * preallocated ones, which are given up on demand.  With a lazy
+ * FAT, the clusters of sectors not yet read count as free. */
+size_t
+fat_free_clusters (void) {
+	size_t cnt;
+
+	lock_acquire (&fat_fs->write_lock);
+	cnt = fat_fs->free_cnt + fat_fs->prealloc_cnt;
+	lock_release (&fat_fs->write_lock);
+	return cnt;
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return cell_get (clst);
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/* Marks a free cluster used and returns it, or returns 0 if the
+ * disk is full.  Takes NEAR + 1 if it is free, else the first free
+ * cluster after NEAR, wrapping around.  For a NEW_CHAIN, prefers
+ * the start of a run of PREALLOC_CLUSTERS free clusters.  Drops
+ * every preallocation before giving up.  Must hold WRITE_LOCK. */
+static cluster_t
+fat_alloc (cluster_t near, bool new_chain) {
+	size_t runs[] = { PREALLOC_CLUSTERS, 1 };
+	size_t start = near + 1 < fat_fs->fat_length ? near + 1 : 1;
+
+	ASSERT (lock_held_by_current_thread (&fat_fs->write_lock));
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t i = new_chain ? 0 : 1; i < 2 && fat_fs->free_cnt > 0;
+				i++) {
+			size_t c = scan_free (start, runs[i]);
+
+			if (c == BITMAP_ERROR)
+				c = scan_free (1, runs[i]);
+			if (c != BITMAP_ERROR) {
+				index_set (c, 1, true);
+
+				/* Next fit: the following new chain starts its search
+				   past the room left for this one to grow. */
+				if (new_chain)
+					fat_fs->cursor = c + PREALLOC_CLUSTERS < fat_fs->fat_length
+						? c + PREALLOC_CLUSTERS : ROOT_DIR_CLUSTER;
+				return c;
+			}
+		}
+		for (size_t i = 0; i < PREALLOC_SLOTS; i++)
+			prealloc_drop (&preallocs[i]);
+	}
+	return 0;
+}
+
+/* Preallocates up to PREALLOC_CLUSTERS free clusters from NEXT on
+ * to the chain that ends just before NEXT, taking over the oldest
+ * preallocation if every slot is in use.  Must hold WRITE_LOCK. */
+static void
+prealloc_reserve (cluster_t next) {
+	struct fat_prealloc *p = NULL;
+	cluster_t end = next;
+
+	index_cover (next, PREALLOC_CLUSTERS);
+	while (end < fat_fs->fat_length && end - next < PREALLOC_CLUSTERS
+			&& !bitmap_test (fat_fs->used, end))
+		end++;
+	if (end == next)
+		return;
+
+	for (size_t i = 0; i < PREALLOC_SLOTS && p == NULL; i++)
+		if (preallocs[i].next == preallocs[i].end)
+			p = &preallocs[i];
+	if (p == NULL) {
+		p = &preallocs[prealloc_hand];
+		prealloc_hand = (prealloc_hand + 1) % PREALLOC_SLOTS;
+		prealloc_drop (p);
+	}
+	index_set (next, end - next, true);
+	fat_fs->prealloc_cnt += end - next;
+	p->next = next;
+	p->end = end;
+}
+
+/* Returns preallocation P's clusters to the free pool.  Must hold
+ * WRITE_LOCK. */
+static void
+prealloc_drop (struct fat_prealloc *p) {
+	if (p->next < p->end) {
+		index_set (p->next, p->end - p->next, false);
+		fat_fs->prealloc_cnt -= p->end - p->next;
+	}
+	p->next = p->end = 0;
+}
+
+/* Returns the preallocation whose next cluster is NEXT, or a null
+ * pointer if none.  Must hold WRITE_LOCK. */
+static struct fat_prealloc *
+prealloc_find (cluster_t next) {
+	for (size_t i = 0; i < PREALLOC_SLOTS; i++)
+		if (preallocs[i].next == next && next < preallocs[i].end)
+			return &preallocs[i];
+	return NULL;
 }
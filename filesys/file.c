@@ -1,29 +1,69 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include "filesys/directory.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* An open file. */
+/* An open file.  POS_LOCK serializes the reads, writes and seeks
+ * that move POS, for holders that share FILE through file_dup(),
+ * and guards the read-ahead state.  It nests inside the inode's
+ * lock. */
 struct file {
 	struct inode *inode;        /* File's inode. */
+	struct lock pos_lock;       /* Guards POS and RA_*. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	int refs;                   /* Holders; see file_dup(). */
+	off_t ra_next;              /* Where a sequential read would start. */
+	off_t ra_last;              /* Where the last read started. */
+	off_t ra_stride;            /* RA_LAST less the read before's start. */
+	off_t ra_end;               /* End of what was already read ahead. */
+	bool ra_strided;            /* RA_END is the next stride to ask for? */
+	int ra_window;              /* Sectors to read ahead, 0 if random. */
 };
 
+/* Bounds of the read-ahead window, in sectors. */
+#define RA_MIN 4
+#define RA_MAX 16
+
+static void file_readahead (struct file *, off_t ofs, off_t bytes);
+
+/* Slab cache for struct file. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the open file module. */
+void
+file_init (void) {
+	file_cache = kmem_cache_create ("file", sizeof (struct file), 0, NULL);
+	if (file_cache == NULL)
+		PANIC ("file_init: out of memory");
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) {
-	struct file *file = calloc (1, sizeof *file);
+	struct file *file = kmem_cache_alloc (file_cache);
 	if (inode != NULL && file != NULL) {
 		file->inode = inode;
+		lock_init (&file->pos_lock);
 		file->pos = 0;
 		file->deny_write = false;
+		file->refs = 1;
+		file->ra_next = 0;
+		file->ra_last = 0;
+		file->ra_stride = 0;
+		file->ra_end = 0;
+		file->ra_strided = false;
+		file->ra_window = 0;
 		return file;
 	} else {
 		inode_close (inode);
-		free (file);
+		kmem_cache_free (file_cache, file);
 		return NULL;
 	}
 }
@@ -42,19 +82,30 @@ file_duplicate (struct file *file) {
 	struct file *nfile = file_open (inode_reopen (file->inode));
 	if (nfile) {
 		nfile->pos = file->pos;
+		nfile->ra_next = file->pos;
 		if (file->deny_write)
 			file_deny_write (nfile);
 	}
 	return nfile;
 }
 
+/* Returns FILE with one more holder, who shares its position and
+ * closes it separately.  FILE stays open until every holder has
+ * closed it. */
+struct file *
+file_dup (struct file *file) {
+	__atomic_add_fetch (&file->refs, 1, __ATOMIC_RELAXED);
+	return file;
+}
+
 /* Closes FILE. */
 void
 file_close (struct file *file) {
-	if (file != NULL) {
+	if (file != NULL
+			&& __atomic_sub_fetch (&file->refs, 1, __ATOMIC_ACQ_REL) == 0) {
 		file_allow_write (file);
 		inode_close (file->inode);
-		free (file);
+		kmem_cache_free (file_cache, file);
 	}
 }
 
@@ -71,8 +122,13 @@ file_get_inode (struct file *file) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
-	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	off_t bytes_read;
+
+	lock_acquire (&file->pos_lock);
+	bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	file_readahead (file, file->pos, bytes_read);
 	file->pos += bytes_read;
+	lock_release (&file->pos_lock);
 	return bytes_read;
 }
 
@@ -83,7 +139,77 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
-	return inode_read_at (file->inode, buffer, size, file_ofs);
+	off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+
+	lock_acquire (&file->pos_lock);
+	file_readahead (file, file_ofs, bytes_read);
+	lock_release (&file->pos_lock);
+	return bytes_read;
+}
+
+/* Notes that BYTES bytes at OFS were just read from FILE, and asks
+ * in the background for what the pattern of reads says comes next.
+ *
+ * A read that starts where the previous one ended is sequential:
+ * it opens the read-ahead window, or doubles it up to RA_MAX
+ * sectors, and asks for the window past the read.  A read that
+ * starts as far past the previous one's start as that one was past
+ * its predecessor's is strided: the window grows the same way, and
+ * as many of the next reads at that stride as it holds are asked
+ * for.  Any other read is a miss and halves the window.  Below
+ * RA_MIN the window closes, and nothing is read ahead until a
+ * pattern shows up again.  Must hold FILE's POS_LOCK. */
+static void
+file_readahead (struct file *file, off_t ofs, off_t bytes) {
+	off_t end = ofs + bytes, stride = ofs - file->ra_last, limit;
+	bool seq = ofs == file->ra_next;
+	bool strided = !seq && stride > bytes && stride == file->ra_stride;
+
+	ASSERT (lock_held_by_current_thread (&file->pos_lock));
+	if (bytes <= 0)
+		return;
+	file->ra_next = end;
+	file->ra_last = ofs;
+	file->ra_stride = stride;
+	if (seq || strided) {
+		if (file->ra_window == 0)
+			file->ra_window = RA_MIN;
+		else if (file->ra_window < RA_MAX)
+			file->ra_window *= 2;
+	} else if ((file->ra_window /= 2) < RA_MIN)
+		file->ra_window = 0;
+
+	if (strided) {
+		/* Reads ahead of this one, as many as fit the window. */
+		off_t ahead = file->ra_window * DISK_SECTOR_SIZE
+			/ ROUND_UP (bytes, DISK_SECTOR_SIZE);
+
+		if (!file->ra_strided || file->ra_end <= ofs) {
+			file->ra_end = ofs + stride;
+			file->ra_strided = true;
+		}
+		limit = ofs + (ahead > 0 ? ahead : 1) * stride;
+		if (limit > file_length (file))
+			limit = file_length (file);
+		for (; file->ra_end <= limit; file->ra_end += stride)
+			inode_readahead (file->inode, file->ra_end, bytes);
+		return;
+	}
+	if (!seq || file->ra_strided) {
+		file->ra_end = end;
+		file->ra_strided = false;
+	}
+	if (file->ra_window == 0)
+		return;
+
+	/* Only ask for what earlier reads did not. */
+	limit = end + file->ra_window * DISK_SECTOR_SIZE;
+	if (file->ra_end < end)
+		file->ra_end = end;
+	if (file->ra_end < limit) {
+		inode_readahead (file->inode, file->ra_end, limit - file->ra_end);
+		file->ra_end = limit;
+	}
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -95,8 +221,12 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
-	off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+	off_t bytes_written;
+
+	lock_acquire (&file->pos_lock);
+	bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
 	file->pos += bytes_written;
+	lock_release (&file->pos_lock);
 	return bytes_written;
 }
 
@@ -113,6 +243,48 @@ file_write_at (struct file *file, const void *buffer, off_t size,
 	return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Writes FILE's data to disk and, unless DATA_ONLY is set and
+ * only data changed, its inode. */
+void
+file_sync (struct file *file, bool data_only) {
+	ASSERT (file != NULL);
+	inode_sync (file->inode, data_only);
+}
+
+/* Packs as many entries of directory FILE, from its position on,
+ * as fit in SIZE bytes of BUF as struct dirents, and advances the
+ * position past them.  Returns the bytes stored, 0 at the end of
+ * the directory, or -1 if FILE is not a directory or the next
+ * entry does not fit. */
+off_t
+file_getdents (struct file *file, void *buf, size_t size) {
+	off_t n;
+
+	ASSERT (file != NULL);
+	if (!inode_is_dir (file->inode))
+		return -1;
+	lock_acquire (&file->pos_lock);
+	n = dir_getdents (file->inode, &file->pos, buf, size);
+	if (n == 0 && file->pos < inode_length (file->inode))
+		n = -1;
+	lock_release (&file->pos_lock);
+	return n;
+}
+
+/* Reserves the space for LEN bytes of FILE from OFS on, growing
+ * FILE if they run past its end, as inode_allocate() does.  The
+ * caller holds FILE's inode locked for writing.  Returns false if
+ * the range is empty or too large, if FILE is a directory, or if
+ * the space cannot be had. */
+bool
+file_allocate (struct file *file, off_t ofs, off_t len) {
+	ASSERT (file != NULL);
+	if (ofs < 0 || len <= 0 || ofs > INT32_MAX - len
+			|| inode_is_dir (file->inode))
+		return false;
+	return inode_allocate (file->inode, ofs + len);
+}
+
 /* Prevents write operations on FILE's underlying inode
  * until file_allow_write() is called or FILE is closed. */
 void
@@ -149,7 +321,9 @@ void
 file_seek (struct file *file, off_t new_pos) {
 	ASSERT (file != NULL);
 	ASSERT (new_pos >= 0);
+	lock_acquire (&file->pos_lock);
 	file->pos = new_pos;
+	lock_release (&file->pos_lock);
 }
 
 /* Returns the current position in FILE as a byte offset from the
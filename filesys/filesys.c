@@ -2,16 +2,43 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "devices/disk.h"
+#include "threads/init.h"
+
+/* Most symbolic links one lookup follows. */
+#define SYMLINK_MAX 8
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
+/* Locking.  No lock covers the whole file system: each structure
+ * has its own, and a thread takes them only in this order,
+ * outermost first, so that no two threads wait on each other:
+ *
+ *   1. An inode's lock, for one read or write system call; see
+ *      inode_lock().  copy_file_range() takes two, in sector order.
+ *   2. A file's POS_LOCK (file.c).
+ *   3. INDEX_BUILD_LOCK, then a directory's index lock
+ *      (directory.c).
+ *   4. The free map's lock, or the FAT's.
+ *   5. The page cache's lock (page_cache.c).
+ *   6. An inode's EXTENT_LOCK.
+ *   7. OPEN_INODES_LOCK (inode.c), then the journal's and the
+ *      buffer cache's own locks.
+ *
+ * A copy to or from user memory under 1, 2 or 5 may fault.  The
+ * page fault path reads and writes files taking only 5 and below,
+ * and skips 5 when its thread already holds it. */
+
 static void do_format (void);
+static struct inode *lookup (struct dir *, const char *name);
+static struct inode *follow_links (struct dir *, struct inode *);
 
 /* Initializes the file system module.
  * If FORMAT is true, reformats the file system. */
@@ -21,23 +48,35 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	cache_init ();
+	journal_init (format);
 	inode_init ();
+	file_init ();
+	dir_init ();
+	boot_phase ("filesys_init");
 
 #ifdef EFILESYS
 	fat_init ();
+	boot_phase ("fat_init");
 
-	if (format)
+	if (format) {
 		do_format ();
+		boot_phase ("format");
+	}
 
 	fat_open ();
+	boot_phase ("fat_open");
 #else
 	/* Original FS */
 	free_map_init ();
 
-	if (format)
+	if (format) {
 		do_format ();
+		boot_phase ("format");
+	}
 
 	free_map_open ();
+	boot_phase ("free_map_open");
 #endif
 }
 
@@ -45,12 +84,15 @@ filesys_init (bool format) {
  * to disk. */
 void
 filesys_done (void) {
+	dir_done ();
 	/* Original FS */
 #ifdef EFILESYS
 	fat_close ();
 #else
 	free_map_close ();
 #endif
+	journal_done ();
+	cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -60,14 +102,46 @@ filesys_done (void) {
 bool
 filesys_create (const char *name, off_t initial_size) {
 	disk_sector_t inode_sector = 0;
-	struct dir *dir = dir_open_root ();
-	bool success = (dir != NULL
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = (dir != NULL
 			&& free_map_allocate (1, &inode_sector)
-			&& inode_create (inode_sector, initial_size)
+			&& inode_create (inode_sector, initial_size, false)
 			&& dir_add (dir, name, inode_sector));
 	if (!success && inode_sector != 0)
 		free_map_release (inode_sector, 1);
 	dir_close (dir);
+	journal_end ();
+
+	return success;
+}
+
+/* Creates a symbolic link named LINKPATH to TARGET.  Opening the
+ * link opens whatever TARGET names when it is opened.
+ * Returns true if successful, false otherwise.
+ * Fails if a file named LINKPATH already exists, if TARGET is
+ * empty or too long, or if internal memory allocation fails. */
+bool
+filesys_symlink (const char *target, const char *linkpath) {
+	disk_sector_t inode_sector = 0;
+	struct dir *dir;
+	bool success;
+
+	if (*target == '\0')
+		return false;
+	journal_begin ();
+	dir = dir_open_root ();
+	success = (dir != NULL
+			&& free_map_allocate (1, &inode_sector)
+			&& inode_create_symlink (inode_sector, target)
+			&& dir_add (dir, linkpath, inode_sector));
+	if (!success && inode_sector != 0)
+		free_map_release (inode_sector, 1);
+	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
@@ -83,21 +157,77 @@ filesys_open (const char *name) {
 	struct inode *inode = NULL;
 
 	if (dir != NULL)
-		dir_lookup (dir, name, &inode);
+		inode = follow_links (dir, lookup (dir, name));
 	dir_close (dir);
 
 	return file_open (inode);
 }
 
+/* Returns the inode NAME names in DIR, or a null pointer. */
+static struct inode *
+lookup (struct dir *dir, const char *name) {
+	struct inode *inode;
+
+	/* "/" names the root directory itself, for getdents(). */
+	if (!strcmp (name, "/"))
+		return inode_reopen (dir_get_inode (dir));
+	dir_lookup (dir, name, &inode);
+	return inode;
+}
+
+/* Follows INODE, found in DIR, through symbolic links to the inode
+ * they lead to and returns it, or a null pointer if a link dangles
+ * or more than SYMLINK_MAX of them chain, which is how a loop ends
+ * without remembering what was visited.  Takes over the caller's
+ * reference to INODE.
+ *
+ * The first link remembers where the chain led, keyed by DIR's
+ * write generation, which every add or remove bumps, so that while
+ * it stays open it resolves again with no lookups at all.  Links
+ * keep their targets inline, so even a cold chain reads nothing
+ * beyond its inodes. */
+static struct inode *
+follow_links (struct dir *dir, struct inode *inode) {
+	unsigned key = inode_write_gen (dir_get_inode (dir));
+	struct inode *link = inode, *next;
+	disk_sector_t sector;
+
+	if (inode == NULL || !inode_is_symlink (inode))
+		return inode;
+	if (inode_link_cached (link, key, &sector)) {
+		inode = inode_open (sector);
+		inode_close (link);
+		return inode;
+	}
+
+	inode = inode_reopen (link);
+	for (int depth = 0; inode != NULL && inode_is_symlink (inode);
+			depth++) {
+		next = depth < SYMLINK_MAX
+			? lookup (dir, inode_symlink_target (inode)) : NULL;
+		inode_close (inode);
+		inode = next;
+	}
+	if (inode != NULL)
+		inode_link_remember (link, key, inode_get_inumber (inode));
+	inode_close (link);
+	return inode;
+}
+
 /* Deletes the file named NAME.
  * Returns true if successful, false on failure.
  * Fails if no file named NAME exists,
  * or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) {
-	struct dir *dir = dir_open_root ();
-	bool success = dir != NULL && dir_remove (dir, name);
+	struct dir *dir;
+	bool success;
+
+	journal_begin ();
+	dir = dir_open_root ();
+	success = dir != NULL && dir_remove (dir, name);
 	dir_close (dir);
+	journal_end ();
 
 	return success;
 }
@@ -1,13 +1,64 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* The free map on disk is the bitmap, but allocation works from an
+ * index of its runs of free sectors, kept in memory.  Each run is
+ * on the list of its size class, for best fit, and in two hash
+ * tables keyed by its first sector and by the sector just past
+ * it, so that a released run merges with its neighbors in
+ * constant time.  If the index cannot get memory for a run, it is
+ * marked stale and rebuilt from the bitmap before the next
+ * allocation. */
+struct free_extent {
+	disk_sector_t start;                /* First free sector. */
+	size_t cnt;                         /* Number of free sectors. */
+	struct hash_elem start_elem;        /* In BY_START. */
+	struct hash_elem end_elem;          /* In BY_END, keyed by START + CNT. */
+	struct list_elem bucket_elem;       /* In BUCKETS[bucket_of (CNT)]. */
+};
+
+/* Size classes: bucket I holds runs of 2**I to 2**(I + 1) - 1
+ * sectors, and the last one every longer run. */
+#define BUCKET_CNT 16
+
+static struct list buckets[BUCKET_CNT];
+static struct hash by_start, by_end;
+static bool index_stale;
+static struct lock free_map_lock;    /* Guards the bitmap and index. */
+
+/* Free sectors, and how many of them free_map_reserve() has
+ * promised.  Allocations that do not use a reservation may only
+ * take the free sectors that are not promised. */
+static size_t free_cnt;
+static size_t reserved_cnt;
+
+static hash_hash_func start_hash, end_hash;
+static hash_less_func start_less, end_less;
+static void index_rebuild (void);
+static void index_add (disk_sector_t, size_t);
+static void index_remove (struct free_extent *);
+static void index_insert (struct free_extent *);
+static struct free_extent *index_find (struct hash *, disk_sector_t key);
+static struct free_extent *best_fit (size_t cnt, disk_sector_t hint);
+static struct free_extent *largest (disk_sector_t hint);
+static disk_sector_t carve (struct free_extent *, size_t cnt,
+		disk_sector_t hint);
+static size_t allocate (size_t cnt, size_t reserved, disk_sector_t hint,
+		struct free_map_extent ext[], size_t max);
+static void release (disk_sector_t, size_t);
+
 /* Initializes the free map. */
 void
 free_map_init (void) {
@@ -16,6 +67,18 @@ free_map_init (void) {
 		PANIC ("bitmap creation failed--disk is too large");
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+	bitmap_set_multiple (free_map, disk_size (filesys_disk) - journal_size (),
+			journal_size (), true);
+
+	free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+
+	lock_init (&free_map_lock);
+	for (size_t i = 0; i < BUCKET_CNT; i++)
+		list_init (&buckets[i]);
+	if (!hash_init (&by_start, start_hash, start_less, NULL)
+			|| !hash_init (&by_end, end_hash, end_less, NULL))
+		PANIC ("free map index creation failed");
+	index_rebuild ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -24,24 +87,75 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
-	}
-	if (sector != BITMAP_ERROR)
-		*sectorp = sector;
-	return sector != BITMAP_ERROR;
+	return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* As free_map_allocate(), but of the free runs that fit CNT
+ * sectors best, takes the one nearest to sector HINT. */
+bool
+free_map_allocate_near (size_t cnt, disk_sector_t hint,
+		disk_sector_t *sectorp) {
+	struct free_map_extent ext;
+
+	if (allocate (cnt, 0, hint, &ext, 1) == 0)
+		return false;
+	*sectorp = ext.start;
+	return true;
+}
+
+/* Allocates CNT sectors in at most MAX runs, stored into EXT, and
+ * returns the number of runs, or 0 if that many sectors cannot
+ * be found in MAX runs.  One run that fits is preferred; then the
+ * longest runs, each nearest to where the last one ended.  HINT
+ * is where the first should be. */
+size_t
+free_map_allocate_extents (size_t cnt, disk_sector_t hint,
+		struct free_map_extent ext[], size_t max) {
+	return allocate (cnt, 0, hint, ext, max);
+}
+
+/* As free_map_allocate_extents(), but RESERVED of the CNT sectors
+ * come out of a reservation made with free_map_reserve(), which is
+ * used up if the allocation succeeds. */
+size_t
+free_map_allocate_reserved (size_t cnt, size_t reserved, disk_sector_t hint,
+		struct free_map_extent ext[], size_t max) {
+	ASSERT (reserved <= cnt);
+	return allocate (cnt, reserved, hint, ext, max);
+}
+
+/* Promises CNT free sectors to a later
+ * free_map_allocate_reserved(), without choosing them yet.  Returns
+ * false if fewer than CNT sectors are free and unpromised. */
+bool
+free_map_reserve (size_t cnt) {
+	bool success;
+
+	lock_acquire (&free_map_lock);
+	success = free_cnt - reserved_cnt >= cnt;
+	if (success)
+		reserved_cnt += cnt;
+	lock_release (&free_map_lock);
+	return success;
+}
+
+/* Gives back CNT sectors reserved with free_map_reserve() that
+ * will not be allocated after all. */
+void
+free_map_unreserve (size_t cnt) {
+	lock_acquire (&free_map_lock);
+	ASSERT (reserved_cnt >= cnt);
+	reserved_cnt -= cnt;
+	lock_release (&free_map_lock);
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
-	ASSERT (bitmap_all (free_map, sector, cnt));
-	bitmap_set_multiple (free_map, sector, cnt, false);
+	lock_acquire (&free_map_lock);
+	release (sector, cnt);
 	bitmap_write (free_map, free_map_file);
+	lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -50,8 +164,13 @@ free_map_open (void) {
 	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
+	inode_set_journaled (file_get_inode (free_map_file));
 	if (!bitmap_read (free_map, free_map_file))
 		PANIC ("can't read free map");
+	lock_acquire (&free_map_lock);
+	free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+	index_rebuild ();
+	lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -64,14 +183,309 @@ free_map_close (void) {
  * it. */
 void
 free_map_create (void) {
-	/* Create inode. */
-	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+	struct inode *inode;
+
+	/* Create inode.  Marking it journaled places its data, which
+	 * must happen before FREE_MAP_FILE is set, as placing it writes
+	 * the free map. */
+	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
 		PANIC ("free map creation failed");
+	inode = inode_open (FREE_MAP_SECTOR);
+	if (inode == NULL)
+		PANIC ("can't open free map");
+	inode_set_journaled (inode);
 
 	/* Write bitmap to file. */
-	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+	free_map_file = file_open (inode);
 	if (free_map_file == NULL)
 		PANIC ("can't open free map");
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
 }
+
+/* Takes CNT sectors for allocate(), RESERVED of them promised
+ * already: see free_map_allocate_reserved().  Falls back to a scan
+ * of the bitmap for one run if the index is stale and cannot be
+ * rebuilt. */
+static size_t
+allocate (size_t cnt, size_t reserved, disk_sector_t hint,
+		struct free_map_extent ext[], size_t max) {
+	size_t n = 0, left = cnt;
+
+	ASSERT (max > 0);
+
+	lock_acquire (&free_map_lock);
+	ASSERT (reserved <= reserved_cnt);
+	if (free_cnt - (reserved_cnt - reserved) < cnt) {
+		/* Free, but promised to others. */
+		lock_release (&free_map_lock);
+		return 0;
+	}
+	if (index_stale)
+		index_rebuild ();
+	if (index_stale) {
+		disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+
+		if (sector != BITMAP_ERROR) {
+			ext[n].start = sector;
+			ext[n++].cnt = cnt;
+			free_cnt -= cnt;
+			left = 0;
+		}
+	} else
+		while (left > 0 && n < max) {
+			struct free_extent *e = best_fit (left, hint);
+			size_t take;
+
+			if (e == NULL && n + 1 < max)
+				e = largest (hint);
+			if (e == NULL)
+				break;
+			take = e->cnt < left ? e->cnt : left;
+			ext[n].start = carve (e, take, hint);
+			ext[n].cnt = take;
+			bitmap_set_multiple (free_map, ext[n].start, take, true);
+			free_cnt -= take;
+			hint = ext[n].start + take;
+			left -= take;
+			n++;
+		}
+
+	if (left > 0 || (n > 0 && free_map_file != NULL
+				&& !bitmap_write (free_map, free_map_file))) {
+		while (n > 0) {
+			n--;
+			release (ext[n].start, ext[n].cnt);
+		}
+	}
+	if (n > 0)
+		reserved_cnt -= reserved;
+	lock_release (&free_map_lock);
+	return n;
+}
+
+/* Marks CNT sectors from SECTOR free in the bitmap and the index.
+ * Must hold FREE_MAP_LOCK. */
+static void
+release (disk_sector_t sector, size_t cnt) {
+	ASSERT (lock_held_by_current_thread (&free_map_lock));
+	ASSERT (bitmap_all (free_map, sector, cnt));
+
+	bitmap_set_multiple (free_map, sector, cnt, false);
+	free_cnt += cnt;
+	if (!index_stale)
+		index_add (sector, cnt);
+}
+
+/* Returns the size class of a run of CNT sectors. */
+static size_t
+bucket_of (size_t cnt) {
+	size_t b = 63 - __builtin_clzll (cnt);
+
+	return b < BUCKET_CNT ? b : BUCKET_CNT - 1;
+}
+
+/* Returns how far run E is from sector HINT. */
+static size_t
+distance (const struct free_extent *e, disk_sector_t hint) {
+	if (hint < e->start)
+		return e->start - hint;
+	if (hint >= e->start + e->cnt)
+		return hint - (e->start + e->cnt) + 1;
+	return 0;
+}
+
+/* Returns the shortest free run of at least CNT sectors, the one
+ * nearest to HINT among equals, or a null pointer if none is that
+ * long.  Must hold FREE_MAP_LOCK. */
+static struct free_extent *
+best_fit (size_t cnt, disk_sector_t hint) {
+	for (size_t b = bucket_of (cnt); b < BUCKET_CNT; b++) {
+		struct free_extent *best = NULL;
+
+		for (struct list_elem *e = list_begin (&buckets[b]);
+				e != list_end (&buckets[b]); e = list_next (e)) {
+			struct free_extent *f = list_entry (e, struct free_extent,
+					bucket_elem);
+
+			if (f->cnt < cnt)
+				continue;
+			if (best == NULL || f->cnt < best->cnt
+					|| (f->cnt == best->cnt
+						&& distance (f, hint) < distance (best, hint)))
+				best = f;
+		}
+
+		/* Every run in a later bucket is longer. */
+		if (best != NULL)
+			return best;
+	}
+	return NULL;
+}
+
+/* Returns the longest free run, the one nearest to HINT among
+ * equals, or a null pointer if the disk is full.  Must hold
+ * FREE_MAP_LOCK. */
+static struct free_extent *
+largest (disk_sector_t hint) {
+	for (size_t b = BUCKET_CNT; b-- > 0; ) {
+		struct free_extent *best = NULL;
+
+		for (struct list_elem *e = list_begin (&buckets[b]);
+				e != list_end (&buckets[b]); e = list_next (e)) {
+			struct free_extent *f = list_entry (e, struct free_extent,
+					bucket_elem);
+
+			if (best == NULL || f->cnt > best->cnt
+					|| (f->cnt == best->cnt
+						&& distance (f, hint) < distance (best, hint)))
+				best = f;
+		}
+		if (best != NULL)
+			return best;
+	}
+	return NULL;
+}
+
+/* Takes CNT sectors off free run E, from whichever end is nearer
+ * to HINT, and returns the first.  Taking an end never splits E,
+ * so this needs no memory.  Must hold FREE_MAP_LOCK. */
+static disk_sector_t
+carve (struct free_extent *e, size_t cnt, disk_sector_t hint) {
+	disk_sector_t end = e->start + e->cnt, sector;
+
+	ASSERT (cnt <= e->cnt);
+
+	index_remove (e);
+	if (hint >= end || (hint > e->start && hint - e->start > end - hint)) {
+		sector = e->start + e->cnt - cnt;
+		e->cnt -= cnt;
+	} else {
+		sector = e->start;
+		e->start += cnt;
+		e->cnt -= cnt;
+	}
+	if (e->cnt > 0)
+		index_insert (e);
+	else
+		free (e);
+	return sector;
+}
+
+/* Adds CNT free sectors from SECTOR to the index, merged with the
+ * runs on either side.  Must hold FREE_MAP_LOCK. */
+static void
+index_add (disk_sector_t sector, size_t cnt) {
+	struct free_extent *prev = index_find (&by_end, sector);
+	struct free_extent *next = index_find (&by_start, sector + cnt);
+
+	if (prev != NULL) {
+		index_remove (prev);
+		prev->cnt += cnt;
+	} else {
+		prev = malloc (sizeof *prev);
+		if (prev == NULL) {
+			index_stale = true;
+			return;
+		}
+		prev->start = sector;
+		prev->cnt = cnt;
+	}
+	if (next != NULL) {
+		index_remove (next);
+		prev->cnt += next->cnt;
+		free (next);
+	}
+	index_insert (prev);
+}
+
+/* Puts run E into the index. */
+static void
+index_insert (struct free_extent *e) {
+	list_push_back (&buckets[bucket_of (e->cnt)], &e->bucket_elem);
+	hash_insert (&by_start, &e->start_elem);
+	hash_insert (&by_end, &e->end_elem);
+}
+
+/* Takes run E out of the index, so that it may change. */
+static void
+index_remove (struct free_extent *e) {
+	list_remove (&e->bucket_elem);
+	hash_delete (&by_start, &e->start_elem);
+	hash_delete (&by_end, &e->end_elem);
+}
+
+/* Returns the run whose first sector, or sector just past it,
+ * is KEY in TABLE, which is BY_START or BY_END. */
+static struct free_extent *
+index_find (struct hash *table, disk_sector_t key) {
+	struct free_extent probe = { .start = key, .cnt = 0 };
+	struct hash_elem *e;
+
+	if (table == &by_start) {
+		e = hash_find (&by_start, &probe.start_elem);
+		return e != NULL ? hash_entry (e, struct free_extent, start_elem)
+			: NULL;
+	}
+	e = hash_find (&by_end, &probe.end_elem);
+	return e != NULL ? hash_entry (e, struct free_extent, end_elem) : NULL;
+}
+
+/* Empties the index and fills it again from the bitmap.  Leaves
+ * it stale if out of memory.  Must hold FREE_MAP_LOCK, if
+ * initialized. */
+static void
+index_rebuild (void) {
+	size_t size = bitmap_size (free_map);
+
+	hash_clear (&by_start, NULL);
+	hash_clear (&by_end, NULL);
+	for (size_t b = 0; b < BUCKET_CNT; b++)
+		while (!list_empty (&buckets[b]))
+			free (list_entry (list_pop_front (&buckets[b]),
+						struct free_extent, bucket_elem));
+	index_stale = false;
+
+	for (size_t first = bitmap_scan (free_map, 0, 1, false);
+			first != BITMAP_ERROR && !index_stale; ) {
+		size_t end = bitmap_scan (free_map, first, 1, true);
+
+		if (end == BITMAP_ERROR)
+			end = size;
+		index_add (first, end - first);
+		first = end < size ? bitmap_scan (free_map, end, 1, false)
+			: BITMAP_ERROR;
+	}
+}
+
+static uint64_t
+start_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct free_extent *f = hash_entry (e, struct free_extent,
+			start_elem);
+
+	return hash_int (f->start);
+}
+
+static bool
+start_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct free_extent, start_elem)->start
+		< hash_entry (b, struct free_extent, start_elem)->start;
+}
+
+static uint64_t
+end_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct free_extent *f = hash_entry (e, struct free_extent,
+			end_elem);
+
+	return hash_int (f->start + f->cnt);
+}
+
+static bool
+end_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	const struct free_extent *x = hash_entry (a, struct free_extent, end_elem);
+	const struct free_extent *y = hash_entry (b, struct free_extent, end_elem);
+
+	return x->start + x->cnt < y->start + y->cnt;
+}
@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -87,7 +88,7 @@ fsutil_put (char **argv) {
 	printf ("Putting '%s' into the file system...\n", file_name);
 
 	/* Allocate buffer. */
-	buffer = malloc (DISK_SECTOR_SIZE);
+	buffer = palloc_get_page (0);
 	if (buffer == NULL)
 		PANIC ("couldn't allocate buffer");
 
@@ -111,10 +112,15 @@ fsutil_put (char **argv) {
 	if (dst == NULL)
 		PANIC ("%s: open failed", file_name);
 
-	/* Do copy. */
+	/* Do copy, a page at a time, so that the scratch disk reads
+	 * several sectors per command and the file system's writes
+	 * go to the cache for the flusher to write in runs. */
 	while (size > 0) {
-		int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-		disk_read (src, sector++, buffer);
+		int chunk_size = size > PGSIZE ? PGSIZE : size;
+		size_t sectors = DIV_ROUND_UP (chunk_size, DISK_SECTOR_SIZE);
+
+		disk_read_multiple (src, sector, sectors, buffer);
+		sector += sectors;
 		if (file_write (dst, buffer, chunk_size) != chunk_size)
 			PANIC ("%s: write failed with %"PROTd" bytes unwritten",
 					file_name, size);
@@ -123,7 +129,7 @@ fsutil_put (char **argv) {
 
 	/* Finish up. */
 	file_close (dst);
-	free (buffer);
+	palloc_free_page (buffer);
 }
 
 /* Copies file FILE_NAME from the file system to the scratch disk.
@@ -150,7 +156,7 @@ fsutil_get (char **argv) {
 	printf ("Getting '%s' from the file system...\n", file_name);
 
 	/* Allocate buffer. */
-	buffer = malloc (DISK_SECTOR_SIZE);
+	buffer = palloc_get_page (0);
 	if (buffer == NULL)
 		PANIC ("couldn't allocate buffer");
 
@@ -171,19 +177,23 @@ fsutil_get (char **argv) {
 	((int32_t *) buffer)[1] = size;
 	disk_write (dst, sector++, buffer);
 
-	/* Do copy. */
+	/* Do copy, a page at a time. */
 	while (size > 0) {
-		int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-		if (sector >= disk_size (dst))
+		int chunk_size = size > PGSIZE ? PGSIZE : size;
+		size_t sectors = DIV_ROUND_UP (chunk_size, DISK_SECTOR_SIZE);
+
+		if (sector + sectors > disk_size (dst))
 			PANIC ("%s: out of space on scratch disk", file_name);
 		if (file_read (src, buffer, chunk_size) != chunk_size)
 			PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-		memset (buffer + chunk_size, 0, DISK_SECTOR_SIZE - chunk_size);
-		disk_write (dst, sector++, buffer);
+		memset ((uint8_t *) buffer + chunk_size, 0,
+				sectors * DISK_SECTOR_SIZE - chunk_size);
+		disk_write_multiple (dst, sector, sectors, buffer);
+		sector += sectors;
 		size -= chunk_size;
 	}
 
 	/* Finish up. */
 	file_close (src);
-	free (buffer);
+	palloc_free_page (buffer);
 }
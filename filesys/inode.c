@@ -1,22 +1,74 @@
 #include "filesys/inode.h"
-#include <list.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#ifdef VM
+#include "vm/vm.h"
+#include "filesys/page_cache.h"
+#include "threads/vaddr.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of sectors: on disk, or by index within a file. */
+struct inode_extent {
+	uint32_t start;                     /* First sector. */
+	uint32_t cnt;                       /* Number of sectors. */
+};
+
+/* Most runs of data sectors a file may have on disk. */
+#define DATA_MAX 31
+
+/* Most runs of written sectors an inode records. */
+#define EXTENT_MAX 31
+
+/* Largest file whose data fits in its inode. */
+#define INLINE_MAX ((DATA_MAX + EXTENT_MAX) * sizeof (struct inode_extent))
+
+/* inode_disk flags. */
+#define INODE_INLINE 0x1                /* Data is in INLINE_DATA. */
+#define INODE_DIR 0x2                   /* A directory. */
+#define INODE_SYMLINK 0x4               /* A symbolic link. */
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ *
+ * A file's data sectors are the runs in DATA, taken in order, so
+ * that a large file can be placed on a fragmented disk.  They are
+ * all allocated at once, when data written to the file is first
+ * flushed (see place_data()), but only those in EXTENTS have ever
+ * been written.  The rest are holes: they read as zeros without
+ * touching the disk, and their first write zero-fills only the
+ * sector it lands in.  EXTENTS is sorted, and its runs neither
+ * overlap nor touch.
+ *
+ * A file of at most INLINE_MAX bytes has no data sectors at all.
+ * Its data takes the place of DATA and EXTENTS, so it is read along
+ * with the inode.  A symbolic link is always inline, its target
+ * followed by at least one null byte. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
+	uint16_t data_cnt;                  /* Runs in DATA. */
+	uint16_t flags;                     /* INODE_* flags. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Runs in EXTENTS. */
+	union {
+		struct {
+			struct inode_extent data[DATA_MAX]; /* Data sectors. */
+			struct inode_extent extents[EXTENT_MAX]; /* Written. */
+		};
+		uint8_t inline_data[INLINE_MAX]; /* Data, if INODE_INLINE. */
+	};
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -26,16 +78,58 @@ bytes_to_sectors (off_t size) {
 	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* Most sectors of data an inode keeps in memory until it is
+ * placed. */
+#define PENDING_MAX 64
+
+/* A sector of data written to a file that has no data sectors
+ * yet, kept in memory until the file is placed. */
+struct pending_block {
+	struct list_elem elem;              /* Element in inode's PENDING. */
+	size_t idx;                         /* Data sector index in file. */
+	uint8_t data[DISK_SECTOR_SIZE];     /* Sector contents. */
+};
+
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in OPEN_INODES. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
+	bool journaled;                     /* Writes go through the journal? */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	unsigned write_gen;                 /* Bumped by every write. */
+	struct rwlock rw;                   /* See inode_lock(). */
+	struct lock extent_lock;            /* Guards DATA's extents. */
+	bool extents_dirty;                 /* Extents changed since last sync? */
+	struct cache_owner dirty;           /* Dirty data sectors in the cache. */
+	struct list pending;                /* Unplaced data, guarded by
+	                                       EXTENT_LOCK. */
+	size_t pending_cnt;                 /* Blocks in PENDING. */
+	size_t reserved;                    /* Sectors reserved for placing. */
+	void *aux;                          /* See inode_set_aux(). */
+	void (*aux_destroy) (void *);       /* Frees AUX, if non-null. */
+	bool link_valid;                    /* LINK_SECTOR is set? */
+	disk_sector_t link_sector;          /* Where a symlink last led. */
+	unsigned link_gen;                  /* WRITE_GEN that LINK_SECTOR saw. */
+	unsigned link_key;                  /* Caller's key to LINK_SECTOR. */
 	struct inode_disk data;             /* Inode content. */
 };
 
+/* Returns the disk sector of INODE's data sector IDX, which must
+ * be inside the file. */
+static disk_sector_t
+index_to_sector (const struct inode *inode, size_t idx) {
+	const struct inode_disk *d = &inode->data;
+
+	for (size_t i = 0; i < d->data_cnt; i++) {
+		if (idx < d->data[i].cnt)
+			return d->data[i].start + idx;
+		idx -= d->data[i].cnt;
+	}
+	NOT_REACHED ();
+}
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
@@ -44,28 +138,73 @@ static disk_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) {
 	ASSERT (inode != NULL);
 	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
+		return index_to_sector (inode, pos / DISK_SECTOR_SIZE);
 	else
 		return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, hashed by sector, so that opening a single inode
+ * twice returns the same `struct inode'.  Lookups take
+ * OPEN_INODES_LOCK for reading, so they run in parallel; adding
+ * and dropping inodes take it for writing.  OPEN_CNT is updated
+ * atomically, as readers bump it concurrently. */
+static struct hash open_inodes;
+static struct rwlock open_inodes_lock;
+
+/* Slab cache for struct inode, which is a little over a sector and
+   would otherwise take a 1 kB malloc() block. */
+static struct kmem_cache *inode_cache;
+
+static const uint8_t zeros[DISK_SECTOR_SIZE];
+
+static struct inode *open_inodes_find (disk_sector_t);
+static off_t read_at (struct inode *, void *, off_t size, off_t offset);
+static off_t write_at (struct inode *, const void *, off_t size,
+		off_t offset);
+static void move_out (struct inode *, uint8_t *, disk_sector_t);
+static bool is_inline (const struct inode *);
+static bool is_placed (const struct inode *);
+static bool place_data (struct inode *);
+static void place_pending (struct inode *);
+static void drop_pending (struct inode *);
+static struct pending_block *find_pending (struct inode *, size_t idx);
+static bool stage_write (struct inode *, size_t idx, const void *,
+		size_t ofs, size_t size);
+static bool read_pending (struct inode *, size_t idx, void *, size_t ofs,
+		size_t size);
+static off_t clamp_size (const struct inode *, off_t size, off_t offset);
+static off_t inline_read_at (struct inode *, void *, off_t size,
+		off_t offset);
+static off_t inline_write_at (struct inode *, const void *, off_t size,
+		off_t offset);
+static bool sector_written (struct inode *, size_t idx);
+static void mark_written (struct inode *, size_t idx);
+static void write_sector (struct inode *, disk_sector_t, const void *,
+		size_t ofs, size_t size);
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	rwlock_init (&open_inodes_lock);
+	inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0, NULL);
+	if (inode_cache == NULL
+			|| !hash_init (&open_inodes, inode_hash, inode_less, NULL))
+		PANIC ("inode_init: out of memory");
 }
 
-/* Initializes an inode with LENGTH bytes of data and
- * writes the new inode to sector SECTOR on the file system
- * disk.
+/* Initializes an inode with LENGTH bytes of data, a directory if
+ * IS_DIR, and writes the new inode to sector SECTOR on the file
+ * system disk.  The file starts out as one hole, which reads as
+ * zeros.  A file small enough to keep its data inline gets no data
+ * sectors, and a larger one gets them only once data written to
+ * it is flushed, or it is given them with inode_allocate(): see
+ * place_data().
  * Returns true if successful.
- * Returns false if memory or disk allocation fails. */
+ * Returns false if memory allocation fails. */
 bool
-inode_create (disk_sector_t sector, off_t length) {
+inode_create (disk_sector_t sector, off_t length, bool is_dir) {
 	struct inode_disk *disk_inode = NULL;
 	bool success = false;
 
@@ -77,63 +216,121 @@ inode_create (disk_sector_t sector, off_t length) {
 
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
+		disk_inode->flags = is_dir ? INODE_DIR : 0;
+		if ((size_t) length <= INLINE_MAX)
+			disk_inode->flags |= INODE_INLINE;
+		journal_write (sector, disk_inode);
+		success = true;
 		free (disk_inode);
 	}
 	return success;
 }
 
+/* Writes a symbolic link to TARGET as a new inode in SECTOR.
+ * Returns true if successful, false if TARGET is too long to keep
+ * inline or memory runs out. */
+bool
+inode_create_symlink (disk_sector_t sector, const char *target) {
+	size_t len = strlen (target);
+	struct inode_disk *disk_inode;
+
+	if (len >= INLINE_MAX)
+		return false;
+	disk_inode = calloc (1, sizeof *disk_inode);
+	if (disk_inode == NULL)
+		return false;
+	disk_inode->length = len;
+	disk_inode->magic = INODE_MAGIC;
+	disk_inode->flags = INODE_INLINE | INODE_SYMLINK;
+	memcpy (disk_inode->inline_data, target, len);
+	journal_write (sector, disk_inode);
+	free (disk_inode);
+	return true;
+}
+
 /* Reads an inode from SECTOR
  * and returns a `struct inode' that contains it.
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
-	struct inode *inode;
+	struct inode *inode, *raced;
 
 	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
-	}
+	rwlock_acquire_read (&open_inodes_lock);
+	inode = open_inodes_find (sector);
+	rwlock_release_read (&open_inodes_lock);
+	if (inode != NULL)
+		return inode;
 
 	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
+	inode = kmem_cache_alloc (inode_cache);
 	if (inode == NULL)
 		return NULL;
 
 	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
 	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->journaled = false;
+	inode->write_gen = 0;
+	rwlock_init (&inode->rw);
+	lock_init (&inode->extent_lock);
+	inode->extents_dirty = false;
+	cache_owner_init (&inode->dirty);
+	list_init (&inode->pending);
+	inode->pending_cnt = 0;
+	inode->reserved = 0;
+	inode->aux = NULL;
+	inode->aux_destroy = NULL;
+	inode->link_valid = false;
+	cache_read (inode->sector, &inode->data);
+
+	/* Someone else may have opened it while we read. */
+	rwlock_acquire_write (&open_inodes_lock);
+	raced = open_inodes_find (sector);
+	if (raced == NULL)
+		hash_insert (&open_inodes, &inode->elem);
+	rwlock_release_write (&open_inodes_lock);
+	if (raced != NULL) {
+		kmem_cache_free (inode_cache, inode);
+		return raced;
+	}
 	return inode;
 }
 
+/* Returns the open inode for SECTOR, reopened, or a null pointer
+ * if SECTOR is not open.  OPEN_INODES_LOCK must be held. */
+static struct inode *
+open_inodes_find (disk_sector_t sector) {
+	struct inode probe;
+	struct hash_elem *e;
+
+	probe.sector = sector;
+	e = hash_find (&open_inodes, &probe.elem);
+	return e != NULL ? inode_reopen (hash_entry (e, struct inode, elem))
+		: NULL;
+}
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode, elem)->sector
+		< hash_entry (b, struct inode, elem)->sector;
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
 	if (inode != NULL)
-		inode->open_cnt++;
+		__atomic_add_fetch (&inode->open_cnt, 1, __ATOMIC_RELAXED);
 	return inode;
 }
 
@@ -143,6 +340,47 @@ inode_get_inumber (const struct inode *inode) {
 	return inode->sector;
 }
 
+/* Returns INODE's write generation, which changes whenever data
+ * is written to it while it stays open. */
+unsigned
+inode_write_gen (const struct inode *inode) {
+	return __atomic_load_n (&inode->write_gen, __ATOMIC_ACQUIRE);
+}
+
+/* Attaches AUX to INODE for a higher layer, such as the index of
+ * a directory, to be passed to DESTROY when the last opener closes
+ * INODE.  Every opener of INODE sees the same AUX. */
+void
+inode_set_aux (struct inode *inode, void *aux, void (*destroy) (void *)) {
+	inode->aux_destroy = destroy;
+	__atomic_store_n (&inode->aux, aux, __ATOMIC_RELEASE);
+}
+
+/* Returns what was attached to INODE with inode_set_aux(), or a
+ * null pointer. */
+void *
+inode_get_aux (const struct inode *inode) {
+	return __atomic_load_n (&inode->aux, __ATOMIC_ACQUIRE);
+}
+
+/* Sends later writes of INODE's data, which is file system
+ * metadata such as a directory, through the journal.  The journal
+ * logs writes by disk sector, so INODE is placed now if it can be. */
+void
+inode_set_journaled (struct inode *inode) {
+	inode->journaled = true;
+	lock_acquire (&inode->extent_lock);
+	if (!is_placed (inode))
+		place_data (inode);
+	lock_release (&inode->extent_lock);
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode) {
+	return inode->removed;
+}
+
 /* Closes INODE and writes it to disk.
  * If this was the last reference to INODE, frees its memory.
  * If INODE was also a removed inode, frees its blocks. */
@@ -152,22 +390,113 @@ inode_close (struct inode *inode) {
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	/* Release resources if this was the last opener.  Holding the
+	 * lock for writing keeps lookups from reviving INODE. */
+	rwlock_acquire_write (&open_inodes_lock);
+	bool last = __atomic_sub_fetch (&inode->open_cnt, 1, __ATOMIC_RELAXED) == 0;
+	if (last)
+		hash_delete (&open_inodes, &inode->elem);
+	rwlock_release_write (&open_inodes_lock);
 
+	if (last) {
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
+			journal_begin ();
 			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
-		}
+			if (!is_inline (inode))
+				for (size_t i = 0; i < inode->data.data_cnt; i++)
+					free_map_release (inode->data.data[i].start,
+							inode->data.data[i].cnt);
+			journal_end ();
+		} else
+			place_pending (inode);
+		drop_pending (inode);
+		if (inode->aux_destroy != NULL)
+			inode->aux_destroy (inode->aux);
+		cache_owner_done (&inode->dirty);
 
-		free (inode); 
+		kmem_cache_free (inode_cache, inode);
 	}
 }
 
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode) {
+	return (inode->data.flags & INODE_DIR) != 0;
+}
+
+/* Returns true if INODE is a symbolic link. */
+bool
+inode_is_symlink (const struct inode *inode) {
+	return (inode->data.flags & INODE_SYMLINK) != 0;
+}
+
+/* Returns the target of symbolic link INODE.  It is kept in the
+ * inode, so that following a link costs no reads of its own. */
+const char *
+inode_symlink_target (const struct inode *inode) {
+	ASSERT (inode_is_symlink (inode));
+	return (const char *) inode->data.inline_data;
+}
+
+/* If symbolic link INODE was resolved to a sector with
+ * inode_link_remember() under KEY, and INODE has not been written
+ * since, stores the sector in *SECTOR and returns true.  KEY names
+ * the state of whatever the resolution depended on, such as the
+ * write generation of the directory it was looked up in.  The
+ * link fields are guarded by EXTENT_LOCK, as lookups of one link
+ * may run at once. */
+bool
+inode_link_cached (struct inode *inode, unsigned key,
+		disk_sector_t *sector) {
+	bool hit;
+
+	lock_acquire (&inode->extent_lock);
+	hit = inode->link_valid && inode->link_key == key
+		&& inode->link_gen == inode_write_gen (inode);
+	if (hit)
+		*sector = inode->link_sector;
+	lock_release (&inode->extent_lock);
+	return hit;
+}
+
+/* Remembers that symbolic link INODE resolved to SECTOR under KEY,
+ * for inode_link_cached(). */
+void
+inode_link_remember (struct inode *inode, unsigned key,
+		disk_sector_t sector) {
+	lock_acquire (&inode->extent_lock);
+	inode->link_sector = sector;
+	inode->link_key = key;
+	inode->link_gen = inode_write_gen (inode);
+	inode->link_valid = true;
+	lock_release (&inode->extent_lock);
+}
+
+/* Locks INODE for reading or, if WRITE, for writing, for the
+ * length of one read or write system call, so that a write() is
+ * seen whole or not at all by read()s of the same file while
+ * read()s of it, and of other files, run in parallel.  This is the
+ * outermost file system lock; see filesys.c for the order of the
+ * rest.  The page fault path reads and writes files without it,
+ * since a fault may come from a copy that holds it. */
+void
+inode_lock (struct inode *inode, bool write) {
+	if (write)
+		rwlock_acquire_write (&inode->rw);
+	else
+		rwlock_acquire_read (&inode->rw);
+}
+
+/* Releases INODE, locked by inode_lock() with the same WRITE. */
+void
+inode_unlock (struct inode *inode, bool write) {
+	if (write)
+		rwlock_release_write (&inode->rw);
+	else
+		rwlock_release_read (&inode->rw);
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
  * has it open. */
 void
@@ -178,16 +507,46 @@ inode_remove (struct inode *inode) {
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
  * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
+ * than SIZE if an error occurs or end of file is reached.
+ * Pages of INODE in the page cache are read from their frames,
+ * where mmap() mappings may have changed them. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+#ifdef VM
+	uint8_t *buffer = buffer_;
+	off_t bytes_read = 0;
+
+	if (page_cache_size () == 0)
+		return read_at (inode, buffer, size, offset);
+	size = clamp_size (inode, size, offset);
+	while (bytes_read < size) {
+		off_t chunk = PGSIZE - offset % PGSIZE;
+
+		if (chunk > size - bytes_read)
+			chunk = size - bytes_read;
+		if (!page_cache_read (inode, buffer + bytes_read, offset, chunk)
+				&& read_at (inode, buffer + bytes_read, chunk, offset) != chunk)
+			break;
+		offset += chunk;
+		bytes_read += chunk;
+	}
+	return bytes_read;
+#else
+	return read_at (inode, buffer_, size, offset);
+#endif
+}
+
+/* inode_read_at() without the page cache. */
+static off_t
+read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
+	if (is_inline (inode))
+		return inline_read_at (inode, buffer, size, offset);
 	while (size > 0) {
-		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		/* Data sector to read, starting byte offset within sector. */
+		size_t idx = offset / DISK_SECTOR_SIZE;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -200,49 +559,139 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		if (!is_placed (inode) && read_pending (inode, idx,
+					buffer + bytes_read, sector_ofs, chunk_size)) {
+			/* Not on disk yet. */
+		} else if (sector_written (inode, idx))
+			cache_read_at (index_to_sector (inode, idx), buffer + bytes_read,
+					sector_ofs, chunk_size);
+		else
+			memset (buffer + bytes_read, 0, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
+/* Asks for the sectors holding SIZE bytes of INODE from OFFSET on
+ * to be read into the buffer cache in the background.  Bytes past
+ * the end of INODE, and holes, are ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size) {
+	off_t end = inode_length (inode);
+
+	if (is_inline (inode))
+		return;
+	if (size < end - offset)
+		end = offset + size;
+	for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+			offset += DISK_SECTOR_SIZE)
+		if (sector_written (inode, offset / DISK_SECTOR_SIZE))
+			cache_readahead (byte_to_sector (inode, offset));
+}
+
+/* Asks for the next sector that opening the inode in SECTOR and
+ * reading it will need to be read into the buffer cache in the
+ * background: the inode itself or, if it is open already, so that
+ * its extents are in memory, its first data sector.  Called as a
+ * directory entry is found, so that the read overlaps the work
+ * before the inode is used. */
+void
+inode_readahead_open (disk_sector_t sector) {
+	struct inode *inode;
+
+	rwlock_acquire_read (&open_inodes_lock);
+	inode = open_inodes_find (sector);
+	rwlock_release_read (&open_inodes_lock);
+	if (inode == NULL) {
+		cache_readahead (sector);
+		return;
+	}
+	inode_readahead (inode, 0, DISK_SECTOR_SIZE);
+	inode_close (inode);
+}
+
+/* Reads the sectors holding SIZE bytes of INODE from OFFSET on
+ * into the buffer cache, returning once they are there.  Sectors
+ * that follow one another on disk are read together.  Bytes past
+ * the end of INODE, and holes, are ignored. */
+void
+inode_prefetch (struct inode *inode, off_t offset, off_t size) {
+	off_t end = inode_length (inode);
+	disk_sector_t first = 0;
+	size_t cnt = 0;
+
+	if (is_inline (inode))
+		return;
+	if (size < end - offset)
+		end = offset + size;
+	for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+			offset += DISK_SECTOR_SIZE) {
+		disk_sector_t sector;
+
+		if (!sector_written (inode, offset / DISK_SECTOR_SIZE))
+			continue;
+		sector = byte_to_sector (inode, offset);
+		if (cnt > 0 && sector == first + cnt) {
+			cnt++;
+			continue;
+		}
+		if (cnt > 0)
+			cache_prefetch (first, cnt);
+		first = sector;
+		cnt = 1;
+	}
+	if (cnt > 0)
+		cache_prefetch (first, cnt);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
  * Returns the number of bytes actually written, which may be
  * less than SIZE if end of file is reached or an error occurs.
  * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * growth is not yet implemented.)  The bytes also go to the frames
+ * of pages of INODE in the page cache, so that mmap() mappings see
+ * them. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
+	off_t bytes_written = write_at (inode, buffer_, size, offset);
+#ifdef VM
+	const uint8_t *buffer = buffer_;
+
+	for (off_t done = 0; done < bytes_written; ) {
+		off_t chunk = PGSIZE - (offset + done) % PGSIZE;
+
+		if (chunk > bytes_written - done)
+			chunk = bytes_written - done;
+		page_cache_update (inode, buffer + done, offset + done, chunk);
+		done += chunk;
+	}
+#endif
+	return bytes_written;
+}
+
+/* inode_write_at() without the page cache. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
 
 	if (inode->deny_write_cnt)
 		return 0;
+	if (is_inline (inode)) {
+		bytes_written = inline_write_at (inode, buffer, size, offset);
+		size = 0;                       /* No sectors to write. */
+	}
 
 	while (size > 0) {
-		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		/* Data sector to write, starting byte offset within sector. */
+		size_t idx = offset / DISK_SECTOR_SIZE;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -255,26 +704,30 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
+		if (!is_placed (inode) && stage_write (inode, idx,
+					buffer + bytes_written, sector_ofs, chunk_size)) {
+			/* Kept in memory until INODE is placed. */
+		} else if (!is_placed (inode))
+			break;                          /* The disk is full. */
+		else if (sector_written (inode, idx))
+			write_sector (inode, index_to_sector (inode, idx),
+					buffer + bytes_written, sector_ofs, chunk_size);
+		else {
+			/* First write into a hole.  The lock keeps two writers
+			 * from both zero-filling the sector. */
+			disk_sector_t sector_idx = index_to_sector (inode, idx);
 
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
+			lock_acquire (&inode->extent_lock);
+			if (!sector_written (inode, idx)) {
+				if (chunk_size < DISK_SECTOR_SIZE)
+					write_sector (inode, sector_idx, zeros, 0, DISK_SECTOR_SIZE);
+				write_sector (inode, sector_idx, buffer + bytes_written,
+						sector_ofs, chunk_size);
+				mark_written (inode, idx);
+			} else
+				write_sector (inode, sector_idx, buffer + bytes_written,
+						sector_ofs, chunk_size);
+			lock_release (&inode->extent_lock);
 		}
 
 		/* Advance. */
@@ -282,18 +735,447 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
+	if (bytes_written > 0)
+		__atomic_add_fetch (&inode->write_gen, 1, __ATOMIC_RELEASE);
 	return bytes_written;
 }
 
+/* Grows INODE to LENGTH bytes, reserving the sectors that takes
+ * as holes, so that writes up to LENGTH find their space already
+ * placed and allocate nothing.  An INODE that has no data sectors
+ * yet gets them all now, as at its first flush, in one allocation.
+ * Otherwise the new sectors follow the last run of INODE's data,
+ * in as few runs as the free map has, and an inline INODE that
+ * outgrows its inode moves its data out to the first sector.  Does
+ * nothing if INODE is placed and at least LENGTH bytes long
+ * already.  Must hold INODE's lock for writing.
+ * Returns false if writes to INODE are denied or the disk has no
+ * room in the runs INODE has left, leaving INODE as it was. */
+bool
+inode_allocate (struct inode *inode, off_t length) {
+	struct inode_disk *d = &inode->data;
+	struct free_map_extent ext[DATA_MAX];
+	size_t want = bytes_to_sectors (length), have, cnt = 0;
+	uint8_t *first = NULL;
+	bool success = false;
+
+	ASSERT (rwlock_held_for_write (&inode->rw));
+	if (length <= inode_length (inode) && is_placed (inode))
+		return true;
+	if (inode->deny_write_cnt)
+		return false;
+
+	journal_begin ();
+	lock_acquire (&inode->extent_lock);
+	if (!is_placed (inode)) {
+		off_t old_length = inode_length (inode);
+
+		if (length > old_length)
+			d->length = length;
+		success = place_data (inode);
+		if (!success)
+			d->length = old_length;
+		else if (length > old_length)
+			__atomic_add_fetch (&inode->write_gen, 1, __ATOMIC_RELEASE);
+		lock_release (&inode->extent_lock);
+		goto done;
+	}
+	lock_release (&inode->extent_lock);
+
+	if (length <= inode_length (inode)) {
+		/* Placed since the check above, and long enough. */
+		success = true;
+		goto done;
+	}
+	if (length <= (off_t) INLINE_MAX)
+		have = want;                    /* Stays inline. */
+	else if (is_inline (inode)) {
+		have = 0;
+		first = calloc (1, DISK_SECTOR_SIZE);
+		if (first != NULL)
+			cnt = free_map_allocate_extents (want, inode->sector + 1, ext,
+					DATA_MAX);
+	} else {
+		struct inode_extent *last = &d->data[d->data_cnt - 1];
+
+		have = bytes_to_sectors (inode_length (inode));
+		if (want > have && d->data_cnt < DATA_MAX)
+			cnt = free_map_allocate_extents (want - have,
+					last->start + last->cnt, ext, DATA_MAX - d->data_cnt);
+	}
+	if (want > have && cnt == 0)
+		goto done;
+
+	lock_acquire (&inode->extent_lock);
+	if (first != NULL)
+		move_out (inode, first, ext[0].start);
+	for (size_t i = 0; i < cnt; i++) {
+		struct inode_extent *last = d->data + d->data_cnt;
+
+		if (d->data_cnt > 0 && last[-1].start + last[-1].cnt == ext[i].start)
+			last[-1].cnt += ext[i].cnt;
+		else {
+			d->data[d->data_cnt].start = ext[i].start;
+			d->data[d->data_cnt].cnt = ext[i].cnt;
+			d->data_cnt++;
+		}
+	}
+	/* Readers that see the new length find its runs in place. */
+	__atomic_store_n (&d->length, length, __ATOMIC_RELEASE);
+	__atomic_add_fetch (&inode->write_gen, 1, __ATOMIC_RELEASE);
+	journal_write (inode->sector, d);
+	__atomic_store_n (&inode->extents_dirty, true, __ATOMIC_RELEASE);
+	lock_release (&inode->extent_lock);
+	success = true;
+
+done:
+	journal_end ();
+	free (first);
+	return success;
+}
+
+/* Moves the data of inline INODE out to SECTOR, which becomes its
+ * first data sector, using BUF, a zeroed sector, to stage it.  The
+ * sector reaches the disk before the inode can point at it.  Must
+ * hold INODE's EXTENT_LOCK. */
+static void
+move_out (struct inode *inode, uint8_t *buf, disk_sector_t sector) {
+	struct inode_disk *d = &inode->data;
+	off_t length = inode_length (inode);
+
+	ASSERT (lock_held_by_current_thread (&inode->extent_lock));
+
+	memcpy (buf, d->inline_data, length);
+	memset (d->inline_data, 0, INLINE_MAX);
+	d->flags &= ~INODE_INLINE;
+	if (length > 0) {
+		write_sector (inode, sector, buf, 0, DISK_SECTOR_SIZE);
+		cache_flush_owner (&inode->dirty);
+		d->extents[0].start = 0;
+		d->extents[0].cnt = 1;
+		d->extent_cnt = 1;
+	}
+}
+
+/* Returns true if INODE keeps its data in the inode itself. */
+static bool
+is_inline (const struct inode *inode) {
+	return (inode->data.flags & INODE_INLINE) != 0;
+}
+
+/* Returns true if INODE has its data sectors, or needs none. */
+static bool
+is_placed (const struct inode *inode) {
+	return is_inline (inode) || inode->data.data_cnt > 0;
+}
+
+/* Gives INODE, which has no data sectors yet, all of them in one
+ * allocation, as one run if the free map has one, and moves its
+ * pending blocks to them.  Data written to a file waits in memory
+ * until the file is synced or closed, has PENDING_MAX blocks
+ * waiting, or has its space reserved by inode_allocate(), so that
+ * however many files are written at once, and in whatever order,
+ * each still gets its sectors side by side.
+ * Returns false if the disk is full, leaving INODE unplaced.  Must
+ * hold INODE's EXTENT_LOCK. */
+static bool
+place_data (struct inode *inode) {
+	struct inode_disk *d = &inode->data;
+	struct free_map_extent ext[DATA_MAX];
+	size_t cnt;
+
+	ASSERT (lock_held_by_current_thread (&inode->extent_lock));
+	ASSERT (!is_placed (inode));
+
+	cnt = free_map_allocate_reserved (bytes_to_sectors (inode_length (inode)),
+			inode->reserved, inode->sector + 1, ext, DATA_MAX);
+	if (cnt == 0)
+		return false;
+	for (size_t i = 0; i < cnt; i++) {
+		d->data[i].start = ext[i].start;
+		d->data[i].cnt = ext[i].cnt;
+	}
+	d->data_cnt = cnt;
+	inode->reserved = 0;
+
+	while (!list_empty (&inode->pending)) {
+		struct pending_block *b = list_entry (list_pop_front (&inode->pending),
+				struct pending_block, elem);
+
+		write_sector (inode, index_to_sector (inode, b->idx), b->data, 0,
+				DISK_SECTOR_SIZE);
+		mark_written (inode, b->idx);
+		free (b);
+	}
+	inode->pending_cnt = 0;
+	journal_write (inode->sector, d);
+	__atomic_store_n (&inode->extents_dirty, true, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* Places INODE if data written to it is waiting in memory. */
+static void
+place_pending (struct inode *inode) {
+	lock_acquire (&inode->extent_lock);
+	if (!is_placed (inode) && inode->pending_cnt > 0)
+		place_data (inode);
+	lock_release (&inode->extent_lock);
+}
+
+/* Frees the pending blocks of INODE, which is being closed for the
+ * last time, and gives back its reservation. */
+static void
+drop_pending (struct inode *inode) {
+	while (!list_empty (&inode->pending))
+		free (list_entry (list_pop_front (&inode->pending),
+					struct pending_block, elem));
+	if (inode->reserved > 0)
+		free_map_unreserve (inode->reserved);
+}
+
+/* Returns INODE's pending block for data sector IDX, or a null
+ * pointer if it has none.  Must hold INODE's EXTENT_LOCK. */
+static struct pending_block *
+find_pending (struct inode *inode, size_t idx) {
+	struct list_elem *e;
+
+	for (e = list_begin (&inode->pending); e != list_end (&inode->pending);
+			e = list_next (e)) {
+		struct pending_block *b = list_entry (e, struct pending_block, elem);
+
+		if (b->idx == idx)
+			return b;
+	}
+	return NULL;
+}
+
+/* Writes SIZE bytes from BUF at byte OFS of data sector IDX of
+ * INODE into its pending block for that sector, and returns true.
+ * The first pending block reserves room on disk for all of INODE,
+ * so that placing it cannot fail later.  Returns false if INODE is
+ * placed, and otherwise tries to place it, if INODE is metadata,
+ * has PENDING_MAX blocks already, or there is no memory for
+ * another; the caller then writes the sector to disk, if INODE
+ * got its sectors. */
+static bool
+stage_write (struct inode *inode, size_t idx, const void *buf, size_t ofs,
+		size_t size) {
+	struct pending_block *b = NULL;
+
+	lock_acquire (&inode->extent_lock);
+	if (!is_placed (inode)) {
+		b = find_pending (inode, idx);
+		if (b == NULL && !inode->journaled
+				&& inode->pending_cnt < PENDING_MAX) {
+			size_t sectors = bytes_to_sectors (inode_length (inode));
+
+			if (inode->reserved == 0 && free_map_reserve (sectors))
+				inode->reserved = sectors;
+			if (inode->reserved > 0)
+				b = calloc (1, sizeof *b);
+			if (b != NULL) {
+				b->idx = idx;
+				list_push_back (&inode->pending, &b->elem);
+				inode->pending_cnt++;
+			}
+		}
+		if (b != NULL)
+			memcpy (b->data + ofs, buf, size);
+		else
+			place_data (inode);
+	}
+	lock_release (&inode->extent_lock);
+	return b != NULL;
+}
+
+/* Reads SIZE bytes at byte OFS of data sector IDX of INODE into
+ * BUF from its pending block, or as zeros if it has none, and
+ * returns true.  Returns false if INODE has been placed, so that
+ * the sector is to be read from disk. */
+static bool
+read_pending (struct inode *inode, size_t idx, void *buf, size_t ofs,
+		size_t size) {
+	bool unplaced;
+
+	lock_acquire (&inode->extent_lock);
+	unplaced = !is_placed (inode);
+	if (unplaced) {
+		struct pending_block *b = find_pending (inode, idx);
+
+		if (b != NULL)
+			memcpy (buf, b->data + ofs, size);
+		else
+			memset (buf, 0, size);
+	}
+	lock_release (&inode->extent_lock);
+	return unplaced;
+}
+
+/* Returns the bytes of SIZE from OFFSET that lie inside INODE. */
+static off_t
+clamp_size (const struct inode *inode, off_t size, off_t offset) {
+	off_t left = inode_length (inode) - offset;
+
+	if (left <= 0 || size <= 0)
+		return 0;
+	return size < left ? size : left;
+}
+
+/* inode_read_at() for an inline INODE, which copies straight out
+ * of the inode read in by inode_open(). */
+static off_t
+inline_read_at (struct inode *inode, void *buffer, off_t size,
+		off_t offset) {
+	size = clamp_size (inode, size, offset);
+	lock_acquire (&inode->extent_lock);
+	memcpy (buffer, inode->data.inline_data + offset, size);
+	lock_release (&inode->extent_lock);
+	return size;
+}
+
+/* inode_write_at() for an inline INODE.  Only the bytes written go
+ * to the inode's sector in the cache. */
+static off_t
+inline_write_at (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	size = clamp_size (inode, size, offset);
+	if (size == 0)
+		return 0;
+	lock_acquire (&inode->extent_lock);
+	memcpy (inode->data.inline_data + offset, buffer, size);
+	write_sector (inode, inode->sector, buffer,
+			offsetof (struct inode_disk, inline_data) + offset, size);
+	lock_release (&inode->extent_lock);
+	return size;
+}
+
+/* Writes SIZE bytes from BUF at byte OFS of INODE's data sector
+ * SECTOR, through the journal if INODE's data is metadata. */
+static void
+write_sector (struct inode *inode, disk_sector_t sector, const void *buf,
+		size_t ofs, size_t size) {
+	if (inode->journaled)
+		journal_write_at (sector, buf, ofs, size);
+	else
+		cache_write_owned (sector, buf, ofs, size, &inode->dirty);
+}
+
+/* Writes INODE's dirty data to disk, then the inode itself unless
+ * DATA_ONLY is set and its extents are unchanged since the last
+ * sync, so that the inode never points at data that is not yet on
+ * disk.  A full sync also waits for the journal to commit what it
+ * holds, such as the directory entry of a new file. */
+void
+inode_sync (struct inode *inode, bool data_only) {
+	ASSERT (inode != NULL);
+
+	place_pending (inode);
+	cache_flush_owner (&inode->dirty);
+	if (__atomic_exchange_n (&inode->extents_dirty, false, __ATOMIC_ACQ_REL)
+			|| !data_only)
+		cache_flush_sector (inode->sector);
+	if (!data_only) {
+		journal_begin ();
+		journal_end ();
+	}
+}
+
+/* Returns true if data sector IDX of INODE has been written, false
+ * if it is still a hole. */
+static bool
+sector_written (struct inode *inode, size_t idx) {
+	const struct inode_disk *d = &inode->data;
+	bool held = lock_held_by_current_thread (&inode->extent_lock);
+	size_t lo = 0, hi;
+	bool written;
+
+	if (!held)
+		lock_acquire (&inode->extent_lock);
+	hi = d->extent_cnt;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (idx < d->extents[mid].start)
+			hi = mid;
+		else if (idx >= d->extents[mid].start + d->extents[mid].cnt)
+			lo = mid + 1;
+		else
+			break;
+	}
+	written = lo < hi;
+	if (!held)
+		lock_release (&inode->extent_lock);
+	return written;
+}
+
+/* Records data sector IDX of INODE, a hole until now, as written,
+ * and writes the inode back.  When the extents are all in use and
+ * IDX touches none of them, the smallest hole between two extents
+ * is zero-filled to join them and make room.  Must hold INODE's
+ * EXTENT_LOCK. */
+static void
+mark_written (struct inode *inode, size_t idx) {
+	struct inode_disk *d = &inode->data;
+	struct inode_extent *e = d->extents;
+	size_t i, n;
+
+	ASSERT (lock_held_by_current_thread (&inode->extent_lock));
+
+	for (;;) {
+		n = d->extent_cnt;
+		for (i = 0; i < n && e[i].start < idx; i++)
+			continue;
+		if (i > 0 && e[i - 1].start + e[i - 1].cnt == idx) {
+			e[i - 1].cnt++;
+			if (i < n && e[i].start == idx + 1) {
+				e[i - 1].cnt += e[i].cnt;
+				memmove (e + i, e + i + 1, (n - i - 1) * sizeof *e);
+				d->extent_cnt--;
+			}
+			break;
+		}
+		if (i < n && e[i].start == idx + 1) {
+			e[i].start--;
+			e[i].cnt++;
+			break;
+		}
+		if (n < EXTENT_MAX) {
+			memmove (e + i + 1, e + i, (n - i) * sizeof *e);
+			e[i].start = idx;
+			e[i].cnt = 1;
+			d->extent_cnt++;
+			break;
+		}
+
+		/* Join the two extents with the smallest hole between
+		 * them, then try again. */
+		size_t best = 0;
+		for (i = 1; i + 1 < n; i++)
+			if (e[i + 1].start - (e[i].start + e[i].cnt)
+					< e[best + 1].start - (e[best].start + e[best].cnt))
+				best = i;
+		for (i = e[best].start + e[best].cnt; i < e[best + 1].start; i++)
+			write_sector (inode, index_to_sector (inode, i), zeros, 0,
+					DISK_SECTOR_SIZE);
+		e[best].cnt = e[best + 1].start + e[best + 1].cnt - e[best].start;
+		memmove (e + best + 1, e + best + 2, (n - best - 2) * sizeof *e);
+		d->extent_cnt--;
+	}
+	journal_write (inode->sector, d);
+	__atomic_store_n (&inode->extents_dirty, true, __ATOMIC_RELEASE);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
 inode_deny_write (struct inode *inode) 
 {
+	/* Waits out a write() in progress. */
+	rwlock_acquire_write (&inode->rw);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -303,7 +1185,7 @@ void
 inode_allow_write (struct inode *inode) {
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
-	inode->deny_write_cnt--;
+	__atomic_sub_fetch (&inode->deny_write_cnt, 1, __ATOMIC_RELEASE);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
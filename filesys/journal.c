@@ -0,0 +1,393 @@
+/* Write-ahead journal for file system metadata.
+
+   An operation that changes metadata, such as creating or
+   removing a file, runs between journal_begin() and journal_end(),
+   and writes its inode, directory and free map sectors with
+   journal_write_at().  Those writes land in the buffer cache as
+   usual, but the cache holds the blocks back from the disk.  The
+   updates of every operation running at once form one
+   transaction.
+
+   journal_end() waits until the operation's transaction is
+   committed.  A committer thread then closes the transaction to
+   newcomers, waits for the operations in it to finish, and copies
+   its sectors into a record: a descriptor listing the sectors and
+   a checksum, followed by their contents.  The transaction is
+   reopened for new operations, and the record goes to the journal
+   in one sequential disk write.  Only then does the cache release
+   the blocks to be written back to their own sectors.  So the
+   operations that finish while one record is being written share
+   the next one (group commit), and a crash at any point leaves
+   either a complete record or none.
+
+   The journal is a region of JOURNAL_SECTORS at the end of the
+   disk: a header sector, then records one after another.  The
+   header names the sequence number of the first record that
+   counts, and each record must carry the next one, so records left
+   over from before the last reset are ignored.  At mount, the
+   valid records are replayed to their own sectors in order.
+
+   Records are appended until the region is half full.  The cache's
+   flusher writes the committed blocks to their sectors in the
+   background meanwhile, so a checkpoint, which must flush the
+   cache before the header starts the journal over, usually finds
+   little left to write.  A checkpoint runs while the committer has
+   a transaction closed, so no block of a committed record can be
+   held again by a newer, uncommitted one. */
+
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Identifies the header and the records. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Most sectors one transaction may hold, and sectors each
+   operation is assumed to need when deciding whether it fits in
+   the running transaction. */
+#define TXN_MAX 62
+#define OP_CREDITS 8
+
+/* On-disk journal header.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_header {
+	uint32_t magic;                 /* JOURNAL_MAGIC. */
+	uint32_t seq;                   /* Sequence number of first record. */
+	uint32_t unused[126];
+};
+
+/* On-disk record descriptor, followed by CNT sectors of data.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_desc {
+	uint32_t magic;                 /* JOURNAL_MAGIC. */
+	uint32_t seq;                   /* Sequence number. */
+	uint32_t cnt;                   /* Number of sectors. */
+	uint32_t checksum;              /* Of the record, taken with this 0. */
+	disk_sector_t sectors[124];     /* Where each sector belongs. */
+};
+
+/* Pages for a record of TXN_MAX sectors and its descriptor. */
+#define RECORD_PAGES \
+	(((TXN_MAX + 1) * DISK_SECTOR_SIZE + PGSIZE - 1) / PGSIZE)
+
+static bool logging;                /* Journal metadata writes? */
+static disk_sector_t journal_start; /* Header sector. */
+static disk_sector_t log_head;      /* Where the next record goes. */
+static bool checkpoint_due;         /* Start over at the next commit? */
+static uint8_t *record;             /* RECORD_PAGES, for the committer. */
+static struct journal_header header;
+
+/* The running transaction, guarded by JOURNAL_LOCK. */
+static struct lock journal_lock;
+static struct condition can_begin;  /* An operation may begin. */
+static struct condition ops_done;   /* An operation ended. */
+static struct condition committed;  /* COMMITTED_SEQ advanced. */
+static unsigned running_seq;        /* Sequence number of the running one. */
+static unsigned committed_seq;      /* Last one on disk. */
+static disk_sector_t txn_sectors[TXN_MAX];
+static size_t txn_cnt;              /* Sectors it holds. */
+static size_t txn_capacity;         /* Admit operations up to this. */
+static size_t active_cnt;           /* Operations running in it. */
+static size_t waiting_cnt;          /* Operations ended in it. */
+static bool closing;                /* Closed to new operations? */
+static bool committing;             /* Committer busy with it? */
+
+/* Statistics. */
+static long long op_cnt;            /* Operations begun. */
+static long long commit_cnt;        /* Records written. */
+static long long logged_cnt;        /* Sectors in those records. */
+static long long checkpoint_cnt;    /* Times the journal started over. */
+static long long replay_cnt;        /* Records replayed at mount. */
+
+static void replay (void);
+static void write_header (unsigned seq);
+static void checkpoint (unsigned seq);
+static void commit (void);
+static void commit_thread (void *);
+
+/* Returns the number of sectors at the end of the file system
+   disk that belong to the journal, which is 0 on a disk too small
+   to spare them. */
+size_t
+journal_size (void) {
+	return disk_size (filesys_disk) >= 8 * JOURNAL_SECTORS
+		? JOURNAL_SECTORS : 0;
+}
+
+/* Initializes the journal.  If FORMAT is false, first replays
+   whatever the journal holds from before a crash.  Logging stays
+   off if the disk has no journal or the buffer cache is too small
+   to hold a transaction's blocks back. */
+void
+journal_init (bool format) {
+	/* If these assertions fail, the on-disk structures are not
+	   exactly one sector in size. */
+	ASSERT (sizeof (struct journal_header) == DISK_SECTOR_SIZE);
+	ASSERT (sizeof (struct journal_desc) == DISK_SECTOR_SIZE);
+
+	lock_init (&journal_lock);
+	cond_init (&can_begin);
+	cond_init (&ops_done);
+	cond_init (&committed);
+	if (journal_size () == 0)
+		return;
+
+	journal_start = disk_size (filesys_disk) - journal_size ();
+	record = palloc_get_multiple (0, RECORD_PAGES);
+	if (record == NULL)
+		PANIC ("journal_init: out of memory");
+	running_seq = 1;
+	if (!format)
+		replay ();
+	write_header (running_seq);
+	log_head = journal_start + 1;
+	committed_seq = running_seq - 1;
+
+	txn_capacity = cache_sectors / 2 < TXN_MAX ? cache_sectors / 2 : TXN_MAX;
+	if (txn_capacity < OP_CREDITS)
+		return;
+	if (thread_create ("journal", PRI_DEFAULT, commit_thread, NULL)
+			== TID_ERROR)
+		PANIC ("journal_init: can't start committer");
+	logging = true;
+}
+
+/* Commits what is left and empties the journal, with every
+   metadata sector written to its place. */
+void
+journal_done (void) {
+	if (!logging)
+		return;
+
+	lock_acquire (&journal_lock);
+	while (txn_cnt > 0 || committing)
+		cond_wait (&committed, &journal_lock);
+	logging = false;
+	lock_release (&journal_lock);
+
+	checkpoint (running_seq);
+}
+
+/* Starts an operation on the calling thread.  Operations nest:
+   only the outermost journal_begin() and journal_end() count.
+   Waits while the running transaction is being closed or has no
+   room for another operation. */
+void
+journal_begin (void) {
+	struct thread *t = thread_current ();
+
+	if (t->journal_depth++ > 0 || !logging)
+		return;
+
+	lock_acquire (&journal_lock);
+	while (closing
+			|| txn_cnt + (active_cnt + 1) * OP_CREDITS > txn_capacity)
+		cond_wait (&can_begin, &journal_lock);
+	active_cnt++;
+	op_cnt++;
+	lock_release (&journal_lock);
+}
+
+/* Ends the calling thread's operation, and waits until the
+   transaction it ran in is on disk. */
+void
+journal_end (void) {
+	struct thread *t = thread_current ();
+	unsigned seq;
+
+	ASSERT (t->journal_depth > 0);
+	if (--t->journal_depth > 0 || !logging)
+		return;
+
+	lock_acquire (&journal_lock);
+	active_cnt--;
+	cond_broadcast (&can_begin, &journal_lock);
+	if (txn_cnt > 0) {
+		seq = running_seq;
+		waiting_cnt++;
+		cond_signal (&ops_done, &journal_lock);
+		while (committed_seq < seq)
+			cond_wait (&committed, &journal_lock);
+	} else
+		cond_signal (&ops_done, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Writes DISK_SECTOR_SIZE bytes from BUF to metadata SECTOR. */
+void
+journal_write (disk_sector_t sector, const void *buf) {
+	journal_write_at (sector, buf, 0, DISK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUF starting at byte OFS of metadata
+   SECTOR, as part of the calling thread's operation.  Outside
+   one, or with logging off, this is a plain cache_write_at(). */
+void
+journal_write_at (disk_sector_t sector, const void *buf, size_t ofs,
+		size_t size) {
+	unsigned seq;
+	size_t i;
+
+	if (!logging || thread_current ()->journal_depth == 0) {
+		cache_write_at (sector, buf, ofs, size);
+		return;
+	}
+
+	lock_acquire (&journal_lock);
+	for (i = 0; i < txn_cnt; i++)
+		if (txn_sectors[i] == sector)
+			break;
+	if (i == txn_cnt) {
+		if (txn_cnt == TXN_MAX)
+			PANIC ("journal: transaction too large");
+		txn_sectors[txn_cnt++] = sector;
+	}
+	seq = running_seq;
+	lock_release (&journal_lock);
+
+	cache_write_held (sector, buf, ofs, size, seq);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void) {
+	if (journal_start == 0)
+		return;
+	printf ("Journal: %lld operations in %lld commits of %lld sectors, "
+			"%lld checkpoints, %lld records replayed\n",
+			op_cnt, commit_cnt, logged_cnt, checkpoint_cnt, replay_cnt);
+}
+
+/* Writes the records that follow the header, in order, to their
+   sectors, stopping at the first that is missing, stale or torn.
+   Sets RUNNING_SEQ past the last one. */
+static void
+replay (void) {
+	struct journal_desc *d = (struct journal_desc *) record;
+	disk_sector_t pos = journal_start + 1;
+	disk_sector_t end = journal_start + JOURNAL_SECTORS;
+
+	disk_read (filesys_disk, journal_start, &header);
+	if (header.magic != JOURNAL_MAGIC)
+		return;
+	running_seq = header.seq;
+
+	while (pos < end) {
+		uint32_t checksum;
+
+		disk_read (filesys_disk, pos, d);
+		if (d->magic != JOURNAL_MAGIC || d->seq != running_seq
+				|| d->cnt == 0 || d->cnt > TXN_MAX || pos + 1 + d->cnt > end)
+			break;
+		disk_read_multiple (filesys_disk, pos + 1, d->cnt,
+				record + DISK_SECTOR_SIZE);
+		checksum = d->checksum;
+		d->checksum = 0;
+		if ((uint32_t) hash_bytes (record, (1 + d->cnt) * DISK_SECTOR_SIZE)
+				!= checksum)
+			break;
+
+		for (size_t i = 0; i < d->cnt; i++)
+			disk_write (filesys_disk, d->sectors[i],
+					record + (i + 1) * DISK_SECTOR_SIZE);
+		pos += 1 + d->cnt;
+		running_seq++;
+		replay_cnt++;
+	}
+	if (replay_cnt > 0)
+		printf ("journal: replayed %lld records\n", replay_cnt);
+}
+
+/* Writes a header that makes SEQ the first record to count. */
+static void
+write_header (unsigned seq) {
+	memset (&header, 0, sizeof header);
+	header.magic = JOURNAL_MAGIC;
+	header.seq = seq;
+	disk_write (filesys_disk, journal_start, &header);
+}
+
+/* Writes every committed block to its sector, then starts the
+   journal over with record SEQ. */
+static void
+checkpoint (unsigned seq) {
+	cache_flush ();
+	write_header (seq);
+	log_head = journal_start + 1;
+	checkpoint_due = false;
+	checkpoint_cnt++;
+}
+
+/* Commits the running transaction, which is closed and has no
+   operations left in it.  Must hold JOURNAL_LOCK, which is
+   released during the disk writes. */
+static void
+commit (void) {
+	struct journal_desc *d = (struct journal_desc *) record;
+	unsigned seq = running_seq;
+	size_t cnt = txn_cnt;
+
+	ASSERT (lock_held_by_current_thread (&journal_lock));
+	ASSERT (closing && active_cnt == 0 && cnt > 0);
+
+	committing = true;
+	memset (d, 0, sizeof *d);
+	d->magic = JOURNAL_MAGIC;
+	d->seq = seq;
+	d->cnt = cnt;
+	memcpy (d->sectors, txn_sectors, cnt * sizeof *txn_sectors);
+	lock_release (&journal_lock);
+
+	/* Nothing writes the held blocks while the transaction is
+	   closed, so these copies are exactly what it changed. */
+	for (size_t i = 0; i < cnt; i++)
+		cache_read (d->sectors[i], record + (i + 1) * DISK_SECTOR_SIZE);
+	if (checkpoint_due || log_head + 1 + cnt > journal_start + JOURNAL_SECTORS)
+		checkpoint (seq);
+	d->checksum = hash_bytes (record, (1 + cnt) * DISK_SECTOR_SIZE);
+
+	lock_acquire (&journal_lock);
+	running_seq++;
+	txn_cnt = 0;
+	waiting_cnt = 0;
+	closing = false;
+	cond_broadcast (&can_begin, &journal_lock);
+	lock_release (&journal_lock);
+
+	disk_write_multiple (filesys_disk, log_head, 1 + cnt, record);
+	log_head += 1 + cnt;
+	if (log_head - journal_start > JOURNAL_SECTORS / 2)
+		checkpoint_due = true;
+	for (size_t i = 0; i < cnt; i++)
+		cache_release (d->sectors[i], seq);
+
+	lock_acquire (&journal_lock);
+	committed_seq = seq;
+	committing = false;
+	commit_cnt++;
+	logged_cnt += cnt;
+	cond_broadcast (&committed, &journal_lock);
+}
+
+/* Commits the running transaction whenever an operation waits on
+   it. */
+static void
+commit_thread (void *aux UNUSED) {
+	lock_acquire (&journal_lock);
+	for (;;) {
+		while (waiting_cnt == 0 || txn_cnt == 0)
+			cond_wait (&ops_done, &journal_lock);
+		closing = true;
+		while (active_cnt > 0)
+			cond_wait (&ops_done, &journal_lock);
+		commit ();
+	}
+}
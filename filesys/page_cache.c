@@ -1,6 +1,17 @@
 /* page_cache.c: Implementation of Page Cache (Buffer Cache). */
 
 #include "vm/vm.h"
+#include "filesys/page_cache.h"
+#ifdef VM
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#endif
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
@@ -48,3 +59,202 @@ page_cache_destroy (struct page *page) {
 static void
 page_cache_kworkerd (void *aux) {
 }
+
+#ifdef VM
+/* The page cache: frames holding pages of files that mmap()
+   mappings use, by file position, so that every mapping of a
+   file page in every process maps the same frame.  read() and
+   write() go to that frame too, so they see what the mappings
+   store and the mappings see what they write, with no copy of the
+   page kept anywhere else.  Writes still go on to the file, so
+   that fsync() covers them.
+
+   A frame stays cached for as long as a page maps it.  The frame
+   table and its clock own the frames: eviction, munmap() and
+   process exit write a frame back the way they write any file
+   page, then call page_cache_forget().
+
+   PAGE_CACHE_LOCK guards the cache and keeps a frame in it alive
+   while it is held, so that read() and write() can copy to and
+   from the frame under it.  It comes before the frame table's
+   lock.  Such a copy may fault on a user buffer, and the fault
+   may come back here: page_cache_enter() then refuses, and the
+   nested access bypasses the cache. */
+struct cached_page {
+	struct hash_elem elem;      /* Element in CACHED_PAGES. */
+	struct inode *inode;        /* File, with a reference of its own. */
+	off_t ofs;                  /* Page-aligned position in INODE. */
+	struct frame *frame;        /* Frame holding the page. */
+};
+
+static struct hash cached_pages;
+static struct lock page_cache_lock;
+static size_t cached_cnt;           /* Entries in CACHED_PAGES. */
+static long long read_hits;         /* read()s served from frames. */
+static long long write_hits;        /* write()s copied into frames. */
+
+static hash_hash_func cached_hash;
+static hash_less_func cached_less;
+
+/* Sets up the page cache. */
+void
+page_cache_init (void) {
+	lock_init (&page_cache_lock);
+	if (!hash_init (&cached_pages, cached_hash, cached_less, NULL))
+		PANIC ("page_cache_init: out of memory");
+}
+
+/* Acquires the page cache lock and returns true, or returns false
+ * if the running thread already holds it. */
+bool
+page_cache_enter (void) {
+	if (lock_held_by_current_thread (&page_cache_lock))
+		return false;
+	lock_acquire (&page_cache_lock);
+	return true;
+}
+
+/* Releases the page cache lock. */
+void
+page_cache_exit (void) {
+	lock_release (&page_cache_lock);
+}
+
+/* Returns true if the running thread holds the page cache lock,
+ * in the middle of a copy to or from a cached frame. */
+bool
+page_cache_held (void) {
+	return lock_held_by_current_thread (&page_cache_lock);
+}
+
+/* Returns the cached page of INODE at OFS, which is page-aligned,
+ * or a null pointer.  The page cache lock must be held. */
+struct cached_page *
+page_cache_find (struct inode *inode, off_t ofs) {
+	struct cached_page probe;
+	struct hash_elem *e;
+
+	ASSERT (page_cache_held ());
+
+	probe.inode = inode;
+	probe.ofs = ofs;
+	e = hash_find (&cached_pages, &probe.elem);
+	return e != NULL ? hash_entry (e, struct cached_page, elem) : NULL;
+}
+
+/* Enters FRAME as holding the page of INODE at OFS, which is
+ * page-aligned and not cached yet.  Returns the new entry, or a
+ * null pointer if out of memory.  The page cache lock must be
+ * held. */
+struct cached_page *
+page_cache_add (struct inode *inode, off_t ofs, struct frame *frame) {
+	struct cached_page *c = malloc (sizeof *c);
+
+	ASSERT (page_cache_held ());
+
+	if (c == NULL)
+		return NULL;
+	c->inode = inode_reopen (inode);
+	c->ofs = ofs;
+	c->frame = frame;
+	hash_insert (&cached_pages, &c->elem);
+	__atomic_add_fetch (&cached_cnt, 1, __ATOMIC_RELAXED);
+	return c;
+}
+
+/* Returns the frame that holds cached page C. */
+struct frame *
+page_cache_frame (const struct cached_page *c) {
+	return c->frame;
+}
+
+/* Takes cached page C out of the cache and frees it, once any copy
+ * to or from its frame is done.  The caller has written the frame
+ * back and is about to free or reuse it. */
+void
+page_cache_forget (struct cached_page *c) {
+	ASSERT (!page_cache_held ());
+
+	lock_acquire (&page_cache_lock);
+	hash_delete (&cached_pages, &c->elem);
+	__atomic_sub_fetch (&cached_cnt, 1, __ATOMIC_RELAXED);
+	lock_release (&page_cache_lock);
+	inode_close (c->inode);
+	free (c);
+}
+
+/* Returns the number of cached pages. */
+size_t
+page_cache_size (void) {
+	return __atomic_load_n (&cached_cnt, __ATOMIC_RELAXED);
+}
+
+/* If the page of INODE holding byte OFS is cached, copies SIZE
+ * bytes from OFS, which must not cross into the next page, out of
+ * its frame into BUF and returns true. */
+bool
+page_cache_read (struct inode *inode, void *buf, off_t ofs, size_t size) {
+	struct cached_page *c;
+
+	if (page_cache_size () == 0 || !page_cache_enter ())
+		return false;
+	c = page_cache_find (inode, ROUND_DOWN (ofs, PGSIZE));
+	if (c != NULL) {
+		memcpy (buf, (uint8_t *) c->frame->kva + ofs % PGSIZE, size);
+		read_hits++;
+	}
+	page_cache_exit ();
+	return c != NULL;
+}
+
+/* Copies SIZE bytes from BUF, just written to INODE at OFS, into
+ * the frame of the page holding OFS, if it is cached.  The bytes
+ * must not cross into the next page.  A write of the frame's own
+ * contents back to the file, as mmap writeback does, copies
+ * nothing. */
+void
+page_cache_update (struct inode *inode, const void *buf, off_t ofs,
+		size_t size) {
+	struct cached_page *c;
+
+	if (page_cache_size () == 0 || !page_cache_enter ())
+		return;
+	c = page_cache_find (inode, ROUND_DOWN (ofs, PGSIZE));
+	if (c != NULL) {
+		uint8_t *dst = (uint8_t *) c->frame->kva + ofs % PGSIZE;
+
+		if (dst != buf) {
+			memcpy (dst, buf, size);
+			write_hits++;
+		}
+	}
+	page_cache_exit ();
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Page cache I/O: %lld reads and %lld writes through frames\n",
+			read_hits, write_hits);
+}
+
+/* Returns a hash of cached page E's position. */
+static uint64_t
+cached_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct cached_page *c = hash_entry (e, struct cached_page, elem);
+
+	return hash_ptr (c->inode) ^ hash_u64 (c->ofs);
+}
+
+/* Orders cached pages A and B by position. */
+static bool
+cached_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct cached_page *a = hash_entry (a_, struct cached_page, elem);
+	const struct cached_page *b = hash_entry (b_, struct cached_page, elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->ofs < b->ofs;
+}
+#endif /* VM */
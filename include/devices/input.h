@@ -2,11 +2,15 @@
 #define DEVICES_INPUT_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 void input_init (void);
 void input_putc (uint8_t);
+void input_putbuf (const uint8_t *, size_t);
 uint8_t input_getc (void);
+size_t input_getbuf (uint8_t *, size_t);
+size_t input_room (void);
 bool input_full (void);
 
 #endif /* devices/input.h */
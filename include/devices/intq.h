@@ -15,17 +15,19 @@
    and condition variables from threads/synch.h cannot be used in
    this case, as they normally would, because they can only
    protect kernel threads from one another, not from interrupt
-   handlers. */
+   handlers.  A spinlock, taken with interrupts off, serves as the
+   monitor lock and wait queues as its condition variables. */
 
 /* Queue buffer size, in bytes. */
 #define INTQ_BUFSIZE 64
 
 /* A circular queue of bytes. */
 struct intq {
+	struct spinlock lock;       /* Monitor lock. */
+
 	/* Waiting threads. */
-	struct lock lock;           /* Only one thread may wait at once. */
-	struct thread *not_full;    /* Thread waiting for not-full condition. */
-	struct thread *not_empty;   /* Thread waiting for not-empty condition. */
+	struct wait_queue not_full; /* Threads waiting for not-full condition. */
+	struct wait_queue not_empty; /* Threads waiting for not-empty condition. */
 
 	/* Queue. */
 	uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
@@ -0,0 +1,9 @@
+#ifndef DEVICES_IOAPIC_H
+#define DEVICES_IOAPIC_H
+
+#include <stdbool.h>
+
+void ioapic_probe (void);
+bool ioapic_init (void);
+
+#endif /* devices/ioapic.h */
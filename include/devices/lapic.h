@@ -0,0 +1,24 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* Interrupt vectors delivered by the local APIC. */
+#define LAPIC_TIMER_VEC 0xf0
+#define LAPIC_RESCHED_VEC 0xf1
+#define LAPIC_SHOOTDOWN_VEC 0xf2
+#define LAPIC_SPURIOUS_VEC 0xff
+
+bool lapic_init (intr_handler_func *timer_handler, uint64_t tsc_hz);
+bool lapic_present (void);
+uint32_t lapic_id (void);
+void lapic_init_ap (void);
+void lapic_start_aps (uint32_t entry);
+void lapic_send_ipi (uint32_t apic_id, uint8_t vec);
+void lapic_eoi (void);
+void lapic_timer_arm (uint64_t deadline);
+void lapic_timer_cancel (void);
+
+#endif /* devices/lapic.h */
@@ -0,0 +1,35 @@
+#ifndef DEVICES_SPSC_H
+#define DEVICES_SPSC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A single-producer, single-consumer circular buffer of bytes.
+
+   Unlike an interrupt queue (see intq.h), neither side needs
+   interrupts off: each side owns one index, and publishes it with
+   release semantics only after touching the bytes it covers, so
+   an interrupt handler can produce while a kernel thread consumes
+   without either blocking the other.  Producers or consumers that
+   may run concurrently with one another must serialize among
+   themselves.  Neither side sleeps; a caller that wants to wait
+   for data or room arranges that itself.
+
+   The buffer is supplied by the caller and its size must be a
+   power of 2. */
+
+struct spsc {
+	uint8_t *buf;               /* Buffer. */
+	size_t size;                /* Size of BUF, a power of 2. */
+	size_t head;                /* Bytes ever put, owned by producer. */
+	size_t tail;                /* Bytes ever gotten, owned by consumer. */
+};
+
+void spsc_init (struct spsc *, uint8_t *buf, size_t size);
+size_t spsc_count (const struct spsc *);
+size_t spsc_room (const struct spsc *);
+size_t spsc_put (struct spsc *, const uint8_t *, size_t);
+size_t spsc_get (struct spsc *, uint8_t *, size_t);
+
+#endif /* devices/spsc.h */
@@ -2,22 +2,43 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+struct thread;
+struct vdso_time;
+
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* Stop the periodic tick while idle?  Set by "-tickless". */
+extern bool timer_tickless;
+
+/* Loops per second to assume instead of measuring them, or 0.  Set
+   by "-loops". */
+extern uint64_t timer_loops_per_sec;
+
 void timer_init (void);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_nsec (void);
+int64_t timer_cycles_to_ns (uint64_t cycles);
+void timer_publish (struct vdso_time *);
 
 void timer_sleep (int64_t ticks);
+void timer_sleep_slack (int64_t ticks, int64_t slack);
+bool timer_reserve (void);
+void timer_block (int64_t ticks);
+bool timer_cancel (struct thread *);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
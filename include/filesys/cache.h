@@ -0,0 +1,37 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <list.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* The dirty blocks written on behalf of one file, so that they can
+   be flushed without scanning the whole cache. */
+struct cache_owner {
+	struct list dirty;          /* Dirty blocks, unordered. */
+};
+
+/* Sectors in the buffer cache, set by the -bc option.  Zero turns
+   the cache off and sends every access to the disk. */
+extern size_t cache_sectors;
+
+void cache_init (void);
+void cache_read (disk_sector_t, void *);
+void cache_write (disk_sector_t, const void *);
+void cache_read_at (disk_sector_t, void *, size_t ofs, size_t size);
+void cache_write_at (disk_sector_t, const void *, size_t ofs, size_t size);
+void cache_write_held (disk_sector_t, const void *, size_t ofs, size_t size,
+		unsigned txn);
+void cache_release (disk_sector_t, unsigned txn);
+void cache_owner_init (struct cache_owner *);
+void cache_owner_done (struct cache_owner *);
+void cache_write_owned (disk_sector_t, const void *, size_t ofs, size_t size,
+		struct cache_owner *);
+void cache_flush_owner (struct cache_owner *);
+void cache_flush_sector (disk_sector_t);
+void cache_readahead (disk_sector_t);
+void cache_prefetch (disk_sector_t, size_t cnt);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -18,6 +18,10 @@ typedef uint32_t cluster_t;  /* Index of a cluster within FAT. */
 #define FAT_BOOT_SECTOR 0     /* FAT boot sector. */
 #define ROOT_DIR_CLUSTER 1    /* Cluster for the root directory */
 
+/* Read FAT sectors through the buffer cache on demand instead of
+   loading the table at mount, set by the -fat-lazy option. */
+extern bool fat_lazy;
+
 void fat_init (void);
 void fat_open (void);
 void fat_close (void);
@@ -31,6 +35,8 @@ void fat_remove_chain (
     cluster_t clst, /* Cluster # to be removed */
     cluster_t pclst /* Previous cluster of clst, 0: clst is the start of chain */
 );
+void fat_release_prealloc (cluster_t clst);
+size_t fat_free_clusters (void);
 cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
@@ -14,6 +14,7 @@ extern struct disk *filesys_disk;
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
+bool filesys_symlink (const char *target, const char *linkpath);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
 
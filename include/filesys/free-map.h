@@ -5,6 +5,12 @@
 #include <stddef.h>
 #include "devices/disk.h"
 
+/* A run of sectors from free_map_allocate_extents(). */
+struct free_map_extent {
+	disk_sector_t start;        /* First sector. */
+	size_t cnt;                 /* Number of sectors. */
+};
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
@@ -12,6 +18,13 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, disk_sector_t *);
+bool free_map_allocate_near (size_t, disk_sector_t hint, disk_sector_t *);
+size_t free_map_allocate_extents (size_t, disk_sector_t hint,
+		struct free_map_extent[], size_t max);
+size_t free_map_allocate_reserved (size_t, size_t reserved,
+		disk_sector_t hint, struct free_map_extent[], size_t max);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
 void free_map_release (disk_sector_t, size_t);
 
 #endif /* filesys/free-map.h */
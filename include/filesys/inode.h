@@ -8,14 +8,32 @@
 struct bitmap;
 
 void inode_init (void);
-bool inode_create (disk_sector_t, off_t);
+bool inode_create (disk_sector_t, off_t, bool is_dir);
+bool inode_create_symlink (disk_sector_t, const char *target);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
 disk_sector_t inode_get_inumber (const struct inode *);
+unsigned inode_write_gen (const struct inode *);
+void inode_set_aux (struct inode *, void *aux, void (*destroy) (void *));
+void *inode_get_aux (const struct inode *);
+bool inode_is_removed (const struct inode *);
+bool inode_is_dir (const struct inode *);
+bool inode_is_symlink (const struct inode *);
+const char *inode_symlink_target (const struct inode *);
+bool inode_link_cached (struct inode *, unsigned key, disk_sector_t *);
+void inode_link_remember (struct inode *, unsigned key, disk_sector_t);
+void inode_lock (struct inode *, bool write);
+void inode_unlock (struct inode *, bool write);
+void inode_set_journaled (struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
+void inode_readahead_open (disk_sector_t);
+void inode_prefetch (struct inode *, off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_allocate (struct inode *, off_t length);
+void inode_sync (struct inode *, bool data_only);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
@@ -0,0 +1,21 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+/* Sectors at the end of the file system disk kept for the
+   journal, on disks large enough to spare them. */
+#define JOURNAL_SECTORS 128
+
+size_t journal_size (void);
+void journal_init (bool format);
+void journal_done (void);
+void journal_begin (void);
+void journal_end (void);
+void journal_write (disk_sector_t, const void *);
+void journal_write_at (disk_sector_t, const void *, size_t ofs, size_t size);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -1,12 +1,36 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
 #include "vm/vm.h"
 
 struct page;
 enum vm_type;
+struct inode;
+struct frame;
 
 struct page_cache {};
 
+/* A page of a file held in a frame that every mmap() mapping of
+   that page shares.  See page_cache.c. */
+struct cached_page;
+
 void page_cache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+
+bool page_cache_enter (void);
+void page_cache_exit (void);
+bool page_cache_held (void);
+struct cached_page *page_cache_find (struct inode *, off_t ofs);
+struct cached_page *page_cache_add (struct inode *, off_t ofs,
+		struct frame *);
+struct frame *page_cache_frame (const struct cached_page *);
+void page_cache_forget (struct cached_page *);
+size_t page_cache_size (void);
+void page_cache_print_stats (void);
+
+bool page_cache_read (struct inode *, void *, off_t ofs, size_t size);
+void page_cache_update (struct inode *, const void *, off_t ofs,
+		size_t size);
 #endif
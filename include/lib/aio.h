@@ -0,0 +1,16 @@
+#ifndef __LIB_AIO_H
+#define __LIB_AIO_H
+
+#include <stdint.h>
+
+/* Value of an aio_read() or aio_write() status word while the
+   request is in flight.  Once delivered, the word holds what
+   pread() or pwrite() would have returned. */
+#define AIO_INPROGRESS INT32_MIN
+
+/* Most requests one process may have in flight, and most bytes
+   one request may move. */
+#define AIO_MAX 16
+#define AIO_SIZE_MAX (64 * 1024)
+
+#endif /* lib/aio.h */
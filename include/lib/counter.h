@@ -0,0 +1,13 @@
+#ifndef __LIB_COUNTER_H
+#define __LIB_COUNTER_H
+
+/* Named kernel counters, for counter_find(), counter_read() and
+   counter_name().  Counter 0 is always "counter.version", which
+   reads as COUNTER_VERSION; that changes only if the meaning of
+   existing counters does. */
+#define COUNTER_VERSION 1
+
+/* Longest counter name. */
+#define COUNTER_NAME_MAX 31
+
+#endif /* lib/counter.h */
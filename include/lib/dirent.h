@@ -0,0 +1,21 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* One directory entry that getdents() packs into the caller's
+   buffer.  Entries follow one another, each D_RECLEN bytes after
+   the last, so that the caller walks them by adding D_RECLEN. */
+struct dirent {
+	uint32_t d_ino;             /* Sector of the entry's inode. */
+	uint16_t d_reclen;          /* Bytes to the next entry. */
+	char d_name[];              /* Null-terminated name. */
+};
+
+/* Bytes a struct dirent takes for a name of LEN characters,
+   rounded up so that the next one stays aligned. */
+#define DIRENT_RECLEN(LEN) \
+	((offsetof (struct dirent, d_name) + (LEN) + 1 + 3) & ~(size_t) 3)
+
+#endif /* lib/dirent.h */
@@ -0,0 +1,67 @@
+#ifndef __LIB_FIXED_POINT_H
+#define __LIB_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* Signed 17.14 fixed-point arithmetic.
+
+   A fixed_t holds a real number X as the integer X * FP_ONE, so
+   that the kernel, which may not use the FPU, can still compute
+   fractional quantities such as the MLFQS load average.  Sums and
+   differences of two fixed_t are plain integer operations;
+   products and quotients go through 64-bit intermediates so they
+   cannot overflow before the final scaling. */
+
+typedef int32_t fixed_t;
+
+/* Number of fraction bits. */
+#define FP_SHIFT 14
+
+/* 1.0 in fixed-point. */
+#define FP_ONE ((fixed_t) 1 << FP_SHIFT)
+
+/* Converts integer N to fixed-point. */
+static inline fixed_t
+fp_from_int (int n) {
+	return n * FP_ONE;
+}
+
+/* Converts X to an integer, rounding toward zero. */
+static inline int
+fp_to_int (fixed_t x) {
+	return x / FP_ONE;
+}
+
+/* Converts X to an integer, rounding to nearest. */
+static inline int
+fp_round (fixed_t x) {
+	return x >= 0 ? (x + FP_ONE / 2) / FP_ONE : (x - FP_ONE / 2) / FP_ONE;
+}
+
+/* Returns X + N, for integer N. */
+static inline fixed_t
+fp_add_int (fixed_t x, int n) {
+	return x + n * FP_ONE;
+}
+
+/* Returns X - N, for integer N. */
+static inline fixed_t
+fp_sub_int (fixed_t x, int n) {
+	return x - n * FP_ONE;
+}
+
+/* Returns X * Y. */
+static inline fixed_t
+fp_mul (fixed_t x, fixed_t y) {
+	return (fixed_t) (((int64_t) x) * y / FP_ONE);
+}
+
+/* Returns X / Y. */
+static inline fixed_t
+fp_div (fixed_t x, fixed_t y) {
+	return (fixed_t) (((int64_t) x) * FP_ONE / y);
+}
+
+fixed_t fp_pow (fixed_t x, unsigned n);
+
+#endif /* lib/fixed-point.h */
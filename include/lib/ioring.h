@@ -0,0 +1,50 @@
+#ifndef __LIB_IORING_H
+#define __LIB_IORING_H
+
+#include <stdint.h>
+
+/* Submission and completion rings for io_ring_enter(), in user
+   memory that io_ring_setup() registers with the kernel.  The
+   process queues operations at SQ_TAIL and the kernel consumes them
+   at SQ_HEAD; the kernel posts their results at CQ_TAIL and the
+   process collects them at CQ_HEAD.  Each side writes only its own
+   two indexes.  Indexes run freely and wrap, so an index's slot is
+   the index modulo IORING_ENTRIES. */
+
+#define IORING_ENTRIES 64           /* Slots in each ring; a power of 2. */
+
+/* Operations a submission can ask for. */
+enum io_ring_op {
+	IORING_OP_NOP,              /* Nothing; completes with 0. */
+	IORING_OP_READ,             /* read(), or pread() if OFF >= 0. */
+	IORING_OP_WRITE,            /* write(), or pwrite() if OFF >= 0. */
+	IORING_OP_OPEN,             /* open() of the name at ADDR. */
+	IORING_OP_CLOSE,            /* close(). */
+};
+
+/* One queued operation. */
+struct io_sqe {
+	uint32_t op;                /* An enum io_ring_op. */
+	int32_t fd;                 /* Descriptor, except for open. */
+	uint64_t addr;              /* Buffer, or the name to open. */
+	uint32_t len;               /* Bytes in the buffer. */
+	int64_t off;                /* File offset, or -1 for the position. */
+	uint64_t user_data;         /* Passed through to the completion. */
+};
+
+/* The result of one operation. */
+struct io_cqe {
+	uint64_t user_data;         /* From the submission. */
+	int64_t res;                /* What the matching system call returns. */
+};
+
+struct io_ring {
+	uint32_t sq_head;           /* Written by the kernel. */
+	uint32_t sq_tail;           /* Written by the process. */
+	uint32_t cq_head;           /* Written by the process. */
+	uint32_t cq_tail;           /* Written by the kernel. */
+	struct io_sqe sq[IORING_ENTRIES];
+	struct io_cqe cq[IORING_ENTRIES];
+};
+
+#endif /* lib/ioring.h */
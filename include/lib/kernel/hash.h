@@ -11,6 +11,14 @@
  * element's data and use that as an index into an array of
  * doubly linked lists, then linearly search the list.
  *
+ * The table resizes incrementally.  When it outgrows its buckets,
+ * or shrinks well below them, it allocates a new bucket array but
+ * keeps the old one, and each later insertion or deletion moves
+ * a few of the old buckets' elements across.  A lookup meanwhile
+ * searches one bucket in each array.  No one operation moves the
+ * whole table, so none of them costs time proportional to its
+ * size.
+ *
  * The chain lists do not use dynamic allocation.  Instead, each
  * structure that can potentially be in a hash must embed a
  * struct hash_elem member.  All of the hash functions operate on
@@ -59,6 +67,9 @@ struct hash {
 	size_t elem_cnt;            /* Number of elements in table. */
 	size_t bucket_cnt;          /* Number of buckets, a power of 2. */
 	struct list *buckets;       /* Array of `bucket_cnt' lists. */
+	struct list *old_buckets;   /* Buckets being emptied, or NULL. */
+	size_t old_bucket_cnt;      /* Number of old buckets, a power of 2. */
+	size_t migrate_idx;         /* Old buckets before this are empty. */
 	hash_hash_func *hash;       /* Hash function. */
 	hash_less_func *less;       /* Comparison function. */
 	void *aux;                  /* Auxiliary data for `hash' and `less'. */
@@ -96,5 +107,7 @@ bool hash_empty (struct hash *);
 uint64_t hash_bytes (const void *, size_t);
 uint64_t hash_string (const char *);
 uint64_t hash_int (int);
+uint64_t hash_u64 (uint64_t);
+uint64_t hash_ptr (const void *);
 
 #endif /* lib/kernel/hash.h */
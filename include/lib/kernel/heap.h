@@ -0,0 +1,67 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Intrusive max-heap.
+
+   A pairing heap: like struct list, the heap does not allocate,
+   it links together heap_elems embedded in the caller's
+   structures.  Finding the maximum and inserting take constant
+   time; removing the maximum or an arbitrary element takes
+   amortized logarithmic time.  An element's key may increase while
+   it is in a heap if heap_raise() is called right after, which
+   takes constant time.  To decrease a key, remove the element,
+   update the key, and insert it again.  Callers synchronize. */
+
+/* Heap element. */
+struct heap_elem {
+	struct heap_elem *child;            /* First child. */
+	struct heap_elem *next;             /* Next sibling. */
+	struct heap_elem *prev;             /* Previous sibling, or parent
+	                                       if first child. */
+};
+
+/* Heap. */
+struct heap {
+	struct heap_elem *root;             /* Maximum element, or NULL. */
+};
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element.  See list_entry() in list.h. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+	((STRUCT *) ((uint8_t *) (HEAP_ELEM)                \
+		- offsetof (STRUCT, MEMBER)))
+
+/* Compares the keys of heap elements A and B, given auxiliary
+   data AUX.  Returns true if A is less than B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+void heap_init (struct heap *);
+void heap_insert (struct heap *, struct heap_elem *,
+                  heap_less_func *, void *aux);
+void heap_remove (struct heap *, struct heap_elem *,
+                  heap_less_func *, void *aux);
+void heap_raise (struct heap *, struct heap_elem *,
+                 heap_less_func *, void *aux);
+struct heap_elem *heap_pop_max (struct heap *, heap_less_func *, void *aux);
+
+/* Returns the maximum element of H, or NULL if H is empty. */
+static inline struct heap_elem *
+heap_max (const struct heap *h) {
+	return h->root;
+}
+
+/* Returns true if H is empty. */
+static inline bool
+heap_empty (const struct heap *h) {
+	return h->root == NULL;
+}
+
+#endif /* lib/kernel/heap.h */
@@ -0,0 +1,41 @@
+#ifndef __LIB_KERNEL_HISTOGRAM_H
+#define __LIB_KERNEL_HISTOGRAM_H
+
+#include <stdint.h>
+
+/* Histogram with power-of-two buckets.
+
+   Bucket 0 counts samples of value 0 or 1, and bucket K > 0
+   counts samples in [2**K, 2**(K+1)).  Samples too large for
+   the last bucket are counted there.  Recording a sample is a
+   count-leading-zeros and an increment, so it is cheap enough
+   for the scheduler and interrupt paths.  Callers synchronize. */
+
+#define HISTOGRAM_BUCKETS 40
+
+struct histogram {
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+	uint64_t max;                   /* Largest sample recorded. */
+};
+
+/* Returns the bucket that VALUE falls into. */
+static inline unsigned
+histogram_bucket (uint64_t value) {
+	unsigned b = value > 1 ? 63 - __builtin_clzll (value) : 0;
+	return b < HISTOGRAM_BUCKETS ? b : HISTOGRAM_BUCKETS - 1;
+}
+
+/* Counts VALUE in histogram H. */
+static inline void
+histogram_add (struct histogram *h, uint64_t value) {
+	h->buckets[histogram_bucket (value)]++;
+	if (value > h->max)
+		h->max = value;
+}
+
+void histogram_init (struct histogram *);
+uint64_t histogram_count (const struct histogram *);
+void histogram_print (const struct histogram *, const char *name,
+		const char *unit);
+
+#endif /* lib/kernel/histogram.h */
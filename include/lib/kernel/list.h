@@ -160,4 +160,38 @@ void list_unique (struct list *, struct list *duplicates,
 struct list_elem *list_max (struct list *, list_less_func *, void *aux);
 struct list_elem *list_min (struct list *, list_less_func *, void *aux);
 
+/* Counted list.
+
+   A struct list that also keeps its size and, if given an
+   ordering, its greatest element, so that clist_size() and
+   clist_max() take constant time instead of walking the list.  (To
+   cache the least element instead, give an ordering that is the
+   reverse of the natural one.)  The greatest element is found
+   again, in linear time, by the first clist_max() after it is
+   removed.  An element's key may increase while it is in the list
+   if clist_raise() is called right after; for any other change to
+   a key, call clist_invalidate().
+
+   Traverse CLIST->LIST with the usual list functions, but add and
+   remove elements only with the functions below. */
+struct clist {
+	struct list list;           /* The elements. */
+	size_t size;                /* Number of elements. */
+	list_less_func *less;       /* Ordering, or a null pointer. */
+	void *aux;                  /* Auxiliary data for LESS. */
+	struct list_elem *max;      /* Greatest element, or a null pointer
+	                               if not known. */
+};
+
+void clist_init (struct clist *, list_less_func *, void *aux);
+void clist_push_front (struct clist *, struct list_elem *);
+void clist_push_back (struct clist *, struct list_elem *);
+struct list_elem *clist_remove (struct clist *, struct list_elem *);
+struct list_elem *clist_pop_front (struct clist *);
+size_t clist_size (const struct clist *);
+bool clist_empty (const struct clist *);
+struct list_elem *clist_max (struct clist *);
+void clist_raise (struct clist *, struct list_elem *);
+void clist_invalidate (struct clist *);
+
 #endif /* lib/kernel/list.h */
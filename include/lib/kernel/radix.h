@@ -0,0 +1,50 @@
+#ifndef __LIB_KERNEL_RADIX_H
+#define __LIB_KERNEL_RADIX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Radix tree keyed by 36-bit index.
+
+   Four levels of 512-way nodes, each one page, consume the index
+   9 bits at a time from the top.  Keyed by virtual page number,
+   the levels line up with the x86-64 PML4, PDPT, page directory
+   and page table, so lookup and insertion touch exactly four
+   nodes and neighbouring pages share the same leaf, which makes
+   range walks cheap.  Values are non-null pointers.  Interior
+   nodes are only freed by radix_destroy().  Callers
+   synchronize. */
+
+#define RADIX_BITS 9                        /* Index bits per level. */
+#define RADIX_LEVELS 4                      /* Levels in a tree. */
+#define RADIX_FANOUT (1 << RADIX_BITS)      /* Slots per node. */
+#define RADIX_KEY_MAX ((1ULL << (RADIX_BITS * RADIX_LEVELS)) - 1)
+
+/* Radix tree. */
+struct radix {
+	void **root;                /* Top-level node, or NULL. */
+	size_t cnt;                 /* Number of values. */
+};
+
+/* Performs some operation on the value VALUE stored at index KEY,
+   given auxiliary data AUX.  For radix_for_each(), returning
+   false stops the walk. */
+typedef bool radix_action_func (uint64_t key, void *value, void *aux);
+
+void radix_init (struct radix *);
+void radix_destroy (struct radix *, radix_action_func *, void *aux);
+void *radix_find (const struct radix *, uint64_t key);
+bool radix_insert (struct radix *, uint64_t key, void *value);
+void *radix_delete (struct radix *, uint64_t key);
+void *radix_replace (struct radix *, uint64_t key, void *value);
+bool radix_for_each (const struct radix *, uint64_t first, uint64_t last,
+                     radix_action_func *, void *aux);
+
+/* Returns the number of values in R. */
+static inline size_t
+radix_size (const struct radix *r) {
+	return r->cnt;
+}
+
+#endif /* lib/kernel/radix.h */
@@ -0,0 +1,108 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Intrusive red-black tree.
+
+   Like struct list, the tree does not allocate: it links together
+   rb_nodes embedded in the caller's structures, ordered by a
+   caller-supplied LESS.  Insertion, removal and lookup take
+   logarithmic time; stepping to the next or previous node takes
+   amortized constant time.  Equal keys are allowed and keep their
+   insertion order.
+
+   A tree may be augmented with data each node summarizes about
+   its subtree.  AUGMENT recomputes that data for a node from the
+   node itself and its children; the tree calls it on every node
+   whose subtree changes, bottom up.  struct itree, below, is one
+   such augmentation.  Callers synchronize. */
+
+/* Tree node. */
+struct rb_node {
+	struct rb_node *parent;             /* Parent, or NULL at the root. */
+	struct rb_node *left, *right;       /* Children, or NULL. */
+	bool red;                           /* Red or black? */
+};
+
+/* Converts pointer to tree node RB_NODE into a pointer to the
+   structure that RB_NODE is embedded inside.  Supply the name of
+   the outer structure STRUCT and the member name MEMBER of the
+   tree node.  See list_entry() in list.h. */
+#define rb_entry(RB_NODE, STRUCT, MEMBER)               \
+	((STRUCT *) ((uint8_t *) (RB_NODE)                  \
+		- offsetof (STRUCT, MEMBER)))
+
+/* Compares the keys of tree nodes A and B, given auxiliary data
+   AUX.  Returns true if A is less than B. */
+typedef bool rb_less_func (const struct rb_node *a,
+                           const struct rb_node *b,
+                           void *aux);
+
+/* Recomputes N's augmented data from N and its children, given
+   auxiliary data AUX. */
+typedef void rb_augment_func (struct rb_node *n, void *aux);
+
+/* Red-black tree. */
+struct rbtree {
+	struct rb_node *root;               /* Root, or NULL if empty. */
+	size_t cnt;                         /* Number of nodes. */
+	rb_less_func *less;                 /* Comparison function. */
+	rb_augment_func *augment;           /* Augmentation, or NULL. */
+	void *aux;                          /* Auxiliary data for both. */
+};
+
+void rb_init (struct rbtree *, rb_less_func *, rb_augment_func *, void *aux);
+void rb_insert (struct rbtree *, struct rb_node *);
+void rb_remove (struct rbtree *, struct rb_node *);
+struct rb_node *rb_find (const struct rbtree *, const struct rb_node *);
+struct rb_node *rb_lower_bound (const struct rbtree *, const struct rb_node *);
+
+/* Traversal in key order. */
+struct rb_node *rb_first (const struct rbtree *);
+struct rb_node *rb_last (const struct rbtree *);
+struct rb_node *rb_next (const struct rb_node *);
+struct rb_node *rb_prev (const struct rb_node *);
+
+/* Returns the number of nodes in T. */
+static inline size_t
+rb_size (const struct rbtree *t) {
+	return t->cnt;
+}
+
+/* Returns true if T is empty. */
+static inline bool
+rb_empty (const struct rbtree *t) {
+	return t->root == NULL;
+}
+
+/* Interval tree.
+
+   A red-black tree of half-open ranges [START, END), ordered by
+   START, where each node also keeps the greatest END in its
+   subtree.  That finds the ranges overlapping a query range in
+   logarithmic time plus the number found. */
+
+/* Interval tree node. */
+struct itree_node {
+	struct rb_node rb;
+	uint64_t start, end;                /* Range [START, END). */
+	uint64_t max_end;                   /* Greatest END in subtree. */
+};
+
+/* Interval tree. */
+struct itree {
+	struct rbtree rb;
+};
+
+void itree_init (struct itree *);
+void itree_insert (struct itree *, struct itree_node *);
+void itree_remove (struct itree *, struct itree_node *);
+struct itree_node *itree_first (const struct itree *,
+                                uint64_t start, uint64_t end);
+struct itree_node *itree_next (const struct itree_node *,
+                               uint64_t start, uint64_t end);
+
+#endif /* lib/kernel/rbtree.h */
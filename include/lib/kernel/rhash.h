@@ -0,0 +1,96 @@
+#ifndef __LIB_KERNEL_RHASH_H
+#define __LIB_KERNEL_RHASH_H
+
+/* Open-addressing hash table.
+ *
+ * A companion to the chained table in hash.h for tables that are
+ * searched far more often than they change.  The table is one
+ * array of slots, each holding a pointer to an element and the
+ * element's full hash value.  A lookup probes consecutive slots,
+ * four to a cache line, and calls the equality function only on
+ * slots whose stored hash matches, so a miss usually touches no
+ * element at all.  Growing the table reuses the stored hashes
+ * instead of calling the hash function again.
+ *
+ * Collisions are resolved by Robin Hood hashing: an insertion
+ * that has probed further than a slot's resident takes the slot
+ * and carries the resident on.  That keeps probe lengths short
+ * and even, and lets a lookup stop as soon as it passes a
+ * resident that is closer to home than the key would be.
+ * Deletion shifts the following run back one slot, so there are
+ * no tombstones.
+ *
+ * Elements need no embedded member: the table stores pointers to
+ * them, and moving a slot moves only the pointer.  Lookups take
+ * a probe element with the key fields filled in, as hash_find()
+ * does.  Callers synchronize. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Computes and returns the hash value for element E, given
+ * auxiliary data AUX. */
+typedef uint64_t rhash_hash_func (const void *e, void *aux);
+
+/* Returns true if elements A and B have equal keys, given
+ * auxiliary data AUX. */
+typedef bool rhash_equal_func (const void *a, const void *b, void *aux);
+
+/* Performs some operation on element E, given auxiliary data
+ * AUX. */
+typedef void rhash_action_func (void *e, void *aux);
+
+/* One slot of a table. */
+struct rhash_slot {
+	uint64_t hash;              /* ELEM's hash value, if ELEM is non-null. */
+	void *elem;                 /* Element, or NULL if the slot is empty. */
+};
+
+/* Open-addressing hash table. */
+struct rhash {
+	size_t elem_cnt;            /* Number of elements in table. */
+	size_t slot_cnt;            /* Number of slots, a power of 2. */
+	struct rhash_slot *slots;   /* Array of `slot_cnt' slots. */
+	rhash_hash_func *hash;      /* Hash function. */
+	rhash_equal_func *equal;    /* Equality function. */
+	void *aux;                  /* Auxiliary data for `hash' and `equal'. */
+};
+
+/* A hash table iterator. */
+struct rhash_iterator {
+	struct rhash *rhash;        /* The hash table. */
+	size_t idx;                 /* Next slot to examine. */
+};
+
+/* Basic life cycle. */
+bool rhash_init (struct rhash *, rhash_hash_func *, rhash_equal_func *,
+		void *aux);
+void rhash_clear (struct rhash *, rhash_action_func *);
+void rhash_destroy (struct rhash *, rhash_action_func *);
+bool rhash_reserve (struct rhash *, size_t cnt);
+
+/* Search, insertion, deletion. */
+void *rhash_insert (struct rhash *, void *);
+void *rhash_replace (struct rhash *, void *);
+void *rhash_find (const struct rhash *, const void *);
+void *rhash_delete (struct rhash *, const void *);
+
+/* Iteration. */
+void rhash_apply (struct rhash *, rhash_action_func *);
+void rhash_first (struct rhash_iterator *, struct rhash *);
+void *rhash_next (struct rhash_iterator *);
+
+/* Returns the number of elements in R. */
+static inline size_t
+rhash_size (const struct rhash *r) {
+	return r->elem_cnt;
+}
+
+/* Returns true if R contains no elements, false otherwise. */
+static inline bool
+rhash_empty (const struct rhash *r) {
+	return r->elem_cnt == 0;
+}
+
+#endif /* lib/kernel/rhash.h */
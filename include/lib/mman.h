@@ -0,0 +1,22 @@
+#ifndef __LIB_MMAN_H
+#define __LIB_MMAN_H
+
+/* Flags for the WRITABLE argument of mmap().  Any other nonzero
+   value there is taken as MAP_WRITE, as it always was. */
+#define MAP_WRITE 0x1               /* Pages may be written. */
+#define MAP_POPULATE 0x100          /* Read the pages in right away. */
+
+/* How a process means to use a range, for madvise(). */
+#define MADV_NORMAL 0               /* No particular way. */
+#define MADV_RANDOM 1               /* In no order: do not read ahead. */
+#define MADV_SEQUENTIAL 2           /* Once, in order: read far ahead and
+                                       drop what is behind. */
+#define MADV_WILLNEED 3             /* Soon: read it in now. */
+#define MADV_DONTNEED 4             /* Not again: drop it now. */
+
+/* Longest name of a shared memory segment, for shm_open(), and
+   most segments that may exist at once. */
+#define SHM_NAME_MAX 31
+#define SHM_MAX 64
+
+#endif /* lib/mman.h */
@@ -2,9 +2,21 @@
 #define __LIB_RANDOM_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 void random_init (unsigned seed);
 void random_bytes (void *, size_t);
 unsigned long random_ulong (void);
 
+/* Fast generator state, for xoshiro256**.  Not shared: each user
+   of one keeps its own, so there is nothing to lock. */
+struct prng {
+	uint64_t s[4];
+};
+
+void prng_init (struct prng *, uint64_t seed);
+void prng_spawn (struct prng *);
+uint64_t prng_next (struct prng *);
+void prng_bytes (struct prng *, void *, size_t);
+
 #endif /* lib/random.h */
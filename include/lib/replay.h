@@ -0,0 +1,59 @@
+#ifndef __LIB_REPLAY_H
+#define __LIB_REPLAY_H
+
+#include <stdint.h>
+
+/* Workload replay traces.
+
+   A kernel run with "-trace=replay" records the file system and
+   memory mapping calls that user programs make into the trace
+   ring.  "pintos-trace --replay FILE" turns the dump into a
+   replay file, which tests/filesys/extended/replay issues again,
+   at the same times, under another kernel.
+
+   In the ring, each call is one "replay" record, whose A is
+   REPLAY_A (NR, TID), B the call's return value and C its first
+   argument.  REPLAY_MORE records follow with the remaining
+   arguments, two per record, and REPLAY_PATH records precede it
+   with up to 16 bytes each of the path named by its first
+   argument, which C then does not point to in any useful way.
+
+   The replay file is a struct replay_header followed by one
+   struct replay_rec per call, then its PATH_LEN bytes of path,
+   padded with null bytes to a multiple of 8. */
+
+#define REPLAY_MAGIC 0x59414c50         /* "PLAY". */
+#define REPLAY_VERSION 1
+
+/* Longest path a replay record carries. */
+#define REPLAY_PATH_MAX 63
+
+/* Pseudo call numbers of continuation records. */
+#define REPLAY_MORE 0xfe
+#define REPLAY_PATH 0xff
+
+/* A of a ring record for call NR by thread TID. */
+#define REPLAY_A(NR, TID) (((uint32_t) (TID) << 8) | ((NR) & 0xff))
+#define REPLAY_NR(A) ((A) & 0xff)
+#define REPLAY_TID(A) ((A) >> 8)
+
+/* Start of a replay file. */
+struct replay_header {
+	uint32_t magic;                     /* REPLAY_MAGIC. */
+	uint32_t version;                   /* REPLAY_VERSION. */
+	uint32_t rec_cnt;                   /* Records that follow. */
+	uint32_t pad;
+};
+
+/* One call in a replay file. */
+struct replay_rec {
+	uint64_t nsec;                      /* Since the first call. */
+	uint32_t nr;                        /* System call number. */
+	uint32_t tid;                       /* Traced caller. */
+	int64_t ret;                        /* Traced return value. */
+	int64_t args[5];
+	uint32_t path_len;                  /* Path bytes that follow. */
+	uint32_t pad;
+};
+
+#endif /* lib/replay.h */
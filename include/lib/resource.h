@@ -0,0 +1,26 @@
+#ifndef __LIB_RESOURCE_H
+#define __LIB_RESOURCE_H
+
+#include <stdint.h>
+
+/* What getrusage() reports about the calling process, all of its
+   threads together.  Times are in timer ticks, memory in pages. */
+struct rusage {
+	uint64_t ru_utime;          /* Ticks running user code. */
+	uint64_t ru_stime;          /* Ticks in the kernel on its behalf. */
+	uint64_t ru_rss;            /* Pages resident now. */
+	uint64_t ru_maxrss;         /* Most pages resident at once. */
+	uint64_t ru_minflt;         /* Page faults served from memory. */
+	uint64_t ru_majflt;         /* Page faults that read swap or a file. */
+	uint64_t ru_nswap;          /* Of those, pages read back from swap. */
+	uint64_t ru_nvcsw;          /* Voluntary context switches. */
+	uint64_t ru_nivcsw;         /* Involuntary context switches. */
+};
+
+/* Range of oom_adjust()'s adjustment, in thousandths of memory
+   added to the process's score when the kernel runs out.  A
+   process at OOM_SCORE_ADJ_MIN is never killed for memory. */
+#define OOM_SCORE_ADJ_MIN (-1000)
+#define OOM_SCORE_ADJ_MAX 1000
+
+#endif /* lib/resource.h */
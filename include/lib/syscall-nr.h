@@ -36,6 +36,77 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Futex-style user synchronization. */
+	SYS_FUTEX_WAIT,             /* Sleep while a word holds a value. */
+	SYS_FUTEX_WAKE,             /* Wake threads sleeping on a word. */
+
+	/* Process creation without fork. */
+	SYS_SPAWN,                  /* Start a program in a new process. */
+	SYS_WAIT_ANY,               /* Wait for whichever child dies first. */
+
+	/* Vectored I/O. */
+	SYS_READV,                  /* Read into several buffers. */
+	SYS_WRITEV,                 /* Write from several buffers. */
+
+	/* Positional I/O. */
+	SYS_PREAD,                  /* Read from a given offset. */
+	SYS_PWRITE,                 /* Write at a given offset. */
+
+	/* Batched I/O through shared rings. */
+	SYS_IO_RING_SETUP,          /* Register a submission/completion ring. */
+	SYS_IO_RING_ENTER,          /* Run queued submissions. */
+
+	/* In-kernel copying. */
+	SYS_COPY_FILE_RANGE,        /* Copy between descriptors. */
+
+	/* Memory use hints. */
+	SYS_MADVISE,                /* Advise how pages will be used. */
+
+	/* Durability. */
+	SYS_FSYNC,                  /* Write a file's data and inode to disk. */
+	SYS_FDATASYNC,              /* Write a file's data to disk. */
+
+	/* Directories. */
+	SYS_GETDENTS,               /* Read many directory entries. */
+
+	/* Space reservation. */
+	SYS_FALLOCATE,              /* Reserve a file's space up front. */
+
+	/* CPU placement. */
+	SYS_SCHED_SETAFFINITY,      /* Restrict the process to some CPUs. */
+	SYS_SCHED_GETAFFINITY,      /* Report the CPUs it may run on. */
+
+	/* Asynchronous I/O. */
+	SYS_AIO_READ,               /* Queue a read for kernel workers. */
+	SYS_AIO_WRITE,              /* Queue a write for kernel workers. */
+	SYS_AIO_WAIT,               /* Collect a finished request. */
+
+	/* Threads sharing an address space. */
+	SYS_THREAD_SPAWN,           /* Start a thread in this process. */
+	SYS_THREAD_JOIN,            /* Wait for one to exit. */
+	SYS_SET_TLS,                /* Set the thread's FS base. */
+
+	/* Accounting. */
+	SYS_GETRUSAGE,              /* Report the process's resource use. */
+	SYS_OOM_ADJUST,             /* Bias the process's OOM kill score. */
+
+	/* Shared memory. */
+	SYS_SHM_OPEN,               /* Find or create a named segment. */
+	SYS_SHM_MAP,                /* Map a segment into memory. */
+	SYS_SHM_UNMAP,              /* Remove a segment mapping. */
+	SYS_SHM_UNLINK,             /* Remove a segment's name. */
+
+	/* Pipes. */
+	SYS_PIPE,                   /* Create a pipe. */
+
+	/* Kernel counters. */
+	SYS_COUNTER_FIND,           /* Look a counter up by name. */
+	SYS_COUNTER_READ,           /* Read a counter's value. */
+	SYS_COUNTER_NAME,           /* Report a counter's name. */
+
+	/* Time. */
+	SYS_CLOCK_GETTIME_NS,       /* Read the monotonic clock. */
 };
 
 #endif /* lib/syscall-nr.h */
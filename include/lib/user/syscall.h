@@ -4,6 +4,10 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <ioring.h>
+#include <mman.h>
+#include <aio.h>
+#include <resource.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -38,7 +42,8 @@ void close (int fd);
 
 int dup2(int oldfd, int newfd);
 
-/* Project 3 and optionally project 4. */
+/* Project 3 and optionally project 4.  WRITABLE is a boolean, or
+   MAP_WRITE and MAP_POPULATE from <mman.h> or'ed together. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
 
@@ -50,6 +55,141 @@ bool isdir (int fd);
 int inumber (int fd);
 int symlink (const char* target, const char* linkpath);
 
+/* Futex-style synchronization. */
+int futex_wait (int *addr, int expected);
+int futex_wake (int *addr, int n);
+
+/* Starts FILE in a new process, without copying this one. */
+pid_t spawn (const char *file, char *const argv[]);
+
+/* Waits for the first child to exit and stores its status. */
+pid_t wait_any (int *status);
+
+/* One buffer of a readv() or writev(). */
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+
+/* Most buffers one readv() or writev() takes. */
+#define IOV_MAX 1024
+
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+
+/* Read and write at OFFSET, leaving the file position alone. */
+int pread (int fd, void *buffer, unsigned length, off_t offset);
+int pwrite (int fd, const void *buffer, unsigned length, off_t offset);
+
+/* Batched I/O: register RING, then queue operations in its
+   submission ring and run up to TO_SUBMIT of them with one
+   io_ring_enter(), which returns how many it ran. */
+int io_ring_setup (struct io_ring *ring);
+int io_ring_enter (unsigned to_submit);
+
+/* Copy LENGTH bytes from IN_FD's file to OUT_FD inside the kernel. */
+int copy_file_range (int in_fd, int out_fd, unsigned length);
+
+/* Write a file's cached data, and its inode, to disk. */
+int fsync (int fd);
+int fdatasync (int fd);
+
+/* Fill BUF with up to SIZE bytes of struct dirents, from <dirent.h>,
+   for the directory open as FD. */
+int getdents (int fd, void *buf, unsigned size);
+
+/* Reserve disk space for LEN bytes of FD's file from OFFSET on,
+   growing the file if they run past its end. */
+int fallocate (int fd, unsigned offset, unsigned len);
+
+/* Read from pages the kernel shares, without a system call.
+   clock_nsec() reads the same clock as clock_gettime_ns(). */
+int64_t clock_ticks (void);
+int64_t clock_nsec (void);
+pid_t getpid (void);
+
+/* Returns monotonic nanoseconds since the OS booted, from the TSC
+   once the kernel has calibrated it against the timer, or in
+   whole timer ticks before.  A system call each time. */
+int64_t clock_gettime_ns (void);
+
+/* Advise the kernel how pages will be used; ADVICE is a MADV_*. */
+int madvise (void *addr, size_t length, int advice);
+
+/* Run only on the CPUs in MASK, bit N for CPU N, or report them. */
+int sched_setaffinity (unsigned mask);
+unsigned sched_getaffinity (void);
+
+/* Asynchronous I/O: queue a pread() or pwrite() and return at
+   once.  *STATUS reads AIO_INPROGRESS until aio_wait (STATUS), or
+   any later aio call after the request finishes, stores its result
+   there; futex_wait() on STATUS also sees it.  aio_wait (NULL)
+   collects finished requests without waiting. */
+int aio_read (int fd, void *buffer, unsigned length, off_t offset,
+		int *status);
+int aio_write (int fd, const void *buffer, unsigned length, off_t offset,
+		int *status);
+int aio_wait (int *status);
+
+/* Threads: start ENTRY (AUX) in a new thread of this process, on
+   the stack whose top is STACK, with FS base TLS, sharing memory
+   and descriptors; it exits when ENTRY returns.  Only the caller
+   may thread_join() it, for its exit status.  exit() in such a
+   thread ends only that thread; in the first thread it ends the
+   process, whose other threads follow at their next system call.
+   By convention a TLS block's first word points to itself, so
+   that get_tls() can find it. */
+pid_t thread_spawn (void (*entry) (void *), void *aux, void *stack,
+		void *tls);
+int thread_join (pid_t tid);
+int set_tls (void *base);
+
+/* Accounting: fills *USAGE with this process's resource use so
+   far. */
+int getrusage (struct rusage *usage);
+
+/* Adds ADJ thousandths of memory to this process's score when the
+   kernel runs out, from OOM_SCORE_ADJ_MIN, never killed, up to
+   OOM_SCORE_ADJ_MAX.  Returns 0, or -1 if ADJ is out of range. */
+int oom_adjust (int adj);
+
+/* Shared memory: shm_open() returns the ID of the segment named
+   NAME, creating it with SIZE zeroed bytes if there is none, or -1.
+   shm_map() maps the whole segment at ADDR in this process, and
+   returns ADDR or NULL; every process mapping it sees the same
+   memory.  shm_unlink() removes the name.  A segment is freed once
+   it is neither named nor mapped. */
+int shm_open (const char *name, size_t size);
+void *shm_map (int id, void *addr, bool writable);
+int shm_unmap (void *addr);
+int shm_unlink (const char *name);
+
+/* Pipes: creates a pipe, and stores a descriptor for reading from
+   it in FDS[0] and one for writing to it in FDS[1].  read() waits
+   for data and returns 0 once every writer has closed; a write()
+   of up to PIPE_BUF (4096) bytes is never interleaved with another.
+   copy_file_range() moves data between a pipe and a file without a
+   user buffer.  Returns 0, or -1. */
+int pipe (int fds[2]);
+
+/* Kernel counters, as <counter.h> describes: counter_find()
+   returns the ID of the counter NAME, or -1; counter_read()
+   returns the value of counter ID, or -1 if there is none; and
+   counter_name() copies its name into BUF, truncated to SIZE bytes
+   with a null terminator, and returns its length, or -1.  IDs are
+   consecutive from 0, so counter_name() can list them. */
+int counter_find (const char *name);
+long long counter_read (int id);
+int counter_name (int id, char *buf, size_t size);
+
+static inline void *
+get_tls (void) {
+	void *tls;
+
+	asm volatile ("movq %%fs:0, %0" : "=r" (tls));
+	return tls;
+}
+
 static inline void* get_phys_addr (void *user_addr) {
 	void* pa;
 	asm volatile ("movq %0, %%rax" ::"r"(user_addr));
@@ -78,4 +218,25 @@ get_fs_disk_write_cnt (void) {
 	return write_cnt;
 }
 
+/* Reads WHAT of system call NR: 0 for calls made, 1 for TSC
+   cycles spent in them, 2 for the most one took. */
+static inline long long
+get_syscall_stat (int nr, int what) {
+	long long v;
+	asm volatile ("int $0x48" : "=a" (v)
+			: "a" ((long long) what), "d" ((long long) nr) : "memory");
+	return v;
+}
+
+/* Reads WHAT of disk DEV_NO on channel CHAN_NO, as the kernel's
+   int 0x49 handler documents; BUCKET selects a histogram bucket. */
+static inline long long
+get_disk_stat (int chan_no, int dev_no, int what, int bucket) {
+	long long v;
+	asm volatile ("int $0x49" : "=a" (v)
+			: "a" ((long long) what), "d" ((long long) chan_no),
+			  "c" ((long long) dev_no), "S" ((long long) bucket) : "memory");
+	return v;
+}
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,37 @@
+#ifndef __LIB_VDSO_H
+#define __LIB_VDSO_H
+
+#include <stdint.h>
+
+/* Pages the kernel maps read-only into every process, so that it
+   can read the time and its process ID without a system call.  The
+   first page, the same for all processes, holds the clock, which
+   the timer updates on every tick; the second holds the process's
+   own information.  They sit just above the initial stack, which
+   ends at USER_STACK in threads/vaddr.h. */
+#define VDSO_ADDR 0x47480000
+#define VDSO_PAGES 2
+#define VDSO_TIME_ADDR VDSO_ADDR                /* struct vdso_time. */
+#define VDSO_PROC_ADDR (VDSO_ADDR + 4096)       /* struct vdso_proc. */
+
+/* The clock, in the first page.  The kernel makes SEQ odd before
+   it changes the rest and even again after, so a reader copies the
+   fields between two reads of an even SEQ that match.  TSC_HZ is 0
+   until the TSC is calibrated, and the time then only advances by
+   whole ticks. */
+struct vdso_time {
+	uint32_t seq;               /* Update count; odd during one. */
+	uint32_t tick_freq;         /* Ticks per second. */
+	int64_t ticks;              /* Timer ticks since boot. */
+	uint64_t tsc_hz;            /* TSC cycles per second, or 0. */
+	uint64_t tsc_epoch;         /* TSC at nanosecond TSC_EPOCH_NS. */
+	int64_t tsc_epoch_ns;
+	uint64_t ns_per_cycle;      /* Nanoseconds per TSC cycle, 32.32. */
+};
+
+/* The process's information, in the second page. */
+struct vdso_proc {
+	int32_t pid;                /* Process ID. */
+};
+
+#endif /* lib/vdso.h */
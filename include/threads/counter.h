@@ -0,0 +1,28 @@
+#ifndef THREADS_COUNTER_H
+#define THREADS_COUNTER_H
+
+#include <counter.h>
+#include <stddef.h>
+
+/* Named kernel counters.
+
+   Subsystems register their statistics here by name, e.g.
+   "cache.hits", and user programs find them by name and read them
+   through the counter_find(), counter_read() and counter_name()
+   system calls, so that a new benchmark needs neither a new
+   interrupt vector nor a new system call.  <counter.h> defines the
+   version counter and the longest name.  IDs are handed out in
+   registration order and stay fixed until shutdown. */
+
+#define COUNTER_MAX 128         /* Most counters registered. */
+
+/* Returns the current value of a counter registered with AUX. */
+typedef long long counter_read_func (void *aux);
+
+int counter_register (const char *name, counter_read_func *, void *aux);
+int counter_register_value (const char *name, const long long *value);
+int counter_find (const char *name);
+long long counter_read (int id);
+const char *counter_name (int id);
+
+#endif /* threads/counter.h */
@@ -0,0 +1,109 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+/* Most CPUs brought up. */
+#define CPU_MAX 16
+
+/* Mask of every CPU, bit N for CPU N. */
+#define CPU_ALL ((1u << CPU_MAX) - 1)
+
+/* Physical address, below 1 MB and page-aligned, to which the
+   application processor startup code is copied. */
+#define AP_TRAMPOLINE 0x8000
+
+/* Offsets of struct cpu members used from assembly. */
+#define CPU_USER_RSP 8
+#define CPU_TSS 16
+
+#ifndef __ASSEMBLER__
+#include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+struct task_state;
+
+/* Per-CPU data.
+
+   Each CPU's IA32_GS_BASE points to its own struct cpu while it
+   runs in the kernel, so that %gs:0 is always the running CPU's
+   SELF.  Entries from user mode and the returns to it exchange
+   that with the user's GS base by `swapgs'. */
+struct cpu {
+	struct cpu *self;               /* This structure. */
+	uint64_t user_rsp;              /* Scratch for syscall_entry. */
+	struct task_state *tss;         /* TSS, if USERPROG. */
+	unsigned id;                    /* Index in cpus[], 0 for the BSP. */
+	uint32_t apic_id;               /* Local APIC ID. */
+	bool online;                    /* Brought up? */
+
+	struct thread *curr;            /* Running thread. */
+	struct thread *idle;            /* Idle thread, or NULL. */
+	long long idle_ticks;           /* # of timer ticks spent idle. */
+	long long kernel_ticks;         /* # of timer ticks in kernel threads. */
+	long long user_ticks;           /* # of timer ticks in user programs. */
+	uint64_t fs_base;               /* FS base loaded, if USERPROG. */
+	struct thread *fpu_owner;       /* Whose state the FPU holds, or NULL. */
+};
+
+extern struct cpu cpus[CPU_MAX];
+extern unsigned cpu_cnt;
+
+/* Bring up application processors?  Set by "-smp". */
+extern bool cpu_smp;
+
+/* Returns the running CPU's per-CPU data. */
+static inline struct cpu *
+this_cpu (void) {
+	struct cpu *c;
+
+	asm volatile ("movq %%gs:0, %0" : "=r" (c));
+	return c;
+}
+
+/* Per-CPU statistics counter.
+
+   Each CPU adds only to its own slot, which has a cache line to
+   itself, with a single unlocked instruction: that cannot be torn
+   by an interrupt on the same CPU, and no other CPU writes the
+   line, so a hot counter costs no more than `X++' and needs
+   neither atomics nor interrupts off.  A reader sums the slots.
+   A thread moved to another CPU between finding its slot and
+   adding to it may rarely lose a count, which statistics can
+   afford. */
+struct cpu_counter {
+	struct {
+		long long value;
+	} __attribute__ ((aligned (64))) slots[CPU_MAX];
+};
+
+/* Adds N to counter C on the running CPU. */
+static inline void
+cpu_counter_add (struct cpu_counter *c, long long n) {
+	long long *slot = &c->slots[this_cpu ()->id].value;
+
+	asm volatile ("addq %1, %0" : "+m" (*slot) : "er" (n));
+}
+
+/* Adds 1 to counter C on the running CPU. */
+static inline void
+cpu_counter_inc (struct cpu_counter *c) {
+	cpu_counter_add (c, 1);
+}
+
+/* Returns the sum of counter C over all CPUs. */
+static inline long long
+cpu_counter_read (const struct cpu_counter *c) {
+	long long sum = 0;
+	int i;
+
+	for (i = 0; i < CPU_MAX; i++)
+		sum += __atomic_load_n (&c->slots[i].value, __ATOMIC_RELAXED);
+	return sum;
+}
+
+void cpu_init (void);
+void cpu_start_aps (void);
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* threads/cpu.h */
@@ -1,6 +1,7 @@
 #ifndef THREADS_INTERRUPT_H
 #define THREADS_INTERRUPT_H
 
+#include <list.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -66,13 +67,31 @@ struct intr_frame {
 typedef void intr_handler_func (struct intr_frame *);
 
 void intr_init (void);
+void intr_init_ap (void);
 void intr_register_ext (uint8_t vec, intr_handler_func *, const char *name);
 void intr_register_int (uint8_t vec, int dpl, enum intr_level,
                         intr_handler_func *, const char *name);
+void intr_register_apic (uint8_t vec, intr_handler_func *, const char *name);
+void intr_mask_pic (void);
 bool intr_context (void);
+bool intr_from_user (void);
 void intr_yield_on_return (void);
 
+/* Deferred interrupt work, see interrupt.c. */
+typedef void softirq_func (void *aux);
+
+struct softirq {
+	struct list_elem elem;      /* Element in pending list. */
+	softirq_func *func;         /* Work to run. */
+	void *aux;                  /* Passed to FUNC. */
+	bool pending;               /* Queued to run? */
+};
+
+void softirq_init (struct softirq *, softirq_func *, void *aux);
+void softirq_raise (struct softirq *);
+
 void intr_dump_frame (const struct intr_frame *);
+void intr_print_stats (void);
 const char *intr_name (uint8_t vec);
 
 #endif /* threads/interrupt.h */
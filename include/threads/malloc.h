@@ -9,5 +9,15 @@ void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
+size_t malloc_bytes_held (void);
+size_t malloc_bytes_in_use (void);
+void malloc_print_stats (void);
+
+/* Slab caches of fixed-size objects. */
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+		size_t align, void (*ctor) (void *));
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
 
 #endif /* threads/malloc.h */
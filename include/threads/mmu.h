@@ -2,23 +2,55 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func (uint64_t *pte, void *va, void *aux);
 
+/* Collects TLB invalidations for one pml4 so that a bulk update
+   flushes once at the end.  Up to MMU_GATHER_MAX addresses are
+   invalidated one by one; past that the whole address space is
+   flushed.  Pages whose mappings were removed through a gather
+   must not be freed until mmu_gather_flush() returns. */
+#define MMU_GATHER_MAX 32
+
+struct mmu_gather {
+	uint64_t *pml4;                 /* Address space being changed. */
+	size_t cnt;                     /* Queued addresses, or more. */
+	uint64_t va[MMU_GATHER_MAX];    /* Queued addresses. */
+};
+
+void mmu_gather_init (struct mmu_gather *, uint64_t *pml4);
+void mmu_gather_add (struct mmu_gather *, const void *va);
+void mmu_gather_add_range (struct mmu_gather *, const void *va,
+		size_t page_cnt);
+void mmu_gather_flush (struct mmu_gather *);
+
 uint64_t *pml4e_walk (uint64_t *pml4, const uint64_t va, int create);
+uint64_t *pml4_pde_walk (uint64_t *pml4, const uint64_t va, int create);
 uint64_t *pml4_create (void);
 bool pml4_for_each (uint64_t *, pte_for_each_func *, void *);
 void pml4_destroy (uint64_t *pml4);
 void pml4_activate (uint64_t *pml4);
+void pml4_init_pcid (void);
+void pml4_init_shootdown (void);
+void mmu_print_stats (void);
 void *pml4_get_page (uint64_t *pml4, const void *upage);
 bool pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
 void pml4_clear_page (uint64_t *pml4, void *upage);
 bool pml4_is_dirty (uint64_t *pml4, const void *upage);
 void pml4_set_dirty (uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed (uint64_t *pml4, const void *upage);
 void pml4_set_accessed (uint64_t *pml4, const void *upage, bool accessed);
+void pml4_clear_page_gather (struct mmu_gather *, void *upage);
+void pml4_set_dirty_gather (struct mmu_gather *, const void *upage,
+		bool dirty);
+void pml4_set_accessed_gather (struct mmu_gather *, const void *upage,
+		bool accessed);
+void pml4_set_writable_gather (struct mmu_gather *, const void *upage,
+		bool writable);
 
 #define is_writable(pte) (*(pte) & PTE_W)
 #define is_user_pte(pte) (*(pte) & PTE_U)
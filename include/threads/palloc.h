@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -14,10 +15,27 @@ enum palloc_flags {
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
+/* Use the buddy allocator backend? */
+extern bool palloc_buddy;
+
+/* Longest run a failed request wanted from the user pool. */
+extern size_t palloc_wanted_run;
+
+struct bitmap;
+
 uint64_t palloc_init (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_aligned (enum palloc_flags, size_t page_cnt, size_t align);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_grow_multiple (void *, size_t page_cnt, size_t new_cnt);
+size_t palloc_available (enum palloc_flags);
+bool palloc_user_bounds (uint64_t *lo, uint64_t *hi);
+size_t palloc_used_in (void *pages, size_t page_cnt);
+size_t palloc_claim_free (void *pages, size_t page_cnt, struct bitmap *owned);
+bool palloc_idle_zero (void);
+void palloc_register_inspect (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,31 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+
+struct intr_frame;
+
+/* Sampling profiler.
+
+   With "-profile", every Nth timer interrupt counts the address
+   it interrupted, kernel or user, in a table of per-address
+   sample counts.  The most-sampled addresses are dumped to the
+   console at power off, for utils/pintos-profile to turn into a
+   flat profile by function. */
+
+/* Sampling enabled? */
+extern bool profile_enabled;
+
+void profile_init (int interval);
+void profile_sample (const struct intr_frame *);
+void profile_dump (void);
+
+/* Takes a sample from F, the timer interrupt's frame, if
+   profiling. */
+static inline void
+profile_tick (const struct intr_frame *f) {
+	if (__builtin_expect (profile_enabled, 0))
+		profile_sample (f);
+}
+
+#endif /* threads/profile.h */
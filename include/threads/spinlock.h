@@ -0,0 +1,100 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+
+/* Ticket spinlock.
+
+   For short critical sections over data that CPUs share, where
+   sleeping on a struct lock would cost more than the section
+   itself.  Each CPU that wants the lock takes the next ticket and
+   spins, reading only the lock's own cache line, until OWNER
+   reaches it, so CPUs get the lock in the order they asked and
+   none starves.
+
+   A spinlock does not keep out interrupt handlers on the holder's
+   own CPU, and a handler that spins on a lock its CPU holds never
+   returns.  Take a spinlock that an interrupt handler also takes,
+   or that is held across code that assumes interrupts are off,
+   with spin_lock_irqsave().  Never sleep or yield while holding a
+   spinlock. */
+struct spinlock {
+	uint32_t next;              /* Next ticket to hand out. */
+	uint32_t owner;             /* Ticket holding the lock. */
+	int cpu;                    /* Holding CPU's id, or -1. */
+};
+
+/* Initializer for a static spinlock. */
+#define SPINLOCK_INITIALIZER { 0, 0, -1 }
+
+static inline void
+spin_lock_init (struct spinlock *s) {
+	s->next = s->owner = 0;
+	s->cpu = -1;
+}
+
+/* Returns true if the running CPU holds S. */
+static inline bool
+spin_held (const struct spinlock *s) {
+	return __atomic_load_n (&s->cpu, __ATOMIC_RELAXED)
+		== (int) this_cpu ()->id;
+}
+
+/* Acquires S, spinning until it is free. */
+static inline void
+spin_lock (struct spinlock *s) {
+	uint32_t ticket;
+
+	ASSERT (!spin_held (s));
+
+	ticket = __atomic_fetch_add (&s->next, 1, __ATOMIC_RELAXED);
+	while (__atomic_load_n (&s->owner, __ATOMIC_ACQUIRE) != ticket)
+		asm volatile ("pause" : : : "memory");
+	s->cpu = this_cpu ()->id;
+}
+
+/* Acquires S if it is free, without spinning.  Returns true if
+   successful. */
+static inline bool
+spin_trylock (struct spinlock *s) {
+	uint32_t owner = __atomic_load_n (&s->owner, __ATOMIC_RELAXED);
+	uint32_t ticket = owner;
+
+	if (!__atomic_compare_exchange_n (&s->next, &ticket, owner + 1, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return false;
+	s->cpu = this_cpu ()->id;
+	return true;
+}
+
+/* Releases S, which the running CPU must hold. */
+static inline void
+spin_unlock (struct spinlock *s) {
+	ASSERT (spin_held (s));
+
+	s->cpu = -1;
+	__atomic_store_n (&s->owner, s->owner + 1, __ATOMIC_RELEASE);
+}
+
+/* Disables interrupts, acquires S, and returns the previous
+   interrupt level for spin_unlock_irqrestore(). */
+static inline enum intr_level
+spin_lock_irqsave (struct spinlock *s) {
+	enum intr_level old_level = intr_disable ();
+
+	spin_lock (s);
+	return old_level;
+}
+
+/* Releases S and returns interrupts to OLD_LEVEL. */
+static inline void
+spin_unlock_irqrestore (struct spinlock *s, enum intr_level old_level) {
+	spin_unlock (s);
+	intr_set_level (old_level);
+}
+
+#endif /* threads/spinlock.h */
@@ -0,0 +1,18 @@
+#ifndef THREADS_SWITCH_H
+#define THREADS_SWITCH_H
+
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* Kernel-to-kernel thread switch.
+ *
+ * Saves the callee-saved registers on the current stack and the
+ * stack pointer in *SAVE_RSP.  Then, if LOAD_RSP is nonzero,
+ * resumes the thread whose stack pointer was saved as LOAD_RSP by
+ * an earlier call; otherwise launches a thread that has never run
+ * by passing FRAME to do_iret().  Returns when some other thread
+ * switches back to the caller.  Interrupts must be off. */
+void switch_threads (uint64_t *save_rsp, uint64_t load_rsp,
+		struct intr_frame *frame);
+
+#endif /* threads/switch.h */
@@ -1,13 +1,16 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "threads/spinlock.h"
 
 /* A counting semaphore. */
 struct semaphore {
-	unsigned value;             /* Current value. */
-	struct list waiters;        /* List of waiting threads. */
+	unsigned value;             /* Current value; see synch.c. */
+	struct clist waiters;       /* Waiting threads, by priority. */
 };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -15,18 +18,56 @@ void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
+void synch_print_stats (void);
+void lock_print_stats (void);
+void lock_register_counters (void);
 
 /* Lock. */
+struct lock_class;
 struct lock {
 	struct thread *holder;      /* Thread holding lock (for debugging). */
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
+	struct heap donors;         /* Waiting threads, by priority. */
+	bool attached;              /* In the holder's held_locks? */
+	int donated;                /* Top donor's priority, as keyed in
+	                               the holder's held_locks. */
+	struct heap_elem held_elem; /* Element in holder's held_locks. */
+	struct lock_class *class;   /* Statistics, or NULL. */
+	uint64_t acquired;          /* TSC when acquired, if CLASS. */
 };
 
-void lock_init (struct lock *);
+/* Keep lock statistics?  Set by "-lockstat".  Locks initialized
+   with the same name, which lock_init() makes from the source file
+   and argument, share statistics, so that all the locks of one
+   kind add up. */
+extern bool lock_stat;
+
+#define lock_init(LOCK) lock_init_named ((LOCK), __FILE__ ": " #LOCK)
+void lock_init_named (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+int lock_max_donation (const struct thread *);
+
+/* Reader-writer lock.  Writers are preferred: once a writer
+   holds GATE, arriving readers queue behind it.  Readers and
+   writers waiting for GATE donate to the writer holding it and
+   are woken in priority order. */
+struct rwlock {
+	struct lock gate;           /* Held by a writer, or an entering reader. */
+	unsigned readers;           /* Number of readers holding the lock. */
+	bool writer_waiting;        /* A writer waits on DRAINED. */
+	struct semaphore drained;   /* Upped when the last reader leaves. */
+};
+
+#define rwlock_init(RW) rwlock_init_named ((RW), __FILE__ ": " #RW)
+void rwlock_init_named (struct rwlock *, const char *name);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
 
 /* Condition variable. */
 struct condition {
@@ -38,6 +79,33 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Wait queue: threads sleeping until an event, woken by other
+   threads or by interrupt handlers.  The caller keeps whatever
+   state says the event has happened and checks it with interrupts
+   off before waiting. */
+struct wait_queue {
+	struct list waiters;        /* List of struct wait_queue_entry. */
+};
+
+void wait_queue_init (struct wait_queue *);
+bool wait_queue_wait (struct wait_queue *, int64_t timeout);
+bool wait_queue_wake_one (struct wait_queue *);
+int wait_queue_wake_all (struct wait_queue *);
+
+/* Completion: a one-shot or counted event, such as "the disk has
+   raised its interrupt".  Interrupt handlers may complete it;
+   threads wait for it, optionally with a timeout in ticks. */
+struct completion {
+	unsigned done;              /* Completions not yet consumed. */
+	struct wait_queue wq;       /* Threads waiting for DONE > 0. */
+};
+
+void completion_init (struct completion *);
+void complete (struct completion *);
+void complete_all (struct completion *);
+void wait_for_completion (struct completion *);
+bool wait_for_completion_timeout (struct completion *, int64_t ticks);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
@@ -2,7 +2,12 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <fixed-point.h>
+#include <hash.h>
+#include <heap.h>
+#include <histogram.h>
 #include <list.h>
+#include <random.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
 #ifdef VM
@@ -28,6 +33,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the MLFQS. */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
  *
  * Each thread structure is stored in its own 4 kB page.  The
@@ -90,14 +100,73 @@ struct thread {
 	tid_t tid;                          /* Thread identifier. */
 	enum thread_status status;          /* Thread state. */
 	char name[16];                      /* Name (for debugging purposes). */
-	int priority;                       /* Priority. */
+	struct hash_elem registry_elem;     /* Element in thread registry. */
+	int priority;                       /* Effective priority. */
+	int base_priority;                  /* Priority before donation. */
+	int preempt_count;                  /* preempt_disable() nesting. */
+	bool resched_pending;               /* Preemption deferred? */
+	unsigned cpu;                       /* CPU whose run queue it joins. */
+	uint32_t affinity;                  /* CPUs it may run on, bit N for N. */
+	int64_t dl_runtime;                 /* Deadline: ticks per period... */
+	int64_t dl_period;                  /* ...period in ticks, or 0... */
+	int64_t dl_deadline;                /* ...end of the current period... */
+	int64_t dl_budget;                  /* ...and ticks left in it. */
+	bool dl_throttled;                  /* Budget spent before DL_DEADLINE? */
+	struct prng prng;                   /* For thread_random(). */
+
+	/* Priority donation, owned by threads/synch.c. */
+	struct lock *wait_on_lock;          /* Lock being waited for. */
+	struct semaphore *wait_on_sema;     /* Semaphore slept on, if any. */
+	struct heap held_locks;             /* Held locks, by donation. */
+	struct heap_elem donor_elem;        /* Element in lock's donors. */
+
+	int nice;                           /* MLFQS niceness. */
+	fixed_t recent_cpu;                 /* MLFQS recent CPU usage. */
+	int64_t decay_epoch;                /* MLFQS second last decayed at. */
 
 	/* Shared between thread.c and synch.c. */
 	struct list_elem elem;              /* List element. */
 
+	/* Owned by devices/timer.c. */
+	int64_t wakeup_tick;                /* Earliest tick to wake up at... */
+	int64_t wakeup_deadline;            /* ...and latest, if sleeping. */
+	size_t sleep_idx;                   /* Slot in the sleep queue. */
+	uint64_t wakeup_tsc;                /* TSC deadline of timer_nsleep()... */
+	struct heap_elem hr_elem;           /* ...and element in its heap. */
+
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
+	int exit_status;                    /* Passed to exit(), else -1. */
+	struct child *child;                /* What the creator waits on. */
+	struct children *children;          /* Unwaited children, or NULL. */
+	struct fd_table *fds;               /* Open files by fd, or NULL. */
+	struct io_ring *ring;               /* User's io_ring_setup() ring. */
+	struct aio_context *aio;            /* aio requests in flight, or NULL. */
+	uint64_t fs_base;                   /* User FS base, for thread-local
+	                                       storage. */
+	void *fpu;                          /* FXSAVE area, once the FPU is
+	                                       used; see exception.c. */
+	struct intr_frame *syscall_if;      /* User registers of a system call
+	                                       on the full path; see
+	                                       syscall.c. */
+	struct thread *leader;              /* Thread whose address space and
+	                                       descriptors this one shares, if
+	                                       started by thread_spawn(). */
+	unsigned members;                   /* As a leader: threads sharing. */
+	bool group_exit;                    /* As a leader: has exited. */
+	bool killed;                        /* As a leader: to be killed by
+	                                       the kernel; see process_kill(). */
+	bool reap_pending;                  /* As a leader: dead, left for the
+	                                       last member to reap. */
+	long long exited_user_ticks;        /* As a leader: totals of the */
+	long long exited_kernel_ticks;      /* members that have exited, */
+	long long exited_voluntary;         /* for getrusage(). */
+	long long exited_involuntary;
+#endif
+#ifdef FILESYS
+	/* Owned by filesys/journal.c. */
+	int journal_depth;                  /* Nesting of journal_begin(). */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
@@ -105,7 +174,17 @@ struct thread {
 #endif
 
 	/* Owned by thread.c. */
-	struct intr_frame tf;               /* Information for switching */
+	uint64_t ready_stamp;               /* TSC when woken, 0 if not woken. */
+	uint64_t run_stamp;                 /* TSC when last switched in. */
+	uint64_t cpu_cycles;                /* TSC cycles run, up to RUN_STAMP. */
+	uint32_t voluntary_switches;        /* # of times blocked or yielded. */
+	uint32_t involuntary_switches;      /* # of times preempted. */
+	long long user_ticks;               /* Timer ticks in user code... */
+	long long kernel_ticks;             /* ...and in the kernel. */
+	struct histogram wakeup_latency;    /* Cycles from wakeup to running. */
+	struct intr_frame tf;               /* Information for first launch. */
+	uint64_t switch_rsp;                /* Saved by switch_threads(), or 0
+	                                       if never run. */
 	unsigned magic;                     /* Detects stack overflow. */
 };
 
@@ -114,10 +193,33 @@ struct thread {
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, use a plain FIFO round-robin scheduler that ignores
+   priorities.  Controlled by kernel command-line option "-rr". */
+extern bool thread_rr;
+
+/* If nonzero, the idle thread polls for up to this many
+   microseconds before halting.  Controlled by kernel command-line
+   option "-idle-poll". */
+extern unsigned thread_idle_poll_us;
+
+#ifdef USERPROG
+/* Returns the thread that owns T's address space, supplemental
+   page table and descriptors: T's leader if T was started by
+   thread_spawn(), otherwise T itself. */
+static inline struct thread *
+thread_leader (struct thread *t) {
+	return t->leader != NULL ? t->leader : t;
+}
+#endif
+
+/* Performs some operation on thread t, given auxiliary data AUX. */
+typedef void thread_action_func (struct thread *t, void *aux);
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_set_time_slices (int high, int low);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -128,13 +230,33 @@ void thread_unblock (struct thread *);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
+uint64_t thread_random (void);
+struct thread *thread_lookup (tid_t);
+uint64_t thread_cpu_cycles (const struct thread *);
 const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
+void thread_release (struct thread *);
+void thread_foreach (thread_action_func *, void *aux);
 void thread_yield (void);
+void thread_preempt (void);
+void thread_preempt_if_outranked (void);
+void thread_defer_preempt (void);
+bool thread_resched_pending (void);
+bool thread_outranks (const struct thread *, const struct thread *);
+
+void preempt_disable (void);
+void preempt_enable (void);
+void cond_resched (void);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_change_priority (struct thread *, int priority);
+
+bool thread_set_deadline (int64_t runtime, int64_t period);
+
+bool thread_set_affinity (struct thread *, uint32_t mask);
+uint32_t thread_get_affinity (const struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
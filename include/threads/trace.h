@@ -0,0 +1,47 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdint.h>
+
+/* Kernel event tracing.
+
+   Tracepoints append fixed-size binary records to a ring in
+   memory, so tracing costs a few stores per event instead of the
+   milliseconds a printf() spends on the serial port.  When the
+   ring wraps, the oldest records are overwritten.  "-trace"
+   allocates the ring and picks the events to record, which user
+   programs can change through int 0x4a; the ring is dumped to the
+   console at power off, for utils/pintos-trace to decode. */
+
+/* Traced events, with the meaning of each record's A, B and C. */
+enum trace_event {
+	TRACE_SWITCH,           /* Next tid, previous tid, its status. */
+	TRACE_INTR,             /* Vector, interrupted RIP, 0. */
+	TRACE_FAULT,            /* Error code, fault address, RIP. */
+	TRACE_DISK_READ,        /* Disk, first sector, sector count. */
+	TRACE_DISK_WRITE,       /* Disk, first sector, sector count. */
+	TRACE_DISK_DONE,        /* Disk, first sector, latency cycles. */
+	TRACE_SYSCALL,          /* Number, return value, cycles, at exit. */
+	TRACE_REPLAY,           /* Call to replay; see lib/replay.h. */
+	TRACE_EVENT_CNT
+};
+
+/* Bit for EVENT in trace_mask. */
+#define TRACE_BIT(EVENT) (1u << (EVENT))
+
+/* Events being recorded.  Nonzero only once the ring exists. */
+extern uint32_t trace_mask;
+
+uint32_t trace_parse (char *events);
+void trace_init (uint32_t mask);
+void trace_record (enum trace_event, uint32_t a, uint64_t b, uint64_t c);
+void trace_dump (void);
+
+/* Records EVENT with arguments A, B and C, if it is enabled. */
+static inline void
+trace (enum trace_event event, uint32_t a, uint64_t b, uint64_t c) {
+	if (__builtin_expect (trace_mask & TRACE_BIT (event), 0))
+		trace_record (event, a, b, c);
+}
+
+#endif /* threads/trace.h */
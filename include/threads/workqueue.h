@@ -0,0 +1,80 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+/* Workqueues.
+
+   A workqueue runs functions on behalf of other code in a pool of
+   kernel threads, so that a subsystem can hand work off without
+   starting and managing threads of its own.  The pool starts with
+   one worker and grows, up to a limit, when work waits with no
+   worker free to take it; a worker left idle for a while exits,
+   down to the last one.
+
+   Work may be queued from kernel threads or from interrupt
+   handlers.  Disabling interrupts serves as the monitor lock, as
+   for struct completion. */
+
+typedef void work_func (void *aux);
+
+/* State of a struct work. */
+enum work_state {
+	WORK_IDLE,                  /* On no queue. */
+	WORK_PENDING,               /* Waiting for a worker. */
+	WORK_DELAYED                /* Waiting for its due tick. */
+};
+
+/* A piece of work, usually embedded in the structure it works on.
+   It may be queued again once a worker has taken it, even by its
+   own function. */
+struct work {
+	struct list_elem elem;      /* In the queue's PENDING or DELAYED. */
+	work_func *func;            /* Function to run... */
+	void *aux;                  /* ...and its argument. */
+	struct workqueue *wq;       /* Queue last queued on, or NULL. */
+	enum work_state state;
+	int64_t due;                /* Tick to run at, if WORK_DELAYED. */
+	bool oneshot;               /* Freed once taken, for queue_work(). */
+};
+
+/* A workqueue. */
+struct workqueue {
+	const char *name;           /* Name, for threads and statistics. */
+	int priority;               /* Priority of its workers. */
+	unsigned max_workers;       /* Most workers. */
+	struct list_elem elem;      /* In the list of all workqueues. */
+
+	struct list pending;        /* Work to run, first in first out. */
+	struct list delayed;        /* Delayed work, by due tick. */
+	struct list busy;           /* Works being run, see workqueue.c. */
+	unsigned workers;           /* Worker threads, starting or started. */
+	unsigned idle;              /* Workers waiting on MORE. */
+	struct wait_queue more;     /* Idle workers. */
+	struct wait_queue done;     /* Threads awaiting a work's end. */
+
+	/* Statistics. */
+	long long ran;              /* Works run. */
+	long long delays;           /* Works queued with a delay. */
+	unsigned peak_workers;      /* Most workers at once. */
+};
+
+/* Shared queue for work with no other home. */
+extern struct workqueue system_wq;
+
+void workqueue_init (void);
+void workqueue_create (struct workqueue *, const char *name, int priority,
+		unsigned max_workers);
+void workqueue_print_stats (void);
+
+void work_init (struct work *, work_func *, void *aux);
+bool queue_work (struct workqueue *, work_func *, void *aux);
+bool queue_work_item (struct workqueue *, struct work *);
+bool queue_delayed_work (struct workqueue *, struct work *, int64_t ticks);
+bool cancel_work (struct work *);
+void flush_workqueue (struct workqueue *);
+
+#endif /* threads/workqueue.h */
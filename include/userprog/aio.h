@@ -0,0 +1,14 @@
+#ifndef USERPROG_AIO_H
+#define USERPROG_AIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+void aio_init (void);
+int aio_submit (int fd, void *ubuf, size_t size, off_t ofs, int *ustatus,
+		bool write);
+int aio_wait (int *ustatus);
+void aio_exit (void);
+
+#endif /* userprog/aio.h */
@@ -6,7 +6,11 @@
 #define PF_W 0x2    /* 0: read, 1: write. */
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
 
+struct thread;
+
 void exception_init (void);
 void exception_print_stats (void);
+void fpu_switch (struct thread *next);
+void fpu_release (struct thread *);
 
 #endif /* userprog/exception.h */
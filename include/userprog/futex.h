@@ -0,0 +1,13 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+#include <stdint.h>
+
+void futex_init (void);
+int futex_wait (uint32_t *uaddr, uint32_t expected);
+int futex_wake (uint32_t *uaddr, int n);
+void futex_freeze (void);
+void futex_thaw (void);
+void futex_rekey (uint64_t old_pa, uint64_t new_pa);
+
+#endif /* userprog/futex.h */
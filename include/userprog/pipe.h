@@ -0,0 +1,18 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct pipe_end;
+
+bool pipe_create (struct pipe_end **read_end, struct pipe_end **write_end);
+struct pipe_end *pipe_end_dup (struct pipe_end *);
+void pipe_end_close (struct pipe_end *);
+int64_t pipe_read (struct pipe_end *, void *buf, size_t size, bool user,
+		bool wait);
+int64_t pipe_write (struct pipe_end *, const void *buf, size_t size,
+		bool user);
+
+#endif /* userprog/pipe.h */
@@ -5,9 +5,55 @@
 
 tid_t process_create_initd (const char *file_name);
 tid_t process_fork (const char *name, struct intr_frame *if_);
+tid_t process_spawn (const char *file, char *const argv[]);
 int process_exec (void *f_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
+void process_setup (void);
+bool process_track (struct thread *);
+bool process_reap (struct thread *);
+tid_t process_thread_spawn (uint64_t entry, uint64_t arg0, uint64_t arg1,
+		uint64_t stack, uint64_t tls);
+bool process_group_exiting (void);
+void process_kill (struct thread *leader);
+bool process_set_tls (uint64_t tls);
+struct rusage;
+void process_getrusage (struct rusage *);
+
+/* A process starts with the console in descriptors 0 and 1, which
+   it may close or duplicate like files.  The descriptors it has
+   open are all below FD_MAX. */
+#define FD_MAX 8192
+
+/* What a console descriptor holds in place of a file. */
+#define FD_CONSOLE_IN ((struct file *) 1)
+#define FD_CONSOLE_OUT ((struct file *) 2)
+#define fd_is_console(FILE) \
+	((FILE) == FD_CONSOLE_IN || (FILE) == FD_CONSOLE_OUT)
+
+/* What a pipe descriptor holds: its struct pipe_end, tagged in the
+   low bit, which no file's address has. */
+#define FD_PIPE_TAG 1
+#define fd_is_pipe(FILE) \
+	((uintptr_t) (FILE) > (uintptr_t) FD_CONSOLE_OUT \
+	 && ((uintptr_t) (FILE) & FD_PIPE_TAG) != 0)
+#define fd_to_pipe(FILE) \
+	((struct pipe_end *) ((uintptr_t) (FILE) & ~(uintptr_t) FD_PIPE_TAG))
+#define pipe_to_fd(END) ((struct file *) ((uintptr_t) (END) | FD_PIPE_TAG))
+
+/* Does a descriptor holding FILE refer to an open file? */
+#define fd_is_file(FILE) \
+	((FILE) != NULL && !fd_is_console (FILE) && !fd_is_pipe (FILE))
+
+struct file;
+struct file *process_fd_dup (struct file *);
+void process_fd_close (struct file *);
+int process_fd_add (struct file *);
+bool process_fd_install (int fd, struct file *, struct file **old);
+struct file *process_fd_get (int fd);
+struct file *process_fd_remove (int fd);
+bool process_fd_fork (struct thread *parent);
+tid_t process_wait_any (int *status);
 
 #endif /* userprog/process.h */
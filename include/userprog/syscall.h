@@ -1,6 +1,11 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+
+extern bool syscall_stat;
+
 void syscall_init (void);
+void syscall_print_stats (void);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,17 @@
+#ifndef USERPROG_VDSO_H
+#define USERPROG_VDSO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <vdso.h>
+#include "threads/vaddr.h"
+
+void vdso_init (void);
+bool vdso_map (uint64_t *pml4, int pid);
+void vdso_unmap (uint64_t *pml4);
+
+/* True if user address VA is in the pages vdso_map() adds. */
+#define is_vdso_vaddr(VA) \
+	((uint64_t) (VA) - VDSO_ADDR < (uint64_t) VDSO_PAGES * PGSIZE)
+
+#endif /* userprog/vdso.h */
@@ -1,13 +1,20 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
 #include "vm/vm.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
 struct page;
 enum vm_type;
 
 struct anon_page {
+	swap_slot_t slot;           /* Swap slot, or SWAP_SLOT_NONE. */
+	struct zswap_entry *zswap;  /* Compressed copy, or NULL. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+size_t anon_swap_out_cluster (struct page *pages[], size_t cnt);
+bool anon_is_swapped (const struct page *);
+void anon_read_swapped (const struct page *, void *kva);
 
 #endif
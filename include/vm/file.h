@@ -5,13 +5,63 @@
 
 struct page;
 enum vm_type;
+struct supplemental_page_table;
+
+/* Marks an uninit anonymous page whose aux is a struct
+ * mmap_region it holds a reference to.  Uninit file pages always
+ * have one. */
+#define VM_REGION VM_MARKER_1
+#define VM_HAS_REGION(type) \
+	(VM_TYPE (type) == VM_FILE || ((type) & VM_REGION) != 0)
+
+/* One mmap() mapping or executable segment, shared by its pages
+ * and, after fork, by the child's copies of them. */
+struct mmap_region {
+	struct file *file;          /* Own handle, from file_reopen(). */
+	void *addr;                 /* First mapped page. */
+	size_t length;              /* Bytes mapped. */
+	off_t offset;               /* File offset of ADDR. */
+	size_t file_bytes;          /* Bytes of the mapping inside the file. */
+	unsigned refs;              /* Pages holding the region. */
+	bool exec;                  /* Executable segment, not mmap(). */
+	int advice;                 /* MADV_* for the whole region. */
+};
+
+/* Identifies the contents of a read-only executable page, for the
+ * text cache: BYTES bytes of INODE at OFS, then zeros. */
+struct text_key {
+	struct inode *inode;
+	off_t ofs;
+	size_t bytes;
+};
 
 struct file_page {
+	struct mmap_region *region; /* Mapping the page belongs to. */
+};
+
+/* One process's mmap() of a region, in its SPT's MAPPINGS.  A
+ * forked child gets its own, for the same region. */
+struct mmap_mapping {
+	struct itree_node node;     /* Covers the region's pages. */
+	struct mmap_region *region;
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+struct mmap_region *mmap_region_create (struct file *, void *addr,
+		size_t length, off_t offset, size_t file_bytes);
+void mmap_region_get (struct mmap_region *);
+void mmap_region_put (struct mmap_region *);
+bool mmap_region_map (struct mmap_region *, void *upage, bool writable);
+bool mmap_region_read (struct mmap_region *, const void *upage, void *kva);
+bool file_text_key (struct page *, struct text_key *);
+bool file_cache_key (struct page *, struct inode **, off_t *ofs);
+struct mmap_region *page_region (struct page *);
+int page_advice (struct page *);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+bool mmap_mappings_copy (struct supplemental_page_table *dst,
+		const struct supplemental_page_table *src);
+void mmap_mappings_destroy (struct supplemental_page_table *);
 #endif
@@ -0,0 +1,25 @@
+#ifndef VM_OOM_H
+#define VM_OOM_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct supplemental_page_table;
+
+/* Policies for vm_overcommit, numbered as in Linux. */
+enum overcommit_policy {
+	OVERCOMMIT_GUESS,           /* Refuse only the hopeless. */
+	OVERCOMMIT_ALWAYS,          /* Refuse nothing. */
+	OVERCOMMIT_NEVER            /* Refuse past the commit limit. */
+};
+
+extern int vm_overcommit;
+extern unsigned vm_overcommit_ratio;
+
+void vm_oom_init (void);
+bool vm_commit (struct supplemental_page_table *, size_t cnt);
+void vm_uncommit (struct supplemental_page_table *, size_t cnt);
+bool vm_oom (void);
+bool vm_oom_adjust (int adj);
+void vm_oom_print_stats (void);
+
+#endif /* vm/oom.h */
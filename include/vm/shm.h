@@ -0,0 +1,27 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct page;
+struct shm_segment;
+enum vm_type;
+
+/* A page of a shared memory segment mapped by a process. */
+struct shm_page {
+	struct shm_segment *seg;    /* Segment, referenced by the page. */
+	size_t idx;                 /* Page number within SEG. */
+};
+
+void vm_shm_init (void);
+bool shm_initializer (struct page *, enum vm_type, void *kva);
+int shm_open (const char *name, size_t size);
+void *shm_map (int id, void *addr, bool writable);
+bool shm_unmap (void *addr);
+bool shm_unlink (const char *name);
+bool shm_claim (struct page *);
+void shm_page_dup (struct page *);
+bool shm_reclaim (void);
+void shm_print_stats (void);
+
+#endif /* vm/shm.h */
@@ -0,0 +1,29 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct disk;
+struct page;
+
+/* A page-sized slot on the swap disk. */
+typedef size_t swap_slot_t;
+
+/* Returned by swap_alloc() when no run of slots is free. */
+#define SWAP_SLOT_NONE ((swap_slot_t) -1)
+
+/* Most pages one swap_write_run() writes. */
+#define SWAP_CLUSTER 8
+
+void swap_init (struct disk *);
+swap_slot_t swap_alloc (size_t cnt);
+void swap_free (swap_slot_t);
+void swap_write_run (swap_slot_t, struct page *pages[], void *kvas[],
+		size_t cnt);
+void swap_read (swap_slot_t, void *kva);
+struct page *swap_owner (swap_slot_t);
+size_t swap_slot_cnt (void);
+void swap_count_readahead (void);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */
@@ -1,7 +1,10 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <radix.h>
+#include <rbtree.h>
 #include "threads/palloc.h"
+#include "threads/synch.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -12,6 +15,8 @@ enum vm_type {
 	VM_FILE = 2,
 	/* page that hold the page cache, for project 4 */
 	VM_PAGE_CACHE = 3,
+	/* page of a shared memory segment */
+	VM_SHM = 4,
 
 	/* Bit flags to store state */
 
@@ -27,12 +32,15 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
+#include "vm/shm.h"
 #ifdef EFILESYS
 #include "filesys/page_cache.h"
 #endif
 
 struct page_operations;
 struct thread;
+struct text_frame;
+struct ksm_frame;
 
 #define VM_TYPE(type) ((type) & 7)
 
@@ -46,6 +54,9 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct thread *owner;       /* Process whose pml4 maps the page. */
+	struct page *share_next;    /* Next page sharing FRAME, or NULL. */
+	bool writable;              /* May user code write to the page? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -53,6 +64,7 @@ struct page {
 		struct uninit_page uninit;
 		struct anon_page anon;
 		struct file_page file;
+		struct shm_page shm;
 #ifdef EFILESYS
 		struct page_cache page_cache;
 #endif
@@ -63,6 +75,12 @@ struct page {
 struct frame {
 	void *kva;
 	struct page *page;
+	struct list_elem elem;      /* Element in the frame table. */
+	unsigned share_cnt;         /* Pages mapping the frame, for COW. */
+	struct text_frame *text;    /* Text cache entry, or NULL. */
+	struct ksm_frame *ksm;      /* Merge candidate entry, or NULL. */
+	struct cached_page *cache;  /* Page cache entry, or NULL. */
+	bool merged;                /* Pages were merged into it. */
 };
 
 /* The function table for page operations.
@@ -81,10 +99,47 @@ struct page_operations {
 #define destroy(page) \
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
+/* Kinds of page faults handled, for accounting. */
+enum vm_fault_kind {
+	VMF_UNINIT,                 /* First touch of a lazily loaded page. */
+	VMF_SWAP_IN,                /* Anonymous page read back from swap. */
+	VMF_FILE,                   /* File page read back in. */
+	VMF_STACK,                  /* Stack growth. */
+	VMF_COW,                    /* Write to a shared or zero page. */
+	VMF_SPURIOUS,               /* Nothing left to do. */
+	VMF_CNT
+};
+
+/* Page fault counts and TSC cycles spent on them, by kind. */
+struct vm_fault_stats {
+	long long cnt[VMF_CNT];
+	uint64_t cycles[VMF_CNT];
+};
+
 /* Representation of current process's memory space.
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct radix pages;         /* Pages by virtual page number. */
+	struct itree mappings;      /* mmap() mappings, by address range;
+	                               only the owner changes them. */
+	struct rwlock lock;         /* Lookups read, changes write. */
+	void *last_fault;           /* Page of the last not-present fault. */
+	unsigned around;            /* Current fault-around window. */
+	void *stack_bottom;         /* Lowest stack page grown, or NULL. */
+	unsigned stack_chunk;       /* Pages in the last stack growth. */
+	struct vm_fault_stats faults;   /* This process's faults. */
+
+	/* Memory use, under the frame table lock. */
+	size_t rss;                 /* Resident pages. */
+	size_t rss_peak;            /* Most RSS has been. */
+	size_t wss;                 /* Pages used in the last sample. */
+	size_t ws_seen;             /* Pages used so far this sample. */
+	unsigned ws_pass;           /* Sample WS_SEEN belongs to. */
+
+	/* Out of memory; see oom.c. */
+	size_t committed;           /* Writable anonymous pages. */
+	int oom_score_adj;          /* Set by oom_adjust(). */
 };
 
 #include "threads/thread.h"
@@ -95,9 +150,27 @@ void supplemental_page_table_kill (struct supplemental_page_table *spt);
 struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
+bool spt_range_empty (struct supplemental_page_table *spt, const void *addr,
+		size_t length);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+extern bool vm_cow;
+extern bool vm_huge;
+extern bool vm_compact;
+extern unsigned vm_fault_around;
+extern bool vm_stat;
+extern unsigned vm_reclaim_low;
+extern unsigned vm_reclaim_high;
+extern unsigned vm_ksm_pages;
+extern unsigned vm_ksm_interval;
+extern unsigned vm_rss_limit;
+extern unsigned vm_wss_interval;
+
 void vm_init (void);
+void vm_print_stats (void);
+void vm_print_fault_stats (const char *name, const struct vm_fault_stats *);
+void vm_print_mem_stats (const char *name,
+		const struct supplemental_page_table *);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -107,6 +180,10 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+bool vm_map_frame (struct page *page, void *kva);
+void *vm_alloc_user_page (void);
+void vm_populate (void *addr, size_t length);
+bool vm_madvise (void *addr, size_t length, int advice);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,17 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A page stored compressed in memory. */
+struct zswap_entry;
+
+extern size_t vm_zswap_pages;
+
+void zswap_init (void);
+struct zswap_entry *zswap_store (const void *kva);
+void zswap_load (const struct zswap_entry *, void *kva);
+void zswap_free (struct zswap_entry *);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */
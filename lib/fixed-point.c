@@ -0,0 +1,16 @@
+#include <fixed-point.h>
+
+/* Returns X raised to the N'th power, by repeated squaring, so
+   that the cost is O(log N) multiplications. */
+fixed_t
+fp_pow (fixed_t x, unsigned n) {
+	fixed_t result = FP_ONE;
+
+	while (n > 0) {
+		if (n & 1)
+			result = fp_mul (result, x);
+		x = fp_mul (x, x);
+		n >>= 1;
+	}
+	return result;
+}
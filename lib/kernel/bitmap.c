@@ -4,6 +4,7 @@
 #include <round.h>
 #include <stdio.h>
 #include "threads/malloc.h"
+#include "threads/thread.h"
 #ifdef FILESYS
 #include "filesys/file.h"
 #endif
@@ -21,14 +22,35 @@ typedef unsigned long elem_type;
 /* Number of bits in an element. */
 #define ELEM_BITS (sizeof (elem_type) * CHAR_BIT)
 
+/* bitmap_scan() offers to reschedule once per this many runs it
+   rejects.  Must be a power of 2. */
+#define BITMAP_RESCHED_INTERVAL 1024
+
+/* Bitmaps of at least this many elements keep a summary. */
+#define SUMMARY_MIN_ELEMS 64
+
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   A large bitmap also keeps a summary with one bit per element of
+   BITS, set when every bit of that element is set, so that a
+   search for unset bits passes over full stretches 64 elements
+   at a time.  Every update of BITS rechecks the summary bit
+   after writing it, so that once concurrent updates of an
+   element finish, its summary bit is right. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	elem_type *summary; /* Full elements of BITS, or NULL. */
 };
 
+static size_t find_next (const struct bitmap *, size_t start, size_t end,
+		bool value);
+static size_t skip_full (const struct bitmap *, size_t idx, size_t last);
+static void update_summary (struct bitmap *, size_t idx);
+static void init_summary (struct bitmap *);
+
 /* Returns the index of the element that contains the bit
    numbered BIT_IDX. */
 static inline size_t
@@ -55,6 +77,21 @@ byte_cnt (size_t bit_cnt) {
 	return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the number of elements in the summary of a bitmap of
+   BIT_CNT bits, which is zero if it has none. */
+static inline size_t
+summary_cnt (size_t bit_cnt) {
+	size_t cnt = elem_cnt (bit_cnt);
+	return cnt >= SUMMARY_MIN_ELEMS ? elem_cnt (cnt) : 0;
+}
+
+/* Returns the number of bytes required for BIT_CNT bits and
+   their summary. */
+static inline size_t
+storage_cnt (size_t bit_cnt) {
+	return byte_cnt (bit_cnt) + sizeof (elem_type) * summary_cnt (bit_cnt);
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -62,6 +99,14 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns true if every bit of element IDX of B's bits is set. */
+static inline bool
+elem_full (const struct bitmap *b, size_t idx) {
+	elem_type full = idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b)
+		: (elem_type) -1;
+	return __atomic_load_n (&b->bits[idx], __ATOMIC_SEQ_CST) == full;
+}
 
 /* Creation and destruction. */
 
@@ -74,8 +119,9 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
-		b->bits = malloc (byte_cnt (bit_cnt));
+		b->bits = malloc (storage_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
+			init_summary (b);
 			bitmap_set_all (b, false);
 			return b;
 		}
@@ -95,6 +141,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 
 	b->bit_cnt = bit_cnt;
 	b->bits = (elem_type *) (b + 1);
+	init_summary (b);
 	bitmap_set_all (b, false);
 	return b;
 }
@@ -103,7 +150,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
    with BIT_CNT bits (for use with bitmap_create_in_buf()). */
 size_t
 bitmap_buf_size (size_t bit_cnt) {
-	return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+	return sizeof (struct bitmap) + storage_cnt (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -148,6 +195,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the OR instruction in [IA32-v2b]. */
 	asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	update_summary (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -160,6 +208,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the AND instruction in [IA32-v2a]. */
 	asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	update_summary (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -174,6 +223,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the XOR instruction in [IA32-v2b]. */
 	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	update_summary (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -197,14 +247,27 @@ bitmap_set_all (struct bitmap *b, bool value) {
 /* Sets the CNT bits starting at START in B to VALUE. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	/* Set one element's share of the bits at a time. */
+	while (start < end) {
+		size_t idx = elem_idx (start);
+		size_t ofs = start % ELEM_BITS;
+		size_t n = end - start < ELEM_BITS - ofs ? end - start : ELEM_BITS - ofs;
+		elem_type mask = n < ELEM_BITS ? (((elem_type) 1 << n) - 1) << ofs
+			: (elem_type) -1;
+
+		if (value)
+			__atomic_fetch_or (&b->bits[idx], mask, __ATOMIC_SEQ_CST);
+		else
+			__atomic_fetch_and (&b->bits[idx], ~mask, __ATOMIC_SEQ_CST);
+		update_summary (b, idx);
+		start += n;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -228,16 +291,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -263,21 +321,89 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 
 /* Finding set or unset bits. */
 
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.  END
+   must not exceed B's size.  Looks at a whole element at a time,
+   and passes over full elements by the summary when looking for
+   an unset bit. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value) {
+	size_t idx, last;
+	elem_type e;
+
+	if (start >= end)
+		return end;
+	idx = elem_idx (start);
+	last = elem_idx (end - 1);
+
+	e = value ? b->bits[idx] : ~b->bits[idx];
+	e &= (elem_type) -1 << (start % ELEM_BITS);
+	while (e == 0) {
+		if (++idx > last)
+			return end;
+		if (!value && b->summary != NULL) {
+			idx = skip_full (b, idx, last);
+			if (idx > last)
+				return end;
+		}
+		e = value ? b->bits[idx] : ~b->bits[idx];
+	}
+
+	start = idx * ELEM_BITS + __builtin_ctzl (e);
+	return start < end ? start : end;
+}
+
+/* Returns the index of the first element of B's bits from IDX
+   through LAST that the summary does not mark full, or LAST + 1
+   if there is none. */
+static size_t
+skip_full (const struct bitmap *b, size_t idx, size_t last) {
+	size_t i = elem_idx (idx);
+	elem_type e = ~b->summary[i] & ((elem_type) -1 << (idx % ELEM_BITS));
+
+	while (e == 0) {
+		if (++i > elem_idx (last))
+			return last + 1;
+		e = ~b->summary[i];
+	}
+	idx = i * ELEM_BITS + __builtin_ctzl (e);
+	return idx <= last ? idx : last + 1;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Finds each candidate run's first bit and the bit that ends it
+   a word at a time, then resumes past the end, so each element is
+   read about once however short the runs are. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
+	size_t last, rejected = 0;
+
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt == 0)
+		return start;
+	if (cnt > b->bit_cnt)
+		return BITMAP_ERROR;
+
+	/* A run must start by LAST. */
+	last = b->bit_cnt - cnt;
+	while (start <= last) {
+		size_t first = find_next (b, start, last + 1, value);
+		size_t stop;
+
+		if (first > last)
+			break;
+		stop = find_next (b, first, first + cnt, !value);
+		if (stop == first + cnt)
+			return first;
+		start = stop + 1;
+		if ((++rejected & (BITMAP_RESCHED_INTERVAL - 1)) == 0)
+			cond_resched ();
 	}
 	return BITMAP_ERROR;
 }
@@ -315,6 +441,7 @@ bitmap_read (struct bitmap *b, struct file *file) {
 		off_t size = byte_cnt (b->bit_cnt);
 		success = file_read_at (file, b->bits, size, 0) == size;
 		b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+		init_summary (b);
 	}
 	return success;
 }
@@ -336,3 +463,45 @@ bitmap_dump (const struct bitmap *b) {
 	hex_dump (0, b->bits, byte_cnt (b->bit_cnt), false);
 }
 
+/* Summary. */
+
+/* Makes element IDX's summary bit in B, if B has a summary, match
+   whether the element is full.  Another update of the element may
+   race with this one, so the summary bit is written and then the
+   element rechecked until the two agree. */
+static void
+update_summary (struct bitmap *b, size_t idx) {
+	elem_type *summary = b->summary;
+	elem_type mask = bit_mask (idx);
+	bool full;
+
+	if (summary == NULL)
+		return;
+
+	do {
+		full = elem_full (b, idx);
+		if (full)
+			__atomic_fetch_or (&summary[elem_idx (idx)], mask, __ATOMIC_SEQ_CST);
+		else
+			__atomic_fetch_and (&summary[elem_idx (idx)], ~mask,
+					__ATOMIC_SEQ_CST);
+	} while (elem_full (b, idx) != full);
+}
+
+/* Sets up B's summary, if B is large enough to have one, to match
+   B's bits as they stand. */
+static void
+init_summary (struct bitmap *b) {
+	size_t i;
+
+	if (summary_cnt (b->bit_cnt) == 0) {
+		b->summary = NULL;
+		return;
+	}
+	b->summary = b->bits + elem_cnt (b->bit_cnt);
+	for (i = 0; i < summary_cnt (b->bit_cnt); i++)
+		b->summary[i] = 0;
+	for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+		if (elem_full (b, i))
+			b->summary[elem_idx (i)] |= bit_mask (i);
+}
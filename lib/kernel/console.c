@@ -1,6 +1,7 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
@@ -9,6 +10,16 @@
 
 static void vprintf_helper (char, void *);
 static void putchar_have_lock (uint8_t c);
+static void putbuf_have_lock (const char *, size_t);
+
+/* Output of one vprintf() call, collected so that it reaches each
+   device as a few putbuf()-sized writes instead of one write per
+   character.  Lives on the caller's stack, so it is kept small. */
+struct vprintf_buf {
+	char buf[128];              /* Characters not yet written. */
+	size_t len;                 /* Number of characters in BUF. */
+	int char_cnt;               /* Characters formatted in all. */
+};
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -116,13 +127,16 @@ console_locked_by_current_thread (void) {
    Writes its output to both vga display and serial port. */
 int
 vprintf (const char *format, va_list args) {
-	int char_cnt = 0;
+	struct vprintf_buf b;
 
+	b.len = 0;
+	b.char_cnt = 0;
 	acquire_console ();
-	__vprintf (format, args, vprintf_helper, &char_cnt);
+	__vprintf (format, args, vprintf_helper, &b);
+	putbuf_have_lock (b.buf, b.len);
 	release_console ();
 
-	return char_cnt;
+	return b.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
@@ -130,20 +144,34 @@ vprintf (const char *format, va_list args) {
 int
 puts (const char *s) {
 	acquire_console ();
-	while (*s != '\0')
-		putchar_have_lock (*s++);
+	putbuf_have_lock (s, strlen (s));
 	putchar_have_lock ('\n');
 	release_console ();
 
 	return 0;
 }
 
-/* Writes the N characters in BUFFER to the console. */
+/* Writes the N characters in BUFFER to the console, streaming them
+   to each device in one pass.  BUFFER may be user memory that the
+   caller has checked. */
 void
 putbuf (const char *buffer, size_t n) {
 	acquire_console ();
-	while (n-- > 0)
-		putchar_have_lock (*buffer++);
+	putbuf_have_lock (buffer, n);
+	release_console ();
+}
+
+/* Keeps other threads' output off the console until the matching
+   console_end(), so that a series of putbuf() calls comes out
+   together and takes the console lock once. */
+void
+console_begin (void) {
+	acquire_console ();
+}
+
+/* Ends what console_begin() started. */
+void
+console_end (void) {
 	release_console ();
 }
 
@@ -159,10 +187,15 @@ putchar (int c) {
 
 /* Helper function for vprintf(). */
 static void
-vprintf_helper (char c, void *char_cnt_) {
-	int *char_cnt = char_cnt_;
-	(*char_cnt)++;
-	putchar_have_lock (c);
+vprintf_helper (char c, void *b_) {
+	struct vprintf_buf *b = b_;
+
+	if (b->len == sizeof b->buf) {
+		putbuf_have_lock (b->buf, b->len);
+		b->len = 0;
+	}
+	b->buf[b->len++] = c;
+	b->char_cnt++;
 }
 
 /* Writes C to the vga display and serial port.
@@ -175,3 +208,14 @@ putchar_have_lock (uint8_t c) {
 	serial_putc (c);
 	vga_putc (c);
 }
+
+/* Writes the N characters in BUFFER to the vga display and serial
+   port.  The caller has already acquired the console lock if
+   appropriate. */
+static void
+putbuf_have_lock (const char *buffer, size_t n) {
+	ASSERT (console_locked_by_current_thread ());
+	write_cnt += n;
+	serial_putbuf ((const uint8_t *) buffer, n);
+	vga_putbuf (buffer, n);
+}
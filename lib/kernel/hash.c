@@ -7,17 +7,23 @@
 
 #include "hash.h"
 #include "../debug.h"
+#include <string.h>
 #include "threads/malloc.h"
 
 #define list_elem_to_hash_elem(LIST_ELEM)                       \
 	list_entry(LIST_ELEM, struct hash_elem, list_elem)
 
-static struct list *find_bucket (struct hash *, struct hash_elem *);
-static struct hash_elem *find_elem (struct hash *, struct list *,
+static struct list *find_bucket (struct hash *, uint64_t hash);
+static struct list *next_bucket (struct hash *, struct list *);
+static struct hash_elem *find_elem (struct hash *, struct hash_elem *,
+		uint64_t hash);
+static struct hash_elem *search_bucket (struct hash *, struct list *,
 		struct hash_elem *);
+static void clear_bucket (struct hash *, struct list *, hash_action_func *);
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
 static void rehash (struct hash *);
+static void migrate (struct hash *);
 
 /* Initializes hash table H to compute hash values using HASH and
    compare hash elements using LESS, given auxiliary data AUX. */
@@ -27,6 +33,9 @@ hash_init (struct hash *h,
 	h->elem_cnt = 0;
 	h->bucket_cnt = 4;
 	h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
+	h->old_buckets = NULL;
+	h->old_bucket_cnt = 0;
+	h->migrate_idx = 0;
 	h->hash = hash;
 	h->less = less;
 	h->aux = aux;
@@ -51,17 +60,13 @@ void
 hash_clear (struct hash *h, hash_action_func *destructor) {
 	size_t i;
 
-	for (i = 0; i < h->bucket_cnt; i++) {
-		struct list *bucket = &h->buckets[i];
-
-		if (destructor != NULL)
-			while (!list_empty (bucket)) {
-				struct list_elem *list_elem = list_pop_front (bucket);
-				struct hash_elem *hash_elem = list_elem_to_hash_elem (list_elem);
-				destructor (hash_elem, h->aux);
-			}
-
-		list_init (bucket);
+	for (i = 0; i < h->bucket_cnt; i++)
+		clear_bucket (h, &h->buckets[i], destructor);
+	if (h->old_buckets != NULL) {
+		for (i = h->migrate_idx; i < h->old_bucket_cnt; i++)
+			clear_bucket (h, &h->old_buckets[i], destructor);
+		free (h->old_buckets);
+		h->old_buckets = NULL;
 	}
 
 	h->elem_cnt = 0;
@@ -82,6 +87,7 @@ hash_destroy (struct hash *h, hash_action_func *destructor) {
 	if (destructor != NULL)
 		hash_clear (h, destructor);
 	free (h->buckets);
+	free (h->old_buckets);
 }
 
 /* Inserts NEW into hash table H and returns a null pointer, if
@@ -90,11 +96,11 @@ hash_destroy (struct hash *h, hash_action_func *destructor) {
    without inserting NEW. */
 struct hash_elem *
 hash_insert (struct hash *h, struct hash_elem *new) {
-	struct list *bucket = find_bucket (h, new);
-	struct hash_elem *old = find_elem (h, bucket, new);
+	uint64_t hash = h->hash (new, h->aux);
+	struct hash_elem *old = find_elem (h, new, hash);
 
 	if (old == NULL)
-		insert_elem (h, bucket, new);
+		insert_elem (h, find_bucket (h, hash), new);
 
 	rehash (h);
 
@@ -105,12 +111,12 @@ hash_insert (struct hash *h, struct hash_elem *new) {
    already in the table, which is returned. */
 struct hash_elem *
 hash_replace (struct hash *h, struct hash_elem *new) {
-	struct list *bucket = find_bucket (h, new);
-	struct hash_elem *old = find_elem (h, bucket, new);
+	uint64_t hash = h->hash (new, h->aux);
+	struct hash_elem *old = find_elem (h, new, hash);
 
 	if (old != NULL)
 		remove_elem (h, old);
-	insert_elem (h, bucket, new);
+	insert_elem (h, find_bucket (h, hash), new);
 
 	rehash (h);
 
@@ -118,10 +124,12 @@ hash_replace (struct hash *h, struct hash_elem *new) {
 }
 
 /* Finds and returns an element equal to E in hash table H, or a
-   null pointer if no equal element exists in the table. */
+   null pointer if no equal element exists in the table.  Unlike
+   the functions that modify H, it does not move elements along
+   during a resize, so it leaves iterators valid. */
 struct hash_elem *
 hash_find (struct hash *h, struct hash_elem *e) {
-	return find_elem (h, find_bucket (h, e), e);
+	return find_elem (h, e, h->hash (e, h->aux));
 }
 
 /* Finds, removes, and returns an element equal to E in hash
@@ -133,7 +141,7 @@ hash_find (struct hash *h, struct hash_elem *e) {
    responsibility to deallocate them. */
 struct hash_elem *
 hash_delete (struct hash *h, struct hash_elem *e) {
-	struct hash_elem *found = find_elem (h, find_bucket (h, e), e);
+	struct hash_elem *found = find_elem (h, e, h->hash (e, h->aux));
 	if (found != NULL) {
 		remove_elem (h, found);
 		rehash (h);
@@ -149,12 +157,11 @@ hash_delete (struct hash *h, struct hash_elem *e) {
    undefined behavior, whether done from ACTION or elsewhere. */
 void
 hash_apply (struct hash *h, hash_action_func *action) {
-	size_t i;
+	struct list *bucket;
 
 	ASSERT (action != NULL);
 
-	for (i = 0; i < h->bucket_cnt; i++) {
-		struct list *bucket = &h->buckets[i];
+	for (bucket = h->buckets; bucket != NULL; bucket = next_bucket (h, bucket)) {
 		struct list_elem *elem, *next;
 
 		for (elem = list_begin (bucket); elem != list_end (bucket); elem = next) {
@@ -205,7 +212,8 @@ hash_next (struct hash_iterator *i) {
 
 	i->elem = list_elem_to_hash_elem (list_next (&i->elem->list_elem));
 	while (i->elem == list_elem_to_hash_elem (list_end (i->bucket))) {
-		if (++i->bucket >= i->hash->buckets + i->hash->bucket_cnt) {
+		i->bucket = next_bucket (i->hash, i->bucket);
+		if (i->bucket == NULL) {
 			i->elem = NULL;
 			break;
 		}
@@ -235,58 +243,144 @@ hash_empty (struct hash *h) {
 	return h->elem_cnt == 0;
 }
 
-/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
-#define FNV_64_PRIME 0x00000100000001B3UL
-#define FNV_64_BASIS 0xcbf29ce484222325UL
+/* The sample hash functions.
+
+   hash_bytes() takes 16 bytes per step, two unaligned 64-bit
+   loads, and mixes them in with a 64x64-bit multiply whose high
+   and low halves are folded together, as in wyhash.  hash_u64()
+   is the finalizer of MurmurHash3, which makes every bit of the
+   result depend on every bit of its input: page-aligned
+   addresses and sector numbers then spread across the low bits
+   that find_bucket() keeps, as a plain multiply would not.  The
+   results are not the same from one version of Pintos to the
+   next, so they may be stored only as a checksum that can afford
+   to miss. */
+
+/* Odd constants from wyhash. */
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+
+/* An unaligned 64-bit word. */
+struct unaligned_u64 {
+	uint64_t value;
+} __attribute__ ((packed));
+
+/* Returns A times B, the high half of the product folded into
+   the low. */
+static inline uint64_t
+hash_mix (uint64_t a, uint64_t b) {
+	unsigned __int128 product = (unsigned __int128) a * b;
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+/* Returns the SIZE bytes at P, fewer than 8, as a word. */
+static inline uint64_t
+read_tail (const uint8_t *p, size_t size) {
+	uint64_t word = 0;
+
+	while (size-- > 0)
+		word = (word << 8) | p[size];
+	return word;
+}
 
 /* Returns a hash of the SIZE bytes in BUF. */
 uint64_t
 hash_bytes (const void *buf_, size_t size) {
-	/* Fowler-Noll-Vo 32-bit hash, for bytes. */
-	const unsigned char *buf = buf_;
-	uint64_t hash;
-
-	ASSERT (buf != NULL);
+	const uint8_t *buf = buf_;
+	uint64_t hash = HASH_P0 ^ size;
+	uint64_t a, b;
 
-	hash = FNV_64_BASIS;
-	while (size-- > 0)
-		hash = (hash * FNV_64_PRIME) ^ *buf++;
+	ASSERT (buf != NULL || size == 0);
 
-	return hash;
+	for (; size >= 16; buf += 16, size -= 16) {
+		a = ((const struct unaligned_u64 *) buf)->value;
+		b = ((const struct unaligned_u64 *) buf)[1].value;
+		hash = hash_mix (a ^ HASH_P1, b ^ hash);
+	}
+	if (size >= 8) {
+		a = ((const struct unaligned_u64 *) buf)->value;
+		b = read_tail (buf + 8, size - 8);
+	} else {
+		a = read_tail (buf, size);
+		b = 0;
+	}
+	hash = hash_mix (a ^ HASH_P1, b ^ hash);
+	return hash_mix (hash ^ HASH_P2, HASH_P1);
 }
 
 /* Returns a hash of string S. */
 uint64_t
-hash_string (const char *s_) {
-	const unsigned char *s = (const unsigned char *) s_;
-	uint64_t hash;
-
+hash_string (const char *s) {
 	ASSERT (s != NULL);
 
-	hash = FNV_64_BASIS;
-	while (*s != '\0')
-		hash = (hash * FNV_64_PRIME) ^ *s++;
+	return hash_bytes (s, strlen (s));
+}
 
-	return hash;
+/* Returns a hash of X. */
+uint64_t
+hash_u64 (uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* Returns a hash of pointer P. */
+uint64_t
+hash_ptr (const void *p) {
+	return hash_u64 ((uintptr_t) p);
 }
 
 /* Returns a hash of integer I. */
 uint64_t
 hash_int (int i) {
-	return hash_bytes (&i, sizeof i);
+	return hash_u64 ((unsigned) i);
 }
-
-/* Returns the bucket in H that E belongs in. */
+
+/* Returns the bucket in H that an element with hash value HASH
+   belongs in. */
 static struct list *
-find_bucket (struct hash *h, struct hash_elem *e) {
-	size_t bucket_idx = h->hash (e, h->aux) & (h->bucket_cnt - 1);
-	return &h->buckets[bucket_idx];
+find_bucket (struct hash *h, uint64_t hash) {
+	return &h->buckets[hash & (h->bucket_cnt - 1)];
+}
+
+/* Returns the bucket after BUCKET in H, or a null pointer after
+   the last.  The buckets are the current ones and then, during a
+   resize, the old ones not yet emptied. */
+static struct list *
+next_bucket (struct hash *h, struct list *bucket) {
+	struct list *old = h->old_buckets;
+
+	if (old != NULL && bucket >= old && bucket < old + h->old_bucket_cnt)
+		return ++bucket < old + h->old_bucket_cnt ? bucket : NULL;
+	if (++bucket < h->buckets + h->bucket_cnt)
+		return bucket;
+	return old != NULL ? old + h->migrate_idx : NULL;
+}
+
+/* Searches H for a hash element equal to E, whose hash value is
+   HASH.  During a resize, E may still be in its old bucket.
+   Returns it if found or a null pointer otherwise. */
+static struct hash_elem *
+find_elem (struct hash *h, struct hash_elem *e, uint64_t hash) {
+	struct hash_elem *found = search_bucket (h, find_bucket (h, hash), e);
+
+	if (found == NULL && h->old_buckets != NULL) {
+		size_t old_idx = hash & (h->old_bucket_cnt - 1);
+
+		if (old_idx >= h->migrate_idx)
+			found = search_bucket (h, &h->old_buckets[old_idx], e);
+	}
+	return found;
 }
 
 /* Searches BUCKET in H for a hash element equal to E.  Returns
    it if found or a null pointer otherwise. */
 static struct hash_elem *
-find_elem (struct hash *h, struct list *bucket, struct hash_elem *e) {
+search_bucket (struct hash *h, struct list *bucket, struct hash_elem *e) {
 	struct list_elem *i;
 
 	for (i = list_begin (bucket); i != list_end (bucket); i = list_next (i)) {
@@ -297,85 +391,86 @@ find_elem (struct hash *h, struct list *bucket, struct hash_elem *e) {
 	return NULL;
 }
 
-/* Returns X with its lowest-order bit set to 1 turned off. */
-static inline size_t
-turn_off_least_1bit (size_t x) {
-	return x & (x - 1);
-}
-
-/* Returns true if X is a power of 2, otherwise false. */
-static inline size_t
-is_power_of_2 (size_t x) {
-	return x != 0 && turn_off_least_1bit (x) == 0;
-}
-
 /* Element per bucket ratios. */
 #define MIN_ELEMS_PER_BUCKET  1 /* Elems/bucket < 1: reduce # of buckets. */
 #define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
 #define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
 
-/* Changes the number of buckets in hash table H to match the
-   ideal.  This function can fail because of an out-of-memory
-   condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+/* Old buckets emptied by each insertion or deletion during a
+   resize. */
+#define MIGRATE_BUCKETS 4
+
+/* Moves some of H's elements to its new buckets, if a resize is
+   under way.  Otherwise begins a resize if H has strayed outside
+   the element per bucket ratios: doubling or halving the bucket
+   count brings it back to BEST_ELEMS_PER_BUCKET.
+
+   A resize of N old buckets finishes in N / MIGRATE_BUCKETS
+   calls, before the N / 2 deletions or 4 * N insertions that the
+   next one needs.  Allocating the new buckets can fail, but that
+   just makes hash accesses less efficient until a later call
+   succeeds; we can still continue. */
 static void
 rehash (struct hash *h) {
-	size_t old_bucket_cnt, new_bucket_cnt;
-	struct list *new_buckets, *old_buckets;
+	size_t new_bucket_cnt;
+	struct list *new_buckets;
 	size_t i;
 
 	ASSERT (h != NULL);
 
-	/* Save old bucket info for later use. */
-	old_buckets = h->buckets;
-	old_bucket_cnt = h->bucket_cnt;
-
-	/* Calculate the number of buckets to use now.
-	   We want one bucket for about every BEST_ELEMS_PER_BUCKET.
-	   We must have at least four buckets, and the number of
-	   buckets must be a power of 2. */
-	new_bucket_cnt = h->elem_cnt / BEST_ELEMS_PER_BUCKET;
-	if (new_bucket_cnt < 4)
-		new_bucket_cnt = 4;
-	while (!is_power_of_2 (new_bucket_cnt))
-		new_bucket_cnt = turn_off_least_1bit (new_bucket_cnt);
-
-	/* Don't do anything if the bucket count wouldn't change. */
-	if (new_bucket_cnt == old_bucket_cnt)
+	if (h->old_buckets != NULL) {
+		migrate (h);
+		return;
+	}
+
+	/* We must have at least four buckets. */
+	if (h->elem_cnt > h->bucket_cnt * MAX_ELEMS_PER_BUCKET)
+		new_bucket_cnt = h->bucket_cnt * 2;
+	else if (h->bucket_cnt > 4
+			&& h->elem_cnt < h->bucket_cnt * MIN_ELEMS_PER_BUCKET)
+		new_bucket_cnt = h->bucket_cnt / 2;
+	else
 		return;
 
 	/* Allocate new buckets and initialize them as empty. */
 	new_buckets = malloc (sizeof *new_buckets * new_bucket_cnt);
-	if (new_buckets == NULL) {
-		/* Allocation failed.  This means that use of the hash table will
-		   be less efficient.  However, it is still usable, so
-		   there's no reason for it to be an error. */
+	if (new_buckets == NULL)
 		return;
-	}
 	for (i = 0; i < new_bucket_cnt; i++)
 		list_init (&new_buckets[i]);
 
-	/* Install new bucket info. */
+	/* Install new bucket info, keeping the old buckets until
+	   migrate() has emptied them. */
+	h->old_buckets = h->buckets;
+	h->old_bucket_cnt = h->bucket_cnt;
+	h->migrate_idx = 0;
 	h->buckets = new_buckets;
 	h->bucket_cnt = new_bucket_cnt;
+	migrate (h);
+}
 
-	/* Move each old element into the appropriate new bucket. */
-	for (i = 0; i < old_bucket_cnt; i++) {
-		struct list *old_bucket;
-		struct list_elem *elem, *next;
+/* Moves the elements of the next MIGRATE_BUCKETS old buckets in H
+   into the new ones, and frees the old buckets once all of them
+   are empty. */
+static void
+migrate (struct hash *h) {
+	size_t n;
 
-		old_bucket = &old_buckets[i];
-		for (elem = list_begin (old_bucket);
-				elem != list_end (old_bucket); elem = next) {
-			struct list *new_bucket
-				= find_bucket (h, list_elem_to_hash_elem (elem));
-			next = list_next (elem);
-			list_remove (elem);
-			list_push_front (new_bucket, elem);
+	for (n = 0; n < MIGRATE_BUCKETS && h->migrate_idx < h->old_bucket_cnt;
+			n++) {
+		struct list *old_bucket = &h->old_buckets[h->migrate_idx++];
+
+		while (!list_empty (old_bucket)) {
+			struct list_elem *elem = list_pop_front (old_bucket);
+			uint64_t hash = h->hash (list_elem_to_hash_elem (elem), h->aux);
+			list_push_front (find_bucket (h, hash), elem);
 		}
 	}
 
-	free (old_buckets);
+	if (h->migrate_idx == h->old_bucket_cnt) {
+		free (h->old_buckets);
+		h->old_buckets = NULL;
+	}
 }
 
 /* Inserts E into BUCKET (in hash table H). */
@@ -392,3 +487,18 @@ remove_elem (struct hash *h, struct hash_elem *e) {
 	list_remove (&e->list_elem);
 }
 
+
+/* Empties BUCKET in H, calling DESTRUCTOR, if non-null, for each
+   element first. */
+static void
+clear_bucket (struct hash *h, struct list *bucket,
+		hash_action_func *destructor) {
+	if (destructor != NULL)
+		while (!list_empty (bucket)) {
+			struct list_elem *list_elem = list_pop_front (bucket);
+			struct hash_elem *hash_elem = list_elem_to_hash_elem (list_elem);
+			destructor (hash_elem, h->aux);
+		}
+
+	list_init (bucket);
+}
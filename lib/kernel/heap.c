@@ -0,0 +1,133 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* Melds the heaps rooted at A and B, neither of which has
+   siblings, and returns the new root. */
+static struct heap_elem *
+meld (struct heap_elem *a, struct heap_elem *b,
+		heap_less_func *less, void *aux) {
+	if (less (a, b, aux)) {
+		struct heap_elem *t = a;
+		a = b;
+		b = t;
+	}
+	b->prev = a;
+	b->next = a->child;
+	if (a->child != NULL)
+		a->child->prev = b;
+	a->child = b;
+	return a;
+}
+
+/* Melds the sibling list starting at FIRST into a single heap
+   and returns its root, or NULL if FIRST is NULL.  This is the
+   standard two-pass pairing: meld adjacent pairs left to right,
+   then meld the results right to left. */
+static struct heap_elem *
+merge_pairs (struct heap_elem *first, heap_less_func *less, void *aux) {
+	struct heap_elem *pairs = NULL;     /* Melded pairs, last first. */
+	struct heap_elem *root = NULL;
+
+	while (first != NULL) {
+		struct heap_elem *a = first;
+		struct heap_elem *b = a->next;
+
+		a->next = a->prev = NULL;
+		if (b != NULL) {
+			first = b->next;
+			b->next = b->prev = NULL;
+			a = meld (a, b, less, aux);
+		} else
+			first = NULL;
+		a->next = pairs;
+		pairs = a;
+	}
+
+	while (pairs != NULL) {
+		struct heap_elem *next = pairs->next;
+		pairs->next = NULL;
+		root = root != NULL ? meld (root, pairs, less, aux) : pairs;
+		pairs = next;
+	}
+	return root;
+}
+
+/* Unlinks E, which must have a parent, from its parent or left
+   sibling.  E keeps its children. */
+static void
+cut (struct heap_elem *e) {
+	if (e->prev->child == e)
+		e->prev->child = e->next;
+	else
+		e->prev->next = e->next;
+	if (e->next != NULL)
+		e->next->prev = e->prev;
+	e->next = e->prev = NULL;
+}
+
+/* Initializes H as an empty heap. */
+void
+heap_init (struct heap *h) {
+	ASSERT (h != NULL);
+	h->root = NULL;
+}
+
+/* Inserts E into H, ordered by LESS given auxiliary data AUX. */
+void
+heap_insert (struct heap *h, struct heap_elem *e,
+		heap_less_func *less, void *aux) {
+	ASSERT (h != NULL);
+	ASSERT (e != NULL);
+
+	e->child = e->next = e->prev = NULL;
+	h->root = h->root != NULL ? meld (h->root, e, less, aux) : e;
+}
+
+/* Removes E, which must be in H, from H.  LESS and AUX must be
+   the ones E was inserted with. */
+void
+heap_remove (struct heap *h, struct heap_elem *e,
+		heap_less_func *less, void *aux) {
+	struct heap_elem *sub;
+
+	ASSERT (h != NULL);
+	ASSERT (e != NULL);
+
+	if (e == h->root) {
+		h->root = merge_pairs (e->child, less, aux);
+		return;
+	}
+
+	cut (e);
+	sub = merge_pairs (e->child, less, aux);
+	if (sub != NULL)
+		h->root = meld (h->root, sub, less, aux);
+}
+
+/* Restores the order of H after the key of E, which must be in
+   H, has increased.  LESS and AUX must be the ones E was inserted
+   with.  E's subtree still holds no key greater than E's, so it is
+   cut out whole and melded with the root, in constant time.  A key
+   that decreases instead needs heap_remove() and heap_insert(). */
+void
+heap_raise (struct heap *h, struct heap_elem *e,
+		heap_less_func *less, void *aux) {
+	ASSERT (h != NULL);
+	ASSERT (e != NULL);
+
+	if (e == h->root)
+		return;
+	cut (e);
+	h->root = meld (h->root, e, less, aux);
+}
+
+/* Removes and returns the maximum element of H, which must not
+   be empty. */
+struct heap_elem *
+heap_pop_max (struct heap *h, heap_less_func *less, void *aux) {
+	struct heap_elem *max = h->root;
+
+	ASSERT (max != NULL);
+	heap_remove (h, max, less, aux);
+	return max;
+}
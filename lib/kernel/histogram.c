@@ -0,0 +1,38 @@
+#include "histogram.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Clears every bucket of H. */
+void
+histogram_init (struct histogram *h) {
+	memset (h, 0, sizeof *h);
+}
+
+/* Returns the number of samples recorded in H. */
+uint64_t
+histogram_count (const struct histogram *h) {
+	uint64_t cnt = 0;
+	int i;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		cnt += h->buckets[i];
+	return cnt;
+}
+
+/* Prints H, headed by NAME, one line per nonempty bucket.
+   UNIT names what the samples measure, e.g. "cycles". */
+void
+histogram_print (const struct histogram *h, const char *name,
+		const char *unit) {
+	int i;
+
+	printf ("%s: %llu samples, max %llu %s\n", name, histogram_count (h),
+			(unsigned long long) h->max, unit);
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		if (h->buckets[i] == 0)
+			continue;
+		else if (i == 0)
+			printf ("  [0, 2^1) %s: %u\n", unit, h->buckets[i]);
+		else
+			printf ("  [2^%d, 2^%d) %s: %u\n", i, i + 1, unit, h->buckets[i]);
+}
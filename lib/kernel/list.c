@@ -487,3 +487,116 @@ list_min (struct list *list, list_less_func *less, void *aux) {
 	}
 	return min;
 }
+
+/* Initializes C as an empty counted list.  If LESS is nonnull,
+   C keeps track of its greatest element according to LESS, given
+   auxiliary data AUX. */
+void
+clist_init (struct clist *c, list_less_func *less, void *aux) {
+	ASSERT (c != NULL);
+	list_init (&c->list);
+	c->size = 0;
+	c->less = less;
+	c->aux = aux;
+	c->max = NULL;
+}
+
+/* Updates C's greatest element for the insertion of E, which is
+   now at the front of C if FRONT, otherwise at the back. */
+static void
+clist_note (struct clist *c, struct list_elem *e, bool front) {
+	if (c->less == NULL)
+		return;
+	if (c->size == 1)
+		c->max = e;
+	else if (c->max != NULL
+			&& (front ? !c->less (e, c->max, c->aux)
+				: c->less (c->max, e, c->aux)))
+		c->max = e;
+}
+
+/* Inserts ELEM at the beginning of C. */
+void
+clist_push_front (struct clist *c, struct list_elem *elem) {
+	list_push_front (&c->list, elem);
+	c->size++;
+	clist_note (c, elem, true);
+}
+
+/* Inserts ELEM at the end of C. */
+void
+clist_push_back (struct clist *c, struct list_elem *elem) {
+	list_push_back (&c->list, elem);
+	c->size++;
+	clist_note (c, elem, false);
+}
+
+/* Removes ELEM, which must be in C, from C and returns the
+   element that followed it. */
+struct list_elem *
+clist_remove (struct clist *c, struct list_elem *elem) {
+	ASSERT (c->size > 0);
+	c->size--;
+	if (elem == c->max)
+		c->max = NULL;
+	return list_remove (elem);
+}
+
+/* Removes the front element from C, which must not be empty, and
+   returns it. */
+struct list_elem *
+clist_pop_front (struct clist *c) {
+	struct list_elem *front = list_front (&c->list);
+	clist_remove (c, front);
+	return front;
+}
+
+/* Returns the number of elements in C, in constant time. */
+size_t
+clist_size (const struct clist *c) {
+	return c->size;
+}
+
+/* Returns true if C is empty, false otherwise. */
+bool
+clist_empty (const struct clist *c) {
+	return c->size == 0;
+}
+
+/* Returns the element in C with the largest value according to
+   the ordering given to clist_init(), which must have been
+   nonnull, as list_max() would: the earliest of several maxima,
+   or C's tail if it is empty.  Takes constant time unless the
+   last one found has since been removed. */
+struct list_elem *
+clist_max (struct clist *c) {
+	ASSERT (c->less != NULL);
+
+	if (c->size == 0)
+		return list_end (&c->list);
+	if (c->max == NULL)
+		c->max = list_max (&c->list, c->less, c->aux);
+	return c->max;
+}
+
+/* Tells C that the key of ELEM, which is in C, has just
+   increased. */
+void
+clist_raise (struct clist *c, struct list_elem *elem) {
+	if (c->less == NULL || c->max == NULL || elem == c->max)
+		return;
+	if (c->less (c->max, elem, c->aux))
+		c->max = elem;
+	else if (!c->less (elem, c->max, c->aux)) {
+		/* A tie: the earlier of the two wins, and we do not know
+		   which that is. */
+		c->max = NULL;
+	}
+}
+
+/* Tells C that the keys of its elements may have changed other
+   than by clist_raise(). */
+void
+clist_invalidate (struct clist *c) {
+	c->max = NULL;
+}
@@ -0,0 +1,171 @@
+#include "radix.h"
+#include "../debug.h"
+#include "threads/palloc.h"
+
+/* Returns the slot within a node of level LEVEL, counting from 0
+   at the top, that KEY goes through. */
+static inline size_t
+slot_of (uint64_t key, int level) {
+	int shift = RADIX_BITS * (RADIX_LEVELS - 1 - level);
+	return (key >> shift) & (RADIX_FANOUT - 1);
+}
+
+/* Initializes R as an empty tree. */
+void
+radix_init (struct radix *r) {
+	r->root = NULL;
+	r->cnt = 0;
+}
+
+/* Frees NODE at level LEVEL and everything below it, calling
+   DESTRUCTOR, if nonnull, on each value.  KEY holds the index
+   bits of the levels above. */
+static void
+destroy_node (void **node, int level, uint64_t key,
+		radix_action_func *destructor, void *aux) {
+	for (size_t i = 0; i < RADIX_FANOUT; i++) {
+		uint64_t k = (key << RADIX_BITS) | i;
+
+		if (node[i] == NULL)
+			continue;
+		if (level == RADIX_LEVELS - 1) {
+			if (destructor != NULL)
+				destructor (k, node[i], aux);
+		} else
+			destroy_node (node[i], level + 1, k, destructor, aux);
+	}
+	palloc_free_page (node);
+}
+
+/* Frees R's nodes, calling DESTRUCTOR, if nonnull, on each value
+   first.  R is left empty. */
+void
+radix_destroy (struct radix *r, radix_action_func *destructor, void *aux) {
+	if (r->root != NULL)
+		destroy_node (r->root, 0, 0, destructor, aux);
+	radix_init (r);
+}
+
+/* Returns the value at index KEY in R, or NULL if there is none. */
+void *
+radix_find (const struct radix *r, uint64_t key) {
+	void **node = r->root;
+
+	ASSERT (key <= RADIX_KEY_MAX);
+
+	for (int level = 0; node != NULL && level < RADIX_LEVELS - 1; level++)
+		node = node[slot_of (key, level)];
+	return node != NULL ? node[slot_of (key, RADIX_LEVELS - 1)] : NULL;
+}
+
+/* Stores VALUE at index KEY in R.  Returns false, leaving R
+   unchanged apart from possibly new empty nodes, if KEY already
+   has a value or a node cannot be allocated. */
+bool
+radix_insert (struct radix *r, uint64_t key, void *value) {
+	void **slot = (void **) &r->root;
+
+	ASSERT (key <= RADIX_KEY_MAX);
+	ASSERT (value != NULL);
+
+	for (int level = 0; level < RADIX_LEVELS; level++) {
+		if (*slot == NULL) {
+			*slot = palloc_get_page (PAL_ZERO);
+			if (*slot == NULL)
+				return false;
+		}
+		slot = &((void **) *slot)[slot_of (key, level)];
+	}
+	if (*slot != NULL)
+		return false;
+	*slot = value;
+	r->cnt++;
+	return true;
+}
+
+/* Removes the value at index KEY from R and returns it, or
+   returns NULL if KEY has no value. */
+void *
+radix_delete (struct radix *r, uint64_t key) {
+	void **node = r->root;
+	void *value;
+
+	ASSERT (key <= RADIX_KEY_MAX);
+
+	for (int level = 0; node != NULL && level < RADIX_LEVELS - 1; level++)
+		node = node[slot_of (key, level)];
+	if (node == NULL)
+		return NULL;
+
+	value = node[slot_of (key, RADIX_LEVELS - 1)];
+	if (value != NULL) {
+		node[slot_of (key, RADIX_LEVELS - 1)] = NULL;
+		r->cnt--;
+	}
+	return value;
+}
+
+/* Replaces the value at index KEY in R by VALUE and returns the
+   old one.  Returns NULL, leaving R unchanged, if KEY has no
+   value. */
+void *
+radix_replace (struct radix *r, uint64_t key, void *value) {
+	void **node = r->root;
+	void *old;
+
+	ASSERT (key <= RADIX_KEY_MAX);
+	ASSERT (value != NULL);
+
+	for (int level = 0; node != NULL && level < RADIX_LEVELS - 1; level++)
+		node = node[slot_of (key, level)];
+	if (node == NULL)
+		return NULL;
+
+	old = node[slot_of (key, RADIX_LEVELS - 1)];
+	if (old != NULL)
+		node[slot_of (key, RADIX_LEVELS - 1)] = value;
+	return old;
+}
+
+/* Walks NODE at level LEVEL for radix_for_each().  KEY holds the
+   index bits of the levels above. */
+static bool
+for_each_node (void **node, int level, uint64_t key,
+		uint64_t first, uint64_t last, radix_action_func *action, void *aux) {
+	int shift = RADIX_BITS * (RADIX_LEVELS - 1 - level);
+	uint64_t base = key << (RADIX_BITS * (RADIX_LEVELS - level));
+	size_t lo = first > base ? slot_of (first, level) : 0;
+	size_t hi = last < base + (((uint64_t) RADIX_FANOUT << shift) - 1)
+		? slot_of (last, level) : RADIX_FANOUT - 1;
+
+	for (size_t i = lo; i <= hi; i++) {
+		uint64_t k = (key << RADIX_BITS) | i;
+
+		if (node[i] == NULL)
+			continue;
+		if (level == RADIX_LEVELS - 1) {
+			if (!action (k, node[i], aux))
+				return false;
+		} else if (!for_each_node (node[i], level + 1, k, first, last,
+					action, aux))
+			return false;
+	}
+	return true;
+}
+
+/* Calls ACTION on each value in R whose index is between FIRST
+   and LAST, inclusive, in ascending order of index.  Stops and
+   returns false as soon as ACTION does; otherwise returns true.
+   ACTION must not insert into R, but it may delete or replace the
+   value it is given. */
+bool
+radix_for_each (const struct radix *r, uint64_t first, uint64_t last,
+		radix_action_func *action, void *aux) {
+	ASSERT (first <= last);
+
+	if (r->root == NULL)
+		return true;
+	if (last > RADIX_KEY_MAX)
+		last = RADIX_KEY_MAX;
+	return for_each_node (r->root, 0, 0, first, last, action, aux);
+}
@@ -0,0 +1,467 @@
+/* Red-black tree.
+
+   See rbtree.h for basic information.  The algorithms are the
+   ones in Cormen, Leiserson, Rivest and Stein, "Introduction to
+   Algorithms", chapter 13, with null pointers for leaves. */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+static void rotate_left (struct rbtree *, struct rb_node *);
+static void rotate_right (struct rbtree *, struct rb_node *);
+static void transplant (struct rbtree *, struct rb_node *, struct rb_node *);
+static void propagate (struct rbtree *, struct rb_node *);
+static void insert_fixup (struct rbtree *, struct rb_node *);
+static void remove_fixup (struct rbtree *, struct rb_node *,
+		struct rb_node *parent);
+
+/* Returns true if N is red.  Leaves are black. */
+static inline bool
+is_red (const struct rb_node *n) {
+	return n != NULL && n->red;
+}
+
+/* Returns the leftmost node in the subtree rooted at N. */
+static struct rb_node *
+leftmost (struct rb_node *n) {
+	while (n->left != NULL)
+		n = n->left;
+	return n;
+}
+
+/* Returns the rightmost node in the subtree rooted at N. */
+static struct rb_node *
+rightmost (struct rb_node *n) {
+	while (n->right != NULL)
+		n = n->right;
+	return n;
+}
+
+/* Initializes T as an empty tree ordered by LESS.  AUGMENT, if
+   non-null, maintains each node's augmented data.  AUX is passed
+   to both. */
+void
+rb_init (struct rbtree *t, rb_less_func *less, rb_augment_func *augment,
+		void *aux) {
+	ASSERT (t != NULL);
+	ASSERT (less != NULL);
+
+	t->root = NULL;
+	t->cnt = 0;
+	t->less = less;
+	t->augment = augment;
+	t->aux = aux;
+}
+
+/* Inserts N into T, after any nodes with equal keys. */
+void
+rb_insert (struct rbtree *t, struct rb_node *n) {
+	struct rb_node *parent = NULL;
+	struct rb_node **link = &t->root;
+
+	ASSERT (n != NULL);
+
+	while (*link != NULL) {
+		parent = *link;
+		link = t->less (n, parent, t->aux) ? &parent->left : &parent->right;
+	}
+	n->parent = parent;
+	n->left = n->right = NULL;
+	n->red = true;
+	*link = n;
+	t->cnt++;
+
+	propagate (t, n);
+	insert_fixup (t, n);
+}
+
+/* Removes N, which must be in T, from T. */
+void
+rb_remove (struct rbtree *t, struct rb_node *n) {
+	struct rb_node *child, *parent;
+	bool removed_red;
+
+	ASSERT (n != NULL);
+
+	if (n->left == NULL || n->right == NULL) {
+		/* N has at most one child, which takes its place. */
+		child = n->left != NULL ? n->left : n->right;
+		parent = n->parent;
+		removed_red = n->red;
+		transplant (t, n, child);
+	} else {
+		/* N's successor, which has no left child, takes its place
+		   and its color, so the color lost is the successor's. */
+		struct rb_node *next = leftmost (n->right);
+
+		removed_red = next->red;
+		child = next->right;
+		if (next->parent == n)
+			parent = next;
+		else {
+			parent = next->parent;
+			transplant (t, next, next->right);
+			next->right = n->right;
+			next->right->parent = next;
+		}
+		transplant (t, n, next);
+		next->left = n->left;
+		next->left->parent = next;
+		next->red = n->red;
+	}
+	t->cnt--;
+
+	/* Every node whose subtree changed is on the path from PARENT
+	   to the root. */
+	propagate (t, parent);
+	if (!removed_red)
+		remove_fixup (t, child, parent);
+}
+
+/* Returns a node in T equal to KEY, or a null pointer if there is
+   none. */
+struct rb_node *
+rb_find (const struct rbtree *t, const struct rb_node *key) {
+	struct rb_node *n = rb_lower_bound (t, key);
+
+	return n != NULL && !t->less (key, n, t->aux) ? n : NULL;
+}
+
+/* Returns the first node in T that is not less than KEY, or a
+   null pointer if there is none. */
+struct rb_node *
+rb_lower_bound (const struct rbtree *t, const struct rb_node *key) {
+	struct rb_node *n = t->root;
+	struct rb_node *found = NULL;
+
+	while (n != NULL)
+		if (t->less (n, key, t->aux))
+			n = n->right;
+		else {
+			found = n;
+			n = n->left;
+		}
+	return found;
+}
+
+/* Returns the first node of T in key order, or a null pointer if T
+   is empty. */
+struct rb_node *
+rb_first (const struct rbtree *t) {
+	return t->root != NULL ? leftmost (t->root) : NULL;
+}
+
+/* Returns the last node of T in key order, or a null pointer if T
+   is empty. */
+struct rb_node *
+rb_last (const struct rbtree *t) {
+	return t->root != NULL ? rightmost (t->root) : NULL;
+}
+
+/* Returns the node after N in key order, or a null pointer if N is
+   the last. */
+struct rb_node *
+rb_next (const struct rb_node *n) {
+	ASSERT (n != NULL);
+
+	if (n->right != NULL)
+		return leftmost (n->right);
+	while (n->parent != NULL && n == n->parent->right)
+		n = n->parent;
+	return n->parent;
+}
+
+/* Returns the node before N in key order, or a null pointer if N
+   is the first. */
+struct rb_node *
+rb_prev (const struct rb_node *n) {
+	ASSERT (n != NULL);
+
+	if (n->left != NULL)
+		return rightmost (n->left);
+	while (n->parent != NULL && n == n->parent->left)
+		n = n->parent;
+	return n->parent;
+}
+
+/* Makes X's right child take X's place in T, with X as its left
+   child. */
+static void
+rotate_left (struct rbtree *t, struct rb_node *x) {
+	struct rb_node *y = x->right;
+
+	x->right = y->left;
+	if (y->left != NULL)
+		y->left->parent = x;
+	transplant (t, x, y);
+	y->left = x;
+	x->parent = y;
+
+	if (t->augment != NULL) {
+		t->augment (x, t->aux);
+		t->augment (y, t->aux);
+	}
+}
+
+/* Makes X's left child take X's place in T, with X as its right
+   child. */
+static void
+rotate_right (struct rbtree *t, struct rb_node *x) {
+	struct rb_node *y = x->left;
+
+	x->left = y->right;
+	if (y->right != NULL)
+		y->right->parent = x;
+	transplant (t, x, y);
+	y->right = x;
+	x->parent = y;
+
+	if (t->augment != NULL) {
+		t->augment (x, t->aux);
+		t->augment (y, t->aux);
+	}
+}
+
+/* Links N, which may be null, into OLD's place under OLD's
+   parent in T.  OLD's own links are left alone. */
+static void
+transplant (struct rbtree *t, struct rb_node *old, struct rb_node *n) {
+	if (old->parent == NULL)
+		t->root = n;
+	else if (old == old->parent->left)
+		old->parent->left = n;
+	else
+		old->parent->right = n;
+	if (n != NULL)
+		n->parent = old->parent;
+}
+
+/* Recomputes the augmented data of N and each of its ancestors in
+   T, if T is augmented. */
+static void
+propagate (struct rbtree *t, struct rb_node *n) {
+	if (t->augment != NULL)
+		for (; n != NULL; n = n->parent)
+			t->augment (n, t->aux);
+}
+
+/* Restores the red-black properties of T after inserting N as a
+   red leaf. */
+static void
+insert_fixup (struct rbtree *t, struct rb_node *n) {
+	while (is_red (n->parent)) {
+		struct rb_node *parent = n->parent;
+		struct rb_node *grand = parent->parent;
+
+		if (parent == grand->left) {
+			struct rb_node *uncle = grand->right;
+
+			if (is_red (uncle)) {
+				parent->red = uncle->red = false;
+				grand->red = true;
+				n = grand;
+				continue;
+			}
+			if (n == parent->right) {
+				n = parent;
+				rotate_left (t, n);
+				parent = n->parent;
+			}
+			parent->red = false;
+			grand->red = true;
+			rotate_right (t, grand);
+		} else {
+			struct rb_node *uncle = grand->left;
+
+			if (is_red (uncle)) {
+				parent->red = uncle->red = false;
+				grand->red = true;
+				n = grand;
+				continue;
+			}
+			if (n == parent->left) {
+				n = parent;
+				rotate_right (t, n);
+				parent = n->parent;
+			}
+			parent->red = false;
+			grand->red = true;
+			rotate_left (t, grand);
+		}
+	}
+	t->root->red = false;
+}
+
+/* Restores the red-black properties of T after a black node was
+   removed from above N, which may be null, leaving N's subtree one
+   black node short.  PARENT is N's parent. */
+static void
+remove_fixup (struct rbtree *t, struct rb_node *n, struct rb_node *parent) {
+	while (n != t->root && !is_red (n)) {
+		if (n == parent->left) {
+			struct rb_node *sibling = parent->right;
+
+			if (is_red (sibling)) {
+				sibling->red = false;
+				parent->red = true;
+				rotate_left (t, parent);
+				sibling = parent->right;
+			}
+			if (!is_red (sibling->left) && !is_red (sibling->right)) {
+				sibling->red = true;
+				n = parent;
+				parent = n->parent;
+				continue;
+			}
+			if (!is_red (sibling->right)) {
+				sibling->left->red = false;
+				sibling->red = true;
+				rotate_right (t, sibling);
+				sibling = parent->right;
+			}
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->right->red = false;
+			rotate_left (t, parent);
+		} else {
+			struct rb_node *sibling = parent->left;
+
+			if (is_red (sibling)) {
+				sibling->red = false;
+				parent->red = true;
+				rotate_right (t, parent);
+				sibling = parent->left;
+			}
+			if (!is_red (sibling->left) && !is_red (sibling->right)) {
+				sibling->red = true;
+				n = parent;
+				parent = n->parent;
+				continue;
+			}
+			if (!is_red (sibling->left)) {
+				sibling->right->red = false;
+				sibling->red = true;
+				rotate_left (t, sibling);
+				sibling = parent->left;
+			}
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->left->red = false;
+			rotate_right (t, parent);
+		}
+		n = t->root;
+	}
+	if (n != NULL)
+		n->red = false;
+}
+
+/* Interval tree. */
+
+#define itree_entry(RB_NODE) rb_entry (RB_NODE, struct itree_node, rb)
+
+/* Orders interval tree nodes by start. */
+static bool
+itree_less (const struct rb_node *a, const struct rb_node *b,
+		void *aux UNUSED) {
+	return itree_entry (a)->start < itree_entry (b)->start;
+}
+
+/* Recomputes N's greatest end in its subtree. */
+static void
+itree_augment (struct rb_node *n_, void *aux UNUSED) {
+	struct itree_node *n = itree_entry (n_);
+
+	n->max_end = n->end;
+	if (n_->left != NULL && itree_entry (n_->left)->max_end > n->max_end)
+		n->max_end = itree_entry (n_->left)->max_end;
+	if (n_->right != NULL && itree_entry (n_->right)->max_end > n->max_end)
+		n->max_end = itree_entry (n_->right)->max_end;
+}
+
+/* Returns the first node, by start, in the subtree rooted at N
+   that overlaps [START, END), or a null pointer if there is
+   none. */
+static struct itree_node *
+subtree_first (struct itree_node *n, uint64_t start, uint64_t end) {
+	for (;;) {
+		/* Some range on the left ends after START.  If it does
+		   not overlap, it starts at or after END, and so do N and
+		   everything on its right. */
+		if (n->rb.left != NULL && itree_entry (n->rb.left)->max_end > start) {
+			n = itree_entry (n->rb.left);
+			continue;
+		}
+		if (n->start >= end)
+			return NULL;
+		if (n->end > start)
+			return n;
+		if (n->rb.right == NULL
+				|| itree_entry (n->rb.right)->max_end <= start)
+			return NULL;
+		n = itree_entry (n->rb.right);
+	}
+}
+
+/* Initializes T as an empty interval tree. */
+void
+itree_init (struct itree *t) {
+	rb_init (&t->rb, itree_less, itree_augment, NULL);
+}
+
+/* Inserts N, whose START and END are set, with START < END, into
+   T. */
+void
+itree_insert (struct itree *t, struct itree_node *n) {
+	ASSERT (n->start < n->end);
+
+	n->max_end = n->end;
+	rb_insert (&t->rb, &n->rb);
+}
+
+/* Removes N, which must be in T, from T. */
+void
+itree_remove (struct itree *t, struct itree_node *n) {
+	rb_remove (&t->rb, &n->rb);
+}
+
+/* Returns the first node, by start, in T that overlaps [START,
+   END), or a null pointer if there is none. */
+struct itree_node *
+itree_first (const struct itree *t, uint64_t start, uint64_t end) {
+	struct rb_node *root = t->rb.root;
+
+	if (root == NULL || start >= end || itree_entry (root)->max_end <= start)
+		return NULL;
+	return subtree_first (itree_entry (root), start, end);
+}
+
+/* Returns the node after N, by start, that overlaps [START, END),
+   or a null pointer if there is none.  N must overlap [START,
+   END), as itree_first() and itree_next() return. */
+struct itree_node *
+itree_next (const struct itree_node *n, uint64_t start, uint64_t end) {
+	const struct rb_node *rb = &n->rb;
+
+	for (;;) {
+		const struct rb_node *prev;
+
+		/* Ranges after N in its right subtree come first. */
+		if (rb->right != NULL && itree_entry (rb->right)->max_end > start)
+			return subtree_first (itree_entry (rb->right), start, end);
+
+		/* Climb until coming up from a left child; that parent is
+		   next in order. */
+		do {
+			prev = rb;
+			rb = rb->parent;
+			if (rb == NULL)
+				return NULL;
+		} while (prev == rb->right);
+
+		n = itree_entry (rb);
+		if (n->start >= end)
+			return NULL;
+		if (n->end > start)
+			return (struct itree_node *) n;
+	}
+}
@@ -0,0 +1,297 @@
+/* Open-addressing hash table.
+
+   See rhash.h for basic information. */
+
+#include "rhash.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Slots in the smallest table. */
+#define MIN_SLOTS 8
+
+static struct rhash_slot *find_slot (const struct rhash *, const void *,
+		uint64_t hash);
+static void place (struct rhash *, uint64_t hash, void *);
+static bool resize (struct rhash *, size_t slot_cnt);
+
+/* Initializes hash table R to compute hash values using HASH and
+   compare elements using EQUAL, given auxiliary data AUX.
+   Returns false if memory runs out. */
+bool
+rhash_init (struct rhash *r,
+		rhash_hash_func *hash, rhash_equal_func *equal, void *aux) {
+	r->elem_cnt = 0;
+	r->slot_cnt = MIN_SLOTS;
+	r->slots = calloc (r->slot_cnt, sizeof *r->slots);
+	r->hash = hash;
+	r->equal = equal;
+	r->aux = aux;
+	return r->slots != NULL;
+}
+
+/* Removes all the elements from R.
+
+   If DESTRUCTOR is non-null, then it is called for each element
+   in the table, which it may free.  Modifying R from DESTRUCTOR
+   yields undefined behavior. */
+void
+rhash_clear (struct rhash *r, rhash_action_func *destructor) {
+	size_t i;
+
+	for (i = 0; i < r->slot_cnt; i++) {
+		struct rhash_slot *s = &r->slots[i];
+
+		if (s->elem != NULL && destructor != NULL)
+			destructor (s->elem, r->aux);
+		s->elem = NULL;
+	}
+	r->elem_cnt = 0;
+}
+
+/* Destroys hash table R, first calling DESTRUCTOR, if non-null,
+   for each element as rhash_clear() does. */
+void
+rhash_destroy (struct rhash *r, rhash_action_func *destructor) {
+	if (destructor != NULL)
+		rhash_clear (r, destructor);
+	free (r->slots);
+}
+
+/* Grows R, if need be, so that CNT more elements can be inserted
+   without growing it again.  Returns false if memory runs out.
+   A caller that cannot back out of an insertion reserves room
+   for it first. */
+bool
+rhash_reserve (struct rhash *r, size_t cnt) {
+	size_t slot_cnt = r->slot_cnt;
+
+	/* Keep the table at most 7/8 full. */
+	while (slot_cnt - slot_cnt / 8 < r->elem_cnt + cnt)
+		slot_cnt *= 2;
+	return slot_cnt == r->slot_cnt || resize (r, slot_cnt);
+}
+
+/* Inserts NEW into hash table R and returns a null pointer, if
+   no equal element is already in the table.
+   If an equal element is already in the table, returns it
+   without inserting NEW.  If R is full and memory runs out
+   growing it, returns NEW without inserting it. */
+void *
+rhash_insert (struct rhash *r, void *new) {
+	uint64_t hash;
+	struct rhash_slot *old;
+
+	ASSERT (new != NULL);
+
+	hash = r->hash (new, r->aux);
+	old = find_slot (r, new, hash);
+	if (old != NULL)
+		return old->elem;
+
+	/* At least one slot stays empty. */
+	if (!rhash_reserve (r, 1) && r->elem_cnt + 1 >= r->slot_cnt)
+		return new;
+	place (r, hash, new);
+	return NULL;
+}
+
+/* Inserts NEW into hash table R, replacing any equal element
+   already in the table, which is returned.  Returns NEW without
+   inserting it in the same case as rhash_insert(). */
+void *
+rhash_replace (struct rhash *r, void *new) {
+	uint64_t hash;
+	struct rhash_slot *s;
+
+	ASSERT (new != NULL);
+
+	hash = r->hash (new, r->aux);
+	s = find_slot (r, new, hash);
+	if (s != NULL) {
+		void *old = s->elem;
+
+		/* Equal elements hash alike, so NEW belongs in the same
+		   slot. */
+		s->elem = new;
+		return old;
+	}
+
+	if (!rhash_reserve (r, 1) && r->elem_cnt + 1 >= r->slot_cnt)
+		return new;
+	place (r, hash, new);
+	return NULL;
+}
+
+/* Finds and returns an element equal to E in hash table R, or a
+   null pointer if no equal element exists in the table. */
+void *
+rhash_find (const struct rhash *r, const void *e) {
+	struct rhash_slot *s = find_slot (r, e, r->hash (e, r->aux));
+
+	return s != NULL ? s->elem : NULL;
+}
+
+/* Finds, removes, and returns an element equal to E in hash
+   table R.  Returns a null pointer if no equal element existed
+   in the table. */
+void *
+rhash_delete (struct rhash *r, const void *e) {
+	struct rhash_slot *s = find_slot (r, e, r->hash (e, r->aux));
+	size_t mask = r->slot_cnt - 1;
+	size_t idx;
+	void *found;
+
+	if (s == NULL)
+		return NULL;
+	found = s->elem;
+
+	/* Shift back the run that follows, up to an empty slot or an
+	   element already in its home slot. */
+	for (idx = s - r->slots; ; idx = (idx + 1) & mask) {
+		struct rhash_slot *next = &r->slots[(idx + 1) & mask];
+
+		if (next->elem == NULL || (next->hash & mask) == ((idx + 1) & mask))
+			break;
+		r->slots[idx] = *next;
+	}
+	r->slots[idx].elem = NULL;
+	r->elem_cnt--;
+
+	/* Shrink below 1/8 full.  If memory runs out, the table
+	   just stays larger than it needs to be. */
+	if (r->slot_cnt > MIN_SLOTS && r->elem_cnt < r->slot_cnt / 8)
+		resize (r, r->slot_cnt / 2);
+	return found;
+}
+
+/* Calls ACTION for each element in hash table R in arbitrary
+   order.  Modifying R from ACTION yields undefined behavior. */
+void
+rhash_apply (struct rhash *r, rhash_action_func *action) {
+	size_t i;
+
+	ASSERT (action != NULL);
+
+	for (i = 0; i < r->slot_cnt; i++)
+		if (r->slots[i].elem != NULL)
+			action (r->slots[i].elem, r->aux);
+}
+
+/* Initializes I for iterating hash table R.
+
+   Iteration idiom:
+
+   struct rhash_iterator i;
+   struct foo *f;
+
+   rhash_first (&i, r);
+   while ((f = rhash_next (&i)) != NULL)
+   {
+   ...do something with f...
+   }
+
+   Modifying R during iteration invalidates all iterators. */
+void
+rhash_first (struct rhash_iterator *i, struct rhash *r) {
+	ASSERT (i != NULL);
+	ASSERT (r != NULL);
+
+	i->rhash = r;
+	i->idx = 0;
+}
+
+/* Returns the next element in the iteration, or a null pointer if
+   no elements are left.  Elements are returned in arbitrary
+   order. */
+void *
+rhash_next (struct rhash_iterator *i) {
+	ASSERT (i != NULL);
+
+	while (i->idx < i->rhash->slot_cnt) {
+		void *elem = i->rhash->slots[i->idx++].elem;
+
+		if (elem != NULL)
+			return elem;
+	}
+	return NULL;
+}
+
+/* Returns the slot in R that holds an element equal to E, whose
+   hash value is HASH, or a null pointer if there is none. */
+static struct rhash_slot *
+find_slot (const struct rhash *r, const void *e, uint64_t hash) {
+	size_t mask = r->slot_cnt - 1;
+	size_t idx = hash & mask;
+	size_t dist;
+
+	for (dist = 0; ; dist++, idx = (idx + 1) & mask) {
+		struct rhash_slot *s = &r->slots[idx];
+
+		/* E would have displaced any resident nearer its home
+		   slot than E is to its own, so past one E is absent. */
+		if (s->elem == NULL || ((idx - s->hash) & mask) < dist)
+			return NULL;
+		if (s->hash == hash && r->equal (s->elem, e, r->aux))
+			return s;
+	}
+}
+
+/* Puts ELEM, whose hash value is HASH, into R, which must have an
+   empty slot and no element equal to ELEM. */
+static void
+place (struct rhash *r, uint64_t hash, void *elem) {
+	size_t mask = r->slot_cnt - 1;
+	size_t idx = hash & mask;
+	size_t dist;
+
+	for (dist = 0; ; dist++, idx = (idx + 1) & mask) {
+		struct rhash_slot *s = &r->slots[idx];
+		size_t resident;
+
+		if (s->elem == NULL) {
+			s->hash = hash;
+			s->elem = elem;
+			break;
+		}
+
+		/* Take the slot from a resident nearer its home, and
+		   carry the resident on instead. */
+		resident = (idx - s->hash) & mask;
+		if (resident < dist) {
+			struct rhash_slot carry = *s;
+
+			s->hash = hash;
+			s->elem = elem;
+			hash = carry.hash;
+			elem = carry.elem;
+			dist = resident;
+		}
+	}
+	r->elem_cnt++;
+}
+
+/* Moves the elements of R into a new array of SLOT_CNT slots,
+   reusing their stored hash values.  Returns false, leaving R
+   as it was, if memory runs out. */
+static bool
+resize (struct rhash *r, size_t slot_cnt) {
+	struct rhash_slot *old_slots = r->slots;
+	size_t old_slot_cnt = r->slot_cnt;
+	struct rhash_slot *new_slots;
+	size_t i;
+
+	ASSERT (slot_cnt >= MIN_SLOTS && (slot_cnt & (slot_cnt - 1)) == 0);
+
+	new_slots = calloc (slot_cnt, sizeof *new_slots);
+	if (new_slots == NULL)
+		return false;
+
+	r->slots = new_slots;
+	r->slot_cnt = slot_cnt;
+	r->elem_cnt = 0;
+	for (i = 0; i < old_slot_cnt; i++)
+		if (old_slots[i].elem != NULL)
+			place (r, old_slots[i].hash, old_slots[i].elem);
+	free (old_slots);
+	return true;
+}
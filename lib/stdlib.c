@@ -3,6 +3,7 @@
 #include <random.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Converts a string representation of a signed decimal integer
    in S into an `int', which is returned. */
@@ -52,7 +53,7 @@ compare_thunk (const void *a, const void *b, void *aux)
    using COMPARE.  When COMPARE is passed a pair of elements A
    and B, respectively, it must return a strcmp()-type result,
    i.e. less than zero if A < B, zero if A == B, greater than
-   zero if A > B.  Runs in O(n lg n) time and O(1) space in
+   zero if A > B.  Runs in O(n lg n) time and O(lg n) space in
    CNT. */
 void
 qsort (void *array, size_t cnt, size_t size,
@@ -61,21 +62,44 @@ qsort (void *array, size_t cnt, size_t size,
   sort (array, cnt, size, compare_thunk, &compare);
 }
 
-/* Swaps elements with 1-based indexes A_IDX and B_IDX in ARRAY
-   with elements of SIZE bytes each. */
+/* Partitions with fewer elements than this are insertion
+   sorted. */
+#define INSERTION_SORT_MAX 16
+
+/* Swaps the SIZE-byte elements at A and B, a word at a time if
+   both elements and SIZE are word-aligned. */
 static void
-do_swap (unsigned char *array, size_t a_idx, size_t b_idx, size_t size)
+swap_elems (unsigned char *a, unsigned char *b, size_t size)
 {
-  unsigned char *a = array + (a_idx - 1) * size;
-  unsigned char *b = array + (b_idx - 1) * size;
   size_t i;
 
-  for (i = 0; i < size; i++)
+  if ((((uintptr_t) a | (uintptr_t) b | size) % sizeof (unsigned long)) == 0)
     {
-      unsigned char t = a[i];
-      a[i] = b[i];
-      b[i] = t;
+      unsigned long *wa = (unsigned long *) a;
+      unsigned long *wb = (unsigned long *) b;
+
+      for (i = 0; i < size / sizeof (unsigned long); i++)
+        {
+          unsigned long t = wa[i];
+          wa[i] = wb[i];
+          wb[i] = t;
+        }
     }
+  else
+    for (i = 0; i < size; i++)
+      {
+        unsigned char t = a[i];
+        a[i] = b[i];
+        b[i] = t;
+      }
+}
+
+/* Swaps elements with 1-based indexes A_IDX and B_IDX in ARRAY
+   with elements of SIZE bytes each. */
+static void
+do_swap (unsigned char *array, size_t a_idx, size_t b_idx, size_t size)
+{
+  swap_elems (array + (a_idx - 1) * size, array + (b_idx - 1) * size, size);
 }
 
 /* Compares elements with 1-based indexes A_IDX and B_IDX in
@@ -122,33 +146,159 @@ heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
     }
 }
 
+/* Heapsorts ARRAY, which contains CNT elements of SIZE bytes
+   each, using COMPARE to compare elements, passing AUX as
+   auxiliary data. */
+static void
+heap_sort (unsigned char *array, size_t cnt, size_t size,
+           int (*compare) (const void *, const void *, void *aux),
+           void *aux) 
+{
+  size_t i;
+
+  /* Build a heap. */
+  for (i = cnt / 2; i > 0; i--)
+    heapify (array, i, cnt, size, compare, aux);
+
+  /* Sort the heap. */
+  for (i = cnt; i > 1; i--) 
+    {
+      do_swap (array, 1, i, size);
+      heapify (array, 1, i - 1, size, compare, aux); 
+    }
+}
+
+/* Insertion sorts ARRAY, which contains CNT elements of SIZE
+   bytes each, using COMPARE to compare elements, passing AUX as
+   auxiliary data. */
+static void
+insertion_sort (unsigned char *array, size_t cnt, size_t size,
+                int (*compare) (const void *, const void *, void *aux),
+                void *aux) 
+{
+  size_t i, j;
+
+  for (i = 1; i < cnt; i++)
+    for (j = i; j > 0; j--)
+      {
+        unsigned char *a = array + (j - 1) * size;
+        unsigned char *b = a + size;
+
+        if (compare (a, b, aux) <= 0)
+          break;
+        swap_elems (a, b, size);
+      }
+}
+
+/* Moves the median of the first, middle, and last of the CNT
+   elements of SIZE bytes each in ARRAY to the front, using
+   COMPARE to compare elements, passing AUX as auxiliary data,
+   and partitions ARRAY around it.  Returns the pivot's final
+   0-based index: elements before it compare less than or equal
+   to it, and elements after it greater than or equal. */
+static size_t
+partition (unsigned char *array, size_t cnt, size_t size,
+           int (*compare) (const void *, const void *, void *aux),
+           void *aux) 
+{
+  unsigned char *first = array;
+  unsigned char *middle = array + cnt / 2 * size;
+  unsigned char *last = array + (cnt - 1) * size;
+  size_t i, j;
+
+  /* Order the three samples, then use the middle one as pivot. */
+  if (compare (middle, first, aux) < 0)
+    swap_elems (middle, first, size);
+  if (compare (last, middle, aux) < 0)
+    {
+      swap_elems (last, middle, size);
+      if (compare (middle, first, aux) < 0)
+        swap_elems (middle, first, size);
+    }
+  swap_elems (first, middle, size);
+
+  /* Scan inward from both ends.  Both scans stop at elements equal
+     to the pivot, which splits runs of equal keys evenly. */
+  i = 1;
+  j = cnt - 1;
+  for (;;)
+    {
+      while (i <= j && compare (array + i * size, first, aux) < 0)
+        i++;
+      while (i <= j && compare (array + j * size, first, aux) > 0)
+        j--;
+      if (i >= j)
+        break;
+      swap_elems (array + i * size, array + j * size, size);
+      i++;
+      j--;
+    }
+  swap_elems (first, array + j * size, size);
+  return j;
+}
+
+/* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
+   using COMPARE to compare elements, passing AUX as auxiliary
+   data.  Quicksorts until DEPTH partitioning steps deep, then
+   heapsorts whatever partition is left, so that adversarial
+   input cannot drive it quadratic. */
+static void
+intro_sort (unsigned char *array, size_t cnt, size_t size,
+            int (*compare) (const void *, const void *, void *aux),
+            void *aux, int depth) 
+{
+  while (cnt >= INSERTION_SORT_MAX)
+    {
+      size_t pivot, right_cnt;
+
+      if (depth-- == 0)
+        {
+          heap_sort (array, cnt, size, compare, aux);
+          return;
+        }
+
+      /* Recurse into the smaller side and loop on the larger, to
+         bound the stack at lg CNT frames. */
+      pivot = partition (array, cnt, size, compare, aux);
+      right_cnt = cnt - pivot - 1;
+      if (pivot < right_cnt)
+        {
+          intro_sort (array, pivot, size, compare, aux, depth);
+          array += (pivot + 1) * size;
+          cnt = right_cnt;
+        }
+      else
+        {
+          intro_sort (array + (pivot + 1) * size, right_cnt, size,
+                      compare, aux, depth);
+          cnt = pivot;
+        }
+    }
+  insertion_sort (array, cnt, size, compare, aux);
+}
+
 /* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
    using COMPARE to compare elements, passing AUX as auxiliary
    data.  When COMPARE is passed a pair of elements A and B,
    respectively, it must return a strcmp()-type result, i.e. less
    than zero if A < B, zero if A == B, greater than zero if A >
-   B.  Runs in O(n lg n) time and O(1) space in CNT. */
+   B.  Runs in O(n lg n) time and O(lg n) space in CNT. */
 void
 sort (void *array, size_t cnt, size_t size,
       int (*compare) (const void *, const void *, void *aux),
       void *aux) 
 {
-  size_t i;
+  int depth = 0;
+  size_t n;
 
   ASSERT (array != NULL || cnt == 0);
   ASSERT (compare != NULL);
   ASSERT (size > 0);
 
-  /* Build a heap. */
-  for (i = cnt / 2; i > 0; i--)
-    heapify (array, i, cnt, size, compare, aux);
-
-  /* Sort the heap. */
-  for (i = cnt; i > 1; i--) 
-    {
-      do_swap (array, 1, i, size);
-      heapify (array, 1, i - 1, size, compare, aux); 
-    }
+  /* Allow 2 lg CNT levels of partitioning. */
+  for (n = cnt; n > 1; n /= 2)
+    depth += 2;
+  intro_sort (array, cnt, size, compare, aux, depth);
 }
 
 /* Searches ARRAY, which contains CNT elements of SIZE bytes
@@ -1,5 +1,31 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Blocks of at least this many bytes are moved with rep movsb or
+   rep stosb on CPUs with ERMS (enhanced rep movsb/stosb), whose
+   microcode beats any loop there.  Smaller ones, and all of them
+   on other CPUs, go a word at a time. */
+#define REP_MIN 512
+
+/* CPUID leaf 7, EBX: enhanced rep movsb/stosb. */
+#define CPUID_7_EBX_ERMS (1 << 9)
+
+/* A word that may sit at any address and alias any type.  x86-64
+   loads and stores it unaligned at little or no cost. */
+typedef uint64_t __attribute__ ((__may_alias__, __aligned__ (1))) word_t;
+
+/* A word with every byte 0x01, and one with every byte 0x80. */
+#define ONES ((uint64_t) 0x0101010101010101)
+#define HIGHS ((uint64_t) 0x8080808080808080)
+
+static bool has_erms (void);
+static uint64_t zero_bytes (uint64_t);
+static size_t first_byte (uint64_t);
+static uint64_t low_bytes (size_t);
+static void copy_forward (unsigned char *, const unsigned char *, size_t);
+static void copy_backward (unsigned char *, const unsigned char *, size_t);
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -11,8 +37,11 @@ memcpy (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = *src++;
+	if (size >= REP_MIN && has_erms ())
+		__asm __volatile ("rep movsb"
+				: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+	else
+		copy_forward (dst, src, size);
 
 	return dst_;
 }
@@ -27,17 +56,108 @@ memmove (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	if (dst < src) {
-		while (size-- > 0)
-			*dst++ = *src++;
-	} else {
-		dst += size;
-		src += size;
-		while (size-- > 0)
-			*--dst = *--src;
+	/* Each direction reads every word before it can be
+	   overwritten. */
+	if (dst < src)
+		copy_forward (dst, src, size);
+	else
+		copy_backward (dst, src, size);
+
+	return dst_;
+}
+
+/* Copies SIZE bytes from SRC to DST, first to last, a word at a
+   time once DST is aligned, so that no store straddles two words.
+   DST may overlap SRC from below. */
+static void
+copy_forward (unsigned char *dst, const unsigned char *src, size_t size) {
+	for (; size > 0 && (uintptr_t) dst % sizeof (word_t) != 0; size--)
+		*dst++ = *src++;
+	for (; size >= 4 * sizeof (word_t); size -= 4 * sizeof (word_t)) {
+		((word_t *) dst)[0] = ((const word_t *) src)[0];
+		((word_t *) dst)[1] = ((const word_t *) src)[1];
+		((word_t *) dst)[2] = ((const word_t *) src)[2];
+		((word_t *) dst)[3] = ((const word_t *) src)[3];
+		dst += 4 * sizeof (word_t);
+		src += 4 * sizeof (word_t);
+	}
+	for (; size >= sizeof (word_t); size -= sizeof (word_t)) {
+		*(word_t *) dst = *(const word_t *) src;
+		dst += sizeof (word_t);
+		src += sizeof (word_t);
+	}
+	while (size-- > 0)
+		*dst++ = *src++;
+}
+
+/* Copies SIZE bytes from SRC to DST, last to first, as
+   copy_forward() does the other way.  DST may overlap SRC from
+   above. */
+static void
+copy_backward (unsigned char *dst, const unsigned char *src, size_t size) {
+	dst += size;
+	src += size;
+	for (; size > 0 && (uintptr_t) dst % sizeof (word_t) != 0; size--)
+		*--dst = *--src;
+	for (; size >= 4 * sizeof (word_t); size -= 4 * sizeof (word_t)) {
+		dst -= 4 * sizeof (word_t);
+		src -= 4 * sizeof (word_t);
+		((word_t *) dst)[3] = ((const word_t *) src)[3];
+		((word_t *) dst)[2] = ((const word_t *) src)[2];
+		((word_t *) dst)[1] = ((const word_t *) src)[1];
+		((word_t *) dst)[0] = ((const word_t *) src)[0];
+	}
+	for (; size >= sizeof (word_t); size -= sizeof (word_t)) {
+		dst -= sizeof (word_t);
+		src -= sizeof (word_t);
+		*(word_t *) dst = *(const word_t *) src;
+	}
+	while (size-- > 0)
+		*--dst = *--src;
+}
+
+/* Returns true if the CPU has ERMS.  CPUID runs once; threads
+   that race to run it first all store the same answer. */
+static bool
+has_erms (void) {
+	static int erms = -1;               /* 1 or 0, once known. */
+
+	if (erms < 0) {
+		uint32_t max, ebx = 0;
+
+		__asm __volatile ("cpuid"
+				: "=a" (max) : "a" (0), "c" (0) : "ebx", "edx");
+		if (max >= 7)
+			__asm __volatile ("cpuid"
+					: "=b" (ebx) : "a" (7), "c" (0) : "edx");
+		erms = (ebx & CPUID_7_EBX_ERMS) != 0;
 	}
+	return erms;
+}
+
+/* Returns a word with the high bit set in each byte that is zero
+   in W, and perhaps in some bytes above the first zero one, and
+   every other bit clear.  So W has a zero byte iff the result is
+   nonzero, and its lowest set bit marks the first one. */
+static inline uint64_t
+zero_bytes (uint64_t w) {
+	return (w - ONES) & ~w & HIGHS;
+}
+
+/* Returns the offset of the byte whose high bit is the lowest set
+   bit of FOUND, which must be nonzero.  x86-64 is little-endian,
+   so that is the byte at the lowest address. */
+static inline size_t
+first_byte (uint64_t found) {
+	return __builtin_ctzll (found) / 8;
+}
 
-	return dst;
+/* Returns a word whose first N bytes are 0xff and the rest zero,
+   for masking off the bytes before a string in its first word.
+   N must be less than sizeof (word_t). */
+static inline uint64_t
+low_bytes (size_t n) {
+	return ~(~(uint64_t) 0 << n * 8);
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -52,6 +172,13 @@ memcmp (const void *a_, const void *b_, size_t size) {
 	ASSERT (a != NULL || size == 0);
 	ASSERT (b != NULL || size == 0);
 
+	/* Skip the equal words, then find the byte that differs. */
+	for (; size >= sizeof (word_t); size -= sizeof (word_t)) {
+		if (*(const word_t *) a != *(const word_t *) b)
+			break;
+		a += sizeof (word_t);
+		b += sizeof (word_t);
+	}
 	for (; size-- > 0; a++, b++)
 		if (*a != *b)
 			return *a > *b ? +1 : -1;
@@ -81,38 +208,60 @@ strcmp (const char *a_, const char *b_) {
 
 /* Returns a pointer to the first occurrence of CH in the first
    SIZE bytes starting at BLOCK.  Returns a null pointer if CH
-   does not occur in BLOCK. */
+   does not occur in BLOCK.
+
+   Reads BLOCK an aligned word at a time.  The first and last
+   words may take in bytes outside BLOCK, but an aligned word
+   never straddles two pages, so those reads cannot fault. */
 void *
 memchr (const void *block_, int ch_, size_t size) {
 	const unsigned char *block = block_;
-	unsigned char ch = ch_;
+	const unsigned char *end = block + size;
+	uint64_t pattern = ONES * (unsigned char) ch_;
+	size_t ofs = (uintptr_t) block % sizeof (word_t);
+	const word_t *w = (const word_t *) (block - ofs);
+	uint64_t found;
 
 	ASSERT (block != NULL || size == 0);
 
-	for (; size-- > 0; block++)
-		if (*block == ch)
-			return (void *) block;
+	if (size == 0)
+		return NULL;
 
-	return NULL;
+	/* Bytes before BLOCK in its first word never match. */
+	found = zero_bytes ((*w ^ pattern) | low_bytes (ofs));
+	while (found == 0) {
+		if ((const unsigned char *) ++w >= end)
+			return NULL;
+		found = zero_bytes (*w ^ pattern);
+	}
+	block = (const unsigned char *) w + first_byte (found);
+	return block < end ? (void *) block : NULL;
 }
 
 /* Finds and returns the first occurrence of C in STRING, or a
    null pointer if C does not appear in STRING.  If C == '\0'
    then returns a pointer to the null terminator at the end of
-   STRING. */
+   STRING.  Reads STRING an aligned word at a time, as memchr()
+   does. */
 char *
 strchr (const char *string, int c_) {
 	char c = c_;
+	uint64_t pattern = ONES * (unsigned char) c;
+	size_t ofs = (uintptr_t) string % sizeof (word_t);
+	const word_t *w = (const word_t *) (string - ofs);
+	uint64_t found;
 
 	ASSERT (string);
 
-	for (;;)
-		if (*string == c)
-			return (char *) string;
-		else if (*string == '\0')
-			return NULL;
-		else
-			string++;
+	/* Stop at the first byte that is C or the null terminator. */
+	found = zero_bytes (*w | low_bytes (ofs))
+		| zero_bytes ((*w ^ pattern) | low_bytes (ofs));
+	while (found == 0) {
+		w++;
+		found = zero_bytes (*w) | zero_bytes (*w ^ pattern);
+	}
+	string = (const char *) w + first_byte (found);
+	return *string == c ? (char *) string : NULL;
 }
 
 /* Returns the length of the initial substring of STRING that
@@ -257,25 +406,49 @@ strtok_r (char *s, const char *delimiters, char **save_ptr) {
 void *
 memset (void *dst_, int value, size_t size) {
 	unsigned char *dst = dst_;
+	word_t word = (unsigned char) value * 0x0101010101010101ULL;
 
 	ASSERT (dst != NULL || size == 0);
 
+	if (size >= REP_MIN && has_erms ()) {
+		__asm __volatile ("rep stosb"
+				: "+D" (dst), "+c" (size) : "a" (value) : "memory");
+		return dst_;
+	}
+
+	for (; size > 0 && (uintptr_t) dst % sizeof (word_t) != 0; size--)
+		*dst++ = value;
+	for (; size >= 4 * sizeof (word_t); size -= 4 * sizeof (word_t)) {
+		((word_t *) dst)[0] = word;
+		((word_t *) dst)[1] = word;
+		((word_t *) dst)[2] = word;
+		((word_t *) dst)[3] = word;
+		dst += 4 * sizeof (word_t);
+	}
+	for (; size >= sizeof (word_t); size -= sizeof (word_t)) {
+		*(word_t *) dst = word;
+		dst += sizeof (word_t);
+	}
 	while (size-- > 0)
 		*dst++ = value;
 
 	return dst_;
 }
 
-/* Returns the length of STRING. */
+/* Returns the length of STRING.  Reads STRING an aligned word at
+   a time, as memchr() does. */
 size_t
 strlen (const char *string) {
-	const char *p;
+	size_t ofs = (uintptr_t) string % sizeof (word_t);
+	const word_t *w = (const word_t *) (string - ofs);
+	uint64_t found;
 
 	ASSERT (string);
 
-	for (p = string; *p != '\0'; p++)
-		continue;
-	return p - string;
+	found = zero_bytes (*w | low_bytes (ofs));
+	while (found == 0)
+		found = zero_bytes (*++w);
+	return (const char *) w + first_byte (found) - string;
 }
 
 /* If STRING is less than MAXLEN characters in length, returns
@@ -4,3 +4,4 @@ lib_SRC += lib/stdio.c			# I/O library.
 lib_SRC += lib/stdlib.c			# Utility functions.
 lib_SRC += lib/string.c			# String functions.
 lib_SRC += lib/arithmetic.c
+lib_SRC += lib/fixed-point.c		# Fixed-point arithmetic.
@@ -54,7 +54,7 @@ static __inline int64_t syscall (uint64_t num_, uint64_t a1_, uint64_t a2_,
 			((uint64_t) ARG2), 0, 0, 0))
 
 #define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3) ( \
-		syscall(((uint64_t *) NUMBER), \
+		syscall(((uint64_t) NUMBER), \
 			((uint64_t) ARG0), \
 			((uint64_t) ARG1), \
 			((uint64_t) ARG2), \
@@ -194,3 +194,190 @@ int
 umount (const char *path) {
 	return syscall1 (SYS_UMOUNT, path);
 }
+
+int
+futex_wait (int *addr, int expected) {
+	return syscall2 (SYS_FUTEX_WAIT, addr, expected);
+}
+
+int
+futex_wake (int *addr, int n) {
+	return syscall2 (SYS_FUTEX_WAKE, addr, n);
+}
+
+pid_t
+spawn (const char *file, char *const argv[]) {
+	return (pid_t) syscall2 (SYS_SPAWN, file, argv);
+}
+
+pid_t
+wait_any (int *status) {
+	return (pid_t) syscall1 (SYS_WAIT_ANY, status);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt) {
+	return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt) {
+	return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+pread (int fd, void *buffer, unsigned length, off_t offset) {
+	return syscall4 (SYS_PREAD, fd, buffer, length, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned length, off_t offset) {
+	return syscall4 (SYS_PWRITE, fd, buffer, length, offset);
+}
+
+int
+io_ring_setup (struct io_ring *ring) {
+	return syscall1 (SYS_IO_RING_SETUP, ring);
+}
+
+int
+io_ring_enter (unsigned to_submit) {
+	return syscall1 (SYS_IO_RING_ENTER, to_submit);
+}
+
+int
+copy_file_range (int in_fd, int out_fd, unsigned length) {
+	return syscall3 (SYS_COPY_FILE_RANGE, in_fd, out_fd, length);
+}
+
+int
+fsync (int fd) {
+	return syscall1 (SYS_FSYNC, fd);
+}
+
+int
+fdatasync (int fd) {
+	return syscall1 (SYS_FDATASYNC, fd);
+}
+
+int
+getdents (int fd, void *buf, unsigned size) {
+	return syscall3 (SYS_GETDENTS, fd, buf, size);
+}
+
+int
+fallocate (int fd, unsigned offset, unsigned len) {
+	return syscall3 (SYS_FALLOCATE, fd, offset, len);
+}
+
+int
+madvise (void *addr, size_t length, int advice) {
+	return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+int
+sched_setaffinity (unsigned mask) {
+	return syscall1 (SYS_SCHED_SETAFFINITY, mask);
+}
+
+unsigned
+sched_getaffinity (void) {
+	return syscall0 (SYS_SCHED_GETAFFINITY);
+}
+
+int
+aio_read (int fd, void *buffer, unsigned length, off_t offset, int *status) {
+	return syscall5 (SYS_AIO_READ, fd, buffer, length, offset, status);
+}
+
+int
+aio_write (int fd, const void *buffer, unsigned length, off_t offset,
+		int *status) {
+	return syscall5 (SYS_AIO_WRITE, fd, buffer, length, offset, status);
+}
+
+int
+aio_wait (int *status) {
+	return syscall1 (SYS_AIO_WAIT, status);
+}
+
+/* Where a thread from thread_spawn() starts: runs ENTRY (AUX),
+   then exits the thread. */
+static void
+thread_trampoline (void (*entry) (void *), void *aux) {
+	entry (aux);
+	exit (0);
+}
+
+pid_t
+thread_spawn (void (*entry) (void *), void *aux, void *stack, void *tls) {
+	/* Enter THREAD_TRAMPOLINE as if called: RSP + 8 16-byte aligned. */
+	uint64_t rsp = ((uint64_t) stack & ~(uint64_t) 15) - 8;
+
+	return syscall5 (SYS_THREAD_SPAWN, thread_trampoline, entry, aux, rsp, tls);
+}
+
+int
+thread_join (pid_t tid) {
+	return syscall1 (SYS_THREAD_JOIN, tid);
+}
+
+int
+set_tls (void *base) {
+	return syscall1 (SYS_SET_TLS, base);
+}
+
+int
+getrusage (struct rusage *usage) {
+	return syscall1 (SYS_GETRUSAGE, usage);
+}
+
+int
+oom_adjust (int adj) {
+	return syscall1 (SYS_OOM_ADJUST, adj);
+}
+
+int
+shm_open (const char *name, size_t size) {
+	return syscall2 (SYS_SHM_OPEN, name, size);
+}
+
+void *
+shm_map (int id, void *addr, bool writable) {
+	return (void *) syscall3 (SYS_SHM_MAP, id, addr, writable);
+}
+
+int
+shm_unmap (void *addr) {
+	return syscall1 (SYS_SHM_UNMAP, addr);
+}
+
+int
+shm_unlink (const char *name) {
+	return syscall1 (SYS_SHM_UNLINK, name);
+}
+
+int
+pipe (int fds[2]) {
+	return syscall1 (SYS_PIPE, fds);
+}
+
+int
+counter_find (const char *name) {
+	return syscall1 (SYS_COUNTER_FIND, name);
+}
+
+long long
+counter_read (int id) {
+	return syscall1 (SYS_COUNTER_READ, id);
+}
+
+int
+counter_name (int id, char *buf, size_t size) {
+	return syscall3 (SYS_COUNTER_NAME, id, buf, size);
+}
+
+int64_t
+clock_gettime_ns (void) {
+	return syscall0 (SYS_CLOCK_GETTIME_NS);
+}
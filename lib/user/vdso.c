@@ -0,0 +1,59 @@
+/* The time and process ID, read from the pages the kernel maps at
+   VDSO_ADDR instead of asked for with a system call. */
+
+#include <syscall.h>
+#include <vdso.h>
+
+static const volatile struct vdso_time *const vdso_time =
+	(const volatile struct vdso_time *) VDSO_TIME_ADDR;
+static const struct vdso_proc *const vdso_proc =
+	(const struct vdso_proc *) VDSO_PROC_ADDR;
+
+/* Copies the clock into *T, trying again if the kernel updates it
+   meanwhile. */
+static void
+read_clock (struct vdso_time *t) {
+	uint32_t seq;
+
+	do {
+		seq = vdso_time->seq;
+		asm volatile ("" : : : "memory");
+		t->tick_freq = vdso_time->tick_freq;
+		t->ticks = vdso_time->ticks;
+		t->tsc_hz = vdso_time->tsc_hz;
+		t->tsc_epoch = vdso_time->tsc_epoch;
+		t->tsc_epoch_ns = vdso_time->tsc_epoch_ns;
+		t->ns_per_cycle = vdso_time->ns_per_cycle;
+		asm volatile ("" : : : "memory");
+	} while ((seq & 1) != 0 || vdso_time->seq != seq);
+}
+
+/* Returns the number of timer ticks since the OS booted. */
+int64_t
+clock_ticks (void) {
+	struct vdso_time t;
+
+	read_clock (&t);
+	return t.ticks;
+}
+
+/* Returns the number of nanoseconds since the OS booted. */
+int64_t
+clock_nsec (void) {
+	struct vdso_time t;
+	uint32_t lo, hi;
+
+	read_clock (&t);
+	if (t.tsc_hz == 0)
+		return t.ticks * (1000000000LL / t.tick_freq);
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return t.tsc_epoch_ns
+		+ (int64_t) (((unsigned __int128) ((((uint64_t) hi << 32) | lo)
+						- t.tsc_epoch) * t.ns_per_cycle) >> 32);
+}
+
+/* Returns the running process's ID. */
+pid_t
+getpid (void) {
+	return vdso_proc->pid;
+}
@@ -1,9 +1,17 @@
-/* crctab[] and cksum() are from the `cksum' entry in SUSv3. */
+/* crctab[] and the algorithm are from the `cksum' entry in SUSv3.
 
+   cksum_update() processes 8 bytes per step by "slicing-by-8":
+   SLICES[K][I] is the CRC of byte I followed by K + 1 zero bytes,
+   so that the contributions of 8 bytes can be looked up all at
+   once and combined with XOR, instead of one byte at a time.
+   crctab[] serves as the slice for no following zeros; the others
+   are derived from it on first use. */
+
+#include <stdbool.h>
 #include <stdint.h>
 #include "tests/cksum.h"
 
-static unsigned long crctab[] = {
+static const uint32_t crctab[256] = {
   0x00000000,
   0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
   0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6,
@@ -58,35 +66,107 @@ static unsigned long crctab[] = {
   0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
-/* This is the algorithm used by the Posix `cksum' utility. */
-unsigned long
-cksum (const void *b_, size_t n)
+static uint32_t slices[7][256];
+static bool slices_ready;
+
+/* Fills in SLICES[] from crctab[]. */
+static void
+init_slices (void)
+{
+  int k, i;
+
+  for (i = 0; i < 256; i++)
+    {
+      uint32_t s = crctab[i];
+      for (k = 0; k < 7; k++)
+        {
+          s = (s << 8) ^ crctab[s >> 24];
+          slices[k][i] = s;
+        }
+    }
+  slices_ready = true;
+}
+
+/* Adds byte C to CRC S. */
+static inline uint32_t
+crc_byte (uint32_t s, unsigned char c)
+{
+  return (s << 8) ^ crctab[(s >> 24) ^ c];
+}
+
+/* Begins a checksum. */
+void
+cksum_init (struct cksum *c)
+{
+  if (!slices_ready)
+    init_slices ();
+  c->crc = 0;
+  c->length = 0;
+}
+
+/* Adds the N bytes at B_ to checksum C. */
+void
+cksum_update (struct cksum *c, const void *b_, size_t n)
 {
   const unsigned char *b = b_;
-  uint32_t s = 0;
-  size_t i;
-  for (i = n; i > 0; --i)
+  uint32_t s = c->crc;
+
+  c->length += n;
+  for (; n >= 8; n -= 8, b += 8)
     {
-      unsigned char c = *b++;
-      s = (s << 8) ^ crctab[(s >> 24) ^ c];
+      s ^= ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16)
+           | ((uint32_t) b[2] << 8) | b[3];
+      s = (slices[6][s >> 24] ^ slices[5][(s >> 16) & 0xff]
+           ^ slices[4][(s >> 8) & 0xff] ^ slices[3][s & 0xff]
+           ^ slices[2][b[4]] ^ slices[1][b[5]] ^ slices[0][b[6]]
+           ^ crctab[b[7]]);
     }
+  for (; n > 0; n--)
+    s = crc_byte (s, *b++);
+  c->crc = s;
+}
+
+/* Returns the checksum of the bytes added to C, as the Posix
+   `cksum' utility computes it: the length is folded in after the
+   data. */
+unsigned long
+cksum_final (const struct cksum *c)
+{
+  uint32_t s = c->crc;
+  size_t n = c->length;
+
   while (n != 0)
     {
-      unsigned char c = n;
+      s = crc_byte (s, n);
       n >>= 8;
-      s = (s << 8) ^ crctab[(s >> 24) ^ c];
     }
   return ~s;
 }
 
+/* Returns the Posix `cksum' of the N bytes at B. */
+unsigned long
+cksum (const void *b, size_t n)
+{
+  struct cksum c;
+
+  cksum_init (&c);
+  cksum_update (&c, b, n);
+  return cksum_final (&c);
+}
+
 #ifdef STANDALONE_TEST
 #include <stdio.h>
 int
 main (void) 
 {
-  char buf[65536];
-  int n = fread (buf, 1, sizeof buf, stdin);
-  printf ("%lu\n", cksum (buf, n));
+  static char buf[65536];
+  struct cksum c;
+  size_t n;
+
+  cksum_init (&c);
+  while ((n = fread (buf, 1, sizeof buf, stdin)) > 0)
+    cksum_update (&c, buf, n);
+  printf ("%lu\n", cksum_final (&c));
   return 0;
 }
 #endif
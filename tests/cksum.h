@@ -2,6 +2,18 @@
 #define TESTS_CKSUM_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+/* A checksum in progress, for data that arrives in pieces. */
+struct cksum
+  {
+    uint32_t crc;               /* CRC of the data so far. */
+    size_t length;              /* Bytes so far. */
+  };
+
+void cksum_init (struct cksum *);
+void cksum_update (struct cksum *, const void *, size_t);
+unsigned long cksum_final (const struct cksum *);
 
 unsigned long cksum(const void *, size_t);
 
@@ -0,0 +1,64 @@
+/* Times reads and writes of blocks at random, block-aligned
+   offsets in a file, at several block sizes.  The write pass
+   ends with fsync(), so it counts the disk writes too. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/fs-bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (128 * 1024)
+#define BLOCK_MAX 4096
+#define OPS 256
+
+static char buf[FILE_SIZE];
+static char block[BLOCK_MAX];
+
+void
+test_main (void)
+{
+  static const size_t sizes[] = { 512, BLOCK_MAX };
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("random", sizeof buf), "create \"random\"");
+  CHECK ((fd = open ("random")) > 1, "open \"random\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"random\"");
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      size_t size = sizes[i];
+      size_t blocks = sizeof buf / size;
+      struct fs_bench b;
+      int j;
+
+      fs_bench_begin (&b);
+      for (j = 0; j < OPS; j++)
+        {
+          size_t ofs = random_ulong () % blocks * size;
+
+          seek (fd, ofs);
+          if (write (fd, buf + ofs, size) != (int) size)
+            fail ("write %zu bytes at offset %zu failed", size, ofs);
+        }
+      fsync (fd);
+      fs_bench_end (&b, "random-write", "block", size, OPS * size, OPS);
+
+      fs_bench_begin (&b);
+      for (j = 0; j < OPS; j++)
+        {
+          size_t ofs = random_ulong () % blocks * size;
+
+          seek (fd, ofs);
+          if (read (fd, block, size) != (int) size
+              || memcmp (block, buf + ofs, size))
+            fail ("read %zu bytes at offset %zu failed", size, ofs);
+        }
+      fs_bench_end (&b, "random-read", "block", size, OPS * size, OPS);
+    }
+  close (fd);
+}
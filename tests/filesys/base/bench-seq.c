@@ -0,0 +1,56 @@
+/* Times sequential writes and reads of a file at several block
+   sizes.  Each write pass ends with fsync(), so it counts the
+   disk writes, not only the copies into the buffer cache. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/filesys/fs-bench.h"
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (128 * 1024)
+#define BLOCK_MAX 16384
+
+static char buf[FILE_SIZE];
+static char block[BLOCK_MAX];
+static size_t block_size;
+
+static size_t
+return_block_size (void)
+{
+  return block_size;
+}
+
+void
+test_main (void)
+{
+  static const size_t sizes[] = { 512, 4096, BLOCK_MAX };
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("seq", sizeof buf), "create \"seq\"");
+  CHECK ((fd = open ("seq")) > 1, "open \"seq\"");
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      struct fs_bench b;
+
+      block_size = sizes[i];
+      seek (fd, 0);
+      fs_bench_begin (&b);
+      seq_write (fd, "seq", buf, sizeof buf, return_block_size, NULL);
+      fsync (fd);
+      fs_bench_end (&b, "seq-write", "block", block_size, sizeof buf,
+                    sizeof buf / block_size);
+
+      seek (fd, 0);
+      fs_bench_begin (&b);
+      seq_read (fd, "seq", buf, sizeof buf, block, block_size);
+      fs_bench_end (&b, "seq-read", "block", block_size, sizeof buf,
+                    sizeof buf / block_size);
+    }
+  close (fd);
+}
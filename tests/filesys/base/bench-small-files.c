@@ -0,0 +1,70 @@
+/* Times creating, writing, reading back and removing many small
+   files, the load of a build or an unpacked archive. */
+
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/fs-bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 10
+#define FILE_SIZE 512
+
+static char buf[FILE_SIZE];
+static char block[FILE_SIZE];
+
+/* Stores the name of file I into NAME. */
+static void
+file_name (char name[16], int i)
+{
+  snprintf (name, 16, "small%d", i);
+}
+
+void
+test_main (void)
+{
+  struct fs_bench b;
+  char name[16];
+  int i, fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  fs_bench_begin (&b);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_name (name, i);
+      if (!create (name, FILE_SIZE) || (fd = open (name)) < 2)
+        fail ("create \"%s\" failed", name);
+      if (write (fd, buf, FILE_SIZE) != FILE_SIZE)
+        fail ("write \"%s\" failed", name);
+      close (fd);
+    }
+  fs_bench_end (&b, "small-create", "files", FILE_CNT,
+                FILE_CNT * FILE_SIZE, FILE_CNT);
+
+  fs_bench_begin (&b);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_name (name, i);
+      if ((fd = open (name)) < 2)
+        fail ("open \"%s\" failed", name);
+      if (read (fd, block, FILE_SIZE) != FILE_SIZE
+          || memcmp (block, buf, FILE_SIZE))
+        fail ("read \"%s\" failed", name);
+      close (fd);
+    }
+  fs_bench_end (&b, "small-read", "files", FILE_CNT,
+                FILE_CNT * FILE_SIZE, FILE_CNT);
+
+  fs_bench_begin (&b);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_name (name, i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+  fs_bench_end (&b, "small-remove", "files", FILE_CNT, 0, FILE_CNT);
+}
@@ -0,0 +1,62 @@
+/* Times reads of small records, down to the size of a directory
+   entry, from a file small enough to stay in the buffer cache.
+   The cost per read is then the system call and the copy out of
+   a partial sector rather than the disk.  The file is synced
+   first, so that its data is on its sectors in the cache rather
+   than still waiting in memory for them. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/userprog/proc-bench.h"
+
+#define FILE_SIZE 5120
+#define REC_MAX 128
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  static const size_t sizes[] = { 4, 20, REC_MAX };
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("records", sizeof buf), "create \"records\"");
+  CHECK ((fd = open ("records")) > 1, "open \"records\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"records\"");
+  CHECK (fsync (fd) == 0, "fsync \"records\"");
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      size_t size = sizes[i];
+      size_t cnt = sizeof buf / size;
+      uint64_t total = 0;
+      int round;
+
+      for (round = 0; round < ROUNDS; round++)
+        {
+          uint64_t start;
+          size_t j;
+
+          seek (fd, 0);
+          start = read_tsc ();
+          for (j = 0; j < cnt; j++)
+            {
+              char rec[REC_MAX];
+
+              if (read (fd, rec, size) != (int) size
+                  || memcmp (rec, buf + j * size, size))
+                fail ("read of %zu bytes at offset %zu failed",
+                      size, j * size);
+            }
+          total += (read_tsc () - start) / cnt;
+        }
+      bench_report ("small-read", "bytes", size, total);
+    }
+  close (fd);
+}
@@ -0,0 +1,58 @@
+/* Child process for syn-atomic test.
+   Even children write the whole test file with a byte of their
+   own, ROUNDS times; odd children read it whole as often and
+   check that every byte of each read is the same, and one that
+   the parent or a writer wrote. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-atomic.h"
+
+static char buf[BUF_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  test_name = "child-syn-atomic";
+
+  int child_idx;
+  int fd;
+  int round;
+  size_t i;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (round = 0; round < ROUNDS; round++) 
+    {
+      seek (fd, 0);
+      if (child_idx % 2 == 0) 
+        {
+          memset (buf, 'b' + child_idx, sizeof buf);
+          CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+                 "write \"%s\"", file_name);
+        }
+      else 
+        {
+          CHECK (read (fd, buf, sizeof buf) == sizeof buf,
+                 "read \"%s\"", file_name);
+          if (buf[0] != 'a'
+              && (buf[0] < 'b' || buf[0] >= 'b' + CHILD_CNT
+                  || (buf[0] - 'b') % 2 != 0))
+            fail ("byte 0 is '%c', which no writer wrote", buf[0]);
+          for (i = 1; i < sizeof buf; i++)
+            if (buf[i] != buf[0])
+              fail ("byte %zu is '%c' but byte 0 is '%c'",
+                    i, buf[i], buf[0]);
+        }
+    }
+  close (fd);
+
+  return child_idx;
+}
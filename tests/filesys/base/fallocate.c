@@ -0,0 +1,49 @@
+/* Reserves space for a file created empty with fallocate(), then
+   checks that the file grew, that syncing it writes no zeros into
+   the reserved space, that the space reads as zeros, and that it
+   holds what is written into it.  Also checks that a range the
+   file already covers leaves it alone and that an empty range is
+   refused. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 40960
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  long long writes;
+  int fd;
+
+  CHECK (create ("falloc", 0), "create \"falloc\"");
+  CHECK ((fd = open ("falloc")) > 1, "open \"falloc\"");
+  writes = get_fs_disk_write_cnt ();
+  CHECK (fallocate (fd, 0, FILE_SIZE) == 0, "fallocate %d bytes", FILE_SIZE);
+  CHECK (fsync (fd) == 0, "fsync \"falloc\"");
+  writes = get_fs_disk_write_cnt () - writes;
+  if (writes >= FILE_SIZE / 512)
+    fail ("fallocate and fsync wrote %lld sectors", writes);
+  CHECK (filesize (fd) == FILE_SIZE, "filesize is %d", FILE_SIZE);
+  CHECK (fallocate (fd, 512, 1024) == 0, "fallocate inside the file");
+  CHECK (filesize (fd) == FILE_SIZE, "filesize is still %d", FILE_SIZE);
+  CHECK (fallocate (fd, 0, 0) == -1, "fallocate 0 bytes");
+
+  CHECK (read (fd, buf, sizeof buf) == FILE_SIZE, "read reserved space");
+  for (size_t i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu of reserved space is %d", i, buf[i]);
+
+  for (size_t i = 0; i < sizeof buf; i++)
+    buf[i] = i % 251;
+  seek (fd, 0);
+  CHECK (write (fd, buf, sizeof buf) == FILE_SIZE, "write \"falloc\"");
+  msg ("close \"falloc\"");
+  close (fd);
+
+  check_file ("falloc", buf, sizeof buf);
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate) begin
+(fallocate) create "falloc"
+(fallocate) open "falloc"
+(fallocate) fallocate 40960 bytes
+(fallocate) fsync "falloc"
+(fallocate) filesize is 40960
+(fallocate) fallocate inside the file
+(fallocate) filesize is still 40960
+(fallocate) fallocate 0 bytes
+(fallocate) read reserved space
+(fallocate) write "falloc"
+(fallocate) close "falloc"
+(fallocate) open "falloc" for verification
+(fallocate) verified contents of "falloc"
+(fallocate) close "falloc"
+(fallocate) end
+EOF
+pass;
@@ -0,0 +1,41 @@
+/* Writes a file, syncs it with fdatasync() and fsync(), and checks
+   that a second sync finds nothing left to write, that the data
+   reads back, and that syncing a bad descriptor fails. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 4096
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  long long writes;
+  int fd;
+
+  CHECK (create ("synced", FILE_SIZE), "create \"synced\"");
+  CHECK ((fd = open ("synced")) > 1, "open \"synced\"");
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"synced\"");
+  CHECK (fdatasync (fd) == 0, "fdatasync \"synced\"");
+  CHECK (fsync (fd) == 0, "fsync \"synced\"");
+
+  writes = get_fs_disk_write_cnt ();
+  CHECK (fsync (fd) == 0, "fsync \"synced\" again");
+  if (get_fs_disk_write_cnt () != writes)
+    fail ("second fsync wrote %lld sectors",
+          get_fs_disk_write_cnt () - writes);
+
+  msg ("close \"synced\"");
+  close (fd);
+  check_file ("synced", buf, FILE_SIZE);
+
+  CHECK (fsync (fd) == -1, "fsync closed descriptor");
+  CHECK (fdatasync (1) == -1, "fdatasync console");
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync-write) begin
+(fsync-write) create "synced"
+(fsync-write) open "synced"
+(fsync-write) write "synced"
+(fsync-write) fdatasync "synced"
+(fsync-write) fsync "synced"
+(fsync-write) fsync "synced" again
+(fsync-write) close "synced"
+(fsync-write) open "synced" for verification
+(fsync-write) verified contents of "synced"
+(fsync-write) close "synced"
+(fsync-write) fsync closed descriptor
+(fsync-write) fdatasync console
+(fsync-write) end
+EOF
+pass;
@@ -0,0 +1,61 @@
+/* Creates a directory's worth of files and lists the root
+   directory with getdents() through a buffer that holds only a few
+   entries, checking that each file shows up exactly once.  Also
+   checks that getdents() refuses a buffer too small for any entry
+   and a descriptor that is not a directory, and that no file can
+   be created as "/", the name that opens the root directory. */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 12
+
+static char buf[64];
+
+void
+test_main (void)
+{
+  bool seen[FILE_CNT] = { false };
+  char name[16];
+  int fd, n, total = 0;
+
+  for (int i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  msg ("created %d files", FILE_CNT);
+  CHECK (!create ("/", 0), "create \"/\" (must fail)");
+
+  CHECK ((fd = open ("/")) > 1, "open \"/\"");
+  CHECK (getdents (fd, buf, 4) == -1, "getdents into 4 bytes");
+  while ((n = getdents (fd, buf, sizeof buf)) > 0)
+    for (int ofs = 0; ofs < n; )
+      {
+        struct dirent *d = (struct dirent *) (buf + ofs);
+        int i = atoi (d->d_name + 4);
+
+        ofs += d->d_reclen;
+        if (memcmp (d->d_name, "file", 4) || i < 0 || i >= FILE_CNT)
+          continue;
+        if (seen[i])
+          fail ("\"%s\" listed twice", d->d_name);
+        seen[i] = true;
+        total++;
+      }
+  CHECK (n == 0, "getdents reaches the end");
+  if (total != FILE_CNT)
+    fail ("listed %d of %d files", total, FILE_CNT);
+  msg ("listed %d files", total);
+  close (fd);
+
+  CHECK ((fd = open ("file0")) > 1, "open \"file0\"");
+  CHECK (getdents (fd, buf, sizeof buf) == -1, "getdents on a file");
+  close (fd);
+}
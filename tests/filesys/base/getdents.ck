@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(getdents) begin
+(getdents) created 12 files
+(getdents) create "/" (must fail)
+(getdents) open "/"
+(getdents) getdents into 4 bytes
+(getdents) getdents reaches the end
+(getdents) listed 12 files
+(getdents) open "file0"
+(getdents) getdents on a file
+(getdents) end
+EOF
+pass;
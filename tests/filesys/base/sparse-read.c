@@ -0,0 +1,64 @@
+/* Creates a large file, which starts out as a hole, writes one
+   byte into the middle of it, and syncs it, so that the file gets
+   its sectors.  Then checks that reading the file returns zeros
+   around the byte without reading the file system disk: the
+   sectors never written stay holes, with nothing to read. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (512 * 1024)
+#define CHUNK 4096
+
+static char buf[CHUNK];
+
+/* Fails unless SIZE bytes at P are all zero. */
+static void
+check_zeros (const char *p, size_t size, size_t ofs)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != 0)
+      fail ("byte %zu is %d, not zero", ofs + i, p[i]);
+}
+
+void
+test_main (void)
+{
+  long long reads;
+  size_t ofs;
+  int fd;
+
+  CHECK (create ("sparse", FILE_SIZE), "create \"sparse\"");
+  CHECK ((fd = open ("sparse")) > 1, "open \"sparse\"");
+
+  msg ("write into hole");
+  seek (fd, FILE_SIZE / 2 + 100);
+  CHECK (write (fd, "x", 1) == 1, "write 1 byte");
+  CHECK (fsync (fd) == 0, "fsync \"sparse\"");
+
+  msg ("read hole");
+  seek (fd, 0);
+  reads = get_fs_disk_read_cnt ();
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK)
+    {
+      if (read (fd, buf, CHUNK) != CHUNK)
+        fail ("read at offset %zu failed", ofs);
+      if (ofs == FILE_SIZE / 2)
+        {
+          if (buf[100] != 'x')
+            fail ("written byte reads back as %d", buf[100]);
+          buf[100] = 0;
+        }
+      check_zeros (buf, CHUNK, ofs);
+    }
+  if (get_fs_disk_read_cnt () != reads)
+    fail ("reading the hole read %lld sectors",
+          get_fs_disk_read_cnt () - reads);
+
+  msg ("close \"sparse\"");
+  close (fd);
+}
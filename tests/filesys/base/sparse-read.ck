@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sparse-read) begin
+(sparse-read) create "sparse"
+(sparse-read) open "sparse"
+(sparse-read) write into hole
+(sparse-read) write 1 byte
+(sparse-read) fsync "sparse"
+(sparse-read) read hole
+(sparse-read) close "sparse"
+(sparse-read) end
+EOF
+pass;
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(syn-atomic) begin
+(syn-atomic) create "atomic"
+(syn-atomic) open "atomic"
+(syn-atomic) write "atomic"
+(syn-atomic) close "atomic"
+(syn-atomic) exec child 1 of 6: "child-syn-atomic 0"
+(syn-atomic) exec child 2 of 6: "child-syn-atomic 1"
+(syn-atomic) exec child 3 of 6: "child-syn-atomic 2"
+(syn-atomic) exec child 4 of 6: "child-syn-atomic 3"
+(syn-atomic) exec child 5 of 6: "child-syn-atomic 4"
+(syn-atomic) exec child 6 of 6: "child-syn-atomic 5"
+(syn-atomic) wait for child 1 of 6 returned 0 (expected 0)
+(syn-atomic) wait for child 2 of 6 returned 1 (expected 1)
+(syn-atomic) wait for child 3 of 6 returned 2 (expected 2)
+(syn-atomic) wait for child 4 of 6 returned 3 (expected 3)
+(syn-atomic) wait for child 5 of 6 returned 4 (expected 4)
+(syn-atomic) wait for child 6 of 6 returned 5 (expected 5)
+(syn-atomic) end
+EOF
+pass;
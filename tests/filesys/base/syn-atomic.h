@@ -0,0 +1,9 @@
+#ifndef TESTS_FILESYS_BASE_SYN_ATOMIC_H
+#define TESTS_FILESYS_BASE_SYN_ATOMIC_H
+
+#define BUF_SIZE 4096
+#define CHILD_CNT 6
+#define ROUNDS 16
+static const char file_name[] = "atomic";
+
+#endif /* tests/filesys/base/syn-atomic.h */
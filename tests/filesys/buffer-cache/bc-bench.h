@@ -0,0 +1,91 @@
+#ifndef TESTS_FILESYS_BUFFER_CACHE_BC_BENCH_H
+#define TESTS_FILESYS_BUFFER_CACHE_BC_BENCH_H
+
+/* Helpers shared by the buffer cache benchmarks.  Each result is
+   one line of the form
+
+     bench NAME sectors=N reads=R writes=W hit=P%
+
+   where N is the number of file sectors the test read or wrote,
+   R and W are the file system disk's read and write counts over
+   the same period, and P is the share of the N that did not
+   need a disk read.  Metadata reads count against the hits, so
+   P is a lower bound. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+#define SECTOR_SIZE 512
+
+/* Sectors in the cache by default (the kernel's -bc option). */
+#define CACHE_SECTORS 64
+
+/* Disk counts at the start of a measured period. */
+struct bc_mark
+  {
+    long long reads, writes;
+  };
+
+static inline void
+bc_start (struct bc_mark *m)
+{
+  m->reads = get_fs_disk_read_cnt ();
+  m->writes = get_fs_disk_write_cnt ();
+}
+
+/* Reports SECTORS sector accesses since M as NAME, and returns
+   the hit percentage. */
+static inline int
+bc_report (const struct bc_mark *m, const char *name, long long sectors)
+{
+  long long reads = get_fs_disk_read_cnt () - m->reads;
+  long long writes = get_fs_disk_write_cnt () - m->writes;
+  long long hits = sectors > reads ? sectors - reads : 0;
+  int hit = sectors > 0 ? (int) (hits * 100 / sectors) : 0;
+
+  msg ("bench %s sectors=%lld reads=%lld writes=%lld hit=%d%%",
+       name, sectors, reads, writes, hit);
+  return hit;
+}
+
+/* Creates NAME with SECTORS sectors, sector I filled with byte
+   I + 1, and returns it open.  The file is synced, so that its
+   data is on its sectors, in the cache, rather than still waiting
+   in memory for the file to be placed. */
+static inline int
+bc_create (const char *name, size_t sectors)
+{
+  static char block[SECTOR_SIZE];
+  size_t i;
+  int fd;
+
+  CHECK (create (name, 0), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  for (i = 0; i < sectors; i++)
+    {
+      memset (block, (int) (i + 1), sizeof block);
+      if (write (fd, block, sizeof block) != (int) sizeof block)
+        fail ("write \"%s\" failed at sector %zu", name, i);
+    }
+  CHECK (fsync (fd) == 0, "fsync \"%s\"", name);
+  return fd;
+}
+
+/* Reads sector SECTOR of FD and checks that it holds byte
+   SECTOR + 1, or if OTHER is nonzero, OTHER. */
+static inline void
+bc_read_sector (int fd, size_t sector, int other)
+{
+  static char block[SECTOR_SIZE];
+  size_t i;
+
+  seek (fd, sector * SECTOR_SIZE);
+  if (read (fd, block, sizeof block) != (int) sizeof block)
+    fail ("short read at sector %zu", sector);
+  for (i = 0; i < sizeof block; i++)
+    if (block[i] != (char) (sector + 1) && (other == 0 || block[i] != other))
+      fail ("sector %zu byte %zu is %#x", sector, i, block[i] & 0xff);
+}
+
+#endif /* tests/filesys/buffer-cache/bc-bench.h */
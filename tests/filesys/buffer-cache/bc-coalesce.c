@@ -0,0 +1,33 @@
+/* Writes one sector a byte at a time, then syncs it.  The cache
+   should absorb the small writes and write the sector back once,
+   plus whatever metadata the sync writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/buffer-cache/bc-bench.h"
+
+void
+test_main (void)
+{
+  struct bc_mark m;
+  size_t i;
+  int fd;
+
+  fd = bc_create ("coalesce", 1);
+
+  bc_start (&m);
+  for (i = 0; i < SECTOR_SIZE; i++)
+    {
+      char c = 1;
+
+      seek (fd, i);
+      if (write (fd, &c, 1) != 1)
+        fail ("write at byte %zu failed", i);
+    }
+  CHECK (fsync (fd) == 0, "fsync \"coalesce\"");
+  bc_report (&m, "bc-coalesce", SECTOR_SIZE);
+  bc_read_sector (fd, 0, 0);
+  close (fd);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+fail "missing bench result in output"
+  unless grep (/^\(bc-coalesce\) bench bc-coalesce sectors=\d+ /, @output);
+fail "missing end in output"
+  unless grep ($_ eq '(bc-coalesce) end', @output);
+
+pass;
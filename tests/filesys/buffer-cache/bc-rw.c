@@ -0,0 +1,61 @@
+/* Runs a reader and a writer on one file at once.  The parent
+   reads the file over and over while a child overwrites its
+   sectors with a second pattern; a reader must see every byte as
+   one pattern or the other, and the file, half the size of the
+   cache, should be read almost entirely from the cache. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/buffer-cache/bc-bench.h"
+
+#define FILE_SECTORS (CACHE_SECTORS / 2)
+#define PASSES 8
+#define PATTERN 0x6b
+
+static void
+writer (void)
+{
+  static char block[SECTOR_SIZE];
+  size_t i;
+  int pass;
+  int fd;
+
+  fd = open ("rw");
+  if (fd < 2)
+    exit (1);
+  memset (block, PATTERN, sizeof block);
+  for (pass = 0; pass < PASSES; pass++)
+    for (i = 0; i < FILE_SECTORS; i++)
+      {
+        seek (fd, i * SECTOR_SIZE);
+        if (write (fd, block, sizeof block) != (int) sizeof block)
+          exit (1);
+      }
+  close (fd);
+  exit (0);
+}
+
+void
+test_main (void)
+{
+  struct bc_mark m;
+  pid_t child;
+  size_t i;
+  int pass;
+  int fd;
+
+  fd = bc_create ("rw", FILE_SECTORS);
+  bc_start (&m);
+  child = fork ("writer");
+  if (child == 0)
+    writer ();
+  CHECK (child > 0, "fork writer");
+  for (pass = 0; pass < PASSES; pass++)
+    for (i = 0; i < FILE_SECTORS; i++)
+      bc_read_sector (fd, i, PATTERN);
+  CHECK (wait (child) == 0, "wait for writer");
+  bc_report (&m, "bc-rw", (long long) FILE_SECTORS * PASSES * 2);
+  close (fd);
+}
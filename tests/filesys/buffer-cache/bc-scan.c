@@ -0,0 +1,32 @@
+/* Loops over a file a quarter again as large as the cache.  An
+   LRU cache misses on every sector of such a loop; a scan-
+   resistant one keeps part of the file and hits on it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/buffer-cache/bc-bench.h"
+
+#define FILE_SECTORS (CACHE_SECTORS * 5 / 4)
+#define PASSES 8
+
+void
+test_main (void)
+{
+  struct bc_mark m;
+  size_t i;
+  int pass;
+  int fd;
+
+  fd = bc_create ("scan", FILE_SECTORS);
+  for (i = 0; i < FILE_SECTORS; i++)
+    bc_read_sector (fd, i, 0);
+
+  bc_start (&m);
+  for (pass = 0; pass < PASSES; pass++)
+    for (i = 0; i < FILE_SECTORS; i++)
+      bc_read_sector (fd, i, 0);
+  bc_report (&m, "bc-scan", (long long) FILE_SECTORS * PASSES);
+  close (fd);
+}
@@ -0,0 +1,60 @@
+/* Reads sectors of a file four times the size of the cache in a
+   Zipf-distributed random order: the Kth most popular sector is
+   read in proportion to 1/K.  A good policy keeps the head of the
+   distribution cached. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/buffer-cache/bc-bench.h"
+
+#define FILE_SECTORS (CACHE_SECTORS * 4)
+#define READ_CNT 4096
+
+/* CDF[K] is the total weight of the K + 1 most popular sectors. */
+static unsigned long cdf[FILE_SECTORS];
+
+/* Returns a sector drawn from the Zipf distribution.  Popularity
+   rank is scrambled across the file by an odd multiplier, so
+   that the hot sectors are not all adjacent. */
+static size_t
+zipf_sector (void)
+{
+  unsigned long r = random_ulong () % cdf[FILE_SECTORS - 1];
+  size_t lo = 0, hi = FILE_SECTORS - 1;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (cdf[mid] > r)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  return lo * 37 % FILE_SECTORS;
+}
+
+void
+test_main (void)
+{
+  unsigned long total = 0;
+  struct bc_mark m;
+  size_t i;
+  int fd;
+
+  for (i = 0; i < FILE_SECTORS; i++)
+    {
+      total += 1000000 / (i + 1);
+      cdf[i] = total;
+    }
+  random_init (0x5eed);
+  fd = bc_create ("zipf", FILE_SECTORS);
+
+  bc_start (&m);
+  for (i = 0; i < READ_CNT; i++)
+    bc_read_sector (fd, zipf_sector (), 0);
+  bc_report (&m, "bc-zipf", READ_CNT);
+  close (fd);
+}
@@ -0,0 +1,44 @@
+/* Times opens of a file through a chain of symbolic links,
+   l0 -> l1 -> ... -> leaf, which costs a directory lookup per
+   link, as a path does per component.  The file system keeps all
+   files in its root directory, so a chain of links is how a name
+   gets that deep. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/fs-bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DEPTH 8
+#define OPENS 64
+
+void
+test_main (void)
+{
+  char link[16], target[16];
+  struct fs_bench b;
+  int i, fd;
+
+  CHECK (create ("leaf", 0), "create \"leaf\"");
+  for (i = DEPTH - 1; i >= 0; i--)
+    {
+      snprintf (link, sizeof link, "l%d", i);
+      if (i == DEPTH - 1)
+        strlcpy (target, "leaf", sizeof target);
+      else
+        snprintf (target, sizeof target, "l%d", i + 1);
+      CHECK (symlink (target, link) == 0, "symlink \"%s\" to \"%s\"",
+             link, target);
+    }
+
+  fs_bench_begin (&b);
+  for (i = 0; i < OPENS; i++)
+    {
+      if ((fd = open ("l0")) < 2)
+        fail ("open \"l0\" failed");
+      close (fd);
+    }
+  fs_bench_end (&b, "deep-open", "depth", DEPTH, 0, OPENS);
+}
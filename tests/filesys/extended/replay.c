@@ -0,0 +1,417 @@
+/* replay.c
+
+   Issues the system calls recorded in a replay file again, at the
+   times they were first made, and reports how long they took and
+   how many sectors they moved, so that two kernels can be
+   compared on the same workload.
+
+   Make the file by running the workload under a kernel with
+   "-trace=replay" and passing its output to "pintos-trace
+   --replay FILE", then put FILE on the file system disk with
+   "pintos -p".  The format is in lib/replay.h.
+
+   Calls are matched up by what they returned when traced: a file
+   opened in the trace is referred to by its traced descriptor,
+   and so on.  Calls on descriptors the trace did not open, such
+   as the console, are skipped.  Forks are replayed by forking,
+   after which each process issues the calls of its traced
+   counterpart.  A child may run before its parent's fork()
+   returns, so its first calls can be traced ahead of the fork;
+   a new child therefore looks for its calls from the start.  Memory accesses are not system calls and are not
+   in the trace, so each page of a new mapping is read once. */
+
+#include <counter.h>
+#include <replay.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+
+#define CALL_MAX 1024           /* Most calls in a replay file. */
+#define FD_MAX 128              /* Traced descriptors must be below this. */
+#define MAP_MAX 32              /* Most mappings at once. */
+#define CHILD_MAX 32            /* Most children of one process. */
+#define PAGE_SIZE 4096
+
+/* A call and its path. */
+struct call
+  {
+    struct replay_rec rec;
+    char path[REPLAY_PATH_MAX + 1];
+  };
+
+static struct call calls[CALL_MAX];
+static size_t call_cnt;
+
+/* Traced thread whose calls this process issues. */
+static uint32_t my_tid;
+
+/* Set in a child just forked by issue(). */
+static bool forked;
+
+/* Real descriptor for each traced one, or -1. */
+static int fds[FD_MAX];
+
+/* Real address of each traced mapping. */
+static struct
+  {
+    int64_t traced;
+    void *real;
+  }
+maps[MAP_MAX];
+
+/* Real pid of each traced child. */
+static struct
+  {
+    int64_t traced;
+    pid_t real;
+  }
+children[CHILD_MAX];
+static size_t child_cnt;
+
+/* Calls skipped and calls whose results differed from the
+   trace's. */
+static int skipped, differed;
+
+static char buf[65536];
+
+static void usage (void);
+static void load (const char *file_name);
+static void issue (const struct call *);
+static void report (int64_t start, int64_t start_ticks,
+                    const long long before[]);
+static void read_disks (long long cnt[]);
+
+int
+main (int argc, char *argv[])
+{
+  bool fast = false;
+  long long before[4];
+  int64_t start, start_ticks;
+  int status = 0;
+  size_t i;
+
+  if (argc == 3 && !strcmp (argv[1], "-f"))
+    fast = true;
+  else if (argc != 2)
+    usage ();
+  load (argv[argc - 1]);
+  if (call_cnt == 0)
+    {
+      printf ("replay: %s holds no calls\n", argv[argc - 1]);
+      return EXIT_FAILURE;
+    }
+
+  for (i = 0; i < FD_MAX; i++)
+    fds[i] = -1;
+  memset (buf, 0x5a, sizeof buf);
+  my_tid = calls[0].rec.tid;
+  read_disks (before);
+  start_ticks = clock_ticks ();
+  start = clock_nsec ();
+
+  i = 0;
+  while (i < call_cnt)
+    {
+      const struct call *c = &calls[i++];
+
+      if (c->rec.tid != my_tid)
+        continue;
+      if (!fast)
+        while (clock_nsec () - start < (int64_t) c->rec.nsec)
+          continue;
+      if (c->rec.nr == SYS_EXIT)
+        {
+          status = c->rec.args[0];
+          break;
+        }
+      issue (c);
+      if (forked)
+        {
+          forked = false;
+          i = 0;
+        }
+    }
+
+  /* Only the first process reports; its children exit as they
+     did in the trace. */
+  if (my_tid == calls[0].rec.tid)
+    report (start, start_ticks, before);
+  exit (status);
+}
+
+static void
+usage (void)
+{
+  printf ("replay, workload replayer\n"
+          "Usage: replay [-f] FILE\n"
+          "where FILE is a replay file made by pintos-trace --replay.\n"
+          "-f issues the calls as fast as possible instead of at the\n"
+          "times they were traced.\n");
+  exit (EXIT_FAILURE);
+}
+
+/* Reads SIZE bytes from FD into BUFFER, or exits. */
+static void
+read_exactly (int fd, void *buffer, size_t size)
+{
+  if (read (fd, buffer, size) != (int) size)
+    {
+      printf ("replay: replay file is truncated\n");
+      exit (EXIT_FAILURE);
+    }
+}
+
+/* Reads the calls in FILE_NAME into CALLS. */
+static void
+load (const char *file_name)
+{
+  struct replay_header h;
+  int fd = open (file_name);
+  uint32_t i;
+
+  if (fd < 0)
+    {
+      printf ("replay: %s: open failed\n", file_name);
+      exit (EXIT_FAILURE);
+    }
+  read_exactly (fd, &h, sizeof h);
+  if (h.magic != REPLAY_MAGIC || h.version != REPLAY_VERSION)
+    {
+      printf ("replay: %s is not a version %d replay file\n",
+              file_name, REPLAY_VERSION);
+      exit (EXIT_FAILURE);
+    }
+  if (h.rec_cnt > CALL_MAX)
+    {
+      printf ("replay: %s holds %u calls, more than %d\n",
+              file_name, h.rec_cnt, CALL_MAX);
+      exit (EXIT_FAILURE);
+    }
+
+  for (i = 0; i < h.rec_cnt; i++)
+    {
+      struct call *c = &calls[i];
+      size_t padded;
+
+      read_exactly (fd, &c->rec, sizeof c->rec);
+      if (c->rec.path_len > REPLAY_PATH_MAX)
+        {
+          printf ("replay: call %u has a %u-byte path\n",
+                  i, c->rec.path_len);
+          exit (EXIT_FAILURE);
+        }
+      padded = (c->rec.path_len + 7) / 8 * 8;
+      memset (c->path, 0, sizeof c->path);
+      if (padded > 0)
+        read_exactly (fd, c->path, padded);
+    }
+  call_cnt = h.rec_cnt;
+  close (fd);
+}
+
+/* Returns the real descriptor for traced descriptor FD, or -1. */
+static int
+real_fd (int64_t fd)
+{
+  return fd >= 0 && fd < FD_MAX ? fds[fd] : -1;
+}
+
+/* Reads (or, if WRITE, writes) LENGTH bytes through FD, at OFS or,
+   if OFS is negative, at its position, and returns the bytes
+   transferred, or -1. */
+static int64_t
+transfer (int fd, bool write_, int64_t length, int64_t ofs)
+{
+  int64_t done = 0;
+
+  while (done < length)
+    {
+      unsigned chunk = length - done < (int64_t) sizeof buf
+                       ? length - done : (int64_t) sizeof buf;
+      int n;
+
+      if (ofs < 0)
+        n = write_ ? write (fd, buf, chunk) : read (fd, buf, chunk);
+      else
+        n = (write_ ? pwrite (fd, buf, chunk, ofs + done)
+             : pread (fd, buf, chunk, ofs + done));
+      if (n < 0)
+        return done > 0 ? done : -1;
+      done += n;
+      if (n < (int) chunk)
+        break;
+    }
+  return done;
+}
+
+/* Counts the call as differing from the trace if its result RET
+   is not TRACED, or, if SIGN_ONLY, only if it did not fail
+   or succeed the same way. */
+static void
+compare (int64_t ret, int64_t traced, bool sign_only)
+{
+  if (sign_only ? (ret < 0) != (traced < 0) : ret != traced)
+    differed++;
+}
+
+/* Issues call C again. */
+static void
+issue (const struct call *c)
+{
+  const int64_t *args = c->rec.args;
+  int64_t traced = c->rec.ret;
+  int fd = -1;
+  size_t i;
+
+  switch (c->rec.nr)
+    {
+    case SYS_CREATE:
+      compare (create (c->path, args[1]), traced, false);
+      return;
+    case SYS_REMOVE:
+      compare (remove (c->path), traced, false);
+      return;
+    case SYS_OPEN:
+      fd = open (c->path);
+      compare (fd, traced, true);
+      if (traced >= 0 && traced < FD_MAX)
+        fds[traced] = fd;
+      else if (fd >= 0)
+        close (fd);
+      return;
+    case SYS_FORK:
+      {
+        pid_t pid;
+
+        if (traced <= 0)
+          break;
+        pid = fork ("replay");
+        if (pid == 0)
+          {
+            my_tid = traced;
+            child_cnt = 0;
+            forked = true;
+          }
+        else if (pid > 0 && child_cnt < CHILD_MAX)
+          {
+            children[child_cnt].traced = traced;
+            children[child_cnt++].real = pid;
+          }
+        else
+          differed++;
+        return;
+      }
+    case SYS_WAIT:
+      for (i = 0; i < child_cnt; i++)
+        if (children[i].traced == args[0])
+          {
+            compare (wait (children[i].real), traced, false);
+            return;
+          }
+      break;
+    case SYS_MMAP:
+      {
+        void *addr;
+
+        fd = real_fd (args[3]);
+        if (fd < 0)
+          break;
+        addr = mmap ((void *) args[0], args[1], args[2], fd, args[4]);
+        compare (addr != NULL ? 0 : -1, traced != 0 ? 0 : -1, false);
+        if (addr == NULL)
+          return;
+        for (i = 0; i < (size_t) args[1]; i += PAGE_SIZE)
+          (void) ((volatile char *) addr)[i];
+        for (i = 0; i < MAP_MAX; i++)
+          if (maps[i].real == NULL)
+            {
+              maps[i].traced = traced;
+              maps[i].real = addr;
+              break;
+            }
+        return;
+      }
+    case SYS_MUNMAP:
+      for (i = 0; i < MAP_MAX; i++)
+        if (maps[i].real != NULL && maps[i].traced == args[0])
+          {
+            munmap (maps[i].real);
+            maps[i].real = NULL;
+            return;
+          }
+      break;
+    default:
+      /* The rest all take a descriptor first. */
+      fd = real_fd (args[0]);
+      if (fd < 0)
+        break;
+      switch (c->rec.nr)
+        {
+        case SYS_CLOSE:
+          close (fd);
+          fds[args[0]] = -1;
+          return;
+        case SYS_READ:
+        case SYS_WRITE:
+          compare (transfer (fd, c->rec.nr == SYS_WRITE, args[1], -1),
+                   traced, false);
+          return;
+        case SYS_PREAD:
+        case SYS_PWRITE:
+          compare (transfer (fd, c->rec.nr == SYS_PWRITE, args[2], args[3]),
+                   traced, false);
+          return;
+        case SYS_SEEK:
+          seek (fd, args[1]);
+          return;
+        case SYS_FSYNC:
+          compare (fsync (fd), traced, false);
+          return;
+        }
+      break;
+    }
+  skipped++;
+}
+
+/* Counters read by read_disks(), in order. */
+static const char *disk_counters[4] =
+  {
+    "disk.hd0:1.reads", "disk.hd0:1.writes",
+    "disk.hd1:1.reads", "disk.hd1:1.writes",
+  };
+
+/* Reads the sectors read and written on the file system disk and
+   the swap disk into CNT[0] through CNT[3].  A disk that is not
+   there reads as 0. */
+static void
+read_disks (long long cnt[])
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+    {
+      int id = counter_find (disk_counters[i]);
+
+      cnt[i] = id >= 0 ? counter_read (id) : 0;
+    }
+}
+
+/* Prints the time since START, in ns, and START_TICKS, and the
+   disk traffic since BEFORE. */
+static void
+report (int64_t start, int64_t start_ticks, const long long before[])
+{
+  int64_t nsec = clock_nsec () - start;
+  long long after[4];
+
+  read_disks (after);
+  printf ("replay: %zu calls, %d skipped, %d differed from the trace\n",
+          call_cnt, skipped, differed);
+  printf ("replay: %lld ticks (%lld ms), file system disk reads=%lld "
+          "writes=%lld, swap disk reads=%lld writes=%lld\n",
+          (long long) (clock_ticks () - start_ticks),
+          (long long) (nsec / 1000000),
+          after[0] - before[0], after[1] - before[1],
+          after[2] - before[2], after[3] - before[3]);
+}
@@ -0,0 +1,53 @@
+#ifndef TESTS_FILESYS_FS_BENCH_H
+#define TESTS_FILESYS_FS_BENCH_H
+
+/* Helpers shared by the file system bench-* benchmarks.  Each
+   result is one line of the form
+
+     bench NAME PARAM=VALUE MB/s=X.XX ops/s=N reads=R writes=W
+
+   where R and W are the sectors the file system disk read and
+   wrote meanwhile, so that scripts can diff results across buffer
+   cache, read-ahead and allocator changes. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+/* A timed stretch of work. */
+struct fs_bench
+  {
+    int64_t start_ns;
+    long long reads, writes;
+  };
+
+static inline void
+fs_bench_begin (struct fs_bench *b)
+{
+  b->reads = get_fs_disk_read_cnt ();
+  b->writes = get_fs_disk_write_cnt ();
+  b->start_ns = clock_nsec ();
+}
+
+/* Reports B, begun with fs_bench_begin(), as OPS operations that
+   moved BYTES bytes in all, which must stay under 64 MB. */
+static inline void
+fs_bench_end (struct fs_bench *b, const char *name, const char *param,
+              long long value, long long bytes, long long ops)
+{
+  int64_t ns = clock_nsec () - b->start_ns;
+  long long reads = get_fs_disk_read_cnt () - b->reads;
+  long long writes = get_fs_disk_write_cnt () - b->writes;
+  long long centi_mbs, ops_s;
+
+  if (ns <= 0)
+    ns = 1;
+  centi_mbs = bytes * 100 * 1000000000 / ns / (1024 * 1024);
+  ops_s = ops * 1000000000 / ns;
+  msg ("bench %s %s=%lld MB/s=%lld.%02lld ops/s=%lld reads=%lld writes=%lld",
+       name, param, value, centi_mbs / 100, centi_mbs % 100, ops_s,
+       reads, writes);
+}
+
+#endif /* tests/filesys/fs-bench.h */
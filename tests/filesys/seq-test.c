@@ -1,5 +1,6 @@
 #include "tests/filesys/seq-test.h"
 #include <random.h>
+#include <string.h>
 #include <syscall.h>
 #include "tests/lib.h"
 
@@ -8,22 +9,38 @@ seq_test (const char *file_name, void *buf, size_t size, size_t initial_size,
           size_t (*block_size_func) (void),
           void (*check_func) (int fd, long ofs)) 
 {
-  size_t ofs;
   int fd;
   
   random_bytes (buf, size);
   CHECK (create (file_name, initial_size), "create \"%s\"", file_name);
   CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
 
-  ofs = 0;
   msg ("writing \"%s\"", file_name);
+  seq_write (fd, file_name, buf, size, block_size_func, check_func);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, size);
+}
+
+/* Writes SIZE bytes from BUF to FD, which is open on FILE_NAME,
+   at its current position, in blocks of the sizes
+   BLOCK_SIZE_FUNC returns.  Calls CHECK_FUNC, if non-null, after
+   each block. */
+void
+seq_write (int fd, const char *file_name, const void *buf, size_t size,
+           size_t (*block_size_func) (void),
+           void (*check_func) (int fd, long ofs))
+{
+  const char *p = buf;
+  size_t ofs = 0;
+
   while (ofs < size) 
     {
       size_t block_size = block_size_func ();
       if (block_size > size - ofs)
         block_size = size - ofs;
 
-      if (write (fd, buf + ofs, block_size) != (int) block_size)
+      if (write (fd, p + ofs, block_size) != (int) block_size)
         fail ("write %zu bytes at offset %zu in \"%s\" failed",
               block_size, ofs, file_name);
 
@@ -31,7 +48,27 @@ seq_test (const char *file_name, void *buf, size_t size, size_t initial_size,
       if (check_func != NULL)
         check_func (fd, ofs);
     }
-  msg ("close \"%s\"", file_name);
-  close (fd);
-  check_file (file_name, buf, size);
+}
+
+/* Reads SIZE bytes from FD, which is open on FILE_NAME, at its
+   current position, BLOCK_SIZE bytes at a time into BLOCK, and
+   fails unless they match BUF. */
+void
+seq_read (int fd, const char *file_name, const void *buf, size_t size,
+          void *block, size_t block_size)
+{
+  const char *p = buf;
+  size_t ofs = 0;
+
+  while (ofs < size)
+    {
+      if (block_size > size - ofs)
+        block_size = size - ofs;
+      if (read (fd, block, block_size) != (int) block_size)
+        fail ("read %zu bytes at offset %zu in \"%s\" failed",
+              block_size, ofs, file_name);
+      if (memcmp (block, p + ofs, block_size))
+        fail ("bad data at offset %zu in \"%s\"", ofs, file_name);
+      ofs += block_size;
+    }
 }
@@ -7,5 +7,10 @@ void seq_test (const char *file_name,
                void *buf, size_t size, size_t initial_size,
                size_t (*block_size_func) (void),
                void (*check_func) (int fd, long ofs));
+void seq_write (int fd, const char *file_name, const void *buf, size_t size,
+                size_t (*block_size_func) (void),
+                void (*check_func) (int fd, long ofs));
+void seq_read (int fd, const char *file_name, const void *buf, size_t size,
+               void *block, size_t block_size);
 
 #endif /* tests/filesys/seq-test.h */
@@ -0,0 +1,468 @@
+/* Microbenchmarks for kernel primitives.
+
+   Run with the `bench' action.  Each benchmark times a fixed
+   number of operations with the TSC, BENCH_TRIALS times over, and
+   reports the fewest cycles per operation any trial took, which
+   is the figure least disturbed by interrupts.  Output is one
+   "bench.KEY=CYCLES" line per benchmark, always the same keys in
+   the same order, so that runs on different commits can be
+   compared with diff.
+
+   The inputs are fixed, not drawn from the random seed, so that
+   the work done is the same from run to run. */
+
+#include "tests/internal/bench.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Trials of each benchmark. */
+#define BENCH_TRIALS 5
+
+/* Operations per trial, by kind. */
+#define SWITCH_OPS 2000         /* Semaphore round trips. */
+#define LOCK_OPS 10000          /* Uncontended acquire-release pairs. */
+#define CONTENDED_OPS 1000      /* Lock handoffs. */
+#define ALLOC_OPS 1000          /* Allocate-free pairs. */
+#define HASH_CNT 1024           /* Hash elements inserted and found. */
+#define SORT_CNT 1024           /* List elements sorted. */
+#define BITMAP_BITS 4096        /* Bits scanned. */
+#define MEM_OPS 1000            /* memcpy() or memset() calls. */
+#define PML4_PAGES 256          /* Pages mapped and looked up. */
+
+/* Benchmark: runs OPS operations on AUX and returns the cycles
+   they took. */
+typedef uint64_t bench_func (void *aux, unsigned ops);
+
+/* An element of the hash and list benchmarks. */
+struct elem
+  {
+    struct hash_elem hash_elem;
+    struct list_elem list_elem;
+    unsigned key;
+  };
+
+static struct elem elems[HASH_CNT > SORT_CNT ? HASH_CNT : SORT_CNT];
+
+static void report (const char *key, bench_func *, void *aux, unsigned ops);
+static bench_func bench_switch, bench_lock, bench_lock_contended;
+static bench_func bench_palloc, bench_malloc, bench_hash_insert;
+static bench_func bench_hash_find, bench_list_sort, bench_bitmap_scan;
+static bench_func bench_memcpy, bench_memset, bench_pml4_set;
+static bench_func bench_pml4_get;
+static hash_hash_func elem_hash;
+static hash_less_func elem_less;
+static list_less_func elem_list_less;
+static void fill_keys (size_t cnt);
+
+/* Runs every benchmark and prints its result. */
+void
+bench_run (char **argv UNUSED)
+{
+  static const size_t mem_sizes[] = { 64, 512, PGSIZE };
+  char key[32];
+  size_t size;
+  size_t i;
+
+  report ("sema.switch", bench_switch, NULL, SWITCH_OPS);
+  report ("lock.uncontended", bench_lock, NULL, LOCK_OPS);
+  report ("lock.contended", bench_lock_contended, NULL, CONTENDED_OPS);
+  report ("palloc.page", bench_palloc, NULL, ALLOC_OPS);
+  for (size = 16; size <= PGSIZE / 2; size *= 2)
+    {
+      snprintf (key, sizeof key, "malloc.%zu", size);
+      report (key, bench_malloc, &size, ALLOC_OPS);
+    }
+  report ("hash.insert", bench_hash_insert, NULL, HASH_CNT);
+  report ("hash.find", bench_hash_find, NULL, HASH_CNT);
+  snprintf (key, sizeof key, "list_sort.%d", SORT_CNT);
+  report (key, bench_list_sort, NULL, 1);
+  snprintf (key, sizeof key, "bitmap_scan.%d", BITMAP_BITS);
+  report (key, bench_bitmap_scan, NULL, 1);
+  for (i = 0; i < sizeof mem_sizes / sizeof *mem_sizes; i++)
+    {
+      size = mem_sizes[i];
+      snprintf (key, sizeof key, "memcpy.%zu", size);
+      report (key, bench_memcpy, &size, MEM_OPS);
+      snprintf (key, sizeof key, "memset.%zu", size);
+      report (key, bench_memset, &size, MEM_OPS);
+    }
+  report ("pml4.set_page", bench_pml4_set, NULL, PML4_PAGES);
+  report ("pml4.get_page", bench_pml4_get, NULL, PML4_PAGES);
+}
+
+/* Runs FUNC (AUX, OPS) BENCH_TRIALS times and prints the fewest
+   cycles per operation, labelled KEY. */
+static void
+report (const char *key, bench_func *func, void *aux, unsigned ops)
+{
+  uint64_t best = UINT64_MAX;
+  int i;
+
+  for (i = 0; i < BENCH_TRIALS; i++)
+    {
+      uint64_t cycles = func (aux, ops);
+      if (cycles < best)
+        best = cycles;
+    }
+  printf ("bench.%s=%llu\n", key, (unsigned long long) (best / ops));
+}
+
+/* Semaphore ping-pong between this thread and one of the same
+   priority.  Each operation is a round trip: two switches. */
+static struct semaphore ping, pong, done;
+
+static void
+pong_thread (void *ops_)
+{
+  unsigned ops = (uintptr_t) ops_;
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+  sema_up (&done);
+}
+
+static uint64_t
+bench_switch (void *aux UNUSED, unsigned ops)
+{
+  uint64_t start, cycles;
+  unsigned i;
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  sema_init (&done, 0);
+  thread_create ("pong", thread_get_priority (), pong_thread,
+                 (void *) (uintptr_t) ops);
+
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  cycles = rdtsc () - start;
+  sema_down (&done);
+  return cycles;
+}
+
+/* Acquiring and releasing a lock no one else wants. */
+static uint64_t
+bench_lock (void *aux UNUSED, unsigned ops)
+{
+  struct lock lock;
+  uint64_t start;
+  unsigned i;
+
+  lock_init (&lock);
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    {
+      lock_acquire (&lock);
+      lock_release (&lock);
+    }
+  return rdtsc () - start;
+}
+
+/* Handing a lock to a waiter.  A helper of higher priority waits
+   for the lock while this thread holds it, donating to it, takes
+   it when it is released, and gives it back.  Each operation is
+   one handoff and the switches around it. */
+static struct lock contended;
+static struct semaphore go;
+
+static void
+contender_thread (void *ops_)
+{
+  unsigned ops = (uintptr_t) ops_;
+  unsigned i;
+
+  for (i = 0; i < ops; i++)
+    {
+      sema_down (&go);
+      lock_acquire (&contended);
+      lock_release (&contended);
+    }
+  sema_up (&done);
+}
+
+static uint64_t
+bench_lock_contended (void *aux UNUSED, unsigned ops)
+{
+  int priority = thread_get_priority ();
+  uint64_t start, cycles;
+  unsigned i;
+
+  lock_init (&contended);
+  sema_init (&go, 0);
+  sema_init (&done, 0);
+  thread_create ("contender", priority < PRI_MAX ? priority + 1 : PRI_MAX,
+                 contender_thread, (void *) (uintptr_t) ops);
+
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    {
+      lock_acquire (&contended);
+      sema_up (&go);
+      lock_release (&contended);
+    }
+  cycles = rdtsc () - start;
+  sema_down (&done);
+  return cycles;
+}
+
+/* palloc_get_page() and palloc_free_page() of one kernel page. */
+static uint64_t
+bench_palloc (void *aux UNUSED, unsigned ops)
+{
+  uint64_t start;
+  unsigned i;
+
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    palloc_free_page (palloc_get_page (0));
+  return rdtsc () - start;
+}
+
+/* malloc() and free() of *SIZE_ bytes. */
+static uint64_t
+bench_malloc (void *size_, unsigned ops)
+{
+  size_t size = *(size_t *) size_;
+  uint64_t start;
+  unsigned i;
+
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    free (malloc (size));
+  return rdtsc () - start;
+}
+
+/* Inserting OPS elements into an empty hash table. */
+static uint64_t
+bench_hash_insert (void *aux UNUSED, unsigned ops)
+{
+  struct hash h;
+  uint64_t start, cycles;
+  unsigned i;
+
+  fill_keys (ops);
+  if (!hash_init (&h, elem_hash, elem_less, NULL))
+    PANIC ("out of memory");
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    hash_insert (&h, &elems[i].hash_elem);
+  cycles = rdtsc () - start;
+  hash_destroy (&h, NULL);
+  return cycles;
+}
+
+/* Finding each of OPS elements in a hash table that holds them. */
+static uint64_t
+bench_hash_find (void *aux UNUSED, unsigned ops)
+{
+  struct hash h;
+  uint64_t start, cycles;
+  unsigned i;
+
+  fill_keys (ops);
+  if (!hash_init (&h, elem_hash, elem_less, NULL))
+    PANIC ("out of memory");
+  for (i = 0; i < ops; i++)
+    hash_insert (&h, &elems[i].hash_elem);
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    if (hash_find (&h, &elems[i].hash_elem) == NULL)
+      PANIC ("hash element lost");
+  cycles = rdtsc () - start;
+  hash_destroy (&h, NULL);
+  return cycles;
+}
+
+/* Sorting a list of SORT_CNT elements in a fixed shuffled order.
+   The operation is the whole sort. */
+static uint64_t
+bench_list_sort (void *aux UNUSED, unsigned ops)
+{
+  struct list list;
+  uint64_t cycles = 0;
+  unsigned i, j;
+
+  for (i = 0; i < ops; i++)
+    {
+      uint64_t start;
+
+      fill_keys (SORT_CNT);
+      list_init (&list);
+      for (j = 0; j < SORT_CNT; j++)
+        list_push_back (&list, &elems[j].list_elem);
+      start = rdtsc ();
+      list_sort (&list, elem_list_less, NULL);
+      cycles += rdtsc () - start;
+    }
+  return cycles;
+}
+
+/* Scanning a bitmap of BITMAP_BITS bits for its only clear bit,
+   the last.  The operation is the whole scan. */
+static uint64_t
+bench_bitmap_scan (void *aux UNUSED, unsigned ops)
+{
+  struct bitmap *b = bitmap_create (BITMAP_BITS);
+  uint64_t start, cycles;
+  unsigned i;
+
+  if (b == NULL)
+    PANIC ("out of memory");
+  bitmap_set_all (b, true);
+  bitmap_reset (b, BITMAP_BITS - 1);
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    if (bitmap_scan (b, 0, 1, false) != BITMAP_BITS - 1)
+      PANIC ("bitmap_scan found the wrong bit");
+  cycles = rdtsc () - start;
+  bitmap_destroy (b);
+  return cycles;
+}
+
+/* memcpy() of *SIZE_ bytes between two pages. */
+static uint64_t
+bench_memcpy (void *size_, unsigned ops)
+{
+  size_t size = *(size_t *) size_;
+  uint8_t *a = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  uint8_t *b = palloc_get_page (PAL_ASSERT);
+  uint64_t start, cycles;
+  unsigned i;
+
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    {
+      memcpy (b, a, size);
+      barrier ();
+    }
+  cycles = rdtsc () - start;
+  palloc_free_page (a);
+  palloc_free_page (b);
+  return cycles;
+}
+
+/* memset() of *SIZE_ bytes of a page. */
+static uint64_t
+bench_memset (void *size_, unsigned ops)
+{
+  size_t size = *(size_t *) size_;
+  uint8_t *a = palloc_get_page (PAL_ASSERT);
+  uint64_t start, cycles;
+  unsigned i;
+
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    {
+      memset (a, i, size);
+      barrier ();
+    }
+  cycles = rdtsc () - start;
+  palloc_free_page (a);
+  return cycles;
+}
+
+/* First user page the pml4 benchmarks map. */
+#define BENCH_UPAGE ((uint8_t *) 0x10000000)
+
+/* Maps OPS consecutive user pages of a fresh page table, all to
+   one kernel page, and, if GET, looks each up again.  Returns the
+   cycles the mapping took, or the lookups if GET.  The mappings
+   are cleared before the table goes, so that it frees nothing
+   but its own page tables. */
+static uint64_t
+pml4_bench (unsigned ops, bool get)
+{
+  uint64_t *pml4 = pml4_create ();
+  void *kpage = palloc_get_page (PAL_ASSERT);
+  uint64_t start, cycles;
+  unsigned i;
+
+  if (pml4 == NULL)
+    PANIC ("out of memory");
+  start = rdtsc ();
+  for (i = 0; i < ops; i++)
+    if (!pml4_set_page (pml4, BENCH_UPAGE + i * PGSIZE, kpage, true))
+      PANIC ("out of memory");
+  cycles = rdtsc () - start;
+  if (get)
+    {
+      start = rdtsc ();
+      for (i = 0; i < ops; i++)
+        if (pml4_get_page (pml4, BENCH_UPAGE + i * PGSIZE) != kpage)
+          PANIC ("pml4_get_page returned the wrong page");
+      cycles = rdtsc () - start;
+    }
+  for (i = 0; i < ops; i++)
+    pml4_clear_page (pml4, BENCH_UPAGE + i * PGSIZE);
+  pml4_destroy (pml4);
+  palloc_free_page (kpage);
+  return cycles;
+}
+
+/* pml4_set_page() of a page not yet mapped. */
+static uint64_t
+bench_pml4_set (void *aux UNUSED, unsigned ops)
+{
+  return pml4_bench (ops, false);
+}
+
+/* pml4_get_page() of a mapped page. */
+static uint64_t
+bench_pml4_get (void *aux UNUSED, unsigned ops)
+{
+  return pml4_bench (ops, true);
+}
+
+/* Gives the first CNT of ELEMS distinct keys in a fixed scrambled
+   order. */
+static void
+fill_keys (size_t cnt)
+{
+  size_t i;
+
+  ASSERT (cnt <= sizeof elems / sizeof *elems);
+  for (i = 0; i < cnt; i++)
+    elems[i].key = (i * 2654435761u) % 1000003;
+}
+
+static uint64_t
+elem_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct elem, hash_elem)->key);
+}
+
+static bool
+elem_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return (hash_entry (a, struct elem, hash_elem)->key
+          < hash_entry (b, struct elem, hash_elem)->key);
+}
+
+static bool
+elem_list_less (const struct list_elem *a, const struct list_elem *b,
+                void *aux UNUSED)
+{
+  return (list_entry (a, struct elem, list_elem)->key
+          < list_entry (b, struct elem, list_elem)->key);
+}
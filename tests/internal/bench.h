@@ -0,0 +1,6 @@
+#ifndef TESTS_INTERNAL_BENCH_H
+#define TESTS_INTERNAL_BENCH_H
+
+void bench_run (char **argv);
+
+#endif /* tests/internal/bench.h */
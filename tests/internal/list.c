@@ -30,6 +30,7 @@ static bool value_less (const struct list_elem *, const struct list_elem *,
                         void *);
 static void verify_list_fwd (struct list *, int size);
 static void verify_list_bkwd (struct list *, int size);
+static void verify_clist (struct value[], int size);
 
 /* Test the linked list implementation. */
 void
@@ -101,6 +102,11 @@ test (void)
           ASSERT ((size_t) ofs < sizeof values / sizeof *values);
           list_unique (&list, NULL, value_less, NULL);
           verify_list_fwd (&list, size);
+
+          /* Assemble a counted list, then remove its maximum
+             repeatedly, and verify its size and maximum. */
+          shuffle (values, size);
+          verify_clist (values, size);
         }
     }
   
@@ -172,3 +178,51 @@ verify_list_bkwd (struct list *list, int size)
   ASSERT (i == size);
   ASSERT (e == list_rend (list));
 }
+
+/* Verifies that a counted list of the SIZE values in VALUES, which
+   are 0...SIZE in some order, knows its size and maximum as its
+   maximum is taken away, and that raising a key to the top makes
+   that element the maximum. */
+static void
+verify_clist (struct value values[], int size)
+{
+  struct clist clist;
+  int i;
+
+  clist_init (&clist, value_less, NULL);
+  for (i = 0; i < size; i++)
+    if (i % 2)
+      clist_push_back (&clist, &values[i].elem);
+    else
+      clist_push_front (&clist, &values[i].elem);
+  ASSERT (clist_size (&clist) == (size_t) size);
+  ASSERT (list_size (&clist.list) == (size_t) size);
+
+  if (size > 1)
+    {
+      struct value *v = list_entry (list_front (&clist.list),
+                                    struct value, elem);
+      int old = v->value;
+
+      if (old != size - 1)
+        {
+          ASSERT (clist_max (&clist) != &v->elem);
+          v->value = size;
+          clist_raise (&clist, &v->elem);
+          ASSERT (clist_max (&clist) == &v->elem);
+          clist_remove (&clist, &v->elem);
+          v->value = old;
+          clist_push_back (&clist, &v->elem);
+        }
+    }
+
+  for (i = size - 1; i >= 0; i--)
+    {
+      struct list_elem *e = clist_max (&clist);
+      ASSERT (list_entry (e, struct value, elem)->value == i);
+      clist_remove (&clist, e);
+      ASSERT (clist_size (&clist) == (size_t) i);
+    }
+  ASSERT (clist_empty (&clist));
+  ASSERT (clist_max (&clist) == list_end (&clist.list));
+}
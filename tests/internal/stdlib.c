@@ -19,6 +19,7 @@
 #define MAX_CNT 4096
 
 static void shuffle (int[], size_t);
+static void reverse (int[], size_t);
 static int compare_ints (const void *, const void *);
 static void verify_order (const int[], size_t);
 static void verify_bsearch (const int[], size_t);
@@ -50,6 +51,14 @@ test (void)
           verify_order (values, cnt);
           verify_bsearch (values, cnt);
         }
+
+      /* Sorted and reversed input are the classic bad cases for
+         quicksort pivot selection. */
+      qsort (values, cnt, sizeof *values, compare_ints);
+      verify_order (values, cnt);
+      reverse (values, cnt);
+      qsort (values, cnt, sizeof *values, compare_ints);
+      verify_order (values, cnt);
     }
   
   printf (" done\n");
@@ -71,6 +80,20 @@ shuffle (int *array, size_t cnt)
     }
 }
 
+/* Reverses the order of the CNT elements in ARRAY. */
+static void
+reverse (int *array, size_t cnt) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt / 2; i++)
+    {
+      int t = array[i];
+      array[i] = array[cnt - i - 1];
+      array[cnt - i - 1] = t;
+    }
+}
+
 /* Returns 1 if *A is greater than *B,
    0 if *A equals *B,
    -1 if *A is less than *B. */
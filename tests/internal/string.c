@@ -0,0 +1,199 @@
+/* Test program for memcpy(), memmove() and memset(), and for
+   memcmp(), memchr(), strchr() and strlen(), in lib/string.c.
+
+   Checks them against one-byte-at-a-time loops at every pair of
+   alignments for a range of sizes, then times the block functions
+   on the block sizes the kernel moves most: small structures,
+   disk sectors and whole pages.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "intrinsic.h"
+#include "threads/test.h"
+
+/* Largest size checked, and the buffers' size. */
+#define MAX_SIZE 600
+#define BUF_SIZE 8192
+
+/* Times each benchmark runs. */
+#define ROUNDS 256
+
+static unsigned char src[BUF_SIZE], dst[BUF_SIZE], ref[BUF_SIZE];
+
+static void byte_copy (void *, const void *, size_t);
+static void byte_move (void *, const void *, size_t);
+static void byte_set (void *, int, size_t);
+static void check (void);
+static void check_search (void);
+static void bench (size_t size);
+
+/* Tests and times the block memory functions. */
+void
+test (void) 
+{
+  check ();
+  check_search ();
+  printf ("%6s %12s %12s %12s %12s\n",
+          "bytes", "memcpy", "byte copy", "memset", "byte set");
+  bench (64);
+  bench (512);
+  bench (4096);
+  bench (BUF_SIZE);
+  printf ("done\n");
+}
+
+/* Compares each function with its byte loop at every alignment. */
+static void
+check (void) 
+{
+  size_t size;
+  int sofs, dofs;
+
+  for (size = 0; size < MAX_SIZE; size += size < 64 ? 1 : 37)
+    for (sofs = 0; sofs < 8; sofs++)
+      for (dofs = 0; dofs < 8; dofs++) 
+        {
+          random_bytes (src, sizeof src);
+          random_bytes (dst, sizeof dst);
+          memcpy (ref, dst, sizeof ref);
+
+          memcpy (dst + dofs, src + sofs, size);
+          byte_copy (ref + dofs, src + sofs, size);
+          ASSERT (!memcmp (dst, ref, sizeof dst));
+
+          memmove (dst + dofs, dst + sofs + 4, size);
+          byte_move (ref + dofs, ref + sofs + 4, size);
+          ASSERT (!memcmp (dst, ref, sizeof dst));
+
+          memmove (dst + sofs + 4, dst + dofs, size);
+          byte_move (ref + sofs + 4, ref + dofs, size);
+          ASSERT (!memcmp (dst, ref, sizeof dst));
+
+          memset (dst + dofs, sofs * 37, size);
+          byte_set (ref + dofs, sofs * 37, size);
+          ASSERT (!memcmp (dst, ref, sizeof dst));
+        }
+  printf ("memcpy, memmove and memset agree with byte loops\n");
+}
+
+/* Checks the search functions at every alignment against byte
+   loops, on text drawn from a few letters so that matches are
+   common and on strings that end at every offset in a word. */
+static void
+check_search (void) 
+{
+  size_t size, i;
+  int ofs, c;
+
+  for (size = 0; size < 80; size++)
+    for (ofs = 0; ofs < 8; ofs++)
+      for (c = 'a'; c <= 'd'; c++) 
+        {
+          unsigned char *s = src + ofs;
+          const unsigned char *p;
+
+          random_bytes (src, sizeof src);
+          for (i = 0; i < size; i++)
+            s[i] = 'a' + s[i] % 8;
+          s[size] = '\0';
+
+          for (p = s; p < s + size && *p != c; p++)
+            continue;
+          ASSERT (memchr (s, c, size) == (p < s + size ? p : NULL));
+          ASSERT (strchr ((char *) s, c)
+                  == (p < s + size ? (char *) p : NULL));
+          ASSERT (strchr ((char *) s, '\0') == (char *) s + size);
+          ASSERT (strlen ((char *) s) == size);
+
+          memcpy (dst + c - 'a', s, size);
+          ASSERT (!memcmp (dst + c - 'a', s, size));
+          if (size > 0) 
+            {
+              i = (size - 1) * (c - 'a') / 3;
+              dst[c - 'a' + i]++;
+              ASSERT (memcmp (dst + c - 'a', s, size) > 0);
+              ASSERT (memcmp (s, dst + c - 'a', size) < 0);
+            }
+        }
+  printf ("memcmp, memchr, strchr and strlen agree with byte loops\n");
+}
+
+/* Prints the cycles per call of each function and its byte loop
+   for SIZE-byte blocks. */
+static void
+bench (size_t size) 
+{
+  uint64_t start, t[4];
+  int i;
+
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    memcpy (dst, src, size);
+  t[0] = rdtsc () - start;
+
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    byte_copy (dst, src, size);
+  t[1] = rdtsc () - start;
+
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    memset (dst, i, size);
+  t[2] = rdtsc () - start;
+
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    byte_set (dst, i, size);
+  t[3] = rdtsc () - start;
+
+  printf ("%6zu %12llu %12llu %12llu %12llu\n", size,
+          (unsigned long long) t[0] / ROUNDS,
+          (unsigned long long) t[1] / ROUNDS,
+          (unsigned long long) t[2] / ROUNDS,
+          (unsigned long long) t[3] / ROUNDS);
+}
+
+/* The byte loops lib/string.c used to have. */
+static void
+byte_copy (void *dst_, const void *src_, size_t size) 
+{
+  unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+static void
+byte_move (void *dst_, const void *src_, size_t size) 
+{
+  unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  if (dst < src) 
+    while (size-- > 0)
+      *dst++ = *src++;
+  else 
+    {
+      dst += size;
+      src += size;
+      while (size-- > 0)
+        *--dst = *--src;
+    }
+}
+
+static void
+byte_set (void *dst_, int value, size_t size) 
+{
+  unsigned char *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+}
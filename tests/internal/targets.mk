@@ -0,0 +1 @@
+tests/internal_SRC = tests/internal/bench.c	# Kernel microbenchmarks.
@@ -109,6 +109,10 @@ wait_children (pid_t pids[], size_t child_cnt)
     }
 }
 
+/* Checks that the file open as FD, named FILE_NAME, holds the
+   SIZE bytes at BUF_, reading them with read() from FD's current
+   position, which ends up SIZE bytes further on, and fails at the
+   first byte that differs. */
 void
 check_file_handle (int fd,
                    const char *file_name, const void *buf_, size_t size) 
@@ -125,10 +129,12 @@ check_file_handle (int fd,
     msg ("size of %s (%zu) differs from expected (%zu)",
           file_name, file_size, size);
 
-  /* Read the file block-by-block, comparing data as we go. */
+  /* Read the file block-by-block, comparing data as we go.  The
+     blocks are large, to keep the system calls few for big files,
+     and so static: a user stack may be a single page. */
   while (ofs < size)
     {
-      char block[512];
+      static char block[4096];
       size_t block_size, ret_val;
 
       block_size = size - ofs;
@@ -152,6 +158,52 @@ check_file_handle (int fd,
   msg ("verified contents of \"%s\"", file_name);
 }
 
+/* Bytes check_file_pread() reads at a time. */
+#define PREAD_BLOCK_SIZE (16 * 1024)
+
+/* Checks, as check_file_handle() does, that the file open as FD,
+   named FILE_NAME, holds the SIZE bytes at BUF_, but reads it
+   from the start with pread(), in large page-aligned blocks, so
+   that a big file costs few system calls next to the file system
+   work being tested.  FD's position is left alone. */
+void
+check_file_pread (int fd,
+                  const char *file_name, const void *buf_, size_t size)
+{
+  static char block[PREAD_BLOCK_SIZE] __attribute__ ((aligned (4096)));
+  const char *buf = buf_;
+  size_t ofs = 0;
+  size_t file_size;
+
+  file_size = filesize (fd);
+  if (file_size != size)
+    msg ("size of %s (%zu) differs from expected (%zu)",
+          file_name, file_size, size);
+
+  while (ofs < size)
+    {
+      size_t block_size, ret_val;
+
+      block_size = size - ofs;
+      if (block_size > sizeof block)
+        block_size = sizeof block;
+
+      ret_val = pread (fd, block, block_size, ofs);
+      if (ret_val != block_size)
+        fail ("read of %zu bytes at offset %zu in \"%s\" returned %zu",
+              block_size, ofs, file_name, ret_val);
+
+      compare_bytes (block, buf + ofs, block_size, ofs, file_name);
+      ofs += block_size;
+    }
+
+  if (file_size != size)
+    fail ("size of %s (%zu) differs from expected (%zu)",
+          file_name, file_size, size);
+
+  msg ("verified contents of \"%s\"", file_name);
+}
+
 void
 check_file (const char *file_name, const void *buf, size_t size) 
 {
@@ -159,7 +211,7 @@ check_file (const char *file_name, const void *buf, size_t size)
 
   CHECK ((fd = open (file_name)) > 1, "open \"%s\" for verification",
          file_name);
-  check_file_handle (fd, file_name, buf, size);
+  check_file_pread (fd, file_name, buf, size);
   msg ("close \"%s\"", file_name);
   close (fd);
 }
@@ -42,6 +42,8 @@ void wait_children (pid_t pids[], size_t child_cnt);
 
 void check_file_handle (int fd, const char *file_name,
                         const void *buf_, size_t filesize);
+void check_file_pread (int fd, const char *file_name,
+                       const void *buf_, size_t filesize);
 void check_file (const char *file_name, const void *buf, size_t filesize);
 
 void compare_bytes (const void *read_data, const void *expected_data,
@@ -0,0 +1,232 @@
+/* Measures wakeup latency.
+
+   alarm-latency runs SLEEPER_CNT threads that each call
+   timer_sleep (1) SLEEP_CNT times, starting just after a tick so
+   that the ideal delay is one tick, and reports the distribution
+   of the actual delays.  Waking early, or a 99th percentile past
+   two ticks, fails the test.
+
+   cond-latency passes tokens down a chain of STAGE_CNT threads,
+   each waiting on its own condition variable for the one before
+   it to cond_signal(), and reports the distribution of the time
+   from each signal to the wakeup of its waiter. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define SLEEPER_CNT 8
+#define SLEEP_CNT 100
+#define STAGE_CNT 4
+#define TOKEN_CNT 500
+
+#define NSEC_PER_TICK (1000000000 / TIMER_FREQ)
+
+/* Delays recorded by all the threads of one test, in ns. */
+#define SAMPLE_MAX (SLEEPER_CNT * SLEEP_CNT > (STAGE_CNT + 1) * TOKEN_CNT \
+                    ? SLEEPER_CNT * SLEEP_CNT : (STAGE_CNT + 1) * TOKEN_CNT)
+static int64_t samples[SAMPLE_MAX];
+static size_t sample_cnt;
+static struct lock sample_lock;
+
+static void record (int64_t);
+static void report (const char *what);
+
+static thread_func sleeper_thread;
+static struct semaphore done;
+
+void
+test_alarm_latency (void)
+{
+  int64_t early = 0, late = 0;
+  size_t i;
+
+  sample_cnt = 0;
+  lock_init (&sample_lock);
+  sema_init (&done, 0);
+  for (i = 0; i < SLEEPER_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "sleeper %zu", i);
+      thread_create (name, PRI_DEFAULT, sleeper_thread, NULL);
+    }
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_down (&done);
+
+  report ("timer_sleep (1) delay");
+  for (i = 0; i < sample_cnt; i++)
+    if (samples[i] < 0)
+      early++;
+    else if (samples[i] > 2 * NSEC_PER_TICK)
+      late++;
+  if (early > 0)
+    fail ("%"PRId64" sleeps woke before the next tick", early);
+  if (late * 100 > (int64_t) sample_cnt)
+    fail ("%"PRId64" of %zu sleeps took more than two ticks",
+          late, sample_cnt);
+  pass ();
+}
+
+/* Sleeps one tick SLEEP_CNT times, recording each delay, or -1
+   if the clock had not moved on. */
+static void
+sleeper_thread (void *aux UNUSED)
+{
+  int i;
+
+  timer_sleep (1);
+  for (i = 0; i < SLEEP_CNT; i++)
+    {
+      int64_t start_tick = timer_ticks ();
+      int64_t start = timer_nsec ();
+
+      timer_sleep (1);
+      record (timer_ticks () > start_tick ? timer_nsec () - start : -1);
+    }
+  sema_up (&done);
+}
+
+/* One link of the cond-latency chain. */
+struct link
+  {
+    struct lock lock;
+    struct condition cond;
+    bool full;                  /* Holds a token? */
+    int token;                  /* Token number. */
+    int64_t sent;               /* timer_nsec() when it was signaled. */
+  };
+
+static struct link links[STAGE_CNT + 1];
+
+static thread_func stage_thread;
+static void link_put (struct link *, int token);
+static int link_take (struct link *);
+
+void
+test_cond_latency (void)
+{
+  int i;
+
+  sample_cnt = 0;
+  lock_init (&sample_lock);
+  for (i = 0; i <= STAGE_CNT; i++)
+    {
+      lock_init (&links[i].lock);
+      cond_init (&links[i].cond);
+      links[i].full = false;
+    }
+  for (i = 0; i < STAGE_CNT; i++)
+    {
+      char name[16];
+
+      snprintf (name, sizeof name, "stage %d", i);
+      thread_create (name, PRI_DEFAULT, stage_thread, &links[i]);
+    }
+
+  for (i = 0; i < TOKEN_CNT; i++)
+    {
+      link_put (&links[0], i);
+      if (link_take (&links[STAGE_CNT]) != i)
+        fail ("token %d came out of order", i);
+    }
+  link_put (&links[0], -1);
+  link_take (&links[STAGE_CNT]);
+
+  report ("cond_signal() to wakeup");
+  pass ();
+}
+
+/* Passes tokens from LINK to the link after it until it takes
+   token -1, which it passes on before exiting. */
+static void
+stage_thread (void *link_)
+{
+  struct link *link = link_;
+  int token;
+
+  do
+    {
+      token = link_take (link);
+      link_put (link + 1, token);
+    }
+  while (token != -1);
+}
+
+/* Waits for LINK to be empty, then puts TOKEN in it and wakes its
+   taker. */
+static void
+link_put (struct link *link, int token)
+{
+  lock_acquire (&link->lock);
+  while (link->full)
+    cond_wait (&link->cond, &link->lock);
+  link->full = true;
+  link->token = token;
+  link->sent = timer_nsec ();
+  cond_signal (&link->cond, &link->lock);
+  lock_release (&link->lock);
+}
+
+/* Waits for a token in LINK and returns it, recording how long
+   the signal took to wake us if we had to wait. */
+static int
+link_take (struct link *link)
+{
+  bool waited = false;
+  int token;
+
+  lock_acquire (&link->lock);
+  while (!link->full)
+    {
+      cond_wait (&link->cond, &link->lock);
+      waited = true;
+    }
+  if (waited && link->token != -1)
+    record (timer_nsec () - link->sent);
+  token = link->token;
+  link->full = false;
+  cond_signal (&link->cond, &link->lock);
+  lock_release (&link->lock);
+  return token;
+}
+
+/* Adds DELAY to the samples. */
+static void
+record (int64_t delay)
+{
+  lock_acquire (&sample_lock);
+  ASSERT (sample_cnt < sizeof samples / sizeof *samples);
+  samples[sample_cnt++] = delay;
+  lock_release (&sample_lock);
+}
+
+static int
+compare_samples (const void *a_, const void *b_)
+{
+  int64_t a = *(const int64_t *) a_;
+  int64_t b = *(const int64_t *) b_;
+
+  return a < b ? -1 : a > b;
+}
+
+/* Prints the distribution of the samples of WHAT, in us. */
+static void
+report (const char *what)
+{
+  if (sample_cnt == 0)
+    fail ("no samples of %s", what);
+  qsort (samples, sample_cnt, sizeof *samples, compare_samples);
+  msg ("%s over %zu samples, in us:", what, sample_cnt);
+  msg ("min %"PRId64", median %"PRId64", 90%% %"PRId64
+       ", 99%% %"PRId64", max %"PRId64".",
+       samples[0] / 1000, samples[sample_cnt / 2] / 1000,
+       samples[sample_cnt * 90 / 100] / 1000,
+       samples[sample_cnt * 99 / 100] / 1000,
+       samples[sample_cnt - 1] / 1000);
+}
@@ -0,0 +1,148 @@
+/* Measures how CPU time is shared among CPU-bound threads.
+
+   Starts GROUP_CNT groups of GROUP_SIZE spinning threads, each
+   group at its own priority (or, with -mlfqs, its own nice
+   value), lets them run for SPIN_SECS seconds, and compares the
+   ticks each received with its ideal share:
+
+   - With the priority scheduler, the highest-priority group
+     shares the CPU evenly and the others get nothing.
+
+   - With -rr, priorities are ignored and every thread gets an
+     even share.
+
+   - With -mlfqs there is no closed form, so each thread's ideal
+     is its group's mean, and the groups must be ordered by nice
+     value.
+
+   A thread more than TOLERANCE percent off its ideal fails the
+   test, as does a starved thread that ran at all. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define GROUP_CNT 3
+#define GROUP_SIZE 3
+#define THREAD_CNT (GROUP_CNT * GROUP_SIZE)
+
+#define SLEEP_SECS 1            /* Time for every thread to start. */
+#define SPIN_SECS 10            /* Time spent spinning. */
+#define TOLERANCE 20            /* Allowed error, in percent. */
+
+/* Nice value of each group under the MLFQS. */
+#define GROUP_NICE(G) ((G) * 4)
+
+/* Priority of each group otherwise, all below the main
+   thread's so that it can wake up to collect the results. */
+#define GROUP_PRIORITY(G) (PRI_DEFAULT - 1 - (G))
+
+struct spinner
+  {
+    int64_t start;              /* Tick the test started. */
+    int group;                  /* Group number. */
+    int ticks;                  /* Ticks during which it ran. */
+  };
+
+static thread_func spinner_thread;
+
+void
+test_sched_fair (void)
+{
+  struct spinner spinners[THREAD_CNT];
+  int group_ticks[GROUP_CNT] = { 0 };
+  int64_t start;
+  int worst = 0;
+  int total = 0;
+  int i;
+
+  if (thread_mlfqs)
+    thread_set_nice (-20);
+
+  start = timer_ticks ();
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      struct spinner *s = &spinners[i];
+      char name[16];
+
+      s->start = start;
+      s->group = i / GROUP_SIZE;
+      s->ticks = 0;
+      snprintf (name, sizeof name, "spin %d", i);
+      thread_create (name, GROUP_PRIORITY (s->group), spinner_thread, s);
+    }
+
+  msg ("Sleeping %d seconds to let threads run, please wait...",
+       SLEEP_SECS + SPIN_SECS + 1);
+  timer_sleep ((SLEEP_SECS + SPIN_SECS + 1) * TIMER_FREQ);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      group_ticks[spinners[i].group] += spinners[i].ticks;
+      total += spinners[i].ticks;
+    }
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      const struct spinner *s = &spinners[i];
+      int ideal, error;
+
+      if (thread_mlfqs)
+        ideal = group_ticks[s->group] / GROUP_SIZE;
+      else if (thread_rr)
+        ideal = total / THREAD_CNT;
+      else
+        ideal = s->group == 0 ? total / GROUP_SIZE : 0;
+
+      msg ("Thread %d (%s %d) received %d ticks, ideal %d.", i,
+           thread_mlfqs ? "nice" : "priority",
+           thread_mlfqs ? GROUP_NICE (s->group) : GROUP_PRIORITY (s->group),
+           s->ticks, ideal);
+      if (ideal == 0)
+        {
+          if (s->ticks != 0)
+            fail ("thread %d should have starved but ran %d ticks",
+                  i, s->ticks);
+          continue;
+        }
+      error = (s->ticks > ideal ? s->ticks - ideal : ideal - s->ticks)
+              * 100 / ideal;
+      if (error > worst)
+        worst = error;
+    }
+  msg ("Largest error %d%% of ideal over %d ticks.", worst, total);
+
+  if (total == 0)
+    fail ("no thread ran");
+  if (worst > TOLERANCE)
+    fail ("a thread was more than %d%% off its ideal share", TOLERANCE);
+  if (thread_mlfqs)
+    for (i = 1; i < GROUP_CNT; i++)
+      if (group_ticks[i] > group_ticks[i - 1])
+        fail ("nice %d threads got more CPU than nice %d threads",
+              GROUP_NICE (i), GROUP_NICE (i - 1));
+  pass ();
+}
+
+static void
+spinner_thread (void *s_)
+{
+  struct spinner *s = s_;
+  int64_t sleep_time = SLEEP_SECS * TIMER_FREQ;
+  int64_t spin_time = sleep_time + SPIN_SECS * TIMER_FREQ;
+  int64_t last_time = 0;
+
+  if (thread_mlfqs)
+    thread_set_nice (GROUP_NICE (s->group));
+  timer_sleep (sleep_time - timer_elapsed (s->start));
+  while (timer_elapsed (s->start) < spin_time)
+    {
+      int64_t cur_time = timer_ticks ();
+      if (cur_time != last_time)
+        s->ticks++;
+      last_time = cur_time;
+    }
+}
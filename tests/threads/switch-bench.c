@@ -0,0 +1,55 @@
+/* Measures kernel thread switches per second by ping-ponging
+   between two threads of equal priority on a pair of
+   semaphores.  Each round trip is two switches. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define ROUND_TRIPS 20000
+
+static thread_func pong_thread;
+static struct semaphore ping, pong, done;
+
+void
+test_switch_bench (void) 
+{
+  int64_t start, elapsed;
+  int i;
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  sema_init (&done, 0);
+  thread_create ("pong", thread_get_priority (), pong_thread, NULL);
+
+  start = timer_ticks ();
+  for (i = 0; i < ROUND_TRIPS; i++) 
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  elapsed = timer_elapsed (start);
+  sema_down (&done);
+
+  if (elapsed == 0)
+    elapsed = 1;
+  msg ("%d switches in %lld ticks, about %lld switches per second.",
+       2 * ROUND_TRIPS, elapsed, 2 * ROUND_TRIPS * TIMER_FREQ / elapsed);
+  pass ();
+}
+
+static void
+pong_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUND_TRIPS; i++) 
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+  sema_up (&done);
+}
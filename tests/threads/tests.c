@@ -29,6 +29,10 @@ static const struct test tests[] =
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"switch-bench", test_switch_bench},
+    {"sched-fair", test_sched_fair},
+    {"alarm-latency", test_alarm_latency},
+    {"cond-latency", test_cond_latency},
     {"mlfqs-load-1", test_mlfqs_load_1},
     {"mlfqs-load-60", test_mlfqs_load_60},
     {"mlfqs-load-avg", test_mlfqs_load_avg},
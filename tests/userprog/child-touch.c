@@ -0,0 +1,27 @@
+/* Child process run by proc-bench-exit.
+   Writes to the first KB kilobytes of a 1 MB buffer, where KB is
+   its argument, and exits. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "tests/lib.h"
+
+#define MAX_KB 1024
+
+static char buf[MAX_KB * 1024];
+
+int
+main (int argc, char *argv[])
+{
+  int kb;
+
+  test_name = "child-touch";
+
+  if (argc != 2)
+    fail ("argc=%d, should be 2", argc);
+  kb = atoi (argv[1]);
+  if (kb < 0 || kb > MAX_KB)
+    fail ("kb=%d, should be 0...%d", kb, MAX_KB);
+  memset (buf, 0xa5, kb * 1024);
+  return 0;
+}
@@ -0,0 +1,26 @@
+/* Copies sample.txt into a new file with copy_file_range(),
+   asking for more than there is, and checks the copy. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int in, out, n;
+
+  CHECK (create ("copy.txt", sizeof sample - 1), "create \"copy.txt\"");
+  CHECK ((in = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((out = open ("copy.txt")) > 1, "open \"copy.txt\"");
+
+  n = copy_file_range (in, out, 2 * sizeof sample);
+  if (n != sizeof sample - 1)
+    fail ("copy_file_range() returned %d instead of %zu", n,
+          sizeof sample - 1);
+  msg ("copy_file_range");
+  close (in);
+  close (out);
+  check_file ("copy.txt", sample, sizeof sample - 1);
+}
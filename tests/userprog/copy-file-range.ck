@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-file-range) begin
+(copy-file-range) create "copy.txt"
+(copy-file-range) open "sample.txt"
+(copy-file-range) open "copy.txt"
+(copy-file-range) copy_file_range
+(copy-file-range) open "copy.txt" for verification
+(copy-file-range) verified contents of "copy.txt"
+(copy-file-range) close "copy.txt"
+(copy-file-range) end
+copy-file-range: exit(0)
+EOF
+pass;
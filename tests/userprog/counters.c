@@ -0,0 +1,37 @@
+/* Reads kernel counters: the version counter, a counter that
+   system calls advance, and every name, each of which must look
+   up to its own ID. */
+
+#include <counter.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char name[COUNTER_NAME_MAX + 1];
+  long long before;
+  int calls;
+  int id;
+
+  CHECK (counter_read (0) == COUNTER_VERSION, "counter version");
+  CHECK (counter_find ("counter.version") == 0, "find counter.version");
+  CHECK (counter_find ("no.such.counter") == -1, "find missing counter");
+
+  calls = counter_find ("syscall.calls");
+  CHECK (calls > 0, "find syscall.calls");
+  before = counter_read (calls);
+  getpid ();
+  CHECK (counter_read (calls) > before, "syscall.calls advanced");
+
+  for (id = 0; counter_name (id, name, sizeof name) >= 0; id++)
+    if (counter_find (name) != id)
+      fail ("counter %d, \"%s\", looks up as %d", id, name,
+            counter_find (name));
+  CHECK (counter_read (id) == -1, "read past the last counter");
+
+  CHECK (counter_name (0, name, 4) == (int) strlen ("counter.version")
+         && !strcmp (name, "cou"), "truncated name");
+}
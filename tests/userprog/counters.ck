@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(counters) begin
+(counters) counter version
+(counters) find counter.version
+(counters) find missing counter
+(counters) find syscall.calls
+(counters) syscall.calls advanced
+(counters) read past the last counter
+(counters) truncated name
+(counters) end
+counters: exit(0)
+EOF
+pass;
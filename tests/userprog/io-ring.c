@@ -0,0 +1,68 @@
+/* Opens, reads and closes a file through one io_ring_enter(),
+   chaining the read and close on the descriptor open returns, and
+   checks each completion. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct io_ring ring;
+static char buf[sizeof sample];
+
+static void
+queue (uint32_t op, int fd, const void *addr, uint32_t len, int64_t off)
+{
+  struct io_sqe *sqe = &ring.sq[ring.sq_tail % IORING_ENTRIES];
+
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) addr;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->user_data = ring.sq_tail;
+  ring.sq_tail++;
+}
+
+static int64_t
+reap (void)
+{
+  struct io_cqe *cqe = &ring.cq[ring.cq_head % IORING_ENTRIES];
+
+  if (cqe->user_data != ring.cq_head)
+    fail ("completion %u has user_data %llu", ring.cq_head,
+          (unsigned long long) cqe->user_data);
+  ring.cq_head++;
+  return cqe->res;
+}
+
+void
+test_main (void)
+{
+  int64_t fd;
+  int n;
+
+  CHECK (io_ring_setup (&ring) == 0, "io_ring_setup");
+
+  queue (IORING_OP_OPEN, 0, "sample.txt", 0, 0);
+  CHECK (io_ring_enter (1) == 1, "enter open");
+  fd = reap ();
+  if (fd < 2)
+    fail ("open completed with %lld", (long long) fd);
+
+  queue (IORING_OP_READ, fd, buf, sizeof sample - 1, 0);
+  queue (IORING_OP_NOP, 0, NULL, 0, 0);
+  queue (IORING_OP_CLOSE, fd, NULL, 0, 0);
+  n = io_ring_enter (IORING_ENTRIES);
+  if (n != 3)
+    fail ("io_ring_enter ran %d, not 3", n);
+  msg ("enter read, nop, close");
+  if (reap () != sizeof sample - 1)
+    fail ("short read");
+  compare_bytes (buf, sample, sizeof sample - 1, 0, "sample.txt");
+  if (reap () != 0 || reap () != 0)
+    fail ("nop or close failed");
+  CHECK (ring.sq_head == ring.sq_tail && ring.cq_tail == ring.cq_head,
+         "rings drained");
+  CHECK (read (fd, buf, 1) == -1, "descriptor closed");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(io-ring) begin
+(io-ring) io_ring_setup
+(io-ring) enter open
+(io-ring) enter read, nop, close
+(io-ring) rings drained
+(io-ring) descriptor closed
+(io-ring) end
+io-ring: exit(0)
+EOF
+pass;
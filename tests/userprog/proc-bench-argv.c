@@ -0,0 +1,49 @@
+/* Times spawn+wait of child-simple with growing argument lists,
+   which exercise argument passing. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/userprog/proc-bench.h"
+
+/* Each argument is "argNNN" or shorter. */
+#define MAX_ARGS 256
+
+static char args[MAX_ARGS][8];
+static char *argv[MAX_ARGS + 1];
+
+void
+test_main (void)
+{
+  static const int counts[] = { 1, 16, 64, MAX_ARGS };
+  size_t i;
+  int arg;
+
+  argv[0] = "child-simple";
+  for (arg = 1; arg < MAX_ARGS; arg++)
+    {
+      snprintf (args[arg], sizeof args[arg], "arg%d", arg);
+      argv[arg] = args[arg];
+    }
+
+  for (i = 0; i < sizeof counts / sizeof *counts; i++)
+    {
+      uint64_t total = 0;
+      int round;
+
+      argv[counts[i]] = NULL;
+      for (round = 0; round < ROUNDS; round++)
+        {
+          uint64_t start = read_tsc ();
+          pid_t child = spawn ("child-simple", argv);
+
+          CHECK (child > 0, "spawn");
+          wait (child);
+          total += read_tsc () - start;
+        }
+      bench_report ("spawn-argv", "args", counts[i], total);
+      if (counts[i] < MAX_ARGS)
+        argv[counts[i]] = args[counts[i]];
+    }
+}
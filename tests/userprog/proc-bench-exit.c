@@ -0,0 +1,36 @@
+/* Times spawn+wait of child-touch, which touches a growing amount
+   of memory before it exits, so that the difference from kb=0
+   shows what faulting in and tearing down that memory costs. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/userprog/proc-bench.h"
+
+void
+test_main (void)
+{
+  static const int sizes[] = { 0, 256, 1024 };
+  size_t i;
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      char kb[16];
+      char *argv[] = { "child-touch", kb, NULL };
+      uint64_t total = 0;
+      int round;
+
+      snprintf (kb, sizeof kb, "%d", sizes[i]);
+      for (round = 0; round < ROUNDS; round++)
+        {
+          uint64_t start = read_tsc ();
+          pid_t child = spawn ("child-touch", argv);
+
+          CHECK (child > 0, "spawn");
+          CHECK (wait (child) == 0, "wait for child-touch");
+          total += read_tsc () - start;
+        }
+      bench_report ("exit-touched", "kb", sizes[i], total);
+    }
+}
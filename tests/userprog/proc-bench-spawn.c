@@ -0,0 +1,26 @@
+/* Times spawn+wait of child-simple, which builds the child from
+   the ELF without copying the parent. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/userprog/proc-bench.h"
+
+void
+test_main (void)
+{
+  char *argv[] = { "child-simple", NULL };
+  uint64_t total = 0;
+  int round;
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      uint64_t start = read_tsc ();
+      pid_t child = spawn ("child-simple", argv);
+
+      CHECK (child > 0, "spawn");
+      wait (child);
+      total += read_tsc () - start;
+    }
+  bench_report ("spawn-wait", "args", 1, total);
+}
@@ -0,0 +1,33 @@
+#ifndef TESTS_USERPROG_PROC_BENCH_H
+#define TESTS_USERPROG_PROC_BENCH_H
+
+/* Helpers shared by the proc-bench-* process lifecycle
+   benchmarks.  Each result is one line of the form
+
+     bench NAME PARAM=VALUE cycles=N
+
+   where N is the mean of ROUNDS runs in TSC cycles, so that
+   scripts can diff results across kernel changes. */
+
+#include <stdint.h>
+#include "tests/lib.h"
+
+#define ROUNDS 8
+
+static inline uint64_t
+read_tsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+static inline void
+bench_report (const char *name, const char *param, long long value,
+              uint64_t total)
+{
+  msg ("bench %s %s=%lld cycles=%llu", name, param, value,
+       (unsigned long long) (total / ROUNDS));
+}
+
+#endif /* tests/userprog/proc-bench.h */
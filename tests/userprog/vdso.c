@@ -0,0 +1,32 @@
+/* Reads the pid and the clock from the kernel's shared pages and
+   checks that the clock runs forward with the timer, and that the
+   clock_gettime_ns() system call reads the same clock. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int64_t start, last, now;
+
+  CHECK (getpid () > 0, "getpid");
+
+  start = clock_ticks ();
+  last = clock_nsec ();
+  do
+    {
+      now = clock_nsec ();
+      if (now < last)
+        fail ("clock_nsec went back from %lld to %lld", (long long) last,
+              (long long) now);
+      last = now;
+    }
+  while (clock_ticks () < start + 2);
+  msg ("clock advanced");
+
+  last = clock_nsec ();
+  now = clock_gettime_ns ();
+  CHECK (now >= last && clock_nsec () >= now, "clock_gettime_ns agrees");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(vdso) begin
+(vdso) getpid
+(vdso) clock advanced
+(vdso) clock_gettime_ns agrees
+(vdso) end
+vdso: exit(0)
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Measures fork+exec+wait latency, in TSC cycles, as a function
+   of how much memory the parent has touched.  With copy-on-write
+   fork the cost should barely grow with the parent's size; boot
+   with -no-cow to compare against eager copying. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define MAX_KB 512
+#define ROUNDS 4
+
+static char buf[MAX_KB * 1024];
+
+static inline uint64_t
+read_tsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+void
+test_main (void)
+{
+  static const size_t sizes[] = { 0, 64, 128, 256, MAX_KB };
+  size_t i;
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      uint64_t total = 0;
+      int round;
+
+      /* Touch the parent's pages so that they are resident. */
+      memset (buf, (int) i + 1, sizes[i] * 1024);
+
+      for (round = 0; round < ROUNDS; round++)
+        {
+          uint64_t start = read_tsc ();
+          pid_t child = fork ("child");
+
+          if (child == 0)
+            {
+              exec ("child-simple");
+              fail ("exec failed");
+            }
+          CHECK (child > 0, "fork");
+          wait (child);
+          total += read_tsc () - start;
+        }
+      msg ("%4zu kB touched: %llu cycles per fork+exec",
+           sizes[i], (unsigned long long) (total / ROUNDS));
+    }
+}
@@ -0,0 +1,49 @@
+/* Maps a file with MAP_POPULATE and reads it under each kind of
+   madvise() advice, then checks that MADV_DONTNEED on anonymous
+   memory leaves zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char zeros[2 * 4096] __attribute__ ((aligned (4096)));
+
+static void
+check_map (const char *actual, const char *what)
+{
+  if (memcmp (actual, sample, strlen (sample)))
+    fail ("read of mmap'd file after %s reported bad data", what);
+}
+
+void
+test_main (void)
+{
+  char *actual = (char *) 0x10000000;
+  int handle;
+  void *map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (actual, 4096, MAP_POPULATE, handle, 0)) != MAP_FAILED,
+         "mmap \"sample.txt\" with MAP_POPULATE");
+  check_map (actual, "MAP_POPULATE");
+
+  CHECK (madvise (map, 4096, MADV_SEQUENTIAL) == 0, "MADV_SEQUENTIAL");
+  check_map (actual, "MADV_SEQUENTIAL");
+  CHECK (madvise (map, 4096, MADV_DONTNEED) == 0, "MADV_DONTNEED");
+  check_map (actual, "MADV_DONTNEED");
+  CHECK (madvise (map, 4096, MADV_WILLNEED) == 0, "MADV_WILLNEED");
+  check_map (actual, "MADV_WILLNEED");
+  CHECK (madvise (actual + 1, 4096, MADV_NORMAL) == -1,
+         "misaligned madvise fails");
+  munmap (map);
+
+  memset (zeros, 'x', sizeof zeros);
+  CHECK (madvise (zeros, sizeof zeros, MADV_DONTNEED) == 0,
+         "MADV_DONTNEED on anonymous memory");
+  for (size_t i = 0; i < sizeof zeros; i++)
+    if (zeros[i] != 0)
+      fail ("byte %zu is %02hhx after MADV_DONTNEED", i, zeros[i]);
+  close (handle);
+}
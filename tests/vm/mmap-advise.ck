@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-advise) begin
+(mmap-advise) open "sample.txt"
+(mmap-advise) mmap "sample.txt" with MAP_POPULATE
+(mmap-advise) MADV_SEQUENTIAL
+(mmap-advise) MADV_DONTNEED
+(mmap-advise) MADV_WILLNEED
+(mmap-advise) misaligned madvise fails
+(mmap-advise) MADV_DONTNEED on anonymous memory
+(mmap-advise) end
+EOF
+pass;
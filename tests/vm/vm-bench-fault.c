@@ -0,0 +1,40 @@
+/* Reports page faults per second for first touches of anonymous
+   memory, in address order and in a scattered order. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/vm-bench.h"
+
+/* Pages touched by each pass.  A power of 2, so that any odd
+   stride visits every page once. */
+#define PAGE_CNT 512
+
+/* Stride of the scattered pass, in pages. */
+#define STRIDE 197
+
+static char seq[PAGE_CNT * PAGE_SIZE];
+static char scattered[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  struct bench_mark m;
+  size_t i;
+
+  bench_start (&m);
+  for (i = 0; i < PAGE_CNT; i++)
+    seq[i * PAGE_SIZE] = 1;
+  bench_report (&m, "fault-seq", "pages", PAGE_CNT, "faults_per_sec",
+                PAGE_CNT);
+
+  bench_start (&m);
+  for (i = 0; i < PAGE_CNT; i++)
+    scattered[(i * STRIDE % PAGE_CNT) * PAGE_SIZE] = 1;
+  bench_report (&m, "fault-random", "pages", PAGE_CNT, "faults_per_sec",
+                PAGE_CNT);
+
+  for (i = 0; i < PAGE_CNT; i++)
+    if (seq[i * PAGE_SIZE] != 1 || scattered[i * PAGE_SIZE] != 1)
+      fail ("page %zu was not touched", i);
+}
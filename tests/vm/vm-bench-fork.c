@@ -0,0 +1,53 @@
+/* Reports how fast fork() and wait() go with a large heap, which
+   copy-on-write should make cheap, both for a child that exits at
+   once and for one that writes every page. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/vm-bench.h"
+
+#define HEAP_SIZE (2 * 1024 * 1024)
+#define ROUNDS 4
+
+static char heap[HEAP_SIZE];
+
+/* Forks ROUNDS children that write every page of the heap if
+   TOUCH, waits for each, and reports as NAME. */
+static void
+fork_rounds (const char *name, bool touch)
+{
+  struct bench_mark m;
+  int round;
+
+  bench_start (&m);
+  for (round = 0; round < ROUNDS; round++)
+    {
+      pid_t child = fork ("child");
+
+      if (child == 0)
+        {
+          size_t i;
+
+          if (touch)
+            for (i = 0; i < HEAP_SIZE; i += PAGE_SIZE)
+              heap[i]++;
+          exit (0);
+        }
+      CHECK (child > 0, "fork");
+      if (wait (child) != 0)
+        fail ("child exited abnormally");
+    }
+  bench_report (&m, name, "kb", HEAP_SIZE / 1024, "forks_per_sec", ROUNDS);
+}
+
+void
+test_main (void)
+{
+  memset (heap, 1, HEAP_SIZE);
+  fork_rounds ("fork-exit", false);
+  fork_rounds ("fork-touch", true);
+  if (heap[0] != 1 || heap[HEAP_SIZE - 1] != 1)
+    fail ("a child's writes reached the parent");
+}
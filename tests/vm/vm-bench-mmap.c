@@ -0,0 +1,59 @@
+/* Reports read and write throughput through a file mapping: the
+   first read of each page, and a write of every byte that
+   munmap() then writes back to the file and fsync() to the disk,
+   so that the write count includes getting the data to the disk
+   rather than only into the buffer cache. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/vm-bench.h"
+
+#define FILE_SIZE (256 * 1024)
+#define ACTUAL ((char *) 0x10000000)
+
+static char buf[PAGE_SIZE];
+
+void
+test_main (void)
+{
+  struct bench_mark m;
+  unsigned sum = 0;
+  int handle;
+  size_t i;
+
+  CHECK (create ("bench.dat", 0), "create \"bench.dat\"");
+  CHECK ((handle = open ("bench.dat")) > 1, "open \"bench.dat\"");
+  for (i = 0; i < FILE_SIZE; i += sizeof buf)
+    {
+      memset (buf, (int) (i / sizeof buf), sizeof buf);
+      if (write (handle, buf, sizeof buf) != (int) sizeof buf)
+        fail ("write \"bench.dat\" failed");
+    }
+
+  CHECK (mmap (ACTUAL, FILE_SIZE, 1, handle, 0) != MAP_FAILED,
+         "mmap \"bench.dat\"");
+  bench_start (&m);
+  for (i = 0; i < FILE_SIZE; i += sizeof (unsigned))
+    sum += *(unsigned *) (ACTUAL + i);
+  bench_report (&m, "mmap-read", "kb", FILE_SIZE / 1024, "bytes_per_sec",
+                FILE_SIZE);
+  if (sum == 0)
+    fail ("mapping read back as zeros");
+
+  bench_start (&m);
+  memset (ACTUAL, 0x5a, FILE_SIZE);
+  munmap (ACTUAL);
+  if (fsync (handle) != 0)
+    fail ("fsync \"bench.dat\" failed");
+  bench_report (&m, "mmap-write", "kb", FILE_SIZE / 1024, "bytes_per_sec",
+                FILE_SIZE);
+
+  seek (handle, FILE_SIZE - sizeof buf);
+  CHECK (read (handle, buf, sizeof buf) == (int) sizeof buf,
+         "read \"bench.dat\"");
+  if (buf[0] != 0x5a || buf[sizeof buf - 1] != 0x5a)
+    fail ("munmap did not write the mapping back");
+  close (handle);
+}
@@ -0,0 +1,83 @@
+/* Reports swap throughput and fairness under thrashing.
+
+   Two children each sweep over their own working set, together
+   half again as large as the user pool, for PASSES passes, and
+   report the pages they touched per second.  A fair kernel gives
+   them about the same rate; the parent reports the ratio of the
+   slower to the faster, in percent. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/vm-bench.h"
+
+#define CHILD_CNT 2
+#define PASSES 3
+
+/* Largest working set, per child. */
+#define MAX_PAGES 2048
+
+static char pages[MAX_PAGES * PAGE_SIZE];
+
+/* Sweeps the first PAGE_CNT pages PASSES times and returns pages
+   touched per second. */
+static int
+sweep (size_t page_cnt)
+{
+  struct bench_mark m;
+  int64_t nsec;
+  size_t i;
+  int pass;
+
+  bench_start (&m);
+  for (pass = 0; pass < PASSES; pass++)
+    for (i = 0; i < page_cnt; i++)
+      pages[i * PAGE_SIZE]++;
+  nsec = clock_nsec () - m.nsec;
+  for (i = 0; i < page_cnt; i++)
+    if (pages[i * PAGE_SIZE] != PASSES)
+      fail ("page %zu lost its contents", i);
+  return nsec > 0 ? (int) (page_cnt * PASSES * 1000000000LL / nsec) : 0;
+}
+
+void
+test_main (void)
+{
+  long long pool = bench_user_free_pages ();
+  size_t page_cnt = pool * 3 / 2 / CHILD_CNT;
+  pid_t children[CHILD_CNT];
+  int rates[CHILD_CNT];
+  int slowest, fastest;
+  struct bench_mark m;
+  int i;
+
+  CHECK (pool > 0, "user pool has %lld free pages", pool);
+  if (page_cnt > MAX_PAGES)
+    page_cnt = MAX_PAGES;
+
+  bench_start (&m);
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      children[i] = fork ("sweeper");
+      if (children[i] == 0)
+        exit (sweep (page_cnt));
+      CHECK (children[i] > 0, "fork child %d", i);
+    }
+  slowest = fastest = -1;
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      rates[i] = wait (children[i]);
+      if (rates[i] < 0)
+        fail ("child %d exited abnormally", i);
+      if (slowest < 0 || rates[i] < slowest)
+        slowest = rates[i];
+      if (fastest < 0 || rates[i] > fastest)
+        fastest = rates[i];
+    }
+  bench_report (&m, "thrash", "pages", (long long) page_cnt * CHILD_CNT,
+                "pages_per_sec", (long long) page_cnt * CHILD_CNT * PASSES);
+  for (i = 0; i < CHILD_CNT; i++)
+    msg ("bench thrash-child child=%d pages_per_sec=%d", i, rates[i]);
+  msg ("bench thrash-fairness children=%d percent=%d", CHILD_CNT,
+       fastest > 0 ? slowest * 100 / fastest : 100);
+}
@@ -0,0 +1,90 @@
+#ifndef TESTS_VM_VM_BENCH_H
+#define TESTS_VM_VM_BENCH_H
+
+/* Helpers shared by the vm-bench-* paging benchmarks.  Each
+   result is one line of the form
+
+     bench NAME PARAM=VALUE RATE=N reads=R writes=W
+
+   where RATE is a per-second figure over one timed run, and R
+   and W are the sectors read from and written to the swap disk
+   and the file system disk together while it ran, as the disk
+   inspection interrupts count them. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+#define PAGE_SIZE 4096
+
+/* Returns the read (int 0x43) or write (int 0x44) count of disk
+   DEV_NO on channel CHAN_NO. */
+static inline long long
+bench_disk_cnt (bool write, int chan_no, int dev_no)
+{
+  long long cnt;
+
+  if (write)
+    asm volatile ("int $0x44" : "=a" (cnt)
+                  : "d" ((long long) chan_no), "c" ((long long) dev_no)
+                  : "memory");
+  else
+    asm volatile ("int $0x43" : "=a" (cnt)
+                  : "d" ((long long) chan_no), "c" ((long long) dev_no)
+                  : "memory");
+  return cnt;
+}
+
+/* Disk counts and the time at the start of a timed run. */
+struct bench_mark
+  {
+    int64_t nsec;
+    long long reads, writes;
+  };
+
+/* Returns the sectors read (or, if WRITE, written) on the file
+   system disk (hd0:1) and the swap disk (hd1:1). */
+static inline long long
+bench_disk_total (bool write)
+{
+  return bench_disk_cnt (write, 0, 1) + bench_disk_cnt (write, 1, 1);
+}
+
+static inline void
+bench_start (struct bench_mark *m)
+{
+  m->reads = bench_disk_total (false);
+  m->writes = bench_disk_total (true);
+  m->nsec = clock_nsec ();
+}
+
+/* Reports COUNT things done since M, as NAME's RATE per second. */
+static inline void
+bench_report (const struct bench_mark *m, const char *name,
+              const char *param, long long value, const char *rate,
+              long long count)
+{
+  int64_t nsec = clock_nsec () - m->nsec;
+
+  if (nsec <= 0)
+    nsec = 1;
+  msg ("bench %s %s=%lld %s=%lld reads=%lld writes=%lld", name, param,
+       value, rate, (long long) (count * 1000000000LL / nsec),
+       bench_disk_total (false) - m->reads,
+       bench_disk_total (true) - m->writes);
+}
+
+/* Returns the number of free pages in the user pool, by int
+   0x47. */
+static inline long long
+bench_user_free_pages (void)
+{
+  long long cnt;
+
+  asm volatile ("int $0x47" : "=a" (cnt)
+                : "a" (0LL), "d" (1LL) : "memory");
+  return cnt;
+}
+
+#endif /* tests/vm/vm-bench.h */
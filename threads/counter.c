@@ -0,0 +1,105 @@
+#include "threads/counter.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+
+/* A registered counter. */
+struct counter {
+	char name[COUNTER_NAME_MAX + 1];
+	counter_read_func *read;    /* Reads it, or null for VALUE. */
+	void *aux;                  /* READ's argument. */
+	const long long *value;     /* Its value, if READ is null. */
+};
+
+static long long version = COUNTER_VERSION;
+
+/* Counters, by ID.  COUNTER_CNT only grows, and a slot is filled
+   in before it is counted, so readers need no lock. */
+static struct counter counters[COUNTER_MAX] = {
+	{ "counter.version", NULL, NULL, &version },
+};
+static int counter_cnt = 1;
+
+static int add (const char *name, counter_read_func *, void *aux,
+		const long long *value);
+
+/* Registers a counter NAME whose value READ (AUX) returns.  Returns
+   its ID, or -1 if the table is full. */
+int
+counter_register (const char *name, counter_read_func *read, void *aux) {
+	ASSERT (read != NULL);
+
+	return add (name, read, aux, NULL);
+}
+
+/* Registers a counter NAME whose value is *VALUE.  Returns its ID,
+   or -1 if the table is full. */
+int
+counter_register_value (const char *name, const long long *value) {
+	ASSERT (value != NULL);
+
+	return add (name, NULL, NULL, value);
+}
+
+/* Returns the ID of the counter named NAME, or -1 if there is
+   none. */
+int
+counter_find (const char *name) {
+	int cnt = __atomic_load_n (&counter_cnt, __ATOMIC_ACQUIRE);
+	int id;
+
+	for (id = 0; id < cnt; id++)
+		if (!strcmp (counters[id].name, name))
+			return id;
+	return -1;
+}
+
+/* Returns the value of counter ID, or -1 if there is none. */
+long long
+counter_read (int id) {
+	const struct counter *c;
+
+	if (id < 0 || id >= __atomic_load_n (&counter_cnt, __ATOMIC_ACQUIRE))
+		return -1;
+	c = &counters[id];
+	return c->read != NULL ? c->read (c->aux)
+		: __atomic_load_n (c->value, __ATOMIC_RELAXED);
+}
+
+/* Returns the name of counter ID, or a null pointer if there is
+   none. */
+const char *
+counter_name (int id) {
+	if (id < 0 || id >= __atomic_load_n (&counter_cnt, __ATOMIC_ACQUIRE))
+		return NULL;
+	return counters[id].name;
+}
+
+/* Adds a counter NAME read by READ (AUX), or from VALUE. */
+static int
+add (const char *name, counter_read_func *read, void *aux,
+		const long long *value) {
+	enum intr_level old_level;
+	struct counter *c;
+	int id;
+
+	ASSERT (strlen (name) <= COUNTER_NAME_MAX);
+	ASSERT (counter_find (name) == -1);
+
+	old_level = intr_disable ();
+	id = counter_cnt;
+	if (id < COUNTER_MAX) {
+		c = &counters[id];
+		strlcpy (c->name, name, sizeof c->name);
+		c->read = read;
+		c->aux = aux;
+		c->value = value;
+		__atomic_store_n (&counter_cnt, id + 1, __ATOMIC_RELEASE);
+	} else {
+		printf ("counter: table full, \"%s\" not registered\n", name);
+		id = -1;
+	}
+	intr_set_level (old_level);
+	return id;
+}
@@ -0,0 +1,158 @@
+#include "threads/cpu.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/lapic.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/tss.h"
+#endif
+#include "intrinsic.h"
+
+/* Per-CPU data and application processor bring-up.
+
+   cpu_init() points the bootstrap processor's GS base at cpus[0]
+   before anything else uses this_cpu().  With "-smp",
+   cpu_start_aps() then starts the other CPUs through their local
+   APICs (see ap-start.S).  Each gets its own struct cpu, stack,
+   GDT and TSS, loads the shared IDT, enables its local APIC, and
+   marks itself online.
+
+   There it stops: it halts with interrupts off, never to run a
+   thread.  Everything else in the kernel still takes disabling
+   interrupts on the running CPU as mutual exclusion, which does
+   not hold once a second CPU runs kernel code; each of those
+   places must move to a spinlock before the scheduler can hand
+   threads to the application processors. */
+
+#define MSR_EFER 0xc0000080
+#define MSR_GS_BASE 0xc0000101
+#define MSR_KERNEL_GS_BASE 0xc0000102
+
+/* The assembly language code finds these by offset. */
+_Static_assert (__builtin_offsetof (struct cpu, user_rsp) == CPU_USER_RSP,
+		"CPU_USER_RSP");
+_Static_assert (__builtin_offsetof (struct cpu, tss) == CPU_TSS, "CPU_TSS");
+
+struct cpu cpus[CPU_MAX];
+
+/* Number of CPUs online. */
+unsigned cpu_cnt;
+
+/* Bring up application processors? */
+bool cpu_smp;
+
+/* Shared with ap-start.S: the next CPU number to hand out, and
+   the top of each CPU's stack. */
+unsigned ap_next = 1;
+uint64_t ap_stacks[CPU_MAX];
+
+/* Control registers for the application processors to copy. */
+static uint64_t ap_cr0, ap_cr4, ap_efer;
+
+void ap_main (unsigned id) NO_RETURN;
+
+/* Sets up per-CPU data for the bootstrap processor. */
+void
+cpu_init (void) {
+	unsigned i;
+
+	for (i = 0; i < CPU_MAX; i++) {
+		cpus[i].self = &cpus[i];
+		cpus[i].id = i;
+	}
+	write_msr (MSR_GS_BASE, (uint64_t) &cpus[0]);
+	write_msr (MSR_KERNEL_GS_BASE, 0);
+	cpus[0].online = true;
+	cpu_cnt = 1;
+}
+
+/* Starts the application processors and waits for them to come
+   online.  The local APIC must be set up. */
+void
+cpu_start_aps (void) {
+	extern char ap_trampoline[], ap_trampoline_end[];
+	unsigned started, i;
+	int tries;
+
+	if (!lapic_present ()) {
+		printf ("SMP: no local APIC, staying on one CPU.\n");
+		return;
+	}
+	cpus[0].apic_id = lapic_id ();
+
+	/* The application processors cannot allocate memory, so
+	   set aside enough for as many as there can be. */
+	for (i = 1; i < CPU_MAX; i++) {
+		ap_stacks[i] = (uint64_t) palloc_get_page (PAL_ASSERT) + PGSIZE;
+#ifdef USERPROG
+		cpus[i].tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+		cpus[i].tss->rsp0 = ap_stacks[i];
+#endif
+	}
+	ap_cr0 = rcr0 ();
+	ap_cr4 = rcr4 ();
+	ap_efer = read_msr (MSR_EFER);
+
+	pml4_init_shootdown ();
+	memcpy (ptov (AP_TRAMPOLINE), ap_trampoline,
+			ap_trampoline_end - ap_trampoline);
+	lapic_start_aps (AP_TRAMPOLINE);
+
+	/* Give the application processors 100 ms to take a number,
+	   then close the count: any later one finds none and halts. */
+	timer_msleep (100);
+	started = __atomic_exchange_n (&ap_next, CPU_MAX, __ATOMIC_ACQ_REL);
+	if (started > CPU_MAX) {
+		printf ("SMP: ignoring %u CPUs past %d.\n", started - CPU_MAX,
+				CPU_MAX);
+		started = CPU_MAX;
+	}
+	for (i = 1; i < started; i++)
+		for (tries = 0; !__atomic_load_n (&cpus[i].online, __ATOMIC_ACQUIRE);
+				tries++) {
+			if (tries == 100)
+				PANIC ("SMP: CPU %u never came online", i);
+			timer_msleep (1);
+		}
+
+	/* Return what the missing CPUs would have used. */
+	for (i = started; i < CPU_MAX; i++) {
+		palloc_free_page ((void *) (ap_stacks[i] - PGSIZE));
+		ap_stacks[i] = 0;
+#ifdef USERPROG
+		palloc_free_page (cpus[i].tss);
+		cpus[i].tss = NULL;
+#endif
+	}
+	cpu_cnt = started;
+	printf ("SMP: %u CPUs online, %u idle.\n", cpu_cnt, cpu_cnt - 1);
+}
+
+/* Entry point of application processor ID, called by ap-start.S
+   on the CPU's own stack with the kernel's page table loaded. */
+void
+ap_main (unsigned id) {
+	struct cpu *c = &cpus[id];
+
+	lcr4 (ap_cr4);
+	lcr0 (ap_cr0);
+	write_msr (MSR_EFER, ap_efer);
+	write_msr (MSR_GS_BASE, (uint64_t) c);
+	write_msr (MSR_KERNEL_GS_BASE, 0);
+#ifdef USERPROG
+	gdt_init ();
+#endif
+	intr_init_ap ();
+	lapic_init_ap ();
+	c->apic_id = lapic_id ();
+	__atomic_store_n (&c->online, true, __ATOMIC_RELEASE);
+
+	for (;;)
+		asm volatile ("cli; hlt" : : : "memory");
+}
@@ -1,6 +1,7 @@
 #include "threads/init.h"
 #include <console.h>
 #include <debug.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <random.h>
 #include <stddef.h>
@@ -8,32 +9,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "devices/ioapic.h"
 #include "devices/kbd.h"
 #include "devices/input.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/workqueue.h"
+#include "intrinsic.h"
 #ifdef USERPROG
+#include "userprog/aio.h"
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #endif
+#include "tests/internal/bench.h"
 #include "tests/threads/tests.h"
 #ifdef VM
+#include "vm/oom.h"
 #include "vm/vm.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/cache.h"
+#include "filesys/fat.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -44,6 +57,10 @@ uint64_t *base_pml4;
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
+
+/* -snapshot: Stop before the actions for the host to snapshot the
+   machine, and take them from the command line it resumes with? */
+static bool snapshot;
 #endif
 
 /* -q: Power off after kernel tasks complete? */
@@ -51,15 +68,49 @@ bool power_off_when_done;
 
 bool thread_tests;
 
+/* -mstat: Seconds between memory statistics dumps, or 0. */
+static int mstat_seconds;
+
+/* -pic: Leave the external interrupts on the 8259 PICs? */
+static bool keep_pic;
+
+/* -bootstat: Print how long each boot phase took? */
+static bool bootstat;
+
+/* End of each boot phase so far, as recorded by boot_phase(). */
+#define BOOT_PHASE_MAX 24
+struct boot_mark {
+	const char *name;           /* Phase that just ended. */
+	uint64_t tsc;               /* TSC when it ended. */
+};
+static struct boot_mark boot_marks[BOOT_PHASE_MAX];
+static int boot_mark_cnt;
+static uint64_t boot_tsc;       /* TSC on entry to main(). */
+
+/* -profile: Timer ticks between profile samples, or 0. */
+static int profile_interval;
+
+/* -trace: Allocate the trace ring, and record which events? */
+static bool trace_enabled;
+static uint32_t trace_events;
+
 static void bss_init (void);
 static void paging_init (uint64_t mem_end);
 
 static char **read_command_line (void);
+static char **split_command_line (char *args, int argc, char *argv[]);
 static char **parse_options (char **argv);
+#ifdef FILESYS
+static char **snapshot_wait (void);
+#endif
+static void parse_time_slices (char *value);
+static void parse_loops (const char *value);
 static void run_actions (char **argv);
 static void usage (void);
+static void mstat_thread (void *aux);
 
 static void print_stats (void);
+static void print_boot_stats (void);
 
 
 int main (void) NO_RETURN;
@@ -67,25 +118,35 @@ int main (void) NO_RETURN;
 /* Pintos main program. */
 int
 main (void) {
+	uint64_t start = rdtsc ();
 	uint64_t mem_end;
 	char **argv;
 
 	/* Clear BSS and get machine's RAM size. */
 	bss_init ();
+	boot_tsc = start;
+	boot_phase ("bss_init");
 
 	/* Break command line into arguments and parse options. */
 	argv = read_command_line ();
 	argv = parse_options (argv);
+	boot_phase ("command line");
 
 	/* Initialize ourselves as a thread so we can use locks,
 	   then enable console locking. */
+	cpu_init ();
 	thread_init ();
 	console_init ();
+	boot_phase ("thread_init");
 
 	/* Initialize memory system. */
 	mem_end = palloc_init ();
+	boot_phase ("palloc_init");
 	malloc_init ();
+	boot_phase ("malloc_init");
 	paging_init (mem_end);
+	boot_phase ("paging_init");
+	ioapic_probe ();
 
 #ifdef USERPROG
 	tss_init ();
@@ -94,29 +155,61 @@ main (void) {
 
 	/* Initialize interrupt handlers. */
 	intr_init ();
+	palloc_register_inspect ();
+	lock_register_counters ();
+	if (trace_enabled)
+		trace_init (trace_events);
+	if (profile_interval > 0)
+		profile_init (profile_interval);
 	timer_init ();
 	kbd_init ();
 	input_init ();
+	boot_phase ("intr_init");
 #ifdef USERPROG
 	exception_init ();
 	syscall_init ();
+	process_setup ();
+	boot_phase ("userprog");
 #endif
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
 	serial_init_queue ();
+	workqueue_init ();
+#ifdef USERPROG
+	aio_init ();
+#endif
+	boot_phase ("thread_start");
 	timer_calibrate ();
+	boot_phase ("timer_calibrate");
+	if (!keep_pic)
+		ioapic_init ();
+	if (cpu_smp) {
+		cpu_start_aps ();
+		boot_phase ("cpu_start_aps");
+	}
 
 #ifdef FILESYS
 	/* Initialize file system. */
 	disk_init ();
+	boot_phase ("disk_init");
 	filesys_init (format_filesys);
 #endif
 
 #ifdef VM
 	vm_init ();
+	boot_phase ("vm_init");
 #endif
 
+	if (mstat_seconds > 0)
+		thread_create ("mstat", PRI_DEFAULT, mstat_thread, NULL);
+
 	printf ("Boot complete.\n");
+	if (bootstat)
+		print_boot_stats ();
+#ifdef FILESYS
+	if (snapshot)
+		argv = snapshot_wait ();
+#endif
 
 	/* Run actions specified on kernel command line. */
 	run_actions (argv);
@@ -152,19 +245,36 @@ paging_init (uint64_t mem_end) {
 	extern char start, _end_kernel_text;
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	// Whole 2 MB frames that do not overlap the read-only kernel
+	// text get a single large PDE; the rest use 4 kB pages.
+	for (uint64_t pa = 0; pa < mem_end; ) {
 		uint64_t va = (uint64_t) ptov(pa);
 
-		perm = PTE_P | PTE_W;
+		if ((pa & LARGE_PGMASK) == 0 && pa + LARGE_PGSIZE <= mem_end
+				&& (va + LARGE_PGSIZE <= (uint64_t) &start
+					|| va >= (uint64_t) &_end_kernel_text)) {
+			if ((pte = pml4_pde_walk (pml4, va, 1)) != NULL)
+				*pte = pa | PTE_P | PTE_W | PTE_PS | PTE_G;
+			pa += LARGE_PGSIZE;
+			continue;
+		}
+
+		perm = PTE_P | PTE_W | PTE_G;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
 		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
 			*pte = pa | perm;
+		pa += PGSIZE;
 	}
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_init_pcid ();
+
+	// Make kernel writes fault on read-only user pages too, as
+	// copy-on-write and the shared zero page depend on.
+	lcr0 (rcr0 () | CR0_WP);
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -172,13 +282,22 @@ paging_init (uint64_t mem_end) {
 static char **
 read_command_line (void) {
 	static char *argv[LOADER_ARGS_LEN / 2 + 1];
-	char *p, *end;
-	int argc;
+
+	return split_command_line (ptov (LOADER_ARGS),
+			*(uint32_t *) ptov (LOADER_ARG_CNT), argv);
+}
+
+/* Breaks the ARGC null-terminated words in the LOADER_ARGS_LEN
+   bytes at ARGS into ARGV, which must have room for
+   LOADER_ARGS_LEN / 2 + 1 pointers, prints them, and returns
+   ARGV. */
+static char **
+split_command_line (char *args, int argc, char *argv[]) {
+	char *p = args, *end = args + LOADER_ARGS_LEN;
 	int i;
 
-	argc = *(uint32_t *) ptov (LOADER_ARG_CNT);
-	p = ptov (LOADER_ARGS);
-	end = p + LOADER_ARGS_LEN;
+	if (argc < 0 || argc > LOADER_ARGS_LEN / 2)
+		PANIC ("command line arguments overflow");
 	for (i = 0; i < argc; i++) {
 		if (p >= end)
 			PANIC ("command line arguments overflow");
@@ -216,16 +335,103 @@ parse_options (char **argv) {
 #ifdef FILESYS
 		else if (!strcmp (name, "-f"))
 			format_filesys = true;
+		else if (!strcmp (name, "-bc")) {
+			int sectors = value != NULL ? atoi (value) : -1;
+			if (sectors < 0)
+				PANIC ("bad -bc value `%s' (expected sectors >= 0)",
+						value != NULL ? value : "");
+			cache_sectors = sectors;
+		}
+		else if (!strcmp (name, "-fat-lazy"))
+			fat_lazy = true;
+		else if (!strcmp (name, "-snapshot"))
+			snapshot = true;
 #endif
 		else if (!strcmp (name, "-rs"))
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-rr"))
+			thread_rr = true;
+		else if (!strcmp (name, "-tickless"))
+			timer_tickless = true;
+		else if (!strcmp (name, "-idle-poll")) {
+			int us = value != NULL ? atoi (value) : 200;
+			if (us <= 0)
+				PANIC ("bad -idle-poll value `%s' (expected microseconds > 0)",
+						value);
+			thread_idle_poll_us = us;
+		}
+		else if (!strcmp (name, "-loops"))
+			parse_loops (value);
+		else if (!strcmp (name, "-ts"))
+			parse_time_slices (value);
+		else if (!strcmp (name, "-buddy"))
+			palloc_buddy = true;
+		else if (!strcmp (name, "-smp"))
+			cpu_smp = true;
+		else if (!strcmp (name, "-pic"))
+			keep_pic = true;
+		else if (!strcmp (name, "-lockstat"))
+			lock_stat = true;
+		else if (!strcmp (name, "-bootstat"))
+			bootstat = true;
+		else if (!strcmp (name, "-profile")) {
+			profile_interval = value != NULL ? atoi (value) : 1;
+			if (profile_interval <= 0)
+				PANIC ("bad -profile value `%s' (expected ticks > 0)", value);
+		}
+		else if (!strcmp (name, "-trace")) {
+			trace_events = trace_parse (value);
+			trace_enabled = true;
+		}
+		else if (!strcmp (name, "-mstat")) {
+			mstat_seconds = value != NULL ? atoi (value) : 0;
+			if (mstat_seconds <= 0)
+				PANIC ("bad -mstat value `%s' (expected seconds > 0)",
+						value != NULL ? value : "");
+		}
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+		else if (!strcmp (name, "-sysstat"))
+			syscall_stat = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-no-cow"))
+			vm_cow = false;
+		else if (!strcmp (name, "-no-huge"))
+			vm_huge = false;
+		else if (!strcmp (name, "-no-compact"))
+			vm_compact = false;
+		else if (!strcmp (name, "-overcommit")) {
+			vm_overcommit = atoi (value);
+			if (vm_overcommit < OVERCOMMIT_GUESS
+					|| vm_overcommit > OVERCOMMIT_NEVER)
+				PANIC ("bad -overcommit value `%s' (expected 0, 1 or 2)",
+						value);
+		} else if (!strcmp (name, "-ocratio"))
+			vm_overcommit_ratio = atoi (value);
+		else if (!strcmp (name, "-fa"))
+			vm_fault_around = atoi (value);
+		else if (!strcmp (name, "-vmstat"))
+			vm_stat = true;
+		else if (!strcmp (name, "-rlow"))
+			vm_reclaim_low = atoi (value);
+		else if (!strcmp (name, "-rhigh"))
+			vm_reclaim_high = atoi (value);
+		else if (!strcmp (name, "-ksm"))
+			vm_ksm_pages = atoi (value);
+		else if (!strcmp (name, "-ksm-ms"))
+			vm_ksm_interval = atoi (value);
+		else if (!strcmp (name, "-zswap"))
+			vm_zswap_pages = atoi (value);
+		else if (!strcmp (name, "-rss"))
+			vm_rss_limit = atoi (value);
+		else if (!strcmp (name, "-wss"))
+			vm_wss_interval = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -234,6 +440,85 @@ parse_options (char **argv) {
 	return argv;
 }
 
+#ifdef FILESYS
+/* Stops for "pintos --snapshot", which saves the machine once it
+   sees the message printed here, and waits for the command line
+   that "pintos --resume" writes into the boot sector of disk hd0:0
+   of the restored machine, which starts with -resume.  Only -q and
+   -rs may follow; the other options took effect while booting.
+   Returns the actions that come next. */
+static char **
+snapshot_wait (void) {
+	static char sector[DISK_SECTOR_SIZE];
+	static char *words[LOADER_ARGS_LEN / 2 + 1];
+	struct disk *boot_disk = disk_get (0, 0);
+	char *args = sector + (LOADER_ARGS - LOADER_BASE);
+	uint32_t argc;
+	char **argv;
+
+	if (boot_disk == NULL)
+		PANIC ("-snapshot: no boot disk to take the new command line from");
+	printf ("Snapshot point reached.\n");
+	serial_flush ();
+	for (;;) {
+		disk_read (boot_disk, 0, sector);
+		argc = *(uint32_t *) (sector + (LOADER_ARG_CNT - LOADER_BASE));
+		if (argc > 0 && !strcmp (args, "-resume"))
+			break;
+		timer_msleep (10);
+	}
+
+	argv = split_command_line (args, argc, words) + 1;
+	for (; *argv != NULL && **argv == '-'; argv++) {
+		char *save_ptr;
+		char *name = strtok_r (*argv, "=", &save_ptr);
+		char *value = strtok_r (NULL, "", &save_ptr);
+
+		if (!strcmp (name, "-q"))
+			power_off_when_done = true;
+		else if (!strcmp (name, "-rs"))
+			random_init (atoi (value));
+		else
+			PANIC ("option `%s' must be given when the snapshot is taken",
+					name);
+	}
+	return argv;
+}
+#endif
+
+/* Parses the "-ts=HIGH,LOW" option VALUE. */
+static void
+parse_time_slices (char *value) {
+	char *save_ptr;
+	char *high = value != NULL ? strtok_r (value, ",", &save_ptr) : NULL;
+	char *low = high != NULL ? strtok_r (NULL, "", &save_ptr) : NULL;
+	int high_ticks = high != NULL ? atoi (high) : 0;
+	int low_ticks = low != NULL ? atoi (low) : 0;
+
+	if (high_ticks <= 0 || high_ticks > 255 || low_ticks <= 0 || low_ticks > 255)
+		PANIC ("bad -ts value `%s' (expected HIGH,LOW ticks in 1...255)",
+				value != NULL ? value : "");
+	thread_set_time_slices (high_ticks, low_ticks);
+}
+
+/* Parses the argument to "-loops", a loops/s count as the boot
+   message prints it, thousands separators and all. */
+static void
+parse_loops (const char *value) {
+	uint64_t loops = 0;
+	const char *p;
+
+	for (p = value != NULL ? value : ""; *p != '\0'; p++)
+		if (*p >= '0' && *p <= '9')
+			loops = loops * 10 + (*p - '0');
+		else if (*p != ',')
+			break;
+	if (*p != '\0' || loops < TIMER_FREQ)
+		PANIC ("bad -loops value `%s' (expected loops/s >= %d)",
+				value != NULL ? value : "", TIMER_FREQ);
+	timer_loops_per_sec = loops;
+}
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv) {
@@ -266,6 +551,7 @@ run_actions (char **argv) {
 	/* Table of supported actions. */
 	static const struct action actions[] = {
 		{"run", 2, run_task},
+		{"bench", 1, bench_run},
 #ifdef FILESYS
 		{"ls", 1, fsutil_ls},
 		{"cat", 2, fsutil_cat},
@@ -312,6 +598,7 @@ usage (void) {
 #else
 			"  run TEST           Run TEST.\n"
 #endif
+			"  bench              Time kernel primitives, one KEY=VALUE line each.\n"
 #ifdef FILESYS
 			"  ls                 List files in the root directory.\n"
 			"  cat FILE           Print FILE to the console.\n"
@@ -324,10 +611,52 @@ usage (void) {
 			"  -h                 Print this help message and power off.\n"
 			"  -q                 Power off VM after actions or on panic.\n"
 			"  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+			"  -bc=SECTORS        Cache SECTORS file system sectors (0 disables).\n"
+			"  -fat-lazy          Read FAT sectors on demand through the cache.\n"
+			"  -snapshot          Wait before the actions to be snapshotted, then\n"
+			"                     run those the resumed command line gives.\n"
+#endif
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -rr                Use round-robin scheduler, ignoring priorities.\n"
+			"  -tickless          Stop the periodic timer tick while idle.\n"
+			"  -idle-poll[=US]    Poll up to US microseconds (default 200) for\n"
+			"                     a ready thread before halting when idle.\n"
+			"  -loops=N           Take N loops/s, as printed at boot, as calibrated.\n"
+			"  -ts=HIGH,LOW       Give PRI_MAX threads HIGH ticks per slice and\n"
+			"                     PRI_MIN threads LOW, shrinking under load.\n"
+			"  -buddy             Allocate pages with a buddy allocator.\n"
+			"  -mstat=SECS        Print memory statistics every SECS seconds.\n"
+			"  -bootstat          Print how long each boot phase took.\n"
+			"  -smp               Bring up the other CPUs (they stay idle).\n"
+			"  -pic               Take external interrupts from the 8259 PICs\n"
+			"                     even if there is an I/O APIC.\n"
+			"  -lockstat          Print the most contended locks at shutdown.\n"
+			"  -profile[=TICKS]   Sample the running address every TICKS ticks.\n"
+			"  -trace[=EVENTS]    Record EVENTS (comma-separated, or \"all\") to a\n"
+			"                     ring dumped at power off.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+			"  -sysstat           Print system call statistics at shutdown.\n"
+#endif
+#ifdef VM
+			"  -no-cow            Copy pages during fork instead of sharing them.\n"
+			"  -no-huge           Map anonymous memory with 4 kB pages only.\n"
+			"  -no-compact        Never move frames to make contiguous memory.\n"
+			"  -overcommit=MODE   Commit anonymous memory by heuristic (0),\n"
+			"                     always (1), or up to a limit (2).\n"
+			"  -ocratio=PCT       Let mode 2 commit PCT%% of user memory\n"
+			"                     beyond swap.\n"
+			"  -fa=PAGES          Map up to PAGES pages around sequential faults.\n"
+			"  -vmstat            Print page fault statistics as processes exit.\n"
+			"  -rlow=PAGES        Start background reclaim below PAGES free pages.\n"
+			"  -rhigh=PAGES       Stop background reclaim at PAGES free pages.\n"
+			"  -ksm=PAGES         Scan PAGES pages per pass to merge equal ones.\n"
+			"  -ksm-ms=MS         Sleep MS milliseconds between merge passes.\n"
+			"  -zswap=PAGES       Keep up to PAGES pages of compressed swap in RAM.\n"
+			"  -rss=PAGES         Limit each process to PAGES resident pages.\n"
+			"  -wss=MS            Sample working sets every MS milliseconds.\n"
 #endif
 			);
 	power_off ();
@@ -343,17 +672,74 @@ power_off (void) {
 #endif
 
 	print_stats ();
+	profile_dump ();
+	trace_dump ();
 
 	printf ("Powering off...\n");
+	serial_flush ();
 	outw (0x604, 0x2000);               /* Poweroff command for qemu */
 	for (;;);
 }
 
+/* Prints memory statistics every MSTAT_SECONDS seconds, for the
+   "-mstat" option. */
+static void
+mstat_thread (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep ((int64_t) mstat_seconds * TIMER_FREQ);
+		palloc_print_stats ();
+		malloc_print_stats ();
+		kmem_print_stats ();
+	}
+}
+
+/* Marks the end of boot phase NAME, for -bootstat.  The phase
+   began where the previous one ended. */
+void
+boot_phase (const char *name) {
+	if (boot_mark_cnt < BOOT_PHASE_MAX) {
+		boot_marks[boot_mark_cnt].name = name;
+		boot_marks[boot_mark_cnt].tsc = rdtsc ();
+		boot_mark_cnt++;
+	}
+}
+
+/* Prints the time each boot phase took, for -bootstat. */
+static void
+print_boot_stats (void) {
+	uint64_t total = rdtsc () - boot_tsc;
+	uint64_t prev = boot_tsc;
+	int i;
+
+	printf ("Boot: %'"PRIu64" cycles, %'"PRId64" us.\n",
+			total, timer_cycles_to_ns (total) / 1000);
+	for (i = 0; i < boot_mark_cnt; i++) {
+		const struct boot_mark *m = &boot_marks[i];
+		uint64_t cycles = m->tsc - prev;
+
+		printf ("  %-16s %'14"PRIu64" cycles %'10"PRId64" us %3d%%\n",
+				m->name, cycles, timer_cycles_to_ns (cycles) / 1000,
+				(int) (cycles * 100 / (total ? total : 1)));
+		prev = m->tsc;
+	}
+}
+
 /* Print statistics about Pintos execution. */
 static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	synch_print_stats ();
+	lock_print_stats ();
+	palloc_print_stats ();
+	malloc_print_stats ();
+	kmem_print_stats ();
+	intr_print_stats ();
+	mmu_print_stats ();
+	workqueue_print_stats ();
+#ifdef VM
+	vm_print_stats ();
+#endif
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -361,5 +747,7 @@ print_stats (void) {
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
+	if (syscall_stat)
+		syscall_print_stats ();
 #endif
 }
@@ -8,11 +8,14 @@
 #include "threads/io.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
 #include "devices/timer.h"
 #include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/gdt.h"
+#include "userprog/process.h"
 #endif
 
 /* Number of x86_64 interrupts. */
@@ -93,6 +96,35 @@ static intr_handler_func *intr_handlers[INTR_CNT];
 /* Names for each interrupt, for debugging purposes. */
 static const char *intr_names[INTR_CNT];
 
+/* External interrupts delivered by the local APIC rather than
+   the PIC, see intr_register_apic(). */
+static bool intr_from_apic[INTR_CNT];
+
+/* True once intr_mask_pic() has handed the ISA interrupts to the
+   I/O APIC, which the local APIC acknowledges. */
+static bool pic_masked;
+
+/* Handlers registered to run with interrupts on.  Every gate is an
+   interrupt gate, so that entry from user mode can `swapgs' before
+   anything preempts it, and intr_handler() turns interrupts back
+   on for these if the interrupted code had them on, just as a
+   trap gate would have left them. */
+static bool intr_trap[INTR_CNT];
+
+/* Per-vector statistics: how often each vector fired and how many
+   TSC cycles its handler took, in total and at most.  A handler
+   that sleeps or yields, such as a system call, is charged for the
+   time until it resumes and returns. */
+struct intr_stats {
+	uint64_t count;
+	uint64_t cycles;
+	uint64_t max_cycles;
+};
+static struct intr_stats intr_stats[INTR_CNT];
+
+static void account_handler (uint8_t vec_no, uint64_t cycles);
+static intr_handler_func inspect_intr;
+
 /* External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
    interrupts turned off, so they never nest, nor are they ever
@@ -101,8 +133,20 @@ static const char *intr_names[INTR_CNT];
    request that a new process be scheduled just before the
    interrupt returns. */
 static bool in_external_intr;   /* Are we processing an external interrupt? */
+static bool external_from_user; /* Did it interrupt user code? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Deferred interrupt work.  Handlers raise softirqs to move work
+   out of the interrupts-off window: once the outermost external
+   interrupt has been acknowledged, pending softirqs run in order
+   with interrupts on, and only then does a requested yield happen.
+   An external interrupt arriving meanwhile just queues more work
+   for the loop already running. */
+static struct list softirq_pending;
+static bool in_softirq;         /* Running softirqs? */
+
+static void run_softirqs (void);
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -166,6 +210,7 @@ intr_init (void) {
 
 	/* Initialize interrupt controller. */
 	pic_init ();
+	list_init (&softirq_pending);
 
 	/* Initialize IDT. */
 	for (i = 0; i < INTR_CNT; i++) {
@@ -173,11 +218,6 @@ intr_init (void) {
 		intr_names[i] = "unknown";
 	}
 
-#ifdef USERPROG
-	/* Load TSS. */
-	ltr (SEL_TSS);
-#endif
-
 	/* Load IDT register. */
 	lidt(&idt_desc);
 
@@ -201,6 +241,15 @@ intr_init (void) {
 	intr_names[17] = "#AC Alignment Check Exception";
 	intr_names[18] = "#MC Machine-Check Exception";
 	intr_names[19] = "#XF SIMD Floating-Point Exception";
+
+	intr_register_int (0x46, 3, INTR_OFF, inspect_intr,
+			"Inspect Interrupt Statistics");
+}
+
+/* Loads the IDT on an application processor. */
+void
+intr_init_ap (void) {
+	lidt (&idt_desc);
 }
 
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
@@ -211,12 +260,8 @@ static void
 register_handler (uint8_t vec_no, int dpl, enum intr_level level,
 		intr_handler_func *handler, const char *name) {
 	ASSERT (intr_handlers[vec_no] == NULL);
-	if (level == INTR_ON) {
-		make_trap_gate(&idt[vec_no], intr_stubs[vec_no], dpl);
-	}
-	else {
-		make_intr_gate(&idt[vec_no], intr_stubs[vec_no], dpl);
-	}
+	make_intr_gate(&idt[vec_no], intr_stubs[vec_no], dpl);
+	intr_trap[vec_no] = level == INTR_ON;
 	intr_handlers[vec_no] = handler;
 	intr_names[vec_no] = name;
 }
@@ -252,17 +297,37 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
 	register_handler (vec_no, dpl, level, handler, name);
 }
 
-/* Returns true during processing of an external interrupt
-   and false at all other times. */
+/* Registers external interrupt VEC_NO, raised by the local APIC,
+   to invoke HANDLER, which is named NAME for debugging purposes.
+   It runs as described for intr_register_ext(), except that it is
+   acknowledged at the local APIC rather than the PIC. */
+void
+intr_register_apic (uint8_t vec_no, intr_handler_func *handler,
+		const char *name) {
+	ASSERT (vec_no >= 0x30);
+	register_handler (vec_no, 0, INTR_OFF, handler, name);
+	intr_from_apic[vec_no] = true;
+}
+
+/* Returns true during processing of an external interrupt or of
+   the softirqs that follow it, and false at all other times.
+   Code in either context must not sleep. */
 bool
 intr_context (void) {
-	return in_external_intr;
+	return in_external_intr || in_softirq;
+}
+
+/* Returns true during processing of an external interrupt that
+   interrupted user code, and false at all other times. */
+bool
+intr_from_user (void) {
+	return in_external_intr && external_from_user;
 }
 
-/* During processing of an external interrupt, directs the
-   interrupt handler to yield to a new process just before
-   returning from the interrupt.  May not be called at any other
-   time. */
+/* During processing of an external interrupt or a softirq,
+   directs the interrupt handler to yield to a new process just
+   before returning from the interrupt.  May not be called at any
+   other time. */
 void
 intr_yield_on_return (void) {
 	ASSERT (intr_context ());
@@ -308,6 +373,18 @@ pic_init (void) {
 	outb (0xa1, 0x00);
 }
 
+/* Masks every interrupt on both PICs, for ioapic_init(), which
+   delivers them through the local APIC instead.  Interrupts must
+   be off. */
+void
+intr_mask_pic (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	outb (0x21, 0xff);
+	outb (0xa1, 0xff);
+	pic_masked = true;
+}
+
 /* Sends an end-of-interrupt signal to the PIC for the given IRQ.
    If we don't acknowledge the IRQ, it will never be delivered to
    us again, so this is important.  */
@@ -333,24 +410,34 @@ intr_handler (struct intr_frame *frame) {
 	bool external;
 	intr_handler_func *handler;
 
+	if (intr_trap[frame->vec_no] && (frame->eflags & FLAG_IF))
+		intr_enable ();
+	trace (TRACE_INTR, frame->vec_no, frame->rip, 0);
+
 	/* External interrupts are special.
 	   We only handle one at a time (so interrupts must be off)
 	   and they need to be acknowledged on the PIC (see below).
 	   An external interrupt handler cannot sleep. */
-	external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+	external = (frame->vec_no >= 0x20 && frame->vec_no < 0x30)
+		|| intr_from_apic[frame->vec_no];
 	if (external) {
 		ASSERT (intr_get_level () == INTR_OFF);
-		ASSERT (!intr_context ());
+		ASSERT (!in_external_intr);
 
 		in_external_intr = true;
-		yield_on_return = false;
+		external_from_user = (frame->cs & 3) == 3;
+		if (!in_softirq)
+			yield_on_return = false;
 	}
 
 	/* Invoke the interrupt's handler. */
 	handler = intr_handlers[frame->vec_no];
-	if (handler != NULL)
+	if (handler != NULL) {
+		uint8_t vec_no = frame->vec_no;
+		uint64_t start = rdtsc ();
 		handler (frame);
-	else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f) {
+		account_handler (vec_no, rdtsc () - start);
+	} else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f) {
 		/* There is no handler, but this interrupt can trigger
 		   spuriously due to a hardware fault or hardware race
 		   condition.  Ignore it. */
@@ -367,11 +454,121 @@ intr_handler (struct intr_frame *frame) {
 		ASSERT (intr_context ());
 
 		in_external_intr = false;
-		pic_end_of_interrupt (frame->vec_no);
+		if (intr_from_apic[frame->vec_no] || pic_masked)
+			lapic_eoi ();
+		else
+			pic_end_of_interrupt (frame->vec_no);
+
+		/* A nested interrupt leaves both to the softirq loop it
+		   interrupted. */
+		if (!in_softirq) {
+			run_softirqs ();
+			if (yield_on_return || thread_resched_pending ())
+				thread_preempt ();
+#ifdef USERPROG
+			/* A thread of a killed process goes instead of going
+			   back to user mode. */
+			if ((frame->cs & 3) == 3 && process_group_exiting ()) {
+				intr_enable ();
+				thread_exit ();
+			}
+#endif
+		}
+	}
+}
+
+/* Records one run of the handler for VEC_NO that took CYCLES.
+   Handlers that run with interrupts on can be interrupted here,
+   so the updates are atomic. */
+static void
+account_handler (uint8_t vec_no, uint64_t cycles) {
+	struct intr_stats *st = &intr_stats[vec_no];
+	uint64_t max = __atomic_load_n (&st->max_cycles, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add (&st->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&st->cycles, cycles, __ATOMIC_RELAXED);
+	while (cycles > max
+			&& !__atomic_compare_exchange_n (&st->max_cycles, &max, cycles,
+				false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		continue;
+}
+
+/* Prints a line for each interrupt vector that has fired. */
+void
+intr_print_stats (void) {
+	int i;
+
+	for (i = 0; i < INTR_CNT; i++) {
+		const struct intr_stats *st = &intr_stats[i];
+		if (st->count != 0)
+			printf ("Interrupt %#04x (%s): %llu times, %llu cycles, "
+					"%llu max\n", i, intr_names[i], st->count, st->cycles,
+					st->max_cycles);
+	}
+}
 
-		if (yield_on_return)
-			thread_yield ();
+/* Interrupt 0x46 handler, which lets user tests read the
+   per-vector statistics.  On entry RAX holds the vector and RDX
+   selects the statistic: 0 for the count, 1 for total cycles, 2
+   for the maximum.  The value, or -1 if RDX is invalid, is
+   returned in RAX. */
+static void
+inspect_intr (struct intr_frame *f) {
+	const struct intr_stats *st = &intr_stats[f->R.rax & (INTR_CNT - 1)];
+
+	switch (f->R.rdx) {
+		case 0: f->R.rax = st->count; break;
+		case 1: f->R.rax = st->cycles; break;
+		case 2: f->R.rax = st->max_cycles; break;
+		default: f->R.rax = -1; break;
+	}
+}
+
+/* Initializes SOFTIRQ to call FUNC, passing AUX. */
+void
+softirq_init (struct softirq *softirq, softirq_func *func, void *aux) {
+	ASSERT (softirq != NULL);
+	ASSERT (func != NULL);
+
+	softirq->func = func;
+	softirq->aux = aux;
+	softirq->pending = false;
+}
+
+/* Schedules SOFTIRQ to run with interrupts on as soon as the
+   current external interrupt, or the next one if we are not in
+   one, has been handled.  Raising a softirq that is already
+   pending does nothing, so it runs once for any number of raises.
+   May be called from any context. */
+void
+softirq_raise (struct softirq *softirq) {
+	enum intr_level old_level = intr_disable ();
+
+	if (!softirq->pending) {
+		softirq->pending = true;
+		list_push_back (&softirq_pending, &softirq->elem);
+	}
+	intr_set_level (old_level);
+}
+
+/* Runs pending softirqs, with interrupts on, until none remain.
+   Called at the end of an outermost external interrupt, with
+   interrupts off, and returns with them off. */
+static void
+run_softirqs (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	in_softirq = true;
+	while (!list_empty (&softirq_pending)) {
+		struct softirq *softirq = list_entry (list_pop_front (&softirq_pending),
+				struct softirq, elem);
+
+		softirq->pending = false;
+		intr_enable ();
+		softirq->func (softirq->aux);
+		intr_disable ();
 	}
+	in_softirq = false;
 }
 
 /* Dumps interrupt frame F to the console, for debugging. */
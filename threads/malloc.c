@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,14 +33,75 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   A slab cache made by kmem_cache_create() is one more descriptor
+   whose block size is exactly the object size, rounded up to the
+   requested alignment, so fixed-size kernel objects are packed
+   tightly instead of being rounded up to a power of 2.  Its
+   arenas look like any other, so free() works on its objects
+   too.
+
+   Each CPU keeps a "magazine" of free blocks for each descriptor,
+   and a second one that is either full or empty, and allocates
+   from and frees to them with interrupts off but without taking
+   the descriptor's lock.  Only when both are empty (or both full)
+   does it go to the descriptor, which keeps a small "depot" of
+   full magazines to hand over, or take, whole.  A CPU that finds
+   the depot empty fills a magazine from the free list, and one
+   that finds it full empties its magazine back onto the free
+   list, each under one acquisition of the lock.  Blocks in
+   magazines and the depot count as free to us but as in use to
+   their arenas, which are therefore not freed.  See [Bonwick01]
+   "Magazines and Vmem". */
+
+/* Most blocks in a magazine, and most full magazines in a
+   depot. */
+#define MAG_ROUNDS 16
+#define DEPOT_MAX 4
+
+/* A stack of free blocks, linked through their NEXT members. */
+struct magazine {
+	struct block *top;          /* Most recently freed block. */
+	size_t cnt;                 /* Blocks in the magazine. */
+};
+
+/* One CPU's magazines for a descriptor, and its statistics, which
+   only it writes.  Touched only with interrupts off. */
+struct mag_cpu {
+	struct magazine loaded;     /* Allocated from and freed to. */
+	struct magazine prev;       /* Full or empty. */
+	uint64_t alloc_cnt;         /* Blocks handed out... */
+	uint64_t req_bytes;         /* ...and the bytes asked for in them. */
+	uint64_t free_cnt;          /* Blocks given back. */
+	uint8_t pad[8];             /* To 64 bytes, a cache line. */
+};
 
 /* Descriptor. */
 struct desc {
 	size_t block_size;          /* Size of each element in bytes. */
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
+	size_t first_ofs;           /* Offset of block 0 in its arena. */
+	size_t mag_rounds;          /* Blocks in a full magazine. */
 	struct list free_list;      /* List of free blocks. */
-	struct lock lock;           /* Lock. */
+	struct spinlock lock;       /* Guards the fields below. */
+	struct block *depot;        /* Top block of first full magazine. */
+	size_t depot_cnt;           /* Full magazines in the depot. */
+
+	/* Slab caches only. */
+	const char *name;           /* Name, for statistics. */
+	size_t obj_size;            /* Requested object size. */
+	void (*ctor) (void *);      /* Run on each new object, or null. */
+
+	size_t arena_cnt;           /* Arenas currently allocated. */
+
+	struct mag_cpu cpus[CPU_MAX];  /* Indexed by CPU id. */
+};
+
+/* Slab cache of fixed-size objects. */
+struct kmem_cache {
+	struct desc desc;           /* Descriptor for the cache's arenas. */
+	struct list_elem elem;      /* Element in CACHES. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -54,15 +116,39 @@ struct arena {
 
 /* Free block. */
 struct block {
-	struct list_elem free_elem; /* Free list element. */
+	union {
+		struct list_elem free_elem; /* Free list element. */
+		struct {
+			struct block *next;     /* Next block in its magazine. */
+			struct block *next_mag; /* In a depot, in a magazine's
+			                           top block, the next magazine. */
+		};
+	};
 };
 
 /* Our set of descriptors. */
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* All slab caches. */
+static struct list caches;
+static struct lock caches_lock;
+
+/* Pages currently held by big blocks.  Updated atomically. */
+static size_t big_pages;
+static struct cpu_counter big_cnt; /* Big blocks ever allocated. */
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void desc_init (struct desc *, size_t block_size, size_t align);
+static void *desc_alloc (struct desc *, size_t size);
+static bool desc_grow (struct desc *);
+static void desc_free (struct desc *, struct block *);
+static bool mag_reload (struct desc *, struct mag_cpu *);
+static void mag_unload (struct desc *, struct mag_cpu *);
+static void desc_stats (const struct desc *, size_t *in_use,
+		uint64_t *alloc_cnt, uint64_t *req_bytes);
+static bool resize_in_place (void *block, size_t new_size);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -72,11 +158,189 @@ malloc_init (void) {
 	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
 		struct desc *d = &descs[desc_cnt++];
 		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-		d->block_size = block_size;
-		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-		list_init (&d->free_list);
-		lock_init (&d->lock);
+		desc_init (d, block_size, 1);
+	}
+	list_init (&caches);
+	lock_init (&caches_lock);
+}
+
+/* Initializes D for blocks of BLOCK_SIZE bytes, each aligned to a
+   multiple of ALIGN, which must be a power of 2. */
+static void
+desc_init (struct desc *d, size_t block_size, size_t align) {
+	ASSERT (align != 0 && (align & (align - 1)) == 0);
+
+	memset (d, 0, sizeof *d);
+	d->block_size = ROUND_UP (block_size, align);
+	d->first_ofs = ROUND_UP (sizeof (struct arena), align);
+	ASSERT (d->first_ofs + d->block_size <= PGSIZE);
+	d->blocks_per_arena = (PGSIZE - d->first_ofs) / d->block_size;
+	d->mag_rounds = d->blocks_per_arena < MAG_ROUNDS ? d->blocks_per_arena
+		: MAG_ROUNDS;
+	list_init (&d->free_list);
+	spin_lock_init (&d->lock);
+}
+
+/* Creates a slab cache of objects of SIZE bytes, aligned to ALIGN
+   bytes (a power of 2, or 0 for pointer alignment), and named
+   NAME for statistics.  If CTOR is nonnull, kmem_cache_alloc()
+   runs it on each object before returning it.  Returns a null
+   pointer if memory is not available.  Objects may be no bigger
+   than about half a page. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+		void (*ctor) (void *)) {
+	struct kmem_cache *c;
+	size_t block_size = size > sizeof (struct block) ? size
+		: sizeof (struct block);
+
+	if (align == 0)
+		align = sizeof (void *);
+	ASSERT (block_size <= PGSIZE / 2);
+
+	c = malloc (sizeof *c);
+	if (c == NULL)
+		return NULL;
+	desc_init (&c->desc, block_size, align);
+	c->desc.name = name;
+	c->desc.obj_size = size;
+	c->desc.ctor = ctor;
+
+	lock_acquire (&caches_lock);
+	list_push_back (&caches, &c->elem);
+	lock_release (&caches_lock);
+	return c;
+}
+
+/* Returns a new object from cache C, or a null pointer if memory
+   is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	void *obj;
+
+	ASSERT (c != NULL);
+
+	obj = desc_alloc (&c->desc, c->desc.obj_size);
+	if (obj != NULL && c->desc.ctor != NULL)
+		c->desc.ctor (obj);
+	return obj;
+}
+
+/* Returns OBJ, which must have come from cache C, to C.  OBJ may
+   be null. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	ASSERT (c != NULL);
+
+	if (obj != NULL) {
+		ASSERT (block_to_arena (obj)->desc == &c->desc);
+		desc_free (&c->desc, obj);
+	}
+}
+
+/* Returns the number of bytes of kernel memory that malloc() and
+   the slab caches hold: whole arenas plus big blocks. */
+size_t
+malloc_bytes_held (void) {
+	size_t pages = __atomic_load_n (&big_pages, __ATOMIC_RELAXED);
+	struct list_elem *e;
+	size_t i;
+
+	for (i = 0; i < desc_cnt; i++)
+		pages += descs[i].arena_cnt;
+	for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e))
+		pages += list_entry (e, struct kmem_cache, elem)->desc.arena_cnt;
+	return pages * PGSIZE;
+}
+
+/* Returns the number of bytes handed out in malloc() blocks that
+   are still in use. */
+size_t
+malloc_bytes_in_use (void) {
+	size_t bytes = __atomic_load_n (&big_pages, __ATOMIC_RELAXED) * PGSIZE;
+	size_t i;
+
+	for (i = 0; i < desc_cnt; i++) {
+		size_t in_use;
+
+		desc_stats (&descs[i], &in_use, NULL, NULL);
+		bytes += in_use * descs[i].block_size;
+	}
+	return bytes;
+}
+
+/* Sums the per-CPU statistics of D into the blocks it has handed
+   out that are still in use, if IN_USE is nonnull, and those it
+   has ever handed out and the bytes asked for in them, if
+   ALLOC_CNT and REQ_BYTES are.  Without a lock, the sums may be a
+   little out of date. */
+static void
+desc_stats (const struct desc *d, size_t *in_use, uint64_t *alloc_cnt,
+		uint64_t *req_bytes) {
+	uint64_t allocs = 0, frees = 0, bytes = 0;
+	int i;
+
+	for (i = 0; i < CPU_MAX; i++) {
+		const struct mag_cpu *m = &d->cpus[i];
+
+		allocs += __atomic_load_n (&m->alloc_cnt, __ATOMIC_RELAXED);
+		frees += __atomic_load_n (&m->free_cnt, __ATOMIC_RELAXED);
+		bytes += __atomic_load_n (&m->req_bytes, __ATOMIC_RELAXED);
+	}
+	if (in_use != NULL)
+		*in_use = allocs > frees ? allocs - frees : 0;
+	if (alloc_cnt != NULL)
+		*alloc_cnt = allocs;
+	if (req_bytes != NULL)
+		*req_bytes = bytes;
+}
+
+/* Prints one line per malloc() size class that has been used:
+   blocks and arenas in use, and how many of the bytes handed out
+   were asked for, which shows what rounding up to a power of 2
+   costs. */
+void
+malloc_print_stats (void) {
+	size_t i;
+
+	for (i = 0; i < desc_cnt; i++) {
+		const struct desc *d = &descs[i];
+		uint64_t alloc_cnt, req_bytes, granted;
+		size_t in_use;
+
+		desc_stats (d, &in_use, &alloc_cnt, &req_bytes);
+		if (alloc_cnt == 0)
+			continue;
+		granted = alloc_cnt * d->block_size;
+		printf ("Malloc: %4zu-byte blocks: %zu in use in %zu arenas, "
+				"%llu of %llu bytes used (%llu%%)\n",
+				d->block_size, in_use, d->arena_cnt,
+				(unsigned long long) req_bytes,
+				(unsigned long long) granted,
+				(unsigned long long) (req_bytes * 100 / granted));
+	}
+	if (cpu_counter_read (&big_cnt) > 0)
+		printf ("Malloc: big blocks: %zu pages in use, %lld allocated\n",
+				big_pages, cpu_counter_read (&big_cnt));
+}
+
+/* Prints one line per slab cache. */
+void
+kmem_print_stats (void) {
+	struct list_elem *e;
+
+	if (!lock_try_acquire (&caches_lock))
+		return;
+	for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e)) {
+		const struct desc *d = &list_entry (e, struct kmem_cache, elem)->desc;
+		size_t in_use;
+
+		desc_stats (d, &in_use, NULL, NULL);
+		printf ("Slab: %-12s %zu objects of %zu bytes (%zu packed per page)"
+				" in %zu pages\n", d->name, in_use, d->obj_size,
+				d->blocks_per_arena, d->arena_cnt);
 	}
+	lock_release (&caches_lock);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -84,7 +348,6 @@ malloc_init (void) {
 void *
 malloc (size_t size) {
 	struct desc *d;
-	struct block *b;
 	struct arena *a;
 
 	/* A null pointer satisfies a request for 0 bytes. */
@@ -109,38 +372,103 @@ malloc (size_t size) {
 		a->magic = ARENA_MAGIC;
 		a->desc = NULL;
 		a->free_cnt = page_cnt;
+		__atomic_fetch_add (&big_pages, page_cnt, __ATOMIC_RELAXED);
+		cpu_counter_inc (&big_cnt);
 		return a + 1;
 	}
 
-	lock_acquire (&d->lock);
+	return desc_alloc (d, size);
+}
 
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
+/* Obtains and returns a block from this CPU's magazines for D,
+   reloading them from D, and giving D a new arena first if it has
+   no free blocks, for a request of SIZE bytes.  Returns a null
+   pointer if memory is not available. */
+static void *
+desc_alloc (struct desc *d, size_t size) {
+	for (;;) {
+		enum intr_level old_level = intr_disable ();
+		struct mag_cpu *m = &d->cpus[this_cpu ()->id];
+
+		if (m->loaded.cnt == 0 && m->prev.cnt > 0) {
+			struct magazine full = m->prev;
+			m->prev = m->loaded;
+			m->loaded = full;
+		}
+		if (m->loaded.cnt > 0 || mag_reload (d, m)) {
+			struct block *b = m->loaded.top;
+
+			m->loaded.top = b->next;
+			m->loaded.cnt--;
+			m->alloc_cnt++;
+			m->req_bytes += size;
+			intr_set_level (old_level);
+			return b;
+		}
+		intr_set_level (old_level);
 
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
+		/* D has no free blocks.  The page is allocated with
+		   interrupts as the caller had them, so another thread may
+		   take its blocks before we return for one; then we try
+		   again. */
+		if (!desc_grow (d))
 			return NULL;
-		}
+	}
+}
 
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
+/* Fills M's loaded magazine, which must be empty, as is M's other
+   magazine, with a full magazine from D's depot or, failing that,
+   with as many blocks from D's free list as a magazine holds.
+   Returns false if D has no free blocks at all. */
+static bool
+mag_reload (struct desc *d, struct mag_cpu *m) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (m->loaded.cnt == 0 && m->prev.cnt == 0);
+
+	spin_lock (&d->lock);
+	if (d->depot != NULL) {
+		m->loaded.top = d->depot;
+		m->loaded.cnt = d->mag_rounds;
+		d->depot = d->depot->next_mag;
+		d->depot_cnt--;
+	} else {
+		while (m->loaded.cnt < d->mag_rounds && !list_empty (&d->free_list)) {
+			struct block *b = list_entry (list_pop_front (&d->free_list),
+					struct block, free_elem);
+
+			block_to_arena (b)->free_cnt--;
+			b->next = m->loaded.top;
+			m->loaded.top = b;
+			m->loaded.cnt++;
 		}
 	}
+	spin_unlock (&d->lock);
+	return m->loaded.cnt > 0;
+}
 
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
-	lock_release (&d->lock);
-	return b;
+/* Adds a new arena's blocks to D's free list.  Returns false if
+   no page is available. */
+static bool
+desc_grow (struct desc *d) {
+	enum intr_level old_level;
+	struct arena *a;
+	size_t i;
+
+	a = palloc_get_page (0);
+	if (a == NULL)
+		return false;
+
+	a->magic = ARENA_MAGIC;
+	a->desc = d;
+	a->free_cnt = d->blocks_per_arena;
+	old_level = spin_lock_irqsave (&d->lock);
+	d->arena_cnt++;
+	for (i = 0; i < d->blocks_per_arena; i++) {
+		struct block *b = arena_to_block (a, i);
+		list_push_back (&d->free_list, &b->free_elem);
+	}
+	spin_unlock_irqrestore (&d->lock, old_level);
+	return true;
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -184,7 +512,9 @@ realloc (void *old_block, size_t new_size) {
 	if (new_size == 0) {
 		free (old_block);
 		return NULL;
-	} else {
+	} else if (old_block != NULL && resize_in_place (old_block, new_size))
+		return old_block;
+	else {
 		void *new_block = malloc (new_size);
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
@@ -196,6 +526,36 @@ realloc (void *old_block, size_t new_size) {
 	}
 }
 
+/* Tries to make BLOCK hold NEW_SIZE bytes without moving it and
+   returns true if successful.  A block that is already big enough
+   stays as it is, except that a big block gives back the pages it
+   no longer needs.  A big block that is too small tries to take
+   over the free pages that follow it. */
+static bool
+resize_in_place (void *block, size_t new_size) {
+	struct arena *a = block_to_arena (block);
+	size_t page_cnt;
+
+	if (a->desc != NULL)
+		return new_size <= a->desc->block_size;
+
+	page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+	if (page_cnt < a->free_cnt) {
+		palloc_free_multiple ((uint8_t *) a + page_cnt * PGSIZE,
+				a->free_cnt - page_cnt);
+		__atomic_fetch_sub (&big_pages, a->free_cnt - page_cnt,
+				__ATOMIC_RELAXED);
+		a->free_cnt = page_cnt;
+	} else if (page_cnt > a->free_cnt) {
+		if (!palloc_grow_multiple (a, a->free_cnt, page_cnt))
+			return false;
+		__atomic_fetch_add (&big_pages, page_cnt - a->free_cnt,
+				__ATOMIC_RELAXED);
+		a->free_cnt = page_cnt;
+	}
+	return true;
+}
+
 /* Frees block P, which must have been previously allocated with
    malloc(), calloc(), or realloc(). */
 void
@@ -207,38 +567,96 @@ free (void *p) {
 
 		if (d != NULL) {
 			/* It's a normal block.  We handle it here. */
+			desc_free (d, b);
+		} else {
+			/* It's a big block.  Free its pages. */
+			__atomic_fetch_sub (&big_pages, a->free_cnt, __ATOMIC_RELAXED);
+			palloc_free_multiple (a, a->free_cnt);
+			return;
+		}
+	}
+}
+
+/* Returns block B to this CPU's magazines for D, first moving a
+   full magazine to D if both are full. */
+static void
+desc_free (struct desc *d, struct block *b) {
+	enum intr_level old_level;
+	struct mag_cpu *m;
 
 #ifndef NDEBUG
-			/* Clear the block to help detect use-after-free bugs. */
-			memset (b, 0xcc, d->block_size);
+	/* Clear the block to help detect use-after-free bugs. */
+	memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
+	old_level = intr_disable ();
+	m = &d->cpus[this_cpu ()->id];
+	if (m->loaded.cnt == d->mag_rounds) {
+		if (m->prev.cnt == 0) {
+			struct magazine empty = m->prev;
+			m->prev = m->loaded;
+			m->loaded = empty;
+		} else
+			mag_unload (d, m);
+	}
+	b->next = m->loaded.top;
+	m->loaded.top = b;
+	m->loaded.cnt++;
+	m->free_cnt++;
+	intr_set_level (old_level);
+}
+
+/* Empties M's loaded magazine, which must be full, into D's depot
+   or, if that is full, onto D's free list, freeing the arenas
+   that leaves entirely unused. */
+static void
+mag_unload (struct desc *d, struct mag_cpu *m) {
+	struct block *unused = NULL;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (m->loaded.cnt == d->mag_rounds);
+
+	spin_lock (&d->lock);
+	if (d->depot_cnt < DEPOT_MAX) {
+		m->loaded.top->next_mag = d->depot;
+		d->depot = m->loaded.top;
+		d->depot_cnt++;
+	} else {
+		struct block *b, *next;
+
+		for (b = m->loaded.top; b != NULL; b = next) {
+			struct arena *a = block_to_arena (b);
 
-			/* Add block to free list. */
+			next = b->next;
 			list_push_front (&d->free_list, &b->free_elem);
 
-			/* If the arena is now entirely unused, free it. */
+			/* If the arena is now entirely unused, take its blocks
+			   off the free list and chain it through its first
+			   block for freeing after we let go of the lock. */
 			if (++a->free_cnt >= d->blocks_per_arena) {
+				struct block *first = arena_to_block (a, 0);
 				size_t i;
 
 				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
+				for (i = 0; i < d->blocks_per_arena; i++)
+					list_remove (&arena_to_block (a, i)->free_elem);
+				d->arena_cnt--;
+				first->next = unused;
+				unused = first;
 			}
-
-			lock_release (&d->lock);
-		} else {
-			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
-			return;
 		}
 	}
+	spin_unlock (&d->lock);
+	m->loaded.top = NULL;
+	m->loaded.cnt = 0;
+
+	while (unused != NULL) {
+		struct block *next = unused->next;
+		palloc_free_page (pg_round_down (unused));
+		unused = next;
+	}
 }
-
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
@@ -250,7 +668,7 @@ block_to_arena (struct block *b) {
 
 	/* Check that the block is properly aligned for the arena. */
 	ASSERT (a->desc == NULL
-			|| (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
+			|| (pg_ofs (b) - a->desc->first_ofs) % a->desc->block_size == 0);
 	ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
 
 	return a;
@@ -263,6 +681,6 @@ arena_to_block (struct arena *a, size_t idx) {
 	ASSERT (a->magic == ARENA_MAGIC);
 	ASSERT (idx < a->desc->blocks_per_arena);
 	return (struct block *) ((uint8_t *) a
-			+ sizeof *a
+			+ a->desc->first_ofs
 			+ idx * a->desc->block_size);
 }
@@ -1,18 +1,168 @@
+#include <histogram.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include "devices/lapic.h"
+#include "threads/cpu.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/spinlock.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context IDs.  With CR4.PCIDE set, TLB entries are tagged
+   with the PCID in the low bits of CR3, so switching between
+   processes need not flush each other's translations.  PCID 0
+   belongs to base_pml4; user pml4s get IDs 1...PCID_MAX from a
+   counter, and when the counter wraps the generation advances
+   and the whole TLB is flushed once, so an ID handed out in an
+   older generation is never trusted.
+
+   The ID lives in the otherwise unused last PML4 slot.  The MMU
+   ignores every bit of an entry whose present bit is clear, so
+   the slot holds the PCID in bits 1...12, a "needs flush" bit,
+   and the generation above them. */
+#define PCID_SLOT 511
+#define PCID_MAX 0xfff
+#define PCID_SHIFT 1
+#define PCID_STALE (1UL << 13)
+#define PCID_GEN_SHIFT 14
+
+#define CR3_NOFLUSH (1UL << 63)
+#define CR4_PGE (1 << 7)
+#define CR4_PCIDE (1 << 17)
+#define CPUID_1_EDX_PGE (1 << 13)
+#define CPUID_1_ECX_PCID (1 << 17)
+#define CPUID_7_EBX_INVPCID (1 << 10)
+
+static bool pcid_enabled;       /* CR4.PCIDE is set. */
+static bool has_invpcid;        /* INVPCID is available. */
+static uint64_t pcid_gen = 1;   /* Current PCID generation. */
+static uint64_t next_pcid = 1;  /* Next PCID to hand out. */
+
+/* CPUs that may hold TLB entries for a user pml4, as a bit mask
+   shifted above the present bit in another unused PML4 slot.
+   pml4_activate() adds the running CPU.  Without PCIDs, loading
+   CR3 drops the old pml4's entries, so it also takes the CPU out
+   of the set of the pml4 it leaves; with PCIDs those entries
+   survive, and so does the CPU's membership. */
+#define CPUS_SLOT 510
+#define CPUS_SHIFT 1
+
+/* PML4 slots below this one map user space; the slots from it up
+   to CPUS_SLOT map the kernel and point to PDPT pages that every
+   pml4 shares with base_pml4. */
+#define KERN_PML4_FIRST PML4 (KERN_BASE)
+
+/* TLB shootdown.
+
+   Once another CPU has run a pml4, changing one of its mappings
+   must invalidate that CPU's TLB as well.  shootdown() sends the
+   invalidations of one operation, a single page or a whole
+   mmu_gather, in one IPI to just the other CPUs in the pml4's set,
+   and spins until every one of them has acknowledged.  One
+   shootdown is in flight at a time.  A CPU waiting for its turn
+   serves requests aimed at itself meanwhile, since it has
+   interrupts off, or two CPUs shooting at each other would wait
+   forever.  For the same reason, no spinlock may be held across a
+   change that can shoot down. */
+static struct spinlock shootdown_lock = SPINLOCK_INITIALIZER;
+static struct {
+	uint64_t *pml4;                 /* Address space changed. */
+	const uint64_t *va;             /* Pages to invalidate... */
+	size_t cnt;                     /* ...their number, or more to flush. */
+	unsigned pending;               /* CPUs yet to acknowledge. */
+} shootdown_req;
+static long long shootdown_cnt;         /* Shootdowns that sent IPIs. */
+static long long shootdown_ipis;        /* IPIs sent. */
+static struct histogram shootdown_latency; /* TSC cycles to all acks. */
+
+/* Page tables set aside for splitting user 2 MB mappings.
+   pml4_set_huge_page() puts one here for each mapping it makes,
+   and splitting or destroying the mapping takes one back, so that
+   a split, which eviction and munmap depend on, never runs out of
+   memory.  Each page links to the next through its first word. */
+static struct spinlock split_lock = SPINLOCK_INITIALIZER;
+static void *split_reserve;             /* Reserved page tables. */
+static long long huge_maps;             /* User 2 MB mappings made. */
+static long long huge_splits;           /* ...and split. */
+
+static void tlb_invalidate (uint64_t *pml4, uint64_t va);
+static void tlb_flush (uint64_t *pml4);
+static void tlb_local (uint64_t *pml4, const uint64_t *va, size_t cnt);
+static void shootdown (uint64_t *pml4, const uint64_t *va, size_t cnt);
+static void shootdown_serve (void);
+static intr_handler_func shootdown_interrupt;
+static void invalidate (uint64_t *pml4, struct mmu_gather *, uint64_t va);
+static void clear_page (uint64_t *pml4, void *upage, struct mmu_gather *);
+static void set_dirty (uint64_t *pml4, const void *vpage, bool dirty,
+		struct mmu_gather *);
+static void set_accessed (uint64_t *pml4, const void *vpage, bool accessed,
+		struct mmu_gather *);
+static uint64_t *pte_for_change (uint64_t *pml4, const void *vpage);
+static void split_reserve_put (void *pt);
+static void *split_reserve_take (void);
+
+/* Replaces the 2 MB mapping in *PDE by a page table that maps
+ * the same memory with 4 kB pages and the same permissions, so
+ * that one of those pages can be remapped.  The translations do
+ * not change, so stale TLB entries for them are harmless.  A user
+ * mapping's page table comes from the split reserve.
+ * Returns false if out of memory. */
+static bool
+split_large_pde (uint64_t *pde) {
+	uint64_t *pt = *pde & PTE_U ? split_reserve_take () : palloc_get_page (0);
+	uint64_t pa = PTE_ADDR (*pde) & ~LARGE_PGMASK;
+	uint64_t flags = *pde & PTE_FLAGS & ~PTE_PS;
+
+	if (pt == NULL)
+		return false;
+	for (unsigned i = 0; i < PGSIZE / sizeof (uint64_t); i++)
+		pt[i] = (pa + (uint64_t) i * PGSIZE) | flags;
+	if (*pde & PTE_U)
+		huge_splits++;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	return true;
+}
+
+/* Sets page table PT aside for a split. */
+static void
+split_reserve_put (void *pt) {
+	enum intr_level old_level = spin_lock_irqsave (&split_lock);
+
+	*(void **) pt = split_reserve;
+	split_reserve = pt;
+	spin_unlock_irqrestore (&split_lock, old_level);
+}
+
+/* Takes a page table set aside for a split, or allocates one if
+ * none is left; returns a null pointer if out of memory. */
+static void *
+split_reserve_take (void) {
+	enum intr_level old_level = spin_lock_irqsave (&split_lock);
+	void *pt = split_reserve;
+
+	if (pt != NULL)
+		split_reserve = *(void **) pt;
+	spin_unlock_irqrestore (&split_lock, old_level);
+	return pt != NULL ? pt : palloc_get_page (0);
+}
+
+/* Returns the entry for VA in page directory PDP: the PDE itself
+ * if WANT_PDE, otherwise the PTE in the page table it points to.
+ * A 2 MB PDE is split when CREATE is set and a PTE is wanted;
+ * without CREATE the large PDE is returned in place of a PTE. */
 static uint64_t *
-pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
+pgdir_walk (uint64_t *pdp, const uint64_t va, int create, bool want_pde) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		if (want_pde)
+			return &pdp[idx];
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -22,6 +172,11 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 					return NULL;
 			} else
 				return NULL;
+		} else if ((uint64_t) pte & PTE_PS) {
+			if (!create)
+				return &pdp[idx];
+			if (!split_large_pde (&pdp[idx]))
+				return NULL;
 		}
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
@@ -29,7 +184,7 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 }
 
 static uint64_t *
-pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
+pdpe_walk (uint64_t *pdpe, const uint64_t va, int create, bool want_pde) {
 	uint64_t *pte = NULL;
 	int idx = PDPE (va);
 	int allocated = 0;
@@ -46,7 +201,7 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
-		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
+		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create, want_pde);
 	}
 	if (pte == NULL && allocated) {
 		palloc_free_page ((void *) ptov (PTE_ADDR (pdpe[idx])));
@@ -55,14 +210,8 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 	return pte;
 }
 
-/* Returns the address of the page table entry for virtual
- * address VADDR in page map level 4, pml4.
- * If PML4E does not have a page table for VADDR, behavior depends
- * on CREATE.  If CREATE is true, then a new page table is
- * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
-uint64_t *
-pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
+static uint64_t *
+pml4_walk (uint64_t *pml4e, const uint64_t va, int create, bool want_pde) {
 	uint64_t *pte = NULL;
 	int idx = PML4 (va);
 	int allocated = 0;
@@ -79,7 +228,7 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
-		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create);
+		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create, want_pde);
 	}
 	if (pte == NULL && allocated) {
 		palloc_free_page ((void *) ptov (PTE_ADDR (pml4e[idx])));
@@ -88,15 +237,45 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page table entry for virtual
+ * address VADDR in page map level 4, pml4.
+ * If PML4E does not have a page table for VADDR, behavior depends
+ * on CREATE.  If CREATE is true, then a new page table is
+ * created and a pointer into it is returned.  Otherwise, a null
+ * pointer is returned.
+ * If VADDR lies in a 2 MB mapping, CREATE splits it into 4 kB
+ * pages first; without CREATE the PDE, which has PTE_PS set, is
+ * returned instead. */
+uint64_t *
+pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
+	return pml4_walk (pml4e, va, create, false);
+}
+
+/* Returns the address of the page directory entry for virtual
+ * address VADDR in PML4, creating the upper levels if CREATE is
+ * true.  Used to install 2 MB mappings. */
+uint64_t *
+pml4_pde_walk (uint64_t *pml4, const uint64_t va, int create) {
+	return pml4_walk (pml4, va, create, true);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
+ * The kernel slots point to base_pml4's own PDPT pages, so the
+ * kernel half is shared rather than copied and never walked or
+ * freed per process.
  * Returns the new page directory, or a null pointer if memory
  * allocation fails. */
 uint64_t *
 pml4_create (void) {
 	uint64_t *pml4 = palloc_get_page (0);
-	if (pml4)
-		memcpy (pml4, base_pml4, PGSIZE);
+	if (pml4) {
+		memset (pml4, 0, KERN_PML4_FIRST * sizeof *pml4);
+		memcpy (pml4 + KERN_PML4_FIRST, base_pml4 + KERN_PML4_FIRST,
+				(CPUS_SLOT - KERN_PML4_FIRST) * sizeof *pml4);
+		pml4[CPUS_SLOT] = 0;
+		pml4[PCID_SLOT] = 0;
+	}
 	return pml4;
 }
 
@@ -122,10 +301,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (((uint64_t) pdp[i] & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+			/* A 2 MB page: hand FUNC the PDE itself. */
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
+				return false;
+		} else if (((uint64_t) pte) & PTE_P)
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		cond_resched ();
 	}
 	return true;
 }
@@ -143,10 +330,11 @@ pdp_for_each (uint64_t *pdp,
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries in the user half of
+ * PML4.  The shared kernel half is not visited. */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
-	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
+	for (unsigned i = 0; i < KERN_PML4_FIRST; i++) {
 		uint64_t *pdpe = ptov((uint64_t *) pml4[i]);
 		if (((uint64_t) pdpe) & PTE_P)
 			if (!pdp_for_each ((uint64_t *) PTE_ADDR (pdpe), func, aux, i))
@@ -169,8 +357,16 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS) {
+			/* A user 2 MB page owns its memory. */
+			palloc_free_multiple (ptov (PTE_ADDR (pdp[i]) & ~LARGE_PGMASK),
+					LARGE_PGSIZE / PGSIZE);
+			palloc_free_page (split_reserve_take ());
+		} else
 			pt_destroy (PTE_ADDR (pte));
+		cond_resched ();
 	}
 	palloc_free_page ((void *) pdp);
 }
@@ -192,18 +388,281 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);
 
-	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
-	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
-	if (((uint64_t) pdpe) & PTE_P)
-		pdpe_destroy ((void *) PTE_ADDR (pdpe));
+	/* Only the user slots own their page tables; the kernel
+	   slots are shared with base_pml4. */
+	for (unsigned i = 0; i < KERN_PML4_FIRST; i++) {
+		uint64_t *pdpe = ptov ((uint64_t *) pml4[i]);
+		if (((uint64_t) pdpe) & PTE_P)
+			pdpe_destroy ((void *) PTE_ADDR (pdpe));
+	}
 	palloc_free_page ((void *) pml4);
 }
 
+/* Turns on global pages and, if the CPU has them, PCIDs.  Must
+ * be called with base_pml4 active. */
+void
+pml4_init_pcid (void) {
+	uint32_t ebx, ecx, edx;
+	uint64_t cr4 = rcr4 ();
+
+	cpuid (1, NULL, NULL, &ecx, &edx);
+	if (edx & CPUID_1_EDX_PGE)
+		cr4 |= CR4_PGE;
+	if (ecx & CPUID_1_ECX_PCID) {
+		ASSERT ((rcr3 () & PTE_FLAGS) == 0);
+		cpuid (7, NULL, &ebx, NULL, NULL);
+		has_invpcid = (ebx & CPUID_7_EBX_INVPCID) != 0;
+		cr4 |= CR4_PCIDE;
+		pcid_enabled = true;
+	}
+	lcr4 (cr4);
+}
+
+/* Flushes every non-global TLB entry of every PCID. */
+static void
+flush_all_pcids (void) {
+	if (has_invpcid)
+		invpcid (3, 0, 0);
+	else {
+		uint64_t cr4 = rcr4 ();
+		lcr4 (cr4 & ~CR4_PGE);
+		lcr4 (cr4);
+	}
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, PD's translations from the last time it
+ * was active are kept unless something marked them stale. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	uint64_t *slot, pcid;
+	bool flush;
+	enum intr_level old_level;
+	uint64_t cpu_bit;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+
+	old_level = intr_disable ();
+	cpu_bit = 1ULL << (this_cpu ()->id + CPUS_SHIFT);
+	if (pml4 != base_pml4)
+		__atomic_fetch_or (&pml4[CPUS_SLOT], cpu_bit, __ATOMIC_SEQ_CST);
+	if (!pcid_enabled || pml4 == base_pml4) {
+		uint64_t *old = ptov (PTE_ADDR (rcr3 ()));
+
+		if (!pcid_enabled && old != base_pml4 && old != pml4)
+			__atomic_fetch_and (&old[CPUS_SLOT], ~cpu_bit, __ATOMIC_SEQ_CST);
+		lcr3 (vtop (pml4));
+		intr_set_level (old_level);
+		return;
+	}
+
+	slot = &pml4[PCID_SLOT];
+	pcid = (*slot >> PCID_SHIFT) & PCID_MAX;
+	flush = (*slot & PCID_STALE) != 0;
+	if (pcid == 0 || (*slot >> PCID_GEN_SHIFT) != pcid_gen) {
+		if (next_pcid > PCID_MAX) {
+			pcid_gen++;
+			next_pcid = 1;
+			flush_all_pcids ();
+		}
+		pcid = next_pcid++;
+		flush = true;
+	}
+	*slot = (pcid_gen << PCID_GEN_SHIFT) | (pcid << PCID_SHIFT);
+	lcr3 (vtop (pml4) | pcid | (flush ? 0 : CR3_NOFLUSH));
+	intr_set_level (old_level);
+}
+
+/* Drops any TLB entry for VA cached on behalf of PML4.  If PML4
+ * is not active, the entry is invalidated by PCID, or PML4 is
+ * marked to be flushed the next time it is activated. */
+static void
+tlb_invalidate (uint64_t *pml4, uint64_t va) {
+	enum intr_level old_level;
+	uint64_t *slot;
+
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4)) {
+		invlpg (va);
+		return;
+	}
+	if (!pcid_enabled || pml4 == base_pml4)
+		return;
+
+	old_level = intr_disable ();
+	slot = &pml4[PCID_SLOT];
+	if ((*slot >> PCID_GEN_SHIFT) == pcid_gen) {
+		if (has_invpcid)
+			invpcid (0, (*slot >> PCID_SHIFT) & PCID_MAX, va);
+		else
+			*slot |= PCID_STALE;
+	}
+	intr_set_level (old_level);
+}
+
+/* Drops every non-global TLB entry cached on behalf of PML4. */
+static void
+tlb_flush (uint64_t *pml4) {
+	enum intr_level old_level;
+	uint64_t *slot;
+
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4)) {
+		/* Without the no-flush bit, this flushes the current PCID. */
+		lcr3 (rcr3 ());
+		return;
+	}
+	if (!pcid_enabled || pml4 == base_pml4)
+		return;
+
+	old_level = intr_disable ();
+	slot = &pml4[PCID_SLOT];
+	if ((*slot >> PCID_GEN_SHIFT) == pcid_gen) {
+		if (has_invpcid)
+			invpcid (1, (*slot >> PCID_SHIFT) & PCID_MAX, 0);
+		else
+			*slot |= PCID_STALE;
+	}
+	intr_set_level (old_level);
+}
+
+/* Invalidates VA in PML4 now, or queues it in G if G is nonnull. */
+static void
+invalidate (uint64_t *pml4, struct mmu_gather *g, uint64_t va) {
+	if (g != NULL)
+		mmu_gather_add (g, (void *) va);
+	else
+		shootdown (pml4, &va, 1);
+}
+
+/* On the running CPU, invalidates the CNT pages at VA in PML4, or
+   flushes PML4 if CNT exceeds MMU_GATHER_MAX. */
+static void
+tlb_local (uint64_t *pml4, const uint64_t *va, size_t cnt) {
+	if (cnt > MMU_GATHER_MAX)
+		tlb_flush (pml4);
+	else
+		for (size_t i = 0; i < cnt; i++)
+			tlb_invalidate (pml4, va[i]);
+}
+
+/* Like tlb_local(), but on every CPU that may have cached PML4. */
+static void
+shootdown (uint64_t *pml4, const uint64_t *va, size_t cnt) {
+	enum intr_level old_level;
+	unsigned targets, c;
+	uint64_t start;
+
+	tlb_local (pml4, va, cnt);
+	if (pml4 == base_pml4 || cpu_cnt < 2)
+		return;
+
+	old_level = intr_disable ();
+	targets = (__atomic_load_n (&pml4[CPUS_SLOT], __ATOMIC_SEQ_CST)
+			>> CPUS_SHIFT) & ~(1u << this_cpu ()->id);
+	if (targets == 0) {
+		intr_set_level (old_level);
+		return;
+	}
+
+	while (!spin_trylock (&shootdown_lock))
+		shootdown_serve ();
+	start = rdtsc ();
+	shootdown_req.pml4 = pml4;
+	shootdown_req.va = va;
+	shootdown_req.cnt = cnt;
+	__atomic_store_n (&shootdown_req.pending, targets, __ATOMIC_RELEASE);
+	for (c = 0; c < cpu_cnt; c++)
+		if (targets & (1u << c)) {
+			lapic_send_ipi (cpus[c].apic_id, LAPIC_SHOOTDOWN_VEC);
+			shootdown_ipis++;
+		}
+	while (__atomic_load_n (&shootdown_req.pending, __ATOMIC_ACQUIRE) != 0)
+		asm volatile ("pause" : : : "memory");
+	shootdown_cnt++;
+	histogram_add (&shootdown_latency, rdtsc () - start);
+	spin_unlock (&shootdown_lock);
+	intr_set_level (old_level);
+}
+
+/* Carries out the shootdown in flight, if it is aimed at the
+   running CPU, and acknowledges it.  Interrupts must be off. */
+static void
+shootdown_serve (void) {
+	unsigned bit = 1u << this_cpu ()->id;
+
+	if (__atomic_load_n (&shootdown_req.pending, __ATOMIC_ACQUIRE) & bit) {
+		tlb_local (shootdown_req.pml4, shootdown_req.va, shootdown_req.cnt);
+		__atomic_fetch_and (&shootdown_req.pending, ~bit, __ATOMIC_RELEASE);
+	}
+}
+
+/* Shootdown IPI handler. */
+static void
+shootdown_interrupt (struct intr_frame *f UNUSED) {
+	shootdown_serve ();
+}
+
+/* Registers the TLB shootdown IPI.  Called before the application
+   processors start. */
+void
+pml4_init_shootdown (void) {
+	histogram_init (&shootdown_latency);
+	intr_register_apic (LAPIC_SHOOTDOWN_VEC, shootdown_interrupt,
+			"TLB Shootdown IPI");
+}
+
+/* Prints statistics on 2 MB user mappings, and on TLB
+   shootdowns if there can have been any. */
+void
+mmu_print_stats (void) {
+	if (huge_maps > 0)
+		printf ("Huge pages: %lld mapped, %lld split\n", huge_maps,
+				huge_splits);
+	if (cpu_cnt < 2)
+		return;
+	printf ("TLB: %lld shootdowns, %lld IPIs\n", shootdown_cnt,
+			shootdown_ipis);
+	histogram_print (&shootdown_latency, "TLB: shootdown latency", "cycles");
+}
+
+/* Starts gathering invalidations for PML4 in G. */
+void
+mmu_gather_init (struct mmu_gather *g, uint64_t *pml4) {
+	ASSERT (pml4 != NULL);
+
+	g->pml4 = pml4;
+	g->cnt = 0;
+}
+
+/* Queues an invalidation of page VA in G. */
+void
+mmu_gather_add (struct mmu_gather *g, const void *va) {
+	if (g->cnt < MMU_GATHER_MAX)
+		g->va[g->cnt] = (uint64_t) va;
+	if (g->cnt <= MMU_GATHER_MAX)
+		g->cnt++;
+}
+
+/* Queues an invalidation of the PAGE_CNT pages starting at VA in
+   G.  A range larger than G can hold becomes a full flush. */
+void
+mmu_gather_add_range (struct mmu_gather *g, const void *va,
+		size_t page_cnt) {
+	if (g->cnt + page_cnt > MMU_GATHER_MAX) {
+		g->cnt = MMU_GATHER_MAX + 1;
+		return;
+	}
+	for (size_t i = 0; i < page_cnt; i++)
+		g->va[g->cnt++] = (uint64_t) va + i * PGSIZE;
+}
+
+/* Performs the invalidations queued in G and empties it, so that
+   G can be reused for the same pml4. */
+void
+mmu_gather_flush (struct mmu_gather *g) {
+	if (g->cnt > 0)
+		shootdown (g->pml4, g->va, g->cnt);
+	g->cnt = 0;
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,8 +675,12 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (*pte & PTE_PS)
+			return ptov ((PTE_ADDR (*pte) & ~LARGE_PGMASK)
+					+ ((uint64_t) uaddr & LARGE_PGMASK));
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
@@ -238,30 +701,91 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		bool was_present = (*pte & PTE_P) != 0;
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (was_present)
+			invalidate (pml4, NULL, (uint64_t) upage);
+	}
 	return pte != NULL;
 }
 
+/* Maps the 2 MB of user virtual memory at UPAGE in PML4 to the
+ * 2 MB of physical memory at kernel virtual address KPAGE with a
+ * single PDE, read/write if RW.  Both must be 2 MB-aligned, and
+ * KPAGE should come from palloc_get_aligned() on the user pool;
+ * PML4 then owns it, as it does pages mapped by pml4_set_page().
+ * The mapping is split into 4 kB pages by the first change to
+ * just one of them.  Returns false, mapping nothing, if some of
+ * the range is mapped already or memory allocation failed. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	void *pt;
+	uint64_t *pde;
+
+	ASSERT (((uint64_t) upage & LARGE_PGMASK) == 0);
+	ASSERT ((vtop (kpage) & LARGE_PGMASK) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	pt = palloc_get_page (0);
+	if (pt == NULL)
+		return false;
+	pde = pml4_pde_walk (pml4, (uint64_t) upage, 1);
+	if (pde == NULL || (*pde & PTE_P)) {
+		palloc_free_page (pt);
+		return false;
+	}
+	split_reserve_put (pt);
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	huge_maps++;
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
  * UPAGE need not be mapped. */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
+	clear_page (pml4, upage, NULL);
+}
+
+/* Like pml4_clear_page(), but leaves the TLB invalidation to
+ * mmu_gather_flush() on G. */
+void
+pml4_clear_page_gather (struct mmu_gather *g, void *upage) {
+	clear_page (g->pml4, upage, g);
+}
+
+static void
+clear_page (uint64_t *pml4, void *upage, struct mmu_gather *g) {
 	uint64_t *pte;
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (is_user_vaddr (upage));
 
-	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	pte = pte_for_change (pml4, upage);
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		invalidate (pml4, g, (uint64_t) upage);
 	}
 }
 
+/* Returns the PTE for virtual page VPAGE in PML4, or a null
+ * pointer if it has none, splitting a 2 MB mapping of VPAGE first
+ * so that the PTE can be changed for VPAGE alone.  The accessed
+ * and dirty bits of an unsplit mapping stand for all of its
+ * pages. */
+static uint64_t *
+pte_for_change (uint64_t *pml4, const void *vpage) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+
+	if (pte != NULL && (*pte & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+		pte = pml4e_walk (pml4, (uint64_t) vpage, true);
+	return pte;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
  * installed.
@@ -276,15 +800,27 @@ pml4_is_dirty (uint64_t *pml4, const void *vpage) {
  * in PML4. */
 void
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	set_dirty (pml4, vpage, dirty, NULL);
+}
+
+/* Like pml4_set_dirty(), but leaves the TLB invalidation to
+ * mmu_gather_flush() on G. */
+void
+pml4_set_dirty_gather (struct mmu_gather *g, const void *vpage, bool dirty) {
+	set_dirty (g->pml4, vpage, dirty, g);
+}
+
+static void
+set_dirty (uint64_t *pml4, const void *vpage, bool dirty,
+		struct mmu_gather *g) {
+	uint64_t *pte = pte_for_change (pml4, vpage);
 	if (pte) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		invalidate (pml4, g, (uint64_t) vpage);
 	}
 }
 
@@ -302,6 +838,20 @@ pml4_is_accessed (uint64_t *pml4, const void *vpage) {
    VPAGE in PD. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
+	set_accessed (pml4, vpage, accessed, NULL);
+}
+
+/* Like pml4_set_accessed(), but leaves the TLB invalidation to
+ * mmu_gather_flush() on G. */
+void
+pml4_set_accessed_gather (struct mmu_gather *g, const void *vpage,
+		bool accessed) {
+	set_accessed (g->pml4, vpage, accessed, g);
+}
+
+static void
+set_accessed (uint64_t *pml4, const void *vpage, bool accessed,
+		struct mmu_gather *g) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
 	if (pte) {
 		if (accessed)
@@ -309,7 +859,22 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		invalidate (pml4, g, (uint64_t) vpage);
+	}
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+ * VPAGE in G's pml4, keeping the other bits, and leaves the TLB
+ * invalidation to mmu_gather_flush() on G. */
+void
+pml4_set_writable_gather (struct mmu_gather *g, const void *vpage,
+		bool writable) {
+	uint64_t *pte = pte_for_change (g->pml4, vpage);
+	if (pte != NULL && (*pte & PTE_P)) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+		mmu_gather_add (g, vpage);
 	}
 }
@@ -2,14 +2,18 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/malloc.h"
+#include "threads/spinlock.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,24 +28,163 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Every usable range of the e820 memory map is used, so a pool's
+   memory may have holes in it.  A pool numbers the pages of its
+   RANGES consecutively, in address order, with one page index left
+   permanently used between two ranges so that no run of free
+   indexes ever spans a hole; converting between a page and its
+   index is a binary search of RANGES.
+
+   Each pool finds free pages with one of two backends.  The
+   default scans USED_MAP first-fit under the pool's lock.  With
+   "-buddy", a binary buddy allocator keeps free blocks of 2**K
+   pages on FREE_LISTS[K] and finds and coalesces them in
+   O(log n); USED_MAP is still kept up to date so that both
+   backends check frees the same way.  The buddy lists are touched
+   only with interrupts off, since pages are freed from the
+   scheduler too.
+
+   In front of either backend, each pool keeps a small LIFO stack
+   of recently freed single pages, HOT.  Single-page requests are
+   served from it with interrupts briefly off, without the lock or
+   the bitmap, and get a page that is likely still in the cache.
+   Pages in HOT stay marked used in USED_MAP.  Once HOT holds
+   HOT_HIGH pages, the oldest HOT_BATCH go back to the backend in
+   one go.
+
+   Each pool also keeps up to ZERO_HIGH pages that the idle thread
+   has already cleared, ZEROED, so that single-page PAL_ZERO
+   requests skip the memset.
+
+   The split between the pools is only a starting point.  A pool
+   that runs out borrows from the other, as long as the lender
+   keeps a quarter of its own pages free: a multi-page request
+   takes its run from the lender directly, and a single page comes
+   from a chunk of LOAN_CHUNK pages taken at once, whose spares the
+   borrower keeps in LOANS.  Borrowed pages stay the lender's, so
+   freeing one returns it there, and the spares go back once the
+   borrower has LOAN_CHUNK pages of its own free again.  With
+   "-ul", the user pool's size is a hard limit and it never
+   borrows.
+
+   Single user pages scatter over the user pool, so a multi-page
+   request can fail with plenty of it free.  Such a failure is
+   noted in PALLOC_WANTED_RUN, and the VM's compaction, which moves
+   frames out of the way, builds runs with palloc_used_in() and
+   palloc_claim_free(). */
+
+/* Number of buddy block sizes: 2**0 up to 2**(BUDDY_ORDERS - 1)
+   pages. */
+#define BUDDY_ORDERS 24
+
+/* Single-page cache size: a free that finds HOT_HIGH pages in
+   the cache first returns the HOT_BATCH oldest to the backend. */
+#define HOT_HIGH 64
+#define HOT_BATCH 32
+
+/* Number of pre-zeroed pages the idle thread keeps per pool. */
+#define ZERO_HIGH 32
+
+/* Pages a pool borrows at once for a single-page request. */
+#define LOAN_CHUNK 64
+
+/* A pool lends only while more than 1/LEND_RESERVE_DIV of its
+   own pages stay free. */
+#define LEND_RESERVE_DIV 4
+
+/* Most usable memory ranges taken from the e820 map, and so most
+   ranges in one pool. */
+#define MAX_AREAS 32
+
+/* A range of contiguous memory in a pool. */
+struct pool_range {
+	uint8_t *base;                  /* First page. */
+	size_t first_idx;               /* Index of BASE in USED_MAP. */
+	size_t page_cnt;                /* Number of pages. */
+};
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
+	struct spinlock lock;           /* Guards the backend and caches. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
-	uint8_t *base;                  /* Base of pool. */
+	struct pool_range ranges[MAX_AREAS]; /* Memory, by address. */
+	size_t range_cnt;               /* Number of RANGES. */
+	size_t page_cnt;                /* Pages in RANGES. */
+	size_t usable_cnt;              /* Pages backed by memory. */
+	size_t used_cnt;                /* Pages handed out to callers. */
+
+	/* Buddy backend. */
+	uint8_t *order_map;             /* Per page: 1 + K if it starts a
+	                                   free block of 2**K pages, else 0. */
+	struct list free_lists[BUDDY_ORDERS]; /* Free blocks, by order. */
+
+	/* Single-page cache. */
+	void *hot[HOT_HIGH];            /* Freed pages, most recent last. */
+	size_t hot_cnt;                 /* Number of pages in HOT. */
+	long long hot_hits;             /* Single pages served from HOT. */
+	long long hot_misses;           /* Single pages from the backend. */
+	long long hot_drains;           /* Batches returned to the backend. */
+
+	/* Pre-zeroed pages. */
+	void *zeroed[ZERO_HIGH];        /* Pages zeroed by the idle thread. */
+	size_t zero_cnt;                /* Number of pages in ZEROED. */
+	long long zero_hits;            /* PAL_ZERO pages taken from ZEROED. */
+	long long zero_inline;          /* PAL_ZERO pages zeroed by the caller. */
+
+	/* Pages borrowed from the other pool. */
+	void *loans;                    /* Spares, linked through their
+	                                   first word. */
+	size_t loan_cnt;                /* Number of pages in LOANS. */
+	long long borrowed;             /* Pages taken from the other pool. */
+	long long repaid;               /* Spares given back unused. */
 };
 
+/* Use the buddy backend?  Set by "-buddy". */
+bool palloc_buddy;
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
-static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
+
+/* Longest run that a multi-page request drawing on the user pool
+   failed to find although enough of the pool was free, or 0.
+   Cleared by whoever compacts the pool. */
+size_t palloc_wanted_run;
+static void init_pool (struct pool *p, void **bm_base);
+static void add_range (struct pool *p, void *base, size_t page_cnt);
 
 static bool page_from_pool (const struct pool *, void *page);
+static const struct pool_range *range_of_page (const struct pool *,
+		const void *page);
+static size_t page_index (const struct pool *, const void *page);
+static void *index_page (const struct pool *, size_t page_idx);
+static struct pool *other_pool (const struct pool *);
+static void clear_pages (void *pages, int value, size_t page_cnt);
+static void buddy_build (struct pool *);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static bool buddy_claim (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t pool_alloc (struct pool *, size_t page_cnt);
+static size_t pool_alloc_aligned (struct pool *, size_t page_cnt,
+		size_t align);
+static void pool_release (struct pool *, size_t page_idx, size_t page_cnt);
+static void *hot_get (struct pool *);
+static void hot_put (struct pool *, void *page);
+static void hot_drain (struct pool *, size_t cnt);
+static void *zero_get (struct pool *);
+static void zero_drain (struct pool *);
+static bool zero_one (struct pool *);
+static size_t pool_free_pages (const struct pool *);
+static size_t pool_unused (const struct pool *);
+static size_t pool_lendable (const struct pool *);
+static bool may_borrow (const struct pool *);
+static void *pool_borrow (struct pool *, size_t page_cnt);
+static void loan_repay (struct pool *);
+static void note_failure (const struct pool *, size_t page_cnt);
 
 /* multiboot info */
 struct multiboot_info {
@@ -63,11 +206,10 @@ struct e820_entry {
 	uint32_t type;
 };
 
-/* Represent the range information of the ext_mem/base_mem */
+/* A range of usable physical memory, [START, END). */
 struct area {
 	uint64_t start;
 	uint64_t end;
-	uint64_t size;
 };
 
 #define BASE_MEM_THRESHOLD 0x100000
@@ -75,182 +217,138 @@ struct area {
 #define ACPI_RECLAIMABLE 3
 #define APPEND_HILO(hi, lo) (((uint64_t) ((hi)) << 32) + (lo))
 
-/* Iterate on the e820 entry, parse the range of basemem and extmem. */
-static void
-resolve_area_info (struct area *base_mem, struct area *ext_mem) {
+/* Collects the usable ranges of the e820 map into AREAS, trimmed
+   to whole pages, sorted by address, and with overlapping or
+   adjacent ranges merged.  Returns the number of ranges. */
+static size_t
+resolve_area_info (struct area areas[MAX_AREAS]) {
 	struct multiboot_info *mb_info = ptov (MULTIBOOT_INFO);
 	struct e820_entry *entries = ptov (mb_info->mmap_base);
+	size_t cnt = 0, merged, j;
 	uint32_t i;
 
 	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
 		struct e820_entry *entry = &entries[i];
-		if (entry->type == ACPI_RECLAIMABLE || entry->type == USABLE) {
-			uint64_t start = APPEND_HILO (entry->mem_hi, entry->mem_lo);
-			uint64_t size = APPEND_HILO (entry->len_hi, entry->len_lo);
-			uint64_t end = start + size;
-			printf("%llx ~ %llx %d\n", start, end, entry->type);
-
-			struct area *area = start < BASE_MEM_THRESHOLD ? base_mem : ext_mem;
-
-			// First entry that belong to this area.
-			if (area->size == 0) {
-				*area = (struct area) {
-					.start = start,
-					.end = end,
-					.size = size,
-				};
-			} else {  // otherwise
-				// Extend start
-				if (area->start > start)
-					area->start = start;
-				// Extend end
-				if (area->end < end)
-					area->end = end;
-				// Extend size
-				area->size += size;
-			}
+		uint64_t start, end;
+
+		if (entry->type != ACPI_RECLAIMABLE && entry->type != USABLE)
+			continue;
+		start = APPEND_HILO (entry->mem_hi, entry->mem_lo);
+		end = start + APPEND_HILO (entry->len_hi, entry->len_lo);
+		start = ROUND_UP (start, PGSIZE);
+		end = ROUND_DOWN (end, PGSIZE);
+		if (start >= end)
+			continue;
+		if (cnt == MAX_AREAS) {
+			printf ("palloc: ignoring memory 0x%llx ~ 0x%llx\n", start, end);
+			continue;
 		}
+
+		/* Insert in order of START. */
+		for (j = cnt; j > 0 && areas[j - 1].start > start; j--)
+			areas[j] = areas[j - 1];
+		areas[j] = (struct area) { .start = start, .end = end };
+		cnt++;
+	}
+
+	merged = 0;
+	for (j = 0; j < cnt; j++) {
+		if (merged > 0 && areas[j].start <= areas[merged - 1].end) {
+			if (areas[merged - 1].end < areas[j].end)
+				areas[merged - 1].end = areas[j].end;
+		} else
+			areas[merged++] = areas[j];
 	}
+	return merged;
 }
 
 /*
  * Populate the pool.
  * All the pages are manged by this allocator, even include code page.
  * Basically, give half of memory to kernel, half to user.
- * We push base_mem portion to the kernel as much as possible.
+ * The kernel pool takes memory from the bottom up, so it gets the
+ * base_mem portion and the kernel image.
  */
 static void
-populate_pools (struct area *base_mem, struct area *ext_mem) {
+populate_pools (const struct area *areas, size_t area_cnt) {
 	extern char _end;
 	void *free_start = pg_round_up (&_end);
+	struct pool *pools[2] = { &kernel_pool, &user_pool };
+	uint64_t total_pages = 0, user_pages, rem;
+	uint8_t *usable_bound;
+	size_t i, j;
 
-	uint64_t total_pages = (base_mem->size + ext_mem->size) / PGSIZE;
-	uint64_t user_pages = total_pages / 2 > user_page_limit ?
+	for (i = 0; i < area_cnt; i++)
+		total_pages += (areas[i].end - areas[i].start) / PGSIZE;
+	user_pages = total_pages / 2 > user_page_limit ?
 		user_page_limit : total_pages / 2;
-	uint64_t kern_pages = total_pages - user_pages;
 
-	// Parse E820 map to claim the memory region for each pool.
-	enum { KERN_START, KERN, USER_START, USER } state = KERN_START;
-	uint64_t rem = kern_pages;
-	uint64_t region_start = 0, end = 0, start, size, size_in_pg;
+	/* The first TOTAL_PAGES - USER_PAGES pages go to the kernel
+	   pool, the rest to the user pool.  The range in which the
+	   kernel pool ends may be split between the two. */
+	rem = total_pages - user_pages;
+	for (i = 0; i < area_cnt; i++) {
+		uint64_t start = areas[i].start;
 
-	struct multiboot_info *mb_info = ptov (MULTIBOOT_INFO);
-	struct e820_entry *entries = ptov (mb_info->mmap_base);
-
-	uint32_t i;
-	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
-		struct e820_entry *entry = &entries[i];
-		if (entry->type == ACPI_RECLAIMABLE || entry->type == USABLE) {
-			start = (uint64_t) ptov (APPEND_HILO (entry->mem_hi, entry->mem_lo));
-			size = APPEND_HILO (entry->len_hi, entry->len_lo);
-			end = start + size;
-			size_in_pg = size / PGSIZE;
-
-			if (state == KERN_START) {
-				region_start = start;
-				state = KERN;
-			}
+		while (start < areas[i].end) {
+			uint64_t page_cnt = (areas[i].end - start) / PGSIZE;
 
-			switch (state) {
-				case KERN:
-					if (rem > size_in_pg) {
-						rem -= size_in_pg;
-						break;
-					}
-					// generate kernel pool
-					init_pool (&kernel_pool,
-							&free_start, region_start, start + rem * PGSIZE);
-					// Transition to the next state
-					if (rem == size_in_pg) {
-						rem = user_pages;
-						state = USER_START;
-					} else {
-						region_start = start + rem * PGSIZE;
-						rem = user_pages - size_in_pg + rem;
-						state = USER;
-					}
-					break;
-				case USER_START:
-					region_start = start;
-					state = USER;
-					break;
-				case USER:
-					if (rem > size_in_pg) {
-						rem -= size_in_pg;
-						break;
-					}
-					ASSERT (rem == size);
-					break;
-				default:
-					NOT_REACHED ();
+			if (rem == 0)
+				add_range (&user_pool, ptov (start), page_cnt);
+			else {
+				if (page_cnt > rem)
+					page_cnt = rem;
+				add_range (&kernel_pool, ptov (start), page_cnt);
+				rem -= page_cnt;
 			}
+			start += page_cnt * PGSIZE;
 		}
 	}
 
-	// generate the user pool
-	init_pool(&user_pool, &free_start, region_start, end);
+	init_pool (&kernel_pool, &free_start);
+	init_pool (&user_pool, &free_start);
 
-	// Iterate over the e820_entry. Setup the usable.
-	uint64_t usable_bound = (uint64_t) free_start;
-	struct pool *pool;
-	void *pool_end;
-	size_t page_idx, page_cnt;
-
-	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
-		struct e820_entry *entry = &entries[i];
-		if (entry->type == ACPI_RECLAIMABLE || entry->type == USABLE) {
-			uint64_t start = (uint64_t)
-				ptov (APPEND_HILO (entry->mem_hi, entry->mem_lo));
-			uint64_t size = APPEND_HILO (entry->len_hi, entry->len_lo);
-			uint64_t end = start + size;
+	/* Free every page past the kernel and the bitmaps. */
+	usable_bound = free_start;
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < pools[i]->range_cnt; j++) {
+			const struct pool_range *r = &pools[i]->ranges[j];
+			uint8_t *start = r->base;
+			uint8_t *end = r->base + r->page_cnt * PGSIZE;
 
 			// TODO: add 0x1000 ~ 0x200000, This is not a matter for now.
 			// All the pages are unuable
-			if (end < usable_bound)
+			if (end <= usable_bound)
 				continue;
-
-			start = (uint64_t)
-				pg_round_up (start >= usable_bound ? start : usable_bound);
-split:
-			if (page_from_pool (&kernel_pool, (void *) start))
-				pool = &kernel_pool;
-			else if (page_from_pool (&user_pool, (void *) start))
-				pool = &user_pool;
-			else
-				NOT_REACHED ();
-
-			pool_end = pool->base + bitmap_size (pool->used_map) * PGSIZE;
-			page_idx = pg_no (start) - pg_no (pool->base);
-			if ((uint64_t) pool_end < end) {
-				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
-				start = (uint64_t) pool_end;
-				goto split;
-			} else {
-				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
-			}
+			if (start < usable_bound)
+				start = usable_bound;
+			bitmap_set_multiple (pools[i]->used_map,
+					r->first_idx + (start - r->base) / PGSIZE,
+					(end - start) / PGSIZE, false);
 		}
-	}
 }
 
 /* Initializes the page allocator and get the memory size */
 uint64_t
 palloc_init (void) {
-  /* End of the kernel as recorded by the linker.
-     See kernel.lds.S. */
-	extern char _end;
-	struct area base_mem = { .size = 0 };
-	struct area ext_mem = { .size = 0 };
+	struct area areas[MAX_AREAS];
+	size_t area_cnt = resolve_area_info (areas);
+	size_t i;
 
-	resolve_area_info (&base_mem, &ext_mem);
 	printf ("Pintos booting with: \n");
-	printf ("\tbase_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
-		  base_mem.start, base_mem.end, base_mem.size / 1024);
-	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
-		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
-	populate_pools (&base_mem, &ext_mem);
-	return ext_mem.end;
+	for (i = 0; i < area_cnt; i++)
+		printf ("\t%s: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
+				areas[i].start < BASE_MEM_THRESHOLD ? "base_mem" : "ext_mem",
+				areas[i].start, areas[i].end,
+				(areas[i].end - areas[i].start) / 1024);
+	populate_pools (areas, area_cnt);
+	kernel_pool.usable_cnt = pool_free_pages (&kernel_pool);
+	user_pool.usable_cnt = pool_free_pages (&user_pool);
+	if (palloc_buddy) {
+		buddy_build (&kernel_pool);
+		buddy_build (&user_pool);
+	}
+	return area_cnt > 0 ? areas[area_cnt - 1].end : 0;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -262,21 +360,44 @@ palloc_init (void) {
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	enum intr_level old_level;
+	size_t page_idx;
+	void *pages = NULL;
+	bool zeroed = false;
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
-	void *pages;
+	old_level = spin_lock_irqsave (&pool->lock);
+	if (page_cnt == 1 && (flags & PAL_ZERO)) {
+		pages = zero_get (pool);
+		zeroed = pages != NULL;
+	}
+	if (pages == NULL && page_cnt == 1)
+		pages = hot_get (pool);
+	if (pages == NULL) {
+		page_idx = pool_alloc (pool, page_cnt);
+		if (page_idx == BITMAP_ERROR
+				&& (pool->hot_cnt > 0 || pool->zero_cnt > 0)) {
+			/* Cached single pages may be what the run needs. */
+			zero_drain (pool);
+			hot_drain (pool, HOT_HIGH);
+			page_idx = pool_alloc (pool, page_cnt);
+		}
+		if (page_idx != BITMAP_ERROR)
+			pages = index_page (pool, page_idx);
+	}
+	if (pages != NULL && (flags & PAL_ZERO) && !zeroed)
+		pool->zero_inline += page_cnt;
+	spin_unlock_irqrestore (&pool->lock, old_level);
 
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
+	if (pages)
+		__atomic_add_fetch (&pool->used_cnt, page_cnt, __ATOMIC_RELAXED);
 	else
-		pages = NULL;
+		pages = pool_borrow (pool, page_cnt);
 
 	if (pages) {
-		if (flags & PAL_ZERO)
-			memset (pages, 0, PGSIZE * page_cnt);
+		if ((flags & PAL_ZERO) && !zeroed)
+			clear_pages (pages, 0, page_cnt);
 	} else {
+		note_failure (pool, page_cnt);
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
 	}
@@ -296,10 +417,144 @@ palloc_get_page (enum palloc_flags flags) {
 	return palloc_get_multiple (flags, 1);
 }
 
+/* Like palloc_get_multiple(), but the PAGE_CNT pages start at a
+   physical address that is a multiple of ALIGN, a power of two no
+   smaller than PGSIZE, as a 2 MB mapping needs.  The pages may be
+   freed one at a time as well as all together. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	enum intr_level old_level;
+	size_t page_idx;
+	void *pages = NULL;
+
+	ASSERT (align >= PGSIZE && (align & (align - 1)) == 0);
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	page_idx = pool_alloc_aligned (pool, page_cnt, align);
+	if (page_idx == BITMAP_ERROR
+			&& (pool->hot_cnt > 0 || pool->zero_cnt > 0)) {
+		zero_drain (pool);
+		hot_drain (pool, HOT_HIGH);
+		page_idx = pool_alloc_aligned (pool, page_cnt, align);
+	}
+	if (page_idx != BITMAP_ERROR) {
+		pages = index_page (pool, page_idx);
+		if (flags & PAL_ZERO)
+			pool->zero_inline += page_cnt;
+	}
+	spin_unlock_irqrestore (&pool->lock, old_level);
+
+	if (pages) {
+		__atomic_add_fetch (&pool->used_cnt, page_cnt, __ATOMIC_RELAXED);
+		if (flags & PAL_ZERO)
+			clear_pages (pages, 0, page_cnt);
+	} else {
+		note_failure (pool, page_cnt);
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+	return pages;
+}
+
+/* Records in PALLOC_WANTED_RUN that a request for PAGE_CNT pages
+   from POOL failed, if it was for a run, could have come from the
+   user pool, and failed for want of contiguity rather than of
+   memory. */
+static void
+note_failure (const struct pool *pool, size_t page_cnt) {
+	if (page_cnt > 1 && (pool == &user_pool || may_borrow (pool))
+			&& pool_unused (&user_pool) >= page_cnt
+			&& page_cnt > palloc_wanted_run)
+		palloc_wanted_run = page_cnt;
+}
+
+/* Stores the physical addresses of the first and one past the
+   last page of the user pool in *LO and *HI.  Returns false if
+   the pool is empty. */
+bool
+palloc_user_bounds (uint64_t *lo, uint64_t *hi) {
+	const struct pool_range *last;
+
+	if (user_pool.range_cnt == 0)
+		return false;
+	last = &user_pool.ranges[user_pool.range_cnt - 1];
+	*lo = vtop (user_pool.ranges[0].base);
+	*hi = vtop (last->base) + (uint64_t) last->page_cnt * PGSIZE;
+	return true;
+}
+
+/* Returns the number of the PAGE_CNT user pool pages at PAGES that
+   are handed out, not counting free pages in the pool's caches, or
+   SIZE_MAX if they do not all lie in one range of the pool.  The
+   count may be stale by the time it is returned. */
+size_t
+palloc_used_in (void *pages, size_t page_cnt) {
+	struct pool *pool = &user_pool;
+	const struct pool_range *r = range_of_page (pool, pages);
+	uint8_t *end = (uint8_t *) pages + page_cnt * PGSIZE;
+	enum intr_level old_level;
+	size_t page_idx, used, i;
+
+	if (r == NULL || pg_no (pages) - pg_no (r->base) + page_cnt > r->page_cnt)
+		return SIZE_MAX;
+	page_idx = page_index (pool, pages);
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	used = bitmap_count (pool->used_map, page_idx, page_cnt, true);
+	for (i = 0; i < pool->hot_cnt; i++)
+		if ((uint8_t *) pool->hot[i] >= (uint8_t *) pages
+				&& (uint8_t *) pool->hot[i] < end)
+			used--;
+	for (i = 0; i < pool->zero_cnt; i++)
+		if ((uint8_t *) pool->zeroed[i] >= (uint8_t *) pages
+				&& (uint8_t *) pool->zeroed[i] < end)
+			used--;
+	spin_unlock_irqrestore (&pool->lock, old_level);
+	return used;
+}
+
+/* Takes every free page among the PAGE_CNT user pool pages at
+   PAGES, as palloc_used_in() accepts them, first returning the
+   pool's cached pages to the backend, and marks each page taken
+   in OWNED, a bitmap of PAGE_CNT bits.  Returns the number of
+   pages taken; each is freed like any other. */
+size_t
+palloc_claim_free (void *pages, size_t page_cnt, struct bitmap *owned) {
+	struct pool *pool = &user_pool;
+	size_t page_idx = page_index (pool, pages);
+	enum intr_level old_level;
+	size_t i, end, cnt = 0;
+
+	ASSERT (bitmap_size (owned) == page_cnt);
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	zero_drain (pool);
+	hot_drain (pool, HOT_HIGH);
+	for (i = 0; i < page_cnt; i = end) {
+		end = i + 1;
+		if (bitmap_test (pool->used_map, page_idx + i))
+			continue;
+		while (end < page_cnt && !bitmap_test (pool->used_map, page_idx + end))
+			end++;
+		if (palloc_buddy) {
+			if (!buddy_claim (pool, page_idx + i, end - i))
+				NOT_REACHED ();
+		} else
+			bitmap_set_multiple (pool->used_map, page_idx + i, end - i, true);
+		bitmap_set_multiple (owned, i, end - i, true);
+		cnt += end - i;
+	}
+	spin_unlock_irqrestore (&pool->lock, old_level);
+	__atomic_add_fetch (&pool->used_cnt, cnt, __ATOMIC_RELAXED);
+	return cnt;
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
+	enum intr_level old_level;
 	size_t page_idx;
 
 	ASSERT (pg_ofs (pages) == 0);
@@ -313,13 +568,470 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	else
 		NOT_REACHED ();
 
-	page_idx = pg_no (pages) - pg_no (pool->base);
+	page_idx = page_index (pool, pages);
 
 #ifndef NDEBUG
-	memset (pages, 0xcc, PGSIZE * page_cnt);
+	clear_pages (pages, 0xcc, page_cnt);
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	__atomic_sub_fetch (&pool->used_cnt, page_cnt, __ATOMIC_RELAXED);
+	old_level = spin_lock_irqsave (&pool->lock);
+	if (page_cnt == 1)
+		hot_put (pool, pages);
+	else
+		pool_release (pool, page_idx, page_cnt);
+	spin_unlock_irqrestore (&pool->lock, old_level);
+
+	if (pool->loan_cnt > 0)
+		loan_repay (pool);
+}
+
+/* Extends the PAGE_CNT pages starting at PAGES, which must have
+   come from one palloc_get_multiple() call or its equivalent, to
+   NEW_CNT pages by taking the pages that follow them, if those are
+   all free.  Returns true if successful, false if PAGES must be
+   moved to grow.  The new pages are not zeroed. */
+bool
+palloc_grow_multiple (void *pages, size_t page_cnt, size_t new_cnt) {
+	struct pool *pool;
+	enum intr_level old_level;
+	size_t page_idx, extra;
+	bool ok = false;
+
+	ASSERT (pg_ofs (pages) == 0);
+	ASSERT (page_cnt > 0 && new_cnt >= page_cnt);
+
+	if (page_from_pool (&kernel_pool, pages))
+		pool = &kernel_pool;
+	else if (page_from_pool (&user_pool, pages))
+		pool = &user_pool;
+	else
+		NOT_REACHED ();
+
+	page_idx = page_index (pool, pages) + page_cnt;
+	extra = new_cnt - page_cnt;
+	if (extra == 0)
+		return true;
+	if (page_idx + extra > bitmap_size (pool->used_map))
+		return false;
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	if (palloc_buddy)
+		ok = buddy_claim (pool, page_idx, extra);
+	else if (bitmap_none (pool->used_map, page_idx, extra)) {
+		bitmap_set_multiple (pool->used_map, page_idx, extra, true);
+		ok = true;
+	}
+	spin_unlock_irqrestore (&pool->lock, old_level);
+	if (ok)
+		__atomic_add_fetch (&pool->used_cnt, extra, __ATOMIC_RELAXED);
+	return ok;
+}
+
+/* Takes PAGE_CNT contiguous pages from POOL's backend and returns
+   the index of the first, or BITMAP_ERROR.
+
+   This and the other functions below that take a pool, down to
+   buddy_free(), expect the caller to hold the pool's lock. */
+static size_t
+pool_alloc (struct pool *pool, size_t page_cnt) {
+	if (palloc_buddy)
+		return buddy_alloc (pool, page_cnt);
+	return bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+}
+
+/* Takes PAGE_CNT contiguous pages that start at a physical
+   address aligned to ALIGN from POOL's backend and returns the
+   index of the first, or BITMAP_ERROR.  Tries each aligned start
+   in each range in turn, which is few enough for 2 MB runs. */
+static size_t
+pool_alloc_aligned (struct pool *pool, size_t page_cnt, size_t align) {
+	for (size_t i = 0; i < pool->range_cnt; i++) {
+		const struct pool_range *r = &pool->ranges[i];
+		uint64_t base = vtop (r->base);
+		uint64_t end = base + (uint64_t) r->page_cnt * PGSIZE;
+
+		for (uint64_t pa = ROUND_UP (base, align);
+				pa + (uint64_t) page_cnt * PGSIZE <= end; pa += align) {
+			size_t page_idx = r->first_idx + (pa - base) / PGSIZE;
+
+			if (palloc_buddy) {
+				if (buddy_claim (pool, page_idx, page_cnt))
+					return page_idx;
+			} else if (bitmap_none (pool->used_map, page_idx, page_cnt)) {
+				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+				return page_idx;
+			}
+		}
+	}
+	return BITMAP_ERROR;
+}
+
+/* Returns the PAGE_CNT pages at PAGE_IDX to POOL's backend. */
+static void
+pool_release (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	if (palloc_buddy)
+		buddy_free (pool, page_idx, page_cnt);
+	else
+		bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+}
+
+/* Returns the most recently freed single page cached in POOL, or
+   a null pointer if the cache is empty. */
+static void *
+hot_get (struct pool *pool) {
+	void *page = NULL;
+
+	if (pool->hot_cnt > 0) {
+		page = pool->hot[--pool->hot_cnt];
+		pool->hot_hits++;
+	} else
+		pool->hot_misses++;
+	return page;
+}
+
+/* Caches free PAGE in POOL, first draining a batch if the cache
+   is full. */
+static void
+hot_put (struct pool *pool, void *page) {
+	if (pool->hot_cnt >= HOT_HIGH)
+		hot_drain (pool, HOT_BATCH);
+	pool->hot[pool->hot_cnt++] = page;
+}
+
+/* Returns up to CNT of the oldest pages cached in POOL to the
+   backend. */
+static void
+hot_drain (struct pool *pool, size_t cnt) {
+	size_t i;
+
+	if (cnt > pool->hot_cnt)
+		cnt = pool->hot_cnt;
+	if (cnt > 0) {
+		for (i = 0; i < cnt; i++)
+			pool_release (pool, page_index (pool, pool->hot[i]), 1);
+		memmove (pool->hot, pool->hot + cnt,
+				(pool->hot_cnt - cnt) * sizeof *pool->hot);
+		pool->hot_cnt -= cnt;
+		pool->hot_drains++;
+	}
+}
+
+/* Returns a page of POOL that the idle thread has zeroed, or a
+   null pointer if there is none. */
+static void *
+zero_get (struct pool *pool) {
+	void *page = NULL;
+
+	if (pool->zero_cnt > 0) {
+		page = pool->zeroed[--pool->zero_cnt];
+		pool->zero_hits++;
+	}
+	return page;
+}
+
+/* Moves all of POOL's pre-zeroed pages back to its single-page
+   cache. */
+static void
+zero_drain (struct pool *pool) {
+	while (pool->zero_cnt > 0)
+		hot_put (pool, pool->zeroed[--pool->zero_cnt]);
+}
+
+/* Zeroes one more free page for POOL's pre-zeroed stack, if it has
+   room and a page can be had without sleeping.  Returns true if a
+   page was zeroed.  The first-fit backend is only drawn from
+   through the single-page cache: scanning the bitmap would hold
+   the pool lock, with interrupts off, for too long.  Takes the
+   pool lock itself, unlike the functions above. */
+static bool
+zero_one (struct pool *pool) {
+	void *page = NULL;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	spin_lock (&pool->lock);
+	if (pool->zero_cnt < ZERO_HIGH) {
+		if (pool->hot_cnt > 0)
+			page = pool->hot[--pool->hot_cnt];
+		else if (palloc_buddy) {
+			size_t page_idx = buddy_alloc (pool, 1);
+			if (page_idx != BITMAP_ERROR)
+				page = index_page (pool, page_idx);
+		}
+	}
+	spin_unlock (&pool->lock);
+	if (page == NULL)
+		return false;
+
+	intr_enable ();
+	memset (page, 0, PGSIZE);
+	intr_disable ();
+
+	spin_lock (&pool->lock);
+	if (pool->zero_cnt < ZERO_HIGH)
+		pool->zeroed[pool->zero_cnt++] = page;
+	else
+		hot_put (pool, page);
+	spin_unlock (&pool->lock);
+	return true;
+}
+
+/* Called by the idle thread, with interrupts off, when nothing
+   else is ready to run.  Zeroes one free page ahead of time for
+   later PAL_ZERO requests, with interrupts on meanwhile so that a
+   wakeup preempts it.  Returns true if it did, false if there is
+   nothing left to do. */
+bool
+palloc_idle_zero (void) {
+	return zero_one (&kernel_pool) || zero_one (&user_pool);
+}
+
+/* Returns the number of pages that can still be allocated from
+   the user pool if PAL_USER is in FLAGS, otherwise from the kernel
+   pool, counting pages held in its caches and those it could
+   borrow.  Cheap enough to call on every allocation. */
+size_t
+palloc_available (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t cnt = pool_unused (pool) + pool->loan_cnt;
+
+	if (may_borrow (pool))
+		cnt += pool_lendable (other_pool (pool));
+	return cnt;
+}
+
+/* Returns the number of POOL's own pages not handed out, counting
+   those in its caches and those it has lent. */
+static size_t
+pool_unused (const struct pool *pool) {
+	size_t used = __atomic_load_n (&pool->used_cnt, __ATOMIC_RELAXED);
+
+	return pool->usable_cnt - used;
+}
+
+/* Returns the number of pages POOL can lend to the other pool
+   without going under its reserve. */
+static size_t
+pool_lendable (const struct pool *pool) {
+	size_t unused = pool_unused (pool);
+	size_t reserve = pool->usable_cnt / LEND_RESERVE_DIV;
+
+	return unused > reserve ? unused - reserve : 0;
+}
+
+/* Returns true if POOL may borrow from the other pool. */
+static bool
+may_borrow (const struct pool *pool) {
+	return pool != &user_pool || user_page_limit == SIZE_MAX;
+}
+
+/* Returns PAGE_CNT contiguous pages for POOL, which has run out,
+   from its spares or else from the other pool, or a null pointer
+   if neither can supply them.  A single page is taken as part of
+   a LOAN_CHUNK, if the other pool can spare one, and the rest
+   become spares.  Takes each pool's lock in turn, never both. */
+static void *
+pool_borrow (struct pool *pool, size_t page_cnt) {
+	struct pool *lender = other_pool (pool);
+	enum intr_level old_level;
+	size_t take, page_idx = BITMAP_ERROR;
+	uint8_t *pages = NULL;
+
+	if (page_cnt == 1 && pool->loan_cnt > 0) {
+		old_level = spin_lock_irqsave (&pool->lock);
+		if (pool->loans != NULL) {
+			pages = pool->loans;
+			pool->loans = *(void **) pages;
+			pool->loan_cnt--;
+		}
+		spin_unlock_irqrestore (&pool->lock, old_level);
+		if (pages != NULL)
+			return pages;
+	}
+	if (!may_borrow (pool) || pool_lendable (lender) < page_cnt)
+		return NULL;
+
+	take = page_cnt == 1 && pool_lendable (lender) >= LOAN_CHUNK
+		? LOAN_CHUNK : page_cnt;
+	old_level = spin_lock_irqsave (&lender->lock);
+	for (;;) {
+		page_idx = pool_alloc (lender, take);
+		if (page_idx == BITMAP_ERROR
+				&& (lender->hot_cnt > 0 || lender->zero_cnt > 0)) {
+			zero_drain (lender);
+			hot_drain (lender, HOT_HIGH);
+			page_idx = pool_alloc (lender, take);
+		}
+		if (page_idx != BITMAP_ERROR || take == page_cnt)
+			break;
+		take = page_cnt;
+	}
+	spin_unlock_irqrestore (&lender->lock, old_level);
+	if (page_idx == BITMAP_ERROR)
+		return NULL;
+	__atomic_add_fetch (&lender->used_cnt, take, __ATOMIC_RELAXED);
+	pages = index_page (lender, page_idx);
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	pool->borrowed += take;
+	for (size_t i = page_cnt; i < take; i++) {
+		void *page = pages + i * PGSIZE;
+
+		*(void **) page = pool->loans;
+		pool->loans = page;
+		pool->loan_cnt++;
+	}
+	spin_unlock_irqrestore (&pool->lock, old_level);
+	return pages;
+}
+
+/* Gives POOL's spare borrowed pages back to the other pool, if
+   POOL has LOAN_CHUNK pages of its own free again. */
+static void
+loan_repay (struct pool *pool) {
+	struct pool *lender = other_pool (pool);
+	enum intr_level old_level;
+	void *page;
+	size_t cnt;
+
+	if (pool_unused (pool) < LOAN_CHUNK)
+		return;
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	page = pool->loans;
+	cnt = pool->loan_cnt;
+	pool->loans = NULL;
+	pool->loan_cnt = 0;
+	pool->repaid += cnt;
+	spin_unlock_irqrestore (&pool->lock, old_level);
+	if (cnt == 0)
+		return;
+
+	old_level = spin_lock_irqsave (&lender->lock);
+	while (page != NULL) {
+		void *next = *(void **) page;
+
+		pool_release (lender, page_index (lender, page), 1);
+		page = next;
+	}
+	spin_unlock_irqrestore (&lender->lock, old_level);
+	__atomic_sub_fetch (&lender->used_cnt, cnt, __ATOMIC_RELAXED);
+}
+
+/* Returns the number of pages free in POOL's backend.  Pages in
+   its caches are not counted. */
+static size_t
+pool_free_pages (const struct pool *pool) {
+	return bitmap_count (pool->used_map, 0, bitmap_size (pool->used_map),
+			false);
+}
+
+/* Returns the length of the longest run of pages free in POOL's
+   backend, the most that palloc_get_multiple() can hand out.  The
+   buddy backend hands out no more than its largest free block, even
+   where free blocks lie side by side. */
+static size_t
+pool_largest_run (const struct pool *pool) {
+	size_t pool_pages = bitmap_size (pool->used_map);
+	size_t start = 0, largest = 0;
+
+	if (palloc_buddy) {
+		uint8_t top = 0;
+
+		for (start = 0; start < pool_pages; start++)
+			if (pool->order_map[start] > top)
+				top = pool->order_map[start];
+		return top > 0 ? (size_t) 1 << (top - 1) : 0;
+	}
+	while (start < pool_pages) {
+		size_t first = bitmap_scan (pool->used_map, start, 1, false);
+		size_t end;
+
+		if (first == BITMAP_ERROR)
+			break;
+		end = bitmap_scan (pool->used_map, first, 1, true);
+		if (end == BITMAP_ERROR)
+			end = pool_pages;
+		if (end - first > largest)
+			largest = end - first;
+		start = end;
+	}
+	return largest;
+}
+
+/* Prints statistics for POOL, called NAME. */
+static void
+print_pool (const char *name, const struct pool *pool) {
+	printf ("Palloc: %s pool: %zu of %zu pages free in %zu ranges, "
+			"%zu cached, largest free run %zu pages\n", name,
+			pool_free_pages (pool), pool->page_cnt, pool->range_cnt,
+			pool->hot_cnt + pool->zero_cnt, pool_largest_run (pool));
+	printf ("Palloc: %s pool: %lld of %lld single pages from the cache, "
+			"%lld drains\n", name, pool->hot_hits,
+			pool->hot_hits + pool->hot_misses, pool->hot_drains);
+	printf ("Palloc: %s pool: %lld pages borrowed, %lld spares repaid, "
+			"%zu spare\n", name, pool->borrowed, pool->repaid,
+			pool->loan_cnt);
+}
+
+/* Memory statistics inspection, via int 0x47.
+ * Input:
+ *   @RAX - What to read: 0 for free pages, 1 for the longest run of
+ *          free pages, 2 for pages in the pool's caches, 3 for bytes
+ *          held by malloc(), 4 for bytes of it in use.
+ *   @RDX - Pool, for RAX = 0, 1, 2: 0 for kernel, 1 for user.
+ * Output:
+ *   @RAX - The requested count, or -1 if the input is invalid. */
+static void
+inspect_mem (struct intr_frame *f) {
+	uint64_t what = f->R.rax, which = f->R.rdx;
+	const struct pool *pool = which == 0 ? &kernel_pool
+		: which == 1 ? &user_pool : NULL;
+
+	switch (what) {
+		case 0: f->R.rax = pool ? pool_free_pages (pool) : (uint64_t) -1; break;
+		case 1: f->R.rax = pool ? pool_largest_run (pool) : (uint64_t) -1; break;
+		case 2: f->R.rax = pool ? pool->hot_cnt + pool->zero_cnt
+				: (uint64_t) -1; break;
+		case 3: f->R.rax = malloc_bytes_held (); break;
+		case 4: f->R.rax = malloc_bytes_in_use (); break;
+		default: f->R.rax = -1; break;
+	}
+}
+
+/* Registers the memory statistics inspection interrupt.  Must be
+   called after intr_init(). */
+void
+palloc_register_inspect (void) {
+	intr_register_int (0x47, 3, INTR_OFF, inspect_mem,
+			"Inspect Memory Statistics");
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	print_pool ("kernel", &kernel_pool);
+	print_pool ("user", &user_pool);
+	printf ("Palloc: %lld PAL_ZERO pages pre-zeroed while idle, "
+			"%lld zeroed inline\n",
+			kernel_pool.zero_hits + user_pool.zero_hits,
+			kernel_pool.zero_inline + user_pool.zero_inline);
+}
+
+/* Fills PAGE_CNT pages starting at PAGES with VALUE, one page at a
+   time with a preemption point in between, so that a large
+   allocation does not hold off a thread that wakes up meanwhile. */
+static void
+clear_pages (void *pages, int value, size_t page_cnt) {
+	uint8_t *page = pages;
+	size_t i;
+
+	for (i = 0; i < page_cnt; i++, page += PGSIZE) {
+		if (i > 0)
+			cond_resched ();
+		memset (page, value, PGSIZE);
+	}
 }
 
 /* Frees the page at PAGE. */
@@ -328,31 +1040,274 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END */
+/* Initializes pool P, whose ranges have been added.  Its
+   used_map, and its order map for the buddy backend, go at
+   *BM_BASE, which is advanced past them. */
 static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
-
-	lock_init(&p->lock);
+init_pool (struct pool *p, void **bm_base) {
+	uint64_t pgcnt = 0;
+	size_t bm_pages;
+
+	if (p->range_cnt > 0) {
+		const struct pool_range *last = &p->ranges[p->range_cnt - 1];
+		pgcnt = last->first_idx + last->page_cnt;
+	}
+	bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+
+	spin_lock_init (&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
-	p->base = (void *) start;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
 
 	*bm_base += bm_pages;
+
+	/* The buddy backend's order map follows the bitmap. */
+	if (palloc_buddy) {
+		size_t map_bytes = ROUND_UP (pgcnt, PGSIZE);
+		int k;
+
+		p->order_map = *bm_base;
+		memset (p->order_map, 0, map_bytes);
+		for (k = 0; k < BUDDY_ORDERS; k++)
+			list_init (&p->free_lists[k]);
+		*bm_base += map_bytes;
+	}
+}
+
+/* Adds the PAGE_CNT pages at BASE, which must lie above any range
+   already in P, to P's ranges.  The range is numbered from one
+   past the end of the last, which leaves a guard index between
+   them. */
+static void
+add_range (struct pool *p, void *base, size_t page_cnt) {
+	struct pool_range *r = &p->ranges[p->range_cnt];
+
+	ASSERT (p->range_cnt < MAX_AREAS);
+	ASSERT (p->range_cnt == 0 || (uint8_t *) base >= r[-1].base);
+
+	r->base = base;
+	r->first_idx = p->range_cnt > 0 ? r[-1].first_idx + r[-1].page_cnt + 1 : 0;
+	r->page_cnt = page_cnt;
+	p->range_cnt++;
+	p->page_cnt += page_cnt;
+}
+
+/* Free buddy block, stored in its own first page. */
+struct buddy_block {
+	struct list_elem elem;          /* Element in pool's free_lists. */
+};
+
+/* Returns the buddy block at page PAGE_IDX of POOL. */
+static struct buddy_block *
+buddy_block (const struct pool *pool, size_t page_idx) {
+	return index_page (pool, page_idx);
+}
+
+/* Files the free block of 2**ORDER pages at PAGE_IDX, merging it
+   with its buddy, and the result with its own buddy, for as long
+   as the buddy is free and whole.  Interrupts must be off. */
+static void
+buddy_insert (struct pool *pool, size_t page_idx, unsigned order) {
+	size_t pool_pages = bitmap_size (pool->used_map);
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (; order + 1 < BUDDY_ORDERS; order++) {
+		size_t buddy = page_idx ^ ((size_t) 1 << order);
+		if (buddy >= pool_pages || pool->order_map[buddy] != order + 1)
+			break;
+		list_remove (&buddy_block (pool, buddy)->elem);
+		pool->order_map[buddy] = 0;
+		if (buddy < page_idx)
+			page_idx = buddy;
+	}
+	pool->order_map[page_idx] = order + 1;
+	list_push_front (&pool->free_lists[order], &buddy_block (pool, page_idx)->elem);
+}
+
+/* Returns the free pages PAGE_IDX...PAGE_IDX + PAGE_CNT - 1 to
+   POOL's free lists as the largest aligned blocks that tile them.
+   Interrupts must be off. */
+static void
+buddy_insert_range (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	while (page_cnt > 0) {
+		unsigned order = 0;
+		while (order + 1 < BUDDY_ORDERS
+				&& (page_idx & ((size_t) 1 << order)) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+		buddy_insert (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Fills POOL's free lists from the free pages in its bitmap, as
+   left by populate_pools(). */
+static void
+buddy_build (struct pool *pool) {
+	size_t pool_pages = bitmap_size (pool->used_map);
+	enum intr_level old_level = spin_lock_irqsave (&pool->lock);
+	size_t start = 0;
+
+	while (start < pool_pages) {
+		size_t first = bitmap_scan (pool->used_map, start, 1, false);
+		size_t end;
+
+		if (first == BITMAP_ERROR)
+			break;
+		end = bitmap_scan (pool->used_map, first, 1, true);
+		if (end == BITMAP_ERROR)
+			end = pool_pages;
+		buddy_insert_range (pool, first, end - first);
+		start = end;
+	}
+	spin_unlock_irqrestore (&pool->lock, old_level);
+}
+
+/* Takes PAGE_CNT contiguous pages from POOL: splits the smallest
+   free block of at least PAGE_CNT pages, rounded up to a power of
+   two, and gives back the pages past PAGE_CNT.  Returns the index
+   of the first page, or BITMAP_ERROR if no block is big enough. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) {
+	unsigned order = 0, k;
+	size_t page_idx = BITMAP_ERROR;
+
+	if (page_cnt == 0)
+		return BITMAP_ERROR;
+	while (order < BUDDY_ORDERS && ((size_t) 1 << order) < page_cnt)
+		order++;
+	if (order >= BUDDY_ORDERS)
+		return BITMAP_ERROR;
+
+	for (k = order; k < BUDDY_ORDERS; k++)
+		if (!list_empty (&pool->free_lists[k])) {
+			struct list_elem *e = list_pop_front (&pool->free_lists[k]);
+			page_idx = page_index (pool,
+					list_entry (e, struct buddy_block, elem));
+			pool->order_map[page_idx] = 0;
+			break;
+		}
+	if (page_idx != BITMAP_ERROR) {
+		if (k > 0 && ((size_t) 1 << k) > page_cnt)
+			buddy_insert_range (pool, page_idx + page_cnt,
+					((size_t) 1 << k) - page_cnt);
+		bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+	}
+	return page_idx;
+}
+
+/* Takes the specific pages PAGE_IDX...PAGE_IDX + PAGE_CNT - 1
+   from POOL's free lists, if they are all free, and returns true;
+   otherwise returns false.  The free blocks that overlap the range
+   are removed first and only then are the parts of the first and
+   last that stick out filed again, so that those cannot coalesce
+   with blocks still inside the range. */
+static bool
+buddy_claim (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	size_t end = page_idx + page_cnt;
+	size_t first_head = page_idx, last_end = end;
+	size_t p;
+
+	if (!bitmap_none (pool->used_map, page_idx, page_cnt))
+		return false;
+
+	for (p = page_idx; p < end; ) {
+		/* Find the free block that contains page P. */
+		size_t head = p;
+		unsigned order;
+
+		for (order = 0; order < BUDDY_ORDERS; order++) {
+			head = p & ~(((size_t) 1 << order) - 1);
+			if (pool->order_map[head] == order + 1)
+				break;
+		}
+		ASSERT (order < BUDDY_ORDERS);
+
+		list_remove (&buddy_block (pool, head)->elem);
+		pool->order_map[head] = 0;
+		if (p == page_idx)
+			first_head = head;
+		p = head + ((size_t) 1 << order);
+		last_end = p;
+	}
+
+	if (first_head < page_idx)
+		buddy_insert_range (pool, first_head, page_idx - first_head);
+	if (last_end > end)
+		buddy_insert_range (pool, end, last_end - end);
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+	return true;
+}
+
+/* Returns the PAGE_CNT pages at PAGE_IDX to POOL. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	buddy_insert_range (pool, page_idx, page_cnt);
+}
+
+/* Returns the range of POOL that contains PAGE, or a null
+   pointer if there is none. */
+static const struct pool_range *
+range_of_page (const struct pool *pool, const void *page) {
+	size_t lo = 0, hi = pool->range_cnt;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct pool_range *r = &pool->ranges[mid];
+
+		if ((const uint8_t *) page < r->base)
+			hi = mid;
+		else if ((const uint8_t *) page >= r->base + r->page_cnt * PGSIZE)
+			lo = mid + 1;
+		else
+			return r;
+	}
+	return NULL;
+}
+
+/* Returns the index in POOL's used_map of PAGE, which must be in
+   POOL. */
+static size_t
+page_index (const struct pool *pool, const void *page) {
+	const struct pool_range *r = range_of_page (pool, page);
+
+	ASSERT (r != NULL);
+	return r->first_idx + (pg_no (page) - pg_no (r->base));
+}
+
+/* Returns the page at index PAGE_IDX of POOL's used_map, which
+   must not be a guard index. */
+static void *
+index_page (const struct pool *pool, size_t page_idx) {
+	size_t lo = 0, hi = pool->range_cnt;
+
+	/* Find the last range that starts at or before PAGE_IDX. */
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (pool->ranges[mid].first_idx <= page_idx)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	ASSERT (lo < pool->range_cnt);
+	ASSERT (page_idx - pool->ranges[lo].first_idx < pool->ranges[lo].page_cnt);
+	return pool->ranges[lo].base + PGSIZE * (page_idx - pool->ranges[lo].first_idx);
+}
+
+/* Returns the pool that POOL borrows from. */
+static struct pool *
+other_pool (const struct pool *pool) {
+	return pool == &kernel_pool ? &user_pool : &kernel_pool;
 }
 
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
 page_from_pool (const struct pool *pool, void *page) {
-	size_t page_no = pg_no (page);
-	size_t start_page = pg_no (pool->base);
-	size_t end_page = start_page + bitmap_size (pool->used_map);
-	return page_no >= start_page && page_no < end_page;
+	return range_of_page (pool, page) != NULL;
 }
@@ -0,0 +1,115 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Pages in the sample table. */
+#define PROFILE_PAGES 8
+
+/* Addresses printed at power off, most-sampled first. */
+#define PROFILE_TOP 64
+
+/* Sample count for one address. */
+struct sample {
+	uint64_t rip;               /* Interrupted address, or 0 if empty. */
+	uint64_t cnt;               /* Samples at RIP. */
+};
+
+bool profile_enabled;
+
+/* Open-addressing table of samples, a power of 2 entries long,
+   filled in only by the timer interrupt, so it needs no lock. */
+static struct sample *table;
+static size_t table_cnt;
+
+/* Ticks between samples, and ticks left until the next one. */
+static int sample_interval;
+static int ticks_left;
+
+/* Samples taken, and samples lost to a full table. */
+static uint64_t sample_cnt;
+static uint64_t lost_cnt;
+
+static int sample_more (const void *, const void *);
+
+/* Allocates the sample table and starts taking one sample every
+   INTERVAL timer ticks.  Must follow palloc_init(). */
+void
+profile_init (int interval) {
+	ASSERT (interval > 0);
+
+	table = palloc_get_multiple (PAL_ZERO, PROFILE_PAGES);
+	if (table == NULL)
+		PANIC ("no memory for profile samples");
+	table_cnt = PROFILE_PAGES * PGSIZE / sizeof *table;
+	ASSERT ((table_cnt & (table_cnt - 1)) == 0);
+
+	sample_interval = ticks_left = interval;
+	profile_enabled = true;
+}
+
+/* Counts a sample at the address F interrupted, if this is the
+   tick for one.  Called from the timer interrupt handler. */
+void
+profile_sample (const struct intr_frame *f) {
+	size_t mask = table_cnt - 1;
+	size_t idx, probes;
+	uint64_t rip = f->rip;
+
+	ASSERT (intr_context ());
+
+	if (--ticks_left > 0)
+		return;
+	ticks_left = sample_interval;
+	sample_cnt++;
+
+	/* Nearby addresses differ only in their low bits, so mix them
+	   all into the index. */
+	idx = (rip * 0x9e3779b97f4a7c15) >> 32;
+	for (probes = 0; probes < table_cnt; probes++, idx++) {
+		struct sample *s = &table[idx & mask];
+
+		if (s->rip == rip || s->rip == 0) {
+			s->rip = rip;
+			s->cnt++;
+			return;
+		}
+	}
+	lost_cnt++;
+}
+
+/* Stops sampling and prints the PROFILE_TOP most-sampled
+   addresses, if profiling. */
+void
+profile_dump (void) {
+	size_t used, i;
+
+	if (table == NULL)
+		return;
+	profile_enabled = false;
+
+	/* Pack the used entries at the front, then sort them. */
+	for (used = i = 0; i < table_cnt; i++)
+		if (table[i].rip != 0)
+			table[used++] = table[i];
+	qsort (table, used, sizeof *table, sample_more);
+
+	printf ("Profile: %"PRIu64" samples at %zu addresses, %"PRIu64" lost.\n",
+			sample_cnt, used, lost_cnt);
+	for (i = 0; i < used && i < PROFILE_TOP; i++)
+		printf ("profile: %"PRIx64" %"PRIu64"\n", table[i].rip, table[i].cnt);
+}
+
+/* Orders samples by descending count, for qsort(). */
+static int
+sample_more (const void *a_, const void *b_) {
+	const struct sample *a = a_;
+	const struct sample *b = b_;
+
+	return a->cnt > b->cnt ? -1 : a->cnt < b->cnt;
+}
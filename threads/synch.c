@@ -27,10 +27,61 @@
    */
 
 #include "threads/synch.h"
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include "threads/counter.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+
+/* Priority donation.
+
+   A thread waiting for a lock sits in the lock's DONORS heap,
+   keyed by its effective priority, and each lock sits in its
+   holder's HELD_LOCKS heap, keyed by its top donor's priority.
+   A thread's effective priority is the larger of its base
+   priority and the top of HELD_LOCKS, so acquiring, releasing
+   and each step of a nested donation are a few heap operations
+   rather than walks over every waiter of every held lock.
+   Nested donation follows at most DONATION_DEPTH_MAX locks.
+   Donation is off under the MLFQS. */
+#define DONATION_DEPTH_MAX 8
+
+static bool waiter_less (const struct list_elem *, const struct list_elem *,
+		void *aux);
+static bool donor_less (const struct heap_elem *, const struct heap_elem *,
+		void *aux);
+static bool held_less (const struct heap_elem *, const struct heap_elem *,
+		void *aux);
+static int lock_top_donor (const struct lock *);
+static void lock_rekey (struct lock *);
+static void refresh_priority (struct thread *);
+static void donate (struct lock *);
+static void lock_take (struct lock *);
+static struct lock_class *class_for (const char *name);
+static void stat_max (uint64_t *, uint64_t);
+static void lock_stat_acquired (struct lock *, bool contended, uint64_t wait);
+static void lock_stat_released (struct lock *);
+
+/* Semaphore fast path.
+
+   SEMA->value holds the count in its low bits and SEMA_WAITERS
+   while any thread sleeps on SEMA->waiters.  Downs that find a
+   positive count and ups that find no sleepers are a single
+   compare-and-swap; only the rest disable interrupts and touch
+   the waiter list.  Slow paths update VALUE with interrupts off,
+   which on our single CPU makes them atomic with respect to the
+   fast paths. */
+#define SEMA_WAITERS 0x80000000u
+#define SEMA_COUNT(V) ((V) & ~SEMA_WAITERS)
+
+static struct cpu_counter fast_downs, slow_downs;
+static struct cpu_counter fast_ups, slow_ups;
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -44,9 +95,10 @@
 void
 sema_init (struct semaphore *sema, unsigned value) {
 	ASSERT (sema != NULL);
+	ASSERT (value < SEMA_WAITERS);
 
 	sema->value = value;
-	list_init (&sema->waiters);
+	clist_init (&sema->waiters, waiter_less, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -64,9 +116,17 @@ sema_down (struct semaphore *sema) {
 	ASSERT (sema != NULL);
 	ASSERT (!intr_context ());
 
+	if (sema_try_down (sema)) {
+		cpu_counter_inc (&fast_downs);
+		return;
+	}
+
 	old_level = intr_disable ();
-	while (sema->value == 0) {
-		list_push_back (&sema->waiters, &thread_current ()->elem);
+	cpu_counter_inc (&slow_downs);
+	while (SEMA_COUNT (sema->value) == 0) {
+		clist_push_back (&sema->waiters, &thread_current ()->elem);
+		thread_current ()->wait_on_sema = sema;
+		sema->value |= SEMA_WAITERS;
 		thread_block ();
 	}
 	sema->value--;
@@ -80,22 +140,16 @@ sema_down (struct semaphore *sema) {
    This function may be called from an interrupt handler. */
 bool
 sema_try_down (struct semaphore *sema) {
-	enum intr_level old_level;
-	bool success;
+	unsigned value;
 
 	ASSERT (sema != NULL);
 
-	old_level = intr_disable ();
-	if (sema->value > 0)
-	{
-		sema->value--;
-		success = true;
-	}
-	else
-		success = false;
-	intr_set_level (old_level);
-
-	return success;
+	value = __atomic_load_n (&sema->value, __ATOMIC_RELAXED);
+	while (SEMA_COUNT (value) > 0)
+		if (__atomic_compare_exchange_n (&sema->value, &value, value - 1,
+					false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return true;
+	return false;
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
@@ -108,12 +162,42 @@ sema_up (struct semaphore *sema) {
 
 	ASSERT (sema != NULL);
 
+	/* Nobody to wake: just count. */
+	unsigned value = __atomic_load_n (&sema->value, __ATOMIC_RELAXED);
+	while (!(value & SEMA_WAITERS))
+		if (__atomic_compare_exchange_n (&sema->value, &value, value + 1,
+					false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			cpu_counter_inc (&fast_ups);
+			return;
+		}
+
 	old_level = intr_disable ();
-	if (!list_empty (&sema->waiters))
-		thread_unblock (list_entry (list_pop_front (&sema->waiters),
-					struct thread, elem));
+	cpu_counter_inc (&slow_ups);
+	if (!clist_empty (&sema->waiters)) {
+		struct list_elem *e = clist_max (&sema->waiters);
+		struct thread *t = list_entry (e, struct thread, elem);
+
+		clist_remove (&sema->waiters, e);
+		t->wait_on_sema = NULL;
+		thread_unblock (t);
+	}
+	if (clist_empty (&sema->waiters))
+		sema->value &= ~SEMA_WAITERS;
 	sema->value++;
 	intr_set_level (old_level);
+	thread_preempt_if_outranked ();
+}
+
+/* Prints semaphore fast-path statistics. */
+void
+synch_print_stats (void) {
+	long long fd = cpu_counter_read (&fast_downs);
+	long long sd = cpu_counter_read (&slow_downs);
+	long long fu = cpu_counter_read (&fast_ups);
+	long long su = cpu_counter_read (&slow_ups);
+
+	printf ("Synch: %lld of %lld downs and %lld of %lld ups uncontended\n",
+			fd, fd + sd, fu, fu + su);
 }
 
 static void sema_test_helper (void *sema_);
@@ -165,13 +249,22 @@ sema_test_helper (void *sema_) {
    another one "up" it, but with a lock the same thread must both
    acquire and release it.  When these restrictions prove
    onerous, it's a good sign that a semaphore should be used,
-   instead of a lock. */
+   instead of a lock.
+
+   NAME identifies the kind of lock in lock statistics, and the
+   lock_init() macro supplies it. */
 void
-lock_init (struct lock *lock) {
+lock_init_named (struct lock *lock, const char *name) {
 	ASSERT (lock != NULL);
+	ASSERT (name != NULL);
 
 	lock->holder = NULL;
 	sema_init (&lock->semaphore, 1);
+	heap_init (&lock->donors);
+	lock->attached = false;
+	lock->donated = PRI_MIN - 1;
+	lock->class = lock_stat ? class_for (name) : NULL;
+	lock->acquired = 0;
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -188,8 +281,43 @@ lock_acquire (struct lock *lock) {
 	ASSERT (!intr_context ());
 	ASSERT (!lock_held_by_current_thread (lock));
 
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+	uint64_t wait_start;
+
+	/* Uncontended: take it without disabling interrupts.  A thread
+	   that started waiting before HOLDER was set could not donate
+	   to us, so catch its donation up now. */
+	if (sema_try_down (&lock->semaphore)) {
+		cpu_counter_inc (&fast_downs);
+		lock->holder = curr;
+		barrier ();
+		if (!thread_mlfqs && !heap_empty (&lock->donors)) {
+			old_level = intr_disable ();
+			lock_take (lock);
+			intr_set_level (old_level);
+		}
+		if (lock->class != NULL)
+			lock_stat_acquired (lock, false, 0);
+		return;
+	}
+
+	wait_start = lock->class != NULL ? rdtsc () : 0;
+	old_level = intr_disable ();
+	if (!thread_mlfqs && SEMA_COUNT (lock->semaphore.value) == 0) {
+		curr->wait_on_lock = lock;
+		heap_insert (&lock->donors, &curr->donor_elem, donor_less, NULL);
+		donate (lock);
+	}
 	sema_down (&lock->semaphore);
-	lock->holder = thread_current ();
+	if (curr->wait_on_lock != NULL) {
+		heap_remove (&lock->donors, &curr->donor_elem, donor_less, NULL);
+		curr->wait_on_lock = NULL;
+	}
+	lock_take (lock);
+	intr_set_level (old_level);
+	if (lock->class != NULL)
+		lock_stat_acquired (lock, true, rdtsc () - wait_start);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -200,14 +328,24 @@ lock_acquire (struct lock *lock) {
    interrupt handler. */
 bool
 lock_try_acquire (struct lock *lock) {
+	enum intr_level old_level;
 	bool success;
 
 	ASSERT (lock != NULL);
 	ASSERT (!lock_held_by_current_thread (lock));
 
 	success = sema_try_down (&lock->semaphore);
-	if (success)
+	if (success) {
 		lock->holder = thread_current ();
+		barrier ();
+		if (!thread_mlfqs && !heap_empty (&lock->donors)) {
+			old_level = intr_disable ();
+			lock_take (lock);
+			intr_set_level (old_level);
+		}
+		if (lock->class != NULL)
+			lock_stat_acquired (lock, false, 0);
+	}
 	return success;
 }
 
@@ -222,7 +360,23 @@ lock_release (struct lock *lock) {
 	ASSERT (lock != NULL);
 	ASSERT (lock_held_by_current_thread (lock));
 
+	struct thread *curr = thread_current ();
+
+	if (lock->class != NULL)
+		lock_stat_released (lock);
+
+	/* Once HOLDER is clear, no waiter will attach LOCK to our
+	   held_locks, so only undo an attachment made before. */
 	lock->holder = NULL;
+	barrier ();
+	if (lock->attached) {
+		enum intr_level old_level = intr_disable ();
+		heap_remove (&curr->held_locks, &lock->held_elem, held_less, NULL);
+		lock->attached = false;
+		lock->donated = PRI_MIN - 1;
+		refresh_priority (curr);
+		intr_set_level (old_level);
+	}
 	sema_up (&lock->semaphore);
 }
 
@@ -235,7 +389,384 @@ lock_held_by_current_thread (const struct lock *lock) {
 
 	return lock->holder == thread_current ();
 }
+
+/* Lock statistics, for "-lockstat".
+
+   Each name passed to lock_init_named() gets one lock_class, in
+   an open-addressing table filled in with interrupts off, so any
+   lock initialized under that name adds to it.  The counts are
+   updated with atomic adds, since a preempted thread can be in
+   the middle of updating them. */
+#define LOCK_CLASS_CNT 128      /* Table size, a power of 2. */
+#define LOCK_REPORT_CNT 16      /* Classes printed at shutdown. */
+
+/* Statistics shared by the locks of one name. */
+struct lock_class {
+	const char *name;           /* Name, or NULL if slot is free. */
+	uint64_t acquires;          /* Times acquired. */
+	uint64_t contended;         /* Times a thread had to wait. */
+	uint64_t wait_cycles;       /* TSC cycles waited in all... */
+	uint64_t wait_max;          /* ...and at most, once. */
+	uint64_t hold_cycles;       /* TSC cycles held in all... */
+	uint64_t hold_max;          /* ...and at most, once. */
+};
+
+bool lock_stat;
+static struct lock_class lock_classes[LOCK_CLASS_CNT];
+static long long lock_class_overflows; /* Names left without a class. */
+static struct spinlock lock_classes_lock = SPINLOCK_INITIALIZER;
+
+/* Returns the lock class for NAME, creating it if need be, or a
+   null pointer if the table is full. */
+static struct lock_class *
+class_for (const char *name) {
+	struct lock_class *c = NULL;
+	enum intr_level old_level;
+	size_t hash = 5381, i;
+	const char *p;
+
+	for (p = name; *p != '\0'; p++)
+		hash = hash * 33 + (unsigned char) *p;
+
+	old_level = spin_lock_irqsave (&lock_classes_lock);
+	for (i = 0; i < LOCK_CLASS_CNT; i++) {
+		struct lock_class *slot = &lock_classes[(hash + i) % LOCK_CLASS_CNT];
+
+		if (slot->name == NULL)
+			slot->name = name;
+		if (slot->name == name || !strcmp (slot->name, name)) {
+			c = slot;
+			break;
+		}
+	}
+	if (c == NULL)
+		lock_class_overflows++;
+	spin_unlock_irqrestore (&lock_classes_lock, old_level);
+	return c;
+}
+
+/* Counts an acquisition of LOCK, which has a class, after WAIT
+   TSC cycles of waiting if CONTENDED, and starts timing the
+   hold. */
+static void
+lock_stat_acquired (struct lock *lock, bool contended, uint64_t wait) {
+	struct lock_class *c = lock->class;
+
+	__atomic_fetch_add (&c->acquires, 1, __ATOMIC_RELAXED);
+	if (contended) {
+		__atomic_fetch_add (&c->contended, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add (&c->wait_cycles, wait, __ATOMIC_RELAXED);
+		stat_max (&c->wait_max, wait);
+	}
+	lock->acquired = rdtsc ();
+}
+
+/* Counts the hold of LOCK, which has a class, as it is
+   released. */
+static void
+lock_stat_released (struct lock *lock) {
+	struct lock_class *c = lock->class;
+	uint64_t hold = rdtsc () - lock->acquired;
+
+	__atomic_fetch_add (&c->hold_cycles, hold, __ATOMIC_RELAXED);
+	stat_max (&c->hold_max, hold);
+}
+
+/* Raises *MAX to VALUE if VALUE is greater. */
+static void
+stat_max (uint64_t *max, uint64_t value) {
+	uint64_t old = __atomic_load_n (max, __ATOMIC_RELAXED);
+
+	while (value > old && !__atomic_compare_exchange_n (max, &old, value,
+				true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		continue;
+}
+
+/* Orders lock classes by descending cycles waited, then by
+   descending contended acquisitions. */
+static int
+class_more (const void *a_, const void *b_, void *aux UNUSED) {
+	const struct lock_class *a = *(const struct lock_class **) a_;
+	const struct lock_class *b = *(const struct lock_class **) b_;
+
+	if (a->wait_cycles != b->wait_cycles)
+		return a->wait_cycles > b->wait_cycles ? -1 : 1;
+	return a->contended > b->contended ? -1 : a->contended < b->contended;
+}
+
+/* Prints the LOCK_REPORT_CNT most contended kinds of lock, if
+   keeping lock statistics. */
+void
+lock_print_stats (void) {
+	static struct lock_class *order[LOCK_CLASS_CNT];
+	size_t cnt = 0, i;
+
+	if (!lock_stat)
+		return;
+	for (i = 0; i < LOCK_CLASS_CNT; i++)
+		if (lock_classes[i].name != NULL && lock_classes[i].acquires != 0)
+			order[cnt++] = &lock_classes[i];
+	sort (order, cnt, sizeof *order, class_more, NULL);
+
+	printf ("Locks: %zu kinds acquired, %lld left uncounted; most contended:\n",
+			cnt, lock_class_overflows);
+	for (i = 0; i < cnt && i < LOCK_REPORT_CNT; i++) {
+		const struct lock_class *c = order[i];
+		const char *name = c->name;
+
+		/* Drop the build directory's "../../". */
+		while (name[0] == '.' && name[1] == '.' && name[2] == '/')
+			name += 3;
+		printf ("  %s: %"PRIu64" acquires, %"PRIu64" contended, "
+				"%"PRIu64" wait cycles (max %"PRIu64"), "
+				"%"PRIu64" hold cycles (max %"PRIu64")\n",
+				name, c->acquires, c->contended, c->wait_cycles, c->wait_max,
+				c->hold_cycles, c->hold_max);
+	}
+}
+
+/* Reads the uint64_t at byte OFFSET in struct lock_class, summed
+   over the classes. */
+static long long
+read_lock_stat (void *offset) {
+	long long sum = 0;
+	size_t i;
+
+	for (i = 0; i < LOCK_CLASS_CNT; i++)
+		if (lock_classes[i].name != NULL)
+			sum += *(uint64_t *) ((char *) &lock_classes[i] + (size_t) offset);
+	return sum;
+}
+
+/* Registers the totals over all kinds of lock as counters.  They
+   stay 0 unless "-lockstat" is given. */
+void
+lock_register_counters (void) {
+	counter_register ("lock.acquires", read_lock_stat,
+			(void *) offsetof (struct lock_class, acquires));
+	counter_register ("lock.contended", read_lock_stat,
+			(void *) offsetof (struct lock_class, contended));
+	counter_register ("lock.wait_cycles", read_lock_stat,
+			(void *) offsetof (struct lock_class, wait_cycles));
+	counter_register ("lock.hold_cycles", read_lock_stat,
+			(void *) offsetof (struct lock_class, hold_cycles));
+}
+
+/* Makes the running thread the holder of LOCK, which it has just
+   downed, and lets LOCK's remaining waiters donate to it.
+   Interrupts must be off. */
+static void
+lock_take (struct lock *lock) {
+	struct thread *curr = thread_current ();
+
+	lock->holder = curr;
+	if (!thread_mlfqs) {
+		lock_rekey (lock);
+		refresh_priority (curr);
+	}
+}
+
+/* Files LOCK in its holder's held_locks under its current top
+   donor, attaching it first if no waiter has done so yet.  A
+   donation that rises, as it always does in donate(), is re-keyed
+   in place.  Interrupts must be off. */
+static void
+lock_rekey (struct lock *lock) {
+	struct thread *holder = lock->holder;
+	int donated = lock_top_donor (lock);
+
+	ASSERT (holder != NULL);
+
+	if (lock->attached && donated >= lock->donated) {
+		lock->donated = donated;
+		heap_raise (&holder->held_locks, &lock->held_elem, held_less, NULL);
+		return;
+	}
+	if (lock->attached)
+		heap_remove (&holder->held_locks, &lock->held_elem, held_less, NULL);
+	lock->donated = donated;
+	heap_insert (&holder->held_locks, &lock->held_elem, held_less, NULL);
+	lock->attached = true;
+}
+
+/* Returns the highest priority donated to T through the locks it
+   holds, or PRI_MIN - 1 if none.  Interrupts must be off. */
+int
+lock_max_donation (const struct thread *t) {
+	if (heap_empty (&t->held_locks))
+		return PRI_MIN - 1;
+	return heap_entry (heap_max (&t->held_locks), struct lock,
+			held_elem)->donated;
+}
+
+/* Returns the priority of LOCK's highest-priority waiter, or
+   PRI_MIN - 1 if nobody waits. */
+static int
+lock_top_donor (const struct lock *lock) {
+	if (heap_empty (&lock->donors))
+		return PRI_MIN - 1;
+	return heap_entry (heap_max (&lock->donors), struct thread,
+			donor_elem)->priority;
+}
+
+/* Recomputes T's effective priority from its base priority and
+   the donations it holds. */
+static void
+refresh_priority (struct thread *t) {
+	int donated = lock_max_donation (t);
+
+	thread_change_priority (t,
+			donated > t->base_priority ? donated : t->base_priority);
+}
+
+/* Passes a raised top donor of LOCK on to LOCK's holder, and from
+   there along the chain of locks the holders wait for, stopping
+   where nothing changes or after DONATION_DEPTH_MAX locks. */
+static void
+donate (struct lock *lock) {
+	int depth;
+
+	for (depth = 0; depth < DONATION_DEPTH_MAX && lock != NULL; depth++) {
+		struct thread *holder = lock->holder;
+		int donated = lock_top_donor (lock);
+		struct lock *next;
+		int old_priority;
+
+		if (holder == NULL || (lock->attached && donated == lock->donated))
+			break;
+
+		/* Re-key LOCK in its holder's heap.  A lock taken on the
+		   fast path is attached here, by its first waiter. */
+		lock_rekey (lock);
+
+		/* Re-key the holder in the donors of the lock it waits for,
+		   and among the waiters of any semaphore it sleeps on.  A
+		   donation only raises the holder's priority. */
+		old_priority = holder->priority;
+		next = holder->wait_on_lock;
+		refresh_priority (holder);
+		ASSERT (holder->priority >= old_priority);
+		if (holder->wait_on_sema != NULL)
+			clist_raise (&holder->wait_on_sema->waiters, &holder->elem);
+		if (next != NULL)
+			heap_raise (&next->donors, &holder->donor_elem, donor_less, NULL);
+
+		if (holder->priority == old_priority)
+			break;
+		lock = next;
+	}
+}
+
+/* Orders semaphore waiters, which are threads, by priority. */
+static bool
+waiter_less (const struct list_elem *a, const struct list_elem *b,
+		void *aux UNUSED) {
+	return list_entry (a, struct thread, elem)->priority
+		< list_entry (b, struct thread, elem)->priority;
+}
+
+/* Orders a lock's donors, which are threads, by priority. */
+static bool
+donor_less (const struct heap_elem *a, const struct heap_elem *b,
+		void *aux UNUSED) {
+	return heap_entry (a, struct thread, donor_elem)->priority
+		< heap_entry (b, struct thread, donor_elem)->priority;
+}
+
+/* Orders a thread's held locks by the priority they donate. */
+static bool
+held_less (const struct heap_elem *a, const struct heap_elem *b,
+		void *aux UNUSED) {
+	return heap_entry (a, struct lock, held_elem)->donated
+		< heap_entry (b, struct lock, held_elem)->donated;
+}
 
+/* Initializes RWLOCK, which nobody holds.  NAME is for its gate
+   lock's statistics, and the rwlock_init() macro supplies it. */
+void
+rwlock_init_named (struct rwlock *rw, const char *name) {
+	ASSERT (rw != NULL);
+
+	lock_init_named (&rw->gate, name);
+	rw->readers = 0;
+	rw->writer_waiting = false;
+	sema_init (&rw->drained, 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it.  Any number of readers may hold RW at once.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!rwlock_held_for_write (rw));
+
+	lock_acquire (&rw->gate);
+	old_level = intr_disable ();
+	rw->readers++;
+	intr_set_level (old_level);
+	lock_release (&rw->gate);
+}
+
+/* Releases RW, which the current thread holds for reading.  The
+   last reader out lets a waiting writer in. */
+void
+rwlock_release_read (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+
+	old_level = intr_disable ();
+	ASSERT (rw->readers > 0);
+	if (--rw->readers == 0 && rw->writer_waiting) {
+		rw->writer_waiting = false;
+		sema_up (&rw->drained);
+	}
+	intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.  New readers are held off while we wait for the current
+   ones to leave.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+
+	lock_acquire (&rw->gate);
+	old_level = intr_disable ();
+	while (rw->readers > 0) {
+		rw->writer_waiting = true;
+		sema_down (&rw->drained);
+	}
+	intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_release_write (struct rwlock *rw) {
+	ASSERT (rwlock_held_for_write (rw));
+
+	lock_release (&rw->gate);
+}
+
+/* Returns true if the current thread holds RW for writing.
+   Readers hold GATE only inside rwlock_acquire_read(). */
+bool
+rwlock_held_for_write (const struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	return lock_held_by_current_thread (&rw->gate);
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem {
 	struct list_elem elem;              /* List element. */
@@ -321,3 +852,221 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 	while (!list_empty (&cond->waiters))
 		cond_signal (cond, lock);
 }
+
+/* One thread in a wait queue, on its own stack. */
+struct wait_queue_entry {
+	struct list_elem elem;      /* List element. */
+	struct thread *thread;      /* The waiting thread. */
+	bool queued;                /* Still in the queue's list? */
+	bool timed;                 /* Also on the timer's sleep queue? */
+	bool woken;                 /* Woken by the event, not a timeout? */
+};
+
+static bool entry_less (const struct list_elem *, const struct list_elem *,
+		void *aux);
+
+/* Initializes wait queue WQ. */
+void
+wait_queue_init (struct wait_queue *wq) {
+	ASSERT (wq != NULL);
+
+	list_init (&wq->waiters);
+}
+
+/* Puts the current thread to sleep on WQ until a wakeup or, if
+   TIMEOUT is positive, until TIMEOUT timer ticks pass.  Returns
+   true if woken by wait_queue_wake_one() or wait_queue_wake_all(),
+   false on timeout.
+
+   Must be called with interrupts off, right after checking that
+   the event has not happened yet.  With a TIMEOUT, the caller must
+   have made room in the sleep queue with timer_reserve(), which
+   is also what turns interrupts off. */
+bool
+wait_queue_wait (struct wait_queue *wq, int64_t timeout) {
+	struct wait_queue_entry w;
+
+	ASSERT (wq != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	w.thread = thread_current ();
+	w.queued = true;
+	w.timed = timeout > 0;
+	w.woken = false;
+	list_push_back (&wq->waiters, &w.elem);
+	if (w.timed)
+		timer_block (timeout);
+	else
+		thread_block ();
+
+	if (w.queued)
+		list_remove (&w.elem);
+	return w.woken;
+}
+
+/* Wakes the highest-priority thread waiting on WQ, skipping any
+   whose timeout has already fired.  Returns true if a thread was
+   woken.  May be called from an interrupt handler.  A caller that
+   has interrupts off is in the middle of something, so its
+   preemption, if the woken thread outranks it, is deferred to the
+   next safe point. */
+bool
+wait_queue_wake_one (struct wait_queue *wq) {
+	enum intr_level old_level;
+	bool woke = false;
+
+	ASSERT (wq != NULL);
+
+	old_level = intr_disable ();
+	while (!woke && !list_empty (&wq->waiters)) {
+		struct list_elem *e = list_max (&wq->waiters, entry_less, NULL);
+		struct wait_queue_entry *w = list_entry (e, struct wait_queue_entry,
+				elem);
+
+		list_remove (e);
+		w->queued = false;
+		if (!w->timed || timer_cancel (w->thread)) {
+			w->woken = woke = true;
+			thread_unblock (w->thread);
+		}
+	}
+	intr_set_level (old_level);
+
+	if (woke && (old_level == INTR_ON || intr_context ()))
+		thread_preempt_if_outranked ();
+	else if (woke)
+		thread_defer_preempt ();
+	return woke;
+}
+
+/* Wakes every thread waiting on WQ and returns how many were
+   woken.  May be called from an interrupt handler. */
+int
+wait_queue_wake_all (struct wait_queue *wq) {
+	enum intr_level old_level;
+	int woken = 0;
+
+	ASSERT (wq != NULL);
+
+	old_level = intr_disable ();
+	while (!list_empty (&wq->waiters)) {
+		struct wait_queue_entry *w = list_entry (list_pop_front (&wq->waiters),
+				struct wait_queue_entry, elem);
+
+		w->queued = false;
+		if (!w->timed || timer_cancel (w->thread)) {
+			w->woken = true;
+			thread_unblock (w->thread);
+			woken++;
+		}
+	}
+	intr_set_level (old_level);
+
+	if (woken > 0 && (old_level == INTR_ON || intr_context ()))
+		thread_preempt_if_outranked ();
+	else if (woken > 0)
+		thread_defer_preempt ();
+	return woken;
+}
+
+/* Orders wait queue entries by their thread's priority. */
+static bool
+entry_less (const struct list_elem *a, const struct list_elem *b,
+		void *aux UNUSED) {
+	return list_entry (a, struct wait_queue_entry, elem)->thread->priority
+		< list_entry (b, struct wait_queue_entry, elem)->thread->priority;
+}
+
+/* Initializes completion C as not yet done. */
+void
+completion_init (struct completion *c) {
+	ASSERT (c != NULL);
+
+	c->done = 0;
+	wait_queue_init (&c->wq);
+}
+
+/* Signals C once, waking one waiter or letting the next
+   wait_for_completion() return at once.  May be called from an
+   interrupt handler. */
+void
+complete (struct completion *c) {
+	enum intr_level old_level;
+
+	ASSERT (c != NULL);
+
+	old_level = intr_disable ();
+	if (c->done != UINT_MAX)
+		c->done++;
+	intr_set_level (old_level);
+	wait_queue_wake_one (&c->wq);
+}
+
+/* Signals C for good: every current and future waiter returns
+   until C is initialized again.  May be called from an interrupt
+   handler. */
+void
+complete_all (struct completion *c) {
+	enum intr_level old_level;
+
+	ASSERT (c != NULL);
+
+	old_level = intr_disable ();
+	c->done = UINT_MAX;
+	intr_set_level (old_level);
+	wait_queue_wake_all (&c->wq);
+}
+
+/* Waits for C to be signaled and consumes one completion. */
+void
+wait_for_completion (struct completion *c) {
+	enum intr_level old_level;
+
+	ASSERT (c != NULL);
+	ASSERT (!intr_context ());
+
+	old_level = intr_disable ();
+	while (c->done == 0)
+		wait_queue_wait (&c->wq, 0);
+	if (c->done != UINT_MAX)
+		c->done--;
+	intr_set_level (old_level);
+}
+
+/* Waits up to TICKS timer ticks for C to be signaled.  Returns
+   true, having consumed one completion, if it was; false on
+   timeout, or straight away if the sleep queue is out of memory.
+   Must be called with interrupts on. */
+bool
+wait_for_completion_timeout (struct completion *c, int64_t ticks) {
+	int64_t deadline = timer_ticks () + ticks;
+	bool done;
+
+	ASSERT (c != NULL);
+	ASSERT (!intr_context ());
+	ASSERT (intr_get_level () == INTR_ON);
+
+	/* A wakeup can find the completion already consumed by a
+	   thread that got there first; then sleep out the rest of the
+	   interval. */
+	for (;;) {
+		int64_t left = deadline - timer_ticks ();
+
+		if (left <= 0 || !timer_reserve ()) {
+			intr_disable ();
+			break;
+		}
+		if (c->done != 0)
+			break;
+		wait_queue_wait (&c->wq, left);
+		if (c->done != 0)
+			break;
+		intr_enable ();
+	}
+	done = c->done != 0;
+	if (done && c->done != UINT_MAX)
+		c->done--;
+	intr_enable ();
+	return done;
+}
@@ -2,8 +2,15 @@ threads_SRC  = threads/init.c		# Main program.
 threads_SRC += threads/thread.c		# Thread management core.
 threads_SRC += threads/interrupt.c	# Interrupt core.
 threads_SRC += threads/intr-stubs.S	# Interrupt stubs.
+threads_SRC += threads/switch.S		# Thread switch routine.
 threads_SRC += threads/synch.c		# Synchronization.
 threads_SRC += threads/palloc.c		# Page allocator.
 threads_SRC += threads/malloc.c		# Subpage allocator.
 threads_SRC += threads/start.S		# Startup code.
+threads_SRC += threads/ap-start.S	# Application processor startup.
+threads_SRC += threads/cpu.c		# Per-CPU data.
+threads_SRC += threads/trace.c		# Event tracing.
+threads_SRC += threads/counter.c	# Named kernel counters.
+threads_SRC += threads/profile.c	# Sampling profiler.
+threads_SRC += threads/workqueue.c	# Kernel worker thread pools.
 threads_SRC += threads/mmu.c		    # Memory management unit related things.
@@ -2,16 +2,24 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/counter.h"
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
+#include "devices/timer.h"
 #include "intrinsic.h"
 #ifdef USERPROG
+#include "userprog/exception.h"
 #include "userprog/process.h"
 #endif
 
@@ -24,9 +32,81 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Number of distinct thread priorities. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+
+/* Run queues, one per CPU.
+
+   The priority and multi-level feedback queue schedulers keep one
+   FIFO of THREAD_READY threads per priority, and an occupancy word
+   in which bit P is set if and only if QUEUES[P] is nonempty.
+   Enqueue is a list_push_back() and picking the next thread is a
+   find-first-set plus a list_pop_front(), both O(1) regardless of
+   queue length.  The round-robin scheduler (kernel command-line
+   option "-rr") uses the single FIFO RR_LIST instead.
+
+   A thread is readied on the run queue of the CPU it last ran on,
+   T->CPU.  A CPU whose queue runs dry steals the highest-priority
+   thread from the longest queue of another CPU, and every
+   BALANCE_TICKS it pulls one from a queue at least two longer
+   than its own.  Readying a thread that outranks the one running
+   on its CPU, if that is another CPU, sends it a reschedule IPI.
+   Only CPUs that schedule threads take part; the application
+   processors do not yet (see threads/cpu.c).  Threads go only to
+   CPUs in their affinity masks: a thread readied on a queue it may
+   not use moves to the least loaded one it may, and stealing skips
+   threads the thief may not run.
+
+   Deadline threads, made so by thread_set_deadline(), form a class
+   above all the others and are scheduled earliest deadline first
+   off DL_LIST, ordered by the end of each thread's current period.
+   Each period a deadline thread may run for its runtime; one that
+   spends it moves to DL_THROTTLED, where it waits, ready but not
+   runnable, until its next period starts.  Admission control keeps
+   their total utilization within DL_BW_MAX on each scheduling CPU,
+   so that they meet their deadlines and leave the rest some time.
+
+   LOCK protects a queue.  Take it with interrupts off, and two
+   at once in CPU order. */
+struct runqueue {
+	struct spinlock lock;
+	struct list queues[PRI_CNT];    /* Ready threads, by priority. */
+	uint64_t bitmap;                /* Bit P set if QUEUES[P] nonempty. */
+	struct list rr_list;            /* Ready threads under "-rr". */
+	struct list dl_list;            /* Ready deadline threads, by deadline. */
+	struct list dl_throttled;       /* Deadline threads out of budget. */
+	int64_t dl_earliest;            /* First deadline in DL_LIST, or
+	                                   INT64_MAX if empty. */
+	size_t cnt;                     /* Number of runnable ready threads. */
+	bool scheduling;                /* Does this CPU run threads? */
+
+	/* Statistics. */
+	long long ticks;                /* Timer ticks counted. */
+	long long load_sum;             /* Sum over ticks of runnable threads. */
+	long long steals;               /* Threads taken from other queues. */
+	long long ipis;                 /* Reschedule IPIs sent to this CPU. */
+	long long dl_throttles;         /* Deadline threads out of budget. */
+};
+static struct runqueue runqueues[CPU_MAX];
+static unsigned scheduling_cnt;         /* CPUs with SCHEDULING set. */
+
+/* Ticks between load balancing passes. */
+#define BALANCE_TICKS (TIMER_FREQ / 10)
+
+/* Deadline thread utilization, runtime / period, in fixed point
+   with DL_BW_ONE for a whole CPU, and the most admitted per
+   scheduling CPU. */
+#define DL_BW_SHIFT 20
+#define DL_BW_ONE (1ULL << DL_BW_SHIFT)
+#define DL_BW_MAX (DL_BW_ONE * 95 / 100)
+static uint64_t dl_bandwidth;           /* Sum over deadline threads. */
+static long long dl_admits;             /* thread_set_deadline() successes. */
+
+/* Returns the running CPU's run queue. */
+static inline struct runqueue *
+this_rq (void) {
+	return &runqueues[this_cpu ()->id];
+}
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -34,34 +114,139 @@ static struct thread *idle_thread;
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
-/* Lock used by allocate_tid(). */
-static struct lock tid_lock;
+/* Registry of live threads, by tid, for thread_lookup().  It is
+   filled from thread_start() on, once malloc() works. */
+static struct hash thread_registry;
+static struct lock registry_lock;
+static bool registry_ready;
 
 /* Thread destruction requests */
 static struct list destruction_req;
 
+/* Pages of dead threads kept for reuse by thread_create(), so that
+   short-lived threads do not pay for a palloc_free_page() and a
+   PAL_ZERO palloc_get_page() each.  Linked through the dead
+   thread's `elem'.  Access with interrupts off. */
+#define THREAD_PAGE_CACHE_MAX 16
+static struct list thread_page_cache;
+static size_t thread_page_cache_cnt;
+
 /* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
+static long long page_cache_hits;   /* # of thread pages reused. */
+static long long page_cache_misses; /* # of thread pages from palloc. */
+static long long voluntary_switches;   /* # of blocks and yields. */
+static long long involuntary_switches; /* # of preemptions. */
+static struct histogram wakeup_latency; /* Cycles from unblock to run. */
+static struct histogram run_length;     /* Cycles run per switch-in. */
+
+/* Set by thread_preempt() so that schedule() counts the switch
+   as involuntary. */
+static bool preempting;
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+static unsigned thread_slice = TIME_SLICE; /* # of timer ticks the running thread gets. */
+
+/* Time slice policy: ticks per quantum, indexed by priority.  Flat
+   at TIME_SLICE unless thread_set_time_slices() is called.  With an
+   adaptive table, quanta also shrink in proportion once more than
+   RUNQUEUE_SHORT threads are waiting, so a long run queue does not
+   stretch response time. */
+#define RUNQUEUE_SHORT 8
+static uint8_t time_slices[PRI_CNT] = { [0 ... PRI_CNT - 1] = TIME_SLICE };
+static bool time_slices_adaptive;
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Multi-level feedback queue scheduler state.
+
+   Per tick, only the running thread is charged and, every fourth
+   tick, re-prioritized.  Once per second the load average is
+   updated and recent_cpu decays, but only for the running thread
+   and, from a softirq, the ready threads, whose priorities decide
+   who runs next.
+   Blocked threads catch up on the decay lazily in
+   thread_unblock(), replaying the coefficient of each second they
+   missed from DECAY_HISTORY.  Past MLFQS_HISTORY seconds of sleep
+   the oldest known coefficient is applied in closed form, so the
+   work per wakeup stays bounded no matter how long it slept. */
+#define MLFQS_HISTORY 32
+static fixed_t load_avg;                /* System load average. */
+static int64_t mlfqs_seconds;           /* # of load_avg updates so far. */
+static fixed_t decay_history[MLFQS_HISTORY]; /* Decay of second S at
+                                           [S % MLFQS_HISTORY]. */
+static struct softirq mlfqs_softirq;    /* Runs mlfqs_refile(). */
+
+/* If true, ignore priorities and run ready threads in plain FIFO
+   order off a single FIFO per CPU.
+   Controlled by kernel command-line option "-rr". */
+bool thread_rr;
+
+/* Adaptive idle polling.
+
+   Waking from `hlt' costs a VM exit and re-entry under a
+   hypervisor, which delays the first interrupt after idling.  With
+   polling on, the idle thread first spins with `pause' for up to
+   idle_poll_ns, watching for a thread to become ready, and halts
+   only if none does.  Like Linux's haltpoll governor, the window
+   adapts to recent wakeups: a halt that ended within
+   thread_idle_poll_us of starting would have been caught by a
+   longer poll, so the window doubles; a longer halt halves it.
+   Controlled by kernel command-line option "-idle-poll". */
+#define IDLE_POLL_START_NS 10000        /* First nonzero window. */
+unsigned thread_idle_poll_us;           /* Window limit, 0 disables. */
+static int64_t idle_poll_ns;            /* Current window. */
+static int64_t idle_left_ns;            /* When idle last switched out. */
+static int64_t idle_poll_hits;          /* # of polls that saw a thread. */
+static int64_t idle_poll_halts;         /* # of halts after a poll. */
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
+static bool idle_poll (void);
+static void idle_poll_adapt (int64_t halt_ns);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
+static struct thread *thread_page_get (void);
+static void thread_page_put (struct thread *);
+static void ready_push (struct thread *);
+static struct thread *ready_pop (void);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
+static bool ready_outranks (const struct thread *);
+static void rq_add (struct runqueue *, struct thread *);
+static struct thread *rq_take (struct runqueue *);
+static struct thread *rq_take_for (struct runqueue *, unsigned cpu);
+static uint32_t scheduling_mask (void);
+static unsigned ready_cpu (const struct thread *);
+static void rq_del (struct runqueue *, struct thread *);
+static void rq_dl_update (struct runqueue *);
+static bool rq_steal (struct runqueue *, size_t min_cnt);
+static void resched_cpu (unsigned cpu);
+static intr_handler_func resched_interrupt;
+static unsigned time_slice_for (const struct thread *);
+static void dl_tick (struct runqueue *, struct thread *curr);
+static void dl_replenish (struct thread *, int64_t now);
+static uint64_t dl_bw (int64_t runtime, int64_t period);
+static list_less_func dl_less;
+static void mlfqs_tick (struct thread *);
+static void mlfqs_second (struct thread *);
+static softirq_func mlfqs_refile;
+static void mlfqs_decay (struct thread *);
+static void mlfqs_update_priority (struct thread *);
 static void do_schedule(int status);
+static void account_switch (struct thread *curr, struct thread *next);
 static void schedule (void);
 static tid_t allocate_tid (void);
+static void registry_add (struct thread *);
+static hash_hash_func registry_hash;
+static hash_less_func registry_less;
+static intr_handler_func inspect_sched;
+static counter_read_func read_cpu_ticks;
 
 /* Returns true if T appears to point to a valid thread. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC)
@@ -106,26 +291,64 @@ thread_init (void) {
 	lgdt (&gdt_ds);
 
 	/* Init the globla thread context */
-	lock_init (&tid_lock);
-	list_init (&ready_list);
+	lock_init (&registry_lock);
+	for (int c = 0; c < CPU_MAX; c++) {
+		struct runqueue *rq = &runqueues[c];
+
+		spin_lock_init (&rq->lock);
+		for (int i = 0; i < PRI_CNT; i++)
+			list_init (&rq->queues[i]);
+		list_init (&rq->rr_list);
+		list_init (&rq->dl_list);
+		list_init (&rq->dl_throttled);
+		rq->dl_earliest = INT64_MAX;
+	}
+	this_rq ()->scheduling = true;
+	scheduling_cnt = 1;
+	softirq_init (&mlfqs_softirq, mlfqs_refile, NULL);
+	histogram_init (&wakeup_latency);
+	histogram_init (&run_length);
 	list_init (&destruction_req);
+	list_init (&thread_page_cache);
 
 	/* Set up a thread structure for the running thread. */
 	initial_thread = running_thread ();
 	init_thread (initial_thread, "main", PRI_DEFAULT);
 	initial_thread->status = THREAD_RUNNING;
 	initial_thread->tid = allocate_tid ();
+	initial_thread->run_stamp = rdtsc ();
+	this_cpu ()->curr = initial_thread;
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
    Also creates the idle thread. */
 void
 thread_start (void) {
+	if (!hash_init (&thread_registry, registry_hash, registry_less, NULL))
+		PANIC ("thread_start: out of memory for the thread registry");
+	registry_ready = true;
+	registry_add (initial_thread);
+
 	/* Create the idle thread. */
 	struct semaphore idle_started;
 	sema_init (&idle_started, 0);
 	thread_create ("idle", PRI_MIN, idle, &idle_started);
 
+	intr_register_int (0x45, 3, INTR_OFF, inspect_sched,
+			"Inspect Scheduler Statistics");
+	counter_register_value ("sched.voluntary_switches", &voluntary_switches);
+	counter_register_value ("sched.involuntary_switches",
+			&involuntary_switches);
+	counter_register ("sched.idle_ticks", read_cpu_ticks,
+			(void *) offsetof (struct cpu, idle_ticks));
+	counter_register ("sched.kernel_ticks", read_cpu_ticks,
+			(void *) offsetof (struct cpu, kernel_ticks));
+	counter_register ("sched.user_ticks", read_cpu_ticks,
+			(void *) offsetof (struct cpu, user_ticks));
+	if (lapic_present ())
+		intr_register_apic (LAPIC_RESCHED_VEC, resched_interrupt,
+				"Reschedule IPI");
+
 	/* Start preemptive thread scheduling. */
 	intr_enable ();
 
@@ -138,27 +361,131 @@ thread_start (void) {
 void
 thread_tick (void) {
 	struct thread *t = thread_current ();
+	struct cpu *c = this_cpu ();
+	struct runqueue *rq = this_rq ();
 
 	/* Update statistics. */
 	if (t == idle_thread)
-		idle_ticks++;
+		c->idle_ticks++;
 #ifdef USERPROG
 	else if (t->pml4 != NULL)
-		user_ticks++;
+		c->user_ticks++;
 #endif
 	else
-		kernel_ticks++;
+		c->kernel_ticks++;
+	if (intr_from_user ())
+		t->user_ticks++;
+	else
+		t->kernel_ticks++;
+	rq->ticks++;
+	rq->load_sum += rq->cnt + (t != idle_thread ? 1 : 0);
+
+	/* Even out the load, pulling a thread from a CPU with two more
+	   to run than this one. */
+	if (rq->ticks % BALANCE_TICKS == 0 && rq_steal (rq, rq->cnt + 2)
+			&& (t == idle_thread || ready_outranks (t)))
+		intr_yield_on_return ();
+
+	/* Charge deadline threads and start their new periods. */
+	if (t->dl_period != 0 || !list_empty (&rq->dl_throttled))
+		dl_tick (rq, t);
+
+	if (thread_mlfqs)
+		mlfqs_tick (t);
 
 	/* Enforce preemption. */
-	if (++thread_ticks >= TIME_SLICE)
+	if (++thread_ticks >= thread_slice)
 		intr_yield_on_return ();
 }
 
+/* Replaces the time slice table with one that hands HIGH ticks to
+   PRI_MAX threads and LOW ticks to PRI_MIN threads, interpolating
+   linearly in between, and turns on run-queue-length scaling.
+   Called for the "-ts" kernel command-line option, before
+   thread_init(). */
+void
+thread_set_time_slices (int high, int low) {
+	int pri;
+
+	ASSERT (high > 0 && high <= UINT8_MAX);
+	ASSERT (low > 0 && low <= UINT8_MAX);
+
+	for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+		time_slices[pri - PRI_MIN] = low
+			+ (high - low) * (pri - PRI_MIN) / (PRI_MAX - PRI_MIN);
+	time_slices_adaptive = true;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) {
+	long long idle_ticks = 0, kernel_ticks = 0, user_ticks = 0;
+	unsigned i;
+
+	for (i = 0; i < cpu_cnt; i++) {
+		idle_ticks += cpus[i].idle_ticks;
+		kernel_ticks += cpus[i].kernel_ticks;
+		user_ticks += cpus[i].user_ticks;
+	}
 	printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
 			idle_ticks, kernel_ticks, user_ticks);
+	printf ("Thread: %lld pages reused, %lld pages allocated\n",
+			page_cache_hits, page_cache_misses);
+	printf ("Thread: %lld voluntary switches, %lld involuntary switches\n",
+			voluntary_switches, involuntary_switches);
+	histogram_print (&wakeup_latency, "Thread: wakeup latency", "cycles");
+	histogram_print (&run_length, "Thread: run length", "cycles");
+	if (thread_idle_poll_us != 0)
+		printf ("Thread: %lld idle polls hit, %lld halted, %lld ns window\n",
+				idle_poll_hits, idle_poll_halts, idle_poll_ns);
+	if (scheduling_cnt > 1)
+		for (i = 0; i < cpu_cnt; i++) {
+			struct runqueue *rq = &runqueues[i];
+
+			if (rq->scheduling && rq->ticks != 0)
+				printf ("Thread: CPU %u: load %lld.%02lld, %lld steals, "
+						"%lld IPIs\n", i, rq->load_sum / rq->ticks,
+						rq->load_sum * 100 / rq->ticks % 100, rq->steals,
+						rq->ipis);
+		}
+	if (dl_admits != 0) {
+		long long throttles = 0;
+
+		for (i = 0; i < cpu_cnt; i++)
+			throttles += runqueues[i].dl_throttles;
+		printf ("Thread: %lld deadline threads admitted, %lld throttled, "
+				"%llu%% utilization\n", dl_admits, throttles,
+				(unsigned long long) (dl_bandwidth * 100 >> DL_BW_SHIFT));
+	}
+
+	/* Per-thread CPU time.  Skipped when called from a context
+	   that cannot take the registry lock, such as a panic. */
+	if (registry_ready && !intr_context ()
+			&& lock_try_acquire (&registry_lock)) {
+		struct hash_iterator i;
+
+		hash_first (&i, &thread_registry);
+		while (hash_next (&i)) {
+			struct thread *t = hash_entry (hash_cur (&i), struct thread,
+					registry_elem);
+			printf ("Thread: %s (tid %d): %llu cycles\n", t->name, t->tid,
+					thread_cpu_cycles (t));
+		}
+		lock_release (&registry_lock);
+	}
+}
+
+/* Returns the TSC cycles T has spent running, including its
+   current run if it is running now. */
+uint64_t
+thread_cpu_cycles (const struct thread *t) {
+	enum intr_level old_level = intr_disable ();
+	uint64_t cycles = t->cpu_cycles;
+
+	if (t->status == THREAD_RUNNING && t->run_stamp != 0)
+		cycles += rdtsc () - t->run_stamp;
+	intr_set_level (old_level);
+	return cycles;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -173,9 +500,8 @@ thread_print_stats (void) {
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   Unless the round-robin scheduler is selected, the new thread
+   preempts the caller if it has a higher priority. */
 tid_t
 thread_create (const char *name, int priority,
 		thread_func *function, void *aux) {
@@ -185,13 +511,30 @@ thread_create (const char *name, int priority,
 	ASSERT (function != NULL);
 
 	/* Allocate thread. */
-	t = palloc_get_page (PAL_ZERO);
+	t = thread_page_get ();
 	if (t == NULL)
 		return TID_ERROR;
 
 	/* Initialize thread. */
 	init_thread (t, name, priority);
+	t->affinity = thread_current ()->affinity;
 	tid = t->tid = allocate_tid ();
+#ifdef USERPROG
+	if (!process_track (t)) {
+		palloc_free_page (t);
+		return TID_ERROR;
+	}
+#endif
+	registry_add (t);
+	if (thread_mlfqs) {
+		/* Inherit the creator's niceness and CPU usage.  The running
+		   thread's recent_cpu is always current. */
+		struct thread *curr = thread_current ();
+		t->nice = curr->nice;
+		t->recent_cpu = curr->recent_cpu;
+		t->decay_epoch = mlfqs_seconds;
+		mlfqs_update_priority (t);
+	}
 
 	/* Call the kernel_thread if it scheduled.
 	 * Note) rdi is 1st argument, and rsi is 2nd argument. */
@@ -206,6 +549,7 @@ thread_create (const char *name, int priority,
 
 	/* Add to run queue. */
 	thread_unblock (t);
+	thread_preempt_if_outranked ();
 
 	return tid;
 }
@@ -240,7 +584,12 @@ thread_unblock (struct thread *t) {
 
 	old_level = intr_disable ();
 	ASSERT (t->status == THREAD_BLOCKED);
-	list_push_back (&ready_list, &t->elem);
+	t->ready_stamp = rdtsc ();
+	if (thread_mlfqs) {
+		mlfqs_decay (t);
+		mlfqs_update_priority (t);
+	}
+	ready_push (t);
 	t->status = THREAD_READY;
 	intr_set_level (old_level);
 }
@@ -275,6 +624,16 @@ thread_tid (void) {
 	return thread_current ()->tid;
 }
 
+/* Returns 64 pseudo-random bits from the running thread's own
+   generator, which, unlike random_ulong()'s, no other thread
+   touches.  Not for interrupt handlers, which would share the
+   generator with the code they interrupted. */
+uint64_t
+thread_random (void) {
+	ASSERT (!intr_context ());
+	return prng_next (&thread_current ()->prng);
+}
+
 /* Deschedules the current thread and destroys it.  Never
    returns to the caller. */
 void
@@ -283,15 +642,35 @@ thread_exit (void) {
 
 #ifdef USERPROG
 	process_exit ();
+	fpu_release (thread_current ());
 #endif
 
+	lock_acquire (&registry_lock);
+	hash_delete (&thread_registry, &thread_current ()->registry_elem);
+	lock_release (&registry_lock);
+
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
 	intr_disable ();
+	dl_bandwidth -= dl_bw (thread_current ()->dl_runtime,
+			thread_current ()->dl_period);
 	do_schedule (THREAD_DYING);
 	NOT_REACHED ();
 }
 
+/* Frees the page of T, a dead thread whose page was kept past
+   its death. */
+void
+thread_release (struct thread *t) {
+	enum intr_level old_level;
+
+	ASSERT (t->status == THREAD_DYING);
+
+	old_level = intr_disable ();
+	thread_page_put (t);
+	intr_set_level (old_level);
+}
+
 /* Yields the CPU.  The current thread is not put to sleep and
    may be scheduled again immediately at the scheduler's whim. */
 void
@@ -303,15 +682,213 @@ thread_yield (void) {
 
 	old_level = intr_disable ();
 	if (curr != idle_thread)
-		list_push_back (&ready_list, &curr->elem);
+		ready_push (curr);
 	do_schedule (THREAD_READY);
 	intr_set_level (old_level);
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Yields the CPU on behalf of the scheduler rather than the
+   running thread, e.g. because its time slice expired or a
+   higher-priority thread became ready.  Counted as an involuntary
+   context switch.  If the running thread has preemption disabled,
+   the yield is deferred until it is enabled again. */
+void
+thread_preempt (void) {
+	struct thread *curr = thread_current ();
+
+	if (curr->preempt_count > 0) {
+		curr->resched_pending = true;
+		return;
+	}
+	curr->resched_pending = false;
+	preempting = true;
+	thread_yield ();
+}
+
+/* Like thread_preempt_if_outranked(), but for wakeups that happen
+   where yielding right away is not safe: if a ready thread outranks
+   the running one, preempts it at its next safe point instead, that
+   is the next interrupt return, preempt_enable(), or
+   cond_resched(). */
+void
+thread_defer_preempt (void) {
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	if (ready_outranks (thread_current ()))
+		thread_current ()->resched_pending = true;
+	intr_set_level (old_level);
+}
+
+/* Returns true if a deferred preemption of the running thread can
+   be carried out now. */
+bool
+thread_resched_pending (void) {
+	struct thread *curr = thread_current ();
+	return curr->resched_pending && curr->preempt_count == 0;
+}
+
+/* Keeps the running thread on the CPU, even if a higher-priority
+   thread wakes up or its time slice expires, until the matching
+   preempt_enable().  Interrupts are still taken.  Calls nest.  The
+   thread may still block or yield on its own. */
+void
+preempt_disable (void) {
+	thread_current ()->preempt_count++;
+	barrier ();
+}
+
+/* Undoes one preempt_disable(), and carries out any preemption
+   that was deferred in the meantime once the count drops to
+   zero. */
+void
+preempt_enable (void) {
+	struct thread *curr = thread_current ();
+
+	ASSERT (curr->preempt_count > 0);
+	barrier ();
+	if (--curr->preempt_count == 0 && curr->resched_pending
+			&& !intr_context () && intr_get_level () == INTR_ON)
+		thread_preempt ();
+}
+
+/* A safe point in a long-running kernel loop.  Gives up the CPU if
+   a preemption is pending or a ready thread outranks the running
+   one, unless preemption or interrupts are disabled.  Cheap enough
+   to call once per page or per few hundred iterations. */
+void
+cond_resched (void) {
+	struct thread *curr;
+
+	if (intr_get_level () == INTR_OFF || intr_context ())
+		return;
+	curr = thread_current ();
+	if (curr->preempt_count > 0)
+		return;
+	if (curr->resched_pending)
+		thread_preempt ();
+	else
+		thread_preempt_if_outranked ();
+}
+
+/* Sets the current thread's priority to NEW_PRIORITY.  Yields
+   if the running thread no longer has the highest priority.
+   Ignored under the MLFQS, which computes priorities itself. */
 void
 thread_set_priority (int new_priority) {
-	thread_current ()->priority = new_priority;
+	ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+	if (thread_mlfqs)
+		return;
+
+	struct thread *curr = thread_current ();
+	enum intr_level old_level = intr_disable ();
+	int donated = lock_max_donation (curr);
+
+	curr->base_priority = new_priority;
+	curr->priority = donated > new_priority ? donated : new_priority;
+	intr_set_level (old_level);
+	thread_preempt_if_outranked ();
+}
+
+/* Changes T's effective priority to PRIORITY, moving it to the
+   matching run queue if it is ready.  Interrupts must be off. */
+void
+thread_change_priority (struct thread *t, int priority) {
+	ASSERT (is_thread (t));
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+	if (t->priority == priority)
+		return;
+	if (t->status == THREAD_READY && !thread_rr) {
+		ready_remove (t);
+		t->priority = priority;
+		ready_push (t);
+	} else
+		t->priority = priority;
+}
+
+/* Makes the running thread a deadline thread that runs for up to
+   RUNTIME timer ticks in every period of PERIOD ticks, starting
+   now, ahead of every thread that is not a deadline thread.  With
+   both zero, returns it to its normal scheduling class.  Returns
+   false, changing nothing, if the arguments are invalid or if
+   admitting the thread would bring the deadline threads' total
+   utilization past DL_BW_MAX on each scheduling CPU. */
+bool
+thread_set_deadline (int64_t runtime, int64_t period) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+	uint64_t bw, others;
+
+	ASSERT (!intr_context ());
+
+	if ((runtime != 0 || period != 0)
+			&& (runtime <= 0 || period < runtime))
+		return false;
+	bw = dl_bw (runtime, period);
+
+	old_level = intr_disable ();
+	others = dl_bandwidth - dl_bw (curr->dl_runtime, curr->dl_period);
+	if (others + bw > DL_BW_MAX * scheduling_cnt) {
+		intr_set_level (old_level);
+		return false;
+	}
+	dl_bandwidth = others + bw;
+	if (bw != 0)
+		dl_admits++;
+	curr->dl_runtime = runtime;
+	curr->dl_period = period;
+	curr->dl_deadline = timer_ticks () + period;
+	curr->dl_budget = runtime;
+	curr->dl_throttled = false;
+	intr_set_level (old_level);
+
+	thread_preempt_if_outranked ();
+	return true;
+}
+
+/* Restricts T to the CPUs in MASK, bit N for CPU N, and returns
+   true; or returns false, changing nothing, if none of those CPUs
+   schedules threads.  New threads inherit their creator's mask.
+   A ready T moves to a CPU in MASK right away and a running T
+   that is the current thread yields to move; a T running on
+   another CPU, or blocked, moves the next time it is readied. */
+bool
+thread_set_affinity (struct thread *t, uint32_t mask) {
+	enum intr_level old_level;
+	bool move;
+
+	ASSERT (is_thread (t));
+
+	old_level = intr_disable ();
+	if ((mask & scheduling_mask ()) == 0) {
+		intr_set_level (old_level);
+		return false;
+	}
+	t->affinity = mask & CPU_ALL;
+	move = (t->affinity & (1u << t->cpu)) == 0;
+	if (move && t->status == THREAD_READY) {
+		ready_remove (t);
+		ready_push (t);
+	}
+	intr_set_level (old_level);
+
+	if (move && t == thread_current ()) {
+		if (intr_context ())
+			intr_yield_on_return ();
+		else
+			thread_yield ();
+	}
+	return true;
+}
+
+/* Returns the mask of CPUs that T may run on. */
+uint32_t
+thread_get_affinity (const struct thread *t) {
+	ASSERT (is_thread (t));
+	return t->affinity;
 }
 
 /* Returns the current thread's priority. */
@@ -320,31 +897,48 @@ thread_get_priority (void) {
 	return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, clamped to
+   [NICE_MIN, NICE_MAX], and recomputes its MLFQS priority. */
 void
-thread_set_nice (int nice UNUSED) {
-	/* TODO: Your implementation goes here */
+thread_set_nice (int nice) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+
+	if (nice < NICE_MIN)
+		nice = NICE_MIN;
+	else if (nice > NICE_MAX)
+		nice = NICE_MAX;
+
+	old_level = intr_disable ();
+	curr->nice = nice;
+	if (thread_mlfqs)
+		mlfqs_update_priority (curr);
+	intr_set_level (old_level);
+	thread_preempt_if_outranked ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	enum intr_level old_level = intr_disable ();
+	int load = fp_round (load_avg * 100);
+	intr_set_level (old_level);
+	return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	enum intr_level old_level = intr_disable ();
+	int recent = fp_round (thread_current ()->recent_cpu * 100);
+	intr_set_level (old_level);
+	return recent;
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -359,8 +953,10 @@ thread_get_recent_cpu (void) {
 static void
 idle (void *idle_started_ UNUSED) {
 	struct semaphore *idle_started = idle_started_;
+	int64_t halt_start;
 
 	idle_thread = thread_current ();
+	this_cpu ()->idle = idle_thread;
 	sema_up (idle_started);
 
 	for (;;) {
@@ -368,6 +964,23 @@ idle (void *idle_started_ UNUSED) {
 		intr_disable ();
 		thread_block ();
 
+		/* Nothing is ready: zero free pages ahead of PAL_ZERO
+		   requests, one page at a time. */
+		while (this_rq ()->cnt == 0 && palloc_idle_zero ())
+			continue;
+
+		/* Still nothing is ready: in polling mode, watch for a
+		   wakeup a while before halting. */
+		if (thread_idle_poll_us != 0 && idle_poll ())
+			continue;
+
+		/* In tickless mode, stop the periodic tick until the next
+		   sleeper is due, unless a deadline thread needs it to start
+		   its next period. */
+		if (list_empty (&this_rq ()->dl_throttled))
+			timer_idle_enter ();
+		halt_start = timer_nsec ();
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -381,6 +994,56 @@ idle (void *idle_started_ UNUSED) {
 		   See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
 		   7.11.1 "HLT Instruction". */
 		asm volatile ("sti; hlt" : : : "memory");
+
+		/* The wakeup that ended the halt either switched us out,
+		   at IDLE_LEFT_NS, or was an interrupt that readied no
+		   one. */
+		if (thread_idle_poll_us != 0)
+			idle_poll_adapt ((idle_left_ns > halt_start ? idle_left_ns
+						: timer_nsec ()) - halt_start);
+	}
+}
+
+/* Spins with interrupts on for up to idle_poll_ns, until a thread
+   becomes ready.  Returns true if one did, in which case the idle
+   thread may already have been switched out and back in. */
+static bool
+idle_poll (void) {
+	struct runqueue *rq = this_rq ();
+	int64_t left = idle_left_ns;
+	int64_t deadline;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (idle_poll_ns == 0)
+		return false;
+
+	deadline = timer_nsec () + idle_poll_ns;
+	intr_enable ();
+	while (rq->cnt == 0 && idle_left_ns == left && timer_nsec () < deadline)
+		asm volatile ("pause" : : : "memory");
+	intr_disable ();
+
+	if (rq->cnt == 0 && idle_left_ns == left)
+		return false;
+	idle_poll_hits++;
+	return true;
+}
+
+/* Resizes the polling window after a halt that lasted HALT_NS. */
+static void
+idle_poll_adapt (int64_t halt_ns) {
+	int64_t limit = (int64_t) thread_idle_poll_us * 1000;
+
+	idle_poll_halts++;
+	if (halt_ns < limit) {
+		idle_poll_ns = idle_poll_ns != 0 ? idle_poll_ns * 2 : IDLE_POLL_START_NS;
+		if (idle_poll_ns > limit)
+			idle_poll_ns = limit;
+	} else {
+		idle_poll_ns /= 2;
+		if (idle_poll_ns < IDLE_POLL_START_NS)
+			idle_poll_ns = 0;
 	}
 }
 
@@ -408,9 +1071,63 @@ init_thread (struct thread *t, const char *name, int priority) {
 	strlcpy (t->name, name, sizeof t->name);
 	t->tf.rsp = (uint64_t) t + PGSIZE - sizeof (void *);
 	t->priority = priority;
+	t->base_priority = priority;
+	t->cpu = this_cpu ()->id;
+	t->affinity = CPU_ALL;
+	heap_init (&t->held_locks);
+	t->nice = NICE_DEFAULT;
+	prng_spawn (&t->prng);
 	t->magic = THREAD_MAGIC;
 }
 
+/* Returns a zeroed page for a new thread, preferably one left
+   behind by a dead thread, or a null pointer if memory is
+   exhausted. */
+static struct thread *
+thread_page_get (void) {
+	enum intr_level old_level;
+	struct thread *t = NULL;
+
+	old_level = intr_disable ();
+	if (!list_empty (&thread_page_cache)) {
+		t = list_entry (list_pop_front (&thread_page_cache),
+				struct thread, elem);
+		thread_page_cache_cnt--;
+		page_cache_hits++;
+	} else
+		page_cache_misses++;
+	intr_set_level (old_level);
+
+	if (t == NULL)
+		return palloc_get_page (PAL_ZERO);
+
+	/* The page was all zeros when first allocated, and the stack
+	   only ever grows down from the top, so everything between
+	   `struct thread' and the deepest point the dead thread's stack
+	   reached is still zero.  Find that point and clear from there
+	   up; init_thread() clears `struct thread' itself. */
+	uint64_t *low = (uint64_t *) ROUND_UP ((uintptr_t) (t + 1), sizeof *low);
+	uint64_t *top = (uint64_t *) ((uint8_t *) t + PGSIZE);
+	while (low < top && *low == 0)
+		low++;
+	memset (low, 0, (uint8_t *) top - (uint8_t *) low);
+	return t;
+}
+
+/* Retires the page of dead thread T, caching it for reuse by
+   thread_create() if the cache has room and freeing it otherwise.
+   Interrupts must be off. */
+static void
+thread_page_put (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (thread_page_cache_cnt < THREAD_PAGE_CACHE_MAX) {
+		list_push_front (&thread_page_cache, &t->elem);
+		thread_page_cache_cnt++;
+	} else
+		palloc_free_page (t);
+}
+
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
@@ -418,10 +1135,555 @@ init_thread (struct thread *t, const char *name, int priority) {
    idle_thread. */
 static struct thread *
 next_thread_to_run (void) {
-	if (list_empty (&ready_list))
-		return idle_thread;
-	else
-		return list_entry (list_pop_front (&ready_list), struct thread, elem);
+	struct thread *t = ready_pop ();
+	return t != NULL ? t : idle_thread;
+}
+
+/* Appends T to the run queue of the CPU it last ran on, and asks
+   that CPU to reschedule if T outranks the thread running there.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t) {
+	struct runqueue *rq;
+	bool resched;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->dl_period != 0)
+		dl_replenish (t, timer_ticks ());
+	t->cpu = ready_cpu (t);
+	rq = &runqueues[t->cpu];
+	spin_lock (&rq->lock);
+	rq_add (rq, t);
+	resched = t->cpu != this_cpu ()->id && !t->dl_throttled
+		&& thread_outranks (t, cpus[t->cpu].curr);
+	spin_unlock (&rq->lock);
+	if (resched)
+		resched_cpu (t->cpu);
+}
+
+/* Removes and returns the thread that should run next on this
+   CPU, stealing one from another CPU if none is ready here, or
+   returns a null pointer if no thread is ready anywhere.
+   Interrupts must be off. */
+static struct thread *
+ready_pop (void) {
+	struct runqueue *rq = this_rq ();
+	struct thread *t;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	spin_lock (&rq->lock);
+	t = rq_take (rq);
+	spin_unlock (&rq->lock);
+	if (t == NULL && rq_steal (rq, 1)) {
+		spin_lock (&rq->lock);
+		t = rq_take (rq);
+		spin_unlock (&rq->lock);
+	}
+	return t;
+}
+
+/* Removes ready thread T from its run queue, e.g. to re-file it
+   under a new priority.  Interrupts must be off. */
+static void
+ready_remove (struct thread *t) {
+	struct runqueue *rq;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (t->status == THREAD_READY);
+
+	/* T may move to another CPU before we get its queue's lock. */
+	for (;;) {
+		rq = &runqueues[t->cpu];
+		spin_lock (&rq->lock);
+		if (rq == &runqueues[t->cpu])
+			break;
+		spin_unlock (&rq->lock);
+	}
+	rq_del (rq, t);
+	spin_unlock (&rq->lock);
+}
+
+/* Returns the highest priority among threads ready on this CPU,
+   or PRI_MIN - 1 if none is.  Meaningless under the round-robin
+   scheduler. */
+static int
+ready_max_priority (void) {
+	uint64_t bitmap = __atomic_load_n (&this_rq ()->bitmap, __ATOMIC_RELAXED);
+
+	if (bitmap == 0)
+		return PRI_MIN - 1;
+	return PRI_MIN + 63 - __builtin_clzll (bitmap);
+}
+
+/* Returns true if a thread ready to run on this CPU outranks
+   CURR.  Interrupts must be off. */
+static bool
+ready_outranks (const struct thread *curr) {
+	int64_t earliest = __atomic_load_n (&this_rq ()->dl_earliest,
+			__ATOMIC_RELAXED);
+	bool dl = curr->dl_period != 0 && !curr->dl_throttled;
+
+	if (dl || earliest != INT64_MAX)
+		return earliest < (dl ? curr->dl_deadline : INT64_MAX);
+	return !thread_rr && ready_max_priority () > curr->priority;
+}
+
+/* Returns true if A should run in preference to B: A is a
+   deadline thread within its budget and B is not, or has a later
+   deadline; or neither is one and A has the higher priority,
+   outside the round-robin scheduler. */
+bool
+thread_outranks (const struct thread *a, const struct thread *b) {
+	bool a_dl = a->dl_period != 0 && !a->dl_throttled;
+	bool b_dl = b->dl_period != 0 && !b->dl_throttled;
+
+	if (a_dl || b_dl)
+		return a_dl && (!b_dl || a->dl_deadline < b->dl_deadline);
+	return !thread_rr && a->priority > b->priority;
+}
+
+/* Appends T to RQ, whose lock must be held.  A deadline thread
+   goes in deadline order onto DL_LIST, or onto DL_THROTTLED if it
+   is out of budget. */
+static void
+rq_add (struct runqueue *rq, struct thread *t) {
+	if (t->dl_period != 0) {
+		if (t->dl_throttled) {
+			list_insert_ordered (&rq->dl_throttled, &t->elem, dl_less, NULL);
+			return;
+		}
+		list_insert_ordered (&rq->dl_list, &t->elem, dl_less, NULL);
+		rq_dl_update (rq);
+	} else if (thread_rr)
+		list_push_back (&rq->rr_list, &t->elem);
+	else {
+		list_push_back (&rq->queues[t->priority - PRI_MIN], &t->elem);
+		rq->bitmap |= 1ULL << (t->priority - PRI_MIN);
+	}
+	rq->cnt++;
+}
+
+/* Removes and returns the thread in RQ that should run first, or
+   a null pointer if RQ is empty.  RQ's lock must be held. */
+static struct thread *
+rq_take (struct runqueue *rq) {
+	struct list *queue;
+	struct thread *t;
+	int pri = PRI_MIN - 1;
+
+	if (!list_empty (&rq->dl_list)) {
+		t = list_entry (list_pop_front (&rq->dl_list), struct thread, elem);
+		rq_dl_update (rq);
+		rq->cnt--;
+		return t;
+	}
+
+	if (thread_rr)
+		queue = &rq->rr_list;
+	else {
+		if (rq->bitmap == 0)
+			return NULL;
+		pri = PRI_MIN + 63 - __builtin_clzll (rq->bitmap);
+		queue = &rq->queues[pri - PRI_MIN];
+	}
+	if (list_empty (queue))
+		return NULL;
+
+	t = list_entry (list_pop_front (queue), struct thread, elem);
+	if (!thread_rr && list_empty (queue))
+		rq->bitmap &= ~(1ULL << (pri - PRI_MIN));
+	rq->cnt--;
+	return t;
+}
+
+/* Like rq_take(), but considers only the threads that may run on
+   CPU.  RQ's lock must be held. */
+static struct thread *
+rq_take_for (struct runqueue *rq, unsigned cpu) {
+	uint32_t bit = 1u << cpu;
+	uint64_t bitmap = rq->bitmap;
+	struct list_elem *e;
+
+	for (e = list_begin (&rq->dl_list); e != list_end (&rq->dl_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, elem);
+		if (t->affinity & bit) {
+			rq_del (rq, t);
+			return t;
+		}
+	}
+
+	if (thread_rr) {
+		for (e = list_begin (&rq->rr_list); e != list_end (&rq->rr_list);
+				e = list_next (e)) {
+			struct thread *t = list_entry (e, struct thread, elem);
+			if (t->affinity & bit) {
+				rq_del (rq, t);
+				return t;
+			}
+		}
+		return NULL;
+	}
+
+	while (bitmap != 0) {
+		int pri = PRI_MIN + 63 - __builtin_clzll (bitmap);
+		struct list *queue = &rq->queues[pri - PRI_MIN];
+
+		for (e = list_begin (queue); e != list_end (queue); e = list_next (e)) {
+			struct thread *t = list_entry (e, struct thread, elem);
+			if (t->affinity & bit) {
+				rq_del (rq, t);
+				return t;
+			}
+		}
+		bitmap &= ~(1ULL << (pri - PRI_MIN));
+	}
+	return NULL;
+}
+
+/* Returns the mask of CPUs that schedule threads. */
+static uint32_t
+scheduling_mask (void) {
+	uint32_t mask = 0;
+	unsigned c;
+
+	for (c = 0; c < CPU_MAX; c++)
+		if (runqueues[c].scheduling)
+			mask |= 1u << c;
+	return mask;
+}
+
+/* Returns the CPU whose run queue T should join: the one it last
+   ran on, if its affinity allows, otherwise the least loaded CPU
+   that it allows. */
+static unsigned
+ready_cpu (const struct thread *t) {
+	uint32_t allowed;
+	unsigned c, best;
+
+	if ((t->affinity & (1u << t->cpu)) && runqueues[t->cpu].scheduling)
+		return t->cpu;
+
+	allowed = t->affinity & scheduling_mask ();
+	ASSERT (allowed != 0);
+	best = __builtin_ctz (allowed);
+	for (c = best + 1; c < CPU_MAX; c++)
+		if ((allowed & (1u << c)) && runqueues[c].cnt < runqueues[best].cnt)
+			best = c;
+	return best;
+}
+
+/* Removes T from RQ, whose lock must be held. */
+static void
+rq_del (struct runqueue *rq, struct thread *t) {
+	list_remove (&t->elem);
+	if (t->dl_period != 0) {
+		if (t->dl_throttled)
+			return;
+		rq_dl_update (rq);
+	} else if (!thread_rr && list_empty (&rq->queues[t->priority - PRI_MIN]))
+		rq->bitmap &= ~(1ULL << (t->priority - PRI_MIN));
+	rq->cnt--;
+}
+
+/* Recomputes RQ's DL_EARLIEST.  RQ's lock must be held. */
+static void
+rq_dl_update (struct runqueue *rq) {
+	int64_t earliest = INT64_MAX;
+
+	if (!list_empty (&rq->dl_list))
+		earliest = list_entry (list_front (&rq->dl_list), struct thread,
+				elem)->dl_deadline;
+	__atomic_store_n (&rq->dl_earliest, earliest, __ATOMIC_RELAXED);
+}
+
+/* Moves the thread that should run first from the longest other
+   run queue, if that has at least MIN_CNT threads, to RQ, which
+   belongs to the running CPU.  Returns true if it moved one.
+   Interrupts must be off. */
+static bool
+rq_steal (struct runqueue *rq, size_t min_cnt) {
+	struct runqueue *victim = NULL, *first, *second;
+	struct thread *t = NULL;
+	size_t most = 0;
+	unsigned c;
+
+	if (scheduling_cnt < 2)
+		return false;
+
+	/* Pick a victim without locks, then check again under them. */
+	for (c = 0; c < cpu_cnt; c++) {
+		struct runqueue *other = &runqueues[c];
+		size_t cnt = __atomic_load_n (&other->cnt, __ATOMIC_RELAXED);
+
+		if (other != rq && other->scheduling && cnt >= min_cnt
+				&& cnt > most) {
+			victim = other;
+			most = cnt;
+		}
+	}
+	if (victim == NULL)
+		return false;
+
+	first = rq < victim ? rq : victim;
+	second = rq < victim ? victim : rq;
+	spin_lock (&first->lock);
+	spin_lock (&second->lock);
+	if (victim->cnt >= min_cnt
+			&& (t = rq_take_for (victim, rq - runqueues)) != NULL) {
+		t->cpu = rq - runqueues;
+		rq_add (rq, t);
+		rq->steals++;
+	}
+	spin_unlock (&second->lock);
+	spin_unlock (&first->lock);
+	return t != NULL;
+}
+
+/* Asks scheduling CPU number CPU, other than the running one, to
+   reschedule. */
+static void
+resched_cpu (unsigned cpu) {
+	__atomic_fetch_add (&runqueues[cpu].ipis, 1, __ATOMIC_RELAXED);
+	lapic_send_ipi (cpus[cpu].apic_id, LAPIC_RESCHED_VEC);
+}
+
+/* Reschedule IPI handler. */
+static void
+resched_interrupt (struct intr_frame *f UNUSED) {
+	intr_yield_on_return ();
+}
+
+/* Returns the number of ticks T may run before being preempted. */
+static unsigned
+time_slice_for (const struct thread *t) {
+	unsigned slice = time_slices[t->priority - PRI_MIN];
+	size_t ready_cnt = this_rq ()->cnt;
+
+	if (time_slices_adaptive && ready_cnt > RUNQUEUE_SHORT) {
+		slice = slice * RUNQUEUE_SHORT / ready_cnt;
+		if (slice == 0)
+			slice = 1;
+	}
+	return slice;
+}
+
+/* Deadline work for one timer tick on the CPU of run queue RQ,
+   with CURR the running thread: moves throttled threads whose new
+   period has started back to DL_LIST, and charges CURR, if it is a
+   deadline thread, for the tick, throttling it once it has spent
+   its runtime.  Runs in interrupt context. */
+static void
+dl_tick (struct runqueue *rq, struct thread *curr) {
+	int64_t now = timer_ticks ();
+	bool yield = false;
+
+	spin_lock (&rq->lock);
+	while (!list_empty (&rq->dl_throttled)) {
+		struct thread *t = list_entry (list_front (&rq->dl_throttled),
+				struct thread, elem);
+
+		if (t->dl_deadline > now)
+			break;
+		list_pop_front (&rq->dl_throttled);
+		dl_replenish (t, now);
+		rq_add (rq, t);
+		if (thread_outranks (t, curr))
+			yield = true;
+	}
+	spin_unlock (&rq->lock);
+
+	if (curr->dl_period != 0) {
+		if (!curr->dl_throttled && --curr->dl_budget <= 0) {
+			curr->dl_throttled = true;
+			rq->dl_throttles++;
+			yield = true;
+		}
+		dl_replenish (curr, now);
+	}
+	if (yield)
+		intr_yield_on_return ();
+}
+
+/* Starts deadline thread T's next period if its current one has
+   ended by tick NOW, giving it a full budget.  A thread that slept
+   through one or more periods starts its next one at NOW. */
+static void
+dl_replenish (struct thread *t, int64_t now) {
+	if (now < t->dl_deadline)
+		return;
+	t->dl_deadline = now + t->dl_period;
+	t->dl_budget = t->dl_runtime;
+	t->dl_throttled = false;
+}
+
+/* Returns the utilization of a deadline thread that runs for
+   RUNTIME ticks every PERIOD, or 0 if PERIOD is 0. */
+static uint64_t
+dl_bw (int64_t runtime, int64_t period) {
+	if (period == 0)
+		return 0;
+	return ((uint64_t) runtime << DL_BW_SHIFT) / period;
+}
+
+/* Orders deadline threads by deadline, earliest first. */
+static bool
+dl_less (const struct list_elem *a, const struct list_elem *b,
+		void *aux UNUSED) {
+	return list_entry (a, struct thread, elem)->dl_deadline
+		< list_entry (b, struct thread, elem)->dl_deadline;
+}
+
+/* MLFQS work for one timer tick, with CURR the running thread.
+   Runs in interrupt context. */
+static void
+mlfqs_tick (struct thread *curr) {
+	int64_t now = timer_ticks ();
+
+	if (curr != idle_thread)
+		curr->recent_cpu = fp_add_int (curr->recent_cpu, 1);
+	if (now % TIMER_FREQ == 0)
+		mlfqs_second (curr);
+	if (now % 4 == 0 && curr != idle_thread) {
+		mlfqs_update_priority (curr);
+		if (ready_outranks (curr))
+			intr_yield_on_return ();
+	}
+}
+
+/* Once-per-second MLFQS update, with CURR the running thread:
+   recomputes the load average, records this second's recent_cpu
+   decay coefficient, and applies it to CURR and to the ready
+   threads.  Blocked threads are left for mlfqs_decay() to catch up
+   when they wake. */
+static void
+mlfqs_second (struct thread *curr) {
+	int ready = 0;
+	fixed_t twice_load;
+	unsigned c;
+
+	/* Ready threads everywhere, plus those running. */
+	for (c = 0; c < cpu_cnt; c++)
+		if (runqueues[c].scheduling)
+			ready += runqueues[c].cnt
+				+ (cpus[c].curr != cpus[c].idle ? 1 : 0);
+
+	load_avg = fp_mul (fp_div (fp_from_int (59), fp_from_int (60)), load_avg)
+		+ fp_from_int (ready) / 60;
+	twice_load = 2 * load_avg;
+	mlfqs_seconds++;
+	decay_history[mlfqs_seconds % MLFQS_HISTORY] =
+		fp_div (twice_load, fp_add_int (twice_load, 1));
+
+	if (curr != idle_thread)
+		mlfqs_decay (curr);
+	softirq_raise (&mlfqs_softirq);
+}
+
+/* Softirq that applies the latest decay to the ready threads,
+   one run queue at a time with interrupts off, and yields on
+   return from the interrupt if the running thread ends up
+   outranked.  A thread whose priority changes is re-filed,
+   possibly into a queue that has yet to be walked; mlfqs_decay()
+   is a no-op the second time around, as it is for threads readied
+   meanwhile. */
+static void
+mlfqs_refile (void *aux UNUSED) {
+	unsigned c;
+	int pri;
+
+	for (c = 0; c < cpu_cnt; c++) {
+		struct runqueue *rq = &runqueues[c];
+
+		if (!rq->scheduling)
+			continue;
+		for (pri = PRI_MAX; pri >= PRI_MIN; pri--) {
+			struct list *queue = &rq->queues[pri - PRI_MIN];
+			enum intr_level old_level = intr_disable ();
+			struct list_elem *e;
+
+			spin_lock (&rq->lock);
+			e = list_begin (queue);
+			while (e != list_end (queue)) {
+				struct thread *t = list_entry (e, struct thread, elem);
+				e = list_next (e);
+
+				mlfqs_decay (t);
+				int old_priority = t->priority;
+				mlfqs_update_priority (t);
+				if (t->priority != old_priority) {
+					int new_priority = t->priority;
+					t->priority = old_priority;
+					rq_del (rq, t);
+					t->priority = new_priority;
+					rq_add (rq, t);
+				}
+			}
+			spin_unlock (&rq->lock);
+			intr_set_level (old_level);
+		}
+	}
+	thread_preempt_if_outranked ();
+}
+
+/* Applies to T every recent_cpu decay it has missed since it last
+   ran or was ready. */
+static void
+mlfqs_decay (struct thread *t) {
+	int64_t first = t->decay_epoch + 1;
+	int64_t oldest = mlfqs_seconds - MLFQS_HISTORY + 1;
+	fixed_t nice = fp_from_int (t->nice);
+	int64_t s;
+
+	if (first < oldest) {
+		/* The coefficients for seconds FIRST...OLDEST-1 are gone.
+		   Approximate them with the oldest one we still have, C,
+		   using the closed form of N steps of R = C * R + NICE:
+		   R = C^N * R + NICE * (1 - C^N) / (1 - C). */
+		fixed_t c = decay_history[oldest % MLFQS_HISTORY];
+		fixed_t cn = fp_pow (c, oldest - first);
+		t->recent_cpu = fp_mul (cn, t->recent_cpu)
+			+ fp_div (fp_mul (nice, FP_ONE - cn), FP_ONE - c);
+		first = oldest;
+	}
+	for (s = first; s <= mlfqs_seconds; s++)
+		t->recent_cpu = fp_mul (decay_history[s % MLFQS_HISTORY],
+				t->recent_cpu) + nice;
+	t->decay_epoch = mlfqs_seconds;
+}
+
+/* Recomputes T's MLFQS priority from its recent_cpu and nice. */
+static void
+mlfqs_update_priority (struct thread *t) {
+	int priority = PRI_MAX - fp_to_int (t->recent_cpu / 4) - t->nice * 2;
+
+	if (priority < PRI_MIN)
+		priority = PRI_MIN;
+	else if (priority > PRI_MAX)
+		priority = PRI_MAX;
+	t->priority = priority;
+}
+
+/* Gives up the CPU if a ready thread has a higher priority than
+   the running one.  From an external interrupt handler, the yield
+   is deferred until the handler returns. */
+void
+thread_preempt_if_outranked (void) {
+	enum intr_level old_level;
+	bool outranked;
+
+	old_level = intr_disable ();
+	outranked = ready_outranks (thread_current ());
+	intr_set_level (old_level);
+
+	if (outranked) {
+		if (intr_context ())
+			intr_yield_on_return ();
+		else
+			thread_preempt ();
+	}
 }
 
 /* Use iretq to launch the thread */
@@ -448,7 +1710,11 @@ do_iret (struct intr_frame *tf) {
 			"movw 8(%%rsp),%%ds\n"
 			"movw (%%rsp),%%es\n"
 			"addq $32, %%rsp\n"
-			"iretq"
+			"cli\n"
+			"testb $3,8(%%rsp)\n"  /* Entering user mode? */
+			"jz 1f\n"
+			"swapgs\n"
+			"1: iretq"
 			: : "g" ((uint64_t) tf) : "memory");
 }
 
@@ -464,61 +1730,11 @@ do_iret (struct intr_frame *tf) {
    added at the end of the function. */
 static void
 thread_launch (struct thread *th) {
-	uint64_t tf_cur = (uint64_t) &running_thread ()->tf;
-	uint64_t tf = (uint64_t) &th->tf;
 	ASSERT (intr_get_level () == INTR_OFF);
 
-	/* The main switching logic.
-	 * We first restore the whole execution context into the intr_frame
-	 * and then switching to the next thread by calling do_iret.
-	 * Note that, we SHOULD NOT use any stack from here
-	 * until switching is done. */
-	__asm __volatile (
-			/* Store registers that will be used. */
-			"push %%rax\n"
-			"push %%rbx\n"
-			"push %%rcx\n"
-			/* Fetch input once */
-			"movq %0, %%rax\n"
-			"movq %1, %%rcx\n"
-			"movq %%r15, 0(%%rax)\n"
-			"movq %%r14, 8(%%rax)\n"
-			"movq %%r13, 16(%%rax)\n"
-			"movq %%r12, 24(%%rax)\n"
-			"movq %%r11, 32(%%rax)\n"
-			"movq %%r10, 40(%%rax)\n"
-			"movq %%r9, 48(%%rax)\n"
-			"movq %%r8, 56(%%rax)\n"
-			"movq %%rsi, 64(%%rax)\n"
-			"movq %%rdi, 72(%%rax)\n"
-			"movq %%rbp, 80(%%rax)\n"
-			"movq %%rdx, 88(%%rax)\n"
-			"pop %%rbx\n"              // Saved rcx
-			"movq %%rbx, 96(%%rax)\n"
-			"pop %%rbx\n"              // Saved rbx
-			"movq %%rbx, 104(%%rax)\n"
-			"pop %%rbx\n"              // Saved rax
-			"movq %%rbx, 112(%%rax)\n"
-			"addq $120, %%rax\n"
-			"movw %%es, (%%rax)\n"
-			"movw %%ds, 8(%%rax)\n"
-			"addq $32, %%rax\n"
-			"call __next\n"         // read the current rip.
-			"__next:\n"
-			"pop %%rbx\n"
-			"addq $(out_iret -  __next), %%rbx\n"
-			"movq %%rbx, 0(%%rax)\n" // rip
-			"movw %%cs, 8(%%rax)\n"  // cs
-			"pushfq\n"
-			"popq %%rbx\n"
-			"mov %%rbx, 16(%%rax)\n" // eflags
-			"mov %%rsp, 24(%%rax)\n" // rsp
-			"movw %%ss, 32(%%rax)\n"
-			"mov %%rcx, %%rdi\n"
-			"call do_iret\n"
-			"out_iret:\n"
-			: : "g"(tf_cur), "g" (tf) : "memory"
-			);
+	/* A thread that ran before was switched out by switch_threads()
+	   and resumes there; a new one starts from its intr_frame. */
+	switch_threads (&running_thread ()->switch_rsp, th->switch_rsp, &th->tf);
 }
 
 /* Schedules a new process. At entry, interrupts must be off.
@@ -532,12 +1748,49 @@ do_schedule(int status) {
 	while (!list_empty (&destruction_req)) {
 		struct thread *victim =
 			list_entry (list_pop_front (&destruction_req), struct thread, elem);
-		palloc_free_page(victim);
+#ifdef USERPROG
+		/* The reaper may take a dead process, address space and
+		   all, and hand the page back with thread_release(). */
+		if (process_reap (victim))
+			continue;
+#endif
+		thread_page_put (victim);
 	}
 	thread_current ()->status = status;
 	schedule ();
 }
 
+/* Records scheduler statistics for a switch from CURR to NEXT.
+   The idle thread is left out of the histograms. */
+static void
+account_switch (struct thread *curr, struct thread *next) {
+	uint64_t now = rdtsc ();
+
+	if (curr->status == THREAD_READY && preempting) {
+		curr->involuntary_switches++;
+		involuntary_switches++;
+	} else if (curr->status != THREAD_DYING) {
+		curr->voluntary_switches++;
+		voluntary_switches++;
+	}
+	preempting = false;
+
+	if (curr->run_stamp != 0) {
+		curr->cpu_cycles += now - curr->run_stamp;
+		if (curr != idle_thread)
+			histogram_add (&run_length, now - curr->run_stamp);
+	}
+	if (next->ready_stamp != 0) {
+		uint64_t latency = now - next->ready_stamp;
+		if (next != idle_thread) {
+			histogram_add (&next->wakeup_latency, latency);
+			histogram_add (&wakeup_latency, latency);
+		}
+		next->ready_stamp = 0;
+	}
+	next->run_stamp = now;
+}
+
 static void
 schedule (void) {
 	struct thread *curr = running_thread ();
@@ -546,15 +1799,29 @@ schedule (void) {
 	ASSERT (intr_get_level () == INTR_OFF);
 	ASSERT (curr->status != THREAD_RUNNING);
 	ASSERT (is_thread (next));
+	account_switch (curr, next);
+	trace (TRACE_SWITCH, next->tid, curr->tid, curr->status);
+
 	/* Mark us as running. */
 	next->status = THREAD_RUNNING;
+	this_cpu ()->curr = next;
+
+	/* Leaving the idle thread restarts the periodic tick. */
+	if (curr == idle_thread) {
+		timer_idle_exit ();
+		if (thread_idle_poll_us != 0 && next != idle_thread)
+			idle_left_ns = timer_nsec ();
+	}
 
 	/* Start new time slice. */
 	thread_ticks = 0;
+	thread_slice = time_slice_for (next);
 
 #ifdef USERPROG
-	/* Activate the new address space. */
+	/* Activate the new address space, and let its first FPU
+	   instruction trap unless the FPU holds its state. */
 	process_activate (next);
+	fpu_switch (next);
 #endif
 
 	if (curr != next) {
@@ -576,15 +1843,110 @@ schedule (void) {
 	}
 }
 
+/* Scheduler statistics inspection, via int 0x45.
+ * Input:
+ *   @RAX - What to read: 0 for the global wakeup-latency histogram,
+ *          1 for the global run-length histogram, 2 for the running
+ *          thread's wakeup-latency histogram, 3 and 4 for the running
+ *          thread's voluntary and involuntary switch counts, 5 for the
+ *          TSC cycles it has run.
+ *   @RDX - Histogram bucket, for RAX = 0, 1, 2.
+ * Output:
+ *   @RAX - The requested count, or -1 if the input is invalid. */
+static void
+inspect_sched (struct intr_frame *f) {
+	struct thread *t = thread_current ();
+	uint64_t what = f->R.rax, bucket = f->R.rdx;
+	const struct histogram *h = NULL;
+
+	switch (what) {
+		case 0: h = &wakeup_latency; break;
+		case 1: h = &run_length; break;
+		case 2: h = &t->wakeup_latency; break;
+		case 3: f->R.rax = t->voluntary_switches; return;
+		case 4: f->R.rax = t->involuntary_switches; return;
+		case 5: f->R.rax = thread_cpu_cycles (t); return;
+	}
+	if (h != NULL && bucket < HISTOGRAM_BUCKETS)
+		f->R.rax = h->buckets[bucket];
+	else
+		f->R.rax = -1;
+}
+
+/* Reads the tick count at byte OFFSET in struct cpu, summed over
+   the CPUs. */
+static long long
+read_cpu_ticks (void *offset) {
+	long long sum = 0;
+	unsigned i;
+
+	for (i = 0; i < cpu_cnt; i++)
+		sum += *(long long *) ((char *) &cpus[i] + (size_t) offset);
+	return sum;
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) {
 	static tid_t next_tid = 1;
-	tid_t tid;
 
-	lock_acquire (&tid_lock);
-	tid = next_tid++;
-	lock_release (&tid_lock);
+	return __atomic_fetch_add (&next_tid, 1, __ATOMIC_RELAXED);
+}
 
-	return tid;
+/* Returns the live thread whose tid is TID, or a null pointer if
+   there is none.  Nothing keeps the thread alive afterward; the
+   caller must know by other means that it cannot exit meanwhile,
+   e.g. because it is a child that reports to the caller before
+   exiting. */
+struct thread *
+thread_lookup (tid_t tid) {
+	struct thread key;
+	struct hash_elem *e;
+
+	key.tid = tid;
+	lock_acquire (&registry_lock);
+	e = hash_find (&thread_registry, &key.registry_elem);
+	lock_release (&registry_lock);
+	return e != NULL ? hash_entry (e, struct thread, registry_elem) : NULL;
+}
+
+/* Invokes ACTION (T, AUX) on every live thread T, holding the
+   registry lock throughout, so ACTION must not take it.  Must not
+   be called from interrupt context. */
+void
+thread_foreach (thread_action_func *action, void *aux) {
+	struct hash_iterator i;
+
+	ASSERT (!intr_context ());
+	ASSERT (registry_ready);
+
+	lock_acquire (&registry_lock);
+	hash_first (&i, &thread_registry);
+	while (hash_next (&i))
+		action (hash_entry (hash_cur (&i), struct thread, registry_elem), aux);
+	lock_release (&registry_lock);
+}
+
+/* Adds T to the thread registry. */
+static void
+registry_add (struct thread *t) {
+	ASSERT (registry_ready);
+
+	lock_acquire (&registry_lock);
+	hash_insert (&thread_registry, &t->registry_elem);
+	lock_release (&registry_lock);
+}
+
+/* Hashes a registered thread by tid. */
+static uint64_t
+registry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct thread, registry_elem)->tid);
+}
+
+/* Orders registered threads by tid. */
+static bool
+registry_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct thread, registry_elem)->tid
+		< hash_entry (b, struct thread, registry_elem)->tid;
 }
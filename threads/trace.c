@@ -0,0 +1,140 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* Pages in the trace ring. */
+#define TRACE_PAGES 16
+
+/* One trace record. */
+struct trace_rec {
+	uint64_t tsc;               /* Time stamp counter at the event. */
+	uint32_t event;             /* enum trace_event. */
+	uint32_t a;                 /* Arguments, see trace.h. */
+	uint64_t b, c;
+};
+
+/* Event names, as "-trace" and the dump spell them. */
+static const char *event_names[TRACE_EVENT_CNT] = {
+	[TRACE_SWITCH] = "switch",
+	[TRACE_INTR] = "intr",
+	[TRACE_FAULT] = "fault",
+	[TRACE_DISK_READ] = "disk-read",
+	[TRACE_DISK_WRITE] = "disk-write",
+	[TRACE_DISK_DONE] = "disk-done",
+	[TRACE_SYSCALL] = "syscall",
+	[TRACE_REPLAY] = "replay",
+};
+
+uint32_t trace_mask;
+
+/* The ring, a power of 2 records long, or a null pointer if
+   tracing was not asked for. */
+static struct trace_rec *ring;
+static size_t ring_cnt;
+
+/* Records ever written.  The next one goes in slot
+   NEXT % RING_CNT. */
+static uint64_t next;
+
+static void trace_control (struct intr_frame *);
+
+/* Parses EVENTS, a comma-separated list of event names or "all",
+   into a mask for trace_init().  A null EVENTS, from a bare
+   "-trace", enables no events yet; user programs can enable them
+   later.  Panics on an unknown name. */
+uint32_t
+trace_parse (char *events) {
+	uint32_t mask = 0;
+	char *name, *save_ptr;
+
+	if (events == NULL)
+		return 0;
+	for (name = strtok_r (events, ",", &save_ptr); name != NULL;
+			name = strtok_r (NULL, ",", &save_ptr)) {
+		int e;
+
+		if (!strcmp (name, "all")) {
+			mask = TRACE_BIT (TRACE_EVENT_CNT) - 1;
+			continue;
+		}
+		for (e = 0; e < TRACE_EVENT_CNT; e++)
+			if (!strcmp (name, event_names[e]))
+				break;
+		if (e == TRACE_EVENT_CNT)
+			PANIC ("bad -trace event `%s'", name);
+		mask |= TRACE_BIT (e);
+	}
+	return mask;
+}
+
+/* Allocates the trace ring and starts recording the events in
+   MASK.  Must follow palloc_init() and intr_init(). */
+void
+trace_init (uint32_t mask) {
+	ring = palloc_get_multiple (PAL_ZERO, TRACE_PAGES);
+	if (ring == NULL)
+		PANIC ("no memory for trace ring");
+	ring_cnt = TRACE_PAGES * PGSIZE / sizeof *ring;
+	ASSERT ((ring_cnt & (ring_cnt - 1)) == 0);
+
+	intr_register_int (0x4a, 3, INTR_OFF, trace_control, "Trace Control");
+	trace_mask = mask;
+}
+
+/* Appends a record of EVENT with arguments A, B and C.  Safe to
+   call from interrupt handlers, which may interrupt another
+   call: each call claims its own slot first. */
+void
+trace_record (enum trace_event event, uint32_t a, uint64_t b, uint64_t c) {
+	uint64_t slot = __atomic_fetch_add (&next, 1, __ATOMIC_RELAXED);
+	struct trace_rec *r = &ring[slot & (ring_cnt - 1)];
+
+	r->tsc = rdtsc ();
+	r->event = event;
+	r->a = a;
+	r->b = b;
+	r->c = c;
+}
+
+/* Prints the records in the ring, oldest first, one per line, if
+   tracing was asked for.  A record claimed but not yet filled in
+   when its writer was interrupted can come out of TSC order;
+   utils/pintos-trace sorts them. */
+void
+trace_dump (void) {
+	uint64_t end, i;
+
+	if (ring == NULL)
+		return;
+	trace_mask = 0;
+	end = next;
+	i = end > ring_cnt ? end - ring_cnt : 0;
+	printf ("Trace: %"PRIu64" events, %"PRIu64" kept.\n", end, end - i);
+	for (; i < end; i++) {
+		const struct trace_rec *r = &ring[i & (ring_cnt - 1)];
+
+		if (r->event < TRACE_EVENT_CNT)
+			printf ("trace: %"PRIx64" %s %"PRIx32" %"PRIx64" %"PRIx64"\n",
+					r->tsc, event_names[r->event], r->a, r->b, r->c);
+	}
+}
+
+/* Trace control, via int 0x4a.
+ * Input:
+ *   @RAX - New trace mask, or -1 to leave it as it is.
+ * Output:
+ *   @RAX - The old mask. */
+static void
+trace_control (struct intr_frame *f) {
+	uint32_t old = trace_mask;
+
+	if (f->R.rax != (uint64_t) -1)
+		trace_mask = f->R.rax & (TRACE_BIT (TRACE_EVENT_CNT) - 1);
+	f->R.rax = old;
+}
@@ -0,0 +1,384 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Ticks a worker other than the last waits for work before it
+   exits. */
+#define WORKER_IDLE_TICKS TIMER_FREQ
+
+/* Most workers of the system workqueue. */
+#define SYSTEM_WQ_WORKERS 4
+
+/* A work being run, on its worker's stack and in its queue's BUSY
+   list.  cancel_work() waits while its work is named in one.  The
+   struct work itself is not touched once a worker has taken it,
+   since its function may free it. */
+struct busy_work {
+	struct list_elem elem;      /* In BUSY. */
+	const struct work *work;    /* Work being run. */
+};
+
+struct workqueue system_wq;
+
+static struct list workqueues;          /* All workqueues. */
+static struct kmem_cache *work_cache;   /* For queue_work(). */
+
+static void worker (void *wq_);
+static bool start_worker (struct workqueue *);
+static bool should_grow (struct workqueue *);
+static struct work *take_work (struct workqueue *);
+static void run_due (struct workqueue *, int64_t now);
+static bool work_busy (struct workqueue *, const struct work *);
+static bool due_less (const struct list_elem *, const struct list_elem *,
+		void *aux);
+
+/* Sets up workqueues and starts the system workqueue.  Must be
+   called after thread_start(). */
+void
+workqueue_init (void) {
+	list_init (&workqueues);
+	work_cache = kmem_cache_create ("work", sizeof (struct work), 0, NULL);
+	if (work_cache == NULL)
+		PANIC ("workqueue_init: out of memory");
+	workqueue_create (&system_wq, "events", PRI_DEFAULT, SYSTEM_WQ_WORKERS);
+}
+
+/* Initializes WQ, named NAME, to run work in up to MAX_WORKERS
+   threads of PRIORITY, and starts its first worker.  Must be
+   called from a kernel thread. */
+void
+workqueue_create (struct workqueue *wq, const char *name, int priority,
+		unsigned max_workers) {
+	ASSERT (wq != NULL);
+	ASSERT (max_workers > 0);
+	ASSERT (!intr_context ());
+
+	wq->name = name;
+	wq->priority = priority;
+	wq->max_workers = max_workers;
+	list_init (&wq->pending);
+	list_init (&wq->delayed);
+	list_init (&wq->busy);
+	wq->workers = wq->idle = 0;
+	wait_queue_init (&wq->more);
+	wait_queue_init (&wq->done);
+	wq->ran = wq->delays = 0;
+	wq->peak_workers = 0;
+	list_push_back (&workqueues, &wq->elem);
+
+	if (!start_worker (wq))
+		PANIC ("%s: cannot start worker", name);
+}
+
+/* Prints one line per workqueue. */
+void
+workqueue_print_stats (void) {
+	struct list_elem *e;
+
+	if (work_cache == NULL)
+		return;
+	for (e = list_begin (&workqueues); e != list_end (&workqueues);
+			e = list_next (e)) {
+		const struct workqueue *wq = list_entry (e, struct workqueue, elem);
+
+		printf ("Workqueue: %s: %lld works run, %lld delayed, "
+				"%u workers (peak %u of %u)\n", wq->name, wq->ran,
+				wq->delays, wq->workers, wq->peak_workers, wq->max_workers);
+	}
+}
+
+/* Initializes W to run FUNC (AUX) when queued. */
+void
+work_init (struct work *w, work_func *func, void *aux) {
+	ASSERT (w != NULL);
+	ASSERT (func != NULL);
+
+	w->func = func;
+	w->aux = aux;
+	w->wq = NULL;
+	w->state = WORK_IDLE;
+	w->due = 0;
+	w->oneshot = false;
+}
+
+/* Queues FUNC (AUX) to run once on WQ.  Returns false if out of
+   memory. */
+bool
+queue_work (struct workqueue *wq, work_func *func, void *aux) {
+	struct work *w = kmem_cache_alloc (work_cache);
+
+	if (w == NULL)
+		return false;
+	work_init (w, func, aux);
+	w->oneshot = true;
+	return queue_work_item (wq, w);
+}
+
+/* Queues W to run on WQ.  Returns false, doing nothing, if W is
+   already queued.  Only a caller with interrupts on can start
+   another worker for it. */
+bool
+queue_work_item (struct workqueue *wq, struct work *w) {
+	enum intr_level old_level;
+	bool grow;
+
+	ASSERT (wq != NULL);
+	ASSERT (w != NULL);
+
+	old_level = intr_disable ();
+	if (w->state != WORK_IDLE) {
+		intr_set_level (old_level);
+		return false;
+	}
+	w->wq = wq;
+	w->state = WORK_PENDING;
+	list_push_back (&wq->pending, &w->elem);
+	if (wait_queue_wake_one (&wq->more))
+		wq->idle--;
+	grow = old_level == INTR_ON && !intr_context () && should_grow (wq);
+	intr_set_level (old_level);
+
+	if (grow)
+		start_worker (wq);
+	return true;
+}
+
+/* Queues W to run on WQ once TICKS timer ticks have passed, or
+   right away if TICKS is not positive.  Returns false, doing
+   nothing, if W is already queued. */
+bool
+queue_delayed_work (struct workqueue *wq, struct work *w, int64_t ticks) {
+	enum intr_level old_level;
+
+	ASSERT (wq != NULL);
+	ASSERT (w != NULL);
+
+	if (ticks <= 0)
+		return queue_work_item (wq, w);
+
+	old_level = intr_disable ();
+	if (w->state != WORK_IDLE) {
+		intr_set_level (old_level);
+		return false;
+	}
+	w->wq = wq;
+	w->state = WORK_DELAYED;
+	w->due = timer_ticks () + ticks;
+	list_insert_ordered (&wq->delayed, &w->elem, due_less, NULL);
+	wq->delays++;
+
+	/* A new earliest deadline: have an idle worker wait anew. */
+	if (list_front (&wq->delayed) == &w->elem
+			&& wait_queue_wake_one (&wq->more))
+		wq->idle--;
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Takes W off its queue if it is waiting there, and returns true
+   if it was.  If W is running, waits for it to finish first,
+   unless called from an interrupt handler.  Must not be called by
+   W's own function. */
+bool
+cancel_work (struct work *w) {
+	enum intr_level old_level;
+	bool queued;
+
+	ASSERT (w != NULL);
+	ASSERT (!w->oneshot);
+
+	old_level = intr_disable ();
+	queued = w->state != WORK_IDLE;
+	if (queued) {
+		list_remove (&w->elem);
+		w->state = WORK_IDLE;
+	}
+	if (w->wq != NULL && !intr_context ())
+		while (work_busy (w->wq, w))
+			wait_queue_wait (&w->wq->done, 0);
+	intr_set_level (old_level);
+	return queued;
+}
+
+/* Waits until WQ has no work left to run, not counting delayed
+   work that is not yet due.  Must not be called from one of WQ's
+   own works. */
+void
+flush_workqueue (struct workqueue *wq) {
+	enum intr_level old_level;
+
+	ASSERT (wq != NULL);
+	ASSERT (!intr_context ());
+
+	old_level = intr_disable ();
+	while (!list_empty (&wq->pending) || !list_empty (&wq->busy))
+		wait_queue_wait (&wq->done, 0);
+	intr_set_level (old_level);
+}
+
+/* A worker thread of workqueue WQ_. */
+static void
+worker (void *wq_) {
+	struct workqueue *wq = wq_;
+
+	for (;;) {
+		struct busy_work busy;
+		struct work *w;
+		work_func *func;
+		void *aux;
+		bool grow;
+
+		intr_disable ();
+		w = take_work (wq);
+		if (w == NULL) {
+			wq->workers--;
+			intr_enable ();
+			return;
+		}
+		list_remove (&w->elem);
+		w->state = WORK_IDLE;
+		func = w->func;
+		aux = w->aux;
+		busy.work = w;
+		list_push_back (&wq->busy, &busy.elem);
+		grow = should_grow (wq);
+		intr_enable ();
+
+		if (w->oneshot)
+			kmem_cache_free (work_cache, w);
+		if (grow)
+			start_worker (wq);
+		func (aux);
+
+		intr_disable ();
+		list_remove (&busy.elem);
+		wq->ran++;
+		wait_queue_wake_all (&wq->done);
+		intr_enable ();
+	}
+}
+
+/* Starts one more worker for WQ, unless it has MAX_WORKERS
+   already.  Returns true if successful.  Must be called with
+   interrupts on. */
+static bool
+start_worker (struct workqueue *wq) {
+	enum intr_level old_level = intr_disable ();
+	bool ok = wq->workers < wq->max_workers;
+
+	if (ok) {
+		wq->workers++;
+		if (wq->workers > wq->peak_workers)
+			wq->peak_workers = wq->workers;
+	}
+	intr_set_level (old_level);
+	if (!ok)
+		return false;
+
+	if (thread_create (wq->name, wq->priority, worker, wq) != TID_ERROR)
+		return true;
+	old_level = intr_disable ();
+	wq->workers--;
+	intr_set_level (old_level);
+	return false;
+}
+
+/* Returns true if WQ has work waiting, no idle worker to take it,
+   and room for another worker.  Interrupts must be off. */
+static bool
+should_grow (struct workqueue *wq) {
+	return !list_empty (&wq->pending) && wq->idle == 0
+		&& wq->workers < wq->max_workers;
+}
+
+/* Waits for work on WQ and returns it, still on PENDING, or
+   returns a null pointer if the calling worker should exit: it
+   has been idle for WORKER_IDLE_TICKS and is not the last.
+   Interrupts must be off; they are turned on and off again while
+   waiting. */
+static struct work *
+take_work (struct workqueue *wq) {
+	bool reserved = false;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (;;) {
+		int64_t now = timer_ticks ();
+		int64_t timeout = 0;
+		bool may_exit = false;
+
+		run_due (wq, now);
+		if (!list_empty (&wq->pending))
+			return list_entry (list_front (&wq->pending), struct work, elem);
+
+		if (!list_empty (&wq->delayed))
+			timeout = list_entry (list_front (&wq->delayed),
+					struct work, elem)->due - now;
+		if (wq->workers > 1 && (timeout == 0 || timeout > WORKER_IDLE_TICKS)) {
+			timeout = WORKER_IDLE_TICKS;
+			may_exit = true;
+		}
+
+		/* A timed wait needs room in the sleep queue.  Making room
+		   turns interrupts on, so look again afterward. */
+		if (timeout > 0 && !reserved) {
+			intr_enable ();
+			if (timer_reserve ())
+				reserved = true;
+			else {
+				timer_sleep (1);
+				intr_disable ();
+			}
+			continue;
+		}
+
+		wq->idle++;
+		if (!wait_queue_wait (&wq->more, timeout)) {
+			wq->idle--;
+			if (may_exit && list_empty (&wq->pending) && wq->workers > 1)
+				return NULL;
+		}
+		reserved = false;
+	}
+}
+
+/* Moves the delayed works of WQ that are due at tick NOW to
+   PENDING.  Interrupts must be off. */
+static void
+run_due (struct workqueue *wq, int64_t now) {
+	while (!list_empty (&wq->delayed)) {
+		struct work *w = list_entry (list_front (&wq->delayed),
+				struct work, elem);
+
+		if (w->due > now)
+			break;
+		list_pop_front (&wq->delayed);
+		w->state = WORK_PENDING;
+		list_push_back (&wq->pending, &w->elem);
+	}
+}
+
+/* Returns true if a worker of WQ is running W.  Interrupts must
+   be off. */
+static bool
+work_busy (struct workqueue *wq, const struct work *w) {
+	struct list_elem *e;
+
+	for (e = list_begin (&wq->busy); e != list_end (&wq->busy);
+			e = list_next (e))
+		if (list_entry (e, struct busy_work, elem)->work == w)
+			return true;
+	return false;
+}
+
+/* Orders works by due tick, earliest first. */
+static bool
+due_less (const struct list_elem *a, const struct list_elem *b,
+		void *aux UNUSED) {
+	return list_entry (a, struct work, elem)->due
+		< list_entry (b, struct work, elem)->due;
+}
@@ -0,0 +1,272 @@
+/* Asynchronous file I/O.
+
+   aio_read() and aio_write() hand a positional read or write to a
+   pool of kernel workers and return at once, so that the process
+   computes while the disk works.  A worker cannot reach the
+   process's memory, so each request carries a kernel buffer: a
+   write's data is copied into it at submission, and a read's data
+   is copied out of it when the request is delivered.
+
+   Delivery happens in the process: aio_wait() on a request's
+   status word sleeps until a worker finishes it, then copies out
+   the data, stores the result in the status word and wakes any
+   futex waiters on that word.  Every aio call also delivers
+   whatever else has finished, so a process that polls its status
+   words sees them change without waiting on each one. */
+
+#include "userprog/aio.h"
+#include <aio.h>
+#include <debug.h>
+#include <limits.h>
+#include <list.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+#include "userprog/futex.h"
+#include "userprog/process.h"
+#include "userprog/uaccess.h"
+
+/* Workers for all processes' requests. */
+#define AIO_WORKERS 8
+
+/* A process's requests in flight. */
+struct aio_context {
+	struct list reqs;           /* struct aio_req, oldest first. */
+	unsigned cnt;               /* Elements in REQS. */
+	struct wait_queue done;     /* Owner waiting in aio_wait(). */
+};
+
+/* One request. */
+struct aio_req {
+	struct list_elem elem;      /* In its context's REQS. */
+	struct work work;           /* Queued on aio_wq. */
+	struct aio_context *ctx;    /* Owner's context. */
+	struct file *file;          /* Held for the request's life. */
+	bool write;                 /* aio_write()? */
+	void *ubuf;                 /* User buffer. */
+	int *ustatus;               /* User status word. */
+	void *buf;                  /* Kernel copy of the data. */
+	size_t size;                /* Bytes to move. */
+	off_t ofs;                  /* File offset. */
+	off_t result;               /* Bytes moved, once DONE. */
+	bool done;                  /* Finished by a worker? */
+};
+
+static struct workqueue aio_wq;
+
+static work_func aio_run;
+static struct aio_context *aio_context (void);
+static struct aio_req *aio_find (struct aio_context *, int *ustatus);
+static int aio_reap (struct aio_context *);
+static int aio_deliver (struct aio_req *);
+static void aio_free (struct aio_req *);
+
+/* Starts the workers.  Must be called after workqueue_init(). */
+void
+aio_init (void) {
+	workqueue_create (&aio_wq, "aio", PRI_DEFAULT, AIO_WORKERS);
+}
+
+/* Queues a read, or if WRITE a write, of SIZE bytes between FD's
+   file at offset OFS and user buffer UBUF, and sets user word
+   USTATUS to AIO_INPROGRESS.  Returns 0, or -1 if the arguments
+   are bad, USTATUS names a request already in flight, or the
+   process has AIO_MAX requests in flight. */
+int
+aio_submit (int fd, void *ubuf, size_t size, off_t ofs, int *ustatus,
+		bool write) {
+	struct aio_context *ctx = aio_context ();
+	struct file *file = process_fd_get (fd);
+	int status = AIO_INPROGRESS;
+	struct aio_req *req;
+
+	if (ctx == NULL)
+		return -1;
+	aio_reap (ctx);
+	if (!fd_is_file (file) || ofs < 0
+			|| size > AIO_SIZE_MAX || ctx->cnt >= AIO_MAX
+			|| ((uintptr_t) ustatus & (sizeof *ustatus - 1)) != 0
+			|| !user_access_ok (ustatus, sizeof *ustatus, true)
+			|| !user_access_ok (ubuf, size, !write)
+			|| aio_find (ctx, ustatus) != NULL)
+		return -1;
+
+	req = malloc (sizeof *req);
+	if (req == NULL)
+		return -1;
+	req->buf = size > 0 ? malloc (size) : NULL;
+	if (size > 0 && req->buf == NULL) {
+		free (req);
+		return -1;
+	}
+	if ((write && !copy_from_user (req->buf, ubuf, size))
+			|| !copy_to_user (ustatus, &status, sizeof status)) {
+		free (req->buf);
+		free (req);
+		return -1;
+	}
+	req->ctx = ctx;
+	req->file = file_dup (file);
+	req->write = write;
+	req->ubuf = ubuf;
+	req->ustatus = ustatus;
+	req->size = size;
+	req->ofs = ofs;
+	req->result = -1;
+	req->done = false;
+	work_init (&req->work, aio_run, req);
+	list_push_back (&ctx->reqs, &req->elem);
+	ctx->cnt++;
+	queue_work_item (&aio_wq, &req->work);
+	return 0;
+}
+
+/* Waits for the request whose status word is USTATUS, delivers
+   it, and returns its result, or -1 if no such request is in
+   flight.  With a null USTATUS, delivers the requests that have
+   finished, without waiting, and returns how many it delivered. */
+int
+aio_wait (int *ustatus) {
+	struct aio_context *ctx = aio_context ();
+	struct aio_req *req;
+	int n;
+
+	if (ctx == NULL)
+		return -1;
+	n = aio_reap (ctx);
+	if (ustatus == NULL)
+		return n;
+	req = aio_find (ctx, ustatus);
+	if (req == NULL)
+		return -1;
+
+	intr_disable ();
+	while (!req->done)
+		wait_queue_wait (&ctx->done, 0);
+	intr_enable ();
+	return aio_deliver (req);
+}
+
+/* Drops the current process's requests, letting any that are
+   running finish first.  Nothing is delivered. */
+void
+aio_exit (void) {
+	struct thread *t = thread_current ();
+	struct aio_context *ctx = t->aio;
+
+	if (ctx == NULL)
+		return;
+	while (!list_empty (&ctx->reqs)) {
+		struct aio_req *req = list_entry (list_front (&ctx->reqs),
+				struct aio_req, elem);
+
+		cancel_work (&req->work);
+		aio_free (req);
+	}
+	free (ctx);
+	t->aio = NULL;
+}
+
+/* Runs request REQ_ in a worker. */
+static void
+aio_run (void *req_) {
+	struct aio_req *req = req_;
+	struct inode *inode = file_get_inode (req->file);
+	off_t n;
+
+	inode_lock (inode, req->write);
+	n = req->write ? file_write_at (req->file, req->buf, req->size, req->ofs)
+		: file_read_at (req->file, req->buf, req->size, req->ofs);
+	inode_unlock (inode, req->write);
+
+	intr_disable ();
+	req->result = n;
+	req->done = true;
+	wait_queue_wake_all (&req->ctx->done);
+	intr_enable ();
+}
+
+/* Returns the current process's context, creating it if needed,
+   or a null pointer if out of memory. */
+static struct aio_context *
+aio_context (void) {
+	struct thread *t = thread_current ();
+
+	if (t->aio == NULL) {
+		t->aio = malloc (sizeof *t->aio);
+		if (t->aio == NULL)
+			return NULL;
+		list_init (&t->aio->reqs);
+		t->aio->cnt = 0;
+		wait_queue_init (&t->aio->done);
+	}
+	return t->aio;
+}
+
+/* Returns CTX's request with status word USTATUS, or a null
+   pointer. */
+static struct aio_req *
+aio_find (struct aio_context *ctx, int *ustatus) {
+	struct list_elem *e;
+
+	for (e = list_begin (&ctx->reqs); e != list_end (&ctx->reqs);
+			e = list_next (e)) {
+		struct aio_req *req = list_entry (e, struct aio_req, elem);
+
+		if (req->ustatus == ustatus)
+			return req;
+	}
+	return NULL;
+}
+
+/* Delivers CTX's finished requests and returns how many. */
+static int
+aio_reap (struct aio_context *ctx) {
+	struct list_elem *e, *next;
+	int n = 0;
+
+	for (e = list_begin (&ctx->reqs); e != list_end (&ctx->reqs); e = next) {
+		struct aio_req *req = list_entry (e, struct aio_req, elem);
+
+		next = list_next (e);
+		if (__atomic_load_n (&req->done, __ATOMIC_ACQUIRE)) {
+			aio_deliver (req);
+			n++;
+		}
+	}
+	return n;
+}
+
+/* Copies finished request REQ's data and result out to the user,
+   wakes futex waiters on its status word, frees it, and returns
+   its result, or -1 if the user's memory has gone away. */
+static int
+aio_deliver (struct aio_req *req) {
+	int *ustatus = req->ustatus;
+	int result = req->result;
+
+	ASSERT (req->done);
+
+	if (!req->write && result > 0
+			&& !copy_to_user (req->ubuf, req->buf, result))
+		result = -1;
+	aio_free (req);
+	if (copy_to_user (ustatus, &result, sizeof result))
+		futex_wake ((uint32_t *) ustatus, INT_MAX);
+	return result;
+}
+
+/* Takes REQ, which no worker may be running, off its context and
+   frees it. */
+static void
+aio_free (struct aio_req *req) {
+	list_remove (&req->elem);
+	req->ctx->cnt--;
+	file_close (req->file);
+	free (req->buf);
+	free (req);
+}
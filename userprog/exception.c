@@ -1,16 +1,43 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include "userprog/gdt.h"
+#include "userprog/uaccess.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "intrinsic.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+/* Lazy FPU switching.
+
+   The FPU and SSE registers are not saved or restored on a context
+   switch.  Instead, fpu_switch() sets CR0.TS unless the incoming
+   thread's state is the one the CPU holds, so that the thread's
+   first FPU or SSE instruction raises #NM.  fpu_trap() then saves
+   the previous owner's registers, loads the thread's, and clears
+   TS.  A thread that never touches the FPU costs nothing and has
+   no save area; one that does gets its area at its first trap.
+
+   The kernel is built without SSE or floating point, so only user
+   code traps.  The state lives in one CPU's registers, which holds
+   while the boot processor alone runs threads; a thread moved to
+   another CPU would first have to have its state saved. */
+#define FPU_SIZE 512                /* Bytes FXSAVE stores. */
+static struct kmem_cache *fpu_cache;
+static uint8_t fpu_init_state[FPU_SIZE] __attribute__ ((aligned (16)));
+static long long fpu_traps;         /* #NM traps taken. */
+static long long fpu_saves;         /* Another thread's state saved. */
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void fpu_init (void);
+static void fpu_trap (struct intr_frame *);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -45,7 +72,8 @@ exception_init (void) {
 	intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
 	intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
 	intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-	intr_register_int (7, 0, INTR_ON, kill,
+	fpu_init ();
+	intr_register_int (7, 0, INTR_ON, fpu_trap,
 			"#NM Device Not Available Exception");
 	intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
 	intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
@@ -64,6 +92,92 @@ exception_init (void) {
 void
 exception_print_stats (void) {
 	printf ("Exception: %lld page faults\n", page_fault_cnt);
+	if (fpu_traps > 0)
+		printf ("Exception: %lld FPU traps, %lld FPU saves\n", fpu_traps,
+				fpu_saves);
+}
+
+/* Enables FXSAVE and SSE, records the state a thread's FPU starts
+   in, and leaves TS set so that the first use traps. */
+static void
+fpu_init (void) {
+	fpu_cache = kmem_cache_create ("fpu", FPU_SIZE, 16, NULL);
+	if (fpu_cache == NULL)
+		PANIC ("fpu_init: out of memory");
+	lcr4 (rcr4 () | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	lcr0 ((rcr0 () & ~(uint64_t) (CR0_EM | CR0_TS)) | CR0_MP);
+	asm volatile ("fninit; fxsave64 %0" : "=m" (fpu_init_state));
+	lcr0 (rcr0 () | CR0_TS);
+}
+
+/* Prepares the running CPU's FPU for NEXT: clears TS if the CPU
+   holds NEXT's state, and sets it otherwise.  Interrupts must be
+   off. */
+void
+fpu_switch (struct thread *next) {
+	uint64_t cr0 = rcr0 ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (this_cpu ()->fpu_owner == next) {
+		if (cr0 & CR0_TS)
+			asm volatile ("clts");
+	} else if (!(cr0 & CR0_TS))
+		lcr0 (cr0 | CR0_TS);
+}
+
+/* Frees T's FPU save area, forgetting its state if the CPU holds
+   it.  T must be the running thread or dead. */
+void
+fpu_release (struct thread *t) {
+	enum intr_level old_level;
+	struct cpu *c;
+
+	if (t->fpu == NULL)
+		return;
+	old_level = intr_disable ();
+	c = this_cpu ();
+	if (c->fpu_owner == t) {
+		c->fpu_owner = NULL;
+		lcr0 (rcr0 () | CR0_TS);
+	}
+	intr_set_level (old_level);
+	kmem_cache_free (fpu_cache, t->fpu);
+	t->fpu = NULL;
+}
+
+/* #NM handler: hands the FPU to the running thread. */
+static void
+fpu_trap (struct intr_frame *f) {
+	struct thread *t = thread_current ();
+	enum intr_level old_level;
+	struct cpu *c;
+
+	if (f->cs != SEL_UCSEG)
+		kill (f);
+	if (t->fpu == NULL) {
+		t->fpu = kmem_cache_alloc (fpu_cache);
+		if (t->fpu == NULL) {
+			printf ("%s: out of memory for FPU state\n", thread_name ());
+			thread_exit ();
+		}
+		memcpy (t->fpu, fpu_init_state, FPU_SIZE);
+	}
+
+	old_level = intr_disable ();
+	c = this_cpu ();
+	asm volatile ("clts");
+	if (c->fpu_owner != t) {
+		if (c->fpu_owner != NULL) {
+			asm volatile ("fxsave64 (%0)" : : "r" (c->fpu_owner->fpu)
+					: "memory");
+			fpu_saves++;
+		}
+		asm volatile ("fxrstor64 (%0)" : : "r" (t->fpu) : "memory");
+		c->fpu_owner = t;
+	}
+	fpu_traps++;
+	intr_set_level (old_level);
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -129,6 +243,7 @@ page_fault (struct intr_frame *f) {
 	   that caused the fault (that's f->rip). */
 
 	fault_addr = (void *) rcr2();
+	trace (TRACE_FAULT, f->error_code, (uint64_t) fault_addr, f->rip);
 
 	/* Turn interrupts back on (they were only off so that we could
 	   be assured of reading CR2 before it changed). */
@@ -146,6 +261,10 @@ page_fault (struct intr_frame *f) {
 		return;
 #endif
 
+	/* A bad user pointer passed to the kernel fails the copy. */
+	if (!user && uaccess_fixup (f))
+		return;
+
 	/* Count page faults. */
 	page_fault_cnt++;
 
@@ -0,0 +1,242 @@
+/* Futex-style wait/wake for user programs.
+
+   A user program builds its own locks out of a 32-bit word in its
+   address space and only enters the kernel when it has to sleep
+   (futex_wait) or when it knows some thread is sleeping
+   (futex_wake).  Sleepers are queued by the *physical* address of
+   the word, so two processes sharing a frame use the same queue
+   even if the word is mapped at different virtual addresses.
+
+   All queues live in one hash table guarded by FUTEX_LOCK.  The
+   value comparison in futex_wait and the enqueue happen under that
+   lock, and futex_wake takes it too, so a wake that follows the
+   user's store can never slip in between the check and the sleep.
+
+   The key is only stable while the frame stays resident; a page
+   that is evicted while threads sleep on it would strand them.
+   A frame that compaction moves takes its queues along: the VM
+   calls futex_rekey() between futex_freeze() and futex_thaw(),
+   and both calls here check, under FUTEX_LOCK, that the word has
+   not moved since they looked it up. */
+
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
+
+/* Threads waiting on one physical word. */
+struct futex_queue {
+	struct hash_elem elem;      /* Element in FUTEXES. */
+	uint64_t key;               /* Physical address of the word. */
+	struct list waiters;        /* List of struct futex_waiter. */
+};
+
+/* One sleeping thread, allocated on its own stack. */
+struct futex_waiter {
+	struct list_elem elem;      /* Element in futex_queue's waiters. */
+	struct semaphore sema;      /* Upped by futex_wake. */
+};
+
+static struct hash futexes;
+static struct lock futex_lock;
+
+static hash_hash_func futex_hash;
+static hash_less_func futex_less;
+static uint32_t *futex_resolve (uint32_t *uaddr);
+static uint32_t *futex_lock_word (uint32_t *uaddr);
+static struct futex_queue *futex_find (uint64_t key);
+
+/* Initializes the futex table. */
+void
+futex_init (void) {
+	hash_init (&futexes, futex_hash, futex_less, NULL);
+	lock_init (&futex_lock);
+}
+
+/* If *UADDR still equals EXPECTED, puts the current thread to
+   sleep until a futex_wake on the same word.  Returns 0 after
+   being woken, or -1 if UADDR is invalid or the value had already
+   changed (the caller should re-check and retry). */
+int
+futex_wait (uint32_t *uaddr, uint32_t expected) {
+	struct futex_waiter w;
+	struct futex_queue *q;
+	uint32_t *kaddr;
+
+	kaddr = futex_lock_word (uaddr);
+	if (kaddr == NULL)
+		return -1;
+
+	if (*(volatile uint32_t *) kaddr != expected) {
+		lock_release (&futex_lock);
+		return -1;
+	}
+
+	q = futex_find (vtop (kaddr));
+	if (q == NULL) {
+		q = malloc (sizeof *q);
+		if (q == NULL) {
+			lock_release (&futex_lock);
+			return -1;
+		}
+		q->key = vtop (kaddr);
+		list_init (&q->waiters);
+		hash_insert (&futexes, &q->elem);
+	}
+	sema_init (&w.sema, 0);
+	list_push_back (&q->waiters, &w.elem);
+	lock_release (&futex_lock);
+
+	sema_down (&w.sema);
+	return 0;
+}
+
+/* Wakes up to N threads sleeping on UADDR, oldest first.
+   Returns the number of threads woken, or -1 if UADDR is
+   invalid. */
+int
+futex_wake (uint32_t *uaddr, int n) {
+	struct futex_queue *q;
+	uint32_t *kaddr;
+	int woken = 0;
+
+	kaddr = futex_lock_word (uaddr);
+	if (kaddr == NULL)
+		return -1;
+
+	q = futex_find (vtop (kaddr));
+	if (q != NULL) {
+		while (woken < n && !list_empty (&q->waiters)) {
+			struct futex_waiter *w = list_entry (list_pop_front (&q->waiters),
+					struct futex_waiter, elem);
+			sema_up (&w->sema);
+			woken++;
+		}
+		if (list_empty (&q->waiters)) {
+			hash_delete (&futexes, &q->elem);
+			free (q);
+		}
+	}
+	lock_release (&futex_lock);
+	return woken;
+}
+
+/* Translates user address UADDR into the kernel virtual address
+   of the same word, faulting the page in if necessary.  Returns
+   a null pointer if UADDR is not a valid, aligned user word. */
+static uint32_t *
+futex_resolve (uint32_t *uaddr) {
+	struct thread *t = thread_current ();
+	void *kva;
+
+	if (uaddr == NULL || !is_user_vaddr (uaddr)
+			|| ((uintptr_t) uaddr & (sizeof *uaddr - 1)) != 0)
+		return NULL;
+
+	kva = pml4_get_page (t->pml4, uaddr);
+#ifdef VM
+	if (kva == NULL && vm_claim_page (pg_round_down (uaddr)))
+		kva = pml4_get_page (t->pml4, uaddr);
+#endif
+	return kva;
+}
+
+/* Resolves UADDR as futex_resolve() does and acquires FUTEX_LOCK,
+   looking the word up again if its frame moved meanwhile.  Returns
+   the word's kernel virtual address with FUTEX_LOCK held, or a
+   null pointer, without it, if UADDR is invalid. */
+static uint32_t *
+futex_lock_word (uint32_t *uaddr) {
+	for (;;) {
+		uint32_t *kaddr = futex_resolve (uaddr);
+
+		if (kaddr == NULL)
+			return NULL;
+		lock_acquire (&futex_lock);
+		if (pml4_get_page (thread_current ()->pml4, uaddr) == kaddr)
+			return kaddr;
+		lock_release (&futex_lock);
+	}
+}
+
+/* Holds off futex_wait() and futex_wake() until futex_thaw(), for
+   a caller about to move frames with futex_rekey(). */
+void
+futex_freeze (void) {
+	lock_acquire (&futex_lock);
+}
+
+/* Lets futex_wait() and futex_wake() proceed again. */
+void
+futex_thaw (void) {
+	lock_release (&futex_lock);
+}
+
+/* Moves the threads sleeping on words of the page at physical
+   address OLD_PA to the same words of the page at NEW_PA, whose
+   contents are a copy.  Must be called between futex_freeze() and
+   futex_thaw(), with the page's mapping already changed. */
+void
+futex_rekey (uint64_t old_pa, uint64_t new_pa) {
+	struct hash_iterator i;
+
+	ASSERT (lock_held_by_current_thread (&futex_lock));
+
+	/* Start over after each change, which invalidates I.  Few
+	   futexes are queued at once. */
+restart:
+	hash_first (&i, &futexes);
+	while (hash_next (&i)) {
+		struct futex_queue *q = hash_entry (hash_cur (&i),
+				struct futex_queue, elem);
+		struct futex_queue *into;
+
+		if (q->key < old_pa || q->key >= old_pa + PGSIZE)
+			continue;
+		hash_delete (&futexes, &q->elem);
+		into = futex_find (new_pa + (q->key - old_pa));
+		if (into != NULL) {
+			while (!list_empty (&q->waiters))
+				list_push_back (&into->waiters, list_pop_front (&q->waiters));
+			free (q);
+		} else {
+			q->key = new_pa + (q->key - old_pa);
+			hash_insert (&futexes, &q->elem);
+		}
+		goto restart;
+	}
+}
+
+/* Returns the queue for physical address KEY, or a null pointer
+   if nobody is waiting there.  Must hold FUTEX_LOCK. */
+static struct futex_queue *
+futex_find (uint64_t key) {
+	struct futex_queue probe;
+	struct hash_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&futex_lock));
+	probe.key = key;
+	e = hash_find (&futexes, &probe.elem);
+	return e != NULL ? hash_entry (e, struct futex_queue, elem) : NULL;
+}
+
+static uint64_t
+futex_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct futex_queue *q = hash_entry (e, struct futex_queue, elem);
+	return hash_bytes (&q->key, sizeof q->key);
+}
+
+static bool
+futex_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct futex_queue, elem)->key
+		< hash_entry (b, struct futex_queue, elem)->key;
+}
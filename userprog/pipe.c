@@ -0,0 +1,211 @@
+/* Pipes.
+
+   A pipe is a ring buffer of PIPE_PAGES kernel pages with a read
+   end and a write end, each of which may be held by any number of
+   descriptors, in any processes, through dup2() and fork().  A
+   reader waits while the ring is empty and a writer while it is
+   full.  Each call wakes the other side at most once for every
+   run of bytes it moves, not for every byte, so a writer filling
+   the ring with one write() costs its readers one wakeup.
+
+   A read returns what is in the ring, up to what was asked, once
+   there is anything; it returns 0 if the ring is empty and every
+   write end is closed.  A write of up to PIPE_BUF bytes goes into
+   the ring whole, never interleaved with another; a longer one may
+   be split among readers.  Writing when every read end is closed
+   fails. */
+
+#include "userprog/pipe.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/uaccess.h"
+
+/* Pages in each pipe's ring, and the largest write that is never
+   interleaved with another. */
+#define PIPE_PAGES 2
+#define PIPE_SIZE (PIPE_PAGES * PGSIZE)
+#define PIPE_BUF PGSIZE
+
+/* A pipe.  LOCK guards everything else. */
+struct pipe {
+	struct lock lock;
+	struct condition readable;  /* Ring not empty, or no writers. */
+	struct condition writable;  /* Ring not full, or no readers. */
+	uint8_t *buf;               /* PIPE_SIZE bytes. */
+	uint64_t rd, wr;            /* Bytes ever read and written. */
+	bool read_open;             /* Is the read end held? */
+	bool write_open;            /* Is the write end held? */
+};
+
+/* One end of a pipe. */
+struct pipe_end {
+	struct pipe *pipe;
+	bool write;                 /* The write end? */
+	unsigned refs;              /* Holders; see pipe_end_dup(). */
+};
+
+static bool pipe_copy (struct pipe *, void *buf, size_t size, bool user,
+		bool write);
+
+/* Creates a pipe and stores its ends in *READ_END and *WRITE_END.
+   Returns false if out of memory. */
+bool
+pipe_create (struct pipe_end **read_end, struct pipe_end **write_end) {
+	struct pipe *p = malloc (sizeof *p);
+	struct pipe_end *r = malloc (sizeof *r);
+	struct pipe_end *w = malloc (sizeof *w);
+
+	if (p == NULL || r == NULL || w == NULL
+			|| (p->buf = palloc_get_multiple (0, PIPE_PAGES)) == NULL) {
+		free (p);
+		free (r);
+		free (w);
+		return false;
+	}
+	lock_init (&p->lock);
+	cond_init (&p->readable);
+	cond_init (&p->writable);
+	p->rd = p->wr = 0;
+	p->read_open = p->write_open = true;
+	r->pipe = w->pipe = p;
+	r->write = false;
+	w->write = true;
+	r->refs = w->refs = 1;
+	*read_end = r;
+	*write_end = w;
+	return true;
+}
+
+/* Returns END with one more holder, who closes it separately.  The
+   end stays open until every holder has closed it. */
+struct pipe_end *
+pipe_end_dup (struct pipe_end *end) {
+	__atomic_add_fetch (&end->refs, 1, __ATOMIC_RELAXED);
+	return end;
+}
+
+/* Closes END.  Closing the last holder of an end wakes whoever
+   waits on the other, and closing the last of both frees the
+   pipe. */
+void
+pipe_end_close (struct pipe_end *end) {
+	struct pipe *p = end->pipe;
+	bool gone;
+
+	if (__atomic_sub_fetch (&end->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+	lock_acquire (&p->lock);
+	if (end->write) {
+		p->write_open = false;
+		cond_broadcast (&p->readable, &p->lock);
+	} else {
+		p->read_open = false;
+		cond_broadcast (&p->writable, &p->lock);
+	}
+	gone = !p->read_open && !p->write_open;
+	lock_release (&p->lock);
+	free (end);
+	if (gone) {
+		palloc_free_multiple (p->buf, PIPE_PAGES);
+		free (p);
+	}
+}
+
+/* Reads up to SIZE bytes from read end END into BUF, user memory
+   if USER, and returns the bytes read.  If the ring is empty,
+   waits for a writer if WAIT and a write end is open, and returns
+   0 otherwise.  Returns -1 if END is a write end or BUF is bad. */
+int64_t
+pipe_read (struct pipe_end *end, void *buf, size_t size, bool user,
+		bool wait) {
+	struct pipe *p = end->pipe;
+	size_t n;
+
+	if (end->write)
+		return -1;
+	if (size == 0)
+		return 0;
+	lock_acquire (&p->lock);
+	while (wait && p->wr == p->rd && p->write_open)
+		cond_wait (&p->readable, &p->lock);
+	n = p->wr - p->rd;
+	if (n > size)
+		n = size;
+	if (n > 0) {
+		if (!pipe_copy (p, buf, n, user, false)) {
+			lock_release (&p->lock);
+			return -1;
+		}
+		p->rd += n;
+		cond_broadcast (&p->writable, &p->lock);
+	}
+	lock_release (&p->lock);
+	return n;
+}
+
+/* Writes SIZE bytes from BUF, user memory if USER, to write end
+   END, waiting for room as needed, and returns the bytes written.
+   Stops short if every read end is closed meanwhile.  Returns -1
+   if END is a read end, BUF is bad, or there is no reader before
+   anything is written. */
+int64_t
+pipe_write (struct pipe_end *end, const void *buf, size_t size, bool user) {
+	struct pipe *p = end->pipe;
+	size_t done = 0;
+
+	if (!end->write)
+		return -1;
+	lock_acquire (&p->lock);
+	while (done < size && p->read_open) {
+		size_t room = PIPE_SIZE - (p->wr - p->rd);
+		size_t n = size - done;
+
+		if (room == 0 || (size <= PIPE_BUF && room < n)) {
+			cond_wait (&p->writable, &p->lock);
+			continue;
+		}
+		if (n > room)
+			n = room;
+		if (!pipe_copy (p, (uint8_t *) buf + done, n, user, true))
+			break;
+		p->wr += n;
+		done += n;
+		cond_broadcast (&p->readable, &p->lock);
+	}
+	lock_release (&p->lock);
+	return done > 0 || size == 0 ? (int64_t) done : -1;
+}
+
+/* Copies SIZE bytes between BUF, user memory if USER, and P's
+   ring: into the ring at WR if WRITE, out of it at RD otherwise.
+   There must be room or data enough.  Returns false if BUF is
+   bad.  P's lock must be held. */
+static bool
+pipe_copy (struct pipe *p, void *buf, size_t size, bool user, bool write) {
+	size_t ofs = (write ? p->wr : p->rd) % PIPE_SIZE;
+
+	while (size > 0) {
+		size_t n = PIPE_SIZE - ofs < size ? PIPE_SIZE - ofs : size;
+		uint8_t *ring = p->buf + ofs;
+		bool ok = true;
+
+		if (write && user)
+			ok = copy_from_user (ring, buf, n);
+		else if (user)
+			ok = copy_to_user (buf, ring, n);
+		else if (write)
+			memcpy (ring, buf, n);
+		else
+			memcpy (buf, ring, n);
+		if (!ok)
+			return false;
+		buf = (uint8_t *) buf + n;
+		size -= n;
+		ofs = 0;
+	}
+	return true;
+}
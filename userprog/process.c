@@ -1,31 +1,127 @@
 #include "userprog/process.h"
+#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
+#include <resource.h>
 #include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/aio.h"
 #include "userprog/gdt.h"
+#include "userprog/pipe.h"
 #include "userprog/tss.h"
+#include "userprog/uaccess.h"
+#include "userprog/vdso.h"
+#include "filesys/cache.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
+#include "threads/workqueue.h"
 #include "intrinsic.h"
 #ifdef VM
 #include "vm/vm.h"
 #endif
 
+/* What a process knows of one child.  The parent and the child
+ * each hold a reference until they are done with it. */
+struct child {
+	struct hash_elem elem;      /* Element in the parent's BY_TID. */
+	struct list_elem exit_elem; /* Element in the parent's EXITED. */
+	tid_t tid;
+	int status;                 /* Exit status, once DONE is up. */
+	struct semaphore done;      /* Upped when the child exits. */
+	struct children *parent;    /* Null once the parent exits. */
+	int refs;
+};
+
+/* A process's children that it has not waited for. */
+struct children {
+	struct hash by_tid;         /* struct child, by tid. */
+	struct list exited;         /* Those that exited, oldest first. */
+	struct semaphore exits;     /* Upped once per EXITED entry. */
+};
+
+/* Guards every struct child and struct children. */
+static struct lock child_lock;
+
+/* Dead processes whose address spaces REAPER has yet to free,
+ * linked by their `elem'.  Interrupts off guard the list. */
+static struct list reap_list;
+static size_t reap_cnt;
+static struct thread *reaper;
+static bool reaper_idle;        /* Blocked waiting for REAP_LIST? */
+
+/* Dead address spaces allowed to wait for the reaper before
+ * creating a process frees one itself. */
+#define REAP_MAX 4
+
+/* A process's open files, by descriptor.  A descriptor is in use
+   if and only if its bit in USED is set, which finds the lowest
+   free one a word at a time, and none below LOW is free, so
+   opening descriptors in turn does not rescan the ones taken.  The
+   table doubles when it fills, up to FD_MAX descriptors. */
+struct fd_table {
+	struct lock lock;           /* Threads of one process share it. */
+	struct file **files;        /* SIZE entries, null if free. */
+	struct bitmap *used;        /* SIZE bits. */
+	size_t size;
+	size_t low;
+};
+
+/* Descriptors in a new table. */
+#define FD_TABLE_MIN 16
+
+/* What process_fork() passes to the child it starts.  The parent
+   waits on DONE until the child has copied what it needs. */
+struct fork_start {
+	struct thread *parent;      /* Leader of the process to copy. */
+	struct intr_frame *if_;     /* Parent's user registers. */
+	uint64_t fs_base;           /* Parent's thread-local storage. */
+	struct semaphore done;      /* Upped once the child is set up. */
+	bool success;               /* Did it copy everything? */
+};
+
+/* How a thread started by process_thread_spawn() begins. */
+struct thread_start {
+	struct thread *leader;      /* Whose address space it shares. */
+	struct intr_frame if_;      /* User registers to start with. */
+	uint64_t fs_base;           /* Its thread-local storage. */
+};
+
+#define MSR_FS_BASE 0xc0000100
+
 static void process_cleanup (void);
-static bool load (const char *file_name, struct intr_frame *if_);
+static bool load (char *cmd_line, struct intr_frame *if_);
 static void initd (void *f_name);
 static void __do_fork (void *);
+static void spawnd (void *cmd_line);
+static void threadd (void *start_);
+static void group_leave (struct thread *);
+static void reap_push (struct thread *);
+static void child_put (struct child *);
+static void children_exit (struct thread *);
+static hash_hash_func child_hash;
+static hash_less_func child_less;
+static hash_action_func child_orphan;
+static void reaper_thread (void *aux);
+static bool reap_one (void);
+static struct fd_table *fd_table_create (size_t size);
+static struct fd_table *fd_table_get (struct thread *);
+static bool fd_table_grow (struct fd_table *, size_t fd);
+static void fd_table_destroy (struct fd_table *);
 
 /* General process initializer for initd and other process. */
 static void
@@ -50,6 +146,13 @@ process_create_initd (const char *file_name) {
 		return TID_ERROR;
 	strlcpy (fn_copy, file_name, PGSIZE);
 
+	/* Dead processes' memory is freed in the background from
+	   now on. */
+	if (thread_create ("reaper", PRI_MIN, reaper_thread, NULL) == TID_ERROR) {
+		palloc_free_page (fn_copy);
+		return TID_ERROR;
+	}
+
 	/* Create a new thread to execute FILE_NAME. */
 	tid = thread_create (file_name, PRI_DEFAULT, initd, fn_copy);
 	if (tid == TID_ERROR)
@@ -71,13 +174,264 @@ initd (void *f_name) {
 	NOT_REACHED ();
 }
 
-/* Clones the current process as `name`. Returns the new process's thread id, or
- * TID_ERROR if the thread cannot be created. */
+/* Clones the current process as `name`, whose user registers are
+ * IF_, and returns the new process's thread id once the child has
+ * copied the parent's address space and descriptors.  The child
+ * returns 0 from the same system call.  Returns TID_ERROR if the
+ * thread cannot be created or the copy fails. */
 tid_t
-process_fork (const char *name, struct intr_frame *if_ UNUSED) {
+process_fork (const char *name, struct intr_frame *if_) {
+	struct thread *cur = thread_current ();
+	struct fork_start start;
+	tid_t tid;
+
+	start.parent = thread_leader (cur);
+	start.if_ = if_;
+	start.fs_base = cur->fs_base;
+	start.success = false;
+	sema_init (&start.done, 0);
+
 	/* Clone current thread to new thread.*/
-	return thread_create (name,
-			PRI_DEFAULT, __do_fork, thread_current ());
+	tid = thread_create (name, PRI_DEFAULT, __do_fork, &start);
+	if (tid == TID_ERROR)
+		return TID_ERROR;
+	sema_down (&start.done);
+	if (!start.success) {
+		/* The child has exited, or is about to; reap it. */
+		process_wait (tid);
+		return TID_ERROR;
+	}
+	return tid;
+}
+
+/* Starts FILE in a new process with arguments ARGV, a null-
+ * terminated array of user strings whose first is the program
+ * name; a null ARGV passes FILE alone.  Unlike fork followed by
+ * exec, the caller's address space is never copied: the child
+ * starts from an empty one and load() builds it from the ELF.
+ * Returns the new thread's id, or TID_ERROR if FILE or ARGV is
+ * bad, the command line does not fit in a page, or out of
+ * memory. */
+tid_t
+process_spawn (const char *file, char *const argv[]) {
+	char *cmd_line;
+	int64_t len, n;
+	tid_t tid;
+
+	cmd_line = palloc_get_page (0);
+	if (cmd_line == NULL)
+		return TID_ERROR;
+	len = strncpy_from_user (cmd_line, file, PGSIZE);
+	if (len <= 0 || len == PGSIZE)
+		goto fail;
+
+	for (size_t i = 1; argv != NULL; i++) {
+		const char *arg;
+
+		if (!copy_from_user (&arg, argv + i, sizeof arg))
+			goto fail;
+		if (arg == NULL)
+			break;
+		if (len + 1 >= PGSIZE)
+			goto fail;
+		cmd_line[len++] = ' ';
+		n = strncpy_from_user (cmd_line + len, arg, PGSIZE - len);
+		if (n < 0 || n == PGSIZE - len)
+			goto fail;
+		len += n;
+	}
+
+	/* The thread is named after its command line, as initd is. */
+	tid = thread_create (cmd_line, PRI_DEFAULT, spawnd, cmd_line);
+	if (tid == TID_ERROR)
+		goto fail;
+	return tid;
+
+fail:
+	palloc_free_page (cmd_line);
+	return TID_ERROR;
+}
+
+/* A thread function that runs the program process_spawn() asked
+ * for in CMD_LINE, a page the thread takes over. */
+static void
+spawnd (void *cmd_line) {
+#ifdef VM
+	supplemental_page_table_init (&thread_current ()->spt);
+#endif
+
+	process_init ();
+
+	process_exec (cmd_line);
+	thread_exit ();
+}
+
+/* Starts a thread in the running process, sharing its address
+ * space, supplemental page table and descriptors, that enters user
+ * mode at ENTRY with ARG0 and ARG1 in its first two argument
+ * registers, STACK in RSP, and TLS as its FS base.  The new thread
+ * is a child of the caller, which may wait for it.  Returns its
+ * tid, or TID_ERROR if an address is bad, the process is exiting,
+ * or out of memory.
+ *
+ * The process's first thread is its leader.  Its struct thread
+ * holds what the others share, so it outlives the leader until
+ * the last of them exits; see group_leave().  When the leader
+ * exits, the others exit at their next system call. */
+tid_t
+process_thread_spawn (uint64_t entry, uint64_t arg0, uint64_t arg1,
+		uint64_t stack, uint64_t tls) {
+	struct thread *cur = thread_current (), *leader = thread_leader (cur);
+	struct thread_start *start;
+	enum intr_level old_level;
+	tid_t tid;
+
+	if (cur->pml4 == NULL || entry < PGSIZE || !is_user_vaddr ((void *) entry)
+			|| stack < PGSIZE || !is_user_vaddr ((void *) (stack - 1))
+			|| !is_user_vaddr ((void *) tls)
+			|| fd_table_get (leader) == NULL)
+		return TID_ERROR;
+	start = malloc (sizeof *start);
+	if (start == NULL)
+		return TID_ERROR;
+	memset (&start->if_, 0, sizeof start->if_);
+	start->if_.ds = start->if_.es = start->if_.ss = SEL_UDSEG;
+	start->if_.cs = SEL_UCSEG;
+	start->if_.eflags = FLAG_IF | FLAG_MBS;
+	start->if_.rip = entry;
+	start->if_.rsp = stack;
+	start->if_.R.rdi = arg0;
+	start->if_.R.rsi = arg1;
+	start->leader = leader;
+	start->fs_base = tls;
+
+	/* Join before the thread can run, so that the leader's
+	   resources are there for it. */
+	old_level = intr_disable ();
+	if (leader->group_exit) {
+		intr_set_level (old_level);
+		free (start);
+		return TID_ERROR;
+	}
+	leader->members++;
+	intr_set_level (old_level);
+
+	tid = thread_create (leader->name, thread_get_priority (), threadd, start);
+	if (tid == TID_ERROR) {
+		old_level = intr_disable ();
+		leader->members--;
+		intr_set_level (old_level);
+		free (start);
+	}
+	return tid;
+}
+
+/* A thread function that enters user mode as START_, a struct
+ * thread_start, says. */
+static void
+threadd (void *start_) {
+	struct thread_start *start = start_;
+	struct thread *t = thread_current ();
+	struct intr_frame if_ = start->if_;
+
+	t->leader = start->leader;
+	t->fds = t->leader->fds;
+	t->fs_base = start->fs_base;
+	t->pml4 = t->leader->pml4;
+	free (start);
+
+	process_activate (t);
+	do_iret (&if_);
+	NOT_REACHED ();
+}
+
+/* Returns true if the running thread should exit because its
+ * process has been killed, or because it was started by
+ * process_thread_spawn() and its leader has exited. */
+bool
+process_group_exiting (void) {
+	struct thread *t = thread_current ();
+
+	if (t->leader != NULL)
+		return t->leader->group_exit || t->leader->killed;
+	return t->killed;
+}
+
+/* Kills the process that LEADER leads.  Each of its threads exits,
+ * with status -1 unless it has one already, when it next makes a
+ * system call or is interrupted in user mode; one blocked in the
+ * kernel finishes what it waits for first.  Does not sleep. */
+void
+process_kill (struct thread *leader) {
+	ASSERT (leader->leader == NULL);
+
+	leader->killed = true;
+}
+
+/* Sets the running thread's FS base to TLS.  Returns false if TLS
+ * is not a user address. */
+bool
+process_set_tls (uint64_t tls) {
+	struct thread *t = thread_current ();
+	enum intr_level old_level;
+
+	if (!is_user_vaddr ((void *) tls))
+		return false;
+	old_level = intr_disable ();
+	t->fs_base = tls;
+	this_cpu ()->fs_base = tls;
+	write_msr (MSR_FS_BASE, tls);
+	intr_set_level (old_level);
+	return true;
+}
+
+/* A getrusage() in progress, for thread_foreach(). */
+struct usage_sum {
+	struct thread *leader;      /* The group being summed. */
+	struct rusage *ru;          /* The sum so far. */
+};
+
+/* Adds the CPU use of thread T to the sum SUM_ if T is a member
+ * of its group that has not yet left it; group_leave() counts the
+ * others. */
+static void
+usage_add (struct thread *t, void *sum_) {
+	struct usage_sum *sum = sum_;
+
+	if (t->leader == NULL || t->leader != sum->leader || t->pml4 == NULL)
+		return;
+	sum->ru->ru_utime += t->user_ticks;
+	sum->ru->ru_stime += t->kernel_ticks;
+	sum->ru->ru_nvcsw += t->voluntary_switches;
+	sum->ru->ru_nivcsw += t->involuntary_switches;
+}
+
+/* Stores the running process's resource use in *RU: the CPU use
+ * of its leader and of its members, live and exited, and the
+ * memory use and faults of the address space they share. */
+void
+process_getrusage (struct rusage *ru) {
+	struct thread *leader = thread_leader (thread_current ());
+	struct usage_sum sum = { leader, ru };
+#ifdef VM
+	const struct vm_fault_stats *f = &leader->spt.faults;
+#endif
+
+	memset (ru, 0, sizeof *ru);
+	ru->ru_utime = leader->user_ticks + leader->exited_user_ticks;
+	ru->ru_stime = leader->kernel_ticks + leader->exited_kernel_ticks;
+	ru->ru_nvcsw = leader->voluntary_switches + leader->exited_voluntary;
+	ru->ru_nivcsw = leader->involuntary_switches + leader->exited_involuntary;
+	if (leader->members > 0)
+		thread_foreach (usage_add, &sum);
+#ifdef VM
+	ru->ru_rss = leader->spt.rss;
+	ru->ru_maxrss = leader->spt.rss_peak;
+	ru->ru_nswap = f->cnt[VMF_SWAP_IN];
+	ru->ru_majflt = f->cnt[VMF_SWAP_IN] + f->cnt[VMF_FILE];
+	ru->ru_minflt = f->cnt[VMF_UNINIT] + f->cnt[VMF_STACK]
+		+ f->cnt[VMF_COW] + f->cnt[VMF_SPURIOUS];
+#endif
 }
 
 #ifndef VM
@@ -91,70 +445,87 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	void *newpage;
 	bool writable;
 
-	/* 1. TODO: If the parent_page is kernel page, then return immediately. */
+	/* 1. Kernel pages are shared by every page table already. */
+	if (is_kernel_vaddr (va))
+		return true;
 
 	/* 2. Resolve VA from the parent's page map level 4. */
 	parent_page = pml4_get_page (parent->pml4, va);
 
-	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
-	 *    TODO: NEWPAGE. */
+	/* 3. Allocate new PAL_USER page for the child. */
+	newpage = palloc_get_page (PAL_USER);
+	if (newpage == NULL)
+		return false;
 
-	/* 4. TODO: Duplicate parent's page to the new page and
-	 *    TODO: check whether parent's page is writable or not (set WRITABLE
-	 *    TODO: according to the result). */
+	/* 4. Duplicate parent's page to the new page, keeping whether
+	 *    it is writable. */
+	memcpy (newpage, parent_page, PGSIZE);
+	writable = is_writable (pte);
 
 	/* 5. Add new page to child's page table at address VA with WRITABLE
 	 *    permission. */
 	if (!pml4_set_page (current->pml4, va, newpage, writable)) {
-		/* 6. TODO: if fail to insert page, do error handling. */
+		palloc_free_page (newpage);
+		return false;
 	}
 	return true;
 }
+
+/* Like duplicate_pte(), but leaves out the vDSO pages, of which
+ * the child already has its own from vdso_map(). */
+static bool
+duplicate_user_pte (uint64_t *pte, void *va, void *aux) {
+	return is_vdso_vaddr (va) || duplicate_pte (pte, va, aux);
+}
 #endif
 
-/* A thread function that copies parent's execution context.
- * Hint) parent->tf does not hold the userland context of the process.
- *       That is, you are required to pass second argument of process_fork to
- *       this function. */
+/* A thread function that copies parent's execution context, as
+ * AUX, a struct fork_start, describes.  The parent's user
+ * registers come from the frame of its fork() system call, as
+ * parent->tf does not hold them. */
 static void
 __do_fork (void *aux) {
 	struct intr_frame if_;
-	struct thread *parent = (struct thread *) aux;
+	struct fork_start *start = aux;
+	struct thread *parent = start->parent;
 	struct thread *current = thread_current ();
-	/* TODO: somehow pass the parent_if. (i.e. process_fork()'s if_) */
-	struct intr_frame *parent_if;
-	bool succ = true;
 
-	/* 1. Read the cpu context to local stack. */
-	memcpy (&if_, parent_if, sizeof (struct intr_frame));
+	/* 1. Read the cpu context to local stack.  The child's fork()
+	 *    returns 0. */
+	memcpy (&if_, start->if_, sizeof (struct intr_frame));
+	if_.R.rax = 0;
+	current->fs_base = start->fs_base;
 
-	/* 2. Duplicate PT */
+	/* 2. Duplicate PT.  The SPT is set up first, so that whatever
+	 *    fails, the reaper finds one to free with the page table. */
+#ifdef VM
+	supplemental_page_table_init (&current->spt);
+#endif
 	current->pml4 = pml4_create();
-	if (current->pml4 == NULL)
+	if (current->pml4 == NULL || !vdso_map (current->pml4, current->tid))
 		goto error;
 
 	process_activate (current);
 #ifdef VM
-	supplemental_page_table_init (&current->spt);
 	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
 		goto error;
 #else
-	if (!pml4_for_each (parent->pml4, duplicate_pte, parent))
+	if (!pml4_for_each (parent->pml4, duplicate_user_pte, parent))
 		goto error;
 #endif
 
-	/* TODO: Your code goes here.
-	 * TODO: Hint) To duplicate the file object, use `file_duplicate`
-	 * TODO:       in include/filesys/file.h. Note that parent should not return
-	 * TODO:       from the fork() until this function successfully duplicates
-	 * TODO:       the resources of parent.*/
+	if (!process_fd_fork (parent))
+		goto error;
 
 	process_init ();
 
-	/* Finally, switch to the newly created process. */
-	if (succ)
-		do_iret (&if_);
+	/* Finally, let the parent return and switch to the newly
+	 * created process.  START is gone once DONE is up. */
+	start->success = true;
+	sema_up (&start->done);
+	do_iret (&if_);
 error:
+	sema_up (&start->done);
 	thread_exit ();
 }
 
@@ -190,6 +561,50 @@ process_exec (void *f_name) {
 }
 
 
+/* Records T, about to start, as a child of the running thread,
+ * which can then wait for it.  Returns false if out of memory. */
+bool
+process_track (struct thread *t) {
+	struct thread *cur = thread_current ();
+	struct child *c = malloc (sizeof *c);
+
+	if (c == NULL)
+		return false;
+
+	/* Keep the memory of dead processes from piling up while the
+	   reaper cannot run. */
+	while (reap_cnt > REAP_MAX && reap_one ())
+		continue;
+
+	c->tid = t->tid;
+	c->status = -1;
+	sema_init (&c->done, 0);
+	c->refs = 2;
+
+	lock_acquire (&child_lock);
+	if (cur->children == NULL) {
+		cur->children = malloc (sizeof *cur->children);
+		if (cur->children == NULL
+				|| !hash_init (&cur->children->by_tid, child_hash, child_less,
+					NULL)) {
+			free (cur->children);
+			cur->children = NULL;
+			lock_release (&child_lock);
+			free (c);
+			return false;
+		}
+		list_init (&cur->children->exited);
+		sema_init (&cur->children->exits, 0);
+	}
+	c->parent = cur->children;
+	hash_insert (&cur->children->by_tid, &c->elem);
+	lock_release (&child_lock);
+
+	t->child = c;
+	t->exit_status = -1;
+	return true;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
  * it was terminated by the kernel (i.e. killed due to an
  * exception), returns -1.  If TID is invalid or if it was not a
@@ -197,26 +612,489 @@ process_exec (void *f_name) {
  * been successfully called for the given TID, returns -1
  * immediately, without waiting.
  *
- * This function will be implemented in problem 2-2.  For now, it
- * does nothing. */
+ * Children are found by tid in a hash table, so the cost does
+ * not grow with how many a process has. */
 int
-process_wait (tid_t child_tid UNUSED) {
-	/* XXX: Hint) The pintos exit if process_wait (initd), we recommend you
-	 * XXX:       to add infinite loop here before
-	 * XXX:       implementing the process_wait. */
-	return -1;
+process_wait (tid_t child_tid) {
+	struct children *ch = thread_current ()->children;
+	struct child probe, *c = NULL;
+	struct hash_elem *e;
+	int status;
+
+	lock_acquire (&child_lock);
+	probe.tid = child_tid;
+	e = ch != NULL ? hash_delete (&ch->by_tid, &probe.elem) : NULL;
+	lock_release (&child_lock);
+	if (e == NULL)
+		return -1;
+	c = hash_entry (e, struct child, elem);
+
+	sema_down (&c->done);
+	lock_acquire (&child_lock);
+	list_remove (&c->exit_elem);
+	lock_release (&child_lock);
+	/* Take back the up that announced C to process_wait_any(). */
+	sema_down (&ch->exits);
+	status = c->status;
+	child_put (c);
+	return status;
+}
+
+/* Waits for whichever child of the running process exits first,
+ * or has already exited, stores its exit status in user memory
+ * at STATUS unless it is null, and returns its tid.  Returns -1
+ * at once if the process has no children left to wait for or
+ * STATUS is bad. */
+tid_t
+process_wait_any (int *status) {
+	struct children *ch = thread_current ()->children;
+	struct child *c;
+	bool none;
+	tid_t tid;
+	int s = -1;
+
+	if (status != NULL && !copy_to_user (status, &s, sizeof s))
+		return -1;
+	lock_acquire (&child_lock);
+	none = ch == NULL || hash_empty (&ch->by_tid);
+	lock_release (&child_lock);
+	if (none)
+		return -1;
+
+	sema_down (&ch->exits);
+	lock_acquire (&child_lock);
+	c = list_entry (list_pop_front (&ch->exited), struct child, exit_elem);
+	hash_delete (&ch->by_tid, &c->elem);
+	lock_release (&child_lock);
+	tid = c->tid;
+	s = c->status;
+	child_put (c);
+
+	if (status != NULL)
+		copy_to_user (status, &s, sizeof s);
+	return tid;
+}
+
+/* Drops a reference to C, freeing it with the last. */
+static void
+child_put (struct child *c) {
+	bool last;
+
+	lock_acquire (&child_lock);
+	last = --c->refs == 0;
+	lock_release (&child_lock);
+	if (last)
+		free (c);
+}
+
+/* Tells T's parent, if alive, that T exited, and lets go of T's
+ * own children. */
+static void
+children_exit (struct thread *t) {
+	struct child *c = t->child;
+
+	lock_acquire (&child_lock);
+	if (t->children != NULL) {
+		hash_destroy (&t->children->by_tid, child_orphan);
+		free (t->children);
+		t->children = NULL;
+	}
+	if (c != NULL) {
+		c->status = t->exit_status;
+		if (c->parent != NULL) {
+			list_push_back (&c->parent->exited, &c->exit_elem);
+			sema_up (&c->parent->exits);
+		}
+		sema_up (&c->done);
+		t->child = NULL;
+	}
+	lock_release (&child_lock);
+
+	if (c != NULL)
+		child_put (c);
+}
+
+/* Drops an exiting parent's reference to child E.  Must hold
+ * CHILD_LOCK. */
+static void
+child_orphan (struct hash_elem *e, void *aux UNUSED) {
+	struct child *c = hash_entry (e, struct child, elem);
+
+	c->parent = NULL;
+	if (--c->refs == 0)
+		free (c);
+}
+
+static uint64_t
+child_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct child *c = hash_entry (e, struct child, elem);
+	return hash_int (c->tid);
+}
+
+static bool
+child_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct child, elem)->tid
+		< hash_entry (b, struct child, elem)->tid;
 }
 
 /* Exit the process. This function is called by thread_exit (). */
 void
 process_exit (void) {
 	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+	bool alone;
 	/* TODO: Your code goes here.
 	 * TODO: Implement process termination message (see
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
 
-	process_cleanup ();
+	aio_exit ();
+	if (curr->leader != NULL) {
+		group_leave (curr);
+		children_exit (curr);
+		return;
+	}
+
+#ifdef VM
+	if (vm_stat && curr->pml4 != NULL) {
+		vm_print_fault_stats (curr->name, &curr->spt.faults);
+		vm_print_mem_stats (curr->name, &curr->spt);
+	}
+#endif
+	/* Threads still sharing the descriptors leave the last of them
+	   to close them. */
+	old_level = intr_disable ();
+	curr->group_exit = true;
+	alone = curr->members == 0;
+	intr_set_level (old_level);
+	if (alone) {
+		fd_table_destroy (curr->fds);
+		curr->fds = NULL;
+	}
+
+	/* Once the reaper runs, it frees the address space after this
+	   thread is gone, and the exit status goes out at once. */
+	if (reaper == NULL && alone)
+		process_cleanup ();
+	children_exit (curr);
+}
+
+/* Takes T, a thread started by process_thread_spawn() that is
+ * exiting, out of its leader's group.  The last to leave after the
+ * leader has exited closes the shared descriptors and, if the
+ * leader is already dead, hands it to the reaper. */
+static void
+group_leave (struct thread *t) {
+	struct thread *leader = t->leader;
+	struct fd_table *fds = NULL;
+	enum intr_level old_level;
+
+	t->fds = NULL;
+	old_level = intr_disable ();
+	t->pml4 = NULL;
+	pml4_activate (NULL);
+	leader->exited_user_ticks += t->user_ticks;
+	leader->exited_kernel_ticks += t->kernel_ticks;
+	leader->exited_voluntary += t->voluntary_switches;
+	leader->exited_involuntary += t->involuntary_switches;
+	if (--leader->members == 0 && leader->group_exit) {
+		fds = leader->fds;
+		leader->fds = NULL;
+		if (leader->reap_pending)
+			reap_push (leader);
+	}
+	intr_set_level (old_level);
+	fd_table_destroy (fds);
+}
+
+/* Returns a table of SIZE descriptors with the console in 0 and
+ * 1, or NULL if out of memory. */
+static struct fd_table *
+fd_table_create (size_t size) {
+	struct fd_table *t = malloc (sizeof *t);
+
+	if (t == NULL)
+		return NULL;
+	lock_init (&t->lock);
+	t->files = calloc (size, sizeof *t->files);
+	t->used = bitmap_create (size);
+	if (t->files == NULL || t->used == NULL) {
+		free (t->files);
+		if (t->used != NULL)
+			bitmap_destroy (t->used);
+		free (t);
+		return NULL;
+	}
+	t->size = size;
+	t->files[STDIN_FILENO] = FD_CONSOLE_IN;
+	t->files[STDOUT_FILENO] = FD_CONSOLE_OUT;
+	bitmap_set_multiple (t->used, 0, 2, true);
+	t->low = 2;
+	return t;
+}
+
+/* Returns T's descriptor table, creating it on first use, or NULL
+ * if out of memory. */
+static struct fd_table *
+fd_table_get (struct thread *t) {
+	if (t->fds == NULL)
+		t->fds = fd_table_create (FD_TABLE_MIN);
+	return t->fds;
+}
+
+/* Doubles T until it holds descriptor FD.  Returns false if FD is
+ * FD_MAX or more or out of memory, leaving T as it was. */
+static bool
+fd_table_grow (struct fd_table *t, size_t fd) {
+	struct file **files;
+	struct bitmap *used;
+	size_t size = t->size;
+
+	if (fd >= FD_MAX)
+		return false;
+	while (size <= fd)
+		size *= 2;
+	if (size > FD_MAX)
+		size = FD_MAX;
+	used = bitmap_create (size);
+	if (used == NULL)
+		return false;
+	files = realloc (t->files, size * sizeof *files);
+	if (files == NULL) {
+		bitmap_destroy (used);
+		return false;
+	}
+	memset (files + t->size, 0, (size - t->size) * sizeof *files);
+	for (size_t i = 0; i < t->size; i++)
+		if (files[i] != NULL)
+			bitmap_mark (used, i);
+	bitmap_destroy (t->used);
+	t->files = files;
+	t->used = used;
+	t->size = size;
+	return true;
+}
+
+/* Closes the files in T, if any, and frees it. */
+static void
+fd_table_destroy (struct fd_table *t) {
+	if (t == NULL)
+		return;
+	for (size_t fd = 0; fd < t->size; fd++)
+		process_fd_close (t->files[fd]);
+	bitmap_destroy (t->used);
+	free (t->files);
+	free (t);
+}
+
+/* Returns FILE, what a descriptor holds, with one more holder for
+ * another descriptor: a file or pipe end is shared, and the console
+ * and NULL need no holding. */
+struct file *
+process_fd_dup (struct file *file) {
+	if (fd_is_pipe (file))
+		pipe_end_dup (fd_to_pipe (file));
+	else if (fd_is_file (file))
+		file_dup (file);
+	return file;
+}
+
+/* Drops a descriptor's hold on FILE, what it held, closing a file
+ * or pipe end with its last holder. */
+void
+process_fd_close (struct file *file) {
+	if (fd_is_pipe (file))
+		pipe_end_close (fd_to_pipe (file));
+	else if (fd_is_file (file))
+		file_close (file);
+}
+
+/* Gives FILE the lowest free descriptor of the running process
+ * and returns it, or -1 if there is none or out of memory. */
+int
+process_fd_add (struct file *file) {
+	struct fd_table *t = fd_table_get (thread_current ());
+	size_t fd;
+
+	if (t == NULL)
+		return -1;
+	lock_acquire (&t->lock);
+	fd = bitmap_scan (t->used, t->low, 1, false);
+	if (fd == BITMAP_ERROR) {
+		fd = t->size;
+		if (!fd_table_grow (t, fd)) {
+			lock_release (&t->lock);
+			return -1;
+		}
+	}
+	t->files[fd] = file;
+	bitmap_mark (t->used, fd);
+	t->low = fd + 1;
+	lock_release (&t->lock);
+	return fd;
+}
+
+/* Puts FILE in descriptor FD of the running process and stores
+ * what FD held before, for the caller to close, in *OLD.  Returns
+ * false if FD is out of range or out of memory. */
+bool
+process_fd_install (int fd, struct file *file, struct file **old) {
+	struct fd_table *t = fd_table_get (thread_current ());
+
+	if (t == NULL || fd < 0)
+		return false;
+	lock_acquire (&t->lock);
+	if ((size_t) fd >= t->size && !fd_table_grow (t, fd)) {
+		lock_release (&t->lock);
+		return false;
+	}
+	*old = t->files[fd];
+	t->files[fd] = file;
+	bitmap_mark (t->used, fd);
+	lock_release (&t->lock);
+	return true;
+}
+
+/* Returns what descriptor FD of the running process holds: a file,
+ * FD_CONSOLE_IN, FD_CONSOLE_OUT, or NULL if FD is not open. */
+struct file *
+process_fd_get (int fd) {
+	struct fd_table *t = thread_current ()->fds;
+	struct file *file = NULL;
+
+	if (t == NULL)
+		return fd == STDIN_FILENO ? FD_CONSOLE_IN
+			: fd == STDOUT_FILENO ? FD_CONSOLE_OUT : NULL;
+	lock_acquire (&t->lock);
+	if (fd >= 0 && (size_t) fd < t->size)
+		file = t->files[fd];
+	lock_release (&t->lock);
+	return file;
+}
+
+/* Frees descriptor FD of the running process and returns what it
+ * held, as process_fd_get() would, for the caller to close. */
+struct file *
+process_fd_remove (int fd) {
+	struct fd_table *t;
+	struct file *file = NULL;
+
+	if (fd < 0 || (t = fd_table_get (thread_current ())) == NULL)
+		return NULL;
+	lock_acquire (&t->lock);
+	if ((size_t) fd < t->size && t->files[fd] != NULL) {
+		file = t->files[fd];
+		t->files[fd] = NULL;
+		bitmap_reset (t->used, fd);
+		if ((size_t) fd < t->low)
+			t->low = fd;
+	}
+	lock_release (&t->lock);
+	return file;
+}
+
+/* Gives the running process the descriptors of PARENT, sharing
+ * each of its files.  Returns false if out of memory. */
+bool
+process_fd_fork (struct thread *parent) {
+	struct fd_table *p = parent->fds, *t;
+
+	if (p == NULL)
+		return true;
+	lock_acquire (&p->lock);
+	t = fd_table_create (p->size);
+	if (t == NULL) {
+		lock_release (&p->lock);
+		return false;
+	}
+	for (size_t fd = 0; fd < p->size; fd++) {
+		struct file *file = p->files[fd];
+
+		t->files[fd] = process_fd_dup (file);
+		bitmap_set (t->used, fd, file != NULL);
+	}
+	t->low = p->low;
+	lock_release (&p->lock);
+	thread_current ()->fds = t;
+	return true;
+}
+
+/* Hands T, a dead thread that still has an address space, to the
+ * reaper, which frees the address space and then T's page.
+ * Returns false, leaving T to the caller, if T has no address
+ * space.  Called by the scheduler with interrupts off. */
+bool
+process_reap (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->pml4 == NULL)
+		return false;
+
+	/* Threads sharing T's address space keep it, and T, until the
+	   last of them leaves. */
+	if (t->members > 0)
+		t->reap_pending = true;
+	else
+		reap_push (t);
+	return true;
+}
+
+/* Queues T, dead, for the reaper.  Interrupts must be off. */
+static void
+reap_push (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (reaper != NULL);
+
+	list_push_back (&reap_list, &t->elem);
+	reap_cnt++;
+	if (reaper_idle) {
+		reaper_idle = false;
+		thread_unblock (reaper);
+	}
+}
+
+/* Frees the address spaces of dead processes, at low priority so
+ * that it runs while the CPU would otherwise idle. */
+static void
+reaper_thread (void *aux UNUSED) {
+	reaper = thread_current ();
+	for (;;) {
+		enum intr_level old_level = intr_disable ();
+		while (list_empty (&reap_list)) {
+			reaper_idle = true;
+			thread_block ();
+		}
+		intr_set_level (old_level);
+		reap_one ();
+	}
+}
+
+/* Frees one dead process's address space and thread, if any
+ * await the reaper.  Returns false if none did. */
+static bool
+reap_one (void) {
+	enum intr_level old_level;
+	struct thread *t = NULL;
+
+	old_level = intr_disable ();
+	if (!list_empty (&reap_list)) {
+		t = list_entry (list_pop_front (&reap_list), struct thread, elem);
+		reap_cnt--;
+	}
+	intr_set_level (old_level);
+	if (t == NULL)
+		return false;
+
+	/* T is not running, so nothing has its page tables active. */
+#ifdef VM
+	supplemental_page_table_kill (&t->spt);
+#endif
+	vdso_unmap (t->pml4);
+	pml4_destroy (t->pml4);
+	t->pml4 = NULL;
+	thread_release (t);
+	return true;
 }
 
 /* Free the current process's resources. */
@@ -242,6 +1120,7 @@ process_cleanup (void) {
 		 * that's been freed (and cleared). */
 		curr->pml4 = NULL;
 		pml4_activate (NULL);
+		vdso_unmap (pml4);
 		pml4_destroy (pml4);
 	}
 }
@@ -250,9 +1129,17 @@ process_cleanup (void) {
  * This function is called on every context switch. */
 void
 process_activate (struct thread *next) {
+	struct cpu *c = this_cpu ();
+
 	/* Activate thread's page tables. */
 	pml4_activate (next->pml4);
 
+	/* Load its thread-local storage base, if that differs. */
+	if (c->fs_base != next->fs_base) {
+		write_msr (MSR_FS_BASE, next->fs_base);
+		c->fs_base = next->fs_base;
+	}
+
 	/* Set thread's kernel stack for use in processing interrupts. */
 	tss_update (next);
 }
@@ -310,40 +1197,147 @@ struct ELF64_PHDR {
 #define ELF ELF64_hdr
 #define Phdr ELF64_PHDR
 
-static bool setup_stack (struct intr_frame *if_);
+/* An executable's entry point and loadable segments, read and
+ * validated once and then cached by inode, so exec of a binary
+ * already seen does no header I/O.  An image matches its file as
+ * long as the inode's write generation is still GEN. */
+struct elf_image {
+	struct list_elem elem;      /* Element in elf_cache. */
+	struct inode *inode;        /* Held open while cached. */
+	disk_sector_t inumber;
+	unsigned gen;
+	unsigned refs;              /* The cache's, plus loads using it. */
+	uint64_t entry;
+	uint16_t load_cnt;
+	struct Phdr *loads;         /* The PT_LOAD headers, in order. */
+	bool prefetched;            /* Segments queued for prefetch? */
+};
+
+/* Images cached, most recently used first. */
+#define ELF_CACHE_MAX 8
+
+/* At most 1/EXEC_PREFETCH_SHARE of the buffer cache is filled
+   prefetching one image, so that a large one does not push out its
+   own first pages, or the cache's hot blocks. */
+#define EXEC_PREFETCH_SHARE 4
+static struct list elf_cache;
+static struct lock elf_cache_lock;
+static size_t elf_cache_cnt;
+
+/* A command line split by args_parse(): ARGC words packed one
+   after another, each null-terminated, at the start of the buffer
+   they were parsed in, and the bytes below USER_STACK that
+   args_push() lays them out in. */
+struct exec_args {
+	char *words;                /* First word, the program name. */
+	int argc;                   /* Number of words. */
+	size_t str_bytes;           /* Bytes of WORDS, terminators included. */
+	size_t frame_bytes;         /* Bytes of stack they take. */
+};
+
+/* argv[] entries args_push() collects before each copy. */
+#define ARGS_BATCH 32
+
+static bool args_parse (char *cmd_line, struct exec_args *);
+static bool args_push (const struct exec_args *, struct intr_frame *);
+static bool setup_stack (struct intr_frame *if_, size_t size);
 static bool validate_segment (const struct Phdr *, struct file *);
+static struct elf_image *elf_image_get (struct file *, const char *file_name);
+static struct elf_image *elf_image_read (struct file *, const char *file_name);
+static void elf_image_put (struct elf_image *);
+static void exec_prefetch (struct elf_image *);
+static work_func exec_prefetch_work;
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes,
 		bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
- * Stores the executable's entry point into *RIP
- * and its initial stack pointer into *RSP.
- * Returns true if successful, false otherwise. */
-static bool
-load (const char *file_name, struct intr_frame *if_) {
-	struct thread *t = thread_current ();
+/* Initializes the tables shared by all processes.  Must run
+ * before any thread is created. */
+void
+process_setup (void) {
+	lock_init (&child_lock);
+	list_init (&reap_list);
+	list_init (&elf_cache);
+	lock_init (&elf_cache_lock);
+	vdso_init ();
+}
+
+/* Returns the image of executable FILE, named FILE_NAME, from the
+ * cache, or reads it and caches it.  Returns a null pointer if
+ * FILE is not a loadable executable or out of memory.  Release
+ * the image with elf_image_put(). */
+static struct elf_image *
+elf_image_get (struct file *file, const char *file_name) {
+	struct inode *inode = file_get_inode (file);
+	struct elf_image *img, *victim = NULL;
+	struct list_elem *e;
+
+	lock_acquire (&elf_cache_lock);
+	for (e = list_begin (&elf_cache); e != list_end (&elf_cache);
+			e = list_next (e)) {
+		img = list_entry (e, struct elf_image, elem);
+		if (img->inumber == inode_get_inumber (inode)
+				&& img->inode == inode
+				&& img->gen == inode_write_gen (inode)) {
+			list_remove (&img->elem);
+			list_push_front (&elf_cache, &img->elem);
+			img->refs++;
+			lock_release (&elf_cache_lock);
+			return img;
+		}
+	}
+	lock_release (&elf_cache_lock);
+
+	img = elf_image_read (file, file_name);
+	if (img == NULL)
+		return NULL;
+
+	/* Cache it in place of any stale image of INODE, or else of
+	   the least recently used one. */
+	lock_acquire (&elf_cache_lock);
+	for (e = list_begin (&elf_cache); e != list_end (&elf_cache);
+			e = list_next (e)) {
+		struct elf_image *old = list_entry (e, struct elf_image, elem);
+		if (old->inode == inode || inode_is_removed (old->inode)) {
+			victim = old;
+			break;
+		}
+	}
+	if (victim == NULL && elf_cache_cnt == ELF_CACHE_MAX)
+		victim = list_entry (list_back (&elf_cache), struct elf_image, elem);
+	if (victim != NULL) {
+		list_remove (&victim->elem);
+		elf_cache_cnt--;
+	}
+	img->refs++;
+	list_push_front (&elf_cache, &img->elem);
+	elf_cache_cnt++;
+	lock_release (&elf_cache_lock);
+
+	if (victim != NULL)
+		elf_image_put (victim);
+	return img;
+}
+
+/* Reads and validates the headers of executable FILE, named
+ * FILE_NAME, into a new image with one reference. */
+static struct elf_image *
+elf_image_read (struct file *file, const char *file_name) {
+	struct elf_image *img;
 	struct ELF ehdr;
-	struct file *file = NULL;
 	off_t file_ofs;
-	bool success = false;
 	int i;
 
-	/* Allocate and activate page directory. */
-	t->pml4 = pml4_create ();
-	if (t->pml4 == NULL)
-		goto done;
-	process_activate (thread_current ());
-
-	/* Open executable file. */
-	file = filesys_open (file_name);
-	if (file == NULL) {
-		printf ("load: %s: open failed\n", file_name);
-		goto done;
-	}
+	/* The generation goes first: a write racing with the reads
+	   leaves the image stale, not wrong. */
+	img = malloc (sizeof *img);
+	if (img == NULL)
+		return NULL;
+	img->gen = inode_write_gen (file_get_inode (file));
+	img->prefetched = false;
 
 	/* Read and verify executable header. */
-	if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
+	if (file_read_at (file, &ehdr, sizeof ehdr, 0) != sizeof ehdr
 			|| memcmp (ehdr.e_ident, "\177ELF\2\1\1", 7)
 			|| ehdr.e_type != 2
 			|| ehdr.e_machine != 0x3E // amd64
@@ -351,8 +1345,15 @@ load (const char *file_name, struct intr_frame *if_) {
 			|| ehdr.e_phentsize != sizeof (struct Phdr)
 			|| ehdr.e_phnum > 1024) {
 		printf ("load: %s: error loading executable\n", file_name);
-		goto done;
+		free (img);
+		return NULL;
+	}
+	img->loads = malloc ((ehdr.e_phnum + 1) * sizeof *img->loads);
+	if (img->loads == NULL) {
+		free (img);
+		return NULL;
 	}
+	img->load_cnt = 0;
 
 	/* Read program headers. */
 	file_ofs = ehdr.e_phoff;
@@ -360,11 +1361,9 @@ load (const char *file_name, struct intr_frame *if_) {
 		struct Phdr phdr;
 
 		if (file_ofs < 0 || file_ofs > file_length (file))
-			goto done;
-		file_seek (file, file_ofs);
-
-		if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-			goto done;
+			goto fail;
+		if (file_read_at (file, &phdr, sizeof phdr, file_ofs) != sizeof phdr)
+			goto fail;
 		file_ofs += sizeof phdr;
 		switch (phdr.p_type) {
 			case PT_NULL:
@@ -377,54 +1376,227 @@ load (const char *file_name, struct intr_frame *if_) {
 			case PT_DYNAMIC:
 			case PT_INTERP:
 			case PT_SHLIB:
-				goto done;
+				goto fail;
 			case PT_LOAD:
-				if (validate_segment (&phdr, file)) {
-					bool writable = (phdr.p_flags & PF_W) != 0;
-					uint64_t file_page = phdr.p_offset & ~PGMASK;
-					uint64_t mem_page = phdr.p_vaddr & ~PGMASK;
-					uint64_t page_offset = phdr.p_vaddr & PGMASK;
-					uint32_t read_bytes, zero_bytes;
-					if (phdr.p_filesz > 0) {
-						/* Normal segment.
-						 * Read initial part from disk and zero the rest. */
-						read_bytes = page_offset + phdr.p_filesz;
-						zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-								- read_bytes);
-					} else {
-						/* Entirely zero.
-						 * Don't read anything from disk. */
-						read_bytes = 0;
-						zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
-					}
-					if (!load_segment (file, file_page, (void *) mem_page,
-								read_bytes, zero_bytes, writable))
-						goto done;
-				}
-				else
-					goto done;
+				if (!validate_segment (&phdr, file))
+					goto fail;
+				img->loads[img->load_cnt++] = phdr;
 				break;
 		}
 	}
 
-	/* Set up stack. */
-	if (!setup_stack (if_))
+	img->inode = inode_reopen (file_get_inode (file));
+	img->inumber = inode_get_inumber (img->inode);
+	img->entry = ehdr.e_entry;
+	img->refs = 1;
+	return img;
+
+fail:
+	free (img->loads);
+	free (img);
+	return NULL;
+}
+
+/* Drops a reference to IMG, freeing it with the last. */
+static void
+elf_image_put (struct elf_image *img) {
+	bool last;
+
+	lock_acquire (&elf_cache_lock);
+	last = --img->refs == 0;
+	lock_release (&elf_cache_lock);
+	if (last) {
+		inode_close (img->inode);
+		free (img->loads);
+		free (img);
+	}
+}
+
+/* The first time IMG is loaded, has a worker read its segments
+ * into the buffer cache, so that the page faults of the new
+ * process find them there instead of each waiting on the disk. */
+static void
+exec_prefetch (struct elf_image *img) {
+	if (__atomic_exchange_n (&img->prefetched, true, __ATOMIC_RELAXED))
+		return;
+
+	lock_acquire (&elf_cache_lock);
+	img->refs++;
+	lock_release (&elf_cache_lock);
+	if (!queue_work (&system_wq, exec_prefetch_work, img))
+		elf_image_put (img);
+}
+
+/* Reads the file bytes of image IMG_'s segments, in segment order,
+ * into the buffer cache, and drops the reference exec_prefetch()
+ * took. */
+static void
+exec_prefetch_work (void *img_) {
+	struct elf_image *img = img_;
+	off_t budget = cache_sectors * DISK_SECTOR_SIZE / EXEC_PREFETCH_SHARE;
+	int i;
+
+	for (i = 0; i < img->load_cnt && budget > 0; i++) {
+		const struct Phdr *phdr = &img->loads[i];
+		off_t size = phdr->p_filesz < (uint64_t) budget
+			? (off_t) phdr->p_filesz : budget;
+
+		inode_prefetch (img->inode, phdr->p_offset, size);
+		budget -= size;
+	}
+	elf_image_put (img);
+}
+
+/* Loads the ELF executable named by the first word of CMD_LINE
+ * into the current thread, with the words as its arguments.
+ * CMD_LINE is split in place.
+ * Stores the executable's entry point into *RIP
+ * and its initial stack pointer into *RSP.
+ * Returns true if successful, false otherwise. */
+static bool
+load (char *cmd_line, struct intr_frame *if_) {
+	struct thread *t = thread_current ();
+	struct elf_image *img = NULL;
+	struct file *file = NULL;
+	struct exec_args args;
+	const char *file_name;
+	bool success = false;
+	int i;
+
+	if (!args_parse (cmd_line, &args))
 		goto done;
+	file_name = args.words;
 
-	/* Start address. */
-	if_->rip = ehdr.e_entry;
+	/* Allocate and activate page directory. */
+	t->pml4 = pml4_create ();
+	if (t->pml4 == NULL || !vdso_map (t->pml4, t->tid))
+		goto done;
+	process_activate (thread_current ());
 
-	/* TODO: Your code goes here.
-	 * TODO: Implement argument passing (see project2/argument_passing.html). */
+	/* Open executable file. */
+	file = filesys_open (file_name);
+	if (file == NULL) {
+		printf ("load: %s: open failed\n", file_name);
+		goto done;
+	}
+
+	/* Fetch the executable's loadable segments. */
+	img = elf_image_get (file, file_name);
+	if (img == NULL)
+		goto done;
+	exec_prefetch (img);
+
+	for (i = 0; i < img->load_cnt; i++) {
+		const struct Phdr *phdr = &img->loads[i];
+		bool writable = (phdr->p_flags & PF_W) != 0;
+		uint64_t file_page = phdr->p_offset & ~PGMASK;
+		uint64_t mem_page = phdr->p_vaddr & ~PGMASK;
+		uint64_t page_offset = phdr->p_vaddr & PGMASK;
+		uint32_t read_bytes, zero_bytes;
+		if (phdr->p_filesz > 0) {
+			/* Normal segment.
+			 * Read initial part from disk and zero the rest. */
+			read_bytes = page_offset + phdr->p_filesz;
+			zero_bytes = (ROUND_UP (page_offset + phdr->p_memsz, PGSIZE)
+					- read_bytes);
+		} else {
+			/* Entirely zero.
+			 * Don't read anything from disk. */
+			read_bytes = 0;
+			zero_bytes = ROUND_UP (page_offset + phdr->p_memsz, PGSIZE);
+		}
+		if (!load_segment (file, file_page, (void *) mem_page,
+					read_bytes, zero_bytes, writable))
+			goto done;
+	}
+
+	/* Set up stack, with the arguments on it. */
+	if (!setup_stack (if_, args.frame_bytes) || !args_push (&args, if_))
+		goto done;
+
+	/* Start address. */
+	if_->rip = img->entry;
 
 	success = true;
 
 done:
 	/* We arrive here whether the load is successful or not. */
+	if (img != NULL)
+		elf_image_put (img);
 	file_close (file);
 	return success;
 }
 
+/* Splits CMD_LINE into words at spaces, in a single pass that
+   packs them, null-terminated, at its start, and fills in A,
+   including the size of the stack frame args_push() will build:
+   the words, padding to align argv[] to 16 bytes, argv[] with its
+   null sentinel, and a fake return address.  Returns false if
+   CMD_LINE holds no words. */
+static bool
+args_parse (char *cmd_line, struct exec_args *a) {
+	const char *src = cmd_line;
+	char *dst = cmd_line;
+	uint64_t argv;
+
+	a->words = cmd_line;
+	a->argc = 0;
+	for (;;) {
+		while (*src == ' ')
+			src++;
+		if (*src == '\0')
+			break;
+		while (*src != ' ' && *src != '\0')
+			*dst++ = *src++;
+		/* Step past the space before DST may overwrite it. */
+		if (*src == ' ')
+			src++;
+		*dst++ = '\0';
+		a->argc++;
+	}
+	a->str_bytes = dst - cmd_line;
+
+	argv = ROUND_DOWN (USER_STACK - a->str_bytes
+			- (a->argc + 1) * sizeof (char *), 16);
+	a->frame_bytes = USER_STACK - (argv - sizeof (void *));
+	return a->argc > 0;
+}
+
+/* Lays A out on the stack setup_stack() mapped, which is zeroed,
+   so the padding and fake return address need no writing: the
+   words go to the top of the stack in one copy, and argv[] below
+   them ARGS_BATCH entries per copy.  Points RSP at the fake return
+   address, RDI at argc and RSI at argv.  Returns false if the
+   stack cannot be written. */
+static bool
+args_push (const struct exec_args *a, struct intr_frame *if_) {
+	char *strs = (char *) USER_STACK - a->str_bytes;
+	char **argv = (char **) (USER_STACK - a->frame_bytes + sizeof (void *));
+	char *batch[ARGS_BATCH];
+	const char *w = a->words;
+	int i, n = 0;
+
+	if (!copy_to_user (strs, a->words, a->str_bytes))
+		return false;
+	for (i = 0; i <= a->argc; i++) {
+		if (i < a->argc) {
+			batch[n++] = strs + (w - a->words);
+			w += strlen (w) + 1;
+		} else
+			batch[n++] = NULL;
+		if (n == ARGS_BATCH || i == a->argc) {
+			if (!copy_to_user (argv + i + 1 - n, batch, n * sizeof *batch))
+				return false;
+			n = 0;
+		}
+	}
+
+	if_->R.rdi = a->argc;
+	if_->R.rsi = (uint64_t) argv;
+	if_->rsp = (uint64_t) argv - sizeof (void *);
+	return true;
+}
+
 
 /* Checks whether PHDR describes a valid, loadable segment in
  * FILE and returns true if so, false otherwise. */
@@ -534,21 +1706,26 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	return true;
 }
 
-/* Create a minimal stack by mapping a zeroed page at the USER_STACK */
+/* Create a minimal stack by mapping zeroed pages below the
+ * USER_STACK, enough for SIZE bytes and at least one.  Pages
+ * already mapped go with the page table on failure. */
 static bool
-setup_stack (struct intr_frame *if_) {
-	uint8_t *kpage;
-	bool success = false;
+setup_stack (struct intr_frame *if_, size_t size) {
+	size_t page_cnt = size > PGSIZE ? DIV_ROUND_UP (size, PGSIZE) : 1;
+	size_t i;
 
-	kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-	if (kpage != NULL) {
-		success = install_page (((uint8_t *) USER_STACK) - PGSIZE, kpage, true);
-		if (success)
-			if_->rsp = USER_STACK;
-		else
+	for (i = 1; i <= page_cnt; i++) {
+		uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+
+		if (kpage == NULL)
+			return false;
+		if (!install_page ((uint8_t *) USER_STACK - i * PGSIZE, kpage, true)) {
 			palloc_free_page (kpage);
+			return false;
+		}
 	}
-	return success;
+	if_->rsp = USER_STACK;
+	return true;
 }
 
 /* Adds a mapping from user virtual address UPAGE to kernel
@@ -574,11 +1751,15 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Loads a writable page of the segment AUX, a struct mmap_region,
+ * on its first fault.  From then on the page is anonymous. */
 static bool
 lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	struct mmap_region *r = aux;
+	bool ok = mmap_region_read (r, page->va, page->frame->kva);
+
+	mmap_region_put (r);
+	return ok;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -592,48 +1773,82 @@ lazy_load_segment (struct page *page, void *aux) {
  *
  * The pages initialized by this function must be writable by the
  * user process if WRITABLE is true, read-only otherwise.
+ * Read-only pages are file pages that the text cache shares
+ * between processes running the same executable; being clean,
+ * eviction drops them and a later fault reads them back from the
+ * file.  Writable pages with nothing in the file, the bss, are
+ * plain anonymous pages that read as the shared zero page until
+ * written.
  *
  * Return true if successful, false if a memory allocation error
  * or disk read error occurs. */
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
+	struct mmap_region *r;
+
 	ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
+	/* The segment's pages hold it, and its own handle keeps the
+	   executable from being written while they do.  Hold it here
+	   too until they are all in place. */
+	r = mmap_region_create (file, upage, read_bytes + zero_bytes, ofs,
+			read_bytes);
+	if (r == NULL)
+		return false;
+	r->exec = true;
+	file_deny_write (r->file);
+	mmap_region_get (r);
+
 	while (read_bytes > 0 || zero_bytes > 0) {
 		/* Do calculate how to fill this page.
 		 * We will read PAGE_READ_BYTES bytes from FILE
 		 * and zero the final PAGE_ZERO_BYTES bytes. */
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
+		bool ok;
+
+		if (writable && page_read_bytes == 0)
+			ok = vm_alloc_page (VM_ANON, upage, true);
+		else if (writable) {
+			ok = vm_alloc_page_with_initializer (VM_ANON | VM_REGION, upage,
+					true, lazy_load_segment, r);
+			if (ok)
+				mmap_region_get (r);
+		} else
+			ok = mmap_region_map (r, upage, false);
+		if (!ok)
+			break;
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
 	}
-	return true;
+	/* Pages already added go with the process on failure. */
+	mmap_region_put (r);
+	return read_bytes == 0 && zero_bytes == 0;
 }
 
-/* Create a PAGE of stack at the USER_STACK. Return true on success. */
+/* Create the PAGEs of stack below the USER_STACK that SIZE bytes
+ * take, at least one. Return true on success. */
 static bool
-setup_stack (struct intr_frame *if_) {
-	bool success = false;
-	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
+setup_stack (struct intr_frame *if_, size_t size) {
+	size_t page_cnt = size > PGSIZE ? DIV_ROUND_UP (size, PGSIZE) : 1;
+	size_t i;
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
+	/* Map each page and claim it immediately; the arguments are
+	 * written to them right away.  VM_MARKER_0 marks stack pages. */
+	for (i = 1; i <= page_cnt; i++) {
+		void *va = (uint8_t *) USER_STACK - i * PGSIZE;
 
-	return success;
+		if (!vm_alloc_page (VM_ANON | VM_MARKER_0, va, true)
+				|| !vm_claim_page (va))
+			return false;
+	}
+	if_->rsp = USER_STACK;
+	return true;
 }
 #endif /* VM */
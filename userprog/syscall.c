@@ -1,15 +1,74 @@
 #include "userprog/syscall.h"
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <console.h>
+#include <ioring.h>
+#include <mman.h>
+#include <replay.h>
+#include <resource.h>
+#include "threads/counter.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/loader.h"
+#include "userprog/aio.h"
 #include "userprog/gdt.h"
+#include "userprog/futex.h"
+#include "userprog/pipe.h"
+#include "userprog/process.h"
+#include "userprog/uaccess.h"
+#include "devices/input.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
+#ifdef VM
+#include "vm/oom.h"
+#include "vm/shm.h"
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
+uint64_t syscall_simple_handler (uint64_t nr, const uint64_t args[]);
+static intr_handler_func inspect_syscalls;
+static counter_read_func read_syscall_calls, read_syscall_cycles;
+static void simple_mask_init (void);
+
+/* One buffer of sys_readv() or sys_writev(); matches struct iovec
+   in lib/user/syscall.h. */
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#define IOV_MAX 1024
+
+/* Longest file name open() copies in. */
+#define NAME_MAX 255
+
+static uint64_t sys_rwv (const uint64_t args[], bool write);
+static int64_t fd_rw (int fd, struct iovec *, int cnt, bool write,
+		off_t ofs);
+static int fd_sync (int fd, bool data_only);
+static int64_t console_read (struct iovec *, int cnt);
+static int64_t console_write (struct iovec *, int cnt);
+static int64_t pipe_rw (struct pipe_end *, struct iovec *, int cnt,
+		bool write);
+static int64_t pipe_splice (struct file *in, struct file *out, size_t len);
+static int64_t file_rw (struct file *, struct iovec *, int cnt, bool write,
+		off_t ofs);
+static int fd_open (const char *uname);
+static void fd_close (int fd);
+static int64_t ring_run (const struct io_sqe *);
+static void copy_lock (struct inode *in, struct inode *out, bool lock);
 
 /* System call.
  *
@@ -35,12 +94,1230 @@ syscall_init (void) {
 	 * mode stack. Therefore, we masked the FLAG_FL. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
+
+	simple_mask_init ();
+	futex_init ();
+	intr_register_int (0x48, 3, INTR_OFF, inspect_syscalls,
+			"Inspect System Calls");
+	counter_register ("syscall.calls", read_syscall_calls, NULL);
+	counter_register ("syscall.cycles", read_syscall_cycles, NULL);
+}
+
+/* Prints system call counts and latencies at shutdown, for the
+   "-sysstat" option. */
+bool syscall_stat;
+
+/* A system call handler.  ARGS holds as many arguments as the
+   call's entry in SYSCALLS says; the value returned goes back to
+   the user in RAX. */
+typedef uint64_t syscall_func (const uint64_t args[]);
+
+static syscall_func sys_exit, sys_fork, sys_exec, sys_wait, sys_create,
+		sys_remove, sys_open, sys_filesize, sys_read, sys_write, sys_seek,
+		sys_tell, sys_close, sys_futex_wait, sys_futex_wake, sys_spawn,
+		sys_wait_any, sys_readv, sys_writev, sys_pread, sys_pwrite, sys_io_ring_setup,
+		sys_io_ring_enter, sys_copy_file_range, sys_dup2, sys_fsync,
+		sys_fdatasync, sys_getdents, sys_symlink, sys_fallocate,
+		sys_sched_setaffinity, sys_sched_getaffinity, sys_aio_read,
+		sys_aio_write, sys_aio_wait, sys_thread_spawn, sys_thread_join,
+		sys_set_tls, sys_getrusage, sys_pipe, sys_counter_find,
+		sys_counter_read, sys_counter_name, sys_clock_gettime_ns;
+#ifdef VM
+static syscall_func sys_mmap, sys_munmap, sys_madvise, sys_oom_adjust,
+		sys_shm_open, sys_shm_map, sys_shm_unmap, sys_shm_unlink;
+#endif
+
+/* System calls, by number.
+
+   A SIMPLE call needs nothing of the user's state but its
+   arguments, so syscall_entry saves only the argument registers
+   for it instead of a whole struct intr_frame.  Calls that start
+   or end threads or processes keep the full frame. */
+struct syscall {
+	const char *name;
+	int argc;
+	syscall_func *func;         /* Null if not implemented. */
+	bool simple;                /* Takes the light entry path? */
+};
+
+static const struct syscall syscalls[] = {
+	[SYS_EXIT] = { "exit", 1, sys_exit },
+	[SYS_FORK] = { "fork", 1, sys_fork },
+	[SYS_EXEC] = { "exec", 1, sys_exec },
+	[SYS_WAIT] = { "wait", 1, sys_wait },
+	[SYS_CREATE] = { "create", 2, sys_create, true },
+	[SYS_REMOVE] = { "remove", 1, sys_remove, true },
+	[SYS_OPEN] = { "open", 1, sys_open, true },
+	[SYS_FILESIZE] = { "filesize", 1, sys_filesize, true },
+	[SYS_READ] = { "read", 3, sys_read, true },
+	[SYS_WRITE] = { "write", 3, sys_write, true },
+	[SYS_SEEK] = { "seek", 2, sys_seek, true },
+	[SYS_TELL] = { "tell", 1, sys_tell, true },
+	[SYS_CLOSE] = { "close", 1, sys_close, true },
+	[SYS_DUP2] = { "dup2", 2, sys_dup2, true },
+	[SYS_FUTEX_WAIT] = { "futex_wait", 2, sys_futex_wait, true },
+	[SYS_FUTEX_WAKE] = { "futex_wake", 2, sys_futex_wake, true },
+	[SYS_SPAWN] = { "spawn", 2, sys_spawn },
+	[SYS_WAIT_ANY] = { "wait_any", 1, sys_wait_any },
+	[SYS_READV] = { "readv", 3, sys_readv, true },
+	[SYS_WRITEV] = { "writev", 3, sys_writev, true },
+	[SYS_PREAD] = { "pread", 4, sys_pread, true },
+	[SYS_PWRITE] = { "pwrite", 4, sys_pwrite, true },
+	[SYS_IO_RING_SETUP] = { "io_ring_setup", 1, sys_io_ring_setup, true },
+	[SYS_IO_RING_ENTER] = { "io_ring_enter", 1, sys_io_ring_enter, true },
+	[SYS_COPY_FILE_RANGE] = { "copy_file_range", 3, sys_copy_file_range, true },
+	[SYS_FSYNC] = { "fsync", 1, sys_fsync, true },
+	[SYS_FDATASYNC] = { "fdatasync", 1, sys_fdatasync, true },
+	[SYS_GETDENTS] = { "getdents", 3, sys_getdents, true },
+	[SYS_FALLOCATE] = { "fallocate", 3, sys_fallocate, true },
+	[SYS_SCHED_SETAFFINITY] = { "sched_setaffinity", 1,
+		sys_sched_setaffinity, true },
+	[SYS_SCHED_GETAFFINITY] = { "sched_getaffinity", 0,
+		sys_sched_getaffinity, true },
+	[SYS_AIO_READ] = { "aio_read", 5, sys_aio_read, true },
+	[SYS_AIO_WRITE] = { "aio_write", 5, sys_aio_write, true },
+	[SYS_AIO_WAIT] = { "aio_wait", 1, sys_aio_wait, true },
+	[SYS_THREAD_SPAWN] = { "thread_spawn", 5, sys_thread_spawn },
+	[SYS_THREAD_JOIN] = { "thread_join", 1, sys_thread_join },
+	[SYS_SET_TLS] = { "set_tls", 1, sys_set_tls, true },
+	[SYS_GETRUSAGE] = { "getrusage", 1, sys_getrusage, true },
+	[SYS_SYMLINK] = { "symlink", 2, sys_symlink, true },
+	[SYS_PIPE] = { "pipe", 1, sys_pipe, true },
+	[SYS_COUNTER_FIND] = { "counter_find", 1, sys_counter_find, true },
+	[SYS_COUNTER_READ] = { "counter_read", 1, sys_counter_read, true },
+	[SYS_COUNTER_NAME] = { "counter_name", 3, sys_counter_name, true },
+	[SYS_CLOCK_GETTIME_NS] = { "clock_gettime_ns", 0, sys_clock_gettime_ns,
+		true },
+#ifdef VM
+	[SYS_MMAP] = { "mmap", 5, sys_mmap, true },
+	[SYS_MUNMAP] = { "munmap", 1, sys_munmap, true },
+	[SYS_MADVISE] = { "madvise", 3, sys_madvise, true },
+	[SYS_OOM_ADJUST] = { "oom_adjust", 1, sys_oom_adjust, true },
+	[SYS_SHM_OPEN] = { "shm_open", 2, sys_shm_open, true },
+	[SYS_SHM_MAP] = { "shm_map", 3, sys_shm_map, true },
+	[SYS_SHM_UNMAP] = { "shm_unmap", 1, sys_shm_unmap, true },
+	[SYS_SHM_UNLINK] = { "shm_unlink", 1, sys_shm_unlink, true },
+#endif
+};
+#define SYSCALL_CNT (sizeof syscalls / sizeof *syscalls)
+
+/* Bit N is set if call N is simple; read by syscall_entry, which
+   sends calls numbered 64 or more down the full path. */
+uint64_t syscall_simple_mask;
+
+static uint64_t syscall_dispatch (uint64_t nr, const uint64_t args[]);
+static void replay_capture (uint64_t nr, const uint64_t args[],
+		uint64_t ret);
+
+/* Sets up syscall_simple_mask from SYSCALLS. */
+static void
+simple_mask_init (void) {
+	for (size_t nr = 0; nr < SYSCALL_CNT && nr < 64; nr++)
+		if (syscalls[nr].func != NULL && syscalls[nr].simple)
+			syscall_simple_mask |= 1ull << nr;
 }
 
+/* Calls of each system call and TSC cycles spent in them.  A call
+   that does not return, like exit, is counted but not timed. */
+static struct {
+	long long cnt;
+	uint64_t cycles;
+	uint64_t max;
+} stats[SYSCALL_CNT];
+
 /* The main system call interface */
 void
-syscall_handler (struct intr_frame *f UNUSED) {
-	// TODO: Your implementation goes here.
-	printf ("system call!\n");
+syscall_handler (struct intr_frame *f) {
+	uint64_t nr = f->R.rax;
+	uint64_t args[6] = { 0 };
+	const struct syscall *sc;
+
+	/* A call that does not exist, or is not implemented, fails. */
+	if (nr >= SYSCALL_CNT || syscalls[nr].func == NULL) {
+		f->R.rax = -1;
+		return;
+	}
+	sc = &syscalls[nr];
+
+	/* Arguments come in RDI, RSI, RDX, R10, R8 and R9. */
+	switch (sc->argc) {
+		case 6: args[5] = f->R.r9;   /* Fall through. */
+		case 5: args[4] = f->R.r8;   /* Fall through. */
+		case 4: args[3] = f->R.r10;  /* Fall through. */
+		case 3: args[2] = f->R.rdx;  /* Fall through. */
+		case 2: args[1] = f->R.rsi;  /* Fall through. */
+		case 1: args[0] = f->R.rdi;  /* Fall through. */
+		default: break;
+	}
+	thread_current ()->syscall_if = f;
+	f->R.rax = syscall_dispatch (nr, args);
+}
+
+/* The light path's system call interface, for call NR, which is
+   simple, with the six argument registers in ARGS.  Returns the
+   value for RAX. */
+uint64_t
+syscall_simple_handler (uint64_t nr, const uint64_t args[]) {
+	ASSERT (nr < SYSCALL_CNT && syscalls[nr].simple);
+
+	return syscall_dispatch (nr, args);
+}
+
+/* Runs call NR, which is implemented, with ARGS, keeping its
+   statistics, and returns its result. */
+static uint64_t
+syscall_dispatch (uint64_t nr, const uint64_t args[]) {
+	uint64_t start, cycles, max, ret;
+
+	/* A thread whose process is exiting goes with it. */
+	if (process_group_exiting ())
+		thread_exit ();
+
+	__atomic_add_fetch (&stats[nr].cnt, 1, __ATOMIC_RELAXED);
+	if (nr == SYS_EXIT)
+		replay_capture (nr, args, 0);
+	start = rdtsc ();
+	ret = syscalls[nr].func (args);
+	cycles = rdtsc () - start;
+	trace (TRACE_SYSCALL, nr, ret, cycles);
+	replay_capture (nr, args, ret);
+	__atomic_add_fetch (&stats[nr].cycles, cycles, __ATOMIC_RELAXED);
+	max = __atomic_load_n (&stats[nr].max, __ATOMIC_RELAXED);
+	while (cycles > max && !__atomic_compare_exchange_n (&stats[nr].max,
+				&max, cycles, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		continue;
+	return ret;
+}
+
+/* Records call NR, with ARGS, which returned RET, for replay, if
+   "-trace=replay" asked for it and it is a call that
+   tests/filesys/extended/replay knows how to issue again.  Exit,
+   which does not return, is recorded before it runs.  The record
+   layout is in lib/replay.h. */
+static void
+replay_capture (uint64_t nr, const uint64_t args[], uint64_t ret) {
+	uint32_t tid = thread_tid ();
+	int argc = syscalls[nr].argc;
+	bool path = false;
+	int i;
+
+	if (!(trace_mask & TRACE_BIT (TRACE_REPLAY)))
+		return;
+	switch (nr) {
+		case SYS_CREATE: case SYS_REMOVE: case SYS_OPEN:
+			path = true;
+			break;
+		case SYS_CLOSE: case SYS_READ: case SYS_WRITE: case SYS_SEEK:
+		case SYS_PREAD: case SYS_PWRITE: case SYS_FSYNC: case SYS_MMAP:
+		case SYS_MUNMAP: case SYS_FORK: case SYS_WAIT: case SYS_EXIT:
+			break;
+		default:
+			return;
+	}
+
+	if (path) {
+		char name[REPLAY_PATH_MAX + 1];
+		int64_t len = strncpy_from_user (name, (const char *) args[0],
+				sizeof name);
+
+		if (len < 0)
+			len = 0;
+		else if (len > REPLAY_PATH_MAX)
+			len = REPLAY_PATH_MAX;
+		memset (name + len, 0, sizeof name - len);
+		for (i = 0; i < len; i += 16) {
+			uint64_t chunk[2];
+
+			memcpy (chunk, name + i, sizeof chunk);
+			trace (TRACE_REPLAY, REPLAY_A (REPLAY_PATH, tid), chunk[0],
+					chunk[1]);
+		}
+	}
+	trace (TRACE_REPLAY, REPLAY_A (nr, tid), ret, args[0]);
+	for (i = 1; i < argc; i += 2)
+		trace (TRACE_REPLAY, REPLAY_A (REPLAY_MORE, tid), args[i],
+				i + 1 < argc ? args[i + 1] : 0);
+}
+
+static uint64_t
+sys_exit (const uint64_t args[]) {
+	thread_current ()->exit_status = (int) args[0];
 	thread_exit ();
 }
+
+static uint64_t
+sys_wait (const uint64_t args[]) {
+	return process_wait ((tid_t) args[0]);
+}
+
+/* create (file, initial_size): creates FILE, INITIAL_SIZE bytes
+   long and reading as zeros.  Returns true, or false if FILE
+   already exists or there is no room for it. */
+static uint64_t
+sys_create (const uint64_t args[]) {
+	char name[NAME_MAX + 1];
+	unsigned size = args[1];
+	int64_t len;
+
+	len = strncpy_from_user (name, (const char *) args[0], sizeof name);
+	if (len < 0 || len == sizeof name || size > INT32_MAX)
+		return false;
+	return filesys_create (name, size);
+}
+
+/* remove (file): deletes FILE.  Descriptors open on it keep
+   working until they are closed.  Returns true, or false. */
+static uint64_t
+sys_remove (const uint64_t args[]) {
+	char name[NAME_MAX + 1];
+	int64_t len;
+
+	len = strncpy_from_user (name, (const char *) args[0], sizeof name);
+	if (len < 0 || len == sizeof name)
+		return false;
+	return filesys_remove (name);
+}
+
+static uint64_t
+sys_open (const uint64_t args[]) {
+	return fd_open ((const char *) args[0]);
+}
+
+/* filesize (fd): returns the length of FD's file, or -1 if FD is
+   not an open file. */
+static uint64_t
+sys_filesize (const uint64_t args[]) {
+	struct file *file = process_fd_get ((int) args[0]);
+
+	return fd_is_file (file) ? file_length (file) : -1;
+}
+
+static uint64_t
+sys_read (const uint64_t args[]) {
+	struct iovec iov = { (void *) args[1], (unsigned) args[2] };
+
+	return fd_rw ((int) args[0], &iov, 1, false, -1);
+}
+
+static uint64_t
+sys_write (const uint64_t args[]) {
+	struct iovec iov = { (void *) args[1], (unsigned) args[2] };
+
+	return fd_rw ((int) args[0], &iov, 1, true, -1);
+}
+
+/* seek (fd, position): moves FD's position to POSITION bytes from
+   the start of its file, which may be past the end.  Does nothing
+   if FD is not an open file. */
+static uint64_t
+sys_seek (const uint64_t args[]) {
+	struct file *file = process_fd_get ((int) args[0]);
+	unsigned pos = args[1];
+
+	if (fd_is_file (file) && pos <= INT32_MAX)
+		file_seek (file, pos);
+	return 0;
+}
+
+/* tell (fd): returns FD's position, or -1 if FD is not an open
+   file. */
+static uint64_t
+sys_tell (const uint64_t args[]) {
+	struct file *file = process_fd_get ((int) args[0]);
+
+	return fd_is_file (file) ? file_tell (file) : -1;
+}
+
+static uint64_t
+sys_close (const uint64_t args[]) {
+	fd_close ((int) args[0]);
+	return 0;
+}
+
+/* dup2 (oldfd, newfd): makes NEWFD refer to what OLDFD does,
+   sharing its file and position, after closing what NEWFD held.
+   Returns NEWFD, or -1. */
+static uint64_t
+sys_dup2 (const uint64_t args[]) {
+	int oldfd = (int) args[0], newfd = (int) args[1];
+	struct file *file = process_fd_get (oldfd), *old;
+
+	if (file == NULL)
+		return -1;
+	if (oldfd == newfd)
+		return newfd;
+	file = process_fd_dup (file);
+	if (!process_fd_install (newfd, file, &old)) {
+		old = file;
+		newfd = -1;
+	}
+	process_fd_close (old);
+	return newfd;
+}
+
+/* symlink (target, linkpath): creates LINKPATH as a symbolic link
+   to TARGET, which need not exist.  Returns 0, or -1. */
+static uint64_t
+sys_symlink (const uint64_t args[]) {
+	char target[NAME_MAX + 1], linkpath[NAME_MAX + 1];
+	int64_t len;
+	bool ok;
+
+	len = strncpy_from_user (target, (const char *) args[0], sizeof target);
+	if (len < 0 || len == sizeof target)
+		return -1;
+	len = strncpy_from_user (linkpath, (const char *) args[1],
+			sizeof linkpath);
+	if (len < 0 || len == sizeof linkpath)
+		return -1;
+	ok = filesys_symlink (target, linkpath);
+	return ok ? 0 : -1;
+}
+
+/* fsync (fd) and fdatasync (fd): write FD's file from the cache
+   to disk, its data before its inode, and return once it is there.
+   Only the file's own dirty sectors are written.  fdatasync()
+   leaves the inode alone unless the data's layout changed.  Return
+   0, or -1. */
+static uint64_t
+sys_fsync (const uint64_t args[]) {
+	return fd_sync ((int) args[0], false);
+}
+
+static uint64_t
+sys_fdatasync (const uint64_t args[]) {
+	return fd_sync ((int) args[0], true);
+}
+
+/* fallocate (fd, offset, len): reserves disk space for LEN bytes
+   of FD's file from OFFSET on, growing the file if they run past
+   its end.  The space is placed as one run after the file's data
+   where the disk allows, and reads as zeros until written, so
+   later writes into it allocate nothing.  Returns 0, or -1. */
+static uint64_t
+sys_fallocate (const uint64_t args[]) {
+	struct file *file = process_fd_get ((int) args[0]);
+	int64_t ofs = args[1], len = args[2];
+	bool ok;
+
+	if (!fd_is_file (file) || ofs < 0 || len <= 0
+			|| ofs > INT32_MAX || len > INT32_MAX)
+		return -1;
+	inode_lock (file_get_inode (file), true);
+	ok = file_allocate (file, ofs, len);
+	inode_unlock (file_get_inode (file), true);
+	return ok ? 0 : -1;
+}
+
+/* getdents (fd, buf, size): fills BUF with as many struct dirents
+   of directory FD, from its position on, as fit in SIZE bytes, at
+   most a page's worth per call, and moves the position past them.
+   Returns the bytes filled, 0 at the end, or -1 if FD is not a
+   directory or BUF cannot hold the next entry. */
+static uint64_t
+sys_getdents (const uint64_t args[]) {
+	struct file *file = process_fd_get ((int) args[0]);
+	void *ubuf = (void *) args[1];
+	size_t size = args[2] < PGSIZE ? args[2] : PGSIZE;
+	int64_t n;
+	void *buf;
+
+	if (!fd_is_file (file) || !user_access_ok (ubuf, size, true))
+		return -1;
+	buf = palloc_get_page (0);
+	if (buf == NULL)
+		return -1;
+	n = file_getdents (file, buf, size);
+	if (n > 0 && !copy_to_user (ubuf, buf, n))
+		n = -1;
+	palloc_free_page (buf);
+	return n;
+}
+
+static uint64_t
+sys_readv (const uint64_t args[]) {
+	return sys_rwv (args, false);
+}
+
+static uint64_t
+sys_writev (const uint64_t args[]) {
+	return sys_rwv (args, true);
+}
+
+/* pread (fd, buf, n, off) and pwrite (fd, buf, n, off): read or
+   write at byte offset OFF of FD's file, without using or moving
+   its position, so that threads sharing the file need not seek. */
+static uint64_t
+sys_pread (const uint64_t args[]) {
+	struct iovec iov = { (void *) args[1], (unsigned) args[2] };
+
+	if ((off_t) args[3] < 0)
+		return -1;
+	return fd_rw ((int) args[0], &iov, 1, false, (off_t) args[3]);
+}
+
+static uint64_t
+sys_pwrite (const uint64_t args[]) {
+	struct iovec iov = { (void *) args[1], (unsigned) args[2] };
+
+	if ((off_t) args[3] < 0)
+		return -1;
+	return fd_rw ((int) args[0], &iov, 1, true, (off_t) args[3]);
+}
+
+/* readv (fd, iov, iovcnt) and writev (fd, iov, iovcnt): moves data
+   between descriptor FD and the IOVCNT buffers of IOV in turn, as
+   one read() or write() would for a single buffer.  Returns the
+   bytes moved, or -1. */
+static uint64_t
+sys_rwv (const uint64_t args[], bool write) {
+	const struct iovec *uiov = (const struct iovec *) args[1];
+	int cnt = (int) args[2];
+	struct iovec *iov;
+	int64_t n;
+
+	if (cnt < 0 || cnt > IOV_MAX)
+		return -1;
+	if (cnt == 0)
+		return 0;
+	iov = malloc (cnt * sizeof *iov);
+	if (iov == NULL)
+		return -1;
+	n = copy_from_user (iov, uiov, cnt * sizeof *iov)
+		? fd_rw ((int) args[0], iov, cnt, write, -1) : -1;
+	free (iov);
+	return n;
+}
+
+/* Moves data between descriptor FD and the CNT user buffers in
+ * IOV, a kernel copy of the user's array: reads into them unless
+ * WRITE.  All the buffers are checked first, so that the transfer
+ * itself cannot fault on a bad address, and files are then read
+ * or written with one call per run of adjacent buffers, all under
+ * one hold of the file system lock.  A file is accessed at its
+ * position, which moves past the data, or at byte offset OFS if it
+ * is not negative; the console has no offsets.  Returns the bytes
+ * moved, or -1. */
+static int64_t
+fd_rw (int fd, struct iovec *iov, int cnt, bool write, off_t ofs) {
+	struct file *file;
+	size_t total = 0;
+	int64_t n;
+
+	for (int i = 0; i < cnt; i++) {
+		if (!user_access_ok (iov[i].iov_base, iov[i].iov_len, !write))
+			return -1;
+		total += iov[i].iov_len;
+		if (total < iov[i].iov_len || total > INT32_MAX)
+			return -1;
+	}
+
+	file = process_fd_get (fd);
+	if (file == FD_CONSOLE_IN)
+		return !write && ofs < 0 ? console_read (iov, cnt) : -1;
+	if (file == FD_CONSOLE_OUT)
+		return write && ofs < 0 ? console_write (iov, cnt) : -1;
+	if (fd_is_pipe (file))
+		return ofs < 0 ? pipe_rw (fd_to_pipe (file), iov, cnt, write) : -1;
+	if (file == NULL)
+		return -1;
+	inode_lock (file_get_inode (file), write);
+	n = file_rw (file, iov, cnt, write, ofs);
+	inode_unlock (file_get_inode (file), write);
+	return n;
+}
+
+/* Opens the file named by user string UNAME as a new descriptor.
+   Returns the descriptor, or -1. */
+static int
+fd_open (const char *uname) {
+	char name[NAME_MAX + 1];
+	struct file *file;
+	int64_t len;
+	int fd;
+
+	len = strncpy_from_user (name, uname, sizeof name);
+	if (len < 0 || len == sizeof name)
+		return -1;
+	file = filesys_open (name);
+	fd = file != NULL ? process_fd_add (file) : -1;
+	if (fd < 0)
+		file_close (file);
+	return fd;
+}
+
+/* Closes descriptor FD, if open. */
+static void
+fd_close (int fd) {
+	process_fd_close (process_fd_remove (fd));
+}
+
+/* Writes descriptor FD's file to disk, as file_sync() does.  No
+   lock is held while the writes wait for the disk, so other calls
+   on the file go on meanwhile.  Returns 0, or -1 if FD is not an
+   open file. */
+static int
+fd_sync (int fd, bool data_only) {
+	struct file *file = process_fd_get (fd);
+
+	if (!fd_is_file (file))
+		return -1;
+	file_sync (file, data_only);
+	return 0;
+}
+
+/* Reads keyboard input into the CNT buffers of IOV, taking keys
+ * as they arrive, as many at once as are waiting.  Keys pass
+ * through a kernel buffer so that no fault on user memory happens
+ * inside input_getbuf(). */
+static int64_t
+console_read (struct iovec *iov, int cnt) {
+	int64_t n = 0;
+
+	for (int i = 0; i < cnt; i++) {
+		uint8_t *p = iov[i].iov_base;
+
+		for (size_t j = 0; j < iov[i].iov_len; ) {
+			uint8_t keys[64];
+			size_t want = iov[i].iov_len - j;
+			size_t got = input_getbuf (keys,
+					want < sizeof keys ? want : sizeof keys);
+
+			memcpy (p + j, keys, got);
+			j += got;
+		}
+		n += iov[i].iov_len;
+	}
+	return n;
+}
+
+/* Writes the CNT buffers of IOV to the console, straight from user
+ * memory, under one hold of the console lock so that they cannot
+ * interleave with other output. */
+static int64_t
+console_write (struct iovec *iov, int cnt) {
+	int64_t n = 0;
+
+	console_begin ();
+	for (int i = 0; i < cnt; i++) {
+		putbuf (iov[i].iov_base, iov[i].iov_len);
+		n += iov[i].iov_len;
+	}
+	console_end ();
+	return n;
+}
+
+/* Reads or writes pipe end END through the CNT buffers of IOV.  A
+ * read waits only for the first byte and takes what is there after
+ * that, so it stops at the first buffer left short. */
+static int64_t
+pipe_rw (struct pipe_end *end, struct iovec *iov, int cnt, bool write) {
+	int64_t done = 0;
+
+	for (int i = 0; i < cnt; i++) {
+		int64_t n = write
+			? pipe_write (end, iov[i].iov_base, iov[i].iov_len, true)
+			: pipe_read (end, iov[i].iov_base, iov[i].iov_len, true,
+					done == 0);
+
+		if (n < 0)
+			return done > 0 ? done : -1;
+		done += n;
+		if ((size_t) n < iov[i].iov_len)
+			break;
+	}
+	return done;
+}
+
+/* Reads or writes FILE through the CNT buffers of IOV, at its
+ * position or at OFS if not negative, with one call for each run
+ * of buffers that follow each other in memory.  Stops early at end
+ * of file.  Must hold FILESYS_LOCK. */
+static int64_t
+file_rw (struct file *file, struct iovec *iov, int cnt, bool write,
+		off_t ofs) {
+	int64_t done = 0;
+
+	for (int i = 0; i < cnt; ) {
+		uint8_t *base = iov[i].iov_base;
+		size_t len = iov[i].iov_len;
+		off_t n;
+
+		for (i++; i < cnt && (uint8_t *) iov[i].iov_base == base + len; i++)
+			len += iov[i].iov_len;
+		if (ofs < 0)
+			n = write ? file_write (file, base, len)
+				: file_read (file, base, len);
+		else
+			n = write ? file_write_at (file, base, len, ofs + done)
+				: file_read_at (file, base, len, ofs + done);
+		done += n;
+		if ((size_t) n < len)
+			break;
+	}
+	return done;
+}
+
+/* copy_file_range (in_fd, out_fd, len): copies up to LEN bytes
+ * from IN_FD's file to OUT_FD, a file or the console, at their
+ * positions, which move past the data.  The data goes through one
+ * kernel page instead of a user buffer, and whole sectors move
+ * between it and the disk without inode_read_at() or
+ * inode_write_at() bouncing them.  Either descriptor may instead be
+ * a pipe; see pipe_splice().  Returns the bytes copied, short at
+ * end of file, or -1. */
+static uint64_t
+sys_copy_file_range (const uint64_t args[]) {
+	struct file *in = process_fd_get ((int) args[0]);
+	struct file *out = process_fd_get ((int) args[1]);
+	size_t len = args[2] < INT32_MAX ? args[2] : INT32_MAX;
+	struct inode *out_inode;
+	int64_t done = 0;
+	uint8_t *buf;
+
+	if (fd_is_pipe (in) || fd_is_pipe (out))
+		return pipe_splice (in, out, len);
+	if (!fd_is_file (in) || out == NULL || out == FD_CONSOLE_IN)
+		return -1;
+	buf = palloc_get_page (0);
+	if (buf == NULL)
+		return -1;
+	out_inode = out != FD_CONSOLE_OUT ? file_get_inode (out) : NULL;
+	copy_lock (file_get_inode (in), out_inode, true);
+	while ((size_t) done < len) {
+		off_t chunk = len - done < PGSIZE ? len - done : PGSIZE;
+		off_t n = file_read (in, buf, chunk), wrote;
+
+		if (n <= 0)
+			break;
+		if (out == FD_CONSOLE_OUT) {
+			putbuf ((const char *) buf, n);
+			wrote = n;
+		} else
+			wrote = file_write (out, buf, n);
+		done += wrote;
+		if (wrote < n) {
+			/* Leave IN just past what reached OUT. */
+			file_seek (in, file_tell (in) - (n - wrote));
+			break;
+		}
+		if (n < chunk)
+			break;
+	}
+	copy_lock (file_get_inode (in), out_inode, false);
+	palloc_free_page (buf);
+	return done;
+}
+
+/* Does sys_copy_file_range() when IN or OUT, but not both, is a
+ * pipe, moving up to LEN bytes from a pipe to a file or the console,
+ * or from a file to a pipe, through one kernel page: the data never
+ * passes through user memory.  Waits for the first byte from a
+ * pipe, but not for more.  Bytes taken from a pipe that a file does
+ * not take are lost, as they would be to a read() and a short
+ * write(). */
+static int64_t
+pipe_splice (struct file *in, struct file *out, size_t len) {
+	int64_t done = 0;
+	uint8_t *buf;
+
+	if (fd_is_pipe (in) ? fd_is_pipe (out) || out == NULL
+			|| out == FD_CONSOLE_IN : !fd_is_file (in))
+		return -1;
+	buf = palloc_get_page (0);
+	if (buf == NULL)
+		return -1;
+	while ((size_t) done < len) {
+		off_t chunk = len - done < PGSIZE ? len - done : PGSIZE;
+		int64_t n, wrote;
+
+		if (fd_is_pipe (in))
+			n = pipe_read (fd_to_pipe (in), buf, chunk, false, done == 0);
+		else {
+			inode_lock (file_get_inode (in), false);
+			n = file_read (in, buf, chunk);
+			inode_unlock (file_get_inode (in), false);
+		}
+		if (n <= 0) {
+			if (n < 0 && done == 0)
+				done = -1;
+			break;
+		}
+
+		if (fd_is_pipe (out)) {
+			/* No reader left: nothing more can go. */
+			wrote = pipe_write (fd_to_pipe (out), buf, n, false);
+			if (wrote < 0) {
+				if (done == 0)
+					done = -1;
+				break;
+			}
+		} else if (out == FD_CONSOLE_OUT) {
+			putbuf ((const char *) buf, n);
+			wrote = n;
+		} else {
+			inode_lock (file_get_inode (out), true);
+			wrote = file_write (out, buf, n);
+			inode_unlock (file_get_inode (out), true);
+		}
+		done += wrote;
+		if (wrote < n) {
+			if (!fd_is_pipe (in))
+				file_seek (in, file_tell (in) - (n - wrote));
+			break;
+		}
+		if (n < chunk)
+			break;
+	}
+	palloc_free_page (buf);
+	return done;
+}
+
+/* Locks, or if !LOCK unlocks, IN for reading and OUT, unless it is
+   null, for writing, for sys_copy_file_range().  Two inodes are
+   locked in sector order, so that copies between two files in
+   opposite directions cannot deadlock. */
+static void
+copy_lock (struct inode *in, struct inode *out, bool lock) {
+	void (*op) (struct inode *, bool) = lock ? inode_lock : inode_unlock;
+
+	if (out == NULL)
+		op (in, false);
+	else if (out == in)
+		op (in, true);
+	else if (inode_get_inumber (in) < inode_get_inumber (out)) {
+		op (in, false);
+		op (out, true);
+	} else {
+		op (out, true);
+		op (in, false);
+	}
+}
+
+/* io_ring_setup (ring): makes RING, in the caller's memory, the
+   ring io_ring_enter() works on, or drops the current one if RING
+   is null.  Only its address is kept: the kernel reads and writes
+   the ring in place, so queueing costs no system call. */
+static uint64_t
+sys_io_ring_setup (const uint64_t args[]) {
+	struct io_ring *ring = (struct io_ring *) args[0];
+
+	if (ring != NULL && ((uint64_t) ring % sizeof (uint64_t) != 0
+				|| !user_access_ok (ring, sizeof *ring, true)))
+		return -1;
+	thread_current ()->ring = ring;
+	return 0;
+}
+
+/* io_ring_enter (to_submit): runs up to TO_SUBMIT queued
+ * submissions in order, posting each one's result before taking
+ * the next, and stops early when the submission ring empties or the
+ * completion ring fills.  Returns the submissions run, or -1 if no
+ * ring is set up or it is no longer mapped. */
+static uint64_t
+sys_io_ring_enter (const uint64_t args[]) {
+	struct io_ring *ring = thread_current ()->ring;
+	uint32_t want = (uint32_t) args[0], done;
+	uint32_t idx[4];            /* SQ head and tail, CQ head and tail. */
+
+	if (ring == NULL || !copy_from_user (idx, ring, sizeof idx))
+		return -1;
+	for (done = 0; done < want && idx[0] != idx[1]
+			&& idx[3] - idx[2] < IORING_ENTRIES; done++) {
+		struct io_sqe sqe;
+		struct io_cqe cqe;
+
+		if (!copy_from_user (&sqe, &ring->sq[idx[0] % IORING_ENTRIES],
+					sizeof sqe))
+			return -1;
+		cqe.user_data = sqe.user_data;
+		cqe.res = ring_run (&sqe);
+		if (!copy_to_user (&ring->cq[idx[3] % IORING_ENTRIES], &cqe,
+					sizeof cqe))
+			return -1;
+		idx[0]++;
+		idx[3]++;
+
+		/* Publish as we go, so that the process sees what ran even
+		   if a later entry kills it. */
+		if (!copy_to_user (&ring->sq_head, &idx[0], sizeof idx[0])
+				|| !copy_to_user (&ring->cq_tail, &idx[3], sizeof idx[3]))
+			return -1;
+	}
+	return done;
+}
+
+/* Runs submission SQE as the matching system call would and
+   returns what that call would. */
+static int64_t
+ring_run (const struct io_sqe *sqe) {
+	struct iovec iov = { (void *) sqe->addr, sqe->len };
+
+	switch (sqe->op) {
+		case IORING_OP_NOP:
+			return 0;
+		case IORING_OP_READ:
+		case IORING_OP_WRITE:
+			if (sqe->off > INT32_MAX)
+				return -1;
+			return fd_rw (sqe->fd, &iov, 1, sqe->op == IORING_OP_WRITE,
+					sqe->off < 0 ? -1 : (off_t) sqe->off);
+		case IORING_OP_OPEN:
+			return fd_open ((const char *) sqe->addr);
+		case IORING_OP_CLOSE:
+			fd_close (sqe->fd);
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+#ifdef VM
+/* mmap (addr, length, flags, fd, offset): maps LENGTH bytes of FD's
+   file from OFFSET at ADDR, writable if FLAGS has MAP_WRITE (or is
+   any other nonzero value without MAP_POPULATE).  With
+   MAP_POPULATE the pages are read in before returning rather than
+   on first touch.  Returns ADDR, or NULL. */
+static uint64_t
+sys_mmap (const uint64_t args[]) {
+	void *addr = (void *) args[0];
+	size_t length = args[1];
+	int flags = (int) args[2];
+	struct file *file = process_fd_get ((int) args[3]);
+	bool writable = flags & MAP_POPULATE ? flags & MAP_WRITE : flags != 0;
+	void *va;
+
+	if (!fd_is_file (file))
+		return 0;
+	va = do_mmap (addr, length, writable, file, (off_t) args[4]);
+	if (va != NULL && (flags & MAP_POPULATE))
+		vm_populate (va, length);
+	return (uint64_t) va;
+}
+
+static uint64_t
+sys_munmap (const uint64_t args[]) {
+	do_munmap ((void *) args[0]);
+	return 0;
+}
+
+/* madvise (addr, length, advice): tells the VM how the process
+   will use its pages from ADDR for LENGTH bytes; see lib/mman.h.
+   Returns 0, or -1 if the arguments are bad. */
+static uint64_t
+sys_madvise (const uint64_t args[]) {
+	return vm_madvise ((void *) args[0], args[1], (int) args[2]) ? 0 : -1;
+}
+
+/* oom_adjust (adj): sets the process's OOM score adjustment to
+   ADJ.  Returns 0, or -1 if ADJ is out of range. */
+static uint64_t
+sys_oom_adjust (const uint64_t args[]) {
+	return vm_oom_adjust ((int) args[0]) ? 0 : -1;
+}
+
+/* shm_open (name, size): returns the ID of the shared memory
+   segment named NAME, created with SIZE bytes if need be, or -1. */
+static uint64_t
+sys_shm_open (const uint64_t args[]) {
+	char name[SHM_NAME_MAX + 1];
+	int64_t len;
+
+	len = strncpy_from_user (name, (const char *) args[0], sizeof name);
+	if (len < 0 || len == sizeof name)
+		return -1;
+	return shm_open (name, args[1]);
+}
+
+/* shm_map (id, addr, writable): maps segment ID at ADDR.  Returns
+   ADDR, or NULL. */
+static uint64_t
+sys_shm_map (const uint64_t args[]) {
+	return (uint64_t) shm_map ((int) args[0], (void *) args[1], args[2] != 0);
+}
+
+/* shm_unmap (addr): unmaps the segment mapped at ADDR.  Returns
+   0, or -1 if there is none. */
+static uint64_t
+sys_shm_unmap (const uint64_t args[]) {
+	return shm_unmap ((void *) args[0]) ? 0 : -1;
+}
+
+/* shm_unlink (name): removes the name NAME.  Returns 0, or -1 if
+   no segment has it. */
+static uint64_t
+sys_shm_unlink (const uint64_t args[]) {
+	char name[SHM_NAME_MAX + 1];
+	int64_t len;
+
+	len = strncpy_from_user (name, (const char *) args[0], sizeof name);
+	if (len < 0 || len == sizeof name)
+		return -1;
+	return shm_unlink (name) ? 0 : -1;
+}
+#endif
+
+static uint64_t
+sys_futex_wait (const uint64_t args[]) {
+	return futex_wait ((uint32_t *) args[0], (uint32_t) args[1]);
+}
+
+static uint64_t
+sys_futex_wake (const uint64_t args[]) {
+	return futex_wake ((uint32_t *) args[0], (int) args[1]);
+}
+
+/* fork (thread_name): clones the running process, which goes on
+   in a child named THREAD_NAME.  Returns the child's tid, or -1,
+   and 0 in the child. */
+static uint64_t
+sys_fork (const uint64_t args[]) {
+	char name[16];
+	int64_t len = strncpy_from_user (name, (const char *) args[0],
+			sizeof name);
+
+	if (len < 0)
+		return -1;
+	name[sizeof name - 1] = '\0';
+	return process_fork (name, thread_current ()->syscall_if);
+}
+
+/* exec (cmd_line): runs CMD_LINE, a program name and its
+   arguments, in place of the running process's program.  Does not
+   return: if the program cannot be loaded, the old one is gone
+   already, and the process exits with status -1.  A process whose
+   address space other threads share cannot exec. */
+static uint64_t
+sys_exec (const uint64_t args[]) {
+	struct thread *t = thread_current ();
+	char *cmd_line = NULL;
+	int64_t len;
+
+	if (t->leader == NULL && t->members == 0)
+		cmd_line = palloc_get_page (0);
+	if (cmd_line != NULL) {
+		len = strncpy_from_user (cmd_line, (const char *) args[0], PGSIZE);
+		if (len > 0 && len < PGSIZE)
+			process_exec (cmd_line);    /* Frees CMD_LINE if it returns. */
+		else
+			palloc_free_page (cmd_line);
+	}
+	t->exit_status = -1;
+	thread_exit ();
+}
+
+static uint64_t
+sys_spawn (const uint64_t args[]) {
+	return process_spawn ((const char *) args[0], (char *const *) args[1]);
+}
+
+static uint64_t
+sys_wait_any (const uint64_t args[]) {
+	return process_wait_any ((int *) args[0]);
+}
+
+/* sched_setaffinity (mask): lets the process run only on the CPUs
+   in MASK, bit N for CPU N.  Returns 0, or -1 if none of them
+   schedules threads. */
+static uint64_t
+sys_sched_setaffinity (const uint64_t args[]) {
+	if (args[0] > UINT32_MAX)
+		return -1;
+	return thread_set_affinity (thread_current (), args[0]) ? 0 : -1;
+}
+
+/* sched_getaffinity (): returns the mask of CPUs the process may
+   run on. */
+static uint64_t
+sys_sched_getaffinity (const uint64_t args[] UNUSED) {
+	return thread_get_affinity (thread_current ());
+}
+
+/* aio_read (fd, buf, n, off, status) and aio_write (fd, buf, n,
+   off, status): queue a pread() or pwrite() for kernel workers and
+   return 0 at once, or -1.  STATUS reads AIO_INPROGRESS until the
+   request is delivered; see userprog/aio.c. */
+static uint64_t
+sys_aio_read (const uint64_t args[]) {
+	if ((off_t) args[3] < 0 || args[3] > INT32_MAX)
+		return -1;
+	return aio_submit ((int) args[0], (void *) args[1], args[2],
+			(off_t) args[3], (int *) args[4], false);
+}
+
+static uint64_t
+sys_aio_write (const uint64_t args[]) {
+	if ((off_t) args[3] < 0 || args[3] > INT32_MAX)
+		return -1;
+	return aio_submit ((int) args[0], (void *) args[1], args[2],
+			(off_t) args[3], (int *) args[4], true);
+}
+
+/* aio_wait (status): waits for the request with status word
+   STATUS and returns its result, or with a null STATUS collects
+   whatever has finished and returns how many. */
+static uint64_t
+sys_aio_wait (const uint64_t args[]) {
+	return aio_wait ((int *) args[0]);
+}
+
+/* thread_spawn (entry, arg0, arg1, stack, tls): starts a thread
+   in this process at ENTRY, with ARG0 and ARG1 as its first two
+   arguments, STACK as its stack pointer and TLS as its FS base.
+   Returns its tid, or -1. */
+static uint64_t
+sys_thread_spawn (const uint64_t args[]) {
+	return process_thread_spawn (args[0], args[1], args[2], args[3], args[4]);
+}
+
+/* thread_join (tid): waits for thread TID, started by the caller,
+   to exit and returns its exit status, as wait() does. */
+static uint64_t
+sys_thread_join (const uint64_t args[]) {
+	return process_wait ((tid_t) args[0]);
+}
+
+/* set_tls (base): sets the calling thread's FS base.  Returns 0,
+   or -1. */
+static uint64_t
+sys_set_tls (const uint64_t args[]) {
+	return process_set_tls (args[0]) ? 0 : -1;
+}
+
+/* getrusage (usage): stores the process's resource use in *USAGE.
+   Returns 0, or -1 if USAGE is bad. */
+static uint64_t
+sys_getrusage (const uint64_t args[]) {
+	struct rusage ru;
+
+	process_getrusage (&ru);
+	return copy_to_user ((void *) args[0], &ru, sizeof ru) ? 0 : -1;
+}
+
+/* pipe (fds): creates a pipe and stores descriptors for its read
+   and write ends in FDS[0] and FDS[1].  Returns 0, or -1. */
+static uint64_t
+sys_pipe (const uint64_t args[]) {
+	struct pipe_end *read_end, *write_end;
+	int fds[2];
+
+	if (!pipe_create (&read_end, &write_end))
+		return -1;
+	fds[0] = process_fd_add (pipe_to_fd (read_end));
+	fds[1] = fds[0] >= 0 ? process_fd_add (pipe_to_fd (write_end)) : -1;
+	if (fds[1] >= 0 && copy_to_user ((void *) args[0], fds, sizeof fds))
+		return 0;
+
+	if (fds[0] >= 0)
+		fd_close (fds[0]);
+	else
+		pipe_end_close (read_end);
+	if (fds[1] >= 0)
+		fd_close (fds[1]);
+	else
+		pipe_end_close (write_end);
+	return -1;
+}
+
+/* counter_find (name): returns the ID of the kernel counter NAME,
+   or -1. */
+static uint64_t
+sys_counter_find (const uint64_t args[]) {
+	char name[COUNTER_NAME_MAX + 1];
+	int64_t len;
+
+	len = strncpy_from_user (name, (const char *) args[0], sizeof name);
+	if (len < 0 || len == sizeof name)
+		return -1;
+	return counter_find (name);
+}
+
+/* counter_read (id): returns the value of kernel counter ID, or -1
+   if there is none. */
+static uint64_t
+sys_counter_read (const uint64_t args[]) {
+	return counter_read ((int) args[0]);
+}
+
+/* counter_name (id, buf, size): copies the name of kernel counter
+   ID into BUF, truncated to SIZE bytes with a null terminator.
+   Returns the name's length, or -1. */
+static uint64_t
+sys_counter_name (const uint64_t args[]) {
+	const char *name = counter_name ((int) args[0]);
+	size_t size = args[2];
+	char copy[COUNTER_NAME_MAX + 1];
+
+	if (name == NULL)
+		return -1;
+	if (size > 0) {
+		strlcpy (copy, name, size < sizeof copy ? size : sizeof copy);
+		if (!copy_to_user ((void *) args[1], copy, strlen (copy) + 1))
+			return -1;
+	}
+	return strlen (name);
+}
+
+/* clock_gettime_ns (): returns nanoseconds since boot. */
+static uint64_t
+sys_clock_gettime_ns (const uint64_t args[] UNUSED) {
+	return timer_nsec ();
+}
+
+/* System call statistics inspection, via int 0x48.
+ * Input:
+ *   @RAX - What to read: 0 for calls made, 1 for TSC cycles spent
+ *          in them, 2 for the most cycles one took.
+ *   @RDX - System call number.
+ * Output:
+ *   @RAX - The requested count, or -1 if the input is invalid. */
+static void
+inspect_syscalls (struct intr_frame *f) {
+	uint64_t what = f->R.rax, nr = f->R.rdx;
+
+	if (nr >= SYSCALL_CNT) {
+		f->R.rax = -1;
+		return;
+	}
+	switch (what) {
+		case 0: f->R.rax = stats[nr].cnt; break;
+		case 1: f->R.rax = stats[nr].cycles; break;
+		case 2: f->R.rax = stats[nr].max; break;
+		default: f->R.rax = -1; break;
+	}
+}
+
+/* Reads the calls made to every system call. */
+static long long
+read_syscall_calls (void *aux UNUSED) {
+	long long sum = 0;
+
+	for (size_t nr = 0; nr < SYSCALL_CNT; nr++)
+		sum += stats[nr].cnt;
+	return sum;
+}
+
+/* Reads the TSC cycles spent in every system call. */
+static long long
+read_syscall_cycles (void *aux UNUSED) {
+	long long sum = 0;
+
+	for (size_t nr = 0; nr < SYSCALL_CNT; nr++)
+		sum += stats[nr].cycles;
+	return sum;
+}
+
+/* Prints the calls made to each system call and their latency. */
+void
+syscall_print_stats (void) {
+	for (size_t nr = 0; nr < SYSCALL_CNT; nr++) {
+		long long cnt = stats[nr].cnt;
+
+		if (cnt == 0)
+			continue;
+		printf ("Syscall %s: %lld calls, %llu cycles avg, %llu max\n",
+				syscalls[nr].name, cnt,
+				(unsigned long long) (stats[nr].cycles / cnt),
+				(unsigned long long) stats[nr].max);
+	}
+}
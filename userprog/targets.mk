@@ -2,5 +2,11 @@ userprog_SRC  = userprog/process.c	# Process loading.
 userprog_SRC += userprog/exception.c	# User exception handler.
 userprog_SRC += userprog/syscall-entry.S # System call entry.
 userprog_SRC += userprog/syscall.c	# System call handler.
+userprog_SRC += userprog/futex.c	# Futex wait/wake.
+userprog_SRC += userprog/aio.c		# Asynchronous file I/O.
+userprog_SRC += userprog/pipe.c		# Pipes.
+userprog_SRC += userprog/uaccess.c	# User memory access.
+userprog_SRC += userprog/usercopy.S	# ...and its faulting primitives.
+userprog_SRC += userprog/vdso.c		# Pages shared with user processes.
 userprog_SRC += userprog/gdt.c		# GDT initialization.
 userprog_SRC += userprog/tss.c		# TSS management.
@@ -0,0 +1,103 @@
+/* Copying to and from user memory.
+
+   Rather than walking the page table to check each user pointer,
+   these just touch user memory, through the primitives in
+   usercopy.S.  If the address is bad, the page fault handler
+   finds the faulting instruction in usercopy_fixups and resumes
+   at its fixup, which makes the copy fail.  Under VM, lazily
+   loaded and copy-on-write pages fault in as for the user, before
+   the fixup is tried.  A valid argument thus costs no page-table
+   walk at all.
+
+   The one check left is that the range lies below KERN_BASE,
+   since kernel addresses are mapped and would not fault. */
+
+#include "userprog/uaccess.h"
+#include "threads/vaddr.h"
+
+/* An instruction in usercopy.S that may fault, and where to
+   resume if it does. */
+struct usercopy_fixup {
+	uint64_t insn;
+	uint64_t fixup;
+};
+
+extern const struct usercopy_fixup usercopy_fixups[];
+bool usercopy (void *dst, const void *src, size_t size);
+int64_t userstrncpy (char *dst, const char *src, size_t size);
+
+/* Returns true if the SIZE bytes at UADDR are all below
+   KERN_BASE. */
+static bool
+user_range_ok (const void *uaddr, size_t size) {
+	uint64_t start = (uint64_t) uaddr;
+
+	return start + size >= start && start + size <= KERN_BASE;
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns false
+   if any of them is not readable user memory. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size) {
+	return user_range_ok (usrc, size) && usercopy (dst, usrc, size);
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns false,
+   having copied only part, if any of them is not writable user
+   memory. */
+bool
+copy_to_user (void *udst, const void *src, size_t size) {
+	return user_range_ok (udst, size) && usercopy (udst, src, size);
+}
+
+/* Copies the user string USRC, null included, into DST, which
+   holds SIZE bytes.  Returns the string's length, SIZE if it does
+   not fit (DST is then not null-terminated), or -1 if it is not
+   all readable user memory. */
+int64_t
+strncpy_from_user (char *dst, const char *usrc, size_t size) {
+	uint64_t start = (uint64_t) usrc;
+	size_t room;
+	int64_t len;
+
+	if (start >= KERN_BASE)
+		return -1;
+	room = KERN_BASE - start < size ? KERN_BASE - start : size;
+	len = userstrncpy (dst, usrc, room);
+
+	/* Running into kernel space is as bad as faulting. */
+	if (len == (int64_t) room && room < size)
+		return -1;
+	return len;
+}
+
+/* Returns true if the SIZE bytes at UADDR are user memory that
+   can be read, and written too if WRITE, so that the kernel may
+   then access them directly.  Touches a byte of each page, which
+   also brings the pages in. */
+bool
+user_access_ok (void *uaddr, size_t size, bool write) {
+	uint8_t *p = uaddr, *end = p + size;
+	uint8_t b;
+
+	if (!user_range_ok (uaddr, size))
+		return false;
+	while (p < end) {
+		if (!usercopy (&b, p, 1) || (write && !usercopy (p, &b, 1)))
+			return false;
+		p = (uint8_t *) pg_round_down (p) + PGSIZE;
+	}
+	return true;
+}
+
+/* If F is a page fault in one of the primitives above, makes it
+   fail by resuming at its fixup and returns true. */
+bool
+uaccess_fixup (struct intr_frame *f) {
+	for (const struct usercopy_fixup *x = usercopy_fixups; x->insn; x++)
+		if (f->rip == x->insn) {
+			f->rip = x->fixup;
+			return true;
+		}
+	return false;
+}
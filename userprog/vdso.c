@@ -0,0 +1,64 @@
+/* Read-only pages shared with user processes.
+
+   vdso_init() allocates the clock page, which the timer keeps up
+   to date, and vdso_map() maps it into each new address space
+   along with a page of the process's own information.  A process
+   thus reads the time and its pid with plain loads; see
+   lib/user/vdso.c. */
+
+#include "userprog/vdso.h"
+#include <debug.h>
+#include "devices/timer.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* The clock page, mapped by every process. */
+static struct vdso_time *vdso_time;
+
+/* Allocates the clock page and has the timer publish to it. */
+void
+vdso_init (void) {
+	ASSERT (VDSO_ADDR == USER_STACK);
+	ASSERT (VDSO_PROC_ADDR == VDSO_ADDR + PGSIZE);
+
+	vdso_time = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	timer_publish (vdso_time);
+}
+
+/* Maps the clock page and a new page for process PID into PML4,
+ * both read-only.  Returns false if out of memory, with nothing
+ * mapped. */
+bool
+vdso_map (uint64_t *pml4, int pid) {
+	void *clock = (void *) VDSO_TIME_ADDR, *info = (void *) VDSO_PROC_ADDR;
+	struct vdso_proc *proc = palloc_get_page (PAL_ZERO);
+
+	if (proc == NULL)
+		return false;
+	proc->pid = pid;
+	if (!pml4_set_page (pml4, clock, vdso_time, false)) {
+		palloc_free_page (proc);
+		return false;
+	}
+	if (!pml4_set_page (pml4, info, proc, false)) {
+		pml4_clear_page (pml4, clock);
+		palloc_free_page (proc);
+		return false;
+	}
+	return true;
+}
+
+/* Undoes vdso_map() on PML4, if it was done, so that destroying
+ * PML4 does not free the clock page.  PML4 must not be active. */
+void
+vdso_unmap (uint64_t *pml4) {
+	void *clock = (void *) VDSO_TIME_ADDR, *info = (void *) VDSO_PROC_ADDR;
+	void *proc = pml4_get_page (pml4, info);
+
+	pml4_clear_page (pml4, clock);
+	if (proc != NULL) {
+		pml4_clear_page (pml4, info);
+		palloc_free_page (proc);
+	}
+}
@@ -2,6 +2,9 @@
 
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include "threads/palloc.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -21,7 +24,9 @@ static const struct page_operations anon_ops = {
 void
 vm_anon_init (void) {
 	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	swap_init (swap_disk);
+	zswap_init ();
 }
 
 /* Initialize the file mapping */
@@ -31,22 +36,134 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SWAP_SLOT_NONE;
+	anon_page->zswap = NULL;
+	return true;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Swap in the page by read contents from the swap disk, or by
+ * decompressing it if it went to the compressed pool.
+ * The pages that were swapped out right after this one, which
+ * usually came from the same cluster of victims, are read back
+ * too and mapped, as long as they belong to the same process and
+ * free frames are at hand; readahead never evicts. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	swap_slot_t slot = anon_page->slot;
+
+	if (anon_page->zswap != NULL) {
+		zswap_load (anon_page->zswap, kva);
+		zswap_free (anon_page->zswap);
+		anon_page->zswap = NULL;
+		return true;
+	}
+	if (slot == SWAP_SLOT_NONE)
+		return true;
+	swap_read (slot, kva);
+	swap_free (slot);
+	anon_page->slot = SWAP_SLOT_NONE;
+
+	for (size_t i = 1; i < SWAP_CLUSTER; i++) {
+		struct page *next = swap_owner (slot + i);
+		void *next_kva;
+
+		if (next == NULL || next->owner != page->owner || next->frame != NULL)
+			break;
+		next_kva = palloc_get_page (PAL_USER);
+		if (next_kva == NULL)
+			break;
+		swap_read (slot + i, next_kva);
+		if (!vm_map_frame (next, next_kva)) {
+			palloc_free_page (next_kva);
+			break;
+		}
+		swap_free (slot + i);
+		next->anon.slot = SWAP_SLOT_NONE;
+		swap_count_readahead ();
+	}
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_cluster (&page, 1) == 1;
+}
+
+/* Writes the CNT resident anonymous PAGES[], which user code can
+ * no longer reach, to swap.  Pages go to the compressed pool while
+ * it takes them, and from the first it turns away on, to the swap
+ * disk in as few sequential runs as the free slots allow.  Returns
+ * how many of PAGES[], from the start, were written; the rest
+ * found no slot. */
+size_t
+anon_swap_out_cluster (struct page *pages[], size_t cnt) {
+	size_t done = 0;
+
+	ASSERT (cnt <= SWAP_CLUSTER);
+
+	for (; done < cnt; done++) {
+		struct page *page = pages[done];
+
+		ASSERT (page->frame != NULL);
+		page->anon.zswap = zswap_store (page->frame->kva);
+		if (page->anon.zswap == NULL)
+			break;
+	}
+
+	while (done < cnt) {
+		size_t run = cnt - done;
+		swap_slot_t first;
+		void *kvas[SWAP_CLUSTER];
+
+		/* Take the longest run of free slots we can get. */
+		while ((first = swap_alloc (run)) == SWAP_SLOT_NONE)
+			if ((run /= 2) == 0)
+				return done;
+
+		for (size_t i = 0; i < run; i++) {
+			struct page *page = pages[done + i];
+			ASSERT (page->frame != NULL);
+			kvas[i] = page->frame->kva;
+			page->anon.slot = first + i;
+		}
+		swap_write_run (first, pages + done, kvas, run);
+		done += run;
+	}
+	return done;
+}
+
+/* Returns true if anonymous PAGE, which is not resident, has
+ * contents in swap. */
+bool
+anon_is_swapped (const struct page *page) {
+	return page->anon.zswap != NULL || page->anon.slot != SWAP_SLOT_NONE;
+}
+
+/* Reads the swapped contents of anonymous PAGE into KVA, leaving
+ * them in swap. */
+void
+anon_read_swapped (const struct page *page, void *kva) {
+	ASSERT (anon_is_swapped (page));
+
+	if (page->anon.zswap != NULL)
+		zswap_load (page->anon.zswap, kva);
+	else
+		swap_read (page->anon.slot, kva);
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->zswap != NULL) {
+		zswap_free (anon_page->zswap);
+		anon_page->zswap = NULL;
+	}
+	if (anon_page->slot != SWAP_SLOT_NONE) {
+		swap_free (anon_page->slot);
+		anon_page->slot = SWAP_SLOT_NONE;
+	}
 }
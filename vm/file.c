@@ -1,10 +1,21 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <mman.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
+#include "userprog/vdso.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
+static bool mmap_load (struct page *page, void *aux);
+static bool write_page (struct page *);
+static void write_run (struct mmap_region *, struct page *run[], size_t cnt,
+		uint8_t *buf, struct mmu_gather *);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations file_ops = {
@@ -14,6 +25,9 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Most dirty pages do_munmap() merges into one write. */
+#define WRITE_RUN_MAX 8
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
@@ -21,38 +35,380 @@ vm_file_init (void) {
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
+	/* Fetch the region before the union turns into the file
+	   page. */
+	struct mmap_region *r = page->uninit.aux;
+
 	/* Set up the handler */
 	page->operations = &file_ops;
+	page->file.region = r;
+	return true;
+}
 
-	struct file_page *file_page = &page->file;
+/* Returns the offset in REGION's file of user page VA. */
+static off_t
+page_offset (const struct mmap_region *r, const void *va) {
+	return r->offset + ((const uint8_t *) va - (const uint8_t *) r->addr);
+}
+
+/* Returns the number of bytes of user page VA that REGION's file
+ * backs; the rest of the page reads as zeros and is never written
+ * back. */
+static size_t
+page_bytes (const struct mmap_region *r, const void *va) {
+	size_t ofs = (const uint8_t *) va - (const uint8_t *) r->addr;
+
+	if (ofs >= r->file_bytes)
+		return 0;
+	return r->file_bytes - ofs < PGSIZE ? r->file_bytes - ofs : PGSIZE;
+}
+
+/* Reads the contents of R's user page UPAGE from its file into
+ * KVA. */
+bool
+mmap_region_read (struct mmap_region *r, const void *upage, void *kva) {
+	size_t bytes = page_bytes (r, upage);
+
+	if ((size_t) file_read_at (r->file, kva, bytes,
+				page_offset (r, upage)) != bytes)
+		return false;
+	memset ((uint8_t *) kva + bytes, 0, PGSIZE - bytes);
+	return true;
+}
+
+/* Loads a page of the mmap region AUX on its first fault. */
+static bool
+mmap_load (struct page *page, void *aux UNUSED) {
+	return mmap_region_read (page->file.region, page->va, page->frame->kva);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	return mmap_region_read (page->file.region, page->va, kva);
+}
+
+/* Writes resident PAGE back to its file if the user modified it.
+ * Returns false only if a needed write falls short. */
+static bool
+write_page (struct page *page) {
+	struct mmap_region *r = page->file.region;
+	size_t bytes = page_bytes (r, page->va);
+
+	if (!pml4_is_dirty (page->owner->pml4, page->va))
+		return true;
+	return (size_t) file_write_at (r->file, page->frame->kva, bytes,
+			page_offset (r, page->va)) == bytes;
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.  A clean
+ * page costs nothing: the file already holds its contents.  The
+ * caller has unmapped PAGE, which leaves the dirty bit
+ * readable. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	return write_page (page);
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (page->frame != NULL)
+		write_page (page);
+	mmap_region_put (file_page->region);
+}
+
+/* Creates a region mapping LENGTH bytes at ADDR from OFFSET in
+ * FILE, of which FILE_BYTES come from the file and the rest read
+ * as zeros.  The region has its own handle to FILE and no
+ * references yet.  Returns a null pointer if out of memory. */
+struct mmap_region *
+mmap_region_create (struct file *file, void *addr, size_t length,
+		off_t offset, size_t file_bytes) {
+	struct mmap_region *r = malloc (sizeof *r);
+
+	if (r == NULL)
+		return NULL;
+	r->file = file_reopen (file);
+	if (r->file == NULL) {
+		free (r);
+		return NULL;
+	}
+	r->addr = addr;
+	r->length = length;
+	r->offset = offset;
+	r->file_bytes = file_bytes < length ? file_bytes : length;
+	r->refs = 0;
+	r->exec = false;
+	r->advice = MADV_NORMAL;
+	return r;
+}
+
+/* Adds a file page for UPAGE, inside R, to the current process,
+ * loaded on first fault.  Returns false if UPAGE is taken or out
+ * of memory. */
+bool
+mmap_region_map (struct mmap_region *r, void *upage, bool writable) {
+	if (!vm_alloc_page_with_initializer (VM_FILE, upage, writable,
+				mmap_load, r))
+		return false;
+	mmap_region_get (r);
+	return true;
+}
+
+/* Takes a reference to R for one more page. */
+void
+mmap_region_get (struct mmap_region *r) {
+	__atomic_add_fetch (&r->refs, 1, __ATOMIC_RELAXED);
+}
+
+/* Drops a page's reference to R, closing the file with the
+ * last one. */
+void
+mmap_region_put (struct mmap_region *r) {
+	if (__atomic_sub_fetch (&r->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		file_close (r->file);
+		free (r);
+	}
+}
+
+/* Returns the mmap region PAGE belongs to, or NULL if it is not
+ * a file page. */
+struct mmap_region *
+page_region (struct page *page) {
+	enum vm_type type = VM_TYPE (page->operations->type);
+
+	if (type == VM_UNINIT)
+		return VM_HAS_REGION (page->uninit.type) ? page->uninit.aux : NULL;
+	return type == VM_FILE ? page->file.region : NULL;
+}
+
+/* Returns the madvise() advice in effect for PAGE. */
+int
+page_advice (struct page *page) {
+	struct mmap_region *r = page_region (page);
+
+	return r != NULL ? r->advice : MADV_NORMAL;
+}
+
+/* If PAGE is a read-only page of an executable segment, stores
+ * what identifies its contents in KEY and returns true. */
+bool
+file_text_key (struct page *page, struct text_key *key) {
+	struct mmap_region *r;
+
+	if (page->writable || VM_TYPE (page_get_type (page)) != VM_FILE)
+		return false;
+	r = page_region (page);
+	if (r == NULL || !r->exec)
+		return false;
+	key->inode = file_get_inode (r->file);
+	key->ofs = page_offset (r, page->va);
+	key->bytes = page_bytes (r, page->va);
+	return true;
+}
+
+/* If PAGE belongs to an mmap() mapping, not an executable, and its
+ * contents are exactly its file's page at that position, stores
+ * the file's inode in *INODE and the position in *OFS and returns
+ * true.  Every such page can map the file page's frame in the page
+ * cache.  A page whose mapping ends short of the end of the file
+ * page keeps a frame of its own, as it reads zeros there. */
+bool
+file_cache_key (struct page *page, struct inode **inode, off_t *ofs) {
+	struct mmap_region *r = page_region (page);
+	off_t len;
+
+	if (r == NULL || r->exec || page_get_type (page) != VM_FILE)
+		return false;
+	*inode = file_get_inode (r->file);
+	*ofs = page_offset (r, page->va);
+	len = file_length (r->file) - *ofs;
+	return len > 0
+		&& page_bytes (r, page->va) == (len < PGSIZE ? (size_t) len : PGSIZE);
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt =
+		&thread_leader (thread_current ())->spt;
+	struct mmap_mapping *m;
+	struct mmap_region *r;
+	off_t file_len;
+	uint8_t *va;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || pg_ofs (offset) != 0
+			|| length == 0 || offset < 0)
+		return NULL;
+	if (!is_user_vaddr (addr) || (uint64_t) addr + length < (uint64_t) addr
+			|| !is_user_vaddr ((uint8_t *) addr + length - 1))
+		return NULL;
+	if ((uint64_t) addr < VDSO_ADDR + VDSO_PAGES * PGSIZE
+			&& (uint64_t) addr + length > VDSO_ADDR)
+		return NULL;
+
+	/* Other mappings are found in the mapping tree; segments and
+	   stack pages are found by one walk of the page index. */
+	if (itree_first (&spt->mappings, (uint64_t) addr,
+				(uint64_t) addr + length) != NULL
+			|| !spt_range_empty (spt, addr, length))
+		return NULL;
+
+	file_len = file_length (file);
+	if (file_len == 0)
+		return NULL;
+	m = malloc (sizeof *m);
+	if (m == NULL)
+		return NULL;
+	r = mmap_region_create (file, addr, length, offset,
+			offset >= file_len ? 0 : (size_t) (file_len - offset));
+	if (r == NULL) {
+		free (m);
+		return NULL;
+	}
+
+	/* Each page holds a reference, so a failure partway through
+	   frees the region with its last page. */
+	for (va = addr; va < (uint8_t *) addr + length; va += PGSIZE)
+		if (!mmap_region_map (r, va, writable))
+			break;
+	if (va < (uint8_t *) addr + length) {
+		free (m);
+		if (r->refs == 0) {
+			file_close (r->file);
+			free (r);
+			return NULL;
+		}
+		while (va > (uint8_t *) addr) {
+			va -= PGSIZE;
+			spt_remove_page (spt, spt_find_page (spt, va));
+		}
+		return NULL;
+	}
+
+	m->node.start = (uint64_t) addr;
+	m->node.end = (uint64_t) addr + length;
+	m->region = r;
+	itree_insert (&spt->mappings, &m->node);
+	return addr;
 }
 
-/* Do the munmap */
+/* Writes the CNT dirty pages in RUN, which are adjacent in R's
+ * file, back with a single write through BUF when BUF is not
+ * null, and marks them clean in G. */
+static void
+write_run (struct mmap_region *r, struct page *run[], size_t cnt,
+		uint8_t *buf, struct mmu_gather *g) {
+	size_t bytes;
+
+	if (cnt == 1 || buf == NULL) {
+		for (size_t i = 0; i < cnt; i++)
+			if (write_page (run[i]))
+				pml4_set_dirty_gather (g, run[i]->va, false);
+		return;
+	}
+
+	for (size_t i = 0; i < cnt; i++)
+		memcpy (buf + i * PGSIZE, run[i]->frame->kva, PGSIZE);
+	bytes = (cnt - 1) * PGSIZE + page_bytes (r, run[cnt - 1]->va);
+	if ((size_t) file_write_at (r->file, buf, bytes,
+				page_offset (r, run[0]->va)) != bytes)
+		return;
+	for (size_t i = 0; i < cnt; i++)
+		pml4_set_dirty_gather (g, run[i]->va, false);
+}
+
+/* Do the munmap.  Only dirty pages reach the file, and runs of
+ * adjacent ones go in one write each, so unmapping a mostly read
+ * mapping costs little more than dropping its pages. */
 void
 do_munmap (void *addr) {
+	struct thread *t = thread_leader (thread_current ());
+	struct itree_node *node = itree_first (&t->spt.mappings, (uint64_t) addr,
+			(uint64_t) addr + 1);
+	struct page *run[WRITE_RUN_MAX];
+	struct page *page;
+	struct mmap_mapping *m;
+	struct mmap_region *r;
+	struct mmu_gather g;
+	uint8_t *buf, *va, *end;
+	size_t cnt = 0;
+
+	if (node == NULL || node->start != (uint64_t) addr)
+		return;
+	m = rb_entry (node, struct mmap_mapping, node.rb);
+	r = m->region;
+	end = (uint8_t *) r->addr + r->length;
+	itree_remove (&t->spt.mappings, &m->node);
+	free (m);
+
+	/* Without the bounce buffer, every dirty page is a write of
+	   its own. */
+	buf = palloc_get_multiple (0, WRITE_RUN_MAX);
+	mmu_gather_init (&g, t->pml4);
+	for (va = addr; va < end; va += PGSIZE) {
+		page = spt_find_page (&t->spt, va);
+		if (page != NULL && page_region (page) == r && page->frame != NULL
+				&& page_bytes (r, va) > 0
+				&& pml4_is_dirty (t->pml4, va)) {
+			run[cnt++] = page;
+			if (cnt < WRITE_RUN_MAX && page_bytes (r, va) == PGSIZE)
+				continue;
+		}
+		if (cnt > 0)
+			write_run (r, run, cnt, buf, &g);
+		cnt = 0;
+	}
+	if (cnt > 0)
+		write_run (r, run, cnt, buf, &g);
+	mmu_gather_flush (&g);
+	if (buf != NULL)
+		palloc_free_multiple (buf, WRITE_RUN_MAX);
+
+	/* What is left dirty failed to write; destroy tries again. */
+	for (va = addr; va < end; va += PGSIZE) {
+		page = spt_find_page (&t->spt, va);
+		if (page != NULL && page_region (page) == r)
+			spt_remove_page (&t->spt, page);
+	}
+}
+
+/* Gives DST, a forked child's SPT, a copy of each of SRC's
+ * mappings.  Returns false if memory runs out. */
+bool
+mmap_mappings_copy (struct supplemental_page_table *dst,
+		const struct supplemental_page_table *src) {
+	struct rb_node *n;
+
+	for (n = rb_first (&src->mappings.rb); n != NULL; n = rb_next (n)) {
+		const struct mmap_mapping *m = rb_entry (n, struct mmap_mapping,
+				node.rb);
+		struct mmap_mapping *copy = malloc (sizeof *copy);
+
+		if (copy == NULL)
+			return false;
+		copy->node.start = m->node.start;
+		copy->node.end = m->node.end;
+		copy->region = m->region;
+		itree_insert (&dst->mappings, &copy->node);
+	}
+	return true;
+}
+
+/* Frees SPT's mappings.  Their pages are gone already. */
+void
+mmap_mappings_destroy (struct supplemental_page_table *spt) {
+	while (!rb_empty (&spt->mappings.rb)) {
+		struct mmap_mapping *m = rb_entry (rb_first (&spt->mappings.rb),
+				struct mmap_mapping, node.rb);
+
+		itree_remove (&spt->mappings, &m->node);
+		free (m);
+	}
 }
@@ -0,0 +1,217 @@
+/* oom.c: Commit accounting and the out-of-memory killer.
+ *
+ * Every writable anonymous page is committed when it enters a
+ * process's supplemental page table and uncommitted when it
+ * leaves, resident or not: it is memory the process may fill, and
+ * the user pool and swap must then hold it somewhere.
+ * vm_overcommit sets how much may be committed.  OVERCOMMIT_GUESS
+ * refuses only what one process could never fit in the user pool
+ * and swap together; OVERCOMMIT_ALWAYS refuses nothing;
+ * OVERCOMMIT_NEVER refuses everything past the swap slots plus
+ * vm_overcommit_ratio percent of the user pool, the commit limit.
+ * A refusal fails the exec, stack growth or fork that asked.
+ *
+ * Short of OVERCOMMIT_NEVER, memory may still run out.  When
+ * neither the user pool nor eviction yields a frame, vm_oom()
+ * kills the process with the highest score: its resident pages
+ * plus its oom_adjust() adjustment in thousandths of all memory.
+ * The victim dies when it next enters or returns to user mode,
+ * and frees its memory then.  Meanwhile faults that need a frame
+ * wait for it, for up to OOM_WAIT_TICKS, before the next victim
+ * is picked. */
+
+#include "vm/oom.h"
+#include <resource.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
+#include "vm/swap.h"
+#include "vm/vm.h"
+
+/* Ticks to wait for a victim to die before picking another. */
+#define OOM_WAIT_TICKS TIMER_FREQ
+
+/* Commit policy.  Set by the "-overcommit" kernel command line
+   option. */
+int vm_overcommit = OVERCOMMIT_GUESS;
+
+/* Percentage of the user pool that OVERCOMMIT_NEVER lets be
+   committed beyond swap.  Set by "-ocratio". */
+unsigned vm_overcommit_ratio = 50;
+
+static size_t pool_pages;           /* Size of the user pool. */
+static size_t committed;            /* Pages committed, in all processes. */
+static size_t committed_peak;       /* Most pages committed at once. */
+
+/* Serializes vm_oom(), so that one shortage kills one process. */
+static struct lock oom_lock;
+static int64_t kill_tick;           /* When the last victim was killed. */
+
+/* Statistics. */
+static long long refusals;          /* Commits refused. */
+static long long oom_kills;         /* Processes killed. */
+static long long oom_waits;         /* Faults that waited for a victim. */
+
+/* State for picking a victim with oom_score(). */
+struct oom_pick {
+	size_t total;               /* Pages of the user pool and swap. */
+	tid_t victim;               /* Best process so far, or TID_ERROR. */
+	long long score;            /* ...and its score. */
+	size_t rss;                 /* ...and its resident pages. */
+	bool dying;                 /* A killed process is still alive. */
+};
+
+static thread_action_func oom_score, oom_kill;
+
+/* Notes the size of the user pool.  Must be called after swap and
+   before any process runs. */
+void
+vm_oom_init (void) {
+	pool_pages = palloc_available (PAL_USER);
+	lock_init (&oom_lock);
+}
+
+/* Commits CNT more pages to SPT's process, as vm_overcommit
+ * allows.  Returns false, committing nothing, if it does not. */
+bool
+vm_commit (struct supplemental_page_table *spt, size_t cnt) {
+	size_t total = pool_pages + swap_slot_cnt ();
+	size_t old, limit;
+
+	switch (vm_overcommit) {
+		case OVERCOMMIT_ALWAYS:
+			old = __atomic_fetch_add (&committed, cnt, __ATOMIC_RELAXED);
+			break;
+		case OVERCOMMIT_NEVER:
+			limit = swap_slot_cnt ()
+				+ pool_pages * vm_overcommit_ratio / 100;
+			old = __atomic_load_n (&committed, __ATOMIC_RELAXED);
+			do
+				if (old + cnt > limit)
+					goto refuse;
+			while (!__atomic_compare_exchange_n (&committed, &old, old + cnt,
+						true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+			break;
+		default:
+			if (__atomic_load_n (&spt->committed, __ATOMIC_RELAXED) + cnt
+					> total)
+				goto refuse;
+			old = __atomic_fetch_add (&committed, cnt, __ATOMIC_RELAXED);
+			break;
+	}
+	__atomic_add_fetch (&spt->committed, cnt, __ATOMIC_RELAXED);
+	if (old + cnt > committed_peak)
+		committed_peak = old + cnt;
+	return true;
+
+refuse:
+	__atomic_add_fetch (&refusals, 1, __ATOMIC_RELAXED);
+	return false;
+}
+
+/* Takes back CNT pages committed to SPT's process. */
+void
+vm_uncommit (struct supplemental_page_table *spt, size_t cnt) {
+	ASSERT (spt->committed >= cnt);
+
+	__atomic_sub_fetch (&spt->committed, cnt, __ATOMIC_RELAXED);
+	__atomic_sub_fetch (&committed, cnt, __ATOMIC_RELAXED);
+}
+
+/* Called when no frame is to be had.  Kills the process with the
+ * highest score, or waits a while for one killed earlier to die.
+ * Returns true if the caller should try again for a frame, false
+ * if it should fail: there is nothing left to kill, or the
+ * running process was the victim. */
+bool
+vm_oom (void) {
+	struct thread *self = thread_leader (thread_current ());
+	struct oom_pick pick;
+
+	lock_acquire (&oom_lock);
+	pick.total = pool_pages + swap_slot_cnt ();
+	pick.victim = TID_ERROR;
+	pick.score = 0;
+	pick.rss = 0;
+	pick.dying = false;
+	thread_foreach (oom_score, &pick);
+
+	if (pick.dying && timer_elapsed (kill_tick) < OOM_WAIT_TICKS) {
+		oom_waits++;
+		lock_release (&oom_lock);
+		timer_sleep (1);
+		return true;
+	}
+	if (pick.victim == TID_ERROR) {
+		lock_release (&oom_lock);
+		return false;
+	}
+	thread_foreach (oom_kill, &pick.victim);
+	kill_tick = timer_ticks ();
+	oom_kills++;
+	printf ("Out of memory: killed process %d, %zu pages resident\n",
+			pick.victim, pick.rss);
+	lock_release (&oom_lock);
+
+	if (pick.victim == self->tid)
+		return false;
+	timer_sleep (1);
+	return true;
+}
+
+/* Sets the running process's score adjustment to ADJ.  Returns
+ * false if ADJ is out of range. */
+bool
+vm_oom_adjust (int adj) {
+	if (adj < OOM_SCORE_ADJ_MIN || adj > OOM_SCORE_ADJ_MAX)
+		return false;
+	thread_leader (thread_current ())->spt.oom_score_adj = adj;
+	return true;
+}
+
+/* Scores T for vm_oom(), if it leads a process, and keeps it in
+ * PICK_, a struct oom_pick, if it beats the best so far. */
+static void
+oom_score (struct thread *t, void *pick_) {
+	struct oom_pick *pick = pick_;
+	long long score;
+
+	if (t->pml4 == NULL || t->leader != NULL || t->group_exit)
+		return;
+	if (t->killed) {
+		pick->dying = true;
+		return;
+	}
+	if (t->spt.oom_score_adj == OOM_SCORE_ADJ_MIN)
+		return;
+	score = (long long) t->spt.rss
+		+ (long long) t->spt.oom_score_adj * (long long) pick->total / 1000;
+	if (pick->victim == TID_ERROR || score > pick->score) {
+		pick->victim = t->tid;
+		pick->score = score;
+		pick->rss = t->spt.rss;
+	}
+}
+
+/* Kills T if it is the process whose tid is in TID_. */
+static void
+oom_kill (struct thread *t, void *tid_) {
+	if (t->tid == *(tid_t *) tid_)
+		process_kill (t);
+}
+
+/* Prints commit and out-of-memory statistics. */
+void
+vm_oom_print_stats (void) {
+	static const char *policies[] = { "guess", "always", "never" };
+
+	printf ("Commit: %zu pages committed (peak %zu), policy %s, "
+			"%lld refused\n", committed, committed_peak,
+			policies[vm_overcommit], refusals);
+	if (oom_kills > 0)
+		printf ("OOM: %lld processes killed, %lld faults waited\n",
+				oom_kills, oom_waits);
+}
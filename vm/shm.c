@@ -0,0 +1,523 @@
+/* shm.c: Named shared memory segments.
+
+   shm_open() names a segment of zeroed pages, creating it if need
+   be, and shm_map() maps the whole segment into the calling
+   process.  Every process that maps a segment maps the same
+   frames, so what one writes the others read at memory speed,
+   with no file in between.
+
+   A segment's frames are its own, like the zero page: they are
+   not in the frame table, and the pages that map them are neither
+   counted in a process's RSS nor linked to each other.  A frame is
+   read in, or zeroed, by the first fault on its page in any
+   process.  While any process has a page of the segment mapped in
+   its page table, the segment stays in memory.  Once none has, it
+   may be swapped out as a unit when memory runs short, and is read
+   back a page at a time as it is faulted on again.
+
+   A segment lives while it is named or mapped: each page of a
+   process that refers to it holds a reference, and so does the
+   name until shm_unlink().  SHM_LOCK protects the segments. */
+
+#include "vm/shm.h"
+#include <debug.h>
+#include <list.h>
+#include <mman.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/vdso.h"
+#include "vm/swap.h"
+#include "vm/vm.h"
+
+/* One page of a segment. */
+struct shm_frame {
+	struct frame frame;         /* KVA is null while not resident. */
+	swap_slot_t slot;           /* Swap slot, or SWAP_SLOT_NONE. */
+	unsigned maps;              /* Page tables mapping FRAME. */
+	bool busy;                  /* Being read in. */
+};
+
+/* A segment. */
+struct shm_segment {
+	struct list_elem elem;      /* In SEGMENTS, least recently mapped
+	                               first. */
+	int id;                     /* Index in SEGMENT_IDS. */
+	char name[SHM_NAME_MAX + 1];    /* Empty once unlinked. */
+	unsigned refs;              /* See above. */
+	size_t page_cnt;            /* Pages in PAGES. */
+	size_t resident;            /* Pages in memory. */
+	size_t mapped;              /* Sum of MAPS over PAGES. */
+	bool swapping;              /* Being swapped out? */
+	struct shm_frame pages[];
+};
+
+static bool shm_swap_in (struct page *page, void *kva);
+static bool shm_swap_out (struct page *page);
+static void shm_destroy (struct page *page);
+
+static const struct page_operations shm_ops = {
+	.swap_in = shm_swap_in,
+	.swap_out = shm_swap_out,
+	.destroy = shm_destroy,
+	.type = VM_SHM,
+};
+
+static struct list segments;
+static struct shm_segment *segment_ids[SHM_MAX];
+static struct lock shm_lock;
+static struct condition shm_changed;   /* A page or segment is no
+                                          longer busy. */
+
+/* Statistics. */
+static long long shm_faults;           /* Pages mapped by a fault. */
+static long long shm_swapped_in;       /* Of those, read from swap. */
+static long long shm_swapouts;         /* Segments swapped out. */
+static long long shm_swapped_out;      /* Pages they wrote. */
+
+static struct shm_segment *shm_find (const char *name);
+static void shm_free (struct shm_segment *);
+static void shm_put (struct shm_segment *);
+static size_t shm_swap_segment (struct shm_segment *);
+
+/* Sets up shared memory. */
+void
+vm_shm_init (void) {
+	list_init (&segments);
+	lock_init (&shm_lock);
+	cond_init (&shm_changed);
+}
+
+/* Sets up PAGE as a page of a segment.  shm_map() fills in the
+   segment and page number right after. */
+bool
+shm_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
+	page->operations = &shm_ops;
+	page->shm.seg = NULL;
+	page->shm.idx = 0;
+	return true;
+}
+
+/* Returns the ID of the segment named NAME, creating it with SIZE
+   bytes, rounded up to whole pages, if there is none.  An existing
+   segment must have at least SIZE bytes.  Returns -1 if NAME is
+   empty, SIZE is 0 for a new segment or too big for an old one,
+   SHM_MAX segments exist, or memory runs out. */
+int
+shm_open (const char *name, size_t size) {
+	size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+	struct shm_segment *seg;
+	int id = -1;
+
+	if (name[0] == '\0' || strlen (name) > SHM_NAME_MAX)
+		return -1;
+
+	lock_acquire (&shm_lock);
+	seg = shm_find (name);
+	if (seg != NULL) {
+		if (page_cnt <= seg->page_cnt)
+			id = seg->id;
+		goto done;
+	}
+	if (page_cnt == 0)
+		goto done;
+	for (id = 0; id < SHM_MAX && segment_ids[id] != NULL; id++)
+		continue;
+	if (id == SHM_MAX
+			|| page_cnt > (SIZE_MAX - sizeof *seg) / sizeof *seg->pages
+			|| (seg = malloc (sizeof *seg
+					+ page_cnt * sizeof *seg->pages)) == NULL) {
+		id = -1;
+		goto done;
+	}
+	seg->id = id;
+	strlcpy (seg->name, name, sizeof seg->name);
+	seg->refs = 1;
+	seg->page_cnt = page_cnt;
+	seg->resident = seg->mapped = 0;
+	seg->swapping = false;
+	for (size_t i = 0; i < page_cnt; i++) {
+		struct shm_frame *sf = &seg->pages[i];
+
+		memset (&sf->frame, 0, sizeof sf->frame);
+		sf->frame.share_cnt = 1;
+		sf->slot = SWAP_SLOT_NONE;
+		sf->maps = 0;
+		sf->busy = false;
+	}
+	segment_ids[id] = seg;
+	list_push_back (&segments, &seg->elem);
+done:
+	lock_release (&shm_lock);
+	return id;
+}
+
+/* Maps the whole of segment ID into the running process at ADDR,
+   which must be page-aligned, writable if WRITABLE.  Returns ADDR,
+   or a null pointer if there is no such segment or the range is
+   not free user memory. */
+void *
+shm_map (int id, void *addr, bool writable) {
+	struct supplemental_page_table *spt =
+		&thread_leader (thread_current ())->spt;
+	struct shm_segment *seg;
+	size_t length, i;
+
+	if (id < 0 || id >= SHM_MAX || addr == NULL || pg_ofs (addr) != 0)
+		return NULL;
+
+	/* Hold the segment while its pages are made, so that an
+	   unlink meanwhile cannot free it. */
+	lock_acquire (&shm_lock);
+	seg = segment_ids[id];
+	if (seg != NULL)
+		seg->refs++;
+	lock_release (&shm_lock);
+	if (seg == NULL)
+		return NULL;
+
+	length = seg->page_cnt * PGSIZE;
+	if (!is_user_vaddr (addr) || (uint64_t) addr + length < (uint64_t) addr
+			|| !is_user_vaddr ((uint8_t *) addr + length - 1)
+			|| ((uint64_t) addr < VDSO_ADDR + VDSO_PAGES * PGSIZE
+				&& (uint64_t) addr + length > VDSO_ADDR)
+			|| itree_first (&spt->mappings, (uint64_t) addr,
+				(uint64_t) addr + length) != NULL
+			|| !spt_range_empty (spt, addr, length)) {
+		lock_acquire (&shm_lock);
+		shm_put (seg);
+		lock_release (&shm_lock);
+		return NULL;
+	}
+
+	for (i = 0; i < seg->page_cnt; i++) {
+		uint8_t *va = (uint8_t *) addr + i * PGSIZE;
+		struct page *page;
+
+		if (!vm_alloc_page (VM_SHM, va, writable))
+			break;
+		page = spt_find_page (spt, va);
+		shm_initializer (page, VM_SHM, NULL);
+		lock_acquire (&shm_lock);
+		seg->refs++;
+		lock_release (&shm_lock);
+		page->shm.seg = seg;
+		page->shm.idx = i;
+	}
+	if (i < seg->page_cnt) {
+		while (i-- > 0)
+			spt_remove_page (spt, spt_find_page (spt,
+						(uint8_t *) addr + i * PGSIZE));
+		addr = NULL;
+	}
+
+	lock_acquire (&shm_lock);
+	shm_put (seg);
+	lock_release (&shm_lock);
+	return addr;
+}
+
+/* Unmaps the segment that the running process mapped at ADDR.
+   Returns false if no segment is mapped there. */
+bool
+shm_unmap (void *addr) {
+	struct supplemental_page_table *spt =
+		&thread_leader (thread_current ())->spt;
+	struct page *page = spt_find_page (spt, addr);
+	struct shm_segment *seg;
+
+	if (page == NULL || VM_TYPE (page->operations->type) != VM_SHM
+			|| page->va != addr || page->shm.idx != 0)
+		return false;
+	seg = page->shm.seg;
+	for (size_t i = seg->page_cnt; i-- > 0; ) {
+		page = spt_find_page (spt, (uint8_t *) addr + i * PGSIZE);
+		if (page != NULL && VM_TYPE (page->operations->type) == VM_SHM
+				&& page->shm.seg == seg && page->shm.idx == i)
+			spt_remove_page (spt, page);
+	}
+	return true;
+}
+
+/* Removes the name NAME.  Its segment is freed once no process
+   maps it, and a new segment may take the name at once.  Returns
+   false if no segment has the name. */
+bool
+shm_unlink (const char *name) {
+	struct shm_segment *seg;
+
+	lock_acquire (&shm_lock);
+	seg = name[0] != '\0' ? shm_find (name) : NULL;
+	if (seg != NULL) {
+		seg->name[0] = '\0';
+		shm_put (seg);
+	}
+	lock_release (&shm_lock);
+	return seg != NULL;
+}
+
+/* Maps PAGE, a page of a segment that is not resident, to the
+   segment's frame, reading it in first or zeroing it if no
+   process has it in memory.  Returns false if out of memory. */
+bool
+shm_claim (struct page *page) {
+	struct shm_segment *seg;
+	struct shm_frame *sf;
+	bool ok;
+
+	ASSERT (page->frame == NULL);
+
+	/* Still being set up by shm_map() in another thread: fault
+	   again. */
+	if (VM_TYPE (page->operations->type) != VM_SHM || page->shm.seg == NULL)
+		return true;
+	seg = page->shm.seg;
+	sf = &seg->pages[page->shm.idx];
+
+	lock_acquire (&shm_lock);
+	while (sf->busy || seg->swapping)
+		cond_wait (&shm_changed, &shm_lock);
+	if (sf->frame.kva == NULL) {
+		void *kva;
+
+		/* Memory for the frame may have to come from eviction,
+		   which may swap out segments itself. */
+		sf->busy = true;
+		lock_release (&shm_lock);
+		kva = vm_alloc_user_page ();
+		if (kva != NULL) {
+			if (sf->slot != SWAP_SLOT_NONE)
+				swap_read (sf->slot, kva);
+			else
+				memset (kva, 0, PGSIZE);
+		}
+		lock_acquire (&shm_lock);
+		sf->busy = false;
+		cond_broadcast (&shm_changed, &shm_lock);
+		if (kva == NULL) {
+			lock_release (&shm_lock);
+			return false;
+		}
+		if (sf->slot != SWAP_SLOT_NONE) {
+			swap_free (sf->slot);
+			sf->slot = SWAP_SLOT_NONE;
+			shm_swapped_in++;
+		}
+		sf->frame.kva = kva;
+		seg->resident++;
+	}
+
+	ok = pml4_set_page (page->owner->pml4, page->va, sf->frame.kva,
+			page->writable);
+	if (ok) {
+		page->frame = &sf->frame;
+		sf->maps++;
+		seg->mapped++;
+		list_remove (&seg->elem);
+		list_push_back (&segments, &seg->elem);
+		shm_faults++;
+	}
+	lock_release (&shm_lock);
+	return ok;
+}
+
+/* Makes PAGE, a fresh copy of another process's page of a
+   segment, refer to the segment too, without mapping it. */
+void
+shm_page_dup (struct page *page) {
+	ASSERT (VM_TYPE (page->operations->type) == VM_SHM);
+
+	page->frame = NULL;
+	lock_acquire (&shm_lock);
+	page->shm.seg->refs++;
+	lock_release (&shm_lock);
+}
+
+/* Swaps out the least recently mapped segment that has pages in
+   memory but no process mapping them.  Returns true if that freed
+   any memory. */
+bool
+shm_reclaim (void) {
+	struct shm_segment *seg = NULL;
+	struct list_elem *e;
+	size_t freed;
+
+	lock_acquire (&shm_lock);
+	for (e = list_begin (&segments); e != list_end (&segments);
+			e = list_next (e)) {
+		struct shm_segment *s = list_entry (e, struct shm_segment, elem);
+
+		if (s->mapped == 0 && s->resident > 0 && !s->swapping) {
+			seg = s;
+			break;
+		}
+	}
+	if (seg == NULL) {
+		lock_release (&shm_lock);
+		return false;
+	}
+	seg->swapping = true;
+	seg->refs++;
+	lock_release (&shm_lock);
+
+	freed = shm_swap_segment (seg);
+
+	lock_acquire (&shm_lock);
+	seg->swapping = false;
+	cond_broadcast (&shm_changed, &shm_lock);
+	if (freed > 0) {
+		shm_swapouts++;
+		shm_swapped_out += freed;
+	}
+	shm_put (seg);
+	lock_release (&shm_lock);
+	return freed > 0;
+}
+
+/* Prints shared memory statistics. */
+void
+shm_print_stats (void) {
+	size_t cnt = 0, resident = 0;
+	struct list_elem *e;
+
+	lock_acquire (&shm_lock);
+	for (e = list_begin (&segments); e != list_end (&segments);
+			e = list_next (e)) {
+		cnt++;
+		resident += list_entry (e, struct shm_segment, elem)->resident;
+	}
+	lock_release (&shm_lock);
+	printf ("Shared memory: %zu segments, %zu pages resident, "
+			"%lld faults (%lld from swap), %lld swap-outs of %lld pages\n",
+			cnt, resident, shm_faults, shm_swapped_in, shm_swapouts,
+			shm_swapped_out);
+}
+
+/* Writes the resident pages of SEG, which no one has mapped and
+   which is marked swapping, to swap in runs of consecutive pages,
+   and frees their frames.  Stops when swap is full.  Returns the
+   number of pages freed. */
+static size_t
+shm_swap_segment (struct shm_segment *seg) {
+	struct page *owners[SWAP_CLUSTER] = { NULL };
+	void *kvas[SWAP_CLUSTER];
+	size_t freed = 0, i = 0;
+
+	while (i < seg->page_cnt) {
+		size_t start, cnt = 0;
+		swap_slot_t slot;
+
+		while (i < seg->page_cnt && seg->pages[i].frame.kva == NULL)
+			i++;
+		start = i;
+		while (i < seg->page_cnt && seg->pages[i].frame.kva != NULL
+				&& cnt < SWAP_CLUSTER)
+			kvas[cnt++] = seg->pages[i++].frame.kva;
+		if (cnt == 0)
+			break;
+
+		/* Swap readahead takes the null owners as the end of a
+		   run, since these pages belong to no process. */
+		slot = swap_alloc (cnt);
+		if (slot == SWAP_SLOT_NONE)
+			break;
+		swap_write_run (slot, owners, kvas, cnt);
+
+		lock_acquire (&shm_lock);
+		for (size_t j = 0; j < cnt; j++) {
+			struct shm_frame *sf = &seg->pages[start + j];
+
+			palloc_free_page (sf->frame.kva);
+			sf->frame.kva = NULL;
+			sf->slot = slot + j;
+		}
+		seg->resident -= cnt;
+		lock_release (&shm_lock);
+		freed += cnt;
+	}
+	return freed;
+}
+
+/* Never called: segment frames are not in the frame table, so
+   neither claim_with_frame() nor eviction sees them. */
+static bool
+shm_swap_in (struct page *page UNUSED, void *kva UNUSED) {
+	return true;
+}
+
+static bool
+shm_swap_out (struct page *page UNUSED) {
+	return false;
+}
+
+/* Unmaps PAGE, if mapped, and drops its reference to the
+   segment. */
+static void
+shm_destroy (struct page *page) {
+	struct shm_segment *seg = page->shm.seg;
+
+	if (seg == NULL)
+		return;
+	if (page->frame != NULL)
+		pml4_clear_page (page->owner->pml4, page->va);
+	lock_acquire (&shm_lock);
+	if (page->frame != NULL) {
+		seg->pages[page->shm.idx].maps--;
+		seg->mapped--;
+		page->frame = NULL;
+	}
+	shm_put (seg);
+	lock_release (&shm_lock);
+	page->shm.seg = NULL;
+}
+
+/* Returns the segment named NAME, or a null pointer.  SHM_LOCK
+   must be held. */
+static struct shm_segment *
+shm_find (const char *name) {
+	struct list_elem *e;
+
+	for (e = list_begin (&segments); e != list_end (&segments);
+			e = list_next (e)) {
+		struct shm_segment *seg = list_entry (e, struct shm_segment, elem);
+
+		if (!strcmp (seg->name, name))
+			return seg;
+	}
+	return NULL;
+}
+
+/* Drops a reference to SEG, freeing it with the last.  SHM_LOCK
+   must be held. */
+static void
+shm_put (struct shm_segment *seg) {
+	ASSERT (seg->refs > 0);
+
+	if (--seg->refs == 0)
+		shm_free (seg);
+}
+
+/* Frees SEG's memory, swap slots and ID, and SEG.  SHM_LOCK must
+   be held. */
+static void
+shm_free (struct shm_segment *seg) {
+	ASSERT (seg->mapped == 0);
+
+	for (size_t i = 0; i < seg->page_cnt; i++) {
+		struct shm_frame *sf = &seg->pages[i];
+
+		if (sf->frame.kva != NULL)
+			palloc_free_page (sf->frame.kva);
+		if (sf->slot != SWAP_SLOT_NONE)
+			swap_free (sf->slot);
+	}
+	segment_ids[seg->id] = NULL;
+	list_remove (&seg->elem);
+	free (seg);
+}
@@ -0,0 +1,134 @@
+/* swap.c: Slot allocator and I/O for the swap disk. */
+
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Sectors in one swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* The swap disk is carved into page-sized slots.  USED_MAP tracks
+   which are taken; OWNERS maps each taken slot back to the page
+   stored there, so that swap-in can find the pages written next
+   to the one it wants.  SWAP_LOCK protects both. */
+static struct disk *swap_disk;
+static struct bitmap *used_map;
+static struct page **owners;
+static struct lock swap_lock;
+
+/* Statistics. */
+static long long pages_out;         /* Pages written. */
+static long long runs_out;          /* Runs they were written in. */
+static long long pages_in;          /* Pages read. */
+static long long pages_ahead;       /* Pages read ahead of a fault. */
+
+/* Sets up swapping to DISK, which may be null if there is no swap
+   disk, in which case every swap_alloc() fails. */
+void
+swap_init (struct disk *disk) {
+	size_t slot_cnt = disk != NULL ? disk_size (disk) / SECTORS_PER_SLOT : 0;
+
+	lock_init (&swap_lock);
+	swap_disk = disk;
+	used_map = bitmap_create (slot_cnt);
+	owners = calloc (slot_cnt > 0 ? slot_cnt : 1, sizeof *owners);
+	if (used_map == NULL || owners == NULL)
+		PANIC ("swap_init: out of memory");
+}
+
+/* Reserves CNT contiguous free slots and returns the first, or
+   SWAP_SLOT_NONE if no such run is free. */
+swap_slot_t
+swap_alloc (size_t cnt) {
+	size_t slot;
+
+	ASSERT (cnt > 0);
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (used_map, 0, cnt, false);
+	lock_release (&swap_lock);
+	return slot != BITMAP_ERROR ? slot : SWAP_SLOT_NONE;
+}
+
+/* Releases SLOT. */
+void
+swap_free (swap_slot_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (used_map, slot));
+	bitmap_reset (used_map, slot);
+	owners[slot] = NULL;
+	lock_release (&swap_lock);
+}
+
+/* Writes the CNT pages at KVAS[] to the consecutive slots starting
+   at FIRST, which must have been reserved with swap_alloc(), and
+   records PAGES[] as their owners.  The run is written in slot
+   order, one command per page, so the disk sees one sequential
+   stream. */
+void
+swap_write_run (swap_slot_t first, struct page *pages[], void *kvas[],
+		size_t cnt) {
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+	for (size_t i = 0; i < cnt; i++) {
+		disk_write_multiple (swap_disk, (first + i) * SECTORS_PER_SLOT,
+				SECTORS_PER_SLOT, kvas[i]);
+		lock_acquire (&swap_lock);
+		owners[first + i] = pages[i];
+		lock_release (&swap_lock);
+	}
+	pages_out += cnt;
+	runs_out++;
+}
+
+/* Reads SLOT into the page at KVA.  The slot stays reserved. */
+void
+swap_read (swap_slot_t slot, void *kva) {
+	ASSERT (bitmap_test (used_map, slot));
+
+	disk_read_multiple (swap_disk, slot * SECTORS_PER_SLOT,
+			SECTORS_PER_SLOT, kva);
+	pages_in++;
+}
+
+/* Returns the number of slots on the swap disk. */
+size_t
+swap_slot_cnt (void) {
+	return bitmap_size (used_map);
+}
+
+/* Returns the page stored in SLOT, or a null pointer if SLOT is
+   out of range or free. */
+struct page *
+swap_owner (swap_slot_t slot) {
+	struct page *page = NULL;
+
+	lock_acquire (&swap_lock);
+	if (slot < bitmap_size (used_map))
+		page = owners[slot];
+	lock_release (&swap_lock);
+	return page;
+}
+
+/* Notes that the last swap_read() was speculative. */
+void
+swap_count_readahead (void) {
+	pages_ahead++;
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) {
+	if (swap_disk == NULL)
+		return;
+	printf ("Swap: %lld pages out in %lld runs, %lld pages in "
+			"(%lld read ahead), %zu of %zu slots used\n",
+			pages_out, runs_out, pages_in, pages_ahead,
+			bitmap_count (used_map, 0, bitmap_size (used_map), true),
+			bitmap_size (used_map));
+}
@@ -3,3 +3,7 @@ vm_SRC += vm/uninit.c     # Uninitialized page
 vm_SRC += vm/anon.c       # Anonymous page
 vm_SRC += vm/file.c       # File mapped page
 vm_SRC += vm/inspect.c    # Testing utility
+vm_SRC += vm/swap.c       # Swap slots and I/O
+vm_SRC += vm/zswap.c      # Compressed swap pool
+vm_SRC += vm/oom.c        # Commit accounting and OOM killer
+vm_SRC += vm/shm.c        # Shared memory segments
@@ -62,7 +62,9 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+
+	/* A pending mmap or segment page holds its region. */
+	if (VM_HAS_REGION (uninit->type))
+		mmap_region_put (uninit->aux);
 }
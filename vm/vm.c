@@ -1,8 +1,201 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
+#include <bitmap.h>
+#include <hash.h>
+#include <mman.h>
+#include <round.h>
+#include "devices/timer.h"
+#include "threads/counter.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+#include "userprog/futex.h"
 #include "vm/vm.h"
+#include "filesys/page_cache.h"
 #include "vm/inspect.h"
+#include "vm/oom.h"
+#include "vm/swap.h"
+
+/* Slab caches for struct page and struct frame.  vm_dealloc_page()
+   returns pages with free(), which works for slab objects too. */
+static struct kmem_cache *page_cache;
+static struct kmem_cache *frame_cache;
+
+/* Frame table: every frame that holds a user page, in clock order.
+   CLOCK_HAND is the next frame the clock looks at, or NULL for the
+   head of the list. */
+static struct list frame_table;
+static struct list_elem *clock_hand;
+static size_t frame_cnt;            /* Frames in FRAME_TABLE. */
+static struct lock frame_lock;
+
+/* A victim search that has passed this many accessed or dirty
+   frames settles for the first dirty candidate it saw instead of
+   holding out for a clean one. */
+#define CLEAN_SCAN_LIMIT 64
+
+/* Share frames copy-on-write between a forked child and its
+   parent instead of copying them during fork.  Cleared by the
+   "-no-cow" kernel command line option. */
+bool vm_cow = true;
+
+/* Map whole 2 MB-aligned ranges of fresh anonymous memory with a
+   single 2 MB page on their first write fault.  Cleared by the
+   "-no-huge" kernel command line option. */
+bool vm_huge = true;
+
+/* Pages in a 2 MB page. */
+#define HUGE_PAGES (LARGE_PGSIZE / PGSIZE)
+
+/* Build a contiguous run of user memory, when palloc has none, by
+   moving private anonymous frames out of the way: at once for a
+   2 MB page, and in the reclaim thread for a failed multi-page
+   request.  Cleared by the "-no-compact" kernel command line
+   option. */
+bool vm_compact = true;
+
+/* Most pages a not-present fault claims beyond the faulting one,
+   as long as faults look sequential.  Set by the "-fa" kernel
+   command line option; 0 disables fault-around. */
+unsigned vm_fault_around = 8;
+
+/* The shared zero page.  Read faults on fresh anonymous pages map
+   ZERO_FRAME's page read-only instead of allocating a frame; the
+   first write gets a private frame through vm_handle_wp().  The
+   pages mapping it are not counted or linked, and ZERO_FRAME is
+   never in the frame table. */
+static struct frame zero_frame;
+
+/* The text cache: frames holding read-only executable pages, by
+   file contents, so that processes running the same binary share
+   them instead of each reading its own copy.  A frame stays
+   cached for as long as a page maps it.  Protected by
+   FRAME_LOCK. */
+struct text_frame {
+	struct hash_elem elem;      /* Element in TEXT_CACHE. */
+	struct text_key key;        /* Contents of FRAME. */
+	struct frame *frame;
+};
+static struct hash text_cache;
+static hash_hash_func text_hash;
+static hash_less_func text_less;
+
+/* Same-page merging.  Every VM_KSM_INTERVAL milliseconds the
+   "ksm" thread hashes up to VM_KSM_PAGES anonymous frames; a frame
+   found equal to another hands its page over to that frame,
+   copy-on-write, and is freed.  Set by the "-ksm" and "-ksm-ms"
+   kernel command line options; 0 pages, the default, disables
+   the scanner. */
+unsigned vm_ksm_pages;
+unsigned vm_ksm_interval = 100;
+
+/* Most pages a process may have resident; a process at its limit
+   replaces its own pages instead of taking free memory, and
+   eviction takes frames of such processes first.  Set by the
+   "-rss" kernel command line option; 0, the default, means no
+   limit. */
+unsigned vm_rss_limit;
+
+/* Processes at VM_RSS_LIMIT.  Protected by FRAME_LOCK. */
+static size_t rss_over_cnt;
+
+/* Working set sampling.  Every VM_WSS_INTERVAL milliseconds the
+   "wss" thread counts, for each process, the resident pages
+   accessed since the last sample, and clears their accessed bits.
+   Set by the "-wss" kernel command line option; 0, the default,
+   disables sampling. */
+unsigned vm_wss_interval;
+static unsigned wss_pass = 1;       /* Current sample, under FRAME_LOCK. */
+
+/* Merge candidates, by checksum of their contents when last
+   scanned, one frame per checksum.  Checksums go stale as pages
+   are written, so a match is only a hint until memcmp() confirms
+   it.  Protected by FRAME_LOCK. */
+struct ksm_frame {
+	struct hash_elem elem;      /* Element in KSM_TABLE. */
+	uint64_t sum;               /* hash_bytes() of the contents. */
+	struct frame *frame;
+};
+static struct hash ksm_table;
+static struct list_elem *ksm_hand;  /* Next frame to scan. */
+static hash_hash_func ksm_hash;
+static hash_less_func ksm_less;
+
+/* Print each process's fault statistics when it exits.  Set by
+   the "-vmstat" kernel command line option. */
+bool vm_stat;
+
+/* User pool watermarks, in pages.  When an allocation leaves
+   fewer than VM_RECLAIM_LOW pages free, the reclaim thread evicts
+   frames until VM_RECLAIM_HIGH are free, so that faults find
+   memory without evicting themselves.  Set by the "-rlow" and
+   "-rhigh" kernel command line options; a low watermark of 0
+   disables the reclaim thread. */
+unsigned vm_reclaim_low = 32;
+unsigned vm_reclaim_high = 64;
+
+/* Reclaim thread state.  RECLAIM_CREDIT counts frames it freed
+   that no fault has taken yet; each one taken is a fault that
+   would otherwise have had to evict. */
+static struct semaphore reclaim_sema;
+static bool reclaim_pending;        /* RECLAIM_SEMA is up or working. */
+static long long reclaimed;         /* Frames freed in the background. */
+static long long reclaim_credit;
+static long long stalls_avoided;    /* Faults served by those frames. */
+static long long direct_reclaims;   /* Faults that had to evict. */
+static void reclaim_thread (void *);
+static void *compact (size_t page_cnt, size_t align);
+static void ksm_thread (void *);
+static void wss_thread (void *);
+static void register_counters (void);
+
+/* Lowest address the stack may grow down to. */
+#define STACK_LIMIT (USER_STACK - (1 << 20))
+
+/* Most pages one stack fault grows the stack by. */
+#define STACK_CHUNK_MAX 32
+
+/* Fault-around window for MADV_SEQUENTIAL, in pages.  Pages further
+   than this behind a sequential fault are dropped. */
+#define SEQ_AROUND 32
+
+/* Faults of every process. */
+static struct vm_fault_stats all_faults;
+
+/* Eviction statistics. */
+static long long evictions;         /* Frames evicted. */
+static long long evict_scans;       /* Frames looked at to find them. */
+static long long clean_evictions;   /* Victims that needed no write. */
+static long long dirty_evictions;   /* Victims that had to be written. */
+static long long cow_shared;        /* Frames shared by fork. */
+static long long cow_copies;        /* Shared frames copied on write. */
+static long long cow_reuses;        /* Write faults on a last sharer. */
+static long long faulted_around;    /* Extra pages they claimed. */
+static long long zero_maps;         /* Read faults given the zero page. */
+static long long zero_copies;       /* Zero-page mappings written. */
+static long long huge_faults;       /* Faults mapped with a 2 MB page. */
+static long long text_hits;         /* Text pages mapped from the cache. */
+static long long cache_shares;      /* File pages mapped from the cache. */
+static long long ksm_scanned;       /* Frames hashed by the scanner. */
+static long long ksm_merged;        /* Pages merged into another frame. */
+static long long ksm_unmerged;      /* Merged frames copied on write. */
+static long long rss_evictions;     /* Victims of processes at limit. */
+static long long stack_growths;     /* Stack faults. */
+static long long stack_prefaulted;  /* Pages they claimed beyond their own. */
+static long long fork_shared;       /* Uninit pages fork left shared. */
+static long long fork_unshared;     /* Shared ones a process touched. */
+static long long populated;         /* Pages read in for MAP_POPULATE. */
+static long long prefetched;        /* ...and for MADV_WILLNEED. */
+static long long dropped;           /* Pages dropped for MADV_DONTNEED. */
+static long long dropped_behind;    /* ...and behind MADV_SEQUENTIAL. */
+static long long compactions;       /* Runs built by moving frames. */
+static long long compact_failures;  /* Attempts that found no run. */
+static long long migrated;          /* Frames moved for them. */
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +208,143 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	page_cache = kmem_cache_create ("vm_page", sizeof (struct page), 0, NULL);
+	frame_cache = kmem_cache_create ("vm_frame", sizeof (struct frame), 0,
+			NULL);
+	if (page_cache == NULL || frame_cache == NULL)
+		PANIC ("vm_init: out of memory");
+	list_init (&frame_table);
+	lock_init (&frame_lock);
+	zero_frame.kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	zero_frame.page = NULL;
+	zero_frame.share_cnt = 1;
+	hash_init (&text_cache, text_hash, text_less, NULL);
+	hash_init (&ksm_table, ksm_hash, ksm_less, NULL);
+	page_cache_init ();
+	vm_oom_init ();
+	vm_shm_init ();
+
+	if (vm_reclaim_low > 0) {
+		size_t pool = palloc_available (PAL_USER);
+
+		/* Never try to keep more than half of the pool free. */
+		if (vm_reclaim_high > pool / 2)
+			vm_reclaim_high = pool / 2;
+		if (vm_reclaim_low > vm_reclaim_high)
+			vm_reclaim_low = vm_reclaim_high;
+		sema_init (&reclaim_sema, 0);
+		if (vm_reclaim_low > 0
+				&& thread_create ("reclaim", PRI_DEFAULT, reclaim_thread,
+					NULL) == TID_ERROR)
+			vm_reclaim_low = 0;
+	}
+	if (vm_ksm_pages > 0
+			&& thread_create ("ksm", PRI_DEFAULT, ksm_thread, NULL) == TID_ERROR)
+		vm_ksm_pages = 0;
+	if (vm_wss_interval > 0
+			&& thread_create ("wss", PRI_DEFAULT, wss_thread, NULL) == TID_ERROR)
+		vm_wss_interval = 0;
+	register_counters ();
+}
+
+/* Reads the frames in use. */
+static long long
+read_frames (void *aux UNUSED) {
+	return frame_cnt;
+}
+
+/* Reads the page faults of every kind, over all processes. */
+static long long
+read_faults (void *aux UNUSED) {
+	long long sum = 0;
+	int kind;
+
+	for (kind = 0; kind < VMF_CNT; kind++)
+		sum += all_faults.cnt[kind];
+	return sum;
+}
+
+/* Registers the VM statistics as counters. */
+static void
+register_counters (void) {
+	counter_register ("vm.frames", read_frames, NULL);
+	counter_register ("vm.faults", read_faults, NULL);
+	counter_register_value ("vm.evictions", &evictions);
+	counter_register_value ("vm.dirty_evictions", &dirty_evictions);
+	counter_register_value ("vm.cow_shared", &cow_shared);
+	counter_register_value ("vm.cow_copies", &cow_copies);
+	counter_register_value ("vm.zero_copies", &zero_copies);
+	counter_register_value ("vm.huge_faults", &huge_faults);
+	counter_register_value ("vm.stack_growths", &stack_growths);
+	counter_register_value ("vm.migrated", &migrated);
+}
+
+/* Prints fault statistics S, labelled with NAME. */
+void
+vm_print_fault_stats (const char *name, const struct vm_fault_stats *s) {
+	static const char *kinds[VMF_CNT] = {
+		"uninit", "swap-in", "file", "stack", "cow", "spurious",
+	};
+
+	printf ("Page faults for %s:", name);
+	for (int k = 0; k < VMF_CNT; k++)
+		printf (" %s %lld (%llu cycles)", kinds[k], s->cnt[k],
+				(unsigned long long) (s->cnt[k] > 0
+					? s->cycles[k] / s->cnt[k] : 0));
+	printf ("\n");
+}
+
+/* Prints the memory use of SPT's process, labelled with NAME. */
+void
+vm_print_mem_stats (const char *name,
+		const struct supplemental_page_table *spt) {
+	printf ("Memory for %s: %zu pages resident (peak %zu)", name,
+			spt->rss, spt->rss_peak);
+	if (vm_wss_interval > 0)
+		printf (", working set %zu pages",
+				spt->wss > spt->ws_seen ? spt->wss : spt->ws_seen);
+	printf ("\n");
+}
+
+/* Prints eviction statistics. */
+void
+vm_print_stats (void) {
+	printf ("Frames: %zu in use, %lld evicted (%lld clean, %lld dirty), "
+			"%lld scanned\n", frame_cnt, evictions,
+			clean_evictions, dirty_evictions, evict_scans);
+	if (vm_rss_limit > 0)
+		printf ("RSS limit: %u pages, %lld victims of processes at it\n",
+				vm_rss_limit, rss_evictions);
+	printf ("COW: %lld pages shared, %lld copied, %lld reused\n",
+			cow_shared, cow_copies, cow_reuses);
+	printf ("Fork: %lld uninit pages shared, %lld copied on access\n",
+			fork_shared, fork_unshared);
+	vm_print_fault_stats ("all processes", &all_faults);
+	printf ("Fault-around: %lld more pages claimed\n", faulted_around);
+	printf ("Advice: %lld pages populated, %lld prefetched, %lld dropped, "
+			"%lld dropped behind\n",
+			populated, prefetched, dropped, dropped_behind);
+	printf ("Stack growth: %lld faults, %lld more pages pre-faulted\n",
+			stack_growths, stack_prefaulted);
+	printf ("Zero page: %lld read mappings, %lld written\n",
+			zero_maps, zero_copies);
+	printf ("Huge pages: %lld faults mapped %lld pages\n",
+			huge_faults, huge_faults * HUGE_PAGES);
+	printf ("Text cache: %lld pages shared, %zu frames cached\n",
+			text_hits, hash_size (&text_cache));
+	printf ("Page cache: %lld pages shared, %zu frames cached\n",
+			cache_shares, page_cache_size ());
+	page_cache_print_stats ();
+	printf ("KSM: %lld frames scanned, %lld pages merged, %lld unmerged\n",
+			ksm_scanned, ksm_merged, ksm_unmerged);
+	zswap_print_stats ();
+	vm_oom_print_stats ();
+	shm_print_stats ();
+	printf ("Reclaim: %lld frames freed in background, %lld direct "
+			"reclaim stalls, %lld avoided\n",
+			reclaimed, direct_reclaims, stalls_avoided);
+	printf ("Compaction: %lld runs built, %lld failed, %lld frames moved\n",
+			compactions, compact_failures, migrated);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,9 +362,87 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
+static radix_action_func spt_kill_page;
+static radix_action_func spt_stop;
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
 static struct frame *vm_evict_frame (void);
+static struct list_elem *clock_next (void);
+static void vm_release_frame (struct page *page, bool unmap);
+static void frame_table_add (struct frame *);
+static void frame_table_remove (struct frame *);
+static struct frame *victim_scan (bool at_limit_only);
+static void frame_free (struct frame *);
+static void share_add (struct frame *, struct page *);
+static void share_remove (struct page *);
+static radix_action_func spt_copy_page;
+static bool claim_with_frame (struct page *, struct frame *);
+static struct frame *frame_get_free (void);
+static bool map_zero_page (struct page *);
+static bool commits (enum vm_type, bool writable);
+static bool map_huge (struct supplemental_page_table *, struct page *);
+static bool huge_candidate (struct supplemental_page_table *, const void *va);
+static void frame_init (struct frame *, void *kva);
+static bool cache_share (struct page *);
+static bool text_share (struct page *);
+static void text_publish (struct page *);
+static void text_forget (struct frame *);
+static void ksm_scan (void);
+static bool ksm_merge (struct frame *, struct frame *);
+static void ksm_forget (struct frame *);
+static bool handle_fault (struct intr_frame *, void *addr, bool user,
+		bool write, bool not_present, enum vm_fault_kind *);
+static void reclaim_check (void);
+static void fault_around (struct supplemental_page_table *,
+		struct page *, vm_initializer *, int advice);
+static bool claim_free (struct page *);
+static void drop_behind (struct supplemental_page_table *, struct page *);
+static void drop_page (struct supplemental_page_table *, struct page *);
+
+/* An uninit page that fork left in several SPTs.  Each SPT keeps
+   a tagged pointer to it in place of a page until it first looks
+   the page up, and only then makes a page of its own. */
+struct uninit_share {
+	vm_initializer *init;       /* As in struct uninit_page. */
+	enum vm_type type;
+	void *aux;                  /* Holds one region reference, if any. */
+	bool writable;
+	unsigned refs;              /* SPTs holding the share. */
+};
+
+static struct page *spt_unshare (struct supplemental_page_table *, void *va);
+static void uninit_share_put (struct uninit_share *);
+
+/* Tags SPT values that are struct uninit_share, not pages. */
+#define SHARE_TAG ((uintptr_t) 1)
+
+static inline bool
+is_share (const void *v) {
+	return ((uintptr_t) v & SHARE_TAG) != 0;
+}
+
+static inline struct uninit_share *
+to_share (void *v) {
+	return (struct uninit_share *) ((uintptr_t) v & ~SHARE_TAG);
+}
+
+typedef bool page_initializer (struct page *, enum vm_type, void *kva);
+
+/* Returns the initializer pages of TYPE turn into on first
+   fault, or NULL for an unknown type. */
+static page_initializer *
+initializer_of (enum vm_type type) {
+	switch (VM_TYPE (type)) {
+		case VM_ANON:
+			return anon_initializer;
+		case VM_FILE:
+			return file_backed_initializer;
+		case VM_SHM:
+			return shm_initializer;
+		default:
+			return NULL;
+	}
+}
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -46,98 +453,1169 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
-	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct supplemental_page_table *spt =
+		&thread_leader (thread_current ())->spt;
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		page_initializer *initializer = initializer_of (type);
+		struct page *page;
+
+		if (initializer == NULL
+				|| (commits (type, writable) && !vm_commit (spt, 1)))
+			goto err;
+		page = kmem_cache_alloc (page_cache);
+		if (page == NULL)
+			goto uncommit;
+		uninit_new (page, pg_round_down (upage), init, type, aux, initializer);
+		page->owner = thread_leader (thread_current ());
+		page->share_next = NULL;
+		page->writable = writable;
 
-		/* TODO: Insert the page into the spt. */
+		if (!spt_insert_page (spt, page)) {
+			kmem_cache_free (page_cache, page);
+			goto uncommit;
+		}
+		return true;
 	}
 err:
 	return false;
+
+uncommit:
+	if (commits (type, writable))
+		vm_uncommit (spt, 1);
+	return false;
 }
 
-/* Find VA from spt and return page. On error, return NULL. */
+/* Returns true if a page of TYPE, writable if WRITABLE, counts
+ * against the commit limit; see oom.c. */
+static bool
+commits (enum vm_type type, bool writable) {
+	return writable && VM_TYPE (type) == VM_ANON;
+}
+
+/* Find VA from spt and return page. On error, return NULL.
+ * Concurrent lookups in one SPT proceed in parallel. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page *page;
+
+	if (!is_user_vaddr (va))
+		return NULL;
+	rwlock_acquire_read (&spt->lock);
+	page = radix_find (&spt->pages, pg_no (va));
+	rwlock_release_read (&spt->lock);
+
+	return is_share (page) ? spt_unshare (spt, va) : page;
+}
+
+/* Gives SPT a page of its own for VA, which holds an uninit page
+ * it shares since fork.  Returns the page, or NULL if out of
+ * memory. */
+static struct page *
+spt_unshare (struct supplemental_page_table *spt, void *va) {
+	struct uninit_share *share;
+	struct page *page;
+	void *v;
 
+	rwlock_acquire_write (&spt->lock);
+	v = radix_find (&spt->pages, pg_no (va));
+	if (!is_share (v)) {
+		/* Another lookup got here first. */
+		rwlock_release_write (&spt->lock);
+		return v;
+	}
+	share = to_share (v);
+	page = kmem_cache_alloc (page_cache);
+	if (page == NULL) {
+		rwlock_release_write (&spt->lock);
+		return NULL;
+	}
+	uninit_new (page, pg_round_down (va), share->init, share->type,
+			share->aux, initializer_of (share->type));
+	page->owner = thread_leader (thread_current ());
+	page->share_next = NULL;
+	page->writable = share->writable;
+	if (VM_HAS_REGION (share->type))
+		mmap_region_get (share->aux);
+	radix_replace (&spt->pages, pg_no (va), page);
+	rwlock_release_write (&spt->lock);
+
+	uninit_share_put (share);
+	__atomic_add_fetch (&fork_unshared, 1, __ATOMIC_RELAXED);
 	return page;
 }
 
+/* Drops an SPT's reference to SHARE, freeing it with the last. */
+static void
+uninit_share_put (struct uninit_share *share) {
+	if (__atomic_sub_fetch (&share->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		if (VM_HAS_REGION (share->type))
+			mmap_region_put (share->aux);
+		free (share);
+	}
+}
+
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt,
+		struct page *page) {
+	bool succ;
+
+	rwlock_acquire_write (&spt->lock);
+	succ = is_user_vaddr (page->va)
+		&& radix_insert (&spt->pages, pg_no (page->va), page);
+	rwlock_release_write (&spt->lock);
 
 	return succ;
 }
 
+/* Returns true if SPT has no page in the LENGTH bytes of user
+ * memory at ADDR, which must be page-aligned.  Walks only the
+ * parts of the page index that exist, not every page. */
+bool
+spt_range_empty (struct supplemental_page_table *spt, const void *addr,
+		size_t length) {
+	bool empty;
+
+	ASSERT (pg_ofs (addr) == 0 && length > 0);
+
+	rwlock_acquire_read (&spt->lock);
+	empty = radix_for_each (&spt->pages, pg_no (addr),
+			pg_no ((const uint8_t *) addr + length - 1), spt_stop, NULL);
+	rwlock_release_read (&spt->lock);
+	return empty;
+}
+
+/* Stops spt_range_empty()'s walk at the first page. */
+static bool
+spt_stop (uint64_t key UNUSED, void *page UNUSED, void *aux UNUSED) {
+	return false;
+}
+
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-	vm_dealloc_page (page);
-	return true;
+	rwlock_acquire_write (&spt->lock);
+	radix_delete (&spt->pages, pg_no (page->va));
+	rwlock_release_write (&spt->lock);
+	if (commits (page_get_type (page), page->writable))
+		vm_uncommit (spt, 1);
+
+	/* Let the page write itself back before its frame goes. */
+	destroy (page);
+	vm_release_frame (page, true);
+	kmem_cache_free (page_cache, page);
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Advances the clock hand and returns the element it passed,
+ * wrapping around the frame table.  The table must not be
+ * empty. */
+static struct list_elem *
+clock_next (void) {
+	struct list_elem *e;
+
+	if (clock_hand == NULL || clock_hand == list_end (&frame_table))
+		clock_hand = list_begin (&frame_table);
+	e = clock_hand;
+	clock_hand = list_next (e);
+	return e;
+}
+
+/* Get the struct frame, that will be evicted.
+ * Second-chance clock: a frame whose page was accessed since the
+ * hand last passed has its accessed bit cleared and is skipped.
+ * Among the rest a clean page is taken at once; a dirty one is
+ * remembered and taken only if no clean page turns up within
+ * CLEAN_SCAN_LIMIT frames.  Two full turns always find a victim,
+ * and the hand stays where it stopped, so the cost of a search is
+ * spread over the faults that follow.  While some process is at
+ * its RSS limit, its frames are searched first, so that it pays
+ * for its own growth.  Called with frame_lock held. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	struct frame *f = NULL;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (rss_over_cnt > 0 && (f = victim_scan (true)) != NULL)
+		rss_evictions++;
+	if (f == NULL)
+		f = victim_scan (false);
+	return f;
+}
+
+/* Returns true if the process of SPT is at the RSS limit. */
+static bool
+at_rss_limit (const struct supplemental_page_table *spt) {
+	return vm_rss_limit > 0 && spt->rss >= vm_rss_limit;
+}
+
+/* Runs the clock for vm_get_victim(), looking only at frames of
+ * processes at their RSS limit if AT_LIMIT_ONLY. */
+static struct frame *
+victim_scan (bool at_limit_only) {
+	struct frame *dirty = NULL;
+	size_t limit = 2 * frame_cnt;
+
+	for (size_t scanned = 0; scanned < limit; scanned++) {
+		struct frame *f = list_entry (clock_next (), struct frame, elem);
+		struct page *page = f->page;
+		uint64_t *pml4 = page->owner->pml4;
+
+		evict_scans++;
+		if (f->share_cnt > 1)
+			continue;
+		/* In the middle of a copy from a cached frame, which may be
+		   this one. */
+		if (f->cache != NULL && page_cache_held ())
+			continue;
+		if (at_limit_only && !at_rss_limit (&page->owner->spt))
+			continue;
+		/* Sequential readers will not be back: no second chance. */
+		if (pml4_is_accessed (pml4, page->va)
+				&& page_advice (page) != MADV_SEQUENTIAL)
+			pml4_set_accessed (pml4, page->va, false);
+		else if (!pml4_is_dirty (pml4, page->va))
+			return f;
+		else if (dirty == NULL)
+			dirty = f;
+
+		if (dirty != NULL && scanned >= CLEAN_SCAN_LIMIT)
+			break;
+	}
+	return dirty;
+}
+
+/* Returns true if PAGE is a resident anonymous page. */
+static bool
+is_anon (const struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_ANON;
+}
 
-	return victim;
+/* Counts DELTA more resident pages for PAGE's process.  Called
+ * with frame_lock held. */
+static void
+rss_add (struct page *page, int delta) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	bool was_at_limit = at_rss_limit (spt);
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	spt->rss += delta;
+	if (spt->rss > spt->rss_peak)
+		spt->rss_peak = spt->rss;
+	if (at_rss_limit (spt) && !was_at_limit)
+		rss_over_cnt++;
+	else if (!at_rss_limit (spt) && was_at_limit)
+		rss_over_cnt--;
+}
+
+/* Enters F, which maps its page, in the frame table.  Called with
+ * frame_lock held. */
+static void
+frame_table_add (struct frame *f) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	list_push_back (&frame_table, &f->elem);
+	frame_cnt++;
+	rss_add (f->page, 1);
+}
+
+/* Takes F out of the frame table.  Called with frame_lock held. */
+static void
+frame_table_remove (struct frame *f) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	rss_add (f->page, -1);
+	if (clock_hand == &f->elem)
+		clock_hand = list_next (clock_hand);
+	if (ksm_hand == &f->elem)
+		ksm_hand = list_next (ksm_hand);
+	list_remove (&f->elem);
+	frame_cnt--;
 }
 
 /* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+ * Return NULL on error.
+ * An anonymous victim brings up to SWAP_CLUSTER - 1 more
+ * anonymous victims with it, so that they reach swap in one
+ * sequential run; the extra frames go back to the user pool for
+ * the faults that follow. */
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	struct frame *victims[SWAP_CLUSTER];
+	struct page *pages[SWAP_CLUSTER];
+	bool dirty[SWAP_CLUSTER];
+	struct cached_page *cache = NULL;
+	size_t cnt = 0, done;
 
-	return NULL;
+	lock_acquire (&frame_lock);
+	while (cnt < SWAP_CLUSTER && frame_cnt > 0) {
+		struct frame *f = vm_get_victim ();
+		if (f == NULL || (cnt > 0 && !is_anon (f->page)))
+			break;
+		frame_table_remove (f);
+		victims[cnt++] = f;
+		if (!is_anon (f->page)) {
+			/* Keep the frame cached, so that read() still finds
+			   what is being written back, but map it into no more
+			   pages. */
+			cache = f->cache;
+			f->cache = NULL;
+			break;
+		}
+	}
+	lock_release (&frame_lock);
+	if (cnt == 0)
+		return NULL;
+
+	for (size_t i = 0; i < cnt; i++) {
+		struct page *page = pages[i] = victims[i]->page;
+		dirty[i] = pml4_is_dirty (page->owner->pml4, page->va);
+		pml4_clear_page (page->owner->pml4, page->va);
+	}
+
+	if (is_anon (pages[0]))
+		done = anon_swap_out_cluster (pages, cnt);
+	else
+		done = swap_out (pages[0]) ? 1 : 0;
+
+	lock_acquire (&frame_lock);
+	for (size_t i = 0; i < cnt; i++) {
+		struct page *page = pages[i];
+
+		if (i >= done) {
+			/* No room in swap: put the page back. */
+			pml4_set_page (page->owner->pml4, page->va, victims[i]->kva,
+					page->writable);
+			if (dirty[i])
+				pml4_set_dirty (page->owner->pml4, page->va, true);
+			frame_table_add (victims[i]);
+			victims[i]->cache = cache;
+			cache = NULL;
+			continue;
+		}
+
+		text_forget (victims[i]);
+		ksm_forget (victims[i]);
+		page->frame = NULL;
+		victims[i]->page = NULL;
+		evictions++;
+		if (dirty[i])
+			dirty_evictions++;
+		else
+			clean_evictions++;
+		if (i > 0) {
+			palloc_free_page (victims[i]->kva);
+			kmem_cache_free (frame_cache, victims[i]);
+		}
+	}
+	lock_release (&frame_lock);
+	if (cache != NULL)
+		page_cache_forget (cache);
+	return done > 0 ? victims[0] : NULL;
+}
+
+/* Returns a new frame from free memory, or a null pointer if there
+ * is none.  Never evicts. */
+static struct frame *
+frame_get_free (void) {
+	struct frame *frame;
+	void *kva = palloc_get_page (PAL_USER);
+
+	if (kva == NULL)
+		return NULL;
+	frame = kmem_cache_alloc (frame_cache);
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		return NULL;
+	}
+	frame_init (frame, kva);
+	return frame;
+}
+
+/* Initializes FRAME to hold user pool page KVA and no page. */
+static void
+frame_init (struct frame *frame, void *kva) {
+	frame->kva = kva;
+	frame->page = NULL;
+	frame->share_cnt = 1;
+	frame->text = NULL;
+	frame->ksm = NULL;
+	frame->cache = NULL;
+	frame->merged = false;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it. That is, if the user pool memory is full, this function
+ * evicts the frame to get the available memory space.  If nothing can be
+ * evicted either, the OOM killer frees memory by killing a process; a null
+ * pointer is returned if even that does not help. */
 static struct frame *
 vm_get_frame (void) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
+	/* A process at its RSS limit replaces a page instead of
+	   growing. */
+	if (at_rss_limit (&thread_leader (thread_current ())->spt)) {
+		frame = vm_evict_frame ();
+		if (frame != NULL)
+			return frame;
+	}
+
+	frame = frame_get_free ();
+	if (frame != NULL && reclaim_credit > 0) {
+		lock_acquire (&frame_lock);
+		if (reclaim_credit > 0) {
+			reclaim_credit--;
+			stalls_avoided++;
+		}
+		lock_release (&frame_lock);
+	}
+	if (frame == NULL) {
+		direct_reclaims++;
+		frame = vm_evict_frame ();
+	}
+	while (frame == NULL && (shm_reclaim () || vm_oom ())) {
+		frame = frame_get_free ();
+		if (frame == NULL)
+			frame = vm_evict_frame ();
+	}
+	reclaim_check ();
+
+	ASSERT (frame == NULL || frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Returns a user pool page for memory that the frame table does
+ * not track, evicting if need be, or a null pointer if there is
+ * none even so. */
+void *
+vm_alloc_user_page (void) {
+	struct frame *frame = vm_get_frame ();
+	void *kva;
+
+	if (frame == NULL)
+		return NULL;
+	kva = frame->kva;
+	kmem_cache_free (frame_cache, frame);
+	return kva;
+}
+
+/* Wakes the reclaim thread if the user pool has dropped below the
+ * low watermark or a multi-page request found no run in it. */
+static void
+reclaim_check (void) {
+	if (vm_reclaim_low == 0 || reclaim_pending
+			|| (palloc_available (PAL_USER) >= vm_reclaim_low
+				&& (palloc_wanted_run == 0 || !vm_compact)))
+		return;
+	reclaim_pending = true;
+	sema_up (&reclaim_sema);
+}
+
+/* Evicts frames in the background whenever woken, until the user
+ * pool is back above the high watermark or nothing more can be
+ * evicted.  Dirty victims are written out here rather than by the
+ * next fault that needs their memory.  Then, if a multi-page
+ * request failed for want of a run, builds one by compaction and
+ * frees it again for the next such request. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+reclaim_thread (void *aux UNUSED) {
+	for (;;) {
+		size_t run;
+
+		sema_down (&reclaim_sema);
+		while (palloc_available (PAL_USER) < vm_reclaim_high) {
+			size_t before = palloc_available (PAL_USER);
+			struct frame *f = vm_evict_frame ();
+			size_t after;
+
+			if (f == NULL)
+				break;
+			frame_free (f);
+
+			/* One eviction may free a whole swap cluster. */
+			after = palloc_available (PAL_USER);
+			lock_acquire (&frame_lock);
+			reclaimed += after > before ? after - before : 1;
+			reclaim_credit += after > before ? after - before : 1;
+			lock_release (&frame_lock);
+		}
+
+		run = palloc_wanted_run;
+		palloc_wanted_run = 0;
+		if (vm_compact && run > 1 && run <= HUGE_PAGES) {
+			size_t align = PGSIZE;
+			void *pages;
+
+			while (align < run * PGSIZE)
+				align *= 2;
+			pages = compact (run, align);
+			if (pages != NULL)
+				palloc_free_multiple (pages, run);
+		}
+		reclaim_pending = false;
+	}
 }
 
-/* Handle the fault on write_protected page */
+/* Returns true if F, in the frame table, may be moved to another
+ * page of memory: it holds a private anonymous page mapped by a
+ * 4 kB PTE, which nothing but that PTE refers to.  Called with
+ * frame_lock held. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+frame_movable (const struct frame *f) {
+	struct page *page = f->page;
+	uint64_t *pte;
+
+	if (f->share_cnt != 1 || f->text != NULL || f->cache != NULL
+			|| !is_anon (page))
+		return false;
+	pte = pml4e_walk (page->owner->pml4, (uint64_t) page->va, 0);
+	return pte != NULL && (*pte & PTE_P) && !(*pte & PTE_PS)
+		&& PTE_ADDR (*pte) == vtop (f->kva);
 }
 
-/* Return true on success */
+/* Moves F's page to a new page of memory outside the PAGE_CNT
+ * pages at BASE, copying it and pointing its PTE at the copy, and
+ * marks F's old page, which is in that range, in OWNED, the pages
+ * of the range compaction holds.  Pages of the range that palloc
+ * hands out meanwhile are kept in OWNED too.  Returns false if no
+ * page could be had.  Called with frame_lock held and futexes
+ * frozen. */
+static bool
+frame_migrate (struct frame *f, uint8_t *base, size_t page_cnt,
+		struct bitmap *owned) {
+	struct page *page = f->page;
+	uint64_t *pml4 = page->owner->pml4;
+	uint8_t *end = base + page_cnt * PGSIZE;
+	enum intr_level old_level;
+	uint8_t *dst;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	while ((dst = palloc_get_page (PAL_USER)) != NULL
+			&& dst >= base && dst < end)
+		bitmap_mark (owned, (dst - base) / PGSIZE);
+	if (dst == NULL)
+		return false;
+
+	/* The owner must not write the page between the copy and the
+	   switch, and only this CPU runs threads. */
+	old_level = intr_disable ();
+	if (frame_movable (f)) {
+		uint64_t *pte = pml4e_walk (pml4, (uint64_t) page->va, 0);
+		bool writable = (*pte & PTE_W) != 0;
+		bool dirty = (*pte & PTE_D) != 0;
+		bool accessed = (*pte & PTE_A) != 0;
+		uint8_t *src = f->kva;
+
+		memcpy (dst, src, PGSIZE);
+		pml4_set_page (pml4, page->va, dst, writable);
+		if (dirty)
+			pml4_set_dirty (pml4, page->va, true);
+		if (accessed)
+			pml4_set_accessed (pml4, page->va, true);
+		futex_rekey (vtop (src), vtop (dst));
+		f->kva = dst;
+		bitmap_mark (owned, (src - base) / PGSIZE);
+		migrated++;
+		dst = NULL;
+	}
+	intr_set_level (old_level);
+	if (dst != NULL)
+		palloc_free_page (dst);
+	return true;
+}
+
+/* Physical memory compaction.  Builds a run of PAGE_CNT free user
+ * pool pages at a physical address aligned to ALIGN, which must
+ * be at least PAGE_CNT pages, and returns it, taken as if from
+ * palloc_get_aligned() but not zeroed.  Of the aligned windows
+ * whose used pages are all movable frames, the one with the fewest
+ * is chosen; its free pages are taken, then its frames are moved
+ * elsewhere.  Returns a null pointer, having moved what it did, if
+ * no window qualifies or memory runs out.  Never evicts. */
+static void *
+compact (size_t page_cnt, size_t align) {
+	uint64_t lo, hi, start;
+	size_t win_cnt, best = SIZE_MAX, best_used = SIZE_MAX, w;
+	uint16_t *movable = NULL;
+	struct bitmap *owned = NULL;
+	struct list_elem *e;
+	uint8_t *base = NULL;
+	bool ok = false;
+
+	ASSERT (page_cnt > 0 && page_cnt <= UINT16_MAX);
+	ASSERT (align >= page_cnt * PGSIZE && (align & (align - 1)) == 0);
+
+	if (!palloc_user_bounds (&lo, &hi))
+		goto done;
+	start = ROUND_UP (lo, align);
+	if (start + page_cnt * PGSIZE > hi)
+		goto done;
+	win_cnt = (hi - start - page_cnt * PGSIZE) / align + 1;
+	movable = calloc (win_cnt, sizeof *movable);
+	owned = bitmap_create (page_cnt);
+	if (movable == NULL || owned == NULL)
+		goto done;
+
+	lock_acquire (&frame_lock);
+	for (e = list_begin (&frame_table); e != list_end (&frame_table);
+			e = list_next (e)) {
+		struct frame *f = list_entry (e, struct frame, elem);
+		uint64_t pa = vtop (f->kva);
+
+		if (pa >= start && (pa - start) % align < page_cnt * PGSIZE
+				&& (pa - start) / align < win_cnt && frame_movable (f))
+			movable[(pa - start) / align]++;
+	}
+	for (w = 0; w < win_cnt && best_used > 0; w++) {
+		size_t used = palloc_used_in (ptov (start + w * align), page_cnt);
+
+		if (used != SIZE_MAX && used == movable[w] && used < best_used) {
+			best = w;
+			best_used = used;
+		}
+	}
+	if (best == SIZE_MAX) {
+		lock_release (&frame_lock);
+		goto done;
+	}
+
+	base = ptov (start + best * align);
+	palloc_claim_free (base, page_cnt, owned);
+	futex_freeze ();
+	for (e = list_begin (&frame_table); e != list_end (&frame_table);
+			e = list_next (e)) {
+		struct frame *f = list_entry (e, struct frame, elem);
+		uint8_t *kva = f->kva;
+
+		if (kva >= base && kva < base + page_cnt * PGSIZE && frame_movable (f)
+				&& !frame_migrate (f, base, page_cnt, owned))
+			break;
+	}
+	futex_thaw ();
+	palloc_claim_free (base, page_cnt, owned);
+	lock_release (&frame_lock);
+	ok = bitmap_all (owned, 0, page_cnt);
+
+done:
+	if (ok)
+		compactions++;
+	else {
+		compact_failures++;
+		for (w = 0; base != NULL && w < page_cnt; w++)
+			if (bitmap_test (owned, w))
+				palloc_free_page (base + w * PGSIZE);
+	}
+	if (owned != NULL)
+		bitmap_destroy (owned);
+	free (movable);
+	return ok ? base : NULL;
+}
+
+/* Growing the stack.  A fault right below the last growth doubles
+ * the extent of this one, up to STACK_CHUNK_MAX pages and never
+ * past STACK_LIMIT, so a stack that keeps going down takes a fault
+ * per chunk rather than per page.  The faulting page is claimed,
+ * the rest of the chunk too as far as free memory allows; what is
+ * left faults in lazily.  Returns false if the faulting page could
+ * not be added. */
+static bool
+vm_stack_growth (void *addr) {
+	struct supplemental_page_table *spt =
+		&thread_leader (thread_current ())->spt;
+	uint8_t *va = pg_round_down (addr);
+
+	if (spt->stack_bottom != NULL
+			&& va == (uint8_t *) spt->stack_bottom - PGSIZE)
+		spt->stack_chunk = spt->stack_chunk * 2 < STACK_CHUNK_MAX
+			? spt->stack_chunk * 2 : STACK_CHUNK_MAX;
+	else
+		spt->stack_chunk = 1;
+
+	if (!vm_alloc_page (VM_ANON | VM_MARKER_0, va, true)
+			|| !vm_claim_page (va))
+		return false;
+	spt->stack_bottom = va;
+	stack_growths++;
+
+	for (unsigned i = 1; i < spt->stack_chunk; i++) {
+		uint8_t *next = va - i * PGSIZE;
+		struct frame *frame;
+
+		if ((uint64_t) next < STACK_LIMIT || spt_find_page (spt, next) != NULL
+				|| !vm_alloc_page (VM_ANON | VM_MARKER_0, next, true))
+			break;
+		spt->stack_bottom = next;
+		frame = frame_get_free ();
+		if (frame != NULL
+				&& claim_with_frame (spt_find_page (spt, next), frame))
+			stack_prefaulted++;
+	}
+	return true;
+}
+
+/* Handle the fault on write_protected page
+ * A writable page is only mapped read-only while its frame is
+ * shared copy-on-write.  The last sharer simply gets its mapping
+ * made writable again; the others get a private copy. */
+static bool
+vm_handle_wp (struct page *page) {
+	struct frame *old = page->frame, *new;
+	bool ok;
+
+	if (old == NULL || !page->writable)
+		return false;
+
+	if (old == &zero_frame) {
+		new = vm_get_frame ();
+		if (new == NULL)
+			return false;
+		memset (new->kva, 0, PGSIZE);
+		new->page = page;
+		page->frame = new;
+		ok = pml4_set_page (page->owner->pml4, page->va, new->kva, true);
+		lock_acquire (&frame_lock);
+		frame_table_add (new);
+		lock_release (&frame_lock);
+		zero_copies++;
+		return ok;
+	}
+
+	/* Map under the lock from here on, so that the merge scanner
+	   cannot free the frame first.  If it moved the page to another
+	   frame meanwhile, the write faults again. */
+	lock_acquire (&frame_lock);
+	if (page->frame != old) {
+		lock_release (&frame_lock);
+		return true;
+	}
+	if (old->share_cnt == 1) {
+		ok = pml4_set_page (page->owner->pml4, page->va, old->kva, true);
+		lock_release (&frame_lock);
+		cow_reuses++;
+		return ok;
+	}
+	lock_release (&frame_lock);
+
+	/* Getting a frame may evict, and meanwhile the other sharers
+	   may go away, so look again before copying. */
+	new = vm_get_frame ();
+	if (new == NULL)
+		return false;
+	lock_acquire (&frame_lock);
+	if (page->frame != old || old->share_cnt == 1) {
+		ok = page->frame != old
+			|| pml4_set_page (page->owner->pml4, page->va, old->kva, true);
+		lock_release (&frame_lock);
+		frame_free (new);
+		return ok;
+	}
+	memcpy (new->kva, old->kva, PGSIZE);
+	share_remove (page);
+	new->page = page;
+	page->frame = new;
+	frame_table_add (new);
+	ok = pml4_set_page (page->owner->pml4, page->va, new->kva, true);
+	if (old->merged)
+		ksm_unmerged++;
+	lock_release (&frame_lock);
+
+	cow_copies++;
+	return ok;
+}
+
+/* Return true on success
+ * Each handled fault is counted, with the cycles spent on it, in
+ * the process's and the global statistics. */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct vm_fault_stats *mine =
+		&thread_leader (thread_current ())->spt.faults;
+	uint64_t start = rdtsc ();
+	enum vm_fault_kind kind = VMF_CNT;
+	bool ok = handle_fault (f, addr, user, write, not_present, &kind);
+
+	if (ok && kind != VMF_CNT) {
+		uint64_t cycles = rdtsc () - start;
+		mine->cnt[kind]++;
+		mine->cycles[kind] += cycles;
+		all_faults.cnt[kind]++;
+		all_faults.cycles[kind] += cycles;
+	}
+	return ok;
+}
+
+/* Does the work of vm_try_handle_fault(), storing the kind of
+ * fault in *KIND. */
+static bool
+handle_fault (struct intr_frame *f, void *addr, bool user, bool write,
+		bool not_present, enum vm_fault_kind *kind) {
+	struct supplemental_page_table *spt =
+		&thread_leader (thread_current ())->spt;
+	struct page *page;
+	int advice;
+
 	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+	page = spt_find_page (spt, addr);
+	if (page == NULL && not_present && user
+			&& (uint8_t *) addr >= (uint8_t *) f->rsp - 8
+			&& (uint64_t) addr >= STACK_LIMIT
+			&& (uint64_t) addr < USER_STACK) {
+		*kind = VMF_STACK;
+		return vm_stack_growth (addr);
+	}
+	if (page == NULL || (write && !page->writable))
+		return false;
+	if (!not_present) {
+		*kind = VMF_COW;
+		return write && vm_handle_wp (page);
+	}
+	if (page->frame != NULL) {
+		/* Mapped by someone else, e.g. fault-around, meanwhile. */
+		*kind = VMF_SPURIOUS;
+		return true;
+	}
 
-	return vm_do_claim_page (page);
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			*kind = VMF_UNINIT;
+			break;
+		case VM_ANON:
+			*kind = VMF_SWAP_IN;
+			break;
+		default:
+			*kind = VMF_FILE;
+			break;
+	}
+	advice = page_advice (page);
+	if (VM_TYPE (page->operations->type) == VM_UNINIT) {
+		vm_initializer *init = page->uninit.init;
+		if (!write && init == NULL
+				&& VM_TYPE (page->uninit.type) == VM_ANON)
+			return map_zero_page (page);
+		if (write && vm_huge && map_huge (spt, page))
+			return true;
+		if (!vm_do_claim_page (page))
+			return false;
+		fault_around (spt, page, init, advice);
+		return true;
+	}
+	if (!vm_do_claim_page (page))
+		return false;
+	if (VM_TYPE (page->operations->type) == VM_FILE)
+		fault_around (spt, page, NULL, advice);
+	return true;
+}
+
+/* Turns PAGE, an uninit anonymous page with no initializer, into
+ * an anonymous page that maps the shared zero page read-only. */
+static bool
+map_zero_page (struct page *page) {
+	if (!page->uninit.page_initializer (page, page->uninit.type, NULL))
+		return false;
+	if (!pml4_set_page (page->owner->pml4, page->va, zero_frame.kva, false))
+		return false;
+	page->frame = &zero_frame;
+	zero_maps++;
+	return true;
+}
+
+/* Maps the 2 MB-aligned range around PAGE, which just took a
+ * write fault, with one 2 MB page, if every page of the range is
+ * a fresh writable anonymous page that is not the stack, and the
+ * user pool has a free aligned run for it.  The pages still get a
+ * frame each, in the frame table, so that they age and swap out
+ * one at a time like other pages; the first of them to be
+ * unmapped, written back, or write-protected splits the mapping.
+ * Never evicts.  Returns true if PAGE is now mapped. */
+static bool
+map_huge (struct supplemental_page_table *spt, struct page *page) {
+	uint8_t *base = (uint8_t *) ((uint64_t) page->va & ~LARGE_PGMASK);
+	uint64_t *pml4 = page->owner->pml4;
+	uint64_t *pde;
+	struct list frames;
+	uint8_t *kva;
+	size_t i;
+	bool ok;
+
+	if (at_rss_limit (spt)
+			|| (vm_rss_limit > 0 && spt->rss + HUGE_PAGES > vm_rss_limit)
+			|| palloc_available (PAL_USER) < HUGE_PAGES)
+		return false;
+	pde = pml4_pde_walk (pml4, (uint64_t) base, 0);
+	if (pde != NULL && (*pde & PTE_P))
+		return false;
+
+	/* The ends of the range are where it usually meets other
+	   memory, so look at them first. */
+	rwlock_acquire_read (&spt->lock);
+	ok = huge_candidate (spt, base)
+		&& huge_candidate (spt, base + LARGE_PGSIZE - PGSIZE);
+	for (i = 1; ok && i < HUGE_PAGES - 1; i++)
+		ok = huge_candidate (spt, base + i * PGSIZE);
+	rwlock_release_read (&spt->lock);
+	if (!ok)
+		return false;
+
+	kva = palloc_get_aligned (PAL_USER | PAL_ZERO, HUGE_PAGES, LARGE_PGSIZE);
+	if (kva == NULL && vm_compact) {
+		palloc_wanted_run = 0;
+		kva = compact (HUGE_PAGES, LARGE_PGSIZE);
+		if (kva != NULL)
+			memset (kva, 0, LARGE_PGSIZE);
+	}
+	if (kva == NULL)
+		return false;
+	list_init (&frames);
+	for (i = 0; i < HUGE_PAGES; i++) {
+		struct frame *f = kmem_cache_alloc (frame_cache);
+
+		if (f == NULL)
+			goto fail;
+		frame_init (f, kva + i * PGSIZE);
+		list_push_back (&frames, &f->elem);
+	}
+
+	/* Getting memory may have slept: look again, then map and
+	   link without sleeping. */
+	rwlock_acquire_read (&spt->lock);
+	for (i = 0; ok && i < HUGE_PAGES; i++)
+		ok = huge_candidate (spt, base + i * PGSIZE);
+	if (!ok || !pml4_set_huge_page (pml4, base, kva, true)) {
+		rwlock_release_read (&spt->lock);
+		goto fail;
+	}
+	for (struct list_elem *e = list_begin (&frames); e != list_end (&frames);
+			e = list_next (e)) {
+		struct frame *f = list_entry (e, struct frame, elem);
+		struct page *p = radix_find (&spt->pages,
+				pg_no (base + ((uint8_t *) f->kva - kva)));
+
+		p->uninit.page_initializer (p, p->uninit.type, f->kva);
+		f->page = p;
+		p->frame = f;
+	}
+	rwlock_release_read (&spt->lock);
+
+	lock_acquire (&frame_lock);
+	while (!list_empty (&frames))
+		frame_table_add (list_entry (list_pop_front (&frames),
+					struct frame, elem));
+	lock_release (&frame_lock);
+	huge_faults++;
+	return true;
+
+fail:
+	while (!list_empty (&frames))
+		kmem_cache_free (frame_cache, list_entry (list_pop_front (&frames),
+					struct frame, elem));
+	palloc_free_multiple (kva, HUGE_PAGES);
+	return false;
+}
+
+/* Returns true if SPT's page at VA is a fresh, writable, plain
+ * anonymous page that is not resident, as map_huge() needs.  A
+ * page still shared with a fork parent or child is not.  SPT's
+ * lock must be held. */
+static bool
+huge_candidate (struct supplemental_page_table *spt, const void *va) {
+	struct page *p = radix_find (&spt->pages, pg_no (va));
+
+	return p != NULL && !is_share (p) && p->frame == NULL && p->writable
+		&& VM_TYPE (p->operations->type) == VM_UNINIT
+		&& p->uninit.init == NULL && p->uninit.type == VM_ANON;
+}
+
+/* Claims up to SPT->around pages following PAGE, which was just
+ * claimed after a not-present fault, so that a sequential scan
+ * does not trap once per page.  Only pages that continue PAGE's
+ * run are taken: pages not yet loaded by the same initializer
+ * INIT, or, if INIT is null, file pages not in memory.  A fault
+ * right after the previous one grows the window up to
+ * vm_fault_around; any other fault closes it, so random access
+ * pays nothing.  ADVICE, PAGE's madvise() advice, overrides that:
+ * MADV_RANDOM reads nothing ahead, and MADV_SEQUENTIAL always
+ * reads SEQ_AROUND pages ahead and drops pages that far behind.
+ * Never evicts. */
+static void
+fault_around (struct supplemental_page_table *spt, struct page *page,
+		vm_initializer *init, int advice) {
+	uint8_t *va = page->va;
+
+	if (advice == MADV_SEQUENTIAL)
+		spt->around = SEQ_AROUND;
+	else if (advice != MADV_RANDOM && spt->last_fault != NULL
+			&& va > (uint8_t *) spt->last_fault
+			&& va <= (uint8_t *) spt->last_fault + (spt->around + 1) * PGSIZE)
+		spt->around = spt->around == 0 ? 1 : spt->around * 2;
+	else
+		spt->around = 0;
+	if (spt->around > vm_fault_around && advice != MADV_SEQUENTIAL)
+		spt->around = vm_fault_around;
+
+	for (unsigned i = 1; i <= spt->around; i++) {
+		struct page *next = spt_find_page (spt, va + i * PGSIZE);
+		enum vm_type type;
+
+		if (next == NULL || next->frame != NULL)
+			break;
+		type = VM_TYPE (next->operations->type);
+		if (init != NULL
+				? type != VM_UNINIT || next->uninit.init != init
+				: type != VM_FILE)
+			break;
+		if (!claim_free (next))
+			break;
+		faulted_around++;
+	}
+	if (advice == MADV_SEQUENTIAL)
+		drop_behind (spt, page);
+
+	/* Faults inside the window just claimed still count as
+	   sequential. */
+	spt->last_fault = va + spt->around * PGSIZE;
+}
+
+/* Claims PAGE, which is not resident, if that takes no eviction.
+ * Returns true if PAGE is now mapped. */
+static bool
+claim_free (struct page *page) {
+	struct frame *frame;
+
+	if (page_get_type (page) == VM_SHM)
+		return shm_claim (page);
+	if (cache_share (page) || text_share (page))
+		return true;
+	frame = frame_get_free ();
+	if (frame == NULL || !claim_with_frame (page, frame))
+		return false;
+	text_publish (page);
+	return true;
+}
+
+/* Drops the clean resident pages of PAGE's region from SEQ_AROUND
+ * to 2 * SEQ_AROUND pages behind PAGE, which a sequential reader
+ * has just faulted on: it is done with them, and keeping them
+ * would only push out memory still in use.  Dirty pages are left
+ * for eviction to write back. */
+static void
+drop_behind (struct supplemental_page_table *spt, struct page *page) {
+	struct mmap_region *r = page_region (page);
+	uint8_t *va = page->va;
+
+	/* Releasing a cached frame waits for copies from it, and this
+	   thread may be in the middle of one. */
+	if (r == NULL || page_cache_held ())
+		return;
+	for (unsigned i = SEQ_AROUND + 1; i <= 2 * SEQ_AROUND; i++) {
+		uint8_t *old = va - i * PGSIZE;
+		struct page *p;
+
+		if ((uint64_t) va < i * PGSIZE || old < (uint8_t *) r->addr)
+			break;
+		p = spt_find_page (spt, old);
+		if (p == NULL || p->frame == NULL || page_region (p) != r
+				|| pml4_is_dirty (p->owner->pml4, old))
+			continue;
+		vm_release_frame (p, true);
+		dropped_behind++;
+	}
+}
+
+/* Reads in the pages of the running process from ADDR for LENGTH
+ * bytes that are not resident, evicting if need be, so that using
+ * them costs no faults.  Stops at the first page that cannot be
+ * read in. */
+void
+vm_populate (void *addr, size_t length) {
+	struct supplemental_page_table *spt =
+		&thread_leader (thread_current ())->spt;
+	uint8_t *end = (uint8_t *) addr + length;
+
+	for (uint8_t *va = pg_round_down (addr); va < end; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+
+		if (page == NULL || page->frame != NULL)
+			continue;
+		if (!vm_do_claim_page (page))
+			break;
+		populated++;
+	}
+}
+
+/* Takes madvise() ADVICE for the running process's pages from
+ * ADDR, page-aligned, for LENGTH bytes.  MADV_WILLNEED reads the
+ * pages in at once, as far as free memory allows, and
+ * MADV_DONTNEED drops them at once.  The others are kept for the
+ * fault and eviction paths, for the whole mmap region of each
+ * file page in the range.  Returns false if ADVICE is unknown or
+ * the range is not user memory. */
+bool
+vm_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt =
+		&thread_leader (thread_current ())->spt;
+	uint8_t *end = (uint8_t *) addr + length;
+
+	if (pg_ofs (addr) != 0 || advice < MADV_NORMAL || advice > MADV_DONTNEED
+			|| !is_user_vaddr (addr) || end < (uint8_t *) addr
+			|| (length > 0 && !is_user_vaddr (end - 1)))
+		return false;
+
+	for (uint8_t *va = addr; va < end; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+		struct mmap_region *r;
+
+		if (page == NULL)
+			continue;
+		switch (advice) {
+			case MADV_WILLNEED:
+				if (page->frame == NULL && claim_free (page))
+					prefetched++;
+				break;
+			case MADV_DONTNEED:
+				drop_page (spt, page);
+				break;
+			default:
+				r = page_region (page);
+				if (r != NULL)
+					r->advice = advice;
+				break;
+		}
+	}
+	return true;
+}
+
+/* Drops PAGE of SPT for MADV_DONTNEED.  A file page goes back to
+ * its file, if dirty, and is read again when next touched; an
+ * anonymous page is thrown away and reads as zeros from then on.
+ * A file page that fails to write back stays. */
+static void
+drop_page (struct supplemental_page_table *spt, struct page *page) {
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_ANON: {
+			void *va = page->va;
+			bool writable = page->writable;
+
+			spt_remove_page (spt, page);
+			if (vm_alloc_page (VM_ANON, va, writable))
+				dropped++;
+			break;
+		}
+		case VM_FILE:
+			if (page->frame == NULL || !swap_out (page))
+				break;
+			vm_release_frame (page, true);
+			dropped++;
+			break;
+		default:
+			break;
+	}
 }
 
 /* Free the page.
@@ -150,41 +1628,733 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_leader (thread_current ())->spt,
+			va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	struct frame *frame;
+
+	if (page_get_type (page) == VM_SHM)
+		return shm_claim (page);
+	if (cache_share (page) || text_share (page))
+		return true;
+	frame = vm_get_frame ();
+	if (frame == NULL || !claim_with_frame (page, frame))
+		return false;
+	text_publish (page);
+	return true;
+}
+
+/* Loads PAGE into FRAME, which holds no page, and maps it.  A
+ * page of a file mapping enters its frame in the page cache, unless
+ * another frame holds its file page already. */
+static bool
+claim_with_frame (struct page *page, struct frame *frame) {
+	struct inode *inode;
+	off_t ofs;
+	bool ok, cached;
 
 	/* Set links */
 	frame->page = page;
 	page->frame = frame;
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		page->frame = NULL;
+		palloc_free_page (frame->kva);
+		kmem_cache_free (frame_cache, frame);
+		return false;
+	}
+	ok = swap_in (page, frame->kva);
+
+	/* Only now may eviction or the merge scanner see the frame. */
+	cached = ok && file_cache_key (page, &inode, &ofs) && page_cache_enter ();
+	lock_acquire (&frame_lock);
+	frame_table_add (frame);
+	if (cached && page_cache_find (inode, ofs) == NULL)
+		frame->cache = page_cache_add (inode, ofs, frame);
+	lock_release (&frame_lock);
+	if (cached)
+		page_cache_exit ();
+
+	return ok;
+}
+
+/* Maps PAGE, which must not be resident, to the user pool page
+ * KVA that already holds its contents, and enters the frame in
+ * the frame table.  Returns false if out of memory. */
+bool
+vm_map_frame (struct page *page, void *kva) {
+	struct frame *frame = kmem_cache_alloc (frame_cache);
+
+	ASSERT (page->frame == NULL);
+
+	if (frame == NULL)
+		return false;
+	if (!pml4_set_page (page->owner->pml4, page->va, kva, page->writable)) {
+		kmem_cache_free (frame_cache, frame);
+		return false;
+	}
+	frame_init (frame, kva);
+	frame->page = page;
+	page->frame = frame;
+
+	lock_acquire (&frame_lock);
+	frame_table_add (frame);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Takes PAGE's frame, if any, out of the frame table and frees
+ * it.  If UNMAP, PAGE's mapping is removed and the frame's memory
+ * freed too; otherwise the memory goes with the pml4 that maps
+ * it. */
+static void
+vm_release_frame (struct page *page, bool unmap) {
+	struct frame *frame = page->frame;
+	struct cached_page *cache;
+
+	if (frame == NULL)
+		return;
+	if (frame == &zero_frame) {
+		pml4_clear_page (page->owner->pml4, page->va);
+		page->frame = NULL;
+		return;
+	}
+	lock_acquire (&frame_lock);
+	if (frame->share_cnt > 1) {
+		/* Others still use the frame: unmap it here, so that
+		   pml4_destroy() leaves the memory alone. */
+		share_remove (page);
+		lock_release (&frame_lock);
+		pml4_clear_page (page->owner->pml4, page->va);
+		page->frame = NULL;
+		return;
+	}
+	frame_table_remove (frame);
+	text_forget (frame);
+	ksm_forget (frame);
+	cache = frame->cache;
+	frame->cache = NULL;
+	lock_release (&frame_lock);
+	if (cache != NULL)
+		page_cache_forget (cache);
+	page->frame = NULL;
+	if (unmap) {
+		pml4_clear_page (page->owner->pml4, page->va);
+		palloc_free_page (frame->kva);
+	}
+	kmem_cache_free (frame_cache, frame);
+}
+
+/* Maps PAGE, a page of a file mapping that is not resident, to
+ * the frame in the page cache that holds its file page, if there
+ * is one.  Returns true if PAGE is now mapped, and also if that
+ * frame is being evicted: PAGE is left unmapped then, and faults
+ * again until the frame is written back and gone from the cache,
+ * after which it reads the file afresh. */
+static bool
+cache_share (struct page *page) {
+	struct cached_page *c;
+	struct inode *inode;
+	struct frame *f;
+	off_t ofs;
+	bool ok = true;
 
-	return swap_in (page, frame->kva);
+	if (!file_cache_key (page, &inode, &ofs) || !page_cache_enter ())
+		return false;
+	c = page_cache_find (inode, ofs);
+	if (c == NULL) {
+		page_cache_exit ();
+		return false;
+	}
+	lock_acquire (&frame_lock);
+	f = page_cache_frame (c);
+	if (f->cache != c)
+		goto done;
+	if (VM_TYPE (page->operations->type) == VM_UNINIT
+			&& !page->uninit.page_initializer (page, page->uninit.type, f->kva)) {
+		ok = false;
+		goto done;
+	}
+	share_add (f, page);
+	ok = pml4_set_page (page->owner->pml4, page->va, f->kva, page->writable);
+	if (!ok) {
+		share_remove (page);
+		page->frame = NULL;
+	} else
+		cache_shares++;
+done:
+	lock_release (&frame_lock);
+	page_cache_exit ();
+	return ok;
+}
+
+/* Maps PAGE, a read-only executable page that is not resident,
+ * to the cached frame that holds its contents, if there is one.
+ * Returns true if PAGE is now mapped. */
+static bool
+text_share (struct page *page) {
+	struct text_frame probe, *t;
+	struct hash_elem *e;
+	bool ok;
+
+	if (!file_text_key (page, &probe.key))
+		return false;
+
+	lock_acquire (&frame_lock);
+	e = hash_find (&text_cache, &probe.elem);
+	if (e == NULL) {
+		lock_release (&frame_lock);
+		return false;
+	}
+	t = hash_entry (e, struct text_frame, elem);
+	if (VM_TYPE (page->operations->type) == VM_UNINIT
+			&& !page->uninit.page_initializer (page, page->uninit.type,
+				t->frame->kva)) {
+		lock_release (&frame_lock);
+		return false;
+	}
+	/* Map under the lock, so the frame cannot be evicted from
+	   under the new mapping. */
+	share_add (t->frame, page);
+	ok = pml4_set_page (page->owner->pml4, page->va, t->frame->kva, false);
+	if (!ok) {
+		share_remove (page);
+		page->frame = NULL;
+	}
+	lock_release (&frame_lock);
+	if (ok)
+		text_hits++;
+	return ok;
+}
+
+/* Enters PAGE's frame, just loaded, in the text cache if PAGE is
+ * a read-only executable page. */
+static void
+text_publish (struct page *page) {
+	struct text_frame *t = malloc (sizeof *t);
+
+	if (t == NULL)
+		return;
+	if (file_text_key (page, &t->key)) {
+		lock_acquire (&frame_lock);
+		t->frame = page->frame;
+		if (t->frame != NULL && t->frame->text == NULL
+				&& hash_insert (&text_cache, &t->elem) == NULL) {
+			t->frame->text = t;
+			t = NULL;
+		}
+		lock_release (&frame_lock);
+	}
+	free (t);
+}
+
+/* Takes F out of the text cache, as its last page lets go of
+ * it. */
+static void
+text_forget (struct frame *f) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (f->text != NULL) {
+		hash_delete (&text_cache, &f->text->elem);
+		free (f->text);
+		f->text = NULL;
+	}
+}
+
+/* Returns a hash of text cache entry E's key. */
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct text_key *k = &hash_entry (e, struct text_frame, elem)->key;
+
+	return hash_ptr (k->inode) ^ hash_u64 ((uint64_t) k->ofs << 32 | k->bytes);
+}
+
+/* Orders text cache entries A and B by key. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_key *a = &hash_entry (a_, struct text_frame, elem)->key;
+	const struct text_key *b = &hash_entry (b_, struct text_frame, elem)->key;
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->bytes < b->bytes;
+}
+
+/* Scans batches of frames for merging, sleeping between them so
+ * that the scanner takes little of the machine. */
+static void
+ksm_thread (void *aux UNUSED) {
+	for (;;) {
+		timer_msleep (vm_ksm_interval);
+		ksm_scan ();
+	}
+}
+
+/* Counts PAGE toward its process's working set if it was
+ * accessed since the last sample, and clears its accessed bit for
+ * the next. */
+static void
+wss_sample (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (spt->ws_pass != wss_pass) {
+		spt->wss = spt->ws_pass == wss_pass - 1 ? spt->ws_seen : 0;
+		spt->ws_seen = 0;
+		spt->ws_pass = wss_pass;
+	}
+	if (pml4_is_accessed (pml4, page->va)) {
+		spt->ws_seen++;
+		pml4_set_accessed (pml4, page->va, false);
+	}
+}
+
+/* Samples the working sets of all processes every
+ * vm_wss_interval milliseconds.  The accessed bits it clears also
+ * serve the clock, which then sees one sample's worth of use. */
+static void
+wss_thread (void *aux UNUSED) {
+	for (;;) {
+		struct list_elem *e;
+
+		timer_msleep (vm_wss_interval);
+		lock_acquire (&frame_lock);
+		wss_pass++;
+		for (e = list_begin (&frame_table); e != list_end (&frame_table);
+				e = list_next (e)) {
+			struct frame *f = list_entry (e, struct frame, elem);
+			struct page *page = f->page;
+
+			do {
+				wss_sample (page);
+				page = page->share_next;
+			} while (page != NULL && page != f->page);
+		}
+		lock_release (&frame_lock);
+	}
+}
+
+/* Sets whether user code may write to PAGE, which is mapped. */
+static void
+set_writable (struct page *page, bool writable) {
+	struct mmu_gather g;
+
+	mmu_gather_init (&g, page->owner->pml4);
+	pml4_set_writable_gather (&g, page->va, writable);
+	mmu_gather_flush (&g);
+}
+
+/* Hashes the next VM_KSM_PAGES frames past KSM_HAND.  A private
+ * anonymous frame whose checksum matches another candidate's is
+ * merged into it; otherwise it becomes the candidate for its
+ * checksum. */
+static void
+ksm_scan (void) {
+	lock_acquire (&frame_lock);
+	for (unsigned i = 0; i < vm_ksm_pages && frame_cnt > 0; i++) {
+		struct ksm_frame probe, *k;
+		struct hash_elem *e;
+		struct frame *f;
+
+		if (ksm_hand == NULL || ksm_hand == list_end (&frame_table))
+			ksm_hand = list_begin (&frame_table);
+		f = list_entry (ksm_hand, struct frame, elem);
+		ksm_hand = list_next (ksm_hand);
+		if (f->share_cnt > 1 || !is_anon (f->page))
+			continue;
+
+		ksm_scanned++;
+		probe.sum = hash_bytes (f->kva, PGSIZE);
+		if (f->ksm != NULL && f->ksm->sum == probe.sum)
+			continue;
+		ksm_forget (f);
+
+		e = hash_find (&ksm_table, &probe.elem);
+		if (e != NULL) {
+			k = hash_entry (e, struct ksm_frame, elem);
+			if (ksm_merge (f, k->frame))
+				continue;
+			/* The candidate changed since it was hashed. */
+			ksm_forget (k->frame);
+		}
+		k = malloc (sizeof *k);
+		if (k != NULL) {
+			k->sum = probe.sum;
+			k->frame = f;
+			hash_insert (&ksm_table, &k->elem);
+			f->ksm = k;
+		}
+	}
+	lock_release (&frame_lock);
+}
+
+/* Merges private anonymous frame F into frame INTO if their
+ * contents are equal: F's page maps INTO copy-on-write and F is
+ * freed.  Both are write-protected first, so that the contents
+ * cannot change between the comparison and the merge. */
+static bool
+ksm_merge (struct frame *f, struct frame *into) {
+	struct page *page = f->page;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (f->share_cnt == 1 && f != into);
+
+	if (!is_anon (into->page))
+		return false;
+	if (into->share_cnt == 1)
+		set_writable (into->page, false);
+	set_writable (page, false);
+	if (memcmp (f->kva, into->kva, PGSIZE) != 0) {
+		if (into->share_cnt == 1 && into->page->writable)
+			set_writable (into->page, true);
+		if (page->writable)
+			set_writable (page, true);
+		return false;
+	}
+
+	ksm_forget (f);
+	text_forget (f);
+	frame_table_remove (f);
+	share_add (into, page);
+	pml4_set_page (page->owner->pml4, page->va, into->kva, false);
+	into->merged = true;
+	frame_free (f);
+	ksm_merged++;
+	return true;
+}
+
+/* Takes F out of the merge candidates. */
+static void
+ksm_forget (struct frame *f) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (f->ksm != NULL) {
+		hash_delete (&ksm_table, &f->ksm->elem);
+		free (f->ksm);
+		f->ksm = NULL;
+	}
+}
+
+/* Returns the hash of merge candidate E, its checksum. */
+static uint64_t
+ksm_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct ksm_frame, elem)->sum;
+}
+
+/* Orders merge candidates A and B by checksum. */
+static bool
+ksm_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct ksm_frame, elem)->sum
+		< hash_entry (b, struct ksm_frame, elem)->sum;
+}
+
+/* Frees F, which is in no frame table and maps no page, and its
+ * memory. */
+static void
+frame_free (struct frame *f) {
+	palloc_free_page (f->kva);
+	kmem_cache_free (frame_cache, f);
+}
+
+/* Makes PAGE another user of F.  The pages that share a frame are
+ * kept on a ring through share_next; F->page is any one of them.
+ * Called with frame_lock held. */
+static void
+share_add (struct frame *f, struct page *page) {
+	struct page *first = f->page;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	if (first->share_next == NULL)
+		first->share_next = first;
+	page->share_next = first->share_next;
+	first->share_next = page;
+	page->frame = f;
+	f->share_cnt++;
+	rss_add (page, 1);
+}
+
+/* Takes PAGE off the ring of pages sharing its frame, which must
+ * have other users.  Called with frame_lock held. */
+static void
+share_remove (struct page *page) {
+	struct frame *f = page->frame;
+	struct page *prev = page;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (f->share_cnt > 1);
+
+	while (prev->share_next != page)
+		prev = prev->share_next;
+	prev->share_next = page->share_next;
+	if (f->page == page)
+		f->page = page->share_next;
+	if (--f->share_cnt == 1)
+		f->page->share_next = NULL;
+	page->share_next = NULL;
+	rss_add (page, -1);
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	radix_init (&spt->pages);
+	itree_init (&spt->mappings);
+	rwlock_init (&spt->lock);
+	spt->last_fault = NULL;
+	spt->around = 0;
+	spt->stack_bottom = NULL;
+	spt->stack_chunk = 0;
+	memset (&spt->faults, 0, sizeof spt->faults);
+	spt->rss = spt->rss_peak = 0;
+	spt->wss = spt->ws_seen = 0;
+	spt->ws_pass = 0;
+	spt->committed = 0;
+	spt->oom_score_adj = 0;
 }
 
-/* Copy supplemental page table from src to dst */
+/* State for copying one SPT into another with spt_copy_page(). */
+struct spt_copy {
+	struct supplemental_page_table *src, *dst;
+	struct mmu_gather gather;   /* Write-protections in the source. */
+};
+
+/* Copy supplemental page table from src to dst
+ * Runs in the child, which owns DST.  Pages not yet loaded are
+ * not copied: both SPTs point at one struct uninit_share, and
+ * each makes its own page on first lookup, so initializers must
+ * not free AUX.  Swapped-out pages are read
+ * back into private frames.  Resident pages share their frame
+ * copy-on-write if vm_cow is set, with both mappings read-only
+ * until the first write; otherwise they are copied. */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct spt_copy copy;
+	bool ok;
+
+	dst->oom_score_adj = src->oom_score_adj;
+	copy.src = src;
+	copy.dst = dst;
+	copy.gather.pml4 = NULL;
+	/* Writing, since uninit pages in SRC become shares. */
+	rwlock_acquire_write (&src->lock);
+	ok = radix_for_each (&src->pages, 0, RADIX_KEY_MAX, spt_copy_page, &copy);
+	if (copy.gather.pml4 != NULL)
+		mmu_gather_flush (&copy.gather);
+	rwlock_release_write (&src->lock);
+	return ok && mmap_mappings_copy (dst, src);
+}
+
+/* Copies SRC, a page of the parent at page number KEY, into the
+ * SPT in COPY_, a struct spt_copy. */
+static bool
+spt_copy_page (uint64_t key, void *src_, void *copy_) {
+	struct page *src = src_, *dst;
+	struct spt_copy *copy = copy_;
+	struct frame *frame;
+
+	if (is_share (src_) || VM_TYPE (src->operations->type) == VM_UNINIT) {
+		struct uninit_share *share;
+		bool ok;
+
+		if (is_share (src_))
+			share = to_share (src_);
+		else {
+			/* The share takes over SRC's region reference. */
+			share = malloc (sizeof *share);
+			if (share == NULL)
+				return false;
+			share->init = src->uninit.init;
+			share->type = src->uninit.type;
+			share->aux = src->uninit.aux;
+			share->writable = src->writable;
+			share->refs = 1;
+			radix_replace (&copy->src->pages, key,
+					(void *) ((uintptr_t) share | SHARE_TAG));
+			kmem_cache_free (page_cache, src);
+		}
+		__atomic_add_fetch (&share->refs, 1, __ATOMIC_RELAXED);
+
+		if (commits (share->type, share->writable)
+				&& !vm_commit (copy->dst, 1)) {
+			uninit_share_put (share);
+			return false;
+		}
+		rwlock_acquire_write (&copy->dst->lock);
+		ok = radix_insert (&copy->dst->pages, key,
+				(void *) ((uintptr_t) share | SHARE_TAG));
+		rwlock_release_write (&copy->dst->lock);
+		if (!ok) {
+			if (commits (share->type, share->writable))
+				vm_uncommit (copy->dst, 1);
+			uninit_share_put (share);
+			return false;
+		}
+		fork_shared++;
+		return true;
+	}
+
+	dst = kmem_cache_alloc (page_cache);
+	if (dst == NULL)
+		return false;
+	*dst = *src;
+	dst->owner = thread_current ();
+	dst->frame = NULL;
+	dst->share_next = NULL;
+	if (VM_TYPE (src->operations->type) == VM_ANON) {
+		dst->anon.slot = SWAP_SLOT_NONE;
+		dst->anon.zswap = NULL;
+	}
+
+	if (VM_TYPE (src->operations->type) == VM_SHM) {
+		/* The child maps the segment's frames on its own faults. */
+		shm_page_dup (dst);
+		goto insert;
+	} else if (src->frame == &zero_frame) {
+		dst->frame = &zero_frame;
+		if (!pml4_set_page (dst->owner->pml4, dst->va, zero_frame.kva, false)) {
+			kmem_cache_free (page_cache, dst);
+			return false;
+		}
+		goto insert;
+	} else if (src->frame == NULL) {
+		/* Not resident: an anonymous page must come back from
+		   swap now, since its slot is not shared. */
+		if (VM_TYPE (src->operations->type) == VM_ANON
+				&& anon_is_swapped (src)) {
+			frame = vm_get_frame ();
+			if (frame == NULL)
+				goto fail;
+			anon_read_swapped (src, frame->kva);
+			goto private;
+		}
+	} else if (vm_cow) {
+		lock_acquire (&frame_lock);
+		frame = src->frame;
+		if (frame != NULL && frame->cache != NULL) {
+			/* Mappings of a file page share its cached frame, the
+			   child's too, with no copy on write. */
+			share_add (frame, dst);
+			lock_release (&frame_lock);
+			if (!pml4_set_page (dst->owner->pml4, dst->va, frame->kva,
+						dst->writable))
+				goto fail;
+			cache_shares++;
+			goto insert;
+		}
+		if (frame != NULL) {
+			share_add (frame, dst);
+			lock_release (&frame_lock);
+			if (copy->gather.pml4 == NULL)
+				mmu_gather_init (&copy->gather, src->owner->pml4);
+			if (src->writable)
+				pml4_set_writable_gather (&copy->gather, src->va, false);
+			if (!pml4_set_page (dst->owner->pml4, dst->va, frame->kva, false))
+				goto fail;
+			cow_shared++;
+			goto insert;
+		}
+		lock_release (&frame_lock);
+		/* Evicted meanwhile: copy from swap or the file below. */
+		frame = vm_get_frame ();
+		if (frame == NULL)
+			goto fail;
+		if (VM_TYPE (src->operations->type) == VM_ANON
+				&& anon_is_swapped (src))
+			anon_read_swapped (src, frame->kva);
+		else if (VM_TYPE (src->operations->type) == VM_FILE)
+			swap_in (src, frame->kva);
+		goto private;
+	} else {
+		frame = vm_get_frame ();
+		if (frame == NULL)
+			goto fail;
+		memcpy (frame->kva, src->frame->kva, PGSIZE);
+		goto private;
+	}
+	goto insert;
+
+private:
+	frame->page = dst;
+	dst->frame = frame;
+	if (!pml4_set_page (dst->owner->pml4, dst->va, frame->kva, dst->writable))
+		goto fail;
+	lock_acquire (&frame_lock);
+	frame_table_add (frame);
+	lock_release (&frame_lock);
+
+insert:
+	if (commits (page_get_type (dst), dst->writable)
+			&& !vm_commit (copy->dst, 1))
+		goto release;
+	if (spt_insert_page (copy->dst, dst)) {
+		if (VM_TYPE (dst->operations->type) == VM_FILE)
+			mmap_region_get (dst->file.region);
+		return true;
+	}
+	if (commits (page_get_type (dst), dst->writable))
+		vm_uncommit (copy->dst, 1);
+release:
+	if (VM_TYPE (dst->operations->type) == VM_SHM)
+		destroy (dst);
+	vm_release_frame (dst, false);
+	kmem_cache_free (page_cache, dst);
+	return false;
+
+fail:
+	if (dst->frame != NULL) {
+		lock_acquire (&frame_lock);
+		if (dst->frame->share_cnt > 1) {
+			share_remove (dst);
+			lock_release (&frame_lock);
+		} else {
+			lock_release (&frame_lock);
+			frame_free (dst->frame);
+		}
+	}
+	kmem_cache_free (page_cache, dst);
+	return false;
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	rwlock_acquire_write (&spt->lock);
+	radix_destroy (&spt->pages, spt_kill_page, NULL);
+	rwlock_release_write (&spt->lock);
+	vm_uncommit (spt, spt->committed);
+	mmap_mappings_destroy (spt);
+}
+
+/* Frees PAGE, a value in an SPT being destroyed. */
+static bool
+spt_kill_page (uint64_t key UNUSED, void *page_, void *aux UNUSED) {
+	struct page *page = page_;
+
+	if (is_share (page_)) {
+		uninit_share_put (to_share (page_));
+		return true;
+	}
+
+	/* As vm_dealloc_page(), but the page writes itself back
+	   before its frame goes. */
+	destroy (page);
+	vm_release_frame (page, false);
+	kmem_cache_free (page_cache, page);
+	return true;
 }
@@ -0,0 +1,199 @@
+/* zswap.c: Compressed in-memory swap, tried before the swap disk.
+ *
+ * Pages are compressed with a small LZ77 coder into blocks from
+ * the kernel heap, up to vm_zswap_pages pages' worth in total.  A
+ * page that does not shrink to ZSWAP_MAX_LEN bytes, or does not
+ * fit in the pool, goes to the swap disk instead.
+ *
+ * The compressed stream is a sequence of tokens.  A control byte
+ * C below 0x80 is followed by C + 1 literal bytes.  Otherwise it
+ * is a match of (C & 0x7f) + MIN_MATCH bytes copied from a
+ * distance given by the two little-endian bytes that follow; a
+ * match may overlap the bytes it produces, which encodes runs. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+#define MIN_MATCH 4
+#define MAX_MATCH (MIN_MATCH + 0x7f)
+#define MAX_LITERALS 0x80
+#define HASH_BITS 10
+
+/* Largest compressed page worth keeping in memory. */
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+struct zswap_entry {
+	size_t len;                 /* Bytes in DATA. */
+	uint8_t data[];             /* Compressed page. */
+};
+
+/* Most pages' worth of memory the compressed pool may use.  Set by
+   the "-zswap" kernel command line option; 0 disables it. */
+size_t vm_zswap_pages = 256;
+
+/* Protects the scratch buffers and the pool size.  The buffers are
+   static since they do not fit on a kernel stack. */
+static struct lock zswap_lock;
+static uint16_t match_table[1 << HASH_BITS];
+static uint8_t out_buf[ZSWAP_MAX_LEN];
+static size_t pool_bytes;           /* Bytes used by stored pages. */
+
+/* Statistics. */
+static long long stores;            /* Pages stored. */
+static long long loads;             /* Pages loaded back. */
+static long long rejects;           /* Pages that did not compress. */
+static long long spills;            /* Pages turned away by a full pool. */
+static long long stored_cnt;        /* Pages in the pool now. */
+
+static size_t compress (const uint8_t *src, uint8_t *dst, size_t max);
+static bool put_literals (const uint8_t *src, size_t cnt,
+		uint8_t *dst, size_t *op, size_t max);
+
+/* Initializes the compressed pool. */
+void
+zswap_init (void) {
+	lock_init (&zswap_lock);
+}
+
+/* Compresses the page at KVA into the pool.  Returns the entry that
+ * holds it, or a null pointer if the page does not compress well
+ * enough or the pool is full, in which case it belongs on the swap
+ * disk. */
+struct zswap_entry *
+zswap_store (const void *kva) {
+	struct zswap_entry *e = NULL;
+	size_t len;
+
+	if (vm_zswap_pages == 0)
+		return NULL;
+
+	lock_acquire (&zswap_lock);
+	len = compress (kva, out_buf, sizeof out_buf);
+	if (len == 0)
+		rejects++;
+	else if (pool_bytes + len > vm_zswap_pages * PGSIZE)
+		spills++;
+	else if ((e = malloc (sizeof *e + len)) != NULL) {
+		e->len = len;
+		memcpy (e->data, out_buf, len);
+		pool_bytes += len;
+		stored_cnt++;
+		stores++;
+	}
+	lock_release (&zswap_lock);
+	return e;
+}
+
+/* Decompresses E into the page at KVA.  E stays stored. */
+void
+zswap_load (const struct zswap_entry *e, void *kva) {
+	const uint8_t *src = e->data;
+	uint8_t *dst = kva;
+	size_t ip = 0, op = 0;
+
+	while (ip < e->len) {
+		uint8_t c = src[ip++];
+
+		if (c < 0x80) {
+			size_t cnt = c + 1;
+
+			ASSERT (op + cnt <= PGSIZE);
+			memcpy (dst + op, src + ip, cnt);
+			ip += cnt;
+			op += cnt;
+		} else {
+			size_t cnt = (c & 0x7f) + MIN_MATCH;
+			size_t dist = src[ip] | (src[ip + 1] << 8);
+
+			ip += 2;
+			ASSERT (dist > 0 && dist <= op && op + cnt <= PGSIZE);
+			for (; cnt > 0; cnt--, op++)
+				dst[op] = dst[op - dist];
+		}
+	}
+	ASSERT (op == PGSIZE);
+	loads++;
+}
+
+/* Releases E. */
+void
+zswap_free (struct zswap_entry *e) {
+	lock_acquire (&zswap_lock);
+	pool_bytes -= e->len;
+	stored_cnt--;
+	lock_release (&zswap_lock);
+	free (e);
+}
+
+/* Compresses the page at SRC into DST, of MAX bytes.  Returns the
+ * compressed length, or 0 if it would exceed MAX. */
+static size_t
+compress (const uint8_t *src, uint8_t *dst, size_t max) {
+	size_t ip = 0, op = 0, lit = 0;
+
+	memset (match_table, 0, sizeof match_table);
+	while (ip + MIN_MATCH <= PGSIZE) {
+		uint32_t seq, h;
+		size_t cand, len;
+
+		memcpy (&seq, src + ip, sizeof seq);
+		h = (seq * 2654435761u) >> (32 - HASH_BITS);
+		cand = match_table[h];
+		match_table[h] = ip + 1;
+		if (cand == 0 || memcmp (src + cand - 1, src + ip, MIN_MATCH)) {
+			ip++;
+			continue;
+		}
+
+		cand--;
+		for (len = MIN_MATCH; ip + len < PGSIZE && len < MAX_MATCH
+				&& src[cand + len] == src[ip + len]; len++)
+			continue;
+		if (!put_literals (src + lit, ip - lit, dst, &op, max)
+				|| op + 3 > max)
+			return 0;
+		dst[op++] = 0x80 | (len - MIN_MATCH);
+		dst[op++] = (ip - cand) & 0xff;
+		dst[op++] = (ip - cand) >> 8;
+		ip += len;
+		lit = ip;
+	}
+	if (!put_literals (src + lit, PGSIZE - lit, dst, &op, max))
+		return 0;
+	return op;
+}
+
+/* Appends the CNT bytes at SRC to DST, of MAX bytes, as literal
+ * tokens at *OP.  Returns false if they do not fit. */
+static bool
+put_literals (const uint8_t *src, size_t cnt, uint8_t *dst, size_t *op,
+		size_t max) {
+	while (cnt > 0) {
+		size_t n = cnt < MAX_LITERALS ? cnt : MAX_LITERALS;
+
+		if (*op + 1 + n > max)
+			return false;
+		dst[(*op)++] = n - 1;
+		memcpy (dst + *op, src, n);
+		*op += n;
+		src += n;
+		cnt -= n;
+	}
+	return true;
+}
+
+/* Prints compressed pool statistics. */
+void
+zswap_print_stats (void) {
+	if (vm_zswap_pages == 0)
+		return;
+	printf ("Zswap: %lld pages stored, %lld loaded, %lld incompressible, "
+			"%lld spilled; %lld pages in %zu bytes\n",
+			stores, loads, rejects, spills, stored_cnt, pool_bytes);
+}